@@ -0,0 +1,169 @@
+#include "benchmarks.h"
+#include "asset_cooker.h"
+#include "gltf_loader.h"
+#include "job_system.h"
+#include "package_loader.h"
+#include "renderer.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            struct LoadRun
+            {
+                double parseMs = 0.0;
+                double firstFrameMs = -1.0;
+                double residentMs = 0.0;
+            };
+
+            // Loads `path` once through `loader` while rendering, like the gltf
+            // benchmark, then unloads it. GltfLoader and PackageLoader share
+            // their interface, so both go through here.
+            template<typename Loader>
+            LoadRun loadOnce(Renderer& renderer, Loader& loader, const std::string& path, double timeoutMs, uint64_t& gpuBytes)
+            {
+                LoadRun run;
+                Timer timer;
+                auto asset = loader.load(path);
+                while (timer.elapsedMs() < timeoutMs) {
+                    renderer.renderFrame();
+                    if (run.firstFrameMs < 0.0 && asset->isDrawable()) {
+                        run.firstFrameMs = timer.elapsedMs();
+                    }
+                    AssetState state = asset->getState();
+                    if (state == AssetState::eResident || state == AssetState::eFailed) {
+                        break;
+                    }
+                }
+                renderer.waitIdle();
+                renderer.takeCompletedTimings();
+
+                AssetState state = asset->getState();
+                if (state == AssetState::eFailed) {
+                    throw std::runtime_error("Loading " + path + " failed: " + asset->getError());
+                }
+                if (state != AssetState::eResident) {
+                    throw std::runtime_error("Loading " + path + " timed out");
+                }
+
+                auto stats = asset->getStats();
+                run.parseMs = stats.parsedMs;
+                run.residentMs = stats.residentMs;
+                gpuBytes = stats.geometryBytes;
+                loader.unload(asset);
+                renderer.waitIdle();
+                return run;
+            }
+
+            // Returns the median time to resident.
+            double writeRuns(JsonWriter& json, const char* name, const std::vector<LoadRun>& runs, uint64_t gpuBytes)
+            {
+                std::vector<double> parse;
+                std::vector<double> firstFrame;
+                std::vector<double> resident;
+                for (const LoadRun& run : runs) {
+                    parse.push_back(run.parseMs);
+                    firstFrame.push_back(run.firstFrameMs);
+                    resident.push_back(run.residentMs);
+                }
+
+                json.key(name);
+                json.beginObject();
+                json.field("geometry_mb", double(gpuBytes) / double(1 << 20));
+                writeStats(json, "parse_ms", computeStats(parse));
+                writeStats(json, "time_to_first_frame_ms", computeStats(firstFrame));
+                SampleStats residentStats = computeStats(resident);
+                writeStats(json, "time_to_resident_ms", residentStats);
+                json.endObject();
+                return residentStats.p50;
+            }
+        }
+
+        int runAssetPackage(const BenchArgs& args)
+        {
+            const double timeoutMs = double(std::max(args.getInt("timeout-ms", 60000), 1));
+            const uint32_t runs = uint32_t(std::max(args.getInt("runs", 3), 1));
+
+            std::string path = args.getString("file", "");
+            const bool generated = path.empty();
+            if (generated) {
+                path = "bvr_bench_package.glb";
+                writeSyntheticGlb(path, uint64_t(std::max(args.getInt("generate-mb", 64), 1)) << 20);
+            }
+            std::string packagePath = args.getString("package", "");
+            const bool temporaryPackage = packagePath.empty();
+            if (temporaryPackage) {
+                packagePath = "bvr_bench_package.bvrpkg";
+            }
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720);
+
+            // Cook for what the device can sample, so both loaders upload every
+            // texture and the comparison stays fair.
+            CookOptions options{};
+            options.compressTextures = renderer->isTextureCompressionBcSupported() && !args.has("uncompressed");
+            CookStats cook;
+            {
+                JobSystem jobs{ uint32_t(std::max(args.getInt("cook-threads", 0), 0)) };
+                cook = cookGltf(path, packagePath, options, jobs);
+            }
+
+            // Alternate the two so the page cache treats them the same.
+            std::vector<LoadRun> gltfRuns;
+            std::vector<LoadRun> packageRuns;
+            uint64_t gltfGeometryBytes = 0;
+            uint64_t packageGeometryBytes = 0;
+            {
+                GltfLoader gltfLoader{ *renderer, uint32_t(std::max(args.getInt("decode-threads", 0), 0)) };
+                PackageLoader packageLoader{ *renderer };
+                for (uint32_t run = 0; run < runs; ++run) {
+                    gltfRuns.push_back(loadOnce(*renderer, gltfLoader, path, timeoutMs, gltfGeometryBytes));
+                    packageRuns.push_back(loadOnce(*renderer, packageLoader, packagePath, timeoutMs, packageGeometryBytes));
+                }
+            }
+            renderer->waitIdle();
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "package");
+            json.field("file", path);
+            json.field("source_mb", double(cook.sourceBytes) / double(1 << 20));
+            json.field("package_mb", double(cook.packageBytes) / double(1 << 20));
+            json.field("compressed_textures", options.compressTextures);
+            json.field("runs", runs);
+
+            json.key("cook");
+            json.beginObject();
+            json.field("parse_ms", cook.parseMs);
+            json.field("process_ms", cook.processMs);
+            json.field("write_ms", cook.writeMs);
+            json.field("geometry_mb", double(cook.geometryBytes) / double(1 << 20));
+            json.field("texture_mb", double(cook.textureBytes) / double(1 << 20));
+            json.field("primitives", cook.primitives);
+            json.field("meshlets", cook.meshlets);
+            json.field("textures", cook.textures);
+            json.field("textures_failed", cook.texturesFailed);
+            json.endObject();
+
+            double gltfResident = writeRuns(json, "gltf", gltfRuns, gltfGeometryBytes);
+            double packageResident = writeRuns(json, "package", packageRuns, packageGeometryBytes);
+            json.field("resident_speedup", packageResident > 0.0 ? gltfResident / packageResident : 0.0);
+            json.endObject();
+
+            if (temporaryPackage) {
+                std::remove(packagePath.c_str());
+            }
+            if (generated) {
+                std::remove(path.c_str());
+            }
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "json_writer.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace bvr
+{
+    namespace bench
+    {
+        // `--key value` pairs and bare `--flag`s, everything after the benchmark name.
+        class BenchArgs
+        {
+        public:
+            BenchArgs(int argc, char** argv)
+            {
+                for (int i = 0; i < argc; ++i) {
+                    std::string arg = argv[i];
+                    if (arg.rfind("--", 0) != 0) {
+                        continue;
+                    }
+                    arg = arg.substr(2);
+                    if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0) {
+                        m_values[arg] = argv[++i];
+                    }
+                    else {
+                        m_values[arg] = "";
+                    }
+                }
+            }
+
+            bool has(const std::string& name) const
+            {
+                return m_values.find(name) != m_values.end();
+            }
+
+            std::string getString(const std::string& name, const std::string& fallback) const
+            {
+                auto it = m_values.find(name);
+                return it != m_values.end() ? it->second : fallback;
+            }
+
+            int getInt(const std::string& name, int fallback) const
+            {
+                auto it = m_values.find(name);
+                return it != m_values.end() && !it->second.empty() ? std::atoi(it->second.c_str()) : fallback;
+            }
+
+        private:
+            std::unordered_map<std::string, std::string> m_values;
+        };
+
+
+        struct SampleStats
+        {
+            double min = 0.0;
+            double max = 0.0;
+            double mean = 0.0;
+            double p50 = 0.0;
+            double p95 = 0.0;
+            double p99 = 0.0;
+        };
+
+        // Nearest-rank percentiles, so every reported value is an observed sample.
+        inline SampleStats computeStats(std::vector<double> samples)
+        {
+            SampleStats stats{};
+            if (samples.empty()) {
+                return stats;
+            }
+
+            std::sort(samples.begin(), samples.end());
+            auto percentile = [&samples](double p) {
+                size_t rank = size_t(p / 100.0 * double(samples.size()) + 0.5);
+                rank = std::min(std::max(rank, size_t(1)), samples.size());
+                return samples[rank - 1];
+            };
+
+            double sum = 0.0;
+            for (double sample : samples) {
+                sum += sample;
+            }
+
+            stats.min = samples.front();
+            stats.max = samples.back();
+            stats.mean = sum / double(samples.size());
+            stats.p50 = percentile(50.0);
+            stats.p95 = percentile(95.0);
+            stats.p99 = percentile(99.0);
+            return stats;
+        }
+
+        inline void writeStats(JsonWriter& json, const char* name, const SampleStats& stats)
+        {
+            json.key(name);
+            json.beginObject();
+            json.field("min", stats.min);
+            json.field("max", stats.max);
+            json.field("mean", stats.mean);
+            json.field("p50", stats.p50);
+            json.field("p95", stats.p95);
+            json.field("p99", stats.p99);
+            json.endObject();
+        }
+
+        // Prints the report to stdout and, when `--out` is given, also writes it to that file.
+        inline void emitReport(const BenchArgs& args, const JsonWriter& json)
+        {
+            std::cout << json.str() << std::endl;
+
+            std::string outPath = args.getString("out", "");
+            if (!outPath.empty()) {
+                std::ofstream file{ outPath };
+                file << json.str() << std::endl;
+            }
+        }
+
+        // Initialized headless renderer sized by `--width`/`--height`, on `--device`,
+        // with validation layers only when `--validation` is given. `configure`
+        // applies the benchmark's own settings before init().
+        inline std::unique_ptr<Renderer> makeHeadlessRenderer(
+            const BenchArgs& args,
+            int defaultWidth,
+            int defaultHeight,
+            const std::function<void(RenderConfig&)>& configure = nullptr
+        )
+        {
+            RenderConfig config{};
+            config.width = args.getInt("width", defaultWidth);
+            config.height = args.getInt("height", defaultHeight);
+            config.headless = true;
+            config.forcedDevice = args.getString("device", "");
+            if (!args.has("validation")) {
+                config.validationLayers = {};
+            }
+            if (configure) {
+                configure(config);
+            }
+
+            auto renderer = std::make_unique<Renderer>(config, nullptr);
+            renderer->init();
+            return renderer;
+        }
+
+        class Timer
+        {
+        public:
+            Timer() : m_start(std::chrono::high_resolution_clock::now()) { }
+
+            double elapsedMs() const
+            {
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - m_start;
+                return elapsed.count();
+            }
+
+        private:
+            std::chrono::high_resolution_clock::time_point m_start;
+        };
+    }
+}
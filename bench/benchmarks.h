@@ -0,0 +1,102 @@
+#pragma once
+
+#include "bench_utils.h"
+
+namespace bvr
+{
+    namespace bench
+    {
+        // Renders `--frames` headless frames after `--warmup` frames and reports
+        // CPU and GPU frame time percentiles.
+        int runFrameTime(const BenchArgs& args);
+
+        // Records a synthetic scene of `--draws` triangles with 1..`--max-threads`
+        // recording threads and reports the CPU recording time for each count.
+        int runRecordScaling(const BenchArgs& args);
+
+        // Streams `--file` (or a generated GLB of `--generate-mb` MiB) through the
+        // glTF loader while rendering, and reports load throughput, time to the
+        // first frame that can draw it and frame times while streaming.
+        int runGltfStream(const BenchArgs& args);
+
+        // Writes a GLB of grid meshes sharing one material and a few embedded
+        // PNGs, about `targetBytes` in total. Shared by the asset benchmarks.
+        void writeSyntheticGlb(const std::string& path, uint64_t targetBytes);
+
+        // Starts the renderer and compiles `--pipelines` scene pipeline variants
+        // twice, without and then with the on-disk pipeline cache, and reports
+        // both startup times.
+        int runPipelineStartup(const BenchArgs& args);
+
+        // Builds, compiles and records a synthetic deferred frame graph every
+        // frame and reports its CPU cost, barrier counts and how much transient
+        // memory aliasing saved. `--dot` and `--graph-json` dump the graph.
+        int runFrameGraph(const BenchArgs& args);
+
+        // Draws `--instances` instances along a moving camera path, culled on the
+        // CPU and then on the GPU (`--mode cpu|gpu|both`), and reports frame
+        // times, CPU culling time and how many instances survived.
+        int runGpuCulling(const BenchArgs& args);
+
+        // Assigns `--min-lights` to `--max-lights` animated point and spot lights,
+        // doubling each step, to the clusters of a fixed camera on the CPU and on
+        // the GPU (`--mode cpu|gpu|both`), and reports the CPU assignment time, the
+        // GPU time of the cluster passes and the light-cluster pairs. `--validate`
+        // compares the GPU lists against the CPU reference.
+        int runClusteredLighting(const BenchArgs& args);
+
+        // Renders `--rounds` rounds of `--frames` frames of `--draws` triangles,
+        // alternating between the profiler disabled and enabled, and reports
+        // the profiling overhead on CPU and GPU frame times. `--trace` writes
+        // the last profiled round as a Chrome trace.
+        int runProfilerOverhead(const BenchArgs& args);
+
+        // Draws `--draws` triangles cycling through `--materials` textured
+        // materials, binding a descriptor set per material change and then
+        // indexing the bindless table with push constants (`--mode
+        // set|bindless|both`), and reports recording and frame times.
+        int runBindlessMaterials(const BenchArgs& args);
+
+        // Animates `--dynamic-casters` casters and `--moving-lights` of `--lights`
+        // shadowed lights over `--static-casters` static casters, with tile
+        // caching on and then off (`--mode cached|uncached|both`), and reports
+        // the shadow update's CPU time, frame times and how many tiles and
+        // cascades were redrawn.
+        int runShadowAtlas(const BenchArgs& args);
+
+        // Loads image based lighting for `--hdr`, or for a generated sky with a
+        // sun, from an empty cache so the GPU bakes it, then `--warm-runs` more
+        // times from the cache, and reports where the time of each start went.
+        // Unless `--no-compare`, also bakes on the CPU and reports how far the
+        // GPU results are from it.
+        int runImageBasedLighting(const BenchArgs& args);
+
+        // Cooks `--file` (or a generated GLB of `--generate-mb` MiB) into a
+        // package, then loads the glTF and the package `--runs` times each while
+        // rendering, and reports the cook times and how much sooner the package
+        // is drawable and resident.
+        int runAssetPackage(const BenchArgs& args);
+
+        // Renders `--objects` built-in meshes with temporal anti-aliasing and
+        // motion blur under a circling camera, adding `--extra-objects` halfway
+        // through. With `--target-us`, dynamic resolution holds that GPU frame
+        // time, otherwise frames render at `--scale-percent`. Reports frame
+        // times, the render scale and the scale and GPU time of every frame.
+        int runTemporalAntiAliasing(const BenchArgs& args);
+
+        // Presents to a virtual swapchain refreshing at `--refresh-hz` in each
+        // `--present-mode` (or all of them), limiting run-ahead to
+        // `--max-latency` frames and resizing every `--resize-every` frames.
+        // Reports how long input sampled before `--work-us` of simulated
+        // update took to be submitted and shown, overall and per frame, and
+        // how often the swapchain was recreated.
+        int runPresentLatency(const BenchArgs& args);
+
+        // Compiles copies of the shaders in `--source` from scratch and from the
+        // SPIR-V cache, then renders with the scene shaders hot reloaded while
+        // triangle.frag is edited `--edits` times, and once so it fails to
+        // compile. Reports compile times, how long each edit took to reach the
+        // screen and the CPU frame times while reloading next to a baseline.
+        int runShaderReload(const BenchArgs& args);
+    }
+}
@@ -0,0 +1,418 @@
+#include "benchmarks.h"
+#include "bindless.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <random>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            // Matches MaterialConstants in shaders/material.vert.
+            struct MaterialConstants
+            {
+                glm::vec4 offsetScale;
+                // Bindless texture, sampler and parameter buffer handles.
+                glm::uvec4 material;
+            };
+
+            const uint32_t kTextureSize = 4;
+
+            struct Materials
+            {
+                std::vector<Image> images;
+                std::vector<vk::ImageView> views;
+                // One tint per material, `paramStride` apart so each can be bound
+                // as its own uniform buffer range.
+                Buffer params;
+                vk::DeviceSize paramStride = 0;
+                vk::Sampler sampler;
+            };
+
+            Materials createMaterials(Renderer& renderer, uint32_t materialCount)
+            {
+                GpuMemory& memory = renderer.getMemory();
+                vk::Device device = renderer.getDevice();
+                vk::PhysicalDeviceLimits limits = renderer.getDeviceProperties().limits;
+                std::mt19937 rng{ 1234 };
+                std::uniform_int_distribution<uint32_t> texel{ 0, 0xffffffffu };
+                std::uniform_real_distribution<float> unit{ 0.0f, 1.0f };
+
+                Materials materials;
+                materials.paramStride = std::max<vk::DeviceSize>({ sizeof(glm::vec4), limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment });
+                materials.params = memory.createBuffer(vk::BufferCreateInfo{
+                    vk::BufferCreateFlags{},
+                    materials.paramStride * materialCount,
+                    vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+                }, MemoryUsage::eUpload);
+
+                const vk::DeviceSize texelsPerImage = kTextureSize * kTextureSize;
+                Buffer staging = memory.createBuffer(vk::BufferCreateInfo{
+                    vk::BufferCreateFlags{},
+                    texelsPerImage * sizeof(uint32_t) * materialCount,
+                    vk::BufferUsageFlagBits::eTransferSrc,
+                }, MemoryUsage::eUpload);
+                uint32_t* texels = static_cast<uint32_t*>(staging.mapped);
+                for (vk::DeviceSize i = 0; i < texelsPerImage * materialCount; ++i) {
+                    texels[i] = texel(rng) | 0xff000000u;
+                }
+
+                for (uint32_t i = 0; i < materialCount; ++i) {
+                    glm::vec4 tint{ 0.5f + 0.5f * unit(rng), 0.5f + 0.5f * unit(rng), 0.5f + 0.5f * unit(rng), 1.0f };
+                    memcpy(static_cast<uint8_t*>(materials.params.mapped) + materials.paramStride * i, &tint, sizeof(tint));
+
+                    vk::ImageCreateInfo imageInfo{
+                        vk::ImageCreateFlags{},
+                        vk::ImageType::e2D,
+                        vk::Format::eR8G8B8A8Unorm,
+                        vk::Extent3D{ kTextureSize, kTextureSize, 1 },
+                        1, // Mip levels
+                        1, // Array layers
+                        vk::SampleCountFlagBits::e1,
+                        vk::ImageTiling::eOptimal,
+                        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst,
+                    };
+                    materials.images.push_back(memory.createImage(imageInfo));
+                    materials.views.push_back(device.createImageView(vk::ImageViewCreateInfo{
+                        vk::ImageViewCreateFlags{},
+                        materials.images.back().image,
+                        vk::ImageViewType::e2D,
+                        imageInfo.format,
+                        vk::ComponentMapping{},
+                        vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 },
+                    }));
+                }
+
+                renderer.immediateSubmit([&materials, &staging, texelsPerImage](vk::CommandBuffer commandBuffer) {
+                    const vk::ImageSubresourceRange range{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+                    std::vector<vk::ImageMemoryBarrier> barriers;
+                    for (const Image& image : materials.images) {
+                        barriers.push_back(vk::ImageMemoryBarrier{
+                            vk::AccessFlags{}, vk::AccessFlagBits::eTransferWrite,
+                            vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+                            VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+                            image.image, range,
+                        });
+                    }
+                    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags{}, nullptr, nullptr, barriers);
+
+                    for (size_t i = 0; i < materials.images.size(); ++i) {
+                        vk::BufferImageCopy copy{
+                            texelsPerImage * sizeof(uint32_t) * i, 0, 0,
+                            vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, 0, 0, 1 },
+                            vk::Offset3D{ 0, 0, 0 },
+                            vk::Extent3D{ kTextureSize, kTextureSize, 1 },
+                        };
+                        commandBuffer.copyBufferToImage(staging.buffer, materials.images[i].image, vk::ImageLayout::eTransferDstOptimal, copy);
+                    }
+
+                    for (vk::ImageMemoryBarrier& barrier : barriers) {
+                        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+                        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+                        barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+                        barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+                    }
+                    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags{}, nullptr, nullptr, barriers);
+                });
+                memory.destroyBuffer(staging);
+
+                materials.sampler = renderer.getPipelines().getSampler(vk::SamplerCreateInfo{
+                    vk::SamplerCreateFlags{},
+                    vk::Filter::eLinear,
+                    vk::Filter::eLinear,
+                    vk::SamplerMipmapMode::eNearest,
+                    vk::SamplerAddressMode::eRepeat,
+                    vk::SamplerAddressMode::eRepeat,
+                    vk::SamplerAddressMode::eRepeat,
+                });
+                return materials;
+            }
+
+            void destroyMaterials(Renderer& renderer, Materials& materials)
+            {
+                for (vk::ImageView view : materials.views) {
+                    renderer.getDevice().destroyImageView(view);
+                }
+                for (Image& image : materials.images) {
+                    renderer.getMemory().destroyImage(image);
+                }
+                renderer.getMemory().destroyBuffer(materials.params);
+            }
+
+            // Same format as the renderer's target, which is all render pass
+            // compatibility asks for.
+            vk::RenderPass createCompatibleRenderPass(vk::Device device)
+            {
+                vk::AttachmentDescription colorAttachment{
+                    vk::AttachmentDescriptionFlags{},
+                    vk::Format::eR8G8B8A8Unorm,
+                    vk::SampleCountFlagBits::e1,
+                    vk::AttachmentLoadOp::eClear,
+                    vk::AttachmentStoreOp::eStore,
+                    vk::AttachmentLoadOp::eDontCare,
+                    vk::AttachmentStoreOp::eDontCare,
+                    vk::ImageLayout::eColorAttachmentOptimal,
+                    vk::ImageLayout::eColorAttachmentOptimal,
+                };
+                vk::AttachmentReference colorRef{ 0, vk::ImageLayout::eColorAttachmentOptimal };
+                vk::SubpassDescription subpass{
+                    vk::SubpassDescriptionFlags{},
+                    vk::PipelineBindPoint::eGraphics,
+                    0, nullptr, // Input attachments
+                    1, &colorRef,
+                };
+                return device.createRenderPass(vk::RenderPassCreateInfo{
+                    vk::RenderPassCreateFlags{},
+                    1, &colorAttachment,
+                    1, &subpass,
+                });
+            }
+
+            vk::Pipeline createMaterialPipeline(Renderer& renderer, vk::RenderPass renderPass, vk::PipelineLayout layout, const char* fragmentShader)
+            {
+                std::array<vk::PipelineShaderStageCreateInfo, 2> stages{
+                    vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eVertex, renderer.createEmbeddedShaderModule("material.vert"), "main" },
+                    vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eFragment, renderer.createEmbeddedShaderModule(fragmentShader), "main" },
+                };
+
+                vk::PipelineVertexInputStateCreateInfo vertexInput{};
+                vk::PipelineInputAssemblyStateCreateInfo inputAssembly{ vk::PipelineInputAssemblyStateCreateFlags{}, vk::PrimitiveTopology::eTriangleList };
+                vk::PipelineViewportStateCreateInfo viewportState{ vk::PipelineViewportStateCreateFlags{}, 1, nullptr, 1, nullptr };
+                vk::PipelineRasterizationStateCreateInfo rasterization{};
+                rasterization.polygonMode = vk::PolygonMode::eFill;
+                rasterization.cullMode = vk::CullModeFlagBits::eNone;
+                rasterization.frontFace = vk::FrontFace::eCounterClockwise;
+                rasterization.lineWidth = 1.0f;
+                vk::PipelineMultisampleStateCreateInfo multisample{};
+                vk::PipelineColorBlendAttachmentState blendAttachment{};
+                blendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+                    vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+                vk::PipelineColorBlendStateCreateInfo colorBlend{};
+                colorBlend.attachmentCount = 1;
+                colorBlend.pAttachments = &blendAttachment;
+                std::array<vk::DynamicState, 2> dynamicStates{ vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+                vk::PipelineDynamicStateCreateInfo dynamicState{ vk::PipelineDynamicStateCreateFlags{}, uint32_t(dynamicStates.size()), dynamicStates.data() };
+
+                vk::GraphicsPipelineCreateInfo pipelineInfo{};
+                pipelineInfo.stageCount = uint32_t(stages.size());
+                pipelineInfo.pStages = stages.data();
+                pipelineInfo.pVertexInputState = &vertexInput;
+                pipelineInfo.pInputAssemblyState = &inputAssembly;
+                pipelineInfo.pViewportState = &viewportState;
+                pipelineInfo.pRasterizationState = &rasterization;
+                pipelineInfo.pMultisampleState = &multisample;
+                pipelineInfo.pColorBlendState = &colorBlend;
+                pipelineInfo.pDynamicState = &dynamicState;
+                pipelineInfo.layout = layout;
+                pipelineInfo.renderPass = renderPass;
+                pipelineInfo.subpass = 0;
+                return renderer.getPipelines().getGraphicsPipeline(pipelineInfo);
+            }
+        }
+
+        int runBindlessMaterials(const BenchArgs& args)
+        {
+            const uint32_t materialCount = uint32_t(std::max(args.getInt("materials", 1024), 1));
+            const uint32_t drawCount = uint32_t(std::max(args.getInt("draws", 20000), 1));
+            const int frameCount = std::max(args.getInt("frames", 200), 1);
+            const int warmupCount = std::max(args.getInt("warmup", 20), 0);
+            const std::string modeArg = args.getString("mode", "both");
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720);
+            vk::Device device = renderer->getDevice();
+            PipelineCache& pipelines = renderer->getPipelines();
+            BindlessTable* bindless = renderer->getBindless();
+
+            Materials materials = createMaterials(*renderer, materialCount);
+            vk::RenderPass renderPass = createCompatibleRenderPass(device);
+            vk::PushConstantRange pushConstants{ vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, sizeof(MaterialConstants) };
+
+            // The classic path: one set per material, written and bound whenever
+            // the material changes, from a pool per frame in flight.
+            std::array<vk::DescriptorSetLayoutBinding, 3> setBindings{
+                vk::DescriptorSetLayoutBinding{ 0, vk::DescriptorType::eSampledImage, 1, vk::ShaderStageFlagBits::eFragment },
+                vk::DescriptorSetLayoutBinding{ 1, vk::DescriptorType::eSampler, 1, vk::ShaderStageFlagBits::eFragment },
+                vk::DescriptorSetLayoutBinding{ 2, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eFragment },
+            };
+            vk::DescriptorSetLayout materialSetLayout = pipelines.getDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{
+                vk::DescriptorSetLayoutCreateFlags{}, uint32_t(setBindings.size()), setBindings.data() });
+            vk::PipelineLayout perSetLayout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+                vk::PipelineLayoutCreateFlags{}, 1, &materialSetLayout, 1, &pushConstants });
+            vk::Pipeline perSetPipeline = createMaterialPipeline(*renderer, renderPass, perSetLayout, "material_set.frag");
+
+            std::array<vk::DescriptorPoolSize, 3> poolSizes{
+                vk::DescriptorPoolSize{ vk::DescriptorType::eSampledImage, drawCount },
+                vk::DescriptorPoolSize{ vk::DescriptorType::eSampler, drawCount },
+                vk::DescriptorPoolSize{ vk::DescriptorType::eUniformBuffer, drawCount },
+            };
+            std::vector<vk::DescriptorPool> materialPools;
+            for (uint32_t i = 0; i < renderer->getFrameCount(); ++i) {
+                materialPools.push_back(device.createDescriptorPool(vk::DescriptorPoolCreateInfo{
+                    vk::DescriptorPoolCreateFlags{}, drawCount, uint32_t(poolSizes.size()), poolSizes.data() }));
+            }
+
+            // The bindless path: every material registered once, the global set
+            // bound once per frame and the handles pushed per draw.
+            vk::PipelineLayout bindlessLayout;
+            vk::Pipeline bindlessPipeline;
+            std::vector<TextureHandle> textureHandles;
+            std::vector<BufferHandle> paramHandles;
+            SamplerHandle samplerHandle;
+            if (bindless != nullptr) {
+                vk::DescriptorSetLayout globalSetLayout = bindless->getSetLayout();
+                bindlessLayout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+                    vk::PipelineLayoutCreateFlags{}, 1, &globalSetLayout, 1, &pushConstants });
+                bindlessPipeline = createMaterialPipeline(*renderer, renderPass, bindlessLayout, "material_bindless.frag");
+                for (uint32_t i = 0; i < materialCount; ++i) {
+                    textureHandles.push_back(bindless->addTexture(materials.views[i]));
+                    paramHandles.push_back(bindless->addBuffer(materials.params.buffer, materials.paramStride * i, sizeof(glm::vec4)));
+                }
+                samplerHandle = bindless->addSampler(materials.sampler);
+            }
+
+            enum class Mode { ePerSet, eBindless };
+            std::vector<Mode> modes;
+            if (modeArg == "set" || modeArg == "both") {
+                modes.push_back(Mode::ePerSet);
+            }
+            if ((modeArg == "bindless" || modeArg == "both") && bindless != nullptr) {
+                modes.push_back(Mode::eBindless);
+            }
+
+            // Material i % materialCount for draw i, so the material changes on
+            // every draw: the worst case for per-material sets.
+            std::mt19937 rng{ 4321 };
+            std::uniform_real_distribution<float> position{ -1.0f, 1.0f };
+            std::vector<MaterialConstants> draws(drawCount);
+            for (uint32_t i = 0; i < drawCount; ++i) {
+                uint32_t material = i % materialCount;
+                draws[i].offsetScale = glm::vec4{ position(rng), position(rng), 0.01f, 0.01f };
+                if (bindless != nullptr) {
+                    draws[i].material = glm::uvec4{ textureHandles[material].index, samplerHandle.index, paramHandles[material].index, 0 };
+                }
+            }
+
+            vk::PhysicalDeviceProperties props = renderer->getDeviceProperties();
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "bindless");
+            json.field("device", &props.deviceName[0]);
+            json.field("materials", materialCount);
+            json.field("draws", drawCount);
+            json.field("frames", frameCount);
+            json.field("bindless_supported", bindless != nullptr);
+            json.key("results");
+            json.beginArray();
+
+            for (Mode mode : modes) {
+                std::vector<double> recordSamples;
+                std::vector<double> cpuSamples;
+                std::vector<double> gpuSamples;
+                auto collectGpuSamples = [&renderer, &gpuSamples]() {
+                    for (const FrameTimings& timings : renderer->takeCompletedTimings()) {
+                        if (timings.gpuMs >= 0.0) {
+                            gpuSamples.push_back(timings.gpuMs);
+                        }
+                    }
+                };
+
+                for (int i = 0; i < warmupCount + frameCount; ++i) {
+                    double recordMs = 0.0;
+                    Timer frameTimer;
+                    renderer->renderFrameGraph([&](RenderGraph& graph, FrameContext& frame, GraphResource target) {
+                        vk::DescriptorPool materialPool = materialPools[frame.frameIndex % materialPools.size()];
+                        graph.addPass("materials", GraphPassType::eRaster)
+                            .colorAttachment(target, vk::AttachmentLoadOp::eClear, vk::ClearColorValue{ std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 1.0f } })
+                            .record([&, materialPool](RenderGraphContext& context) {
+                                Timer recordTimer;
+                                vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                                vk::Extent2D extent = context.getExtent();
+                                commandBuffer.setViewport(0, vk::Viewport{ 0.0f, 0.0f, float(extent.width), float(extent.height), 0.0f, 1.0f });
+                                commandBuffer.setScissor(0, vk::Rect2D{ vk::Offset2D{ 0, 0 }, extent });
+
+                                if (mode == Mode::eBindless) {
+                                    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, bindlessPipeline);
+                                    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindlessLayout, 0, bindless->getSet(), nullptr);
+                                    for (const MaterialConstants& draw : draws) {
+                                        commandBuffer.pushConstants(bindlessLayout, pushConstants.stageFlags, 0, sizeof(MaterialConstants), &draw);
+                                        commandBuffer.draw(3, 1, 0, 0);
+                                    }
+                                    recordMs = recordTimer.elapsedMs();
+                                    return;
+                                }
+
+                                // The frame that used this pool last has retired.
+                                device.resetDescriptorPool(materialPool);
+                                commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, perSetPipeline);
+                                uint32_t boundMaterial = UINT32_MAX;
+                                for (uint32_t d = 0; d < drawCount; ++d) {
+                                    uint32_t material = d % materialCount;
+                                    if (material != boundMaterial) {
+                                        vk::DescriptorSet set = device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{ materialPool, 1, &materialSetLayout })[0];
+                                        vk::DescriptorImageInfo textureInfo{ vk::Sampler{}, materials.views[material], vk::ImageLayout::eShaderReadOnlyOptimal };
+                                        vk::DescriptorImageInfo samplerInfo{ materials.sampler };
+                                        vk::DescriptorBufferInfo paramsInfo{ materials.params.buffer, materials.paramStride * material, sizeof(glm::vec4) };
+                                        std::array<vk::WriteDescriptorSet, 3> writes{
+                                            vk::WriteDescriptorSet{ set, 0, 0, 1, vk::DescriptorType::eSampledImage, &textureInfo },
+                                            vk::WriteDescriptorSet{ set, 1, 0, 1, vk::DescriptorType::eSampler, &samplerInfo },
+                                            vk::WriteDescriptorSet{ set, 2, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &paramsInfo },
+                                        };
+                                        device.updateDescriptorSets(writes, nullptr);
+                                        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, perSetLayout, 0, set, nullptr);
+                                        boundMaterial = material;
+                                    }
+                                    commandBuffer.pushConstants(perSetLayout, pushConstants.stageFlags, 0, sizeof(MaterialConstants), &draws[d]);
+                                    commandBuffer.draw(3, 1, 0, 0);
+                                }
+                                recordMs = recordTimer.elapsedMs();
+                            });
+                    });
+                    double frameMs = frameTimer.elapsedMs();
+
+                    if (i < warmupCount) {
+                        renderer->takeCompletedTimings();
+                        continue;
+                    }
+                    recordSamples.push_back(recordMs);
+                    cpuSamples.push_back(frameMs);
+                    collectGpuSamples();
+                }
+                renderer->waitIdle();
+                collectGpuSamples();
+
+                json.beginObject();
+                json.field("mode", mode == Mode::eBindless ? "bindless" : "set");
+                writeStats(json, "record_ms", computeStats(recordSamples));
+                writeStats(json, "cpu_frame_ms", computeStats(cpuSamples));
+                writeStats(json, "gpu_frame_ms", computeStats(gpuSamples));
+                json.endObject();
+            }
+
+            json.endArray();
+            json.endObject();
+
+            renderer->waitIdle();
+            if (bindless != nullptr) {
+                for (uint32_t i = 0; i < materialCount; ++i) {
+                    bindless->release(textureHandles[i]);
+                    bindless->release(paramHandles[i]);
+                }
+                bindless->release(samplerHandle);
+            }
+            for (vk::DescriptorPool pool : materialPools) {
+                device.destroyDescriptorPool(pool);
+            }
+            device.destroyRenderPass(renderPass);
+            destroyMaterials(*renderer, materials);
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
@@ -0,0 +1,242 @@
+#include "benchmarks.h"
+#include "clustered_lighting.h"
+#include "renderer.h"
+
+#include <vma/vk_mem_alloc.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            const float kSceneExtent = 200.0f;
+
+            struct LightField
+            {
+                std::vector<Light> base;
+                std::vector<float> phases;
+                std::vector<Light> animated;
+            };
+
+            // Lights scattered in front of the camera, one in four a spot light.
+            LightField makeLightField(uint32_t lightCount)
+            {
+                std::mt19937 rng{ 4321 };
+                std::uniform_real_distribution<float> lateral{ -kSceneExtent, kSceneExtent };
+                std::uniform_real_distribution<float> depth{ -2.0f * kSceneExtent, 0.0f };
+                std::uniform_real_distribution<float> height{ 0.0f, 20.0f };
+                std::uniform_real_distribution<float> range{ 2.0f, 10.0f };
+                std::uniform_real_distribution<float> unit{ 0.0f, 1.0f };
+
+                LightField field;
+                for (uint32_t i = 0; i < lightCount; ++i) {
+                    glm::vec3 position{ lateral(rng), height(rng), depth(rng) };
+                    glm::vec3 color{ unit(rng), unit(rng), unit(rng) };
+                    if (i % 4 == 3) {
+                        glm::vec3 direction{ unit(rng) - 0.5f, -1.0f, unit(rng) - 0.5f };
+                        field.base.push_back(makeSpotLight(position, range(rng) * 2.0f, direction, 0.2f + unit(rng) * 0.6f, color, 4.0f));
+                    }
+                    else {
+                        field.base.push_back(makePointLight(position, range(rng), color, 1.0f));
+                    }
+                    field.phases.push_back(unit(rng) * 6.2832f);
+                }
+                field.animated = field.base;
+                return field;
+            }
+
+            // Every light bobs along its own small circle.
+            void animateLights(LightField& field, uint32_t frame)
+            {
+                float time = float(frame) * 0.02f;
+                for (size_t i = 0; i < field.base.size(); ++i) {
+                    float angle = time + field.phases[i];
+                    field.animated[i].positionRange = field.base[i].positionRange + glm::vec4(std::cos(angle) * 3.0f, 0.0f, std::sin(angle) * 3.0f, 0.0f);
+                }
+            }
+
+            struct ListReadback
+            {
+                Buffer ranges;
+                Buffer indices;
+            };
+
+            // Clusters whose GPU list differs from the CPU reference. Offsets
+            // differ between the two, only the lists are compared.
+            uint32_t countMismatches(GpuMemory& memory, const ListReadback& readback, const ClusterLightLists& reference)
+            {
+                vmaInvalidateAllocation(memory.getAllocator(), readback.ranges.allocation, 0, VK_WHOLE_SIZE);
+                vmaInvalidateAllocation(memory.getAllocator(), readback.indices.allocation, 0, VK_WHOLE_SIZE);
+                const glm::uvec2* ranges = static_cast<const glm::uvec2*>(readback.ranges.mapped);
+                const uint32_t* indices = static_cast<const uint32_t*>(readback.indices.mapped);
+
+                uint32_t mismatches = 0;
+                for (size_t cluster = 0; cluster < reference.ranges.size(); ++cluster) {
+                    glm::uvec2 expected = reference.ranges[cluster];
+                    glm::uvec2 actual = ranges[cluster];
+                    if (actual.y != expected.y
+                        || memcmp(indices + actual.x, reference.indices.data() + expected.x, expected.y * sizeof(uint32_t)) != 0) {
+                        ++mismatches;
+                    }
+                }
+                return mismatches;
+            }
+        }
+
+        int runClusteredLighting(const BenchArgs& args)
+        {
+            const uint32_t minLights = uint32_t(std::max(args.getInt("min-lights", 1024), 1));
+            const uint32_t maxLights = uint32_t(std::max(args.getInt("max-lights", 65536), int(minLights)));
+            const int frameCount = std::max(args.getInt("frames", 60), 1);
+            const int warmupCount = std::max(args.getInt("warmup", 5), 0);
+            const std::string modeArg = args.getString("mode", "both");
+            const bool validate = args.has("validate");
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720);
+            const RenderConfig& config = renderer->getConfig();
+
+            ClusterGridConfig gridConfig{};
+            gridConfig.farZ = kSceneExtent * 2.0f;
+            ClusteredLighting clusters{ *renderer, gridConfig };
+
+            std::vector<ClusterCullMode> modes;
+            if (modeArg == "cpu" || modeArg == "both") {
+                modes.push_back(ClusterCullMode::eCpu);
+            }
+            if (modeArg == "gpu" || modeArg == "both") {
+                modes.push_back(ClusterCullMode::eGpu);
+            }
+
+            glm::mat4 view = glm::lookAt(glm::vec3{ 0.0f, 10.0f, 0.0f }, glm::vec3{ 0.0f, 5.0f, -kSceneExtent }, glm::vec3{ 0.0f, 1.0f, 0.0f });
+            glm::mat4 projection = glm::perspectiveRH_ZO(glm::radians(60.0f), float(config.width) / float(config.height), gridConfig.nearZ, gridConfig.farZ);
+            // Vulkan's clip space points y down.
+            projection[1][1] *= -1.0f;
+
+            GpuMemory& memory = renderer->getMemory();
+            ListReadback readback{};
+            if (validate) {
+                readback.ranges = memory.createBuffer(vk::BufferCreateInfo{
+                    vk::BufferCreateFlags{},
+                    uint64_t(gridConfig.tilesX) * gridConfig.tilesY * gridConfig.slices * sizeof(glm::uvec2),
+                    vk::BufferUsageFlagBits::eTransferDst,
+                }, MemoryUsage::eReadback);
+                readback.indices = memory.createBuffer(vk::BufferCreateInfo{
+                    vk::BufferCreateFlags{},
+                    vk::DeviceSize(gridConfig.maxLightIndices) * sizeof(uint32_t),
+                    vk::BufferUsageFlagBits::eTransferDst,
+                }, MemoryUsage::eReadback);
+            }
+
+            vk::PhysicalDeviceProperties props = renderer->getDeviceProperties();
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "clusters");
+            json.field("device", &props.deviceName[0]);
+            json.field("clusters", clusters.getStats().clusters);
+            json.field("frames", frameCount);
+            json.key("results");
+            json.beginArray();
+
+            for (uint32_t lightCount = minLights; lightCount <= maxLights; lightCount *= 2) {
+                LightField lights = makeLightField(lightCount);
+
+                for (ClusterCullMode mode : modes) {
+                    std::vector<double> assignSamples;
+                    std::vector<double> gpuSamples;
+                    std::vector<double> pairSamples;
+                    bool overflowed = false;
+                    auto collectGpuSamples = [&renderer, &gpuSamples]() {
+                        for (const FrameTimings& timings : renderer->takeCompletedTimings()) {
+                            if (timings.gpuMs >= 0.0) {
+                                gpuSamples.push_back(timings.gpuMs);
+                            }
+                        }
+                    };
+
+                    // The frames hold nothing but the cluster passes, so their
+                    // GPU time is the time the GPU spends assigning lights.
+                    for (int i = 0; i < warmupCount + frameCount; ++i) {
+                        animateLights(lights, uint32_t(i));
+                        bool readLists = validate && mode == ClusterCullMode::eGpu && i == warmupCount + frameCount - 1;
+                        renderer->renderFrameGraph([&](RenderGraph& graph, FrameContext& frame, GraphResource) {
+                            ClusterResources lists = clusters.addPasses(graph, frame, view, projection, lights.animated, mode);
+                            if (!readLists) {
+                                return;
+                            }
+                            // Sized like the cluster lists, see the buffers above.
+                            Buffer rangesReadback = readback.ranges;
+                            Buffer indicesReadback = readback.indices;
+                            graph.addPass("cluster_lists_readback", GraphPassType::eTransfer)
+                                .read(lists.ranges, GraphAccess::eTransferRead)
+                                .read(lists.indices, GraphAccess::eTransferRead)
+                                .sideEffect()
+                                .record([lists, rangesReadback, indicesReadback](RenderGraphContext& context) {
+                                    vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                                    commandBuffer.copyBuffer(context.getBuffer(lists.ranges), rangesReadback.buffer, vk::BufferCopy{ 0, 0, rangesReadback.size });
+                                    commandBuffer.copyBuffer(context.getBuffer(lists.indices), indicesReadback.buffer, vk::BufferCopy{ 0, 0, indicesReadback.size });
+                                    commandBuffer.pipelineBarrier(
+                                        vk::PipelineStageFlagBits::eTransfer,
+                                        vk::PipelineStageFlagBits::eHost,
+                                        vk::DependencyFlags{},
+                                        vk::MemoryBarrier{ vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead },
+                                        nullptr,
+                                        nullptr
+                                    );
+                                });
+                        });
+
+                        if (i < warmupCount) {
+                            renderer->takeCompletedTimings();
+                            continue;
+                        }
+                        collectGpuSamples();
+
+                        ClusterStats stats = clusters.getStats();
+                        overflowed = overflowed || stats.overflowed;
+                        if (mode == ClusterCullMode::eCpu) {
+                            assignSamples.push_back(stats.cpuAssignMs);
+                            pairSamples.push_back(double(stats.cpuIndexCount));
+                        }
+                        else if (stats.gpuIndexCount != UINT32_MAX) {
+                            pairSamples.push_back(double(stats.gpuIndexCount));
+                        }
+                    }
+                    renderer->waitIdle();
+                    collectGpuSamples();
+
+                    json.beginObject();
+                    json.field("lights", lightCount);
+                    json.field("mode", mode == ClusterCullMode::eCpu ? "cpu" : "gpu");
+                    writeStats(json, "gpu_frame_ms", computeStats(gpuSamples));
+                    if (mode == ClusterCullMode::eCpu) {
+                        writeStats(json, "cpu_assign_ms", computeStats(assignSamples));
+                    }
+                    writeStats(json, "light_cluster_pairs", computeStats(pairSamples));
+                    json.field("overflowed", overflowed);
+                    if (validate && mode == ClusterCullMode::eGpu && !overflowed) {
+                        // The lights are still where the last frame put them.
+                        const ClusterLightLists& reference = clusters.assignLightsCpu(view, projection, lights.animated);
+                        json.field("mismatched_clusters", countMismatches(memory, readback, reference));
+                    }
+                    json.endObject();
+                }
+            }
+
+            json.endArray();
+            json.endObject();
+
+            memory.destroyBuffer(readback.ranges);
+            memory.destroyBuffer(readback.indices);
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
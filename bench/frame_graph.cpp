@@ -0,0 +1,190 @@
+#include "benchmarks.h"
+#include "renderer.h"
+
+#include <fstream>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            // A deferred frame shaped like the one the README's feature list
+            // leads to, with empty passes: only the graph's own work, barriers and
+            // render passes are measured. "debug_normals" writes a view nothing
+            // reads, so it is culled.
+            void buildDeferredFrame(RenderGraph& graph, const OffscreenTarget& output, uint32_t width, uint32_t height)
+            {
+                GraphImageDesc full{};
+                full.width = width;
+                full.height = height;
+                GraphImageDesc half = full;
+                half.width = std::max(width / 2, 1u);
+                half.height = std::max(height / 2, 1u);
+
+                GraphImageDesc albedoDesc = full;
+                albedoDesc.format = vk::Format::eR8G8B8A8Unorm;
+                GraphImageDesc normalDesc = full;
+                normalDesc.format = vk::Format::eR16G16B16A16Sfloat;
+                GraphImageDesc depthDesc = full;
+                depthDesc.format = vk::Format::eD32Sfloat;
+                GraphImageDesc aoDesc = full;
+                aoDesc.format = vk::Format::eR32Sfloat;
+                GraphImageDesc hdrDesc = full;
+                hdrDesc.format = vk::Format::eR16G16B16A16Sfloat;
+                GraphImageDesc bloomDesc = half;
+                bloomDesc.format = vk::Format::eR16G16B16A16Sfloat;
+
+                GraphResource albedo = graph.createImage("albedo", albedoDesc);
+                GraphResource normal = graph.createImage("normal", normalDesc);
+                GraphResource depth = graph.createImage("depth", depthDesc);
+                GraphResource ao = graph.createImage("ao", aoDesc);
+                GraphResource aoBlurred = graph.createImage("ao_blurred", aoDesc);
+                GraphResource hdr = graph.createImage("hdr", hdrDesc);
+                GraphResource bloomHalf = graph.createImage("bloom_down", bloomDesc);
+                GraphResource bloom = graph.createImage("bloom_up", bloomDesc);
+                GraphResource debugView = graph.createImage("debug_view", albedoDesc);
+
+                GraphImageDesc outputDesc = full;
+                outputDesc.format = vk::Format::eR8G8B8A8Unorm;
+                GraphResource target = graph.importImage(
+                    "output",
+                    output.color.image,
+                    output.view,
+                    outputDesc,
+                    GraphImportState{},
+                    GraphImportState{ vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead }
+                );
+
+                graph.addPass("gbuffer", GraphPassType::eRaster)
+                    .colorAttachment(albedo, vk::AttachmentLoadOp::eClear)
+                    .colorAttachment(normal, vk::AttachmentLoadOp::eClear)
+                    .depthAttachment(depth, vk::AttachmentLoadOp::eClear);
+                graph.addPass("ssao", GraphPassType::eCompute)
+                    .read(depth, GraphAccess::eSampledCompute)
+                    .read(normal, GraphAccess::eSampledCompute)
+                    .write(ao, GraphAccess::eStorageWriteCompute);
+                graph.addPass("ssao_blur", GraphPassType::eCompute)
+                    .read(ao, GraphAccess::eSampledCompute)
+                    .write(aoBlurred, GraphAccess::eStorageWriteCompute);
+                graph.addPass("lighting", GraphPassType::eCompute)
+                    .read(albedo, GraphAccess::eSampledCompute)
+                    .read(normal, GraphAccess::eSampledCompute)
+                    .read(depth, GraphAccess::eSampledCompute)
+                    .read(aoBlurred, GraphAccess::eSampledCompute)
+                    .write(hdr, GraphAccess::eStorageWriteCompute);
+                graph.addPass("debug_normals", GraphPassType::eRaster)
+                    .read(normal, GraphAccess::eSampledFragment)
+                    .colorAttachment(debugView, vk::AttachmentLoadOp::eDontCare);
+                graph.addPass("bloom_down", GraphPassType::eCompute)
+                    .read(hdr, GraphAccess::eSampledCompute)
+                    .write(bloomHalf, GraphAccess::eStorageWriteCompute);
+                graph.addPass("bloom_up", GraphPassType::eCompute)
+                    .read(bloomHalf, GraphAccess::eSampledCompute)
+                    .write(bloom, GraphAccess::eStorageWriteCompute);
+                graph.addPass("tonemap", GraphPassType::eRaster)
+                    .read(hdr, GraphAccess::eSampledFragment)
+                    .read(bloom, GraphAccess::eSampledFragment)
+                    .colorAttachment(target, vk::AttachmentLoadOp::eDontCare);
+            }
+
+            void writeFile(const std::string& path, const std::string& contents)
+            {
+                if (path.empty()) {
+                    return;
+                }
+                std::ofstream file{ path };
+                file << contents;
+            }
+        }
+
+        int runFrameGraph(const BenchArgs& args)
+        {
+            const int frameCount = std::max(args.getInt("frames", 500), 1);
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1920, 1080);
+            const RenderConfig& config = renderer->getConfig();
+
+            vk::PhysicalDeviceProperties props = renderer->getDeviceProperties();
+            RenderGraph graph{ renderer->getDevice(), renderer->getMemory(), props.limits.bufferImageGranularity, config.framesInFlight };
+
+            OffscreenTarget output{};
+            output.color = renderer->getMemory().createImage(vk::ImageCreateInfo{
+                vk::ImageCreateFlags{},
+                vk::ImageType::e2D,
+                vk::Format::eR8G8B8A8Unorm,
+                vk::Extent3D{ uint32_t(config.width), uint32_t(config.height), 1 },
+                1,
+                1,
+                vk::SampleCountFlagBits::e1,
+                vk::ImageTiling::eOptimal,
+                vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
+            });
+            output.view = renderer->getDevice().createImageView(vk::ImageViewCreateInfo{
+                vk::ImageViewCreateFlags{},
+                output.color.image,
+                vk::ImageViewType::e2D,
+                vk::Format::eR8G8B8A8Unorm,
+                vk::ComponentMapping{},
+                vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 },
+            });
+
+            // Build, compile and record every frame, as the renderer does.
+            std::vector<double> buildSamples;
+            std::vector<double> compileSamples;
+            std::vector<double> executeSamples;
+            for (int i = 0; i < frameCount; ++i) {
+                FrameContext& frame = renderer->beginFrame();
+
+                Timer buildTimer;
+                graph.reset();
+                buildDeferredFrame(graph, output, uint32_t(config.width), uint32_t(config.height));
+                buildSamples.push_back(buildTimer.elapsedMs());
+
+                Timer compileTimer;
+                graph.compile(uint32_t(frame.frameIndex % config.framesInFlight));
+                compileSamples.push_back(compileTimer.elapsedMs());
+
+                Timer executeTimer;
+                graph.execute(frame.commandBuffer);
+                executeSamples.push_back(executeTimer.elapsedMs());
+
+                renderer->endFrame();
+            }
+            renderer->waitIdle();
+
+            RenderGraphStats stats = graph.getStats();
+            writeFile(args.getString("dot", ""), graph.dumpGraphviz());
+            writeFile(args.getString("graph-json", ""), graph.dumpJson());
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "graph");
+            json.field("device", &props.deviceName[0]);
+            json.field("width", config.width);
+            json.field("height", config.height);
+            json.field("frames", frameCount);
+            json.field("passes", stats.passes);
+            json.field("culled_passes", stats.culledPasses);
+            json.field("transient_resources", stats.transientResources);
+            json.field("image_barriers", stats.imageBarriers);
+            json.field("memory_barriers", stats.memoryBarriers);
+            json.field("barrier_batches", stats.barrierBatches);
+            json.field("aliased_bytes", uint64_t(stats.aliasedBytes));
+            json.field("unaliased_bytes", uint64_t(stats.unaliasedBytes));
+            json.field("saved_fraction", stats.unaliasedBytes > 0 ?
+                1.0 - double(stats.aliasedBytes) / double(stats.unaliasedBytes) : 0.0);
+            writeStats(json, "build_ms", computeStats(buildSamples));
+            writeStats(json, "compile_ms", computeStats(compileSamples));
+            writeStats(json, "execute_ms", computeStats(executeSamples));
+            json.endObject();
+
+            emitReport(args, json);
+
+            graph.releaseImportedView(output.view);
+            renderer->getDevice().destroyImageView(output.view);
+            renderer->getMemory().destroyImage(output.color);
+            return EXIT_SUCCESS;
+        }
+    }
+}
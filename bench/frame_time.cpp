@@ -0,0 +1,79 @@
+#include "benchmarks.h"
+#include "renderer.h"
+
+namespace bvr
+{
+    namespace bench
+    {
+        int runFrameTime(const BenchArgs& args)
+        {
+            const int frameCount = std::max(args.getInt("frames", 1000), 1);
+            const int warmupCount = std::max(args.getInt("warmup", 60), 0);
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720, [&args](RenderConfig& config) {
+                config.framesInFlight = uint32_t(std::max(args.getInt("frames-in-flight", 2), 1));
+            });
+            const RenderConfig& config = renderer->getConfig();
+
+            for (int i = 0; i < warmupCount; ++i) {
+                renderer->renderFrame();
+            }
+            renderer->waitIdle();
+            renderer->takeCompletedTimings();
+
+            std::vector<double> cpuSamples;
+            std::vector<double> gpuSamples;
+            cpuSamples.reserve(frameCount);
+            gpuSamples.reserve(frameCount);
+
+            // GPU timings are only read back once a frame context is reused, so
+            // they trail the CPU by up to framesInFlight frames.
+            auto collectGpuSamples = [&renderer, &gpuSamples]() {
+                for (const FrameTimings& timings : renderer->takeCompletedTimings()) {
+                    if (timings.gpuMs >= 0.0) {
+                        gpuSamples.push_back(timings.gpuMs);
+                    }
+                }
+            };
+
+            Timer totalTimer;
+            for (int i = 0; i < frameCount; ++i) {
+                Timer frameTimer;
+                renderer->renderFrame();
+                cpuSamples.push_back(frameTimer.elapsedMs());
+
+                collectGpuSamples();
+            }
+            renderer->waitIdle();
+            collectGpuSamples();
+            double totalMs = totalTimer.elapsedMs();
+
+            vk::PhysicalDeviceProperties props = renderer->getDeviceProperties();
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "frame");
+            json.field("device", &props.deviceName[0]);
+            json.field("width", config.width);
+            json.field("height", config.height);
+            json.field("frames", frameCount);
+            json.field("warmup_frames", warmupCount);
+            json.field("frames_in_flight", config.framesInFlight);
+            json.field("total_ms", totalMs);
+            writeStats(json, "cpu_ms", computeStats(cpuSamples));
+            json.field("gpu_timestamps", !gpuSamples.empty());
+            writeStats(json, "gpu_ms", computeStats(gpuSamples));
+            json.field("memory_within_budget", renderer->getMemory().isWithinBudget());
+            json.endObject();
+
+            emitReport(args, json);
+
+            std::string memoryStatsPath = args.getString("memory-stats", "");
+            if (!memoryStatsPath.empty()) {
+                std::ofstream file{ memoryStatsPath };
+                file << renderer->getMemory().buildStatsJson() << std::endl;
+            }
+            return EXIT_SUCCESS;
+        }
+    }
+}
@@ -0,0 +1,307 @@
+#include "benchmarks.h"
+#include "gltf_loader.h"
+#include "renderer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+            {
+                static uint32_t table[256] = {};
+                if (table[1] == 0) {
+                    for (uint32_t i = 0; i < 256; ++i) {
+                        uint32_t c = i;
+                        for (int k = 0; k < 8; ++k) {
+                            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                        }
+                        table[i] = c;
+                    }
+                }
+                crc = ~crc;
+                for (size_t i = 0; i < size; ++i) {
+                    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+                }
+                return ~crc;
+            }
+
+            void appendBe32(std::vector<uint8_t>& out, uint32_t value)
+            {
+                out.push_back(uint8_t(value >> 24));
+                out.push_back(uint8_t(value >> 16));
+                out.push_back(uint8_t(value >> 8));
+                out.push_back(uint8_t(value));
+            }
+
+            void appendPngChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+            {
+                appendBe32(out, uint32_t(data.size()));
+                size_t typeStart = out.size();
+                out.insert(out.end(), type, type + 4);
+                out.insert(out.end(), data.begin(), data.end());
+                appendBe32(out, crc32(out.data() + typeStart, out.size() - typeStart));
+            }
+
+            // RGBA8 gradient PNG with uncompressed deflate blocks, so decoding cost
+            // is dominated by the filters and the upload rather than by inflate.
+            std::vector<uint8_t> makeTestPng(uint32_t size, uint32_t seed)
+            {
+                std::vector<uint8_t> raw;
+                raw.reserve(size_t(size) * (size * 4 + 1));
+                for (uint32_t y = 0; y < size; ++y) {
+                    raw.push_back(0); // No filter
+                    for (uint32_t x = 0; x < size; ++x) {
+                        raw.push_back(uint8_t(x + seed));
+                        raw.push_back(uint8_t(y));
+                        raw.push_back(uint8_t((x ^ y) + seed * 37));
+                        raw.push_back(255);
+                    }
+                }
+
+                std::vector<uint8_t> zlib{ 0x78, 0x01 };
+                uint32_t a = 1;
+                uint32_t b = 0;
+                for (size_t pos = 0; pos < raw.size();) {
+                    size_t block = std::min<size_t>(raw.size() - pos, 65535);
+                    zlib.push_back(pos + block == raw.size() ? 1 : 0);
+                    zlib.push_back(uint8_t(block));
+                    zlib.push_back(uint8_t(block >> 8));
+                    zlib.push_back(uint8_t(~block));
+                    zlib.push_back(uint8_t(~block >> 8));
+                    for (size_t i = pos; i < pos + block; ++i) {
+                        a = (a + raw[i]) % 65521;
+                        b = (b + a) % 65521;
+                    }
+                    zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + block);
+                    pos += block;
+                }
+                appendBe32(zlib, (b << 16) | a);
+
+                std::vector<uint8_t> header;
+                appendBe32(header, size);
+                appendBe32(header, size);
+                header.insert(header.end(), { 8, 6, 0, 0, 0 }); // 8-bit RGBA, not interlaced
+
+                std::vector<uint8_t> png{ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+                appendPngChunk(png, "IHDR", header);
+                appendPngChunk(png, "IDAT", zlib);
+                appendPngChunk(png, "IEND", {});
+                return png;
+            }
+        }
+
+        void writeSyntheticGlb(const std::string& path, uint64_t targetBytes)
+        {
+            const uint32_t imageCount = 4;
+            const uint32_t imageSize = 512;
+            const uint32_t gridSize = 128; // Vertices per side
+            const uint32_t vertexCount = gridSize * gridSize;
+            const uint32_t indexCount = (gridSize - 1) * (gridSize - 1) * 6;
+            const uint64_t meshBytes = uint64_t(vertexCount) * 32 + uint64_t(indexCount) * 4;
+            const uint32_t meshCount = uint32_t(std::max<uint64_t>(targetBytes / meshBytes, 1));
+
+            std::vector<uint8_t> bin;
+            std::string views;
+            std::string accessors;
+            std::string meshes;
+            std::string nodes;
+            auto addView = [&](size_t offset, size_t length, uint32_t stride) {
+                if (!views.empty()) views += ",";
+                views += "{\"buffer\":0,\"byteOffset\":" + std::to_string(offset) + ",\"byteLength\":" + std::to_string(length);
+                if (stride != 0) views += ",\"byteStride\":" + std::to_string(stride);
+                views += "}";
+            };
+            auto addAccessor = [&](uint32_t view, uint32_t offset, uint32_t componentType, uint32_t count, const char* type) {
+                if (!accessors.empty()) accessors += ",";
+                accessors += "{\"bufferView\":" + std::to_string(view) + ",\"byteOffset\":" + std::to_string(offset) +
+                    ",\"componentType\":" + std::to_string(componentType) + ",\"count\":" + std::to_string(count) +
+                    ",\"type\":\"" + type + "\"}";
+            };
+
+            uint32_t viewCount = 0;
+            uint32_t accessorCount = 0;
+            for (uint32_t mesh = 0; mesh < meshCount; ++mesh) {
+                // Interleaved position, normal and uv.
+                size_t vertexOffset = bin.size();
+                for (uint32_t y = 0; y < gridSize; ++y) {
+                    for (uint32_t x = 0; x < gridSize; ++x) {
+                        float u = float(x) / float(gridSize - 1);
+                        float v = float(y) / float(gridSize - 1);
+                        float vertex[8] = { u, 0.0f, v, 0.0f, 1.0f, 0.0f, u, v };
+                        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(vertex);
+                        bin.insert(bin.end(), bytes, bytes + sizeof(vertex));
+                    }
+                }
+                addView(vertexOffset, size_t(vertexCount) * 32, 32);
+
+                size_t indexOffset = bin.size();
+                for (uint32_t y = 0; y + 1 < gridSize; ++y) {
+                    for (uint32_t x = 0; x + 1 < gridSize; ++x) {
+                        uint32_t i = y * gridSize + x;
+                        uint32_t quad[6] = { i, i + gridSize, i + 1, i + 1, i + gridSize, i + gridSize + 1 };
+                        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(quad);
+                        bin.insert(bin.end(), bytes, bytes + sizeof(quad));
+                    }
+                }
+                addView(indexOffset, size_t(indexCount) * 4, 0);
+
+                addAccessor(viewCount, 0, 5126, vertexCount, "VEC3");
+                addAccessor(viewCount, 12, 5126, vertexCount, "VEC3");
+                addAccessor(viewCount, 24, 5126, vertexCount, "VEC2");
+                addAccessor(viewCount + 1, 0, 5125, indexCount, "SCALAR");
+
+                if (!meshes.empty()) meshes += ",";
+                meshes += "{\"primitives\":[{\"attributes\":{\"POSITION\":" + std::to_string(accessorCount) +
+                    ",\"NORMAL\":" + std::to_string(accessorCount + 1) + ",\"TEXCOORD_0\":" + std::to_string(accessorCount + 2) +
+                    "},\"indices\":" + std::to_string(accessorCount + 3) + ",\"material\":0}]}";
+                if (!nodes.empty()) nodes += ",";
+                nodes += "{\"mesh\":" + std::to_string(mesh) + ",\"translation\":[" + std::to_string(mesh % 32) + ",0," +
+                    std::to_string(mesh / 32) + "]}";
+
+                viewCount += 2;
+                accessorCount += 4;
+            }
+
+            std::string images;
+            std::string textures;
+            for (uint32_t image = 0; image < imageCount; ++image) {
+                while (bin.size() % 4 != 0) {
+                    bin.push_back(0);
+                }
+                std::vector<uint8_t> png = makeTestPng(imageSize, image);
+                addView(bin.size(), png.size(), 0);
+                bin.insert(bin.end(), png.begin(), png.end());
+
+                if (!images.empty()) images += ",";
+                images += "{\"bufferView\":" + std::to_string(viewCount++) + ",\"mimeType\":\"image/png\"}";
+                if (!textures.empty()) textures += ",";
+                textures += "{\"source\":" + std::to_string(image) + "}";
+            }
+            while (bin.size() % 4 != 0) {
+                bin.push_back(0);
+            }
+
+            std::string sceneNodes;
+            for (uint32_t mesh = 0; mesh < meshCount; ++mesh) {
+                sceneNodes += (mesh == 0 ? "" : ",") + std::to_string(mesh);
+            }
+
+            std::string json = "{\"asset\":{\"version\":\"2.0\"},\"scene\":0,\"scenes\":[{\"nodes\":[" + sceneNodes + "]}]" +
+                ",\"nodes\":[" + nodes + "],\"meshes\":[" + meshes + "]" +
+                ",\"materials\":[{\"pbrMetallicRoughness\":{\"baseColorTexture\":{\"index\":0},\"metallicRoughnessTexture\":{\"index\":1}},\"normalTexture\":{\"index\":2}}]" +
+                ",\"textures\":[" + textures + "],\"images\":[" + images + "]" +
+                ",\"accessors\":[" + accessors + "],\"bufferViews\":[" + views + "]" +
+                ",\"buffers\":[{\"byteLength\":" + std::to_string(bin.size()) + "}]}";
+            while (json.size() % 4 != 0) {
+                json += ' ';
+            }
+
+            auto writeLe32 = [](std::ofstream& file, uint32_t value) {
+                file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+            };
+            std::ofstream file{ path, std::ios::binary };
+            writeLe32(file, 0x46546C67); // "glTF"
+            writeLe32(file, 2);
+            writeLe32(file, uint32_t(12 + 8 + json.size() + 8 + bin.size()));
+            writeLe32(file, uint32_t(json.size()));
+            writeLe32(file, 0x4E4F534A); // "JSON"
+            file.write(json.data(), std::streamsize(json.size()));
+            writeLe32(file, uint32_t(bin.size()));
+            writeLe32(file, 0x004E4942); // "BIN\0"
+            file.write(reinterpret_cast<const char*>(bin.data()), std::streamsize(bin.size()));
+            if (!file) {
+                throw std::runtime_error("Failed to write " + path);
+            }
+        }
+
+        int runGltfStream(const BenchArgs& args)
+        {
+            const double timeoutMs = double(std::max(args.getInt("timeout-ms", 60000), 1));
+
+            std::string path = args.getString("file", "");
+            const bool generated = path.empty();
+            if (generated) {
+                path = "bvr_bench_scene.glb";
+                writeSyntheticGlb(path, uint64_t(std::max(args.getInt("generate-mb", 256), 1)) << 20);
+            }
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720);
+
+            JsonWriter json;
+            {
+                GltfLoader loader{ *renderer, uint32_t(std::max(args.getInt("decode-threads", 0), 0)) };
+
+                // Keep rendering while the asset streams in, measuring every frame so
+                // hitches caused by the loader show up in the percentiles.
+                Timer timer;
+                std::shared_ptr<GltfAsset> asset = loader.load(path);
+                double firstFrameMs = -1.0;
+                std::vector<double> frameSamples;
+                while (timer.elapsedMs() < timeoutMs) {
+                    Timer frameTimer;
+                    renderer->renderFrame();
+                    frameSamples.push_back(frameTimer.elapsedMs());
+
+                    // The frame that just rendered could draw the asset.
+                    if (firstFrameMs < 0.0 && asset->isDrawable()) {
+                        firstFrameMs = timer.elapsedMs();
+                    }
+                    AssetState state = asset->getState();
+                    if (state == AssetState::eResident || state == AssetState::eFailed) {
+                        break;
+                    }
+                }
+                renderer->waitIdle();
+                renderer->takeCompletedTimings();
+
+                AssetState state = asset->getState();
+                if (state == AssetState::eFailed) {
+                    throw std::runtime_error("Loading " + path + " failed: " + asset->getError());
+                }
+                if (state != AssetState::eResident) {
+                    throw std::runtime_error("Loading " + path + " timed out");
+                }
+
+                GltfLoadStats stats = asset->getStats();
+                UploadStats uploads = renderer->getUploads().getStats();
+                const double fileMb = double(stats.fileBytes) / double(1 << 20);
+                const double uploadedMb = double(uploads.bytesUploaded) / double(1 << 20);
+
+                json.beginObject();
+                json.field("benchmark", "gltf");
+                json.field("file", path);
+                json.field("file_mb", fileMb);
+                json.field("geometry_mb", double(stats.geometryBytes) / double(1 << 20));
+                json.field("image_mb", double(stats.imageBytes) / double(1 << 20));
+                json.field("images_failed", stats.imagesFailed);
+                json.field("parse_ms", stats.parsedMs);
+                json.field("time_to_first_frame_ms", firstFrameMs);
+                json.field("time_to_resident_ms", stats.residentMs);
+                json.field("load_mb_per_s", stats.residentMs > 0.0 ? fileMb / (stats.residentMs / 1000.0) : 0.0);
+                json.field("upload_mb_per_s", stats.residentMs > 0.0 ? uploadedMb / (stats.residentMs / 1000.0) : 0.0);
+                json.field("upload_batches", uploads.batchesSubmitted);
+                json.field("staging_stalls", uploads.stagingStalls);
+                json.field("frames_while_streaming", uint64_t(frameSamples.size()));
+                writeStats(json, "frame_cpu_ms", computeStats(frameSamples));
+                json.endObject();
+
+                loader.unload(asset);
+            }
+            renderer->waitIdle();
+
+            if (generated) {
+                std::remove(path.c_str());
+            }
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
@@ -0,0 +1,154 @@
+#include "benchmarks.h"
+#include "instance_culling.h"
+#include "renderer.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <random>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            const float kSceneExtent = 500.0f;
+
+            // Small objects scattered over a plane, with one in 32 instances a
+            // tall wall that hides what's behind it from the occlusion test.
+            InstanceSet makeSyntheticInstances(uint32_t instanceCount)
+            {
+                std::mt19937 rng{ 1234 };
+                std::uniform_real_distribution<float> position{ -kSceneExtent, kSceneExtent };
+                std::uniform_real_distribution<float> unit{ 0.0f, 1.0f };
+
+                InstanceSet instances;
+                for (uint32_t i = 0; i < instanceCount; ++i) {
+                    glm::vec3 center{ position(rng), 0.0f, position(rng) };
+                    glm::vec4 color{ unit(rng), unit(rng), unit(rng), 1.0f };
+                    glm::mat4 transform = glm::translate(glm::mat4{ 1.0f }, center);
+                    if (i % 32 == 0) {
+                        transform = glm::rotate(transform, unit(rng) * 3.14159f, glm::vec3{ 0.0f, 1.0f, 0.0f });
+                        transform = glm::scale(transform, glm::vec3{ 12.0f, 8.0f, 0.5f });
+                        instances.add(transform, color * 0.5f, BuiltinMesh::eCube);
+                        continue;
+                    }
+                    transform = glm::scale(transform, glm::vec3{ 0.5f + unit(rng) });
+                    instances.add(transform, color, BuiltinMesh(i % uint32_t(BuiltinMesh::eCount)));
+                }
+                return instances;
+            }
+
+            // A camera circling the scene just above the ground, looking across it.
+            glm::mat4 makeViewProjection(uint32_t frame, float aspect)
+            {
+                float angle = float(frame) * 0.01f;
+                glm::vec3 eye{ std::cos(angle) * kSceneExtent * 0.5f, 4.0f, std::sin(angle) * kSceneExtent * 0.5f };
+                glm::mat4 view = glm::lookAt(eye, glm::vec3{ 0.0f, 2.0f, 0.0f }, glm::vec3{ 0.0f, 1.0f, 0.0f });
+                glm::mat4 projection = glm::perspectiveRH_ZO(glm::radians(60.0f), aspect, 0.1f, kSceneExtent * 2.0f);
+                // Vulkan's clip space points y down.
+                projection[1][1] *= -1.0f;
+                return projection * view;
+            }
+        }
+
+        int runGpuCulling(const BenchArgs& args)
+        {
+            const uint32_t instanceCount = uint32_t(std::max(args.getInt("instances", 100000), 1));
+            const int frameCount = std::max(args.getInt("frames", 300), 1);
+            const int warmupCount = std::max(args.getInt("warmup", 30), 0);
+            const std::string modeArg = args.getString("mode", "both");
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720);
+            const RenderConfig& config = renderer->getConfig();
+
+            InstanceCuller culler{ *renderer, makeSyntheticInstances(instanceCount) };
+            while (!culler.isReady()) {
+                renderer->renderFrame();
+            }
+            renderer->waitIdle();
+            renderer->takeCompletedTimings();
+
+            std::vector<CullMode> modes;
+            if (modeArg == "cpu" || modeArg == "both") {
+                modes.push_back(CullMode::eCpu);
+            }
+            if ((modeArg == "gpu" || modeArg == "both") && renderer->isGpuCullingSupported()) {
+                modes.push_back(CullMode::eGpu);
+            }
+
+            const float aspect = float(config.width) / float(config.height);
+            vk::PhysicalDeviceProperties props = renderer->getDeviceProperties();
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "culling");
+            json.field("device", &props.deviceName[0]);
+            json.field("instances", instanceCount);
+            json.field("frames", frameCount);
+            json.field("gpu_culling_supported", renderer->isGpuCullingSupported());
+            json.key("results");
+            json.beginArray();
+
+            for (CullMode mode : modes) {
+                std::vector<double> cpuSamples;
+                std::vector<double> gpuSamples;
+                std::vector<double> cullSamples;
+                std::vector<double> visibleSamples;
+                auto collectGpuSamples = [&renderer, &gpuSamples]() {
+                    for (const FrameTimings& timings : renderer->takeCompletedTimings()) {
+                        if (timings.gpuMs >= 0.0) {
+                            gpuSamples.push_back(timings.gpuMs);
+                        }
+                    }
+                };
+
+                // Both modes see the same camera path.
+                for (int i = 0; i < warmupCount + frameCount; ++i) {
+                    glm::mat4 viewProjection = makeViewProjection(uint32_t(i), aspect);
+                    Timer frameTimer;
+                    renderer->renderFrameGraph([&](RenderGraph& graph, FrameContext& frame, GraphResource target) {
+                        culler.addPasses(graph, frame, target, viewProjection, mode);
+                    });
+                    double frameMs = frameTimer.elapsedMs();
+
+                    if (i < warmupCount) {
+                        renderer->takeCompletedTimings();
+                        continue;
+                    }
+                    cpuSamples.push_back(frameMs);
+                    collectGpuSamples();
+
+                    CullStats stats = culler.getStats();
+                    if (mode == CullMode::eCpu) {
+                        cullSamples.push_back(stats.cpuCullMs);
+                        visibleSamples.push_back(double(stats.cpuVisible));
+                    }
+                    else if (stats.gpuVisible != UINT32_MAX) {
+                        visibleSamples.push_back(double(stats.gpuVisible));
+                    }
+                }
+                renderer->waitIdle();
+                collectGpuSamples();
+
+                json.beginObject();
+                json.field("mode", mode == CullMode::eCpu ? "cpu" : "gpu");
+                writeStats(json, "cpu_frame_ms", computeStats(cpuSamples));
+                writeStats(json, "gpu_frame_ms", computeStats(gpuSamples));
+                writeStats(json, "cpu_cull_ms", computeStats(cullSamples));
+                // The GPU path also culls occluded instances, the CPU path only
+                // tests the frustum.
+                writeStats(json, "visible_instances", computeStats(visibleSamples));
+                json.field("occlusion_tested", mode == CullMode::eGpu && culler.getStats().occlusionTested);
+                json.endObject();
+            }
+
+            json.endArray();
+            json.endObject();
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
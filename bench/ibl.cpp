@@ -0,0 +1,213 @@
+#include "benchmarks.h"
+#include "ibl.h"
+#include "mapped_file.h"
+#include "renderer.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            // A sky gradient with a small, very bright sun, written as a flat
+            // (not run length encoded) Radiance file. The sun is what makes the
+            // specular mips and the SH worth checking.
+            void writeSyntheticEnvironment(const std::string& path, uint32_t width, uint32_t height)
+            {
+                const float pi = 3.14159265f;
+                const glm::vec3 sunDirection = glm::normalize(glm::vec3{ 0.4f, 0.6f, 0.3f });
+
+                std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+                file << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << height << " +X " << width << "\n";
+                std::vector<uint8_t> scanline(size_t(width) * 4);
+                for (uint32_t y = 0; y < height; ++y) {
+                    float theta = pi * (float(y) + 0.5f) / float(height);
+                    for (uint32_t x = 0; x < width; ++x) {
+                        float phi = 2.0f * pi * ((float(x) + 0.5f) / float(width) - 0.5f);
+                        glm::vec3 direction{ std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+                        glm::vec3 color = direction.y > 0.0f
+                            ? glm::mix(glm::vec3{ 0.8f, 0.9f, 1.0f }, glm::vec3{ 0.2f, 0.4f, 0.9f }, direction.y)
+                            : glm::vec3{ 0.3f, 0.25f, 0.2f } * (1.0f + direction.y * 0.5f);
+                        if (glm::dot(direction, sunDirection) > 0.999f) {
+                            color = glm::vec3{ 2000.0f, 1800.0f, 1500.0f };
+                        }
+
+                        float maxChannel = std::max(color.r, std::max(color.g, color.b));
+                        uint8_t* texel = &scanline[x * 4];
+                        if (maxChannel < 1e-32f) {
+                            texel[0] = texel[1] = texel[2] = texel[3] = 0;
+                            continue;
+                        }
+                        int exponent;
+                        float scale = std::frexp(maxChannel, &exponent) * 256.0f / maxChannel;
+                        texel[0] = uint8_t(color.r * scale);
+                        texel[1] = uint8_t(color.g * scale);
+                        texel[2] = uint8_t(color.b * scale);
+                        texel[3] = uint8_t(exponent + 128);
+                    }
+                    file.write(reinterpret_cast<const char*>(scanline.data()), std::streamsize(scanline.size()));
+                }
+                if (!file) {
+                    throw std::runtime_error("Failed to write " + path);
+                }
+            }
+
+            void writeIblStats(JsonWriter& json, const IblStats& stats, double totalMs)
+            {
+                json.beginObject();
+                json.field("source", toString(stats.source));
+                json.field("total_ms", totalMs);
+                json.field("hash_ms", stats.hashMs);
+                json.field("decode_ms", stats.decodeMs);
+                json.field("bake_ms", stats.bakeMs);
+                json.field("cache_ms", stats.cacheMs);
+                json.field("upload_ms", stats.uploadMs);
+                json.endObject();
+            }
+
+            // Differences between two bakes of the same source, `reference`
+            // being the CPU one.
+            void writeComparison(JsonWriter& json, const IblData& data, const IblData& reference)
+            {
+                double lutMaxError = 0.0;
+                for (size_t i = 0; i < std::min(data.brdfLut.size(), reference.brdfLut.size()); ++i) {
+                    double error = std::abs(double(glm::unpackHalf1x16(data.brdfLut[i])) - double(glm::unpackHalf1x16(reference.brdfLut[i])));
+                    lutMaxError = std::max(lutMaxError, error);
+                }
+                json.field("brdf_lut_max_abs_error", lutMaxError);
+
+                // Relative to the ambient term, which all the others are bounded by.
+                double shScale = std::max(double(glm::length(reference.irradianceSH[0])), 1e-6);
+                double shMaxError = 0.0;
+                for (uint32_t i = 0; i < 9; ++i) {
+                    shMaxError = std::max(shMaxError, double(glm::length(data.irradianceSH[i] - reference.irradianceSH[i])) / shScale);
+                }
+                json.field("irradiance_sh_max_rel_error", shMaxError);
+
+                json.key("specular_mean_rel_error");
+                json.beginArray();
+                for (size_t mip = 0; mip < std::min(data.specular.size(), reference.specular.size()); ++mip) {
+                    const std::vector<uint16_t>& texels = data.specular[mip];
+                    const std::vector<uint16_t>& referenceTexels = reference.specular[mip];
+                    double sum = 0.0;
+                    size_t count = 0;
+                    for (size_t i = 0; i < std::min(texels.size(), referenceTexels.size()); ++i) {
+                        // Color channels only.
+                        if (i % 4 == 3) {
+                            continue;
+                        }
+                        double value = glm::unpackHalf1x16(texels[i]);
+                        double expected = glm::unpackHalf1x16(referenceTexels[i]);
+                        sum += std::abs(value - expected) / (std::abs(expected) + 1e-3);
+                        ++count;
+                    }
+                    json.value(count > 0 ? sum / double(count) : 0.0);
+                }
+                json.endArray();
+            }
+        }
+
+        int runImageBasedLighting(const BenchArgs& args)
+        {
+            const int warmCount = std::max(args.getInt("warm-runs", 5), 1);
+            const bool compare = !args.has("no-compare");
+
+            IblConfig iblConfig{};
+            iblConfig.brdfLutSize = uint32_t(std::max(args.getInt("lut", 128), 1));
+            iblConfig.specularSize = uint32_t(std::max(args.getInt("specular-size", 256), 1));
+            iblConfig.specularMips = uint32_t(std::max(args.getInt("mips", 6), 1));
+            iblConfig.specularSamples = uint32_t(std::max(args.getInt("samples", 256), 1));
+            iblConfig.cacheDirectory = args.getString("cache", "ibl_bench_cache");
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720);
+
+            // Every run starts cold: the cache directory is the benchmark's own.
+            std::filesystem::remove_all(iblConfig.cacheDirectory);
+            std::filesystem::create_directories(iblConfig.cacheDirectory);
+            std::string hdrPath = args.getString("hdr", "");
+            if (hdrPath.empty()) {
+                hdrPath = (std::filesystem::path{ iblConfig.cacheDirectory } / "synthetic.hdr").string();
+                writeSyntheticEnvironment(hdrPath, uint32_t(std::max(args.getInt("env-width", 2048), 2)), uint32_t(std::max(args.getInt("env-height", 1024), 1)));
+            }
+
+            vk::PhysicalDeviceProperties props = renderer->getDeviceProperties();
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "ibl");
+            json.field("device", &props.deviceName[0]);
+            json.field("source", hdrPath);
+            json.field("brdf_lut_size", iblConfig.brdfLutSize);
+            json.field("specular_size", iblConfig.specularSize);
+            json.field("specular_mips", iblConfig.specularMips);
+            json.field("specular_samples", iblConfig.specularSamples);
+
+            uint64_t key = 0;
+            {
+                Timer timer;
+                ImageBasedLighting ibl{ *renderer, hdrPath, iblConfig, IblSource::eGpu };
+                double totalMs = timer.elapsedMs();
+                key = ibl.getStats().key;
+                json.key("cold");
+                writeIblStats(json, ibl.getStats(), totalMs);
+            }
+            renderer->waitIdle();
+
+            std::vector<double> warmSamples;
+            std::vector<double> hashSamples;
+            std::vector<double> cacheSamples;
+            std::vector<double> uploadSamples;
+            uint32_t cacheHits = 0;
+            for (int i = 0; i < warmCount; ++i) {
+                Timer timer;
+                ImageBasedLighting ibl{ *renderer, hdrPath, iblConfig, IblSource::eGpu };
+                warmSamples.push_back(timer.elapsedMs());
+                IblStats stats = ibl.getStats();
+                hashSamples.push_back(stats.hashMs);
+                cacheSamples.push_back(stats.cacheMs);
+                uploadSamples.push_back(stats.uploadMs);
+                cacheHits += stats.source == IblSource::eCache ? 1 : 0;
+                renderer->waitIdle();
+            }
+            json.key("warm");
+            json.beginObject();
+            json.field("runs", warmCount);
+            json.field("cache_hits", cacheHits);
+            writeStats(json, "total_ms", computeStats(warmSamples));
+            writeStats(json, "hash_ms", computeStats(hashSamples));
+            writeStats(json, "cache_ms", computeStats(cacheSamples));
+            writeStats(json, "upload_ms", computeStats(uploadSamples));
+            json.endObject();
+
+            // The cold run's GPU bake is in the cache, the CPU reference is
+            // baked from scratch.
+            if (compare) {
+                MappedFile source{ hdrPath };
+                DecodedHdrImage environment = decodeHdr(source.data(), source.size());
+                Timer timer;
+                IblData reference = bakeIblCpu(environment, iblConfig, renderer->getJobSystem());
+                double cpuBakeMs = timer.elapsedMs();
+
+                IblData gpuData;
+                json.key("comparison");
+                json.beginObject();
+                json.field("cpu_bake_ms", cpuBakeMs);
+                if (readIblCache(iblConfig, key, gpuData)) {
+                    writeComparison(json, gpuData, reference);
+                }
+                json.endObject();
+            }
+
+            json.endObject();
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
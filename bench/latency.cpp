@@ -0,0 +1,172 @@
+#include "benchmarks.h"
+#include "renderer.h"
+
+#include <random>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            std::vector<DrawItem> makeDraws(uint32_t count)
+            {
+                std::mt19937 rng{ 1234 };
+                std::uniform_real_distribution<float> unit{ 0.0f, 1.0f };
+
+                std::vector<DrawItem> draws(count);
+                for (DrawItem& draw : draws) {
+                    draw.offsetScale = glm::vec4{ unit(rng) * 2.0f - 1.0f, unit(rng) * 2.0f - 1.0f, 0.05f + unit(rng) * 0.2f, 0.0f };
+                    draw.color = glm::vec4{ unit(rng), unit(rng), unit(rng), 1.0f };
+                }
+                return draws;
+            }
+
+            // Stands in for the game update between sampling input and
+            // submitting the frame built from it.
+            void simulateWork(int workUs)
+            {
+                Timer timer;
+                while (timer.elapsedMs() * 1e3 < double(workUs)) {
+                }
+            }
+        }
+
+        int runPresentLatency(const BenchArgs& args)
+        {
+            const int frameCount = std::max(args.getInt("frames", 300), 1);
+            const int warmupCount = std::max(args.getInt("warmup", 30), 0);
+            const uint32_t drawCount = uint32_t(std::max(args.getInt("draws", 2000), 0));
+            const int workUs = std::max(args.getInt("work-us", 2000), 0);
+            const int resizeEvery = std::max(args.getInt("resize-every", 120), 0);
+            const std::string modeArg = args.getString("present-mode", "all");
+
+            const int width = args.getInt("width", 1280);
+            const int height = args.getInt("height", 720);
+            const uint32_t framesInFlight = uint32_t(std::max(args.getInt("frames-in-flight", 2), 1));
+            const uint32_t refreshHz = uint32_t(std::max(args.getInt("refresh-hz", 60), 1));
+            const uint32_t maxFrameLatency = uint32_t(std::max(args.getInt("max-latency", 1), 1));
+
+            std::vector<PresentMode> modes;
+            for (PresentMode mode : { PresentMode::eFifo, PresentMode::eFifoRelaxed, PresentMode::eMailbox, PresentMode::eImmediate }) {
+                if (modeArg == "all" || modeArg == toString(mode)) {
+                    modes.push_back(mode);
+                }
+            }
+            if (modes.empty()) {
+                throw std::runtime_error("Unknown present mode " + modeArg);
+            }
+
+            std::vector<DrawItem> draws = makeDraws(drawCount);
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "latency");
+            json.field("width", width);
+            json.field("height", height);
+            json.field("frames", frameCount);
+            json.field("frames_in_flight", framesInFlight);
+            json.field("max_frame_latency", maxFrameLatency);
+            json.field("refresh_hz", refreshHz);
+            json.field("draws", drawCount);
+            json.field("work_us", workUs);
+            json.field("resize_every", resizeEvery);
+            json.key("results");
+            json.beginArray();
+
+            for (PresentMode mode : modes) {
+                std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, width, height, [&](RenderConfig& config) {
+                    config.framesInFlight = framesInFlight;
+                    config.swapchain.virtualSwapchain = true;
+                    config.swapchain.virtualRefreshHz = refreshHz;
+                    config.swapchain.maxFrameLatency = maxFrameLatency;
+                    config.swapchain.presentMode = mode;
+                });
+
+                struct FrameSample
+                {
+                    uint64_t frameIndex = 0;
+                    double inputToSubmitMs = 0.0;
+                    double inputToPresentMs = -1.0;
+                };
+                std::vector<FrameSample> frames;
+                std::vector<double> submitSamples;
+                std::vector<double> presentSamples;
+                std::vector<double> intervalSamples;
+                uint64_t firstMeasuredFrame = UINT64_MAX;
+                auto collectTimings = [&]() {
+                    for (const FrameTimings& timings : renderer->takeCompletedTimings()) {
+                        if (timings.frameIndex < firstMeasuredFrame) {
+                            continue;
+                        }
+                        frames.push_back(FrameSample{ timings.frameIndex, timings.inputToSubmitMs, timings.inputToPresentMs });
+                        submitSamples.push_back(timings.inputToSubmitMs);
+                        if (timings.inputToPresentMs >= 0.0) {
+                            presentSamples.push_back(timings.inputToPresentMs);
+                        }
+                    }
+                };
+
+                // Resizes alternate between the full and three quarters of the
+                // size, recreating the swapchain while frames are in flight.
+                uint32_t resizes = 0;
+                Timer intervalTimer;
+                for (int i = 0; i < warmupCount + frameCount; ++i) {
+                    if (i == warmupCount) {
+                        firstMeasuredFrame = renderer->getFrameIndex();
+                    }
+                    if (resizeEvery > 0 && i > 0 && i % resizeEvery == 0) {
+                        bool shrink = (++resizes % 2) == 1;
+                        renderer->resize(
+                            uint32_t(shrink ? width * 3 / 4 : width),
+                            uint32_t(shrink ? height * 3 / 4 : height)
+                        );
+                    }
+
+                    renderer->waitForFrameLatency();
+                    renderer->markInputSampled();
+                    simulateWork(workUs);
+                    renderer->renderFrame(draws);
+
+                    if (i >= warmupCount) {
+                        intervalSamples.push_back(intervalTimer.elapsedMs());
+                    }
+                    intervalTimer = Timer{};
+                    collectTimings();
+                }
+                renderer->waitIdle();
+                collectTimings();
+
+                const Swapchain& swapchain = *renderer->getSwapchain();
+                vk::PhysicalDeviceProperties props = renderer->getDeviceProperties();
+                json.beginObject();
+                json.field("device", &props.deviceName[0]);
+                json.field("present_mode", toString(swapchain.getPresentMode()));
+                writeStats(json, "input_to_submit_ms", computeStats(submitSamples));
+                writeStats(json, "input_to_present_ms", computeStats(presentSamples));
+                writeStats(json, "frame_interval_ms", computeStats(intervalSamples));
+                json.field("frames_presented", uint32_t(presentSamples.size()));
+                json.field("recreates", swapchain.getRecreateCount());
+
+                json.key("per_frame");
+                json.beginArray();
+                for (const FrameSample& sample : frames) {
+                    json.beginObject();
+                    json.field("frame", sample.frameIndex - firstMeasuredFrame);
+                    json.field("input_to_submit_ms", sample.inputToSubmitMs);
+                    json.field("input_to_present_ms", sample.inputToPresentMs);
+                    json.endObject();
+                }
+                json.endArray();
+                json.endObject();
+            }
+
+            json.endArray();
+            json.endObject();
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
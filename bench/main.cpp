@@ -0,0 +1,68 @@
+#include "benchmarks.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+namespace
+{
+    struct BenchEntry
+    {
+        const char* name;
+        int (*run)(const bvr::bench::BenchArgs& args);
+        const char* usage;
+    };
+
+    const BenchEntry s_benchmarks[] = {
+        { "frame", bvr::bench::runFrameTime, "[--frames N] [--warmup N] [--width W] [--height H] [--frames-in-flight N] [--device index|name] [--validation] [--memory-stats file.json] [--out file.json]" },
+        { "record", bvr::bench::runRecordScaling, "[--draws N] [--max-threads N] [--frames N] [--warmup N] [--device index|name] [--validation] [--out file.json]" },
+        { "gltf", bvr::bench::runGltfStream, "[--file scene.glb | --generate-mb N] [--decode-threads N] [--timeout-ms N] [--device index|name] [--validation] [--out file.json]" },
+        { "graph", bvr::bench::runFrameGraph, "[--frames N] [--width W] [--height H] [--dot file.dot] [--graph-json file.json] [--device index|name] [--validation] [--out file.json]" },
+        { "culling", bvr::bench::runGpuCulling, "[--instances N] [--mode cpu|gpu|both] [--frames N] [--warmup N] [--width W] [--height H] [--device index|name] [--validation] [--out file.json]" },
+        { "clusters", bvr::bench::runClusteredLighting, "[--min-lights N] [--max-lights N] [--mode cpu|gpu|both] [--frames N] [--warmup N] [--validate] [--width W] [--height H] [--device index|name] [--validation] [--out file.json]" },
+        { "profiler", bvr::bench::runProfilerOverhead, "[--draws N] [--frames N] [--rounds N] [--warmup N] [--trace file.json] [--device index|name] [--validation] [--out file.json]" },
+        { "bindless", bvr::bench::runBindlessMaterials, "[--materials N] [--draws N] [--mode set|bindless|both] [--frames N] [--warmup N] [--device index|name] [--validation] [--out file.json]" },
+        { "shadows", bvr::bench::runShadowAtlas, "[--lights N] [--static-casters N] [--dynamic-casters N] [--moving-lights N] [--budget N] [--atlas N] [--mode cached|uncached|both] [--frames N] [--warmup N] [--width W] [--height H] [--device index|name] [--validation] [--out file.json]" },
+        { "ibl", bvr::bench::runImageBasedLighting, "[--hdr file.hdr] [--env-width W] [--env-height H] [--lut N] [--specular-size N] [--mips N] [--samples N] [--warm-runs N] [--cache dir] [--no-compare] [--device index|name] [--validation] [--out file.json]" },
+        { "package", bvr::bench::runAssetPackage, "[--file scene.glb | --generate-mb N] [--package file.bvrpkg] [--runs N] [--uncompressed] [--cook-threads N] [--decode-threads N] [--timeout-ms N] [--device index|name] [--validation] [--out file.json]" },
+        { "taa", bvr::bench::runTemporalAntiAliasing, "[--objects N] [--extra-objects N] [--moving-percent N] [--target-us N] [--scale-percent N] [--min-scale-percent N] [--no-motion-blur] [--frames N] [--warmup N] [--width W] [--height H] [--device index|name] [--validation] [--out file.json]" },
+        { "latency", bvr::bench::runPresentLatency, "[--present-mode fifo|fifo_relaxed|mailbox|immediate|all] [--max-latency N] [--frames-in-flight N] [--refresh-hz N] [--work-us N] [--draws N] [--resize-every N] [--frames N] [--warmup N] [--width W] [--height H] [--device index|name] [--validation] [--out file.json]" },
+        { "shaders", bvr::bench::runShaderReload, "[--source dir] [--work-dir dir] [--compiler path] [--edits N] [--frames N] [--draws N] [--timeout-ms N] [--width W] [--height H] [--device index|name] [--validation] [--out file.json]" },
+        { "startup", bvr::bench::runPipelineStartup, "[--pipelines N] [--cache file] [--async] [--device index|name] [--validation] [--out file.json]" },
+    };
+
+    void printUsage()
+    {
+        std::cerr << "Usage: BVRBench <benchmark> [options]" << std::endl;
+        for (const BenchEntry& entry : s_benchmarks) {
+            std::cerr << "  " << entry.name << " " << entry.usage << std::endl;
+        }
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    for (const BenchEntry& entry : s_benchmarks) {
+        if (strcmp(entry.name, argv[1]) != 0) {
+            continue;
+        }
+
+        try {
+            return entry.run(bvr::bench::BenchArgs{ argc - 2, argv + 2 });
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    printUsage();
+    return EXIT_FAILURE;
+}
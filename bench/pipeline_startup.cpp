@@ -0,0 +1,115 @@
+#include "benchmarks.h"
+#include "renderer.h"
+
+#include <cstdio>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            struct StartupPass
+            {
+                double initMs = 0.0;
+                double pipelinesMs = 0.0;
+                // Frames rendered while the variants compiled in the background.
+                uint32_t asyncFrames = 0;
+                SampleStats asyncFrameMs{};
+                PipelineCacheStats cache{};
+            };
+
+            StartupPass runPass(const BenchArgs& args, const std::string& cachePath, uint32_t pipelineCount, bool async)
+            {
+                StartupPass pass{};
+                std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720, [&cachePath](RenderConfig& config) {
+                    config.pipelineCachePath = cachePath;
+                });
+                pass.initMs = renderer->getStartupMs();
+
+                Timer timer;
+                if (async) {
+                    std::vector<std::shared_ptr<const AsyncPipeline>> pending;
+                    for (uint32_t variant = 1; variant <= pipelineCount; ++variant) {
+                        pending.push_back(renderer->compileScenePipelineVariantAsync(variant));
+                    }
+
+                    std::vector<double> frameSamples;
+                    auto allReady = [&pending]() {
+                        for (const std::shared_ptr<const AsyncPipeline>& pipeline : pending) {
+                            if (!pipeline->isReady()) {
+                                return false;
+                            }
+                        }
+                        return true;
+                    };
+                    while (!allReady()) {
+                        Timer frameTimer;
+                        renderer->renderFrame();
+                        frameSamples.push_back(frameTimer.elapsedMs());
+                    }
+                    pass.asyncFrames = uint32_t(frameSamples.size());
+                    pass.asyncFrameMs = computeStats(frameSamples);
+                }
+                else {
+                    for (uint32_t variant = 1; variant <= pipelineCount; ++variant) {
+                        renderer->getScenePipelineVariant(variant);
+                    }
+                }
+                pass.pipelinesMs = timer.elapsedMs();
+
+                renderer->waitIdle();
+                pass.cache = renderer->getPipelines().getStats();
+                return pass;
+            }
+
+            void writePass(JsonWriter& json, const char* name, const StartupPass& pass, bool async)
+            {
+                json.key(name);
+                json.beginObject();
+                json.field("cache", toString(pass.cache.load));
+                json.field("cache_bytes", uint64_t(pass.cache.diskBytes));
+                json.field("init_ms", pass.initMs);
+                json.field("pipelines_ms", pass.pipelinesMs);
+                json.field("total_ms", pass.initMs + pass.pipelinesMs);
+                json.field("compile_ms", pass.cache.compileMs);
+                json.field("pipeline_misses", pass.cache.pipelineMisses);
+                json.field("pipeline_hits", pass.cache.pipelineHits);
+                if (async) {
+                    json.field("frames_while_compiling", pass.asyncFrames);
+                    writeStats(json, "frame_cpu_ms", pass.asyncFrameMs);
+                }
+                json.endObject();
+            }
+        }
+
+        int runPipelineStartup(const BenchArgs& args)
+        {
+            const uint32_t pipelineCount = uint32_t(std::max(args.getInt("pipelines", 256), 0));
+            const std::string cachePath = args.getString("cache", "bvr_bench_pipeline_cache.bin");
+            const bool async = args.has("async");
+
+            // The first pass starts without a cache file and writes it on shutdown,
+            // the second starts from it.
+            std::remove(cachePath.c_str());
+            StartupPass cold = runPass(args, cachePath, pipelineCount, async);
+            StartupPass warm = runPass(args, cachePath, pipelineCount, async);
+
+            double coldTotal = cold.initMs + cold.pipelinesMs;
+            double warmTotal = warm.initMs + warm.pipelinesMs;
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "startup");
+            json.field("pipelines", pipelineCount + 1);
+            json.field("async", async);
+            writePass(json, "cold", cold, async);
+            writePass(json, "warm", warm, async);
+            json.field("speedup", warmTotal > 0.0 ? coldTotal / warmTotal : 0.0);
+            json.endObject();
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
@@ -0,0 +1,130 @@
+#include "benchmarks.h"
+#include "profiler.h"
+#include "renderer.h"
+
+#include <random>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            std::vector<DrawItem> makeTriangles(uint32_t drawCount)
+            {
+                std::mt19937 rng{ 1234 };
+                std::uniform_real_distribution<float> position{ -1.0f, 1.0f };
+                std::uniform_real_distribution<float> unit{ 0.0f, 1.0f };
+
+                std::vector<DrawItem> draws(drawCount);
+                for (DrawItem& draw : draws) {
+                    float scale = 0.002f + 0.01f * unit(rng);
+                    draw.offsetScale = glm::vec4{ position(rng), position(rng), scale, scale };
+                    draw.color = glm::vec4{ unit(rng), unit(rng), unit(rng), 1.0f };
+                }
+                return draws;
+            }
+
+            struct FrameSamples
+            {
+                std::vector<double> cpu;
+                std::vector<double> gpu;
+            };
+
+            void renderFrames(Renderer& renderer, const std::vector<DrawItem>& draws, int frameCount, FrameSamples& samples)
+            {
+                auto collectGpuSamples = [&renderer, &samples]() {
+                    for (const FrameTimings& timings : renderer.takeCompletedTimings()) {
+                        if (timings.gpuMs >= 0.0) {
+                            samples.gpu.push_back(timings.gpuMs);
+                        }
+                    }
+                };
+
+                for (int i = 0; i < frameCount; ++i) {
+                    Timer frameTimer;
+                    renderer.renderFrame(draws);
+                    samples.cpu.push_back(frameTimer.elapsedMs());
+                    collectGpuSamples();
+                }
+                renderer.waitIdle();
+                collectGpuSamples();
+            }
+        }
+
+        int runProfilerOverhead(const BenchArgs& args)
+        {
+            const uint32_t drawCount = uint32_t(std::max(args.getInt("draws", 10000), 0));
+            const int frameCount = std::max(args.getInt("frames", 200), 1);
+            const int warmupCount = std::max(args.getInt("warmup", 30), 0);
+            const int roundCount = std::max(args.getInt("rounds", 4), 1);
+            const std::string tracePath = args.getString("trace", "");
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720);
+
+            std::vector<DrawItem> draws = makeTriangles(drawCount);
+            FrameSamples warmup;
+            renderFrames(*renderer, draws, warmupCount, warmup);
+
+            // Alternating rounds, so clock and thermal drift hit both sides alike.
+            FrameSamples disabled;
+#if BVR_PROFILE
+            FrameSamples enabled;
+            size_t eventCount = 0;
+            Profiler& profiler = Profiler::get();
+#endif
+            for (int round = 0; round < roundCount; ++round) {
+#if BVR_PROFILE
+                profiler.setEnabled(false);
+#endif
+                renderFrames(*renderer, draws, frameCount, disabled);
+#if BVR_PROFILE
+                // Only the last round is kept for the trace.
+                profiler.clear();
+                profiler.setEnabled(true);
+                renderFrames(*renderer, draws, frameCount, enabled);
+                profiler.setEnabled(false);
+                eventCount = profiler.getEventCount();
+#endif
+            }
+
+            vk::PhysicalDeviceProperties props = renderer->getDeviceProperties();
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "profiler");
+            json.field("device", &props.deviceName[0]);
+            json.field("draws", drawCount);
+            json.field("frames", frameCount * roundCount);
+            json.field("profiler_compiled", bool(BVR_PROFILE));
+            json.key("disabled");
+            json.beginObject();
+            SampleStats disabledCpu = computeStats(disabled.cpu);
+            writeStats(json, "cpu_frame_ms", disabledCpu);
+            writeStats(json, "gpu_frame_ms", computeStats(disabled.gpu));
+            json.endObject();
+#if BVR_PROFILE
+            SampleStats enabledCpu = computeStats(enabled.cpu);
+            SampleStats enabledGpu = computeStats(enabled.gpu);
+            json.key("enabled");
+            json.beginObject();
+            writeStats(json, "cpu_frame_ms", enabledCpu);
+            writeStats(json, "gpu_frame_ms", enabledGpu);
+            json.field("events_per_frame", double(eventCount) / double(frameCount));
+            json.endObject();
+            json.field("cpu_overhead_ms", enabledCpu.p50 - disabledCpu.p50);
+            json.field("cpu_overhead_percent", disabledCpu.p50 > 0.0 ? (enabledCpu.p50 / disabledCpu.p50 - 1.0) * 100.0 : 0.0);
+            json.field("gpu_overhead_ms", enabledGpu.p50 - computeStats(disabled.gpu).p50);
+
+            if (!tracePath.empty()) {
+                profiler.writeChromeTrace(tracePath);
+                json.field("trace", tracePath);
+            }
+#endif
+            json.endObject();
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
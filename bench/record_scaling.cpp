@@ -0,0 +1,86 @@
+#include "benchmarks.h"
+#include "renderer.h"
+
+#include <random>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            std::vector<DrawItem> makeSyntheticScene(uint32_t drawCount)
+            {
+                std::mt19937 rng{ 1234 };
+                std::uniform_real_distribution<float> position{ -1.0f, 1.0f };
+                std::uniform_real_distribution<float> unit{ 0.0f, 1.0f };
+
+                std::vector<DrawItem> draws(drawCount);
+                for (DrawItem& draw : draws) {
+                    float scale = 0.002f + 0.01f * unit(rng);
+                    draw.offsetScale = glm::vec4{ position(rng), position(rng), scale, scale };
+                    draw.color = glm::vec4{ unit(rng), unit(rng), unit(rng), 1.0f };
+                }
+                return draws;
+            }
+        }
+
+        int runRecordScaling(const BenchArgs& args)
+        {
+            const uint32_t drawCount = uint32_t(std::max(args.getInt("draws", 100000), 1));
+            const int frameCount = std::max(args.getInt("frames", 30), 1);
+            const int warmupCount = std::max(args.getInt("warmup", 5), 0);
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720, [&args](RenderConfig& config) {
+                config.workerThreads = uint32_t(std::max(args.getInt("max-threads", 0), 0));
+            });
+
+            const std::vector<DrawItem> draws = makeSyntheticScene(drawCount);
+            const uint32_t maxThreads = renderer->getJobSystem().getThreadCount();
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "record");
+            json.field("draws", drawCount);
+            json.field("frames", frameCount);
+            json.field("max_threads", maxThreads);
+            json.key("results");
+            json.beginArray();
+
+            double singleThreadedP50 = 0.0;
+            for (uint32_t threads = 1; threads <= maxThreads; ++threads) {
+                renderer->setRecordThreadCount(threads);
+
+                for (int i = 0; i < warmupCount; ++i) {
+                    renderer->renderFrame(draws);
+                }
+
+                std::vector<double> recordSamples;
+                recordSamples.reserve(frameCount);
+                for (int i = 0; i < frameCount; ++i) {
+                    renderer->renderFrame(draws);
+                    recordSamples.push_back(renderer->getLastRecordCpuMs());
+                }
+                renderer->waitIdle();
+                renderer->takeCompletedTimings();
+
+                SampleStats stats = computeStats(recordSamples);
+                if (threads == 1) {
+                    singleThreadedP50 = stats.p50;
+                }
+
+                json.beginObject();
+                json.field("threads", threads);
+                writeStats(json, "record_ms", stats);
+                json.field("speedup", stats.p50 > 0.0 ? singleThreadedP50 / stats.p50 : 0.0);
+                json.endObject();
+            }
+
+            json.endArray();
+            json.endObject();
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
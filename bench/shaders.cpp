@@ -0,0 +1,212 @@
+#include "benchmarks.h"
+#include "renderer.h"
+#include "shader_compiler.h"
+#include "shader_reflection.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            // What the edits rewrite in triangle.frag.
+            const char* const kEditLine = "outColor = inColor;";
+
+            std::vector<DrawItem> makeDraws(uint32_t count)
+            {
+                std::mt19937 rng{ 1234 };
+                std::uniform_real_distribution<float> unit{ 0.0f, 1.0f };
+
+                std::vector<DrawItem> draws(count);
+                for (DrawItem& draw : draws) {
+                    draw.offsetScale = glm::vec4{ unit(rng) * 2.0f - 1.0f, unit(rng) * 2.0f - 1.0f, 0.05f + unit(rng) * 0.2f, 0.0f };
+                    draw.color = glm::vec4{ unit(rng), unit(rng), unit(rng), 1.0f };
+                }
+                return draws;
+            }
+
+            std::string readText(const std::string& path)
+            {
+                std::ifstream file{ path, std::ios::binary };
+                if (!file) {
+                    throw std::runtime_error("Failed to read " + path);
+                }
+                std::ostringstream stream;
+                stream << file.rdbuf();
+                return stream.str();
+            }
+
+            // Written in one go, like an editor saving in place.
+            void writeText(const std::string& path, const std::string& text)
+            {
+                std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+                file << text;
+            }
+
+            bool isShaderSource(const std::filesystem::path& path)
+            {
+                std::string extension = path.extension().string();
+                return extension == ".vert" || extension == ".frag" || extension == ".comp" || extension == ".glsl";
+            }
+        }
+
+        int runShaderReload(const BenchArgs& args)
+        {
+            const std::string sourceDirectory = args.getString("source", "shaders");
+            const std::string workDirectory = args.getString("work-dir", "shader_bench");
+            const int editCount = std::max(args.getInt("edits", 10), 1);
+            const int frameCount = std::max(args.getInt("frames", 120), 1);
+            const int timeoutMs = std::max(args.getInt("timeout-ms", 5000), 1);
+            const uint32_t drawCount = uint32_t(std::max(args.getInt("draws", 2000), 0));
+
+            // Every run starts cold: the sources and the SPIR-V cache are the
+            // benchmark's own copies.
+            std::filesystem::path workPath{ workDirectory };
+            std::filesystem::remove_all(workPath);
+            std::filesystem::create_directories(workPath / "src");
+            std::vector<std::string> sources;
+            for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator{ sourceDirectory }) {
+                if (!entry.is_regular_file() || !isShaderSource(entry.path())) {
+                    continue;
+                }
+                std::filesystem::path copy = workPath / "src" / entry.path().filename();
+                std::filesystem::copy_file(entry.path(), copy);
+                if (entry.path().extension() != ".glsl") {
+                    sources.push_back(copy.string());
+                }
+            }
+            const std::string editPath = (workPath / "src" / "triangle.frag").string();
+            const std::string original = readText(editPath);
+            const size_t editOffset = original.find(kEditLine);
+            if (editOffset == std::string::npos) {
+                throw std::runtime_error(editPath + " has nothing to edit");
+            }
+
+            ShaderLibraryConfig libraryConfig{};
+            libraryConfig.hotReload = true;
+            libraryConfig.sourceDirectory = (workPath / "src").string();
+            libraryConfig.compiler.compilerPath = args.getString("compiler", libraryConfig.compiler.compilerPath);
+            libraryConfig.compiler.cacheDirectory = (workPath / "cache").string();
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "shaders");
+            json.field("shaders", uint32_t(sources.size()));
+            json.field("edits", editCount);
+            json.field("draws", drawCount);
+
+            // Compiling every shader twice: from scratch, then from the cache.
+            {
+                ShaderCompiler compiler{ libraryConfig.compiler };
+                double reflectMs = 0.0;
+                uint32_t failures = 0;
+                uint32_t cacheHits = 0;
+                for (int pass = 0; pass < 2; ++pass) {
+                    Timer timer;
+                    for (const std::string& source : sources) {
+                        CompiledShader shader = compiler.compile(source);
+                        failures += shader.isValid() ? 0 : 1;
+                        cacheHits += shader.cacheHit ? 1 : 0;
+                        if (pass == 0 && shader.isValid()) {
+                            Timer reflectTimer;
+                            reflectSpirv(shader.spirv.data(), shader.spirv.size() * sizeof(uint32_t));
+                            reflectMs += reflectTimer.elapsedMs();
+                        }
+                    }
+                    json.field(pass == 0 ? "cold_compile_ms" : "cached_compile_ms", timer.elapsedMs());
+                }
+                json.field("reflect_ms", reflectMs);
+                json.field("compile_failures", failures);
+                json.field("cache_hits", cacheHits);
+            }
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720, [&libraryConfig](RenderConfig& config) {
+                config.shaders = libraryConfig;
+            });
+            ShaderLibrary& shaders = renderer->getShaders();
+            std::vector<DrawItem> draws = makeDraws(drawCount);
+
+            vk::PhysicalDeviceProperties props = renderer->getDeviceProperties();
+            json.field("device", &props.deviceName[0]);
+
+            std::vector<double> baselineSamples;
+            for (int i = 0; i < frameCount; ++i) {
+                Timer timer;
+                renderer->renderFrame(draws);
+                baselineSamples.push_back(timer.elapsedMs());
+            }
+
+            // Each edit changes the generated code, so the cache can't serve it,
+            // and renders until the rebuilt pipeline is in use. Frames keep
+            // rendering with the previous one meanwhile.
+            std::vector<double> reloadFrameSamples;
+            std::vector<double> editToSwapSamples;
+            std::vector<double> changeToSwapSamples;
+            uint32_t timeouts = 0;
+            for (int edit = 0; edit < editCount; ++edit) {
+                std::string text = original;
+                std::string editLine = "outColor = inColor * " + std::to_string(1.0 - double(edit + 1) / 1024.0) + ";";
+                text.replace(editOffset, strlen(kEditLine), editLine);
+
+                uint32_t reloads = shaders.getStats().reloads;
+                Timer editTimer;
+                writeText(editPath, text);
+                for (;;) {
+                    Timer timer;
+                    renderer->renderFrame(draws);
+                    reloadFrameSamples.push_back(timer.elapsedMs());
+                    if (shaders.getStats().reloads != reloads) {
+                        editToSwapSamples.push_back(editTimer.elapsedMs());
+                        changeToSwapSamples.push_back(shaders.getStats().lastReloadMs);
+                        break;
+                    }
+                    if (editTimer.elapsedMs() > double(timeoutMs)) {
+                        ++timeouts;
+                        break;
+                    }
+                }
+            }
+
+            // A broken shader must leave the last good pipeline in place.
+            ShaderLibraryStats beforeError = shaders.getStats();
+            writeText(editPath, original + "\nthis does not compile\n");
+            Timer errorTimer;
+            while (shaders.getStats().failures == beforeError.failures && errorTimer.elapsedMs() < double(timeoutMs)) {
+                renderer->renderFrame(draws);
+            }
+            renderer->renderFrame(draws);
+            renderer->waitIdle();
+
+            ShaderLibraryStats stats = shaders.getStats();
+            writeStats(json, "baseline_frame_ms", computeStats(baselineSamples));
+            writeStats(json, "reload_frame_ms", computeStats(reloadFrameSamples));
+            writeStats(json, "edit_to_swap_ms", computeStats(editToSwapSamples));
+            writeStats(json, "change_to_swap_ms", computeStats(changeToSwapSamples));
+            json.field("reloads", stats.reloads);
+            json.field("timeouts", timeouts);
+            bool errorReported = stats.failures != beforeError.failures;
+            json.field("error_reported", errorReported);
+            json.field("error_kept_pipeline", stats.reloads == beforeError.reloads);
+            json.field("compiles", stats.compiles);
+            json.field("compile_ms", stats.compileMs);
+
+            json.key("per_edit_ms");
+            json.beginArray();
+            for (double sample : editToSwapSamples) {
+                json.value(sample);
+            }
+            json.endArray();
+            json.endObject();
+
+            emitReport(args, json);
+            return timeouts == 0 && errorReported ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+}
@@ -0,0 +1,229 @@
+#include "benchmarks.h"
+#include "renderer.h"
+#include "shadow_atlas.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <random>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            const float kSceneExtent = 120.0f;
+
+            struct ShadowScene
+            {
+                std::vector<Light> lights;
+                std::vector<glm::mat4> staticCasters;
+                // Orbit of each dynamic caster: center in xyz, radius in w.
+                std::vector<glm::vec4> orbits;
+            };
+
+            // Lights hanging over a field of static casters, two in three of
+            // them point lights, with dynamic casters circling among them.
+            ShadowScene makeScene(uint32_t lightCount, uint32_t staticCount, uint32_t dynamicCount)
+            {
+                std::mt19937 rng{ 1234 };
+                std::uniform_real_distribution<float> position{ -kSceneExtent, kSceneExtent };
+                std::uniform_real_distribution<float> unit{ 0.0f, 1.0f };
+
+                ShadowScene scene;
+                for (uint32_t i = 0; i < lightCount; ++i) {
+                    glm::vec3 center{ position(rng), 4.0f + unit(rng) * 6.0f, position(rng) };
+                    glm::vec3 color{ unit(rng), unit(rng), unit(rng) };
+                    float range = 8.0f + unit(rng) * 12.0f;
+                    if (i % 3 == 2) {
+                        glm::vec3 direction = glm::normalize(glm::vec3{ unit(rng) - 0.5f, -1.0f, unit(rng) - 0.5f });
+                        scene.lights.push_back(makeSpotLight(center, range, direction, glm::radians(30.0f + unit(rng) * 20.0f), color, 4.0f));
+                    }
+                    else {
+                        scene.lights.push_back(makePointLight(center, range, color, 4.0f));
+                    }
+                }
+
+                // The ground, then the static casters standing on it.
+                glm::mat4 ground = glm::translate(glm::mat4{ 1.0f }, glm::vec3{ 0.0f, -0.5f, 0.0f });
+                scene.staticCasters.push_back(glm::scale(ground, glm::vec3{ kSceneExtent * 1.2f, 0.5f, kSceneExtent * 1.2f }));
+                for (uint32_t i = 0; i < staticCount; ++i) {
+                    float scale = 0.5f + unit(rng) * 1.5f;
+                    glm::mat4 transform = glm::translate(glm::mat4{ 1.0f }, glm::vec3{ position(rng), scale, position(rng) });
+                    transform = glm::rotate(transform, unit(rng) * 3.14159f, glm::vec3{ 0.0f, 1.0f, 0.0f });
+                    scene.staticCasters.push_back(glm::scale(transform, glm::vec3{ scale }));
+                }
+                for (uint32_t i = 0; i < dynamicCount; ++i) {
+                    scene.orbits.push_back(glm::vec4{ position(rng), 1.0f + unit(rng) * 2.0f, position(rng), 2.0f + unit(rng) * 4.0f });
+                }
+                return scene;
+            }
+
+            glm::mat4 orbitTransform(const glm::vec4& orbit, uint32_t index, uint32_t frame)
+            {
+                float angle = float(frame) * 0.05f + float(index);
+                glm::vec3 center = glm::vec3(orbit) + glm::vec3{ std::cos(angle), 0.0f, std::sin(angle) } * orbit.w;
+                return glm::translate(glm::mat4{ 1.0f }, center);
+            }
+
+            // A camera slowly circling the middle of the scene, looking down at it.
+            ShadowCamera makeCamera(uint32_t frame, const RenderConfig& config)
+            {
+                float angle = float(frame) * 0.002f;
+                glm::vec3 eye{ std::cos(angle) * kSceneExtent * 0.4f, 25.0f, std::sin(angle) * kSceneExtent * 0.4f };
+
+                ShadowCamera camera{};
+                camera.view = glm::lookAt(eye, glm::vec3{ 0.0f }, glm::vec3{ 0.0f, 1.0f, 0.0f });
+                camera.projection = glm::perspectiveRH_ZO(glm::radians(60.0f), float(config.width) / float(config.height), camera.nearZ, kSceneExtent * 3.0f);
+                // Vulkan's clip space points y down.
+                camera.projection[1][1] *= -1.0f;
+                camera.viewportHeight = uint32_t(config.height);
+                return camera;
+            }
+        }
+
+        int runShadowAtlas(const BenchArgs& args)
+        {
+            const uint32_t lightCount = uint32_t(std::max(args.getInt("lights", 256), 0));
+            const uint32_t staticCount = uint32_t(std::max(args.getInt("static-casters", 20000), 0));
+            const uint32_t dynamicCount = uint32_t(std::max(args.getInt("dynamic-casters", 32), 0));
+            const uint32_t movingLights = uint32_t(std::max(args.getInt("moving-lights", 4), 0));
+            const int frameCount = std::max(args.getInt("frames", 300), 1);
+            const int warmupCount = std::max(args.getInt("warmup", 30), 0);
+            const std::string modeArg = args.getString("mode", "both");
+
+            ShadowConfig shadowConfig{};
+            shadowConfig.atlasSize = uint32_t(std::max(args.getInt("atlas", 8192), 1));
+            shadowConfig.tileUpdateBudget = uint32_t(std::max(args.getInt("budget", 16), 0));
+            shadowConfig.maxLights = std::max(lightCount, 1u);
+            shadowConfig.maxCasters = staticCount + dynamicCount + 1;
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1280, 720);
+            const RenderConfig& config = renderer->getConfig();
+
+            ShadowScene scene = makeScene(lightCount, staticCount, dynamicCount);
+
+            std::vector<bool> modes;
+            if (modeArg == "cached" || modeArg == "both") {
+                modes.push_back(true);
+            }
+            if (modeArg == "uncached" || modeArg == "both") {
+                modes.push_back(false);
+            }
+
+            vk::PhysicalDeviceProperties props = renderer->getDeviceProperties();
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "shadows");
+            json.field("device", &props.deviceName[0]);
+            json.field("lights", lightCount);
+            json.field("static_casters", staticCount);
+            json.field("dynamic_casters", dynamicCount);
+            json.field("moving_lights", movingLights);
+            json.field("atlas_size", shadowConfig.atlasSize);
+            json.field("tile_update_budget", shadowConfig.tileUpdateBudget);
+            json.field("frames", frameCount);
+            json.key("results");
+            json.beginArray();
+
+            for (bool cached : modes) {
+                shadowConfig.disableCaching = !cached;
+                ShadowAtlas atlas{ *renderer, shadowConfig };
+                while (!atlas.isReady()) {
+                    renderer->renderFrame();
+                }
+                renderer->waitIdle();
+                renderer->takeCompletedTimings();
+
+                std::vector<ShadowLightHandle> lights;
+                for (const Light& light : scene.lights) {
+                    lights.push_back(atlas.addLight(light));
+                }
+                for (const glm::mat4& transform : scene.staticCasters) {
+                    atlas.addCaster(transform, BuiltinMesh::eCube);
+                }
+                std::vector<ShadowCasterHandle> dynamicCasters;
+                for (uint32_t i = 0; i < dynamicCount; ++i) {
+                    dynamicCasters.push_back(atlas.addCaster(orbitTransform(scene.orbits[i], i, 0), BuiltinMesh::eOctahedron));
+                }
+
+                std::vector<double> cpuSamples;
+                std::vector<double> gpuSamples;
+                std::vector<double> updateSamples;
+                std::vector<double> tileSamples;
+                std::vector<double> cascadeSamples;
+                std::vector<double> deferredSamples;
+                std::vector<double> casterDrawSamples;
+                std::vector<double> occupancySamples;
+                std::vector<double> shadowedSamples;
+                auto collectGpuSamples = [&renderer, &gpuSamples]() {
+                    for (const FrameTimings& timings : renderer->takeCompletedTimings()) {
+                        if (timings.gpuMs >= 0.0) {
+                            gpuSamples.push_back(timings.gpuMs);
+                        }
+                    }
+                };
+
+                // Both modes see the same animation.
+                for (int i = 0; i < warmupCount + frameCount; ++i) {
+                    uint32_t frameNumber = uint32_t(i);
+                    for (uint32_t j = 0; j < dynamicCount; ++j) {
+                        atlas.moveCaster(dynamicCasters[j], orbitTransform(scene.orbits[j], j, frameNumber));
+                    }
+                    for (uint32_t j = 0; j < std::min(movingLights, lightCount); ++j) {
+                        Light light = scene.lights[j];
+                        float angle = float(frameNumber) * 0.03f + float(j);
+                        light.positionRange += glm::vec4{ std::cos(angle) * 3.0f, 0.0f, std::sin(angle) * 3.0f, 0.0f };
+                        atlas.updateLight(lights[j], light);
+                    }
+                    ShadowCamera camera = makeCamera(frameNumber, config);
+
+                    Timer frameTimer;
+                    renderer->renderFrameGraph([&](RenderGraph& graph, FrameContext& frame, GraphResource) {
+                        atlas.addPasses(graph, frame, camera);
+                    });
+                    double frameMs = frameTimer.elapsedMs();
+
+                    if (i < warmupCount) {
+                        renderer->takeCompletedTimings();
+                        continue;
+                    }
+                    cpuSamples.push_back(frameMs);
+                    collectGpuSamples();
+
+                    ShadowStats stats = atlas.getStats();
+                    updateSamples.push_back(stats.cpuUpdateMs);
+                    tileSamples.push_back(double(stats.tilesUpdated));
+                    cascadeSamples.push_back(double(stats.cascadesUpdated));
+                    deferredSamples.push_back(double(stats.tilesDeferred));
+                    casterDrawSamples.push_back(double(stats.casterDraws));
+                    occupancySamples.push_back(double(stats.atlasOccupancy));
+                    shadowedSamples.push_back(double(stats.shadowedLights));
+                }
+                renderer->waitIdle();
+                collectGpuSamples();
+
+                json.beginObject();
+                json.field("mode", cached ? "cached" : "uncached");
+                writeStats(json, "cpu_frame_ms", computeStats(cpuSamples));
+                writeStats(json, "gpu_frame_ms", computeStats(gpuSamples));
+                writeStats(json, "cpu_update_ms", computeStats(updateSamples));
+                writeStats(json, "tiles_updated", computeStats(tileSamples));
+                writeStats(json, "cascades_updated", computeStats(cascadeSamples));
+                writeStats(json, "tiles_deferred", computeStats(deferredSamples));
+                writeStats(json, "caster_draws", computeStats(casterDrawSamples));
+                writeStats(json, "atlas_occupancy", computeStats(occupancySamples));
+                writeStats(json, "shadowed_lights", computeStats(shadowedSamples));
+                json.endObject();
+            }
+
+            json.endArray();
+            json.endObject();
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
@@ -0,0 +1,209 @@
+#include "benchmarks.h"
+#include "renderer.h"
+#include "temporal_filter.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <random>
+
+namespace bvr
+{
+    namespace bench
+    {
+        namespace
+        {
+            const float kSceneExtent = 40.0f;
+
+            struct TemporalObjectDesc
+            {
+                glm::vec3 position;
+                float scale = 1.0f;
+                glm::vec4 color;
+                BuiltinMesh mesh = BuiltinMesh::eCube;
+                // Spins and bobs in place when set.
+                bool moving = false;
+            };
+
+            std::vector<TemporalObjectDesc> makeObjects(uint32_t count, uint32_t movingPercent, uint32_t seed)
+            {
+                std::mt19937 rng{ seed };
+                std::uniform_real_distribution<float> position{ -kSceneExtent, kSceneExtent };
+                std::uniform_real_distribution<float> unit{ 0.0f, 1.0f };
+
+                std::vector<TemporalObjectDesc> objects(count);
+                for (TemporalObjectDesc& object : objects) {
+                    object.scale = 0.3f + unit(rng) * 1.2f;
+                    object.position = glm::vec3{ position(rng), object.scale, position(rng) };
+                    object.color = glm::vec4{ 0.2f + 0.8f * unit(rng), 0.2f + 0.8f * unit(rng), 0.2f + 0.8f * unit(rng), 1.0f };
+                    object.mesh = BuiltinMesh(uint32_t(unit(rng) * float(BuiltinMesh::eCount)) % uint32_t(BuiltinMesh::eCount));
+                    object.moving = unit(rng) * 100.0f < float(movingPercent);
+                }
+                return objects;
+            }
+
+            glm::mat4 objectTransform(const TemporalObjectDesc& object, uint32_t index, uint32_t frame)
+            {
+                float time = object.moving ? float(frame) * 0.05f + float(index) : float(index);
+                glm::vec3 position = object.position;
+                if (object.moving) {
+                    position.y += std::sin(time) * object.scale;
+                }
+                glm::mat4 transform = glm::translate(glm::mat4{ 1.0f }, position);
+                transform = glm::rotate(transform, time, glm::normalize(glm::vec3{ 0.3f, 1.0f, 0.2f }));
+                return glm::scale(transform, glm::vec3{ object.scale });
+            }
+
+            // Circles the field at a height, so every pixel keeps moving.
+            TemporalCamera makeCamera(uint32_t frame, const RenderConfig& config)
+            {
+                float angle = float(frame) * 0.004f;
+                glm::vec3 eye{ std::cos(angle) * kSceneExtent * 0.8f, 12.0f, std::sin(angle) * kSceneExtent * 0.8f };
+
+                TemporalCamera camera{};
+                camera.view = glm::lookAt(eye, glm::vec3{ 0.0f }, glm::vec3{ 0.0f, 1.0f, 0.0f });
+                camera.projection = glm::perspectiveRH_ZO(glm::radians(60.0f), float(config.width) / float(config.height), 0.1f, kSceneExtent * 4.0f);
+                // Vulkan's clip space points y down.
+                camera.projection[1][1] *= -1.0f;
+                return camera;
+            }
+        }
+
+        int runTemporalAntiAliasing(const BenchArgs& args)
+        {
+            const uint32_t objectCount = uint32_t(std::max(args.getInt("objects", 4000), 1));
+            const uint32_t extraCount = uint32_t(std::max(args.getInt("extra-objects", int(objectCount)), 0));
+            const uint32_t movingPercent = uint32_t(std::min(std::max(args.getInt("moving-percent", 25), 0), 100));
+            const int frameCount = std::max(args.getInt("frames", 600), 1);
+            const int warmupCount = std::max(args.getInt("warmup", 30), 0);
+            const int targetUs = std::max(args.getInt("target-us", 0), 0);
+
+            TemporalConfig temporalConfig{};
+            temporalConfig.motionBlur = !args.has("no-motion-blur");
+            temporalConfig.maxObjects = objectCount + extraCount;
+
+            std::unique_ptr<Renderer> renderer = makeHeadlessRenderer(args, 1920, 1080, [&args, targetUs](RenderConfig& config) {
+                config.dynamicResolution.enabled = targetUs > 0;
+                config.dynamicResolution.targetGpuMs = double(targetUs) * 1e-3;
+                config.dynamicResolution.minScale = float(std::max(args.getInt("min-scale-percent", 50), 10)) * 0.01f;
+            });
+            const RenderConfig& config = renderer->getConfig();
+            // A fixed scale without a target, the starting scale with one.
+            renderer->setRenderScale(float(std::max(args.getInt("scale-percent", 100), 10)) * 0.01f);
+
+            TemporalFilter temporal{ *renderer, temporalConfig };
+            while (!temporal.isReady()) {
+                renderer->renderFrame();
+            }
+            renderer->waitIdle();
+            renderer->takeCompletedTimings();
+
+            std::vector<TemporalObjectDesc> descs = makeObjects(objectCount + extraCount, movingPercent, 1234);
+            std::vector<TemporalObjectHandle> handles;
+            for (uint32_t i = 0; i < objectCount; ++i) {
+                handles.push_back(temporal.addObject(objectTransform(descs[i], i, 0), descs[i].color, descs[i].mesh));
+            }
+
+            // One entry per measured frame, filled in as the timings retire.
+            struct FrameSample
+            {
+                uint64_t frameIndex = 0;
+                float scale = 1.0f;
+                double gpuMs = -1.0;
+            };
+            std::vector<FrameSample> frames;
+            std::vector<double> cpuSamples;
+            std::vector<double> gpuSamples;
+            std::vector<double> scaleSamples;
+            std::vector<double> updateSamples;
+            uint32_t framesOverTarget = 0;
+            uint64_t firstMeasuredFrame = UINT64_MAX;
+            auto collectTimings = [&]() {
+                for (const FrameTimings& timings : renderer->takeCompletedTimings()) {
+                    if (timings.frameIndex < firstMeasuredFrame) {
+                        continue;
+                    }
+                    frames.push_back(FrameSample{ timings.frameIndex, timings.renderScale, timings.gpuMs });
+                    scaleSamples.push_back(double(timings.renderScale));
+                    if (timings.gpuMs >= 0.0) {
+                        gpuSamples.push_back(timings.gpuMs);
+                        if (targetUs > 0 && timings.gpuMs * 1e3 > double(targetUs)) {
+                            ++framesOverTarget;
+                        }
+                    }
+                }
+            };
+
+            // Halfway through, the extra objects appear at once, a sudden
+            // load the controller has to absorb.
+            const int spikeFrame = warmupCount + frameCount / 2;
+            for (int i = 0; i < warmupCount + frameCount; ++i) {
+                uint32_t frameNumber = uint32_t(i);
+                if (i == warmupCount) {
+                    firstMeasuredFrame = renderer->getFrameIndex();
+                }
+                if (i == spikeFrame) {
+                    for (uint32_t j = objectCount; j < objectCount + extraCount; ++j) {
+                        handles.push_back(temporal.addObject(objectTransform(descs[j], j, frameNumber), descs[j].color, descs[j].mesh));
+                    }
+                }
+                for (uint32_t j = 0; j < handles.size(); ++j) {
+                    if (descs[j].moving) {
+                        temporal.moveObject(handles[j], objectTransform(descs[j], j, frameNumber));
+                    }
+                }
+                TemporalCamera camera = makeCamera(frameNumber, config);
+
+                Timer frameTimer;
+                renderer->renderFrameGraph([&](RenderGraph& graph, FrameContext& frame, GraphResource target) {
+                    temporal.addPasses(graph, frame, camera, target);
+                });
+                double frameMs = frameTimer.elapsedMs();
+                collectTimings();
+                if (i >= warmupCount) {
+                    cpuSamples.push_back(frameMs);
+                    updateSamples.push_back(temporal.getStats().cpuUpdateMs);
+                }
+            }
+            renderer->waitIdle();
+            collectTimings();
+
+            vk::PhysicalDeviceProperties props = renderer->getDeviceProperties();
+
+            JsonWriter json;
+            json.beginObject();
+            json.field("benchmark", "taa");
+            json.field("device", &props.deviceName[0]);
+            json.field("width", config.width);
+            json.field("height", config.height);
+            json.field("objects", objectCount);
+            json.field("extra_objects", extraCount);
+            json.field("moving_percent", movingPercent);
+            json.field("motion_blur", temporalConfig.motionBlur);
+            json.field("dynamic_resolution", config.dynamicResolution.enabled);
+            json.field("target_gpu_ms", config.dynamicResolution.targetGpuMs);
+            json.field("frames", frameCount);
+            writeStats(json, "cpu_frame_ms", computeStats(cpuSamples));
+            writeStats(json, "gpu_frame_ms", computeStats(gpuSamples));
+            writeStats(json, "render_scale", computeStats(scaleSamples));
+            writeStats(json, "cpu_update_ms", computeStats(updateSamples));
+            json.field("scale_changes", renderer->getDynamicResolution().getChangeCount());
+            json.field("frames_over_target", framesOverTarget);
+
+            json.key("per_frame");
+            json.beginArray();
+            for (const FrameSample& sample : frames) {
+                json.beginObject();
+                json.field("frame", sample.frameIndex - firstMeasuredFrame);
+                json.field("scale", sample.scale);
+                json.field("gpu_ms", sample.gpuMs);
+                json.endObject();
+            }
+            json.endArray();
+            json.endObject();
+
+            emitReport(args, json);
+            return EXIT_SUCCESS;
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#include "asset_cooker.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+namespace
+{
+    void printUsage()
+    {
+        std::cerr << "Usage: BVRCook <scene.gltf|scene.glb> -o <scene.bvrpkg> [--threads N] [--uncompressed] [--no-mips]" << std::endl;
+        std::cerr << "  --threads N     Worker threads, 0 for every hardware thread (default)" << std::endl;
+        std::cerr << "  --uncompressed  RGBA8 textures, for devices without BC support" << std::endl;
+        std::cerr << "  --no-mips       Only cook mip 0 of every texture" << std::endl;
+    }
+
+    double toMb(uint64_t bytes)
+    {
+        return double(bytes) / double(1 << 20);
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    std::string input;
+    std::string output;
+    uint32_t threads = 0;
+    bvr::CookOptions options{};
+
+    for (int i = 1; i < argc; ++i) {
+        if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--out") == 0) && i + 1 < argc) {
+            output = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = uint32_t(std::max(atoi(argv[++i]), 0));
+        }
+        else if (strcmp(argv[i], "--uncompressed") == 0) {
+            options.compressTextures = false;
+        }
+        else if (strcmp(argv[i], "--no-mips") == 0) {
+            options.generateMips = false;
+        }
+        else if (argv[i][0] != '-' && input.empty()) {
+            input = argv[i];
+        }
+        else {
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (input.empty() || output.empty()) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        bvr::JobSystem jobs{ threads };
+        bvr::CookStats stats = bvr::cookGltf(input, output, options, jobs);
+
+        printf("%s -> %s\n", input.c_str(), output.c_str());
+        printf("  %u meshes, %u primitives, %u meshlets, %u instances, %u textures (%u failed)\n",
+            stats.meshes, stats.primitives, stats.meshlets, stats.instances, stats.textures, stats.texturesFailed);
+        printf("  %.2f MiB source, %.2f MiB package: %.2f MiB geometry, %.2f MiB textures\n",
+            toMb(stats.sourceBytes), toMb(stats.packageBytes), toMb(stats.geometryBytes), toMb(stats.textureBytes));
+        printf("  parse %.1f ms, process %.1f ms, write %.1f ms\n", stats.parseMs, stats.processMs, stats.writeMs);
+        return EXIT_SUCCESS;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace bvr
+{
+    class JobSystem;
+
+
+    struct CookOptions
+    {
+        // BC1, BC3 or BC5 by texture use, RGBA8 otherwise.
+        bool compressTextures = true;
+        // Full mip chains, else only mip 0.
+        bool generateMips = true;
+        uint32_t meshletMaxVertices = 64;
+        uint32_t meshletMaxTriangles = 124;
+    };
+
+
+    struct CookStats
+    {
+        // The glTF and every file it references.
+        uint64_t sourceBytes = 0;
+        uint64_t packageBytes = 0;
+        uint64_t geometryBytes = 0;
+        uint64_t textureBytes = 0;
+        uint32_t meshes = 0;
+        uint32_t primitives = 0;
+        uint32_t meshlets = 0;
+        uint32_t instances = 0;
+        uint32_t textures = 0;
+        // Images that failed to decode; their textures have no levels.
+        uint32_t texturesFailed = 0;
+        double parseMs = 0.0;
+        // Geometry and textures, which are processed together.
+        double processMs = 0.0;
+        double writeMs = 0.0;
+    };
+
+
+    // Cooks a .gltf or .glb file into a package (see package_format.h) at
+    // `packagePath`. Primitives and images are processed in parallel on
+    // `jobs`, and the package is written next to `packagePath` and renamed
+    // over it, so a failed cook never leaves half a package behind.
+    //
+    // Reads the same subset of glTF as GltfLoader: triangle lists with float
+    // or normalized attributes, PNG and baseline JPEG images, and embedded,
+    // external or data: URI buffers and images. Images that fail to decode
+    // (such as progressive JPEGs) are logged and cooked as empty textures.
+    // Throws std::runtime_error on anything else.
+    CookStats cookGltf(const std::string& sourcePath, const std::string& packagePath, const CookOptions& options, JobSystem& jobs);
+}
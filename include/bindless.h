@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace bvr
+{
+    class Renderer;
+
+
+    struct BindlessConfig
+    {
+        // Capacity of each array of the global set. Clamped to the device's
+        // update-after-bind limits.
+        uint32_t maxTextures = 16384;
+        uint32_t maxBuffers = 16384;
+        uint32_t maxSamplers = 256;
+    };
+
+
+    // Bindings of the global set, matching shaders/bindless.glsl.
+    const uint32_t kBindlessTextureBinding = 0;
+    const uint32_t kBindlessBufferBinding = 1;
+    const uint32_t kBindlessSamplerBinding = 2;
+
+
+    // An index into one of the global set's arrays, what shaders receive through
+    // push constants or instance data.
+    template<typename Tag>
+    struct BindlessHandle
+    {
+        uint32_t index = UINT32_MAX;
+
+        bool isValid() const { return index != UINT32_MAX; }
+    };
+
+    using TextureHandle = BindlessHandle<struct BindlessTextureTag>;
+    using BufferHandle = BindlessHandle<struct BindlessBufferTag>;
+    using SamplerHandle = BindlessHandle<struct BindlessSamplerTag>;
+
+
+    struct BindlessStats
+    {
+        uint32_t textures = 0;
+        uint32_t buffers = 0;
+        uint32_t samplers = 0;
+        // Released slots still waiting for their frames to retire.
+        uint32_t pendingReleases = 0;
+    };
+
+
+    // One descriptor set holding every sampled image, storage buffer and sampler
+    // the renderer's shaders index, bound once per command buffer instead of a
+    // set per material. Built on descriptor indexing: the arrays are partially
+    // bound and updated after bind, so adding a resource never waits for the
+    // GPU and never touches a slot an in-flight frame may read.
+    //
+    // Released slots go back to the free list once every frame recorded so far
+    // has retired. The table doesn't own the views, buffers and samplers it
+    // references; keep them alive until their slot is released and those frames
+    // have retired, e.g. by destroying them through Renderer::deferRelease().
+    // Adding is thread safe; release on the render thread, like deferRelease().
+    class BindlessTable
+    {
+    public:
+        BindlessTable(Renderer& renderer, const BindlessConfig& config);
+        ~BindlessTable();
+
+        BindlessTable(const BindlessTable&) = delete;
+        BindlessTable& operator=(const BindlessTable&) = delete;
+
+        // Throw std::runtime_error when the array is full.
+        TextureHandle addTexture(vk::ImageView view, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
+        BufferHandle addBuffer(vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE);
+        SamplerHandle addSampler(vk::Sampler sampler);
+
+        void release(TextureHandle handle);
+        void release(BufferHandle handle);
+        void release(SamplerHandle handle);
+
+        vk::DescriptorSetLayout getSetLayout() const { return m_setLayout; }
+        vk::DescriptorSet getSet() const { return m_set; }
+        BindlessStats getStats() const;
+
+    private:
+        struct SlotArray
+        {
+            uint32_t capacity = 0;
+            // Slots below this have been handed out at least once.
+            uint32_t highWater = 0;
+            uint32_t live = 0;
+            std::vector<uint32_t> freeList;
+        };
+
+        // Shared with the deferred releases, which may run after the table is gone.
+        struct SlotState
+        {
+            std::mutex mutex;
+            std::array<SlotArray, 3> arrays;
+            uint32_t pendingReleases = 0;
+        };
+
+        uint32_t allocateSlot(uint32_t binding);
+        void releaseSlot(uint32_t binding, uint32_t index);
+        void writeDescriptor(const vk::WriteDescriptorSet& write);
+
+        Renderer& m_renderer;
+        vk::Device m_device;
+        vk::DescriptorSetLayout m_setLayout;
+        vk::DescriptorPool m_pool;
+        vk::DescriptorSet m_set;
+        std::shared_ptr<SlotState> m_slots;
+        // vkUpdateDescriptorSets needs the set externally synchronized.
+        std::mutex m_writeMutex;
+    };
+}
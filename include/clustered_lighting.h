@@ -0,0 +1,194 @@
+#pragma once
+
+#include "gpu_memory.h"
+#include "render_graph.h"
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace bvr
+{
+    class Renderer;
+    struct FrameContext;
+
+
+    // Matches Light in shaders/cluster_assign.comp.
+    struct Light
+    {
+        // World space position and the distance at which the light reaches zero.
+        glm::vec4 positionRange;
+        glm::vec4 colorIntensity;
+        // Spot lights: world space direction and cosine of the outer cone angle.
+        // Point lights have a cosine of -1.
+        glm::vec4 directionCosAngle;
+
+        bool isSpot() const { return directionCosAngle.w > -1.0f; }
+    };
+
+    Light makePointLight(const glm::vec3& position, float range, const glm::vec3& color, float intensity);
+    // `outerAngle` is the half angle of the cone in radians, below 90 degrees.
+    Light makeSpotLight(const glm::vec3& position, float range, const glm::vec3& direction, float outerAngle, const glm::vec3& color, float intensity);
+
+
+    struct ClusterGridConfig
+    {
+        // Screen space tiles and depth slices. Slices are spaced exponentially
+        // between `nearZ` and `farZ`, so clusters stay roughly cubic.
+        uint32_t tilesX = 16;
+        uint32_t tilesY = 9;
+        uint32_t slices = 24;
+        float nearZ = 0.1f;
+        float farZ = 500.0f;
+        // Capacity of the light index list shared by every cluster. Clusters
+        // beyond it lose their lights, see ClusterStats::overflowed.
+        uint32_t maxLightIndices = 1u << 20;
+    };
+
+
+    // View space bounds of one froxel, xyz only. Matches ClusterBounds in
+    // shaders/cluster_assign.comp.
+    struct ClusterBounds
+    {
+        glm::vec4 minPoint;
+        glm::vec4 maxPoint;
+    };
+
+    // Cluster (x, y, z) is at index x + y * tilesX + z * tilesX * tilesY. Shading
+    // finds the slice of a fragment at view depth d (positive, in front of the
+    // camera) as floor(log(d / nearZ) / log(farZ / nearZ) * slices).
+    std::vector<ClusterBounds> buildClusterGrid(const ClusterGridConfig& config, const glm::mat4& projection);
+
+
+    // Compact per-cluster light lists: cluster i's lights are
+    // indices[ranges[i].x, ranges[i].x + ranges[i].y), in increasing order.
+    struct ClusterLightLists
+    {
+        std::vector<glm::uvec2> ranges;
+        std::vector<uint32_t> indices;
+    };
+
+
+    enum class ClusterCullMode
+    {
+        // SIMD light assignment on the job system, uploaded for the frame.
+        eCpu,
+        // Light assignment in a compute pass.
+        eGpu,
+    };
+
+
+    // What shading passes read. `ranges` holds one uvec2 per cluster and
+    // `indices` the light indices they point into, both as storage buffers.
+    struct ClusterResources
+    {
+        GraphResource ranges;
+        GraphResource indices;
+    };
+
+
+    struct ClusterStats
+    {
+        uint32_t clusters = 0;
+        uint32_t lights = 0;
+        double cpuAssignMs = 0.0;
+        // Light-cluster pairs of the last CPU assignment.
+        uint32_t cpuIndexCount = 0;
+        // Pairs of the last GPU assignment that has retired, read back
+        // framesInFlight frames late. UINT32_MAX until the first one retired.
+        uint32_t gpuIndexCount = UINT32_MAX;
+        // Whether an assignment ran out of ClusterGridConfig::maxLightIndices.
+        bool overflowed = false;
+    };
+
+
+    // Clustered forward light culling. Every frame, the lights are assigned to
+    // the froxels of the camera's view frustum, either by the "cluster_lights"
+    // compute pass or by the CPU reference, and shading passes read the
+    // resulting lists through ClusterResources.
+    class ClusteredLighting
+    {
+    public:
+        ClusteredLighting(Renderer& renderer, const ClusterGridConfig& config);
+        ~ClusteredLighting();
+
+        ClusteredLighting(const ClusteredLighting&) = delete;
+        ClusteredLighting& operator=(const ClusteredLighting&) = delete;
+
+        // Adds the passes assigning `lights` to clusters. Call from the
+        // Renderer::renderFrameGraph() callback; the lights are copied.
+        ClusterResources addPasses(
+            RenderGraph& graph,
+            FrameContext& frame,
+            const glm::mat4& view,
+            const glm::mat4& projection,
+            const std::vector<Light>& lights,
+            ClusterCullMode mode
+        );
+
+        // The CPU reference on its own, also what eCpu uploads. The result is
+        // valid until the next call.
+        const ClusterLightLists& assignLightsCpu(const glm::mat4& view, const glm::mat4& projection, const std::vector<Light>& lights);
+
+        const std::vector<ClusterBounds>& getClusterBounds() const { return m_clusters; }
+        ClusterStats getStats() const { return m_stats; }
+
+    private:
+        // Lights in view space, one array per component for SIMD tests.
+        struct ViewLights
+        {
+            std::vector<float> x;
+            std::vector<float> y;
+            std::vector<float> z;
+            std::vector<float> radius;
+            std::vector<glm::vec4> spotCones;
+
+            void resize(size_t count);
+        };
+
+        // One depth slice's share of the CPU assignment.
+        struct SliceLists
+        {
+            std::vector<uint32_t> candidates;
+            std::vector<uint32_t> indices;
+            std::vector<glm::uvec2> ranges;
+            ViewLights candidateLights;
+        };
+
+        struct SlotBuffers
+        {
+            Buffer counterReadback;
+            bool counterPending = false;
+            // Host visible copies of the CPU lists, created on first use.
+            Buffer cpuRanges;
+            Buffer cpuIndices;
+        };
+
+        void updateGrid(const glm::mat4& projection);
+        void assignSlice(uint32_t slice);
+        void createPipeline();
+        void readBackCounter(SlotBuffers& slot);
+        ClusterResources addGpuPasses(RenderGraph& graph, FrameContext& frame, SlotBuffers& slot, const glm::mat4& view, const std::vector<Light>& lights);
+        ClusterResources addCpuPasses(RenderGraph& graph, SlotBuffers& slot, const glm::mat4& view, const glm::mat4& projection, const std::vector<Light>& lights);
+
+        Renderer& m_renderer;
+        ClusterGridConfig m_config;
+        uint32_t m_clusterCount = 0;
+        glm::mat4 m_projection{ 0.0f };
+        std::vector<ClusterBounds> m_clusters;
+
+        ViewLights m_viewLights;
+        std::vector<SliceLists> m_slices;
+        ClusterLightLists m_cpuLists;
+
+        std::vector<SlotBuffers> m_slots;
+
+        vk::DescriptorSetLayout m_setLayout;
+        vk::PipelineLayout m_pipelineLayout;
+        vk::Pipeline m_pipeline;
+
+        ClusterStats m_stats;
+    };
+}
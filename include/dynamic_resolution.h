@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+
+namespace bvr
+{
+    struct DynamicResolutionConfig
+    {
+        // Off keeps the scale wherever DynamicResolution::setScale() put it.
+        bool enabled = false;
+        // GPU time per frame to hold, in milliseconds.
+        double targetGpuMs = 16.0;
+        // Share of the target the controller aims for, so ordinary frame to
+        // frame noise doesn't push frames over it.
+        float headroom = 0.9f;
+        float minScale = 0.5f;
+        float maxScale = 1.0f;
+        // Scales are multiples of this, so the scale doesn't creep by tiny
+        // amounts every frame.
+        float scaleStep = 0.05f;
+        // Frames at a scale before it may go down, and frames under budget
+        // before it may go up. Dropping fast and climbing slowly keeps the
+        // scale from oscillating around the budget.
+        uint32_t decreaseDelayFrames = 3;
+        uint32_t increaseDelayFrames = 30;
+    };
+
+
+    // Picks the scale of the internal render resolution from measured GPU
+    // frame times. GPU time is assumed to grow with the pixel count, so the
+    // scale that hits the target is the current one times
+    // sqrt(target / measured).
+    //
+    // Samples arrive frames after the scale they measure was chosen, so each
+    // sample carries the scale its frame rendered at and samples of older
+    // scales are ignored.
+    class DynamicResolution
+    {
+    public:
+        explicit DynamicResolution(const DynamicResolutionConfig& config = {});
+
+        // The GPU time of a retired frame, rendered at `renderScale`.
+        void addSample(float renderScale, double gpuMs);
+        // Clamped to the configured range. Also resets the measurements.
+        void setScale(float scale);
+
+        float getScale() const { return m_scale; }
+        // Smoothed GPU time at the current scale, 0 before the first sample.
+        double getSmoothedGpuMs() const { return m_samples > 0 ? m_smoothedMs : 0.0; }
+        // Scale changes since creation, for stats.
+        uint32_t getChangeCount() const { return m_changes; }
+        const DynamicResolutionConfig& getConfig() const { return m_config; }
+
+    private:
+        void changeScale(float scale);
+
+        DynamicResolutionConfig m_config;
+        float m_scale = 1.0f;
+        double m_smoothedMs = 0.0;
+        uint32_t m_samples = 0;
+        uint32_t m_framesUnderBudget = 0;
+        uint32_t m_changes = 0;
+    };
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bvr
+{
+    struct ShaderBinary
+    {
+        const uint32_t* code = nullptr;
+        // In bytes, as vk::ShaderModuleCreateInfo expects.
+        size_t size = 0;
+    };
+
+    // SPIR-V compiled from shaders/ by `make shaders` and linked into the binary,
+    // looked up by source file name (e.g. "triangle.vert"). Returns an empty
+    // binary for unknown names.
+    ShaderBinary getEmbeddedShader(const char* name);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace bvr
+{
+    // Reports files written in a set of directories. Uses inotify on Linux and
+    // compares modification times elsewhere, which notices changes up to a
+    // polling interval later.
+    //
+    // Not thread safe: one thread adds directories and waits.
+    class FileWatcher
+    {
+    public:
+        FileWatcher();
+        ~FileWatcher();
+
+        FileWatcher(const FileWatcher&) = delete;
+        FileWatcher& operator=(const FileWatcher&) = delete;
+
+        // Watches the files directly inside `path`, not its subdirectories.
+        // Throws std::runtime_error when it can't be watched.
+        void addDirectory(const std::string& path);
+
+        // Blocks for up to `timeoutMs` until files are written, created or moved
+        // into a watched directory, and returns their absolute paths. Empty on
+        // timeout. Saving a file may report it more than once.
+        std::vector<std::string> wait(uint32_t timeoutMs);
+
+    private:
+#ifdef __linux__
+        int m_fd = -1;
+        // Watch descriptor to absolute directory path.
+        std::unordered_map<int, std::string> m_directories;
+#else
+        void scan(std::vector<std::string>& changed);
+
+        std::vector<std::string> m_directories;
+        std::unordered_map<std::string, std::filesystem::file_time_type> m_writeTimes;
+#endif
+    };
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "gpu_memory.h"
+#include "job_system.h"
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bvr
+{
+    class Renderer;
+
+
+    enum class AssetState : uint32_t
+    {
+        eQueued,
+        eParsing,
+        // Geometry and images are on their way through the transfer queue.
+        eStreaming,
+        // Geometry is resident and may be drawn, images are still streaming.
+        eDrawable,
+        eResident,
+        eFailed,
+    };
+
+
+    // A vertex attribute inside the asset's geometry buffer, ready for
+    // vkCmdBindVertexBuffers.
+    struct GltfVertexStream
+    {
+        vk::DeviceSize offset = 0;
+        uint32_t stride = 0;
+        vk::Format format = vk::Format::eUndefined;
+
+        bool isValid() const { return format != vk::Format::eUndefined; }
+    };
+
+
+    struct GltfPrimitive
+    {
+        GltfVertexStream position;
+        GltfVertexStream normal;
+        GltfVertexStream texcoord0;
+        vk::DeviceSize indexOffset = 0;
+        vk::IndexType indexType = vk::IndexType::eUint32;
+        // 0 for non-indexed primitives.
+        uint32_t indexCount = 0;
+        uint32_t vertexCount = 0;
+        int32_t material = -1;
+    };
+
+
+    struct GltfMesh
+    {
+        std::vector<GltfPrimitive> primitives;
+    };
+
+
+    // Flattened scene graph: one entry per node of the default scene that
+    // references a mesh.
+    struct GltfInstance
+    {
+        glm::mat4 world{ 1.0f };
+        uint32_t mesh = 0;
+    };
+
+
+    struct GltfMaterial
+    {
+        glm::vec4 baseColorFactor{ 1.0f };
+        float metallicFactor = 1.0f;
+        float roughnessFactor = 1.0f;
+        // Indices into GltfAsset::getTextures(), -1 when unused.
+        int32_t baseColorTexture = -1;
+        int32_t metallicRoughnessTexture = -1;
+        int32_t normalTexture = -1;
+        int32_t emissiveTexture = -1;
+    };
+
+
+    struct GltfTexture
+    {
+        Image image;
+        vk::ImageView view;
+        uint32_t width = 0;
+        uint32_t height = 0;
+
+        // False for images that failed to decode, draw with a fallback instead.
+        bool isValid() const { return bool(view); }
+    };
+
+
+    struct GltfLoadStats
+    {
+        uint64_t fileBytes = 0;
+        uint64_t geometryBytes = 0;
+        // Decoded RGBA8 bytes.
+        uint64_t imageBytes = 0;
+        uint32_t imagesFailed = 0;
+        // Milliseconds since GltfLoader::load().
+        double parsedMs = 0.0;
+        double drawableMs = 0.0;
+        double residentMs = 0.0;
+    };
+
+
+    // A glTF 2.0 scene streamed onto the GPU. Everything but the state is
+    // written by the loader thread before the asset becomes drawable and is
+    // read-only afterwards, so the render thread may use it without locking
+    // once getState() returns eDrawable or eResident.
+    class GltfAsset
+    {
+    public:
+        AssetState getState() const { return m_state.load(std::memory_order_acquire); }
+        bool isDrawable() const { AssetState state = getState(); return state == AssetState::eDrawable || state == AssetState::eResident; }
+        const std::string& getPath() const { return m_path; }
+        // Set once the state is eFailed.
+        const std::string& getError() const { return m_error; }
+
+        // Defragmentation may move the geometry, look the buffer up every frame.
+        vk::Buffer getGeometryBuffer() const;
+        const std::vector<GltfMesh>& getMeshes() const { return m_meshes; }
+        const std::vector<GltfInstance>& getInstances() const { return m_instances; }
+        const std::vector<GltfMaterial>& getMaterials() const { return m_materials; }
+        // Only complete once the state is eResident.
+        const std::vector<GltfTexture>& getTextures() const { return m_textures; }
+        GltfLoadStats getStats() const;
+
+    private:
+        friend class GltfLoader;
+
+        std::string m_path;
+        std::atomic<AssetState> m_state{ AssetState::eQueued };
+        std::string m_error;
+        std::chrono::steady_clock::time_point m_requested;
+
+        GpuMemory* m_memory = nullptr;
+        MovableBufferHandle m_geometry;
+        std::vector<GltfMesh> m_meshes;
+        std::vector<GltfInstance> m_instances;
+        std::vector<GltfMaterial> m_materials;
+        std::vector<GltfTexture> m_textures;
+        // Upload timeline value after which the GPU no longer writes to the asset.
+        uint64_t m_lastUploadValue = 0;
+
+        mutable std::mutex m_statsMutex;
+        GltfLoadStats m_stats;
+    };
+
+
+    // Loads .glb and .gltf files on a background thread. Files are memory
+    // mapped and parsed in place: geometry goes straight from the mapping into
+    // the upload staging ring, so the only CPU copy is the one into mapped GPU
+    // memory. Images are decoded on the loader's own job system, which keeps
+    // multi-millisecond decodes off the render thread's job queues.
+    //
+    // Supports embedded (GLB), external and base64 data: URI buffers and images.
+    // Images may be PNG or baseline JPEG; progressive JPEGs load as invalid
+    // textures. Base color and emissive images are created sRGB, the rest UNORM.
+    //
+    // Assets only become drawable and resident while the renderer keeps
+    // rendering frames, since that is when uploads change queue ownership.
+    class GltfLoader
+    {
+    public:
+        // `decodeThreads` 0 uses half of the hardware threads.
+        GltfLoader(Renderer& renderer, uint32_t decodeThreads = 0);
+        // Must run on the render thread, before the renderer is destroyed.
+        ~GltfLoader();
+
+        GltfLoader(const GltfLoader&) = delete;
+        GltfLoader& operator=(const GltfLoader&) = delete;
+
+        // Queues a file and returns immediately.
+        std::shared_ptr<GltfAsset> load(const std::string& path);
+        // Releases the asset's GPU resources once no frame uses them anymore.
+        // The asset must be resident or failed. Call from the render thread.
+        void unload(const std::shared_ptr<GltfAsset>& asset);
+
+    private:
+        void loaderLoop();
+        void loadAsset(const std::shared_ptr<GltfAsset>& asset);
+        void releaseResources(GltfAsset& asset);
+
+        Renderer& m_renderer;
+        std::unique_ptr<JobSystem> m_decodeJobs;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::deque<std::shared_ptr<GltfAsset>> m_queue;
+        std::vector<std::shared_ptr<GltfAsset>> m_assets;
+        bool m_running = true;
+        std::thread m_thread;
+    };
+
+
+    // True for data: URIs, which glTF uses to embed buffers and images in the
+    // JSON itself.
+    bool isDataUri(const std::string& uri);
+
+    // Decodes the payload of a base64 data: URI. Throws std::runtime_error for
+    // any other encoding.
+    std::vector<uint8_t> decodeDataUri(const std::string& uri);
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vma/vk_mem_alloc.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace bvr
+{
+    struct GpuMemoryConfig
+    {
+        // Size of each VkDeviceMemory block backing the sub-allocation pools.
+        // Resources of at least half a block get a dedicated allocation instead.
+        vk::DeviceSize poolBlockSize = 64ull << 20;
+        // Per frame in flight, for uniform and dynamic vertex data.
+        vk::DeviceSize frameRingSize = 16ull << 20;
+        // Staging ring shared by every upload on the transfer queue.
+        vk::DeviceSize uploadStagingSize = 64ull << 20;
+        // Upper bound on the bytes moved by a single defragmentation step.
+        vk::DeviceSize defragBytesPerStep = 8ull << 20;
+        // Defragment once this fraction of the movable pool's free space is
+        // outside of its largest free range.
+        float defragThreshold = 0.3f;
+        // Frames between two fragmentation checks.
+        uint32_t defragInterval = 120;
+    };
+
+
+    enum class MemoryUsage
+    {
+        eGpuOnly,
+        // Host visible, persistently mapped. For staging and CPU written data.
+        eUpload,
+        // Host visible and cached, persistently mapped. For GPU to CPU copies.
+        eReadback,
+    };
+
+
+    struct Buffer
+    {
+        vk::Buffer buffer;
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        vk::DeviceSize size = 0;
+        void* mapped = nullptr;
+    };
+
+
+    struct Image
+    {
+        vk::Image image;
+        VmaAllocation allocation = VK_NULL_HANDLE;
+    };
+
+
+    // Buffers that defragmentation may relocate. The vk::Buffer behind a handle
+    // changes when it moves, so look it up again every frame instead of caching it.
+    // Only for data the GPU reads but never writes, since a frame still in flight
+    // may read the old copy while the next one reads the new.
+    struct MovableBufferHandle
+    {
+        uint32_t index = UINT32_MAX;
+
+        bool isValid() const { return index != UINT32_MAX; }
+    };
+
+
+    struct RingAllocation
+    {
+        vk::Buffer buffer;
+        vk::DeviceSize offset = 0;
+        void* mapped = nullptr;
+    };
+
+
+    struct HeapBudget
+    {
+        vk::DeviceSize size = 0;
+        // How much the process may allocate from the heap before the driver starts
+        // evicting or failing. Estimated as 80% of the heap without VK_EXT_memory_budget.
+        vk::DeviceSize budget = 0;
+        // Process wide usage as reported by the driver, or what VMA has allocated
+        // without VK_EXT_memory_budget.
+        vk::DeviceSize usage = 0;
+        // Bytes VMA currently has in VkDeviceMemory blocks from this heap.
+        vk::DeviceSize blockBytes = 0;
+        bool deviceLocal = false;
+    };
+
+
+    struct DefragmentationTotals
+    {
+        uint64_t steps = 0;
+        uint64_t bytesMoved = 0;
+        uint64_t allocationsMoved = 0;
+    };
+
+
+    // Per-frame linear allocator carved out of one persistently mapped buffer.
+    // Each frame in flight owns one region; it is reset when that frame context
+    // is reused, so allocations live exactly as long as the frame. Thread safe.
+    class FrameRingAllocator
+    {
+    public:
+        void init(const Buffer& buffer, vk::DeviceSize regionSize, vk::DeviceSize alignment);
+
+        void beginFrame(uint32_t frameSlot);
+        // Returns a null buffer when the frame's region is exhausted.
+        RingAllocation allocate(vk::DeviceSize size);
+
+        vk::DeviceSize getRegionSize() const { return m_regionSize; }
+        vk::DeviceSize getHighWaterMark() const { return m_highWaterMark; }
+
+    private:
+        Buffer m_buffer;
+        vk::DeviceSize m_regionSize = 0;
+        vk::DeviceSize m_alignment = 1;
+        vk::DeviceSize m_regionStart = 0;
+        std::atomic<vk::DeviceSize> m_head{ 0 };
+        vk::DeviceSize m_highWaterMark = 0;
+    };
+
+
+    // Owns the VMA allocator and every pool the renderer sub-allocates from.
+    class GpuMemory
+    {
+    public:
+        GpuMemory(
+            vk::PhysicalDevice physicalDevice,
+            vk::Device device,
+            const GpuMemoryConfig& config,
+            uint32_t framesInFlight,
+            bool memoryBudgetSupported
+        );
+        ~GpuMemory();
+
+        GpuMemory(const GpuMemory&) = delete;
+        GpuMemory& operator=(const GpuMemory&) = delete;
+
+        Buffer createBuffer(const vk::BufferCreateInfo& createInfo, MemoryUsage usage);
+        void destroyBuffer(Buffer& buffer);
+
+        Image createImage(const vk::ImageCreateInfo& createInfo, MemoryUsage usage = MemoryUsage::eGpuOnly);
+        void destroyImage(Image& image);
+
+        // Device local memory for resources the caller creates and binds itself,
+        // e.g. render graph transients that alias each other.
+        VmaAllocation allocateMemory(const vk::MemoryRequirements& requirements);
+        void freeMemory(VmaAllocation allocation);
+        void bindImageMemory(VmaAllocation allocation, vk::DeviceSize offset, vk::Image image);
+        void bindBufferMemory(VmaAllocation allocation, vk::DeviceSize offset, vk::Buffer buffer);
+
+        // Device local buffer that defragmentation is allowed to relocate. It
+        // starts out pinned, so pending uploads keep a valid vk::Buffer; unpin it
+        // once its contents have been acquired on the graphics queue. Thread safe.
+        MovableBufferHandle createMovableBuffer(const vk::BufferCreateInfo& createInfo);
+        void unpinMovableBuffer(MovableBufferHandle handle);
+        Buffer getMovableBuffer(MovableBufferHandle handle) const;
+        void destroyMovableBuffer(MovableBufferHandle handle);
+
+        void beginFrame(uint64_t frameIndex);
+        FrameRingAllocator& getFrameRing() { return m_frameRing; }
+
+        // Fraction of the movable pool's free bytes that are not part of its
+        // largest free range. 0 means all free space is contiguous.
+        float getFragmentation() const;
+        bool shouldDefragment(uint64_t frameIndex) const;
+
+        // Moves at most GpuMemoryConfig::defragBytesPerStep of unpinned movable
+        // buffers out of the emptiest block of the movable pool, recording the
+        // copies and their barriers into `commandBuffer`. Handles point at the new
+        // copies right away, so work recorded after the copies can use them. The
+        // old buffers are appended to `moved`; destroy them once `commandBuffer`
+        // and everything submitted before it has executed. Returns how many moved.
+        uint32_t defragment(vk::CommandBuffer commandBuffer, std::vector<Buffer>& moved);
+
+        std::vector<HeapBudget> queryBudget() const;
+        // True when no heap uses more than `fraction` of its budget.
+        bool isWithinBudget(float fraction = 1.0f) const;
+        void logBudget() const;
+
+        // VMA's detailed JSON dump together with pool, ring, budget and
+        // defragmentation totals, stable enough to diff between builds.
+        std::string buildStatsJson() const;
+
+        VmaAllocator getAllocator() const { return m_allocator; }
+
+    private:
+        struct MovableBuffer
+        {
+            Buffer buffer;
+            vk::BufferCreateInfo createInfo;
+            bool pinned = true;
+            bool dedicated = false;
+        };
+
+        VmaPool createPool(uint32_t memoryTypeIndex, const char* name);
+        VmaPool choosePool(MemoryUsage usage, uint32_t memoryTypeBits, bool isImage) const;
+        bool isDedicated(vk::DeviceSize size) const;
+
+        vk::PhysicalDevice m_physicalDevice;
+        vk::Device m_device;
+        GpuMemoryConfig m_config;
+        uint32_t m_framesInFlight = 1;
+        bool m_memoryBudgetSupported = false;
+
+        VmaAllocator m_allocator = VK_NULL_HANDLE;
+
+        struct Pool
+        {
+            VmaPool pool = VK_NULL_HANDLE;
+            uint32_t memoryTypeIndex = UINT32_MAX;
+            const char* name = "";
+        };
+        Pool m_bufferPool;
+        Pool m_imagePool;
+        Pool m_uploadPool;
+        Pool m_movablePool;
+
+        Buffer m_ringBuffer;
+        FrameRingAllocator m_frameRing;
+
+        // Loader threads create and destroy movable buffers while the render
+        // thread looks them up and defragments.
+        mutable std::mutex m_movableMutex;
+        std::vector<MovableBuffer> m_movableBuffers;
+        std::vector<uint32_t> m_freeMovableSlots;
+        DefragmentationTotals m_defragTotals;
+    };
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "gpu_memory.h"
+#include "image_decoder.h"
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bvr
+{
+    class JobSystem;
+    class Renderer;
+
+
+    struct IblConfig
+    {
+        // Side of the split-sum BRDF lookup table and the GGX samples per texel.
+        uint32_t brdfLutSize = 128;
+        uint32_t brdfSamples = 512;
+        // Face size of the prefiltered specular cube map's first mip. Mip i is
+        // prefiltered for roughness i / (specularMips - 1).
+        uint32_t specularSize = 256;
+        uint32_t specularMips = 6;
+        uint32_t specularSamples = 256;
+        // The irradiance SH are projected from the first environment mip at most
+        // this wide.
+        uint32_t irradianceWidth = 128;
+        // Where baked results are kept as KTX2 files, keyed by the source file's
+        // contents and every setting above. Empty disables the cache.
+        std::string cacheDirectory = "ibl_cache";
+    };
+
+
+    // What a bake produces and the cache stores.
+    struct IblData
+    {
+        uint32_t brdfLutSize = 0;
+        // RG16F scale and bias to F0, N.V along x and roughness along y.
+        std::vector<uint16_t> brdfLut;
+        // Irradiance SH, bands 0 to 2 convolved with the clamped cosine, so
+        // evaluating them at a normal gives irradiance; divide by pi for the
+        // Lambertian radiance. Ordered Y00, Y1-1, Y10, Y11, Y2-2, Y2-1, Y20, Y21, Y22.
+        std::array<glm::vec3, 9> irradianceSH{};
+        uint32_t specularSize = 0;
+        // RGBA16F, one entry per mip, each holding the six faces (+X, -X, +Y,
+        // -Y, +Z, -Z) tightly packed.
+        std::vector<std::vector<uint16_t>> specular;
+    };
+
+
+    enum class IblSource
+    {
+        eCache,
+        eGpu,
+        eCpu,
+    };
+
+    const char* toString(IblSource source);
+
+
+    // Hash of the source file's bytes, every setting that affects the output
+    // and the cache format version.
+    uint64_t computeIblKey(const uint8_t* source, size_t size, const IblConfig& config);
+
+    // Runs the same algorithms and sample patterns as the compute shaders on
+    // the job system, as a reference to validate them against and for machines
+    // without a usable GPU.
+    IblData bakeIblCpu(const DecodedHdrImage& environment, const IblConfig& config, JobSystem& jobs);
+    // Runs the compute shaders through Renderer::immediateSubmit() and reads
+    // the results back.
+    IblData bakeIblGpu(Renderer& renderer, const DecodedHdrImage& environment, const IblConfig& config);
+
+    // False when any of the key's files is missing or doesn't match `config`.
+    bool readIblCache(const IblConfig& config, uint64_t key, IblData& data);
+    // Throws std::runtime_error on I/O errors.
+    void writeIblCache(const IblConfig& config, uint64_t key, const IblData& data);
+
+
+    struct IblStats
+    {
+        IblSource source = IblSource::eCache;
+        uint64_t key = 0;
+        double hashMs = 0.0;
+        // Zero on cache hits, which never decode the source.
+        double decodeMs = 0.0;
+        double bakeMs = 0.0;
+        // Reading the cache, plus writing it after a bake.
+        double cacheMs = 0.0;
+        double uploadMs = 0.0;
+    };
+
+
+    // Prefiltered image based lighting for an equirectangular HDR environment:
+    // the split-sum BRDF lookup table, irradiance as spherical harmonics and a
+    // specular cube map whose mips are prefiltered for increasing roughness.
+    //
+    // Baking happens once per source and configuration. The results go to
+    // IblConfig::cacheDirectory, and later runs load them from there without
+    // decoding the source, so a warm start only hashes it and uploads.
+    class ImageBasedLighting
+    {
+    public:
+        // Bakes with `bakeWith`, eGpu or eCpu, when the cache misses. Throws
+        // std::runtime_error when the source can't be read or decoded.
+        ImageBasedLighting(Renderer& renderer, const std::string& hdrPath, const IblConfig& config, IblSource bakeWith = IblSource::eGpu);
+        ~ImageBasedLighting();
+
+        ImageBasedLighting(const ImageBasedLighting&) = delete;
+        ImageBasedLighting& operator=(const ImageBasedLighting&) = delete;
+
+        // Both in eShaderReadOnlyOptimal: a 2D RG16F table and an RGBA16F cube.
+        vk::ImageView getBrdfLutView() const { return m_brdfLutView; }
+        vk::ImageView getSpecularView() const { return m_specularView; }
+        // Trilinear and clamped, for both.
+        vk::Sampler getSampler() const { return m_sampler; }
+        uint32_t getSpecularMips() const { return m_specularMips; }
+        const std::array<glm::vec3, 9>& getIrradianceSH() const { return m_irradianceSH; }
+        IblStats getStats() const { return m_stats; }
+
+    private:
+        void createTextures(const IblData& data);
+
+        Renderer& m_renderer;
+        Image m_brdfLut;
+        vk::ImageView m_brdfLutView;
+        Image m_specular;
+        vk::ImageView m_specularView;
+        // Owned by the pipeline cache.
+        vk::Sampler m_sampler;
+        uint32_t m_specularMips = 0;
+        std::array<glm::vec3, 9> m_irradianceSH{};
+        IblStats m_stats;
+    };
+}
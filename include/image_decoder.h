@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bvr
+{
+    // Decoded image, always expanded to 8-bit RGBA.
+    struct DecodedImage
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> rgba;
+    };
+
+    // Decodes a PNG from memory. Supports every non-interlaced color type at
+    // 8 bits per channel, paletted images at 1-8 bits and 16-bit images (which
+    // are truncated to 8 bits). Throws std::runtime_error on anything else.
+    DecodedImage decodePng(const uint8_t* data, size_t size);
+
+    bool isPng(const uint8_t* data, size_t size);
+
+    // Decodes a baseline or extended sequential (Huffman coded, 8-bit) JPEG
+    // from memory, grayscale or YCbCr with any chroma subsampling. Progressive,
+    // arithmetic coded and CMYK images throw std::runtime_error.
+    DecodedImage decodeJpeg(const uint8_t* data, size_t size);
+
+    bool isJpeg(const uint8_t* data, size_t size);
+
+    // Decodes a PNG or JPEG, picked by signature.
+    DecodedImage decodeImage(const uint8_t* data, size_t size);
+
+
+    // Decoded high dynamic range image, linear RGBA with alpha set to 1.
+    struct DecodedHdrImage
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<float> rgba;
+    };
+
+    // Decodes a Radiance RGBE (.hdr) image from memory, flat or run-length
+    // encoded, in the usual -Y H +X W orientation. Throws std::runtime_error on
+    // anything else.
+    DecodedHdrImage decodeHdr(const uint8_t* data, size_t size);
+
+    bool isHdr(const uint8_t* data, size_t size);
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "gpu_memory.h"
+#include "render_graph.h"
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace bvr
+{
+    class Renderer;
+    struct FrameContext;
+
+
+    // Meshes every InstanceCuller shares, all fitting the unit sphere.
+    enum class BuiltinMesh : uint32_t
+    {
+        eCube,
+        eOctahedron,
+        eTetrahedron,
+        eCount,
+    };
+
+
+    struct BuiltinMeshRange
+    {
+        uint32_t indexCount = 0;
+        uint32_t firstIndex = 0;
+        int32_t vertexOffset = 0;
+    };
+
+    // Every built-in mesh packed into one position and one index array.
+    struct BuiltinMeshGeometry
+    {
+        std::vector<glm::vec3> vertices;
+        std::vector<uint32_t> indices;
+        // Indexed by BuiltinMesh.
+        std::array<BuiltinMeshRange, size_t(BuiltinMesh::eCount)> ranges;
+    };
+
+    BuiltinMeshGeometry buildBuiltinMeshes();
+
+    // World space bounding sphere of a built-in mesh drawn with `transform`,
+    // center in xyz and radius in w.
+    glm::vec4 builtinMeshBounds(const glm::mat4& transform);
+
+
+    // Per-instance data as parallel arrays, uploaded as one storage buffer each.
+    struct InstanceSet
+    {
+        // World space bounding spheres, center in xyz and radius in w.
+        std::vector<glm::vec4> bounds;
+        std::vector<glm::mat4> transforms;
+        std::vector<glm::vec4> colors;
+        std::vector<uint32_t> meshes;
+
+        // Derives the bounds from the transform, built-in meshes fit the unit sphere.
+        void add(const glm::mat4& transform, const glm::vec4& color, BuiltinMesh mesh);
+        uint32_t size() const { return uint32_t(transforms.size()); }
+    };
+
+
+    // Bounding spheres split into one array per component, so the CPU culler
+    // loads four spheres per SIMD register.
+    struct BoundsSoA
+    {
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<float> radius;
+
+        explicit BoundsSoA(const std::vector<glm::vec4>& bounds);
+    };
+
+
+    struct CullView
+    {
+        glm::mat4 viewProjection;
+        // Left, right, bottom, top, near, far. Normalized, pointing inwards.
+        std::array<glm::vec4, 6> planes;
+    };
+
+    // Expects a projection with Vulkan's 0..1 depth range.
+    CullView makeCullView(const glm::mat4& viewProjection);
+
+    // Writes the index of every sphere in [begin, end) that intersects the
+    // frustum to `visible` and returns how many it wrote. Tests four spheres at
+    // a time with SSE2 where available.
+    uint32_t frustumCullSpheres(const CullView& view, const BoundsSoA& bounds, uint32_t begin, uint32_t end, uint32_t* visible);
+
+
+    enum class CullMode
+    {
+        // SIMD frustum culling on the job system, one draw call per survivor.
+        eCpu,
+        // Frustum and Hi-Z occlusion culling in a compute pass, drawn with a
+        // single vkCmdDrawIndexedIndirectCount.
+        eGpu,
+    };
+
+
+    struct CullStats
+    {
+        uint32_t instances = 0;
+        // Survivors of the last CPU culled frame.
+        uint32_t cpuVisible = 0;
+        double cpuCullMs = 0.0;
+        // Survivors of the last GPU culled frame that has retired, read back
+        // framesInFlight frames late. UINT32_MAX until the first one retired.
+        uint32_t gpuVisible = UINT32_MAX;
+        // Whether the last GPU culled frame tested occlusion against a Hi-Z
+        // pyramid of the frame before.
+        bool occlusionTested = false;
+    };
+
+
+    // Culls and draws an InstanceSet into the renderer's color target. The
+    // instance data is uploaded once and only the camera changes per frame.
+    //
+    // GPU culling adds these passes to the frame graph:
+    //  - "clear_count" and "cull", which compacts the survivors into indirect
+    //    draw commands,
+    //  - "draw", a depth tested raster pass drawing them,
+    //  - "hiz_build", reducing the depth buffer into a max-depth pyramid that
+    //    the next frame's "cull" tests against,
+    //  - "count_readback", copying the survivor count for CullStats.
+    // The pyramid is only valid for consecutive GPU culled frames; switching to
+    // the CPU invalidates it.
+    class InstanceCuller
+    {
+    public:
+        InstanceCuller(Renderer& renderer, const InstanceSet& instances);
+        ~InstanceCuller();
+
+        InstanceCuller(const InstanceCuller&) = delete;
+        InstanceCuller& operator=(const InstanceCuller&) = delete;
+
+        // True once the instance data has been uploaded and acquired by a frame.
+        bool isReady() const { return m_ready->load(std::memory_order_acquire); }
+
+        // Adds the passes culling and drawing the instances into `target`. Call
+        // from the Renderer::renderFrameGraph() callback once isReady().
+        void addPasses(RenderGraph& graph, FrameContext& frame, GraphResource target, const glm::mat4& viewProjection, CullMode mode);
+
+        CullStats getStats() const { return m_stats; }
+
+    private:
+        struct MeshDraw
+        {
+            uint32_t indexCount = 0;
+            uint32_t firstIndex = 0;
+            int32_t vertexOffset = 0;
+            uint32_t padding = 0;
+        };
+
+        struct HizLevel
+        {
+            vk::ImageView view;
+            vk::Extent2D extent;
+        };
+
+        void createBuffers(const InstanceSet& instances);
+        void createMeshes();
+        void createHizPyramid();
+        void createPipelines();
+        void addGpuPasses(RenderGraph& graph, FrameContext& frame, GraphResource target, const CullView& view);
+        void addCpuPasses(RenderGraph& graph, FrameContext& frame, GraphResource target, const CullView& view);
+        void readBackCount(uint32_t frameSlot);
+
+        Renderer& m_renderer;
+        uint32_t m_instanceCount = 0;
+        BoundsSoA m_cpuBounds;
+        std::vector<uint32_t> m_cpuMeshes;
+        std::vector<MeshDraw> m_meshDraws;
+        // Shared with the upload callback, which may outlive the culler.
+        std::shared_ptr<std::atomic<bool>> m_ready;
+        uint64_t m_uploadValue = 0;
+
+        Buffer m_bounds;
+        Buffer m_transforms;
+        Buffer m_colors;
+        Buffer m_meshes;
+        Buffer m_meshTable;
+        Buffer m_vertices;
+        Buffer m_indices;
+
+        Image m_hiz;
+        vk::ImageView m_hizView;
+        std::vector<HizLevel> m_hizLevels;
+        bool m_hizValid = false;
+        glm::mat4 m_hizViewProjection{ 1.0f };
+
+        // One per frame slot, so a count is only read once its frame retired.
+        std::vector<Buffer> m_countReadbacks;
+        std::vector<bool> m_countPending;
+
+        // Only used to create the draw pipeline. Frames draw through the render
+        // graph's own, compatible render pass.
+        vk::RenderPass m_drawRenderPass;
+        vk::DescriptorSetLayout m_cullSetLayout;
+        vk::DescriptorSetLayout m_hizSetLayout;
+        vk::DescriptorSetLayout m_drawSetLayout;
+        vk::PipelineLayout m_cullLayout;
+        vk::PipelineLayout m_hizLayout;
+        vk::PipelineLayout m_drawLayout;
+        vk::Pipeline m_cullPipeline;
+        vk::Pipeline m_hizPipeline;
+        vk::Pipeline m_drawPipeline;
+        // Nearest filtering over every mip, for the depth buffer and the pyramid.
+        vk::Sampler m_pointSampler;
+
+        std::vector<std::vector<uint32_t>> m_cpuVisible;
+        CullStats m_stats;
+    };
+}
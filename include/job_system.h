@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bvr
+{
+    // Tracks a group of jobs. Waiting on it runs other jobs instead of blocking.
+    struct JobCounter
+    {
+        std::atomic<uint32_t> pending{ 0 };
+        // First exception a job threw, rethrown by JobSystem::wait().
+        std::mutex errorMutex;
+        std::exception_ptr error;
+
+        bool isDone() const { return pending.load(std::memory_order_acquire) == 0; }
+    };
+
+
+    // Fixed pool of worker threads, each with its own job queue. Workers pop the
+    // newest job from their own queue (it is most likely still in cache) and, when
+    // it runs dry, steal the oldest job from another worker.
+    //
+    // Queue 0 belongs to every thread outside the pool, including the one that
+    // created it. Those threads only run jobs while they wait on a counter, and
+    // only one of them may wait at a time, since they all share worker index 0.
+    class JobSystem
+    {
+    public:
+        using Job = std::function<void()>;
+
+        // `threadCount` includes the calling thread. 0 uses one per hardware thread.
+        explicit JobSystem(uint32_t threadCount = 0);
+        ~JobSystem();
+
+        JobSystem(const JobSystem&) = delete;
+        JobSystem& operator=(const JobSystem&) = delete;
+
+        void run(Job job, JobCounter& counter);
+
+        // Splits [0, count) into ranges of at most `grainSize` and runs
+        // `fn(begin, end)` for each of them.
+        void parallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& fn, JobCounter& counter);
+
+        // Runs queued jobs on the calling thread until the counter reaches zero,
+        // then rethrows the first exception one of its jobs threw. Throws
+        // std::runtime_error when another thread outside the pool is waiting.
+        void wait(JobCounter& counter);
+
+        uint32_t getThreadCount() const { return uint32_t(m_queues.size()); }
+
+        // Index of the calling thread in [0, getThreadCount()). Threads that aren't
+        // workers of this job system, including workers of another one, report 0.
+        uint32_t getWorkerIndex() const;
+
+    private:
+        struct WorkQueue
+        {
+            std::mutex mutex;
+            std::deque<std::pair<Job, JobCounter*>> jobs;
+        };
+
+        void workerLoop(uint32_t workerIndex);
+        bool tryRunOne(uint32_t workerIndex);
+        bool popLocal(uint32_t workerIndex, std::pair<Job, JobCounter*>& out);
+        bool steal(uint32_t thiefIndex, std::pair<Job, JobCounter*>& out);
+
+        std::vector<std::unique_ptr<WorkQueue>> m_queues;
+        std::vector<std::thread> m_threads;
+
+        std::atomic<uint32_t> m_queuedJobs{ 0 };
+        std::atomic<uint32_t> m_nextQueue{ 0 };
+        std::atomic<bool> m_running{ true };
+        // The thread outside the pool currently waiting, as worker 0.
+        std::atomic<std::thread::id> m_outsideWaiter{};
+        std::mutex m_sleepMutex;
+        std::condition_variable m_wake;
+    };
+}
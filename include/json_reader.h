@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bvr
+{
+    // In-situ JSON parser. Strings and keys are views into the source text, which
+    // must outlive the document, so parsing a memory-mapped file copies nothing
+    // but the node table.
+    class JsonDocument
+    {
+    public:
+        enum class Type : uint8_t
+        {
+            eNull,
+            eBool,
+            eNumber,
+            eString,
+            eArray,
+            eObject,
+        };
+
+        static constexpr uint32_t kInvalid = UINT32_MAX;
+
+        // Lightweight handle to a node. Lookups on missing nodes return invalid
+        // values instead of throwing, so optional glTF properties read naturally:
+        // `node["extras"]["foo"].asNumber(1.0)`.
+        class Value
+        {
+        public:
+            Value() = default;
+            Value(const JsonDocument* document, uint32_t index) : m_document(document), m_index(index) { }
+
+            bool isValid() const { return m_index != kInvalid; }
+            Type getType() const;
+            bool isArray() const { return isValid() && getType() == Type::eArray; }
+            bool isObject() const { return isValid() && getType() == Type::eObject; }
+
+            Value operator[](const char* key) const;
+            Value operator[](uint32_t index) const;
+            uint32_t size() const;
+
+            double asNumber(double fallback = 0.0) const;
+            uint32_t asUint(uint32_t fallback = 0) const { return uint32_t(asNumber(double(fallback))); }
+            bool asBool(bool fallback = false) const;
+            // Raw contents between the quotes, escape sequences are left as is.
+            std::string_view asRawString(std::string_view fallback = {}) const;
+            // Unescaped copy, for the rare strings that may contain escapes (URIs, names).
+            std::string asString(const std::string& fallback = {}) const;
+
+            // Iteration over arrays and objects.
+            Value firstChild() const;
+            Value next() const;
+            std::string_view key() const;
+
+        private:
+            const JsonDocument* m_document = nullptr;
+            uint32_t m_index = kInvalid;
+        };
+
+        // Throws std::runtime_error on malformed input.
+        void parse(const char* text, size_t length);
+
+        Value root() const { return Value{ this, m_nodes.empty() ? kInvalid : 0 }; }
+
+    private:
+        struct Node
+        {
+            Type type = Type::eNull;
+            uint32_t childCount = 0;
+            uint32_t firstChild = kInvalid;
+            uint32_t nextSibling = kInvalid;
+            double number = 0.0;
+            std::string_view string;
+            std::string_view key;
+        };
+
+        uint32_t parseValue(uint32_t depth);
+        void parseString(std::string_view& out);
+        void skipWhitespace();
+        [[noreturn]] void fail(const char* message) const;
+
+        std::vector<Node> m_nodes;
+        const char* m_text = nullptr;
+        size_t m_length = 0;
+        size_t m_pos = 0;
+    };
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace bvr
+{
+    // Minimal streaming JSON writer used for stats and benchmark reports.
+    // Keys and values must alternate inside objects; the writer only tracks
+    // whether a separator is needed, it does not validate the document.
+    class JsonWriter
+    {
+    public:
+        void beginObject()
+        {
+            separate();
+            m_out.push_back('{');
+            m_needsComma.push_back(false);
+        }
+
+        void endObject()
+        {
+            m_needsComma.pop_back();
+            m_out.push_back('}');
+        }
+
+        void beginArray()
+        {
+            separate();
+            m_out.push_back('[');
+            m_needsComma.push_back(false);
+        }
+
+        void endArray()
+        {
+            m_needsComma.pop_back();
+            m_out.push_back(']');
+        }
+
+        void key(const char* name)
+        {
+            separate();
+            writeString(name);
+            m_out.push_back(':');
+            m_afterKey = true;
+        }
+
+        void value(const char* str)
+        {
+            separate();
+            writeString(str);
+        }
+
+        void value(const std::string& str) { value(str.c_str()); }
+
+        void value(bool b)
+        {
+            separate();
+            m_out.append(b ? "true" : "false");
+        }
+
+        void value(double number)
+        {
+            separate();
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.6g", number);
+            m_out.append(buffer);
+        }
+
+        void value(float number) { value(double(number)); }
+
+        void value(uint64_t number)
+        {
+            separate();
+            m_out.append(std::to_string(number));
+        }
+
+        void value(int64_t number)
+        {
+            separate();
+            m_out.append(std::to_string(number));
+        }
+
+        void value(uint32_t number) { value(uint64_t(number)); }
+        void value(int32_t number) { value(int64_t(number)); }
+
+        // Splices an already serialized JSON document (e.g. from VMA) in place.
+        void raw(const char* json)
+        {
+            separate();
+            m_out.append(json);
+        }
+
+        template<typename T>
+        void field(const char* name, const T& v)
+        {
+            key(name);
+            value(v);
+        }
+
+        const std::string& str() const { return m_out; }
+
+    private:
+        void separate()
+        {
+            if (m_afterKey) {
+                m_afterKey = false;
+                return;
+            }
+            if (!m_needsComma.empty()) {
+                if (m_needsComma.back()) {
+                    m_out.push_back(',');
+                }
+                m_needsComma.back() = true;
+            }
+        }
+
+        void writeString(const char* str)
+        {
+            m_out.push_back('"');
+            for (const char* c = str; *c != '\0'; ++c) {
+                switch (*c) {
+                case '"': m_out.append("\\\""); break;
+                case '\\': m_out.append("\\\\"); break;
+                case '\n': m_out.append("\\n"); break;
+                case '\t': m_out.append("\\t"); break;
+                default:
+                    if (uint8_t(*c) < 0x20) {
+                        char buffer[8];
+                        snprintf(buffer, sizeof(buffer), "\\u%04x", unsigned(uint8_t(*c)));
+                        m_out.append(buffer);
+                    }
+                    else {
+                        m_out.push_back(*c);
+                    }
+                }
+            }
+            m_out.push_back('"');
+        }
+
+        std::string m_out;
+        std::vector<bool> m_needsComma;
+        bool m_afterKey = false;
+    };
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bvr
+{
+    // A 2D texture or cube map as stored in a KTX2 file. Only uncompressed
+    // formats without supercompression, which is all the renderer writes.
+    struct Ktx2Texture
+    {
+        vk::Format format = vk::Format::eUndefined;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // 6 for cube maps, faces ordered +X, -X, +Y, -Y, +Z, -Z.
+        uint32_t faceCount = 1;
+        // One per mip level, largest first, each holding every face of the
+        // level tightly packed.
+        std::vector<std::vector<uint8_t>> levels;
+    };
+
+    // Bytes per texel of the formats KTX2 files may hold here, 0 for the rest:
+    // RGBA8 (UNORM or SRGB), RG16F, RGBA16F, RG32F and RGBA32F.
+    uint32_t getKtx2TexelSize(vk::Format format);
+
+    // Bytes of mip `level` of `texture`, every face included.
+    size_t getKtx2LevelSize(const Ktx2Texture& texture, uint32_t level);
+
+    // Writes next to `path` and renames over it, so readers never see half a
+    // file. Throws std::runtime_error on I/O errors and unsupported textures.
+    void writeKtx2(const std::string& path, const Ktx2Texture& texture);
+
+    // Throws std::runtime_error on files that are corrupt or hold anything
+    // writeKtx2() can't write.
+    Ktx2Texture readKtx2(const uint8_t* data, size_t size);
+
+    bool isKtx2(const uint8_t* data, size_t size);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bvr
+{
+    // Reorders the triangles of an indexed triangle list for the post-transform
+    // vertex cache, using Tipsify (Sander et al. 2007) with a `cacheSize` entry
+    // FIFO. Runs in linear time.
+    void optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize = 16);
+
+    // Numbers vertices in the order the indices first use them, so vertex
+    // fetches walk memory forwards, and rewrites the indices. Returns the old
+    // index of every new vertex; vertices no triangle uses are dropped.
+    std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t>& indices, uint32_t vertexCount);
+
+
+    // A run of consecutive triangles of an index buffer that touches at most
+    // a meshlet's worth of vertices, with what culling it needs.
+    struct Meshlet
+    {
+        // In indices, from the start of the primitive's index buffer.
+        uint32_t firstIndex = 0;
+        uint32_t triangleCount = 0;
+        uint32_t vertexCount = 0;
+        // Bounding sphere, center and radius.
+        glm::vec4 sphere{ 0.0f };
+        // Normal cone: axis, and the sine of its half angle. Every triangle
+        // faces away from an eye at e when
+        // dot(center - e, axis) >= w * length(center - e) + radius.
+        // w is 1 for meshlets whose triangles face too many ways to ever pass.
+        glm::vec4 cone{ 0.0f, 0.0f, 1.0f, 1.0f };
+    };
+
+    // Splits the triangles, in their order, into meshlets of at most
+    // `maxVertices` unique vertices and `maxTriangles` triangles. Run after
+    // optimizeVertexCache(), whose triangle order keeps meshlets compact.
+    std::vector<Meshlet> buildMeshlets(const std::vector<uint32_t>& indices, const glm::vec3* positions, uint32_t maxVertices = 64, uint32_t maxTriangles = 124);
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bvr
+{
+    // On-disk layout of cooked asset packages (.bvrpkg), written by cookGltf()
+    // and memory mapped by PackageLoader.
+    //
+    // A package is a header, a table of contents and the chunks it points
+    // to. Table chunks are arrays of the Packed* records below; the geometry
+    // and texture chunks are blobs the records index into, in exactly the
+    // layout the GPU wants. Everything is little endian and every chunk is
+    // aligned to kPackageAlignment, so the runtime never parses or converts
+    // anything: it validates the table of contents and copies ranges.
+    //
+    // Bump kPackageVersion on any change to these structures, since readers
+    // reject other versions outright instead of guessing.
+    constexpr uint32_t kPackageMagic = 0x50525642; // "BVRP"
+    constexpr uint32_t kPackageVersion = 1;
+    constexpr uint64_t kPackageAlignment = 256;
+
+
+    enum class PackageChunk : uint32_t
+    {
+        eMeshes = 1,
+        ePrimitives,
+        eMeshlets,
+        eInstances,
+        eMaterials,
+        eTextures,
+        // Index and vertex streams of every primitive.
+        eGeometry,
+        // Mip chains of every texture.
+        eTextureData,
+    };
+
+
+    struct PackageHeader
+    {
+        uint32_t magic = kPackageMagic;
+        uint32_t version = kPackageVersion;
+        uint32_t tocCount = 0;
+        uint32_t reserved = 0;
+        uint64_t tocOffset = 0;
+        // The whole file, so truncated copies are caught before anything else.
+        uint64_t fileSize = 0;
+    };
+    static_assert(sizeof(PackageHeader) == 32, "PackageHeader layout is part of the format");
+
+
+    struct PackageTocEntry
+    {
+        PackageChunk type = PackageChunk::eMeshes;
+        // Records in table chunks, 0 for blobs.
+        uint32_t count = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+    static_assert(sizeof(PackageTocEntry) == 24, "PackageTocEntry layout is part of the format");
+
+
+    struct PackedMesh
+    {
+        uint32_t firstPrimitive = 0;
+        uint32_t primitiveCount = 0;
+    };
+    static_assert(sizeof(PackedMesh) == 8, "PackedMesh layout is part of the format");
+
+
+    // Attribute streams are separate, so position-only passes fetch 8 bytes a
+    // vertex:
+    //   position   R16G16B16A16_UNORM, quantized to the primitive's bounds:
+    //              positionBias + positionScale * value.xyz
+    //   normal     R8G8B8A8_SNORM, w is 0
+    //   texcoord0  R16G16_SFLOAT
+    // Offsets are into the geometry chunk, which is loaded as one buffer.
+    // Triangles are ordered for the vertex cache and split into meshlets, and
+    // vertices are numbered in the order the triangles use them.
+    struct PackedPrimitive
+    {
+        static constexpr uint64_t kNoStream = ~uint64_t(0);
+
+        uint64_t indexOffset = 0;
+        uint64_t positionOffset = kNoStream;
+        uint64_t normalOffset = kNoStream;
+        uint64_t texcoordOffset = kNoStream;
+        // xyz only, w is unused.
+        glm::vec4 positionBias{ 0.0f };
+        glm::vec4 positionScale{ 1.0f };
+        uint32_t indexCount = 0;
+        uint32_t vertexCount = 0;
+        // 2 for uint16 indices, 4 for uint32.
+        uint32_t indexSize = 4;
+        int32_t material = -1;
+        uint32_t firstMeshlet = 0;
+        uint32_t meshletCount = 0;
+        uint32_t reserved[2] = {};
+
+        bool hasNormals() const { return normalOffset != kNoStream; }
+        bool hasTexcoords() const { return texcoordOffset != kNoStream; }
+    };
+    static_assert(sizeof(PackedPrimitive) == 96, "PackedPrimitive layout is part of the format");
+
+
+    // See Meshlet in mesh_optimizer.h, in the primitive's dequantized space.
+    struct PackedMeshlet
+    {
+        glm::vec4 sphere{ 0.0f };
+        glm::vec4 cone{ 0.0f, 0.0f, 1.0f, 1.0f };
+        // In indices, from the primitive's first index.
+        uint32_t firstIndex = 0;
+        uint32_t triangleCount = 0;
+        uint32_t vertexCount = 0;
+        uint32_t reserved = 0;
+    };
+    static_assert(sizeof(PackedMeshlet) == 48, "PackedMeshlet layout is part of the format");
+
+
+    struct PackedInstance
+    {
+        glm::mat4 world{ 1.0f };
+        uint32_t mesh = 0;
+        uint32_t reserved[3] = {};
+    };
+    static_assert(sizeof(PackedInstance) == 80, "PackedInstance layout is part of the format");
+
+
+    // Texture indices are into the textures chunk, -1 when unused. Normal maps
+    // are two channel (BC5 or the RG of RGBA8), shaders rebuild z.
+    struct PackedMaterial
+    {
+        glm::vec4 baseColorFactor{ 1.0f };
+        float metallicFactor = 1.0f;
+        float roughnessFactor = 1.0f;
+        int32_t baseColorTexture = -1;
+        int32_t metallicRoughnessTexture = -1;
+        int32_t normalTexture = -1;
+        uint32_t reserved[3] = {};
+    };
+    static_assert(sizeof(PackedMaterial) == 48, "PackedMaterial layout is part of the format");
+
+
+    // A full mip chain in the texture data chunk, largest mip first, each
+    // tightly packed as getImageLevelSize() describes. Textures the cooker
+    // couldn't decode have no levels.
+    struct PackedTexture
+    {
+        uint64_t dataOffset = 0;
+        uint64_t dataSize = 0;
+        // A VkFormat.
+        uint32_t format = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t levelCount = 0;
+    };
+    static_assert(sizeof(PackedTexture) == 32, "PackedTexture layout is part of the format");
+
+
+    // A table chunk viewed in place, inside the package's mapping.
+    template<typename T>
+    struct PackageTable
+    {
+        const T* data = nullptr;
+        uint32_t count = 0;
+
+        const T* begin() const { return data; }
+        const T* end() const { return data + count; }
+        uint32_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        const T& operator[](size_t i) const { return data[i]; }
+    };
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "gltf_loader.h"
+#include "gpu_memory.h"
+#include "mapped_file.h"
+#include "package_format.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bvr
+{
+    class Renderer;
+
+
+    // Vertex formats of the streams of a PackedPrimitive, for pipelines that
+    // draw packages.
+    constexpr vk::Format kPackagePositionFormat = vk::Format::eR16G16B16A16Unorm;
+    constexpr vk::Format kPackageNormalFormat = vk::Format::eR8G8B8A8Snorm;
+    constexpr vk::Format kPackageTexcoordFormat = vk::Format::eR16G16Sfloat;
+
+
+    struct PackageTexture
+    {
+        Image image;
+        vk::ImageView view;
+        vk::Format format = vk::Format::eUndefined;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t levelCount = 0;
+
+        // False for textures the cooker couldn't decode or the device can't
+        // sample, draw with a fallback instead.
+        bool isValid() const { return bool(view); }
+    };
+
+
+    struct PackageLoadStats
+    {
+        uint64_t fileBytes = 0;
+        uint64_t geometryBytes = 0;
+        // As stored, so compressed for BC textures.
+        uint64_t textureBytes = 0;
+        // Empty in the package, or in a format the device can't sample.
+        uint32_t texturesSkipped = 0;
+        // Milliseconds since PackageLoader::load().
+        double parsedMs = 0.0;
+        double drawableMs = 0.0;
+        double residentMs = 0.0;
+    };
+
+
+    // A cooked package streamed onto the GPU. The tables are views into the
+    // package's mapping, which the asset keeps open. Same threading rules as
+    // GltfAsset: everything but the state is read-only once getState()
+    // returns eDrawable or eResident.
+    class PackageAsset
+    {
+    public:
+        AssetState getState() const { return m_state.load(std::memory_order_acquire); }
+        bool isDrawable() const { AssetState state = getState(); return state == AssetState::eDrawable || state == AssetState::eResident; }
+        const std::string& getPath() const { return m_path; }
+        // Set once the state is eFailed.
+        const std::string& getError() const { return m_error; }
+
+        // The package's geometry chunk; PackedPrimitive offsets index into it.
+        // Defragmentation may move it, look the buffer up every frame.
+        vk::Buffer getGeometryBuffer() const;
+        PackageTable<PackedMesh> getMeshes() const { return m_meshes; }
+        PackageTable<PackedPrimitive> getPrimitives() const { return m_primitives; }
+        PackageTable<PackedMeshlet> getMeshlets() const { return m_meshlets; }
+        PackageTable<PackedInstance> getInstances() const { return m_instances; }
+        PackageTable<PackedMaterial> getMaterials() const { return m_materials; }
+        // Only complete once the state is eResident.
+        const std::vector<PackageTexture>& getTextures() const { return m_textures; }
+        PackageLoadStats getStats() const;
+
+    private:
+        friend class PackageLoader;
+
+        std::string m_path;
+        std::atomic<AssetState> m_state{ AssetState::eQueued };
+        std::string m_error;
+        std::chrono::steady_clock::time_point m_requested;
+
+        MappedFile m_file;
+        GpuMemory* m_memory = nullptr;
+        MovableBufferHandle m_geometry;
+        PackageTable<PackedMesh> m_meshes;
+        PackageTable<PackedPrimitive> m_primitives;
+        PackageTable<PackedMeshlet> m_meshlets;
+        PackageTable<PackedInstance> m_instances;
+        PackageTable<PackedMaterial> m_materials;
+        std::vector<PackageTexture> m_textures;
+        // Upload timeline value after which the GPU no longer writes to the asset.
+        uint64_t m_lastUploadValue = 0;
+
+        mutable std::mutex m_statsMutex;
+        PackageLoadStats m_stats;
+    };
+
+
+    // Loads packages written by cookGltf() on a background thread. Loading a
+    // package is validation and copies: the table of contents and every record
+    // are bounds checked against the mapping, then the geometry chunk goes to
+    // the GPU in one upload and every texture in another, straight from the
+    // mapping into the upload staging ring. Nothing is decoded or converted.
+    //
+    // Like GltfLoader, assets only become drawable and resident while the
+    // renderer keeps rendering frames.
+    class PackageLoader
+    {
+    public:
+        PackageLoader(Renderer& renderer);
+        // Must run on the render thread, before the renderer is destroyed.
+        ~PackageLoader();
+
+        PackageLoader(const PackageLoader&) = delete;
+        PackageLoader& operator=(const PackageLoader&) = delete;
+
+        // Queues a file and returns immediately.
+        std::shared_ptr<PackageAsset> load(const std::string& path);
+        // Releases the asset's GPU resources once no frame uses them anymore.
+        // The asset must be resident or failed. Call from the render thread.
+        void unload(const std::shared_ptr<PackageAsset>& asset);
+
+    private:
+        void loaderLoop();
+        void loadAsset(const std::shared_ptr<PackageAsset>& asset);
+        void releaseResources(PackageAsset& asset);
+
+        Renderer& m_renderer;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::deque<std::shared_ptr<PackageAsset>> m_queue;
+        std::vector<std::shared_ptr<PackageAsset>> m_assets;
+        bool m_running = true;
+        std::thread m_thread;
+    };
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace bvr
+{
+    // What PipelineCache found on disk at startup.
+    enum class PipelineCacheLoad
+    {
+        // No cache file, every pipeline compiles from scratch.
+        eCold,
+        eWarm,
+        // A cache file existed but was written by another device or driver, or
+        // was corrupt, and was discarded.
+        eInvalidated,
+    };
+
+    const char* toString(PipelineCacheLoad load);
+
+
+    struct PipelineCacheStats
+    {
+        PipelineCacheLoad load = PipelineCacheLoad::eCold;
+        size_t diskBytes = 0;
+        uint64_t pipelineHits = 0;
+        uint64_t pipelineMisses = 0;
+        uint64_t layoutHits = 0;
+        uint64_t layoutMisses = 0;
+        uint64_t samplerHits = 0;
+        uint64_t samplerMisses = 0;
+        // Time spent inside vkCreate*Pipelines, on any thread.
+        double compileMs = 0.0;
+    };
+
+
+    // A pipeline that may still be compiling on the background thread.
+    class AsyncPipeline
+    {
+    public:
+        bool isReady() const { return m_state.load(std::memory_order_acquire) != State::ePending; }
+        bool isFailed() const { return m_state.load(std::memory_order_acquire) == State::eFailed; }
+        // Null until the pipeline is ready, and for failed compilations.
+        vk::Pipeline get() const { return isReady() ? m_pipeline : vk::Pipeline{}; }
+
+    private:
+        friend class PipelineCache;
+
+        enum class State
+        {
+            ePending,
+            eReady,
+            eFailed,
+        };
+
+        std::atomic<State> m_state{ State::ePending };
+        vk::Pipeline m_pipeline;
+        // Null for compute pipelines.
+        vk::RenderPass m_renderPass;
+    };
+
+
+    // The bytes a create info was hashed from, together with the hash. Lookups
+    // compare the bytes, so a hash collision is never a hit.
+    struct PipelineCacheKey
+    {
+        uint64_t hash = 0;
+        std::vector<uint8_t> bytes;
+
+        bool operator==(const PipelineCacheKey& other) const { return hash == other.hash && bytes == other.bytes; }
+    };
+
+    struct PipelineCacheKeyHash
+    {
+        size_t operator()(const PipelineCacheKey& key) const { return size_t(key.hash); }
+    };
+
+
+    // Owns every pipeline, pipeline layout, descriptor set layout, sampler and
+    // shader module the renderer creates, deduplicated by their create info.
+    // Requesting the same state twice returns the same handle, so callers never
+    // destroy what they get from here.
+    //
+    // Pipelines are compiled through a VkPipelineCache that is loaded from and
+    // saved to disk. The file is only reused when it was written by the same
+    // vendor, device, driver version and pipeline cache UUID.
+    //
+    // Create infos are hashed field by field, following their pointers. pNext
+    // chains are rejected, except descriptor set layout binding flags. Shader
+    // modules are hashed by handle, so create them through getShaderModule() to
+    // deduplicate by SPIR-V content. Render passes are hashed by handle too, see
+    // releaseRenderPass().
+    //
+    // Thread safe.
+    class PipelineCache
+    {
+    public:
+        // An empty `path` keeps the cache in memory only.
+        PipelineCache(vk::Device device, const vk::PhysicalDeviceProperties& properties, const std::string& path);
+        // Saves the cache and destroys everything it created.
+        ~PipelineCache();
+
+        PipelineCache(const PipelineCache&) = delete;
+        PipelineCache& operator=(const PipelineCache&) = delete;
+
+        vk::ShaderModule getShaderModule(const uint32_t* code, size_t size);
+        vk::DescriptorSetLayout getDescriptorSetLayout(const vk::DescriptorSetLayoutCreateInfo& createInfo);
+        vk::PipelineLayout getPipelineLayout(const vk::PipelineLayoutCreateInfo& createInfo);
+        vk::Sampler getSampler(const vk::SamplerCreateInfo& createInfo);
+
+        // Compiles on the calling thread on a miss. Waits if the same pipeline is
+        // being compiled in the background. Throws when compilation fails.
+        vk::Pipeline getGraphicsPipeline(const vk::GraphicsPipelineCreateInfo& createInfo);
+        vk::Pipeline getComputePipeline(const vk::ComputePipelineCreateInfo& createInfo);
+
+        // Copies the create info and compiles it on the background thread. Every
+        // handle it references must stay alive until the pipeline is ready.
+        std::shared_ptr<const AsyncPipeline> compileGraphicsPipelineAsync(const vk::GraphicsPipelineCreateInfo& createInfo);
+        std::shared_ptr<const AsyncPipeline> compileComputePipelineAsync(const vk::ComputePipelineCreateInfo& createInfo);
+
+        // Destroys the pipelines created for `renderPass`, so one that later
+        // reuses its handle never gets them. Call it right before destroying the
+        // render pass, once no frame uses those pipelines anymore.
+        void releaseRenderPass(vk::RenderPass renderPass);
+
+        // Writes the VkPipelineCache to disk, a no-op without a path.
+        void save() const;
+
+        vk::PipelineCache getVkCache() const { return m_cache; }
+        PipelineCacheStats getStats() const;
+
+    private:
+        struct OwnedGraphicsPipelineInfo;
+        struct OwnedComputePipelineInfo;
+
+        struct CompileRequest
+        {
+            std::shared_ptr<AsyncPipeline> pipeline;
+            std::shared_ptr<OwnedGraphicsPipelineInfo> graphics;
+            std::shared_ptr<OwnedComputePipelineInfo> compute;
+        };
+
+        std::vector<uint8_t> loadFromDisk();
+        // Returns the entry for `key`, inserting a pending one when missing.
+        std::shared_ptr<AsyncPipeline> findOrInsertPipeline(PipelineCacheKey key, vk::RenderPass renderPass, bool& inserted);
+        void compile(AsyncPipeline& pipeline, const vk::GraphicsPipelineCreateInfo* graphics, const vk::ComputePipelineCreateInfo* compute);
+        vk::Pipeline waitForPipeline(const AsyncPipeline& pipeline);
+        void compileLoop();
+
+        vk::Device m_device;
+        vk::PhysicalDeviceProperties m_properties;
+        std::string m_path;
+        vk::PipelineCache m_cache;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_compiled;
+        std::unordered_map<PipelineCacheKey, vk::ShaderModule, PipelineCacheKeyHash> m_shaderModules;
+        std::unordered_map<PipelineCacheKey, vk::DescriptorSetLayout, PipelineCacheKeyHash> m_setLayouts;
+        std::unordered_map<PipelineCacheKey, vk::PipelineLayout, PipelineCacheKeyHash> m_pipelineLayouts;
+        std::unordered_map<PipelineCacheKey, vk::Sampler, PipelineCacheKeyHash> m_samplers;
+        std::unordered_map<PipelineCacheKey, std::shared_ptr<AsyncPipeline>, PipelineCacheKeyHash> m_pipelines;
+        PipelineCacheStats m_stats;
+
+        // Background compilation, started on the first asynchronous request.
+        std::deque<CompileRequest> m_compileQueue;
+        std::condition_variable m_compileWake;
+        bool m_running = true;
+        std::thread m_compileThread;
+    };
+}
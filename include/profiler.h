@@ -0,0 +1,216 @@
+#pragma once
+
+// BVR_PROFILE selects whether profiling is compiled in. Release builds leave it
+// out unless genie ran with --with-profiler; every zone then expands to nothing
+// and no query pool is created.
+#ifndef BVR_PROFILE
+#ifdef NDEBUG
+#define BVR_PROFILE 0
+#else
+#define BVR_PROFILE 1
+#endif
+#endif
+
+#if BVR_PROFILE
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace bvr
+{
+    class JsonWriter;
+
+
+    // The subset of VkQueryPipelineStatisticFlags the GPU profiler requests,
+    // in the order of the query results.
+    struct PipelineStatistics
+    {
+        uint64_t inputAssemblyVertices = 0;
+        uint64_t vertexShaderInvocations = 0;
+        uint64_t clippingPrimitives = 0;
+        uint64_t fragmentShaderInvocations = 0;
+        uint64_t computeShaderInvocations = 0;
+    };
+
+
+    // A finished zone on one timeline. Times are in microseconds since the
+    // profiler started.
+    struct ProfileEvent
+    {
+        // A string literal or a Profiler::intern()ed name.
+        const char* name = nullptr;
+        uint32_t thread = 0;
+        double startUs = 0.0;
+        double durationUs = 0.0;
+        bool gpu = false;
+        bool hasStatistics = false;
+        PipelineStatistics statistics;
+    };
+
+
+    // Collects CPU zones from any thread and GPU zones from the GpuProfiler,
+    // and exports both as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+    // Each thread appends to its own buffer, so zones on different threads
+    // never contend.
+    class Profiler
+    {
+    public:
+        static Profiler& get();
+
+        // Starts disabled. Zones opened while disabled record nothing.
+        void setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+        bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+        // Nanoseconds on the profiler's clock.
+        static uint64_t now();
+
+        void addCpuZone(const char* name, uint64_t startNs, uint64_t endNs);
+        void addGpuZone(const char* name, double startUs, double durationUs, const PipelineStatistics* statistics);
+
+        // Names the calling thread's track in the trace.
+        void setThreadName(const std::string& name);
+        // Keeps a copy of `name` alive until the profiler is destroyed, for zone
+        // names that don't outlive the frame, like render graph passes.
+        const char* intern(const std::string& name);
+
+        // Drops every recorded event, keeping thread names.
+        void clear();
+        size_t getEventCount() const;
+
+        void writeChromeTrace(JsonWriter& json) const;
+        // Throws std::runtime_error when `path` can't be written.
+        void writeChromeTrace(const std::string& path) const;
+
+    private:
+        struct ThreadBuffer
+        {
+            uint32_t thread = 0;
+            std::string name;
+            // Only contended while exporting or clearing.
+            mutable std::mutex mutex;
+            std::vector<ProfileEvent> events;
+        };
+
+        Profiler() = default;
+        ThreadBuffer& getThreadBuffer();
+
+        std::atomic<bool> m_enabled{ false };
+
+        mutable std::mutex m_mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> m_threads;
+        ThreadBuffer m_gpu;
+        std::unordered_set<std::string> m_names;
+    };
+
+
+    // Times a scope on the calling thread, see BVR_PROFILE_ZONE.
+    class ProfileZone
+    {
+    public:
+        explicit ProfileZone(const char* name) :
+            m_name(name),
+            m_active(Profiler::get().isEnabled()),
+            m_start(m_active ? Profiler::now() : 0)
+        { }
+
+        ~ProfileZone()
+        {
+            if (m_active) {
+                Profiler::get().addCpuZone(m_name, m_start, Profiler::now());
+            }
+        }
+
+        ProfileZone(const ProfileZone&) = delete;
+        ProfileZone& operator=(const ProfileZone&) = delete;
+
+    private:
+        const char* m_name;
+        bool m_active;
+        uint64_t m_start;
+    };
+
+
+    // Per-pass GPU timestamps and pipeline statistics, one query pool pair per
+    // frame in flight. A slot's queries are only read once the renderer has
+    // retired its frame, so reading them never stalls.
+    //
+    // Timestamps are placed on the CPU timeline relative to the frame's
+    // submission, since the two clocks aren't calibrated against each other.
+    class GpuProfiler
+    {
+    public:
+        // `timestampValidBits` is the queue family's, the bits above it are
+        // undefined and the counter wraps at that width.
+        GpuProfiler(vk::Device device, uint32_t frameSlots, float timestampPeriod, uint32_t timestampValidBits, bool pipelineStatistics);
+        ~GpuProfiler();
+
+        GpuProfiler(const GpuProfiler&) = delete;
+        GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+        // Resets the slot's queries. Outside of a render pass.
+        void beginFrame(vk::CommandBuffer commandBuffer, uint32_t frameSlot);
+        // Remembers when the frame was submitted, to place its zones.
+        void endFrame();
+        // Reads back the slot's queries into the Profiler. The frame that used
+        // the slot must have retired.
+        void collect(uint32_t frameSlot);
+
+        // Zones must not overlap, and both ends must be outside of a render pass.
+        // Pipeline statistics are only gathered when `statistics` is set; passes
+        // executing secondary command buffers must not set it, since they can't
+        // inherit the query. Returns UINT32_MAX when nothing is measured.
+        uint32_t beginZone(vk::CommandBuffer commandBuffer, const char* name, bool statistics);
+        void endZone(vk::CommandBuffer commandBuffer, uint32_t zone);
+
+        bool hasPipelineStatistics() const { return m_pipelineStatistics; }
+
+    private:
+        struct Zone
+        {
+            const char* name = nullptr;
+            uint32_t statisticsQuery = UINT32_MAX;
+        };
+
+        struct Slot
+        {
+            vk::QueryPool timestamps;
+            vk::QueryPool statistics;
+            std::vector<Zone> zones;
+            uint32_t statisticsUsed = 0;
+            uint64_t submitNs = 0;
+            bool recording = false;
+            bool pending = false;
+        };
+
+        static const uint32_t kMaxZones = 256;
+
+        vk::Device m_device;
+        float m_timestampPeriod = 1.0f;
+        uint64_t m_timestampMask = ~0ull;
+        bool m_pipelineStatistics = false;
+        std::vector<Slot> m_slots;
+        Slot* m_current = nullptr;
+    };
+}
+
+#define BVR_PROFILE_CONCAT_INNER(a, b) a##b
+#define BVR_PROFILE_CONCAT(a, b) BVR_PROFILE_CONCAT_INNER(a, b)
+// Times the rest of the enclosing scope as a CPU zone named `name`, which must
+// be a string literal or otherwise outlive the profiler.
+#define BVR_PROFILE_ZONE(name) ::bvr::ProfileZone BVR_PROFILE_CONCAT(bvrProfileZone, __LINE__){ name }
+#define BVR_PROFILE_THREAD(name) ::bvr::Profiler::get().setThreadName(name)
+
+#else
+
+#define BVR_PROFILE_ZONE(name) do { } while (false)
+#define BVR_PROFILE_THREAD(name) do { } while (false)
+
+#endif
@@ -0,0 +1,372 @@
+#pragma once
+
+#include "gpu_memory.h"
+#include "profiler.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace bvr
+{
+    // How a pass uses a resource. Each one implies the pipeline stages, access
+    // flags, image layout and usage flags the graph derives barriers from.
+    enum class GraphAccess : uint32_t
+    {
+        eColorAttachment,
+        eDepthAttachment,
+        // Depth testing without depth writes.
+        eDepthRead,
+        eSampledFragment,
+        eSampledCompute,
+        eStorageReadVertex,
+        eStorageReadFragment,
+        eStorageReadCompute,
+        eStorageWriteCompute,
+        eUniformRead,
+        eVertexRead,
+        eIndexRead,
+        eIndirectRead,
+        eTransferRead,
+        eTransferWrite,
+    };
+
+
+    enum class GraphPassType
+    {
+        // Gets a VkRenderPass and framebuffer built from its attachments.
+        eRaster,
+        eCompute,
+        eTransfer,
+    };
+
+
+    // Refers to a resource of the graph being built. Only valid until reset().
+    struct GraphResource
+    {
+        uint32_t index = UINT32_MAX;
+
+        bool isValid() const { return index != UINT32_MAX; }
+    };
+
+
+    struct GraphImageDesc
+    {
+        vk::Format format = vk::Format::eR8G8B8A8Unorm;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mipLevels = 1;
+        uint32_t arrayLayers = 1;
+        vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+    };
+
+
+    // Where an imported resource is before the graph runs, or where it has to
+    // be once it is done.
+    struct GraphImportState
+    {
+        vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+        vk::PipelineStageFlags stages;
+        vk::AccessFlags access;
+    };
+
+
+    struct RenderGraphStats
+    {
+        uint32_t passes = 0;
+        uint32_t culledPasses = 0;
+        uint32_t transientResources = 0;
+        uint32_t imageBarriers = 0;
+        // Buffers are synchronized through global memory barriers.
+        uint32_t memoryBarriers = 0;
+        uint32_t barrierBatches = 0;
+        // Device memory the transients of the last compile occupy, and what
+        // they would occupy with one allocation each.
+        vk::DeviceSize aliasedBytes = 0;
+        vk::DeviceSize unaliasedBytes = 0;
+    };
+
+
+    class RenderGraph;
+
+    // Handed to a pass's record callback.
+    class RenderGraphContext
+    {
+    public:
+        vk::CommandBuffer getCommandBuffer() const { return m_commandBuffer; }
+        vk::Image getImage(GraphResource resource) const;
+        vk::ImageView getImageView(GraphResource resource) const;
+        vk::Buffer getBuffer(GraphResource resource) const;
+
+        // Raster passes only. The render pass is already begun when the callback
+        // runs and is ended after it returns.
+        vk::RenderPass getRenderPass() const { return m_renderPass; }
+        vk::Framebuffer getFramebuffer() const { return m_framebuffer; }
+        vk::Extent2D getExtent() const { return m_extent; }
+
+    private:
+        friend class RenderGraph;
+
+        const RenderGraph* m_graph = nullptr;
+        vk::CommandBuffer m_commandBuffer;
+        vk::RenderPass m_renderPass;
+        vk::Framebuffer m_framebuffer;
+        vk::Extent2D m_extent;
+    };
+
+
+    // Declares what a pass reads and writes. Returned by RenderGraph::addPass().
+    class RenderGraphPassBuilder
+    {
+    public:
+        RenderGraphPassBuilder& read(GraphResource resource, GraphAccess access);
+        RenderGraphPassBuilder& write(GraphResource resource, GraphAccess access);
+        // Attachments are bound in declaration order. Loading keeps the previous
+        // contents, anything else lets the graph discard them.
+        RenderGraphPassBuilder& colorAttachment(
+            GraphResource resource,
+            vk::AttachmentLoadOp loadOp,
+            vk::ClearColorValue clearValue = {}
+        );
+        RenderGraphPassBuilder& depthAttachment(
+            GraphResource resource,
+            vk::AttachmentLoadOp loadOp,
+            float clearDepth = 1.0f,
+            bool depthWrite = true
+        );
+        // Begins the render pass for secondary command buffers instead of inline
+        // commands.
+        RenderGraphPassBuilder& secondaryCommandBuffers();
+        // Keeps the pass even when nothing reads what it writes, e.g. for
+        // readbacks into host memory.
+        RenderGraphPassBuilder& sideEffect();
+        RenderGraphPassBuilder& record(std::function<void(RenderGraphContext&)> callback);
+
+    private:
+        friend class RenderGraph;
+
+        RenderGraphPassBuilder(RenderGraph& graph, uint32_t pass) :
+            m_graph(graph),
+            m_pass(pass)
+        { }
+
+        RenderGraph& m_graph;
+        uint32_t m_pass;
+    };
+
+
+    // A frame graph, rebuilt every frame. Passes declare the resources they
+    // read and write, and compile():
+    //  - culls passes whose results nothing uses, that is passes that neither
+    //    write an imported resource nor are marked as side effects and whose
+    //    transients no remaining pass reads,
+    //  - places transient resources with disjoint lifetimes at overlapping
+    //    offsets of shared allocations,
+    //  - plans one batched pipeline barrier per pass covering execution and
+    //    memory dependencies and layout transitions, plus the transitions of
+    //    imported images into their final state.
+    //
+    // Passes run in the order they were added; the graph never reorders them.
+    //
+    // Transient memory is kept per frame slot and only reallocated when the set
+    // of transients or their lifetimes change, so compiling the same graph every
+    // frame costs no allocations. A slot must not be compiled again before the
+    // GPU has finished the frame that last used it.
+    class RenderGraph
+    {
+    public:
+        RenderGraph(vk::Device device, GpuMemory& memory, vk::DeviceSize bufferImageGranularity, uint32_t frameSlots);
+        ~RenderGraph();
+
+        RenderGraph(const RenderGraph&) = delete;
+        RenderGraph& operator=(const RenderGraph&) = delete;
+
+        // Drops every pass and resource, to start building the next frame.
+        void reset();
+
+        GraphResource createImage(const std::string& name, const GraphImageDesc& desc);
+        GraphResource createBuffer(const std::string& name, vk::DeviceSize size);
+        // Imported images always count as used, so the passes writing them are
+        // never culled. `finalState` with an undefined layout leaves the image in
+        // whatever state the last pass put it.
+        GraphResource importImage(
+            const std::string& name,
+            vk::Image image,
+            vk::ImageView view,
+            const GraphImageDesc& desc,
+            const GraphImportState& initialState,
+            const GraphImportState& finalState
+        );
+        // `initialState` names the last GPU access before the graph that its
+        // passes still have to wait for. Leave it empty for buffers that are
+        // already visible, e.g. uploads the frame's submission waits on.
+        GraphResource importBuffer(
+            const std::string& name,
+            vk::Buffer buffer,
+            vk::DeviceSize size,
+            const GraphImportState& initialState = GraphImportState{}
+        );
+
+        RenderGraphPassBuilder addPass(const std::string& name, GraphPassType type);
+
+        // Destroys the cached framebuffers that use `view`, so a view that later
+        // reuses its handle never gets them. Call it right before destroying an
+        // imported view, once no frame uses it anymore.
+        void releaseImportedView(vk::ImageView view);
+
+        void compile(uint32_t frameSlot);
+        // Records every pass that survived culling. Call after compile().
+        void execute(vk::CommandBuffer commandBuffer);
+
+#if BVR_PROFILE
+        // Wraps every pass execute() records in a GPU zone named after it.
+        void setGpuProfiler(GpuProfiler* profiler) { m_gpuProfiler = profiler; }
+#endif
+
+        // Results of the last compile().
+        RenderGraphStats getStats() const { return m_stats; }
+        std::string dumpGraphviz() const;
+        std::string dumpJson() const;
+
+    private:
+        friend class RenderGraphContext;
+        friend class RenderGraphPassBuilder;
+
+        struct ResourceUse
+        {
+            uint32_t resource = UINT32_MAX;
+            GraphAccess access = GraphAccess::eSampledFragment;
+            bool write = false;
+            // Attachments that are cleared or don't care about their contents.
+            bool discard = false;
+        };
+
+        struct Attachment
+        {
+            uint32_t resource = UINT32_MAX;
+            vk::AttachmentLoadOp loadOp = vk::AttachmentLoadOp::eDontCare;
+            vk::ClearValue clearValue;
+            bool depth = false;
+            bool depthWrite = true;
+        };
+
+        struct Pass
+        {
+            std::string name;
+            GraphPassType type = GraphPassType::eCompute;
+            std::vector<ResourceUse> uses;
+            std::vector<Attachment> attachments;
+            std::function<void(RenderGraphContext&)> callback;
+            bool secondaryCommandBuffers = false;
+            bool sideEffect = false;
+
+            // Filled by compile().
+            bool culled = false;
+            vk::PipelineStageFlags srcStages;
+            vk::PipelineStageFlags dstStages;
+            std::vector<vk::ImageMemoryBarrier> imageBarriers;
+            vk::AccessFlags memorySrcAccess;
+            vk::AccessFlags memoryDstAccess;
+            bool memoryBarrier = false;
+            vk::RenderPass renderPass;
+            vk::Framebuffer framebuffer;
+            vk::Extent2D extent;
+        };
+
+        struct Resource
+        {
+            std::string name;
+            bool isImage = true;
+            bool imported = false;
+            GraphImageDesc image;
+            vk::DeviceSize bufferSize = 0;
+            GraphImportState initialState;
+            GraphImportState finalState;
+
+            // Imported handles, or the physical transient after compile().
+            vk::Image vkImage;
+            vk::ImageView vkView;
+            vk::Buffer vkBuffer;
+
+            // Filled by compile().
+            vk::ImageUsageFlags imageUsage;
+            vk::BufferUsageFlags bufferUsage;
+            uint32_t firstPass = UINT32_MAX;
+            uint32_t lastPass = 0;
+            uint32_t physical = UINT32_MAX;
+        };
+
+        // A transient's memory placement inside a frame slot's allocations.
+        struct PhysicalResource
+        {
+            vk::Image image;
+            vk::ImageView view;
+            vk::Buffer buffer;
+            vk::MemoryRequirements requirements;
+            uint32_t heap = UINT32_MAX;
+            vk::DeviceSize offset = 0;
+            uint32_t firstPass = 0;
+            uint32_t lastPass = 0;
+        };
+
+        struct AliasingHeap
+        {
+            uint32_t memoryTypeBits = 0;
+            vk::DeviceSize size = 0;
+            vk::DeviceSize alignment = 1;
+            VmaAllocation allocation = VK_NULL_HANDLE;
+        };
+
+        struct CachedFramebuffer
+        {
+            vk::Framebuffer framebuffer;
+            // Transient views die with the slot, imported ones are released
+            // through releaseImportedView().
+            std::vector<vk::ImageView> importedViews;
+        };
+
+        struct FrameSlot
+        {
+            uint64_t key = 0;
+            std::vector<PhysicalResource> resources;
+            std::vector<AliasingHeap> heaps;
+            vk::DeviceSize unaliasedBytes = 0;
+            std::unordered_map<uint64_t, CachedFramebuffer> framebuffers;
+        };
+
+        void cullPasses();
+        void computeLifetimes();
+        uint64_t computeTransientKey() const;
+        void allocateTransients(FrameSlot& slot);
+        void destroyTransients(FrameSlot& slot);
+        void bindTransients(const FrameSlot& slot);
+        void planBarriers(const FrameSlot& slot);
+        vk::RenderPass getRenderPass(const Pass& pass);
+        vk::Framebuffer getFramebuffer(FrameSlot& slot, const Pass& pass);
+
+        vk::Device m_device;
+        GpuMemory& m_memory;
+        vk::DeviceSize m_bufferImageGranularity = 1;
+
+        std::vector<Pass> m_passes;
+        std::vector<Resource> m_resources;
+        std::vector<FrameSlot> m_slots;
+        uint32_t m_currentSlot = UINT32_MAX;
+        // Render passes only depend on attachment formats and load ops, so they
+        // are shared by every frame and slot.
+        std::unordered_map<uint64_t, vk::RenderPass> m_renderPasses;
+        // Moves imported images into their final state after the last pass.
+        std::vector<vk::ImageMemoryBarrier> m_finalBarriers;
+        vk::PipelineStageFlags m_finalSrcStages;
+        vk::PipelineStageFlags m_finalDstStages;
+        RenderGraphStats m_stats;
+#if BVR_PROFILE
+        GpuProfiler* m_gpuProfiler = nullptr;
+#endif
+    };
+}
@@ -0,0 +1,389 @@
+#pragma once
+
+#include "bindless.h"
+#include "dynamic_resolution.h"
+#include "gpu_memory.h"
+#include "job_system.h"
+#include "pipeline_cache.h"
+#include "profiler.h"
+#include "render_graph.h"
+#include "shader_library.h"
+#include "swapchain.h"
+#include "upload_queue.h"
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct GLFWwindow;
+
+namespace bvr
+{
+    struct RenderConfig
+    {
+        int width = 1280;
+        int height = 720;
+        std::vector<const char*> validationLayers = {
+            "VK_LAYER_KHRONOS_validation"
+        };
+        // Renders into offscreen images instead of a window surface. No GLFW
+        // window is needed and no present queue is requested.
+        bool headless = false;
+        // Number of frames the CPU may record ahead of the GPU. More frames hide
+        // CPU/GPU stalls at the cost of input latency.
+        uint32_t framesInFlight = 2;
+        GpuMemoryConfig memory{};
+        // Only used when the device supports descriptor indexing.
+        BindlessConfig bindless{};
+        // Threads used for command recording and other jobs, including the render
+        // thread. 0 uses one per hardware thread.
+        uint32_t workerThreads = 0;
+        // Smallest number of draws worth handing to a recording job.
+        uint32_t minDrawsPerRecordJob = 1024;
+        // Bypasses device ranking. Either an index into vkEnumeratePhysicalDevices
+        // (e.g. "1") or a substring of the device name (e.g. "llvmpipe").
+        std::string forcedDevice;
+        // Where compiled pipelines persist between runs. Empty keeps them in
+        // memory only, so every start compiles from scratch.
+        std::string pipelineCachePath = "bvr_pipeline_cache.bin";
+        // Scales the internal render resolution to hold a GPU frame time. Only
+        // passes that render at FrameContext::renderExtent follow it, the
+        // target keeps its size.
+        DynamicResolutionConfig dynamicResolution{};
+        // Presentation to the window. Headless runs only present when
+        // swapchain.virtualSwapchain is set.
+        SwapchainConfig swapchain{};
+        // Shaders compiled from source at runtime. With shaders.hotReload the
+        // scene pipeline is built from shaders.sourceDirectory instead of the
+        // embedded SPIR-V, and follows edits to it.
+        ShaderLibraryConfig shaders{};
+    };
+
+
+    struct QueueFamilyIndices
+    {
+        uint32_t graphicsFamily = UINT32_MAX;
+        uint32_t presentFamily = UINT32_MAX;
+        // A transfer-only family when the device has one, so uploads run on the
+        // copy engines alongside rendering. Falls back to the graphics family.
+        uint32_t transferFamily = UINT32_MAX;
+
+        bool isComplete(bool headless) const
+        {
+            return graphicsFamily != UINT32_MAX && (headless || presentFamily != UINT32_MAX);
+        }
+    };
+
+
+    struct OffscreenTarget
+    {
+        Image color;
+        vk::ImageView view;
+    };
+
+
+    // A single triangle, positioned and tinted through push constants. Matches
+    // DrawConstants in shaders/triangle.vert.
+    struct DrawItem
+    {
+        glm::vec4 offsetScale;
+        glm::vec4 color;
+    };
+
+
+    struct FrameTimings
+    {
+        uint64_t frameIndex = 0;
+        // Time the GPU spent executing the frame's command buffer, measured with
+        // timestamp queries. Negative when the queue doesn't support timestamps.
+        double gpuMs = -1.0;
+        // Internal resolution scale the frame rendered at, see
+        // FrameContext::renderScale.
+        float renderScale = 1.0f;
+        // From the input sample the frame was built from, see
+        // Renderer::markInputSampled(), to its submission and to the moment it
+        // was shown. The latter is negative when it isn't known, e.g. for
+        // frames that weren't presented or without present wait support.
+        double inputToSubmitMs = 0.0;
+        double inputToPresentMs = -1.0;
+    };
+
+
+    // Everything a single frame in flight owns. A context is only reused once the
+    // frame timeline semaphore reaches its `timelineValue`, so nothing in here
+    // needs further synchronization while it is being recorded.
+    struct FrameContext
+    {
+        // Command pools are not thread safe, so every worker thread records its
+        // secondary command buffers from its own pool.
+        struct WorkerCommandPool
+        {
+            vk::CommandPool pool;
+            std::vector<vk::CommandBuffer> secondaries;
+            uint32_t used = 0;
+        };
+
+        vk::CommandPool commandPool;
+        vk::CommandBuffer commandBuffer;
+        std::vector<WorkerCommandPool> workerPools;
+        vk::DescriptorPool descriptorPool;
+        vk::QueryPool timestampPool;
+        OffscreenTarget target;
+
+        uint64_t frameIndex = 0;
+        // Internal resolution of the frame: the target extent times the scale,
+        // chosen when the frame begins. Passes that support it render at
+        // renderExtent and upscale into the target.
+        float renderScale = 1.0f;
+        vk::Extent2D renderExtent;
+        uint64_t timelineValue = 0;
+        // Present id of the swapchain image the frame was copied into, 0 when
+        // it wasn't presented.
+        uint64_t presentId = 0;
+        std::chrono::steady_clock::time_point inputSampleTime;
+        double inputToSubmitMs = 0.0;
+        double inputToPresentMs = -1.0;
+        // Upload timeline value the frame's submission waits on, 0 for none.
+        uint64_t uploadWaitValue = 0;
+        bool pendingTimings = false;
+        // Run once the GPU has finished with this frame, see Renderer::deferRelease.
+        std::vector<std::function<void()>> deferredReleases;
+    };
+
+
+    class Renderer
+    {
+
+    public:
+        Renderer() = default;
+        Renderer(const RenderConfig& config, GLFWwindow* window) :
+            m_config(config),
+            m_window(window),
+            m_dynamicResolution(config.dynamicResolution)
+        { };
+
+        ~Renderer();
+
+        Renderer(const Renderer&) = delete;
+        Renderer& operator=(const Renderer&) = delete;
+
+        void init();
+
+        // Waits until the oldest frame in flight has retired, then recycles its
+        // command pool, descriptor pool and deferred releases for recording.
+        FrameContext& beginFrame();
+        // Submits the frame's command buffer, signalling the frame timeline, and
+        // presents its target when there is a swapchain.
+        void endFrame();
+
+        // Blocks until the frame SwapchainConfig::maxFrameLatency frames back
+        // has been shown, or has at least finished on the GPU without present
+        // wait support. Call right before sampling input, so the input isn't
+        // queued behind frames the display hasn't caught up with. beginFrame()
+        // calls it when the frame hasn't. Does nothing without a swapchain.
+        void waitForFrameLatency();
+        // Marks when the next frame's input was sampled, the start of its
+        // FrameTimings::inputToSubmitMs. Without it the frame's beginFrame()
+        // counts as the sample.
+        void markInputSampled();
+        // Resizes the swapchain at the next present. The target keeps
+        // RenderConfig's size and is scaled when copied into it.
+        void resize(uint32_t width, uint32_t height);
+
+        // Renders the draws into the frame's target. Recording is split across the
+        // job system into secondary command buffers, executed from the primary.
+        void renderFrame(const std::vector<DrawItem>& draws);
+        void renderFrame();
+        // Renders a frame built by `build` instead of the scene pass. `target` is
+        // the frame's imported color target; the graph is compiled and recorded
+        // once `build` returns.
+        void renderFrameGraph(const std::function<void(RenderGraph& graph, FrameContext& frame, GraphResource target)>& build);
+
+        // Caps the number of threads that record draws, for scaling measurements.
+        // 0 uses every thread of the job system.
+        void setRecordThreadCount(uint32_t threadCount) { m_recordThreadCount = threadCount; }
+        // CPU time spent recording the scene pass of the last frame.
+        double getLastRecordCpuMs() const { return m_lastRecordCpuMs; }
+
+        // Blocks until all submitted work has finished and every frame's timings
+        // have been collected.
+        void waitIdle();
+
+        // Destroys a resource once every frame recorded so far has retired.
+        void deferRelease(std::function<void()> release);
+
+        // Timings of the frames that retired since the last call, oldest first.
+        std::vector<FrameTimings> takeCompletedTimings();
+
+        uint64_t getFrameIndex() const { return m_frameIndex; }
+        const RenderConfig& getConfig() const { return m_config; }
+
+        // Fixes the render scale of the frames that begin from now on. With
+        // dynamic resolution enabled it is only the starting point.
+        void setRenderScale(float scale) { m_dynamicResolution.setScale(scale); }
+        float getRenderScale() const { return m_dynamicResolution.getScale(); }
+        const DynamicResolution& getDynamicResolution() const { return m_dynamicResolution; }
+        // Null in headless runs without a virtual swapchain.
+        const Swapchain* getSwapchain() const { return m_swapchain.get(); }
+
+        // Records commands into a one-off command buffer on the graphics queue and
+        // blocks until they have executed. Meant for setup work, not per-frame use.
+        void immediateSubmit(const std::function<void(vk::CommandBuffer)>& record);
+
+        // The scene pipeline specialized for `variant`, sharing everything but the
+        // specialization constant with the one renderFrame() uses (variant 0).
+        // Exists to exercise the pipeline cache with many distinct pipelines.
+        vk::Pipeline getScenePipelineVariant(uint32_t variant);
+        std::shared_ptr<const AsyncPipeline> compileScenePipelineVariantAsync(uint32_t variant);
+
+        // A module for one of the shaders compiled into the binary, owned by the
+        // pipeline cache.
+        vk::ShaderModule createEmbeddedShaderModule(const char* name);
+
+        // Wall time init() took, including shader and pipeline compilation.
+        double getStartupMs() const { return m_startupMs; }
+
+        // vkCmdDrawIndexedIndirectCount with a non-zero firstInstance and more
+        // than one draw, everything GPU-driven culling submits with.
+        bool isGpuCullingSupported() const { return m_gpuCullingSupported; }
+        // BC1 to BC7 sampled images.
+        bool isTextureCompressionBcSupported() const { return m_textureCompressionBcSupported; }
+        // The global descriptor set of every texture, storage buffer and sampler
+        // registered with it. Null without descriptor indexing support.
+        BindlessTable* getBindless() { return m_bindless.get(); }
+        uint32_t getFrameCount() const { return uint32_t(m_frames.size()); }
+        vk::Extent2D getTargetExtent() const { return vk::Extent2D{ uint32_t(m_config.width), uint32_t(m_config.height) }; }
+
+        GpuMemory& getMemory() { return *m_memory; }
+        PipelineCache& getPipelines() { return *m_pipelines; }
+        RenderGraph& getRenderGraph() { return *m_graph; }
+        ShaderLibrary& getShaders() { return *m_shaders; }
+        JobSystem& getJobSystem() { return *m_jobs; }
+        UploadQueue& getUploads() { return *m_uploads; }
+        vk::PhysicalDeviceProperties getDeviceProperties() const { return m_physicalDevice.getProperties(); }
+        vk::Device getDevice() const { return m_device; }
+
+    private:
+        void initVulkan();
+        void createInstance();
+        bool isValidationEnabled();
+        std::vector<const char*> getRequiredExtensions() const;
+        void validateExtensions(std::vector<const char*> requiredExtensions) const;
+        bool checkValidationLayerSupport() const;
+        void pickPhysicalDevice();
+        vk::PhysicalDevice findForcedDevice(const std::vector<vk::PhysicalDevice>& devices) const;
+        bool isDeviceSuitable(const vk::PhysicalDevice& device) const;
+        uint64_t scoreDevice(const vk::PhysicalDevice& device) const;
+        QueueFamilyIndices findQueueFamilies(const vk::PhysicalDevice& physicalDevice) const;
+        void createLogicalDevice();
+        void createSurface();
+        void createMemory();
+        void createUploadQueue();
+        void createFrameContexts();
+        void createBindlessTable();
+        void createSwapchain();
+        void destroyFrameContext(FrameContext& frame);
+        OffscreenTarget createOffscreenTarget();
+        void waitForTimelineValue(uint64_t value);
+        void retireFrame(FrameContext& frame);
+        // Records one bounded defragmentation step of the movable buffer pool at
+        // the start of the frame. The old copies are freed when the frame retires.
+        void defragmentMemory(FrameContext& frame);
+        void createPipelineCache();
+        void createShaderLibrary();
+        void createScenePass();
+        // Builds the scene pipeline's create info and passes it to `compile`,
+        // which must be done with it before returning.
+        void buildScenePipelineInfo(uint32_t variant, const std::function<void(const vk::GraphicsPipelineCreateInfo&)>& compile);
+        GraphResource importTarget(FrameContext& frame);
+        // Copies the frame's target into `image`, scaling it to the image's size.
+        void recordPresentCopy(FrameContext& frame, const SwapchainImage& image);
+        void recordScene(FrameContext& frame, const std::vector<DrawItem>& draws);
+        void recordDraws(FrameContext& frame, RenderGraphContext& context, const std::vector<DrawItem>& draws);
+        vk::CommandBuffer recordDrawChunk(FrameContext& frame, const vk::CommandBufferInheritanceInfo& inheritanceInfo, const DrawItem* draws, uint32_t count);
+
+        VkDebugUtilsMessengerCreateInfoEXT getDebugMessengerCreateInfo() const;
+        void setupDebugMessenger();
+        void destroyDebugMessenger();
+
+        static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+            VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+            VkDebugUtilsMessageTypeFlagsEXT messageType,
+            const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+            void* pUserData);
+
+        RenderConfig m_config{};
+        GLFWwindow* m_window = nullptr;
+
+        vk::Instance m_instance{};
+        vk::DebugUtilsMessengerEXT m_dbgMessenger;
+        vk::PhysicalDevice m_physicalDevice;
+        vk::SurfaceKHR m_surface;
+
+        vk::Device m_device;
+        QueueFamilyIndices m_queueFamilies;
+        vk::Queue m_graphicsQueue;
+        vk::Queue m_presentQueue;
+        vk::Queue m_transferQueue;
+        // Guards m_graphicsQueue when the device has a single queue that uploads
+        // have to share with rendering.
+        std::mutex m_graphicsQueueMutex;
+        bool m_transferSharesGraphicsQueue = false;
+        bool m_memoryBudgetSupported = false;
+        bool m_gpuCullingSupported = false;
+        bool m_bindlessSupported = false;
+        bool m_textureCompressionBcSupported = false;
+        bool m_presentWaitSupported = false;
+
+        std::unique_ptr<GpuMemory> m_memory;
+        std::unique_ptr<UploadQueue> m_uploads;
+        std::unique_ptr<PipelineCache> m_pipelines;
+        std::unique_ptr<ShaderLibrary> m_shaders;
+        std::unique_ptr<BindlessTable> m_bindless;
+        // Rebuilt every frame, see recordScene().
+        std::unique_ptr<RenderGraph> m_graph;
+        std::unique_ptr<JobSystem> m_jobs;
+        std::unique_ptr<Swapchain> m_swapchain;
+        uint32_t m_recordThreadCount = 0;
+        double m_lastRecordCpuMs = 0.0;
+
+        vk::RenderPass m_sceneRenderPass;
+        vk::PipelineLayout m_scenePipelineLayout;
+        vk::Pipeline m_scenePipeline;
+        // Valid with hot reload, see RenderConfig::shaders.
+        ShaderPipelineHandle m_sceneShaders;
+        double m_startupMs = 0.0;
+        vk::CommandPool m_immediatePool;
+        vk::Fence m_immediateFence;
+
+        std::vector<FrameContext> m_frames;
+        // Signalled with frameIndex + 1 when a frame's submission completes.
+        vk::Semaphore m_frameTimeline;
+        bool m_timestampsSupported = false;
+        float m_timestampPeriod = 1.0f;
+        // Bits of the graphics queue's timestamps that are valid.
+        uint32_t m_timestampValidBits = 64;
+#if BVR_PROFILE
+        bool m_pipelineStatisticsSupported = false;
+        // Per-pass timestamps of the render graph, null without timestamp support.
+        std::unique_ptr<GpuProfiler> m_gpuProfiler;
+#endif
+
+        uint64_t m_frameIndex = 0;
+        FrameContext* m_currentFrame = nullptr;
+        // Whether the next frame has already waited for its latency limit and
+        // sampled its input.
+        bool m_latencyWaited = false;
+        bool m_inputSampled = false;
+        std::chrono::steady_clock::time_point m_inputSampleTime;
+        // Fed from retireFrame(), read when a frame begins.
+        DynamicResolution m_dynamicResolution;
+        std::vector<FrameTimings> m_completedTimings;
+    };
+}
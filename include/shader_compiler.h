@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bvr
+{
+    enum class ShaderLanguage
+    {
+        eGlsl,
+        eHlsl,
+    };
+
+
+    struct ShaderCompilerConfig
+    {
+        // glslangValidator, which compiles HLSL as well as GLSL. Searched for
+        // on the PATH unless it is a path.
+        std::string compilerPath = "glslangValidator";
+        // Compiled SPIR-V is kept here, named after the hash of everything
+        // that went into it. Empty compiles every time.
+        std::string cacheDirectory = "shader_cache";
+        // Searched for includes after the including file's own directory.
+        std::vector<std::string> includeDirs;
+    };
+
+
+    struct CompiledShader
+    {
+        std::string path;
+        vk::ShaderStageFlagBits stage = vk::ShaderStageFlagBits::eVertex;
+        ShaderLanguage language = ShaderLanguage::eGlsl;
+        std::vector<uint32_t> spirv;
+        // The source followed by every file it includes, directly or not.
+        std::vector<std::string> dependencies;
+        uint64_t hash = 0;
+        bool cacheHit = false;
+        // Hashing plus compiling or loading from the cache.
+        double compileMs = 0.0;
+        // The compiler's output when compilation failed.
+        std::string error;
+
+        bool isValid() const { return !spirv.empty(); }
+    };
+
+
+    // The stage and language a file name implies: "name.vert", "name.frag"
+    // and "name.comp" are GLSL, the same with ".hlsl" appended are HLSL with
+    // a "main" entry point. False for anything else.
+    bool getShaderStage(const std::string& path, vk::ShaderStageFlagBits& stage, ShaderLanguage& language);
+
+
+    // Compiles shader sources to SPIR-V by running the compiler, with a disk
+    // cache keyed by a hash of the source, every file it includes and the
+    // compiler settings. Editing a shader back to an earlier version hits the
+    // cache again.
+    //
+    // Thread safe.
+    class ShaderCompiler
+    {
+    public:
+        explicit ShaderCompiler(const ShaderCompilerConfig& config);
+
+        // Errors in the shader end up in CompiledShader::error. Throws
+        // std::runtime_error for file names without a stage and unreadable
+        // sources.
+        CompiledShader compile(const std::string& path) const;
+
+        const ShaderCompilerConfig& getConfig() const { return m_config; }
+
+    private:
+        // Hashes the source and its includes, listing them in `dependencies`.
+        uint64_t hashSource(const std::string& path, vk::ShaderStageFlagBits stage, ShaderLanguage language, std::vector<std::string>& dependencies) const;
+        bool runCompiler(const CompiledShader& shader, const std::string& outputPath, std::string& error) const;
+
+        ShaderCompilerConfig m_config;
+        // Keeps the output of concurrent compilations of one hash apart.
+        mutable std::atomic<uint32_t> m_compileCount{ 0 };
+    };
+}
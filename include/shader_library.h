@@ -0,0 +1,209 @@
+#pragma once
+
+#include "file_watcher.h"
+#include "shader_compiler.h"
+#include "shader_reflection.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace bvr
+{
+    class AsyncPipeline;
+    class PipelineCache;
+    class Renderer;
+
+
+    struct ShaderLibraryConfig
+    {
+        // Watches the sources and rebuilds the pipelines that use them when
+        // they change.
+        bool hotReload = false;
+        // What pipelines' shader paths are relative to. Watched, and searched
+        // for includes after compiler.includeDirs.
+        std::string sourceDirectory = "shaders";
+        ShaderCompilerConfig compiler{};
+        // Quiet time after the last change before recompiling, so editors that
+        // save in several steps trigger a single compile.
+        uint32_t debounceMs = 30;
+    };
+
+
+    struct ShaderPipelineHandle
+    {
+        uint32_t index = UINT32_MAX;
+
+        bool isValid() const { return index != UINT32_MAX; }
+    };
+
+
+    // A pipeline built from shader sources. Replaced as a whole by reloads.
+    struct ShaderPipeline
+    {
+        vk::Pipeline pipeline;
+        vk::PipelineLayout layout;
+        std::vector<vk::DescriptorSetLayout> setLayouts;
+        ShaderReflection reflection;
+        // Incremented by every reload.
+        uint32_t version = 0;
+    };
+
+
+    struct GraphicsShaderDesc
+    {
+        // Relative to ShaderLibraryConfig::sourceDirectory, one per stage.
+        std::vector<std::string> stages;
+        // Sets whose layout isn't reflected, see createReflectedLayout().
+        std::vector<vk::DescriptorSetLayout> externalSets;
+        // Completes `shaderInfo`, whose stages and layout are set, with the
+        // fixed-function state and passes the result to `compile`. Called again
+        // for every reload, so it must not capture anything short-lived.
+        std::function<void(const vk::GraphicsPipelineCreateInfo& shaderInfo, const std::function<void(const vk::GraphicsPipelineCreateInfo&)>& compile)> build;
+    };
+
+
+    struct ComputeShaderDesc
+    {
+        // Relative to ShaderLibraryConfig::sourceDirectory.
+        std::string path;
+        std::vector<vk::DescriptorSetLayout> externalSets;
+    };
+
+
+    struct ShaderLibraryStats
+    {
+        uint32_t pipelines = 0;
+        // Pipelines swapped for rebuilt ones.
+        uint32_t reloads = 0;
+        // Shaders that didn't compile, and pipelines that failed to rebuild.
+        // The previous pipeline stays in use in either case.
+        uint32_t failures = 0;
+        uint32_t compiles = 0;
+        uint32_t cacheHits = 0;
+        double compileMs = 0.0;
+        // From the watcher seeing the first change of the last reload to the
+        // rebuilt pipeline being swapped in. Negative before the first reload.
+        double lastReloadMs = -1.0;
+        double maxReloadMs = -1.0;
+    };
+
+
+    // Builds pipelines from shader sources: compiled to SPIR-V through the
+    // ShaderCompiler and its disk cache, with set and pipeline layouts
+    // reflected from the SPIR-V, and modules, layouts and pipelines created
+    // through the PipelineCache.
+    //
+    // With hot reload, a worker thread watches the sources and recompiles the
+    // shaders that include a changed file. update() then rebuilds their
+    // pipelines on the pipeline cache's background thread and swaps them in
+    // once compiled, so neither step stalls a frame. Shaders that fail to
+    // compile or link keep the previous pipeline and print the error. The cache
+    // keeps replaced pipelines alive until shutdown, so frames in flight that
+    // still use them need no deferred release.
+    //
+    // Create pipelines and call update() and get() on the render thread.
+    class ShaderLibrary
+    {
+    public:
+        ShaderLibrary(Renderer& renderer, const ShaderLibraryConfig& config);
+        ~ShaderLibrary();
+
+        ShaderLibrary(const ShaderLibrary&) = delete;
+        ShaderLibrary& operator=(const ShaderLibrary&) = delete;
+
+        // Compile on the calling thread. Throws std::runtime_error when a shader
+        // doesn't compile or reflect, or the pipeline doesn't build.
+        ShaderPipelineHandle createGraphicsPipeline(const GraphicsShaderDesc& desc);
+        ShaderPipelineHandle createComputePipeline(const ComputeShaderDesc& desc);
+
+        // Takes the worker's recompiled shaders, starts rebuilding their
+        // pipelines and swaps in the ones that finished. Never waits for a
+        // compile. Call once per frame, before recording.
+        void update();
+
+        // Valid until the next update().
+        const ShaderPipeline& get(ShaderPipelineHandle handle) const;
+
+        // Whether changed sources are being recompiled or their pipelines
+        // rebuilt.
+        bool isReloading() const;
+
+        const ShaderLibraryConfig& getConfig() const { return m_config; }
+        ShaderLibraryStats getStats() const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Entry
+        {
+            // Absolute source paths, one per stage.
+            std::vector<std::string> paths;
+            std::vector<vk::DescriptorSetLayout> externalSets;
+            // Null for compute pipelines.
+            std::function<void(const vk::GraphicsPipelineCreateInfo&, const std::function<void(const vk::GraphicsPipelineCreateInfo&)>&)> build;
+            ShaderPipeline current;
+
+            // Set when a stage was recompiled, until the rebuild is started.
+            bool dirty = false;
+            Clock::time_point changeTime;
+            // The rebuild in progress, swapped in once `pending` is ready.
+            std::shared_ptr<const AsyncPipeline> pending;
+            ShaderPipeline next;
+            Clock::time_point nextChangeTime;
+        };
+
+        // A recompile from the worker thread.
+        struct CompileResult
+        {
+            CompiledShader shader;
+            Clock::time_point changeTime;
+        };
+
+        ShaderPipelineHandle addEntry(std::unique_ptr<Entry> entry);
+        // The last SPIR-V of `path` that compiled, compiling it first if needed.
+        const CompiledShader& getCompiled(const std::string& path);
+        void recordCompile(const CompiledShader& shader);
+        // Reflects the entry's stages into `pipeline` and creates its layouts.
+        // Compiles the pipeline on the calling thread without `pending`, on
+        // the cache's background thread with it.
+        void buildPipeline(const Entry& entry, ShaderPipeline& pipeline, std::shared_ptr<const AsyncPipeline>* pending);
+        // Watches the directories of includes outside the configured ones.
+        void watchDependencyDirectories();
+        void watchLoop();
+
+        PipelineCache& m_pipelines;
+        ShaderLibraryConfig m_config;
+        ShaderCompiler m_compiler;
+        std::vector<std::unique_ptr<Entry>> m_entries;
+        // The last successful compile of every source in use. Render thread only.
+        std::unordered_map<std::string, CompiledShader> m_shaders;
+
+        mutable std::mutex m_mutex;
+        // Guarded by m_mutex: the worker reads the dependencies, the render
+        // thread updates them.
+        std::unordered_map<std::string, std::vector<std::string>> m_dependencies;
+        std::vector<CompileResult> m_results;
+        // Set when dependencies changed, so the worker watches their
+        // directories too.
+        bool m_dependenciesChanged = false;
+        bool m_compiling = false;
+        ShaderLibraryStats m_stats;
+
+        std::unique_ptr<FileWatcher> m_watcher;
+        // Worker thread only, once started.
+        std::set<std::string> m_watchedDirectories;
+        std::atomic<bool> m_running{ true };
+        std::thread m_watchThread;
+    };
+}
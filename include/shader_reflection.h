@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bvr
+{
+    class PipelineCache;
+
+
+    struct ReflectedBinding
+    {
+        uint32_t set = 0;
+        uint32_t binding = 0;
+        vk::DescriptorType type = vk::DescriptorType::eUniformBuffer;
+        // Product of the array lengths, 0 for runtime-sized arrays.
+        uint32_t count = 1;
+        vk::ShaderStageFlags stages;
+    };
+
+
+    // The resource interface of one or more shader stages.
+    struct ShaderReflection
+    {
+        vk::ShaderStageFlags stages;
+        std::string entryPoint;
+        // Sorted by set, then binding.
+        std::vector<ReflectedBinding> bindings;
+        // A single range for every stage that declares push constants, from 0
+        // to the end of the largest block. Size 0 without any.
+        vk::PushConstantRange pushConstants;
+    };
+
+
+    // Reads the descriptor bindings and push constant block of the module's
+    // first entry point. Only the instructions that declare them are looked at,
+    // so unused resources are included. Throws std::runtime_error for modules
+    // that aren't SPIR-V or use resource types the renderer doesn't.
+    ShaderReflection reflectSpirv(const uint32_t* code, size_t size);
+
+    // Adds another stage's interface to `reflection`. Throws when the stages
+    // disagree about the type of a binding.
+    void mergeReflection(ShaderReflection& reflection, const ShaderReflection& stage);
+
+
+    struct ReflectedLayout
+    {
+        vk::PipelineLayout layout;
+        // One per set up to the highest one used, empty layouts filling gaps.
+        std::vector<vk::DescriptorSetLayout> setLayouts;
+    };
+
+    // Creates the set and pipeline layouts the reflected stages need, through
+    // the cache, so stages with the same interface share them. Sets with a
+    // non-null entry in `externalSets` use that layout instead, e.g.
+    // BindlessTable::getSetLayout(); runtime-sized arrays are only allowed in
+    // those. Throws std::runtime_error otherwise.
+    ReflectedLayout createReflectedLayout(PipelineCache& pipelines, const ShaderReflection& reflection, const std::vector<vk::DescriptorSetLayout>& externalSets);
+}
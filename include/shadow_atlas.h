@@ -0,0 +1,338 @@
+#pragma once
+
+#include "clustered_lighting.h"
+#include "gpu_memory.h"
+#include "instance_culling.h"
+#include "render_graph.h"
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace bvr
+{
+    class Renderer;
+    struct FrameContext;
+
+
+    struct ShadowConfig
+    {
+        // Side of the square depth atlas holding every shadow map.
+        uint32_t atlasSize = 4096;
+        // Bounds of the power of two tile sizes of local lights. A light gets
+        // about its projected diameter on screen.
+        uint32_t minTileSize = 64;
+        uint32_t maxTileSize = 1024;
+        // Local light tiles redrawn per frame at most. Dirty tiles over budget
+        // keep their previous contents until a later frame gets to them.
+        // Cascades are view dependent and never wait.
+        uint32_t tileUpdateBudget = 16;
+        // Redraws every tile every frame, ignoring the budget. For measuring
+        // what caching saves.
+        bool disableCaching = false;
+
+        // Cascades of the directional light, each a tile of `cascadeSize`.
+        uint32_t cascadeCount = 4;
+        uint32_t cascadeSize = 1024;
+        // View distance the cascades cover, and the blend between logarithmic
+        // (1) and uniform (0) split distances.
+        float shadowDistance = 150.0f;
+        float cascadeSplitLambda = 0.8f;
+        // How far towards the light casters outside a cascade's bounds still
+        // cast into it.
+        float cascadeCasterDistance = 100.0f;
+
+        uint32_t maxLights = 1024;
+        uint32_t maxCasters = 65536;
+        float depthBiasConstant = 1.25f;
+        float depthBiasSlope = 1.75f;
+    };
+
+
+    // A square of the atlas, in texels.
+    struct ShadowTile
+    {
+        uint32_t x = 0;
+        uint32_t y = 0;
+        uint32_t size = 0;
+
+        bool isValid() const { return size != 0; }
+    };
+
+
+    // Quadtree allocator of power of two tiles. Freeing the last of four
+    // siblings merges them back into their parent.
+    class ShadowTileAllocator
+    {
+    public:
+        ShadowTileAllocator(uint32_t atlasSize, uint32_t minTileSize);
+
+        // Returns an invalid tile when no square of `size` is free. `size` must
+        // be a power of two between the minimum tile size and the atlas size.
+        ShadowTile allocate(uint32_t size);
+        void free(const ShadowTile& tile);
+
+        // Texels in allocated tiles.
+        uint64_t getAllocatedArea() const { return m_allocatedArea; }
+
+    private:
+        uint32_t getLevel(uint32_t size) const;
+
+        uint32_t m_atlasSize = 0;
+        uint32_t m_levelCount = 0;
+        // Free tiles per level, level 0 being the whole atlas.
+        std::vector<std::vector<glm::uvec2>> m_freeTiles;
+        uint64_t m_allocatedArea = 0;
+    };
+
+
+    struct ShadowLightHandle
+    {
+        uint32_t index = UINT32_MAX;
+
+        bool isValid() const { return index != UINT32_MAX; }
+    };
+
+    struct ShadowCasterHandle
+    {
+        uint32_t index = UINT32_MAX;
+
+        bool isValid() const { return index != UINT32_MAX; }
+    };
+
+
+    // The camera the cascades are fitted to and light importance is measured
+    // from.
+    struct ShadowCamera
+    {
+        glm::mat4 view{ 1.0f };
+        // Perspective with Vulkan's 0..1 depth range.
+        glm::mat4 projection{ 1.0f };
+        float nearZ = 0.1f;
+        // Height of the target in pixels, to turn projected sizes into tile sizes.
+        uint32_t viewportHeight = 720;
+    };
+
+
+    // What shading reads for one shadow map. Matches ShadowView in shaders
+    // sampling the atlas.
+    struct ShadowViewData
+    {
+        glm::mat4 viewProjection;
+        // The view's tile in atlas UVs, offset in xy and scale in zw.
+        glm::vec4 atlasRect;
+    };
+
+
+    struct ShadowResources
+    {
+        // The depth atlas, left in eShaderReadOnlyOptimal.
+        GraphResource atlas;
+        // ShadowViewData of the cascades, then of every light with a shadow.
+        GraphResource views;
+    };
+
+
+    struct ShadowStats
+    {
+        uint32_t lights = 0;
+        uint32_t casters = 0;
+        // Lights with a complete shadow in this frame's views.
+        uint32_t shadowedLights = 0;
+        // Visible lights that found no free tile.
+        uint32_t lightsWithoutTile = 0;
+        // Local light tiles holding a shadow map, and how they fared this frame.
+        uint32_t tiles = 0;
+        uint32_t tilesUpdated = 0;
+        uint32_t tilesCached = 0;
+        // Dirty tiles the budget pushed to a later frame.
+        uint32_t tilesDeferred = 0;
+        uint32_t cascadesUpdated = 0;
+        uint32_t casterDraws = 0;
+        // Share of the atlas in allocated tiles, cascades included.
+        float atlasOccupancy = 0.0f;
+        double cpuUpdateMs = 0.0;
+    };
+
+
+    // Shadow maps of local lights and a directional light, packed into one
+    // depth atlas.
+    //
+    // Every frame, the visible lights get tiles sized by their projected size
+    // on screen, most important first. Tiles are cached: one is only redrawn
+    // when it is new, its light changed, or a caster that moved, appeared or
+    // disappeared intersects it, so lights surrounded by static geometry are
+    // drawn once. At most ShadowConfig::tileUpdateBudget dirty tiles are drawn
+    // per frame, the ones without a shadow yet first, then by importance and by
+    // how long they have waited. A resized tile keeps shading from its old
+    // contents until the new one is drawn.
+    //
+    // The directional light gets cascades fitted to the camera. Their bounds
+    // are snapped to texels, so they too stay cached while neither the camera
+    // nor the casters in them move.
+    //
+    // Point lights take six tiles, one per cube face (+X, -X, +Y, -Y, +Z, -Z),
+    // spot lights one. Casters are built-in meshes.
+    class ShadowAtlas
+    {
+    public:
+        ShadowAtlas(Renderer& renderer, const ShadowConfig& config);
+        ~ShadowAtlas();
+
+        ShadowAtlas(const ShadowAtlas&) = delete;
+        ShadowAtlas& operator=(const ShadowAtlas&) = delete;
+
+        // True once the caster meshes have been uploaded and acquired by a frame.
+        bool isReady() const { return m_ready->load(std::memory_order_acquire); }
+
+        // Throws std::runtime_error past ShadowConfig::maxLights.
+        ShadowLightHandle addLight(const Light& light);
+        // Only redraws the light's tiles if its position, range or cone changed.
+        void updateLight(ShadowLightHandle handle, const Light& light);
+        void removeLight(ShadowLightHandle handle);
+
+        // Throws std::runtime_error past ShadowConfig::maxCasters.
+        ShadowCasterHandle addCaster(const glm::mat4& transform, BuiltinMesh mesh);
+        void moveCaster(ShadowCasterHandle handle, const glm::mat4& transform);
+        void removeCaster(ShadowCasterHandle handle);
+
+        // Direction the light travels in.
+        void setDirectionalLight(const glm::vec3& direction);
+
+        // Allocates tiles, picks the ones to redraw and adds the "shadow_casters"
+        // and "shadow_atlas" passes drawing them. Call from the
+        // Renderer::renderFrameGraph() callback once isReady().
+        ShadowResources addPasses(RenderGraph& graph, FrameContext& frame, const ShadowCamera& camera);
+
+        // The light's first view in ShadowResources::views of the last
+        // addPasses(), UINT32_MAX when it had no complete shadow.
+        uint32_t getShadowView(ShadowLightHandle handle) const;
+        // View space depth where each cascade ends.
+        const std::vector<float>& getCascadeSplits() const { return m_cascadeSplits; }
+        ShadowStats getStats() const { return m_stats; }
+
+    private:
+        struct ShadowFace
+        {
+            CullView view;
+            // Holds the last drawn contents.
+            ShadowTile tile;
+            // Replaces `tile` once drawn, after the light was resized.
+            ShadowTile pendingTile;
+            bool dirty = true;
+            // Frames the face has been waiting for the budget.
+            uint32_t waitedFrames = 0;
+        };
+
+        struct LightSlot
+        {
+            Light light;
+            std::array<ShadowFace, 6> faces;
+            uint32_t faceCount = 0;
+            // Size of the faces' pending tiles, or of their tiles without any.
+            uint32_t tileSize = 0;
+            float importance = 0.0f;
+            uint32_t viewIndex = UINT32_MAX;
+            bool alive = false;
+        };
+
+        struct Cascade
+        {
+            CullView view;
+            ShadowTile tile;
+            bool drawn = false;
+        };
+
+        // One tile drawn this frame.
+        struct TileDraw
+        {
+            CullView view;
+            ShadowTile tile;
+            std::vector<uint32_t> casters;
+            uint32_t casterCount = 0;
+        };
+
+        // A dirty light face waiting for the budget.
+        struct FaceCandidate
+        {
+            uint32_t light = 0;
+            uint32_t face = 0;
+            // Faces of lights without a complete shadow go first.
+            bool lightComplete = false;
+            float priority = 0.0f;
+        };
+
+        void createBuffers();
+        void createPipeline();
+        void updateFaceViews(LightSlot& slot);
+        void releaseTiles(LightSlot& slot);
+        void setCasterBounds(uint32_t index, const glm::vec4& bounds);
+        void markCasterChanged(uint32_t index);
+        void updateCascades(const ShadowCamera& camera);
+        void allocateTiles(const ShadowCamera& camera);
+        void invalidateTiles();
+        void selectDraws();
+        void addDraw(const CullView& view, const ShadowTile& tile);
+        void cullDraws();
+        void buildViews();
+
+        Renderer& m_renderer;
+        ShadowConfig m_config;
+        ShadowTileAllocator m_allocator;
+        // Shared with the upload callback, which may outlive the atlas.
+        std::shared_ptr<std::atomic<bool>> m_ready;
+        uint64_t m_uploadValue = 0;
+        std::array<BuiltinMeshRange, size_t(BuiltinMesh::eCount)> m_meshRanges;
+
+        std::vector<LightSlot> m_lights;
+        std::vector<uint32_t> m_freeLights;
+        uint32_t m_lightCount = 0;
+        // Visible lights, most important first.
+        std::vector<uint32_t> m_lightOrder;
+        std::vector<FaceCandidate> m_candidates;
+
+        // Dead casters have an infinitely negative radius, which every
+        // frustum test rejects.
+        BoundsSoA m_casterBounds;
+        std::vector<glm::mat4> m_casterTransforms;
+        std::vector<uint32_t> m_casterMeshes;
+        std::vector<uint32_t> m_freeCasters;
+        uint32_t m_casterCount = 0;
+        // Slots whose transforms the next frame uploads.
+        std::vector<uint32_t> m_changedCasters;
+        std::vector<bool> m_casterChanged;
+        // Where casters were and are since the last frame, for invalidation.
+        std::vector<glm::vec4> m_changedBounds;
+
+        glm::vec3 m_lightDirection{ -0.4f, -1.0f, -0.3f };
+        std::vector<Cascade> m_cascades;
+        std::vector<float> m_cascadeSplits;
+
+        std::vector<TileDraw> m_draws;
+        uint32_t m_drawCount = 0;
+        std::vector<ShadowViewData> m_views;
+        // One per frame slot, sized for every cascade and light face.
+        std::vector<Buffer> m_viewBuffers;
+
+        Image m_atlas;
+        vk::ImageView m_atlasView;
+        bool m_atlasInitialized = false;
+        Buffer m_transforms;
+        Buffer m_vertices;
+        Buffer m_indices;
+
+        // Only used to create the pipeline. Frames draw through the render
+        // graph's own, compatible render pass.
+        vk::RenderPass m_renderPass;
+        vk::DescriptorSetLayout m_setLayout;
+        vk::PipelineLayout m_pipelineLayout;
+        vk::Pipeline m_pipeline;
+
+        ShadowStats m_stats;
+    };
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "gpu_memory.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace bvr
+{
+    class Renderer;
+
+
+    enum class PresentMode
+    {
+        // Waits for vertical blank and never tears. Always supported, and what
+        // the other modes fall back to.
+        eFifo,
+        // FIFO, except a frame that missed its blank is shown right away and
+        // may tear.
+        eFifoRelaxed,
+        // Waits for vertical blank, but a newer frame replaces the one queued.
+        eMailbox,
+        // Shows frames as soon as they are done, tearing.
+        eImmediate,
+    };
+
+    const char* toString(PresentMode mode);
+
+
+    struct SwapchainConfig
+    {
+        PresentMode presentMode = PresentMode::eFifo;
+        // Frames the CPU may start before the oldest of them has been shown,
+        // at most RenderConfig::framesInFlight. Every frame of run-ahead is a
+        // frame of input latency.
+        uint32_t maxFrameLatency = 1;
+        // Images requested from the surface, clamped to what it supports.
+        uint32_t imageCount = 3;
+        // Headless runs present into offscreen images shown on a simulated
+        // display instead, with the same acquire, present and recreation as
+        // a window.
+        bool virtualSwapchain = false;
+        uint32_t virtualRefreshHz = 60;
+    };
+
+
+    // An acquired image, valid until it is presented.
+    struct SwapchainImage
+    {
+        uint32_t index = UINT32_MAX;
+        vk::Image image;
+        vk::Extent2D extent;
+        // Signalled when the image can be written, and to signal once it can
+        // be presented. Null for virtual images, which need neither.
+        vk::Semaphore acquired;
+        vk::Semaphore presentReady;
+
+        bool isValid() const { return index != UINT32_MAX; }
+    };
+
+
+    // Presents to a window surface, or to a virtual display without one.
+    //
+    // Resizes and out of date surfaces recreate the swapchain from the old
+    // one at the next acquire. The old swapchain and its semaphores are
+    // released once the frames that used them retire, so nothing waits for
+    // the device to go idle.
+    class Swapchain
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        // A null `surface` creates a virtual swapchain. `frameTimeline` is the
+        // renderer's, which virtual presents wait on. `presentWaitSupported`
+        // is whether the device has VK_KHR_present_wait enabled.
+        Swapchain(
+            Renderer& renderer,
+            const SwapchainConfig& config,
+            vk::PhysicalDevice physicalDevice,
+            vk::SurfaceKHR surface,
+            uint32_t graphicsFamily,
+            uint32_t presentFamily,
+            uint32_t frameCount,
+            vk::Semaphore frameTimeline,
+            bool presentWaitSupported,
+            vk::Extent2D extent
+        );
+        ~Swapchain();
+
+        Swapchain(const Swapchain&) = delete;
+        Swapchain& operator=(const Swapchain&) = delete;
+
+        // Returns an invalid image while the window is minimized. Recreates the
+        // swapchain first when it is out of date or was resized. `frameSlot`
+        // picks the acquire semaphore, which the frame in that slot owns.
+        SwapchainImage acquire(uint32_t frameSlot);
+        // Queues `image` for presentation once the frame timeline reaches
+        // `timelineValue`. Present ids must increase.
+        void present(vk::Queue queue, const SwapchainImage& image, uint64_t presentId, uint64_t timelineValue);
+
+        // Blocks until the present with `presentId` has been shown. False when
+        // that can't be known, e.g. without present wait support or for ids
+        // from before the last recreation; callers then fall back to waiting
+        // for the GPU.
+        bool waitForPresent(uint64_t presentId, Clock::time_point& shownTime);
+
+        // Takes effect at the next acquire. An empty extent pauses presenting.
+        void resize(vk::Extent2D extent);
+
+        // What images must be in when presented.
+        vk::ImageLayout getPresentLayout() const;
+        vk::Extent2D getExtent() const { return m_extent; }
+        vk::Format getFormat() const { return m_format; }
+        // The mode in use, which is FIFO when the requested one isn't supported.
+        PresentMode getPresentMode() const { return m_presentMode; }
+        bool isVirtual() const { return !m_surface; }
+        uint32_t getImageCount() const { return uint32_t(m_images.size()); }
+        uint32_t getRecreateCount() const { return m_recreateCount; }
+
+    private:
+        // A virtual present, scheduled on the display once the GPU is done
+        // with it.
+        struct VirtualPresent
+        {
+            uint64_t presentId = 0;
+            uint64_t timelineValue = 0;
+            Clock::time_point shownTime;
+            bool scheduled = false;
+        };
+
+        void recreate();
+        void createSurfaceSwapchain();
+        void createVirtualImages();
+        void releaseImages();
+        void pollVirtualPresents();
+        // When the virtual display shows a frame that finished at `readyTime`.
+        Clock::time_point scheduleVirtualPresent(Clock::time_point readyTime);
+
+        Renderer& m_renderer;
+        SwapchainConfig m_config;
+        vk::PhysicalDevice m_physicalDevice;
+        vk::Device m_device;
+        vk::SurfaceKHR m_surface;
+        uint32_t m_graphicsFamily = 0;
+        uint32_t m_presentFamily = 0;
+        vk::Semaphore m_frameTimeline;
+        PFN_vkWaitForPresentKHR m_waitForPresent = nullptr;
+
+        vk::SwapchainKHR m_swapchain;
+        vk::Format m_format = vk::Format::eUndefined;
+        vk::Extent2D m_extent;
+        vk::Extent2D m_requestedExtent;
+        PresentMode m_presentMode = PresentMode::eFifo;
+        std::vector<vk::Image> m_images;
+        // Virtual swapchains own their images.
+        std::vector<Image> m_virtualImages;
+        std::vector<vk::Semaphore> m_acquireSemaphores;
+        // One per image: a present may still wait on it until the image is
+        // acquired again.
+        std::vector<vk::Semaphore> m_presentSemaphores;
+        bool m_outOfDate = false;
+        uint32_t m_recreateCount = 0;
+        // Ids this swapchain has presented, the range present waits can cover.
+        uint64_t m_firstPresentId = 0;
+        uint64_t m_lastPresentId = 0;
+
+        uint32_t m_nextVirtualImage = 0;
+        std::deque<VirtualPresent> m_virtualPresents;
+        Clock::time_point m_virtualStart;
+        Clock::duration m_virtualPeriod;
+        Clock::time_point m_lastShownTime;
+    };
+}
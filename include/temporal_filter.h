@@ -0,0 +1,197 @@
+#pragma once
+
+#include "gpu_memory.h"
+#include "instance_culling.h"
+#include "render_graph.h"
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace bvr
+{
+    class Renderer;
+    struct FrameContext;
+
+
+    struct TemporalConfig
+    {
+        // Length of the Halton jitter sequence at full resolution. Lower
+        // render scales cover an output pixel with fewer samples per frame,
+        // so the sequence grows by 1 / scale^2 to make up for it.
+        uint32_t jitterPhases = 8;
+        // Share of the history kept per frame: feedbackMax where the history
+        // is trusted, down to feedbackMin where the velocity changed by
+        // 1 / velocityRejection output pixels or more since the history was
+        // written, which is what disocclusions look like.
+        float feedbackMin = 0.6f;
+        float feedbackMax = 0.94f;
+        float velocityRejection = 0.5f;
+
+        // Blurs the resolved image along the motion vectors. The blur covers
+        // `shutter` of the motion between two frames, at most maxBlurPixels.
+        bool motionBlur = true;
+        uint32_t motionBlurSamples = 8;
+        float shutter = 0.5f;
+        float maxBlurPixels = 32.0f;
+
+        uint32_t maxObjects = 65536;
+    };
+
+
+    struct TemporalObjectHandle
+    {
+        uint32_t index = UINT32_MAX;
+
+        bool isValid() const { return index != UINT32_MAX; }
+    };
+
+
+    struct TemporalCamera
+    {
+        glm::mat4 view{ 1.0f };
+        // Perspective with Vulkan's 0..1 depth range, without jitter.
+        glm::mat4 projection{ 1.0f };
+    };
+
+
+    struct TemporalStats
+    {
+        float renderScale = 1.0f;
+        vk::Extent2D renderExtent;
+        // Sub-pixel offset of this frame's samples, in render pixels.
+        glm::vec2 jitter{ 0.0f };
+        uint32_t jitterPhases = 0;
+        uint32_t objects = 0;
+        // Objects whose transforms the frame uploaded, moved ones and the
+        // ones that stopped moving.
+        uint32_t objectsUploaded = 0;
+        // False on frames that started over without history.
+        bool historyValid = false;
+        double cpuUpdateMs = 0.0;
+    };
+
+
+    // Temporal anti-aliasing of built-in meshes, with motion vectors reused
+    // for motion blur.
+    //
+    // Each frame draws the objects with a sub-pixel jitter at the frame's
+    // render extent (FrameContext::renderExtent), writing color and the
+    // screen space motion of every pixel since the previous frame. Objects
+    // keep their previous transform, so moving objects and a moving camera
+    // both produce motion. The "taa_resolve" pass accumulates the samples
+    // into a history at the target's resolution, which also upsamples frames
+    // rendered below it, and "motion_blur" blurs the result along the motion
+    // into the target.
+    class TemporalFilter
+    {
+    public:
+        TemporalFilter(Renderer& renderer, const TemporalConfig& config);
+        ~TemporalFilter();
+
+        TemporalFilter(const TemporalFilter&) = delete;
+        TemporalFilter& operator=(const TemporalFilter&) = delete;
+
+        // True once the meshes have been uploaded and acquired by a frame.
+        bool isReady() const { return m_ready->load(std::memory_order_acquire); }
+
+        // Throws std::runtime_error past TemporalConfig::maxObjects.
+        TemporalObjectHandle addObject(const glm::mat4& transform, const glm::vec4& color, BuiltinMesh mesh);
+        // Motion is measured from where the object was in the previous frame,
+        // however often it moves in between.
+        void moveObject(TemporalObjectHandle handle, const glm::mat4& transform);
+        void removeObject(TemporalObjectHandle handle);
+
+        // Direction the light travels in.
+        void setLightDirection(const glm::vec3& direction);
+        // Drops the history, for camera cuts. The next frame starts over from
+        // its own samples.
+        void resetHistory() { m_historyValid = false; }
+
+        // Adds the "temporal_objects", "temporal_scene", "taa_resolve" and
+        // "motion_blur" passes, the last one writing all of `target`. Call
+        // from the Renderer::renderFrameGraph() callback once isReady().
+        void addPasses(RenderGraph& graph, FrameContext& frame, const TemporalCamera& camera, GraphResource target);
+
+        TemporalStats getStats() const { return m_stats; }
+
+    private:
+        // Matches TemporalObject in shaders/temporal_scene.vert.
+        struct ObjectData
+        {
+            glm::mat4 world;
+            glm::mat4 previousWorld;
+            glm::vec4 color;
+        };
+
+        void createBuffers();
+        void createPipelines();
+        void markObjectDirty(uint32_t index);
+        glm::vec2 nextJitter(float renderScale);
+
+        Renderer& m_renderer;
+        TemporalConfig m_config;
+        vk::Extent2D m_outputExtent;
+        // Shared with the upload callback, which may outlive the filter.
+        std::shared_ptr<std::atomic<bool>> m_ready;
+        uint64_t m_uploadValue = 0;
+        std::array<BuiltinMeshRange, size_t(BuiltinMesh::eCount)> m_meshRanges;
+
+        std::vector<ObjectData> m_objects;
+        std::vector<uint32_t> m_objectMeshes;
+        std::vector<bool> m_objectAlive;
+        std::vector<uint32_t> m_freeObjects;
+        uint32_t m_objectCount = 0;
+        // Slots whose data the next frame uploads.
+        std::vector<uint32_t> m_dirtyObjects;
+        std::vector<bool> m_objectDirty;
+        // Moved since the last frame, and moved in the last frame. The latter
+        // still carry that motion and need their previous transform caught up.
+        std::vector<uint32_t> m_movedObjects;
+        std::vector<uint32_t> m_settlingObjects;
+        std::vector<bool> m_objectMoved;
+
+        glm::vec3 m_lightDirection{ -0.4f, -1.0f, -0.3f };
+        uint32_t m_jitterIndex = 0;
+        // Unjittered, to measure the camera's motion against.
+        glm::mat4 m_previousViewProjection{ 1.0f };
+
+        // Ping-pong histories at the output resolution: the resolve reads one
+        // and writes the other. The velocity history holds the motion each
+        // history pixel was resolved with, as packed halves.
+        std::array<Image, 2> m_history;
+        std::array<vk::ImageView, 2> m_historyViews;
+        std::array<Image, 2> m_velocityHistory;
+        std::array<vk::ImageView, 2> m_velocityHistoryViews;
+        uint32_t m_historyIndex = 0;
+        bool m_historyValid = false;
+        bool m_historyInitialized = false;
+
+        Buffer m_objectBuffer;
+        Buffer m_vertices;
+        Buffer m_indices;
+
+        vk::Sampler m_pointSampler;
+        vk::Sampler m_linearSampler;
+        // Only used to create the pipelines. Frames draw through the render
+        // graph's own, compatible render passes.
+        vk::RenderPass m_sceneRenderPass;
+        vk::RenderPass m_blurRenderPass;
+        vk::DescriptorSetLayout m_sceneSetLayout;
+        vk::DescriptorSetLayout m_resolveSetLayout;
+        vk::DescriptorSetLayout m_blurSetLayout;
+        vk::PipelineLayout m_sceneLayout;
+        vk::PipelineLayout m_resolveLayout;
+        vk::PipelineLayout m_blurLayout;
+        vk::Pipeline m_scenePipeline;
+        vk::Pipeline m_resolvePipeline;
+        vk::Pipeline m_blurPipeline;
+
+        TemporalStats m_stats;
+    };
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "image_decoder.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bvr
+{
+    class JobSystem;
+
+
+    // Halves an RGBA8 image with a 2x2 box filter, down to 1x1. `srgb` filters
+    // the color channels in linear space; alpha is always linear.
+    DecodedImage downsampleImage(const DecodedImage& image, bool srgb);
+
+    // Block compresses tightly packed RGBA8 texels into `format`, one of
+    // BC1 RGB (alpha is dropped), BC3, BC4 (red) or BC5 (red and green), each
+    // UNORM or, where it exists, SRGB. The encoder fits endpoints along each
+    // block's principal axis; it aims at cooking speed, not the best quality.
+    // Splits the blocks across `jobs` when given. Throws std::runtime_error for
+    // other formats.
+    std::vector<uint8_t> compressBlocks(vk::Format format, const DecodedImage& image, JobSystem* jobs = nullptr);
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "gpu_memory.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace bvr
+{
+    // Texel block of the formats UploadQueue::uploadImage() accepts: 1x1 for
+    // uncompressed formats, 4x4 for BC. Zero bytes for anything else.
+    struct TexelBlock
+    {
+        uint32_t width = 1;
+        uint32_t height = 1;
+        uint32_t bytes = 0;
+    };
+
+    TexelBlock getTexelBlock(vk::Format format);
+
+    // Bytes of mip `level` of a `format` image whose mip 0 is `extent`, tightly
+    // packed.
+    vk::DeviceSize getImageLevelSize(vk::Format format, vk::Extent2D extent, uint32_t level);
+
+
+    struct UploadStats
+    {
+        uint64_t bytesUploaded = 0;
+        uint64_t batchesSubmitted = 0;
+        // Times an upload had to wait for the transfer queue to free staging space.
+        uint64_t stagingStalls = 0;
+    };
+
+
+    // Streams buffer and image data to device local memory through a staging
+    // ring on the transfer queue. Copies are batched into one command buffer
+    // until flush() or until the ring is full, and every batch signals the
+    // upload timeline with an increasing value.
+    //
+    // When the transfer queue belongs to another family than graphics, each
+    // batch releases its resources and the render thread acquires them in
+    // recordAcquires(), once the batch has completed. Acquiring only completed
+    // batches means a frame never waits on the transfer queue, uploads simply
+    // become visible one frame later.
+    //
+    // Every upload method is thread safe. recordAcquires() must be called from
+    // the render thread while it records a frame.
+    class UploadQueue
+    {
+    public:
+        // `queueMutex` must be locked around every other submission to
+        // `transferQueue` when it is shared with the graphics queue, else null.
+        UploadQueue(
+            vk::Device device,
+            GpuMemory& memory,
+            vk::Queue transferQueue,
+            uint32_t transferFamily,
+            uint32_t graphicsFamily,
+            vk::Extent3D imageGranularity,
+            vk::DeviceSize stagingSize,
+            std::mutex* queueMutex
+        );
+        ~UploadQueue();
+
+        UploadQueue(const UploadQueue&) = delete;
+        UploadQueue& operator=(const UploadQueue&) = delete;
+
+        // Copies `size` bytes into `dst` at `dstOffset`. Uploads larger than the
+        // staging ring are split across batches.
+        void uploadBuffer(vk::Buffer dst, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize size);
+        // Copies tightly packed RGBA8 texels into mip 0 of `dst`, which must be
+        // in the undefined layout. It ends up in eShaderReadOnlyOptimal.
+        void uploadImage(vk::Image dst, vk::Extent2D extent, const void* texels);
+        // Copies mips 0 to `levelCount` - 1 of `dst`, tightly packed one after
+        // the other, largest first. Block compressed formats are copied in whole
+        // block rows. Same layouts as above.
+        void uploadImage(vk::Image dst, vk::Format format, vk::Extent2D extent, uint32_t levelCount, const void* data);
+
+        // Submits the copies recorded so far and returns the upload timeline value
+        // their batch signals, or the last submitted value if nothing was pending.
+        uint64_t flush();
+        uint64_t getCompletedValue() const;
+        // Blocks the calling thread until the upload timeline reaches `value`.
+        void wait(uint64_t value);
+
+        // Runs `callback` on the render thread during the first recordAcquires()
+        // that acquires the batch signalling `value`, so anything the callback
+        // publishes can be drawn by the frame being recorded.
+        void whenAcquired(uint64_t value, std::function<void()> callback);
+
+        // Records the acquire barriers of every completed batch into the graphics
+        // command buffer. Returns the upload timeline value the frame's submission
+        // has to wait on, 0 if it needs none.
+        uint64_t recordAcquires(vk::CommandBuffer commandBuffer);
+
+        vk::Semaphore getTimeline() const { return m_timeline; }
+        UploadStats getStats() const;
+
+    private:
+        struct Batch
+        {
+            vk::CommandBuffer commandBuffer;
+            uint64_t timelineValue = 0;
+            // Ring offset where the next batch's staging data starts, freed up to
+            // here once the batch completes.
+            vk::DeviceSize stagingEnd = 0;
+            vk::DeviceSize stagingBytes = 0;
+            std::vector<vk::BufferMemoryBarrier> bufferAcquires;
+            std::vector<vk::ImageMemoryBarrier> imageAcquires;
+        };
+
+        struct AcquireCallback
+        {
+            uint64_t timelineValue = 0;
+            std::function<void()> callback;
+        };
+
+        // All private methods expect m_mutex to be held.
+        vk::DeviceSize allocateStaging(vk::DeviceSize size, std::unique_lock<std::mutex>& lock);
+        bool tryAllocateStaging(vk::DeviceSize size, vk::DeviceSize& offset);
+        vk::DeviceSize getMaxChunkSize() const { return m_staging.size / 4; }
+        Batch& getRecordingBatch();
+        uint64_t submitRecording();
+        void submitIfLarge();
+        void reclaimCompleted();
+
+        vk::Device m_device;
+        GpuMemory& m_memory;
+        vk::Queue m_queue;
+        uint32_t m_transferFamily;
+        uint32_t m_graphicsFamily;
+        vk::Extent3D m_imageGranularity;
+        std::mutex* m_queueMutex = nullptr;
+
+        vk::CommandPool m_commandPool;
+        vk::Semaphore m_timeline;
+        Buffer m_staging;
+
+        mutable std::mutex m_mutex;
+        // Staging bytes in [m_stagingTail, m_stagingHead) are in use, wrapping
+        // around the end of the ring.
+        vk::DeviceSize m_stagingHead = 0;
+        vk::DeviceSize m_stagingTail = 0;
+        bool m_recording = false;
+        Batch m_recordingBatch;
+        std::deque<Batch> m_submitted;
+        std::vector<vk::CommandBuffer> m_freeCommandBuffers;
+        // Acquires of completed batches, waiting for the next recordAcquires().
+        std::vector<vk::BufferMemoryBarrier> m_readyBufferAcquires;
+        std::vector<vk::ImageMemoryBarrier> m_readyImageAcquires;
+        uint64_t m_lastSubmittedValue = 0;
+        uint64_t m_completedValue = 0;
+        uint64_t m_lastAcquiredValue = 0;
+        std::vector<AcquireCallback> m_callbacks;
+        UploadStats m_stats;
+    };
+}
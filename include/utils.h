@@ -0,0 +1,13 @@
+#pragma once
+
+#include <iostream>
+
+namespace bvr
+{
+    inline void debugLog(const char* output)
+    {
+#ifndef NDEBUG
+        std::cout << "INFO: " << output << std::endl;
+#endif
+    }
+}
@@ -0,0 +1,197 @@
+#include "job_system.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace bvr
+{
+    namespace
+    {
+        // Several job systems may exist, so a worker index only means something
+        // together with the job system that owns the thread.
+        thread_local const JobSystem* t_workerOwner = nullptr;
+        thread_local uint32_t t_workerIndex = 0;
+    }
+
+    JobSystem::JobSystem(uint32_t threadCount)
+    {
+        if (threadCount == 0) {
+            threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+
+        m_queues.reserve(threadCount);
+        for (uint32_t i = 0; i < threadCount; ++i) {
+            m_queues.push_back(std::make_unique<WorkQueue>());
+        }
+
+        m_threads.reserve(threadCount - 1);
+        for (uint32_t i = 1; i < threadCount; ++i) {
+            m_threads.emplace_back(&JobSystem::workerLoop, this, i);
+        }
+    }
+
+    JobSystem::~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock{ m_sleepMutex };
+            m_running = false;
+        }
+        m_wake.notify_all();
+
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    uint32_t JobSystem::getWorkerIndex() const
+    {
+        return t_workerOwner == this ? t_workerIndex : 0;
+    }
+
+    void JobSystem::run(Job job, JobCounter& counter)
+    {
+        counter.pending.fetch_add(1, std::memory_order_relaxed);
+
+        // Workers push onto their own queue. Jobs from outside the pool are spread
+        // round robin so that every worker has something to pop before stealing.
+        uint32_t queueIndex = getWorkerIndex();
+        if (queueIndex == 0) {
+            queueIndex = m_nextQueue.fetch_add(1, std::memory_order_relaxed) % getThreadCount();
+        }
+
+        {
+            WorkQueue& queue = *m_queues[queueIndex];
+            std::lock_guard<std::mutex> lock{ queue.mutex };
+            queue.jobs.emplace_back(std::move(job), &counter);
+        }
+
+        m_queuedJobs.fetch_add(1, std::memory_order_release);
+        {
+            // Pairs with the predicate check in workerLoop so the wake-up can't be lost.
+            std::lock_guard<std::mutex> lock{ m_sleepMutex };
+        }
+        m_wake.notify_one();
+    }
+
+    void JobSystem::parallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& fn, JobCounter& counter)
+    {
+        grainSize = std::max(grainSize, 1u);
+        // Callers usually pass a temporary that dies before they wait, so the
+        // jobs share a copy.
+        auto shared = std::make_shared<std::function<void(uint32_t, uint32_t)>>(fn);
+        for (uint32_t begin = 0; begin < count; begin += grainSize) {
+            uint32_t end = std::min(begin + grainSize, count);
+            run([shared, begin, end]() { (*shared)(begin, end); }, counter);
+        }
+    }
+
+    void JobSystem::wait(JobCounter& counter)
+    {
+        // Jobs may wait themselves, so the waiting thread can already hold the
+        // slot. Only the outermost wait releases it.
+        const uint32_t workerIndex = getWorkerIndex();
+        const std::thread::id self = std::this_thread::get_id();
+        bool claimed = false;
+        if (t_workerOwner != this && m_outsideWaiter.load(std::memory_order_acquire) != self) {
+            std::thread::id none{};
+            if (!m_outsideWaiter.compare_exchange_strong(none, self, std::memory_order_acq_rel)) {
+                throw std::runtime_error("Only one thread outside the job system may wait at a time");
+            }
+            claimed = true;
+        }
+
+        while (!counter.isDone()) {
+            if (!tryRunOne(workerIndex)) {
+                std::this_thread::yield();
+            }
+        }
+        if (claimed) {
+            m_outsideWaiter.store(std::thread::id{}, std::memory_order_release);
+        }
+
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock{ counter.errorMutex };
+            std::swap(error, counter.error);
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    void JobSystem::workerLoop(uint32_t workerIndex)
+    {
+        t_workerOwner = this;
+        t_workerIndex = workerIndex;
+        BVR_PROFILE_THREAD("worker " + std::to_string(workerIndex));
+
+        while (true) {
+            if (tryRunOne(workerIndex)) {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock{ m_sleepMutex };
+            m_wake.wait(lock, [this]() {
+                return !m_running || m_queuedJobs.load(std::memory_order_acquire) > 0;
+            });
+            if (!m_running) {
+                return;
+            }
+        }
+    }
+
+    bool JobSystem::tryRunOne(uint32_t workerIndex)
+    {
+        std::pair<Job, JobCounter*> entry;
+        if (!popLocal(workerIndex, entry) && !steal(workerIndex, entry)) {
+            return false;
+        }
+        m_queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+
+        // An exception must neither leave a worker thread nor skip the
+        // decrement, or the waiter would spin forever. It is kept for wait().
+        JobCounter& counter = *entry.second;
+        try {
+            entry.first();
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock{ counter.errorMutex };
+            if (!counter.error) {
+                counter.error = std::current_exception();
+            }
+        }
+        counter.pending.fetch_sub(1, std::memory_order_acq_rel);
+        return true;
+    }
+
+    bool JobSystem::popLocal(uint32_t workerIndex, std::pair<Job, JobCounter*>& out)
+    {
+        WorkQueue& queue = *m_queues[workerIndex];
+        std::lock_guard<std::mutex> lock{ queue.mutex };
+        if (queue.jobs.empty()) {
+            return false;
+        }
+        out = std::move(queue.jobs.back());
+        queue.jobs.pop_back();
+        return true;
+    }
+
+    bool JobSystem::steal(uint32_t thiefIndex, std::pair<Job, JobCounter*>& out)
+    {
+        const uint32_t queueCount = getThreadCount();
+        for (uint32_t offset = 1; offset < queueCount; ++offset) {
+            WorkQueue& victim = *m_queues[(thiefIndex + offset) % queueCount];
+            std::unique_lock<std::mutex> lock{ victim.mutex, std::try_to_lock };
+            if (!lock.owns_lock() || victim.jobs.empty()) {
+                continue;
+            }
+            out = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return true;
+        }
+        return false;
+    }
+}
@@ -1,47 +1,122 @@
 BVR_SRC_DIR = path.join(BVR_DIR, "src")
 BVR_INCLUDE_DIR = path.join(BVR_DIR, "include")
+BVR_BENCH_DIR = path.join(BVR_DIR, "bench")
+BVR_COOKER_DIR = path.join(BVR_DIR, "cooker")
 EXTERNAL_INCLUDE_DIR = path.join(EXTERNAL_DIR, "include")
 VK_DIR = os.getenv("VK_SDK_PATH")
+LINUX_VK_DIR = os.getenv("VULKAN_SDK")
+
+newoption {
+  trigger = "with-profiler",
+  description = "Keep the CPU/GPU profiler in Release builds (BVR_PROFILE)"
+}
+
+-- Settings shared by every executable that compiles the renderer sources.
+function bvrRendererSettings()
+  flags {
+    "FatalWarnings",
+    "Cpp17"
+  }
+
+  defines {
+    "_HAS_ITERATOR_DEBUGGING=0",
+    "_SECURE_SCL=0",
+    "WIN32_LEAN_AND_MEAN"
+  }
+
+  files {
+    path.join(BVR_SRC_DIR, "**.cpp"),
+    path.join(BVR_INCLUDE_DIR, "**.h")
+    -- path.join(MIKKTSPACE_DIR, "mikktspace.c")
+  }
+
+  removefiles {
+    path.join(BVR_DIR, "**.bin.h")
+  }
+
+  -- SPIR-V headers generated by `make shaders`
+  includedirs {
+    BVR_INCLUDE_DIR,
+    EXTERNAL_INCLUDE_DIR,
+    path.join(BVR_DIR, ".build", "shaders")
+  }
+
+  -- VK_SDK_PATH is only set by the Windows SDK installer.
+  if VK_DIR ~= nil then
+    configuration "vs*"
+      includedirs {
+        path.join(VK_DIR, "Include")
+      }
+
+      links {
+        path.join(EXTERNAL_DIR, "libs", "glfw3"),
+        path.join(VK_DIR, "Lib", "vulkan-1")
+      }
+  end
+
+  -- Vulkan and GLFW come from the system (libvulkan-dev, libglfw3-dev), or
+  -- from the LunarG SDK when VULKAN_SDK is set.
+  configuration "linux"
+    if LINUX_VK_DIR ~= nil then
+      includedirs { path.join(LINUX_VK_DIR, "include") }
+      libdirs { path.join(LINUX_VK_DIR, "lib") }
+    end
+
+    links {
+      "glfw",
+      "vulkan",
+      "dl",
+      "pthread"
+    }
+
+  configuration "Debug"
+    flags { "Symbols" }
+    defines { "BVR_PROFILE=1" }
+
+  configuration "Release"
+    flags { "OptimizeSpeed" }
+    defines { _OPTIONS["with-profiler"] and "BVR_PROFILE=1" or "BVR_PROFILE=0" }
+
+  configuration {}
+end
 
 project("BVR")
 uuid(os.uuid("BVR"))
 kind "ConsoleApp"
 
-flags {
-  "FatalWarnings"
-}
+bvrRendererSettings()
 
-defines {
-  "_HAS_ITERATOR_DEBUGGING=0",
-  "_SECURE_SCL=0",
-  "WIN32_LEAN_AND_MEAN"
-}
+-- Headless benchmarks, see bench/main.cpp for the list of modes.
+project("BVRBench")
+uuid(os.uuid("BVRBench"))
+kind "ConsoleApp"
+
+bvrRendererSettings()
 
 files {
-  path.join(BVR_SRC_DIR, "**.cpp"),
-  path.join(BVR_INCLUDE_DIR, "**.h")
-  -- path.join(MIKKTSPACE_DIR, "mikktspace.c")
+  path.join(BVR_BENCH_DIR, "**.cpp"),
+  path.join(BVR_BENCH_DIR, "**.h")
 }
 
 removefiles {
-  path.join(BVR_DIR, "**.bin.h")
+  path.join(BVR_SRC_DIR, "main.cpp")
 }
 
 includedirs {
-  BVR_INCLUDE_DIR,
-  EXTERNAL_INCLUDE_DIR,
-  path.join(VK_DIR, "Include")
+  BVR_BENCH_DIR
 }
 
-links {
-  path.join(EXTERNAL_DIR, "libs", "glfw3"),
-  path.join(VK_DIR, "Lib", "vulkan-1")
-}
+-- Offline asset cooker, glTF to .bvrpkg packages.
+project("BVRCook")
+uuid(os.uuid("BVRCook"))
+kind "ConsoleApp"
 
-configuration "Debug"
-  flags { "Symbols" }
+bvrRendererSettings()
 
-configuration "Release"
-  flags { "OptimizeSpeed" }
+files {
+  path.join(BVR_COOKER_DIR, "**.cpp")
+}
 
-configuration {}
+removefiles {
+  path.join(BVR_SRC_DIR, "main.cpp")
+}
@@ -8,6 +8,7 @@ BVR_SCRIPTS_DIR = path.join(BVR_DIR, "scripts")
 EXTERNAL_DIR = (BVR_DIR .. "external/")
 
 local BUILD_DIR = path.join(BVR_DIR, ".build")
+local BUILD_PLATFORM = os.is("linux") and "linux64" or "win64"
 
 --
 -- Solution
@@ -19,8 +20,8 @@ platforms {"x64"}
 startproject "bvr"
 location (BUILD_DIR)
 
-targetdir (path.join(BUILD_DIR, "win64_" .. _ACTION, "bin", _name))
-objdir (path.join(BUILD_DIR, "win64_" .. _ACTION, "obj", _name))
+targetdir (path.join(BUILD_DIR, BUILD_PLATFORM .. "_" .. _ACTION, "bin", _name))
+objdir (path.join(BUILD_DIR, BUILD_PLATFORM .. "_" .. _ACTION, "obj", _name))
 
 group "libs"
 dofile(path.join(BVR_SCRIPTS_DIR, "bvr.lua"))
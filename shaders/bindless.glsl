@@ -0,0 +1,22 @@
+// The renderer's global descriptor set, see include/bindless.h. Handles from
+// the BindlessTable index these arrays directly.
+#extension GL_EXT_nonuniform_qualifier : require
+
+#ifndef BVR_BINDLESS_SET
+#define BVR_BINDLESS_SET 0
+#endif
+
+layout(set = BVR_BINDLESS_SET, binding = 0) uniform texture2D g_textures[];
+layout(set = BVR_BINDLESS_SET, binding = 2) uniform sampler g_samplers[];
+
+// Storage buffers are declared per block type, all aliasing binding 1, e.g.
+// BVR_BINDLESS_BUFFERS(Materials { Material materials[]; }, g_materials);
+#define BVR_BINDLESS_BUFFERS(block, name) \
+    layout(set = BVR_BINDLESS_SET, binding = 1) readonly buffer block name[]
+
+// Indices from instance data or varyings differ within a draw and must be
+// marked non-uniform; push constant indices needn't be.
+vec4 sampleBindless(uint textureIndex, uint samplerIndex, vec2 uv)
+{
+    return texture(nonuniformEXT(sampler2D(g_textures[textureIndex], g_samplers[samplerIndex])), uv);
+}
@@ -0,0 +1,117 @@
+// Sampling and GGX helpers of the IBL bakes, see include/ibl.h. Every
+// function has a C++ twin in src/ibl.cpp that the CPU bake runs, so keep the
+// two in sync.
+
+const float kPi = 3.14159265358979;
+
+// The environment as an equirectangular mip chain: levels[i] holds the offset
+// of mip i in texels, its width and its height.
+layout(std430, set = 0, binding = 0) readonly buffer EnvironmentTexels { vec4 texels[]; };
+layout(std430, set = 0, binding = 1) readonly buffer EnvironmentLevels { uvec4 levels[]; };
+
+vec2 directionToEquirect(vec3 direction)
+{
+    return vec2(atan(direction.z, direction.x) / (2.0 * kPi) + 0.5, acos(clamp(direction.y, -1.0, 1.0)) / kPi);
+}
+
+vec3 equirectToDirection(vec2 uv)
+{
+    float phi = (uv.x - 0.5) * 2.0 * kPi;
+    float theta = uv.y * kPi;
+    return vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+// Vulkan's cube map conventions, `uv` in 0..1 across the face.
+vec3 cubeDirection(uint face, vec2 uv)
+{
+    float s = uv.x * 2.0 - 1.0;
+    float t = uv.y * 2.0 - 1.0;
+    vec3 direction;
+    switch (face) {
+    case 0: direction = vec3(1.0, -t, -s); break;
+    case 1: direction = vec3(-1.0, -t, s); break;
+    case 2: direction = vec3(s, 1.0, t); break;
+    case 3: direction = vec3(s, -1.0, -t); break;
+    case 4: direction = vec3(s, -t, 1.0); break;
+    default: direction = vec3(-s, -t, -1.0); break;
+    }
+    return normalize(direction);
+}
+
+// Bilinear, wrapping around horizontally and clamped at the poles.
+vec3 sampleLevel(uint level, vec2 uv)
+{
+    uvec4 info = levels[level];
+    int width = int(info.y);
+    int height = int(info.z);
+    float x = uv.x * float(width) - 0.5;
+    float y = uv.y * float(height) - 0.5;
+    float x0 = floor(x);
+    float y0 = floor(y);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    int left = ((int(x0) % width) + width) % width;
+    int right = (left + 1) % width;
+    int top = clamp(int(y0), 0, height - 1);
+    int bottom = clamp(int(y0) + 1, 0, height - 1);
+    uint base = info.x;
+    vec3 topRow = mix(texels[base + uint(top * width + left)].rgb, texels[base + uint(top * width + right)].rgb, fx);
+    vec3 bottomRow = mix(texels[base + uint(bottom * width + left)].rgb, texels[base + uint(bottom * width + right)].rgb, fx);
+    return mix(topRow, bottomRow, fy);
+}
+
+// Trilinear between the two mips around `lod`.
+vec3 sampleEnvironment(vec3 direction, float lod, uint levelCount)
+{
+    vec2 uv = directionToEquirect(direction);
+    lod = clamp(lod, 0.0, float(levelCount - 1));
+    uint lower = uint(lod);
+    uint upper = min(lower + 1, levelCount - 1);
+    return mix(sampleLevel(lower, uv), sampleLevel(upper, uv), lod - float(lower));
+}
+
+float radicalInverse(uint bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10;
+}
+
+vec2 hammersley(uint i, uint count)
+{
+    return vec2(float(i) / float(count), radicalInverse(i));
+}
+
+// Half vector around `normal` distributed like GGX with `roughness`, which is
+// perceptual, squared into alpha.
+vec3 importanceSampleGgx(vec2 xi, vec3 normal, float roughness)
+{
+    float alpha = roughness * roughness;
+    float phi = 2.0 * kPi * xi.x;
+    float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (alpha * alpha - 1.0) * xi.y));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+
+    vec3 up = abs(normal.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(up, normal));
+    vec3 bitangent = cross(normal, tangent);
+    return normalize(tangent * (sinTheta * cos(phi)) + bitangent * (sinTheta * sin(phi)) + normal * cosTheta);
+}
+
+float distributionGgx(float nDotH, float roughness)
+{
+    float alpha = roughness * roughness;
+    float alpha2 = alpha * alpha;
+    float denominator = nDotH * nDotH * (alpha2 - 1.0) + 1.0;
+    return alpha2 / (kPi * denominator * denominator);
+}
+
+// Smith-Schlick with the k of image based lighting.
+float geometrySmith(float nDotV, float nDotL, float roughness)
+{
+    float k = roughness * roughness * 0.5;
+    return (nDotV / (nDotV * (1.0 - k) + k)) * (nDotL / (nDotL * (1.0 - k) + k));
+}
@@ -0,0 +1,21 @@
+#version 450
+
+// Draws culled instances: gl_InstanceIndex is the instance's index into the
+// per-instance arrays, passed as the draw's firstInstance.
+layout(push_constant) uniform ViewConstants
+{
+    mat4 viewProjection;
+} view;
+
+layout(std430, set = 0, binding = 0) readonly buffer Transforms { mat4 transforms[]; };
+layout(std430, set = 0, binding = 1) readonly buffer Colors { vec4 colors[]; };
+
+layout(location = 0) in vec3 inPosition;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+    gl_Position = view.viewProjection * transforms[gl_InstanceIndex] * vec4(inPosition, 1.0);
+    outColor = colors[gl_InstanceIndex];
+}
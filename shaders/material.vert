@@ -0,0 +1,24 @@
+#version 450
+
+// One triangle per draw like triangle.vert, shaded with a material. `material`
+// holds bindless handles (texture, sampler, parameter buffer), the per-set
+// path ignores it.
+layout(push_constant) uniform MaterialConstants
+{
+    vec4 offsetScale;
+    uvec4 material;
+} draw;
+
+layout(location = 0) out vec2 outUv;
+
+const vec2 positions[3] = vec2[](
+    vec2(0.0, -1.0),
+    vec2(1.0, 1.0),
+    vec2(-1.0, 1.0)
+);
+
+void main()
+{
+    gl_Position = vec4(positions[gl_VertexIndex] * draw.offsetScale.zw + draw.offsetScale.xy, 0.0, 1.0);
+    outUv = positions[gl_VertexIndex] * 0.5 + 0.5;
+}
@@ -0,0 +1,27 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "bindless.glsl"
+
+// The same material as material_set.frag, found through bindless handles.
+layout(push_constant) uniform MaterialConstants
+{
+    vec4 offsetScale;
+    uvec4 material;
+} draw;
+
+struct MaterialParams
+{
+    vec4 tint;
+};
+
+BVR_BINDLESS_BUFFERS(MaterialBuffer { MaterialParams params; }, g_materials);
+
+layout(location = 0) in vec2 inUv;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+    outColor = sampleBindless(draw.material.x, draw.material.y, inUv) * g_materials[draw.material.z].params.tint;
+}
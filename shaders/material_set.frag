@@ -0,0 +1,18 @@
+#version 450
+
+// A material bound as its own descriptor set.
+layout(set = 0, binding = 0) uniform texture2D materialTexture;
+layout(set = 0, binding = 1) uniform sampler materialSampler;
+layout(set = 0, binding = 2) uniform MaterialParams
+{
+    vec4 tint;
+} params;
+
+layout(location = 0) in vec2 inUv;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+    outColor = texture(sampler2D(materialTexture, materialSampler), inUv) * params.tint;
+}
@@ -0,0 +1,41 @@
+#version 450
+
+// Blurs the resolved image along each pixel's motion, reusing the velocity
+// the TAA resolve wrote. The velocity covers a whole frame, the shutter is
+// the share of it the blur spans. A single sample copies the image.
+layout(push_constant) uniform BlurConstants
+{
+    // Extent in xy, its inverse in zw.
+    vec4 outputSize;
+    float shutter;
+    float maxBlurPixels;
+    uint sampleCount;
+} params;
+
+layout(set = 0, binding = 0) uniform sampler2D color;
+layout(set = 0, binding = 1) uniform usampler2D velocity;
+
+layout(location = 0) in vec2 inUv;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+    vec2 blur = unpackHalf2x16(texelFetch(velocity, ivec2(gl_FragCoord.xy), 0).r) * params.shutter;
+    float blurPixels = length(blur * params.outputSize.xy);
+    if (blurPixels > params.maxBlurPixels) {
+        blur *= params.maxBlurPixels / blurPixels;
+    }
+    if (params.sampleCount <= 1u || blurPixels < 0.5) {
+        outColor = vec4(texture(color, inUv).rgb, 1.0);
+        return;
+    }
+
+    // Centered on the pixel, so moving objects stay where they were drawn.
+    vec3 sum = vec3(0.0);
+    for (uint i = 0u; i < params.sampleCount; ++i) {
+        float t = (float(i) + 0.5) / float(params.sampleCount) - 0.5;
+        sum += texture(color, inUv + blur * t).rgb;
+    }
+    outColor = vec4(sum / float(params.sampleCount), 1.0);
+}
@@ -0,0 +1,17 @@
+#version 450
+
+// Depth only draws of shadow casters into an atlas tile. gl_InstanceIndex is
+// the caster's slot, passed as the draw's firstInstance.
+layout(push_constant) uniform ViewConstants
+{
+    mat4 viewProjection;
+} view;
+
+layout(std430, set = 0, binding = 0) readonly buffer Transforms { mat4 transforms[]; };
+
+layout(location = 0) in vec3 inPosition;
+
+void main()
+{
+    gl_Position = view.viewProjection * transforms[gl_InstanceIndex] * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,33 @@
+#version 450
+
+// Flat shaded color, and the pixel's motion since the previous frame in UV
+// units: where it is now minus where it was.
+layout(set = 0, binding = 0) uniform SceneParams
+{
+    mat4 jitteredViewProjection;
+    mat4 viewProjection;
+    mat4 previousViewProjection;
+    vec4 lightDirection;
+} scene;
+
+layout(location = 0) in vec3 inWorldPosition;
+layout(location = 1) in vec4 inColor;
+layout(location = 2) in vec4 inClip;
+layout(location = 3) in vec4 inPreviousClip;
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec2 outVelocity;
+
+void main()
+{
+    // Framebuffer y points down, so this faces the camera.
+    vec3 normal = normalize(cross(dFdy(inWorldPosition), dFdx(inWorldPosition)));
+    float diffuse = max(dot(normal, -scene.lightDirection.xyz), 0.0);
+    outColor = vec4(inColor.rgb * (0.2 + 0.8 * diffuse), 1.0);
+
+    // Vertices behind the previous camera have no meaningful position, the
+    // resolve rejects their history as coming from off screen.
+    vec2 current = inClip.xy / inClip.w;
+    vec2 previous = inPreviousClip.xy / max(inPreviousClip.w, 1e-5);
+    outVelocity = (current - previous) * 0.5;
+}
@@ -0,0 +1,39 @@
+#version 450
+
+// Draws objects with this frame's jittered projection, and passes along where
+// each vertex is and was without jitter, for the velocity target.
+// gl_InstanceIndex is the object's slot, passed as the draw's firstInstance.
+layout(set = 0, binding = 0) uniform SceneParams
+{
+    mat4 jitteredViewProjection;
+    mat4 viewProjection;
+    mat4 previousViewProjection;
+    vec4 lightDirection;
+} scene;
+
+struct TemporalObject
+{
+    mat4 world;
+    mat4 previousWorld;
+    vec4 color;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Objects { TemporalObject objects[]; };
+
+layout(location = 0) in vec3 inPosition;
+
+layout(location = 0) out vec3 outWorldPosition;
+layout(location = 1) out vec4 outColor;
+layout(location = 2) out vec4 outClip;
+layout(location = 3) out vec4 outPreviousClip;
+
+void main()
+{
+    TemporalObject object = objects[gl_InstanceIndex];
+    vec4 world = object.world * vec4(inPosition, 1.0);
+    outWorldPosition = world.xyz;
+    outColor = object.color;
+    outClip = scene.viewProjection * world;
+    outPreviousClip = scene.previousViewProjection * object.previousWorld * vec4(inPosition, 1.0);
+    gl_Position = scene.jitteredViewProjection * world;
+}
@@ -0,0 +1,17 @@
+#version 450
+
+// Compiles the same shader into distinct pipelines, see
+// Renderer::getScenePipelineVariant(). Variant 0 is the regular scene shader.
+layout(constant_id = 0) const uint kVariant = 0u;
+
+layout(location = 0) in vec4 inColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+    outColor = inColor;
+    if (kVariant != 0u) {
+        outColor.rgb *= 1.0 - float(kVariant) / 65536.0;
+    }
+}
@@ -0,0 +1,23 @@
+#version 450
+
+// One triangle per draw, positioned and tinted through push constants so that
+// synthetic scenes need no vertex buffers.
+layout(push_constant) uniform DrawConstants
+{
+    vec4 offsetScale;
+    vec4 color;
+} draw;
+
+layout(location = 0) out vec4 outColor;
+
+const vec2 positions[3] = vec2[](
+    vec2(0.0, -1.0),
+    vec2(1.0, 1.0),
+    vec2(-1.0, 1.0)
+);
+
+void main()
+{
+    gl_Position = vec4(positions[gl_VertexIndex] * draw.offsetScale.zw + draw.offsetScale.xy, 0.0, 1.0);
+    outColor = draw.color;
+}
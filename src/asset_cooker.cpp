@@ -0,0 +1,767 @@
+#include "asset_cooker.h"
+#include "gltf_loader.h"
+#include "image_decoder.h"
+#include "job_system.h"
+#include "json_reader.h"
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
+#include "package_format.h"
+#include "texture_compressor.h"
+#include "upload_queue.h"
+#include "utils.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        constexpr uint32_t kGlbMagic = 0x46546C67; // "glTF"
+        constexpr uint32_t kGlbChunkJson = 0x4E4F534A; // "JSON"
+        constexpr uint32_t kGlbChunkBin = 0x004E4942; // "BIN\0"
+        // Streams inside a primitive's geometry, and entries in the blobs.
+        constexpr uint64_t kStreamAlignment = 16;
+
+        struct ByteRange
+        {
+            const uint8_t* data = nullptr;
+            size_t size = 0;
+        };
+
+        struct BufferView
+        {
+            uint32_t buffer = 0;
+            size_t offset = 0;
+            size_t length = 0;
+            uint32_t stride = 0;
+        };
+
+        struct Accessor
+        {
+            int32_t bufferView = -1;
+            size_t offset = 0;
+            uint32_t componentType = 0;
+            uint32_t components = 0;
+            uint32_t count = 0;
+            bool normalized = false;
+        };
+
+        // A primitive as glTF describes it, before it is read.
+        struct SourcePrimitive
+        {
+            int32_t position = -1;
+            int32_t normal = -1;
+            int32_t texcoord0 = -1;
+            int32_t indices = -1;
+            int32_t material = -1;
+        };
+
+        enum class ImageUse
+        {
+            eUnused,
+            eColor,
+            eNormal,
+            eData,
+        };
+
+        struct CookedPrimitive
+        {
+            // Stream offsets relative to `geometry` until the package is laid out.
+            PackedPrimitive record;
+            std::vector<uint8_t> geometry;
+            std::vector<PackedMeshlet> meshlets;
+        };
+
+        struct CookedTexture
+        {
+            PackedTexture record;
+            std::vector<uint8_t> data;
+        };
+
+        uint32_t readLe32(const uint8_t* p)
+        {
+            uint32_t value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        uint32_t componentSize(uint32_t componentType)
+        {
+            switch (componentType) {
+            case 5120: case 5121: return 1; // BYTE, UNSIGNED_BYTE
+            case 5122: case 5123: return 2; // SHORT, UNSIGNED_SHORT
+            case 5125: case 5126: return 4; // UNSIGNED_INT, FLOAT
+            default: return 0;
+            }
+        }
+
+        uint32_t componentCount(std::string_view type)
+        {
+            if (type == "SCALAR") return 1;
+            if (type == "VEC2") return 2;
+            if (type == "VEC3") return 3;
+            if (type == "VEC4") return 4;
+            if (type == "MAT4") return 16;
+            return 0;
+        }
+
+        float readComponent(const uint8_t* p, uint32_t componentType, bool normalized)
+        {
+            switch (componentType) {
+            case 5126: { float v; memcpy(&v, p, 4); return v; }
+            case 5121: return normalized ? float(p[0]) / 255.0f : float(p[0]);
+            case 5120: return normalized ? std::max(float(int8_t(p[0])) / 127.0f, -1.0f) : float(int8_t(p[0]));
+            case 5123: { uint16_t v; memcpy(&v, p, 2); return normalized ? float(v) / 65535.0f : float(v); }
+            case 5122: { int16_t v; memcpy(&v, p, 2); return normalized ? std::max(float(v) / 32767.0f, -1.0f) : float(v); }
+            case 5125: { uint32_t v; memcpy(&v, p, 4); return float(v); }
+            default: return 0.0f;
+            }
+        }
+
+        std::string directoryOf(const std::string& path)
+        {
+            size_t slash = path.find_last_of("/\\");
+            return slash == std::string::npos ? std::string{} : path.substr(0, slash + 1);
+        }
+
+        glm::mat4 localTransform(JsonDocument::Value node)
+        {
+            JsonDocument::Value matrix = node["matrix"];
+            if (matrix.size() == 16) {
+                // Column major, like glm.
+                glm::mat4 result{ 1.0f };
+                uint32_t i = 0;
+                for (JsonDocument::Value element = matrix.firstChild(); element.isValid(); element = element.next(), ++i) {
+                    result[i / 4][i % 4] = float(element.asNumber());
+                }
+                return result;
+            }
+
+            JsonDocument::Value t = node["translation"];
+            JsonDocument::Value r = node["rotation"];
+            JsonDocument::Value s = node["scale"];
+            glm::vec3 translation{ float(t[0u].asNumber()), float(t[1u].asNumber()), float(t[2u].asNumber()) };
+            glm::quat rotation{ float(r[3u].asNumber(1.0)), float(r[0u].asNumber()), float(r[1u].asNumber()), float(r[2u].asNumber()) };
+            glm::vec3 scale{ float(s[0u].asNumber(1.0)), float(s[1u].asNumber(1.0)), float(s[2u].asNumber(1.0)) };
+
+            return glm::translate(glm::mat4{ 1.0f }, translation) * glm::mat4_cast(rotation) * glm::scale(glm::mat4{ 1.0f }, scale);
+        }
+
+        uint64_t alignUp(uint64_t value, uint64_t alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        template<typename T>
+        uint64_t appendAligned(std::vector<uint8_t>& blob, const T* data, size_t count)
+        {
+            uint64_t offset = alignUp(blob.size(), kStreamAlignment);
+            blob.resize(size_t(offset));
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+            blob.insert(blob.end(), bytes, bytes + count * sizeof(T));
+            return offset;
+        }
+
+        double millisecondsSince(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // The parsed document and everything it maps, shared by the jobs.
+        struct SourceAsset
+        {
+            MappedFile file;
+            std::vector<MappedFile> externalFiles;
+            // Decoded data: URI buffers.
+            std::vector<std::vector<uint8_t>> embeddedBuffers;
+            std::vector<ByteRange> buffers;
+            std::vector<BufferView> views;
+            std::vector<Accessor> accessors;
+            std::string directory;
+
+            // Element `index` of an accessor as floats, for up to 4 components.
+            void readElement(const Accessor& accessor, uint32_t index, float* out) const
+            {
+                const BufferView& view = views[accessor.bufferView];
+                uint32_t size = componentSize(accessor.componentType);
+                uint32_t stride = view.stride != 0 ? view.stride : size * accessor.components;
+                size_t offset = accessor.offset + size_t(index) * stride;
+                if (offset + size_t(size) * accessor.components > view.length) {
+                    throw std::runtime_error("accessor reads past its bufferView");
+                }
+                const uint8_t* p = buffers[view.buffer].data + view.offset + offset;
+                for (uint32_t c = 0; c < std::min(accessor.components, 4u); ++c) {
+                    out[c] = readComponent(p + c * size, accessor.componentType, accessor.normalized);
+                }
+            }
+
+            const Accessor* getAccessor(int32_t index, uint32_t components) const
+            {
+                if (index < 0 || uint32_t(index) >= accessors.size()) {
+                    return nullptr;
+                }
+                const Accessor& accessor = accessors[index];
+                if (accessor.bufferView < 0 || accessor.components != components || componentSize(accessor.componentType) == 0) {
+                    return nullptr;
+                }
+                return &accessor;
+            }
+        };
+
+        CookedPrimitive cookPrimitive(const SourceAsset& source, const SourcePrimitive& primitive, const CookOptions& options)
+        {
+            const Accessor* positionAccessor = source.getAccessor(primitive.position, 3);
+            if (positionAccessor == nullptr) {
+                throw std::runtime_error("primitive without a readable POSITION");
+            }
+            const Accessor* normalAccessor = source.getAccessor(primitive.normal, 3);
+            const Accessor* texcoordAccessor = source.getAccessor(primitive.texcoord0, 2);
+            const uint32_t sourceVertexCount = positionAccessor->count;
+
+            std::vector<uint32_t> indices;
+            if (const Accessor* indexAccessor = source.getAccessor(primitive.indices, 1)) {
+                indices.resize(indexAccessor->count);
+                for (uint32_t i = 0; i < indexAccessor->count; ++i) {
+                    float value;
+                    source.readElement(*indexAccessor, i, &value);
+                    indices[i] = uint32_t(value);
+                    if (indices[i] >= sourceVertexCount) {
+                        throw std::runtime_error("index out of range");
+                    }
+                }
+            }
+            else {
+                indices.resize(sourceVertexCount);
+                for (uint32_t i = 0; i < sourceVertexCount; ++i) {
+                    indices[i] = i;
+                }
+            }
+            indices.resize(indices.size() / 3 * 3);
+
+            optimizeVertexCache(indices, sourceVertexCount);
+            std::vector<uint32_t> order = optimizeVertexFetch(indices, sourceVertexCount);
+            const uint32_t vertexCount = uint32_t(order.size());
+
+            std::vector<glm::vec3> positions(vertexCount);
+            glm::vec3 low{ FLT_MAX };
+            glm::vec3 high{ -FLT_MAX };
+            for (uint32_t v = 0; v < vertexCount; ++v) {
+                source.readElement(*positionAccessor, order[v], &positions[v].x);
+                low = glm::min(low, positions[v]);
+                high = glm::max(high, positions[v]);
+            }
+            if (vertexCount == 0) {
+                low = high = glm::vec3{ 0.0f };
+            }
+
+            CookedPrimitive cooked;
+            PackedPrimitive& record = cooked.record;
+            record.indexCount = uint32_t(indices.size());
+            record.vertexCount = vertexCount;
+            record.material = primitive.material;
+
+            for (const Meshlet& meshlet : buildMeshlets(indices, positions.data(), options.meshletMaxVertices, options.meshletMaxTriangles)) {
+                PackedMeshlet packed{};
+                packed.sphere = meshlet.sphere;
+                packed.cone = meshlet.cone;
+                packed.firstIndex = meshlet.firstIndex;
+                packed.triangleCount = meshlet.triangleCount;
+                packed.vertexCount = meshlet.vertexCount;
+                cooked.meshlets.push_back(packed);
+            }
+            record.meshletCount = uint32_t(cooked.meshlets.size());
+
+            if (vertexCount <= 65536) {
+                std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+                record.indexSize = 2;
+                record.indexOffset = appendAligned(cooked.geometry, shortIndices.data(), shortIndices.size());
+            }
+            else {
+                record.indexSize = 4;
+                record.indexOffset = appendAligned(cooked.geometry, indices.data(), indices.size());
+            }
+
+            // Positions relative to the bounds, 16 bits per axis.
+            glm::vec3 extent = high - low;
+            record.positionBias = glm::vec4(low, 0.0f);
+            record.positionScale = glm::vec4(extent, 0.0f);
+            std::vector<uint16_t> quantized(size_t(vertexCount) * 4, 0);
+            for (uint32_t v = 0; v < vertexCount; ++v) {
+                for (uint32_t c = 0; c < 3; ++c) {
+                    float normalized = extent[c] > 0.0f ? (positions[v][c] - low[c]) / extent[c] : 0.0f;
+                    quantized[v * 4 + c] = uint16_t(std::lround(glm::clamp(normalized, 0.0f, 1.0f) * 65535.0f));
+                }
+            }
+            record.positionOffset = appendAligned(cooked.geometry, quantized.data(), quantized.size());
+
+            if (normalAccessor != nullptr) {
+                std::vector<int8_t> normals(size_t(vertexCount) * 4, 0);
+                for (uint32_t v = 0; v < vertexCount; ++v) {
+                    glm::vec3 normal;
+                    source.readElement(*normalAccessor, order[v], &normal.x);
+                    float length = glm::length(normal);
+                    normal = length > 0.0f ? normal / length : glm::vec3{ 0.0f, 0.0f, 1.0f };
+                    for (uint32_t c = 0; c < 3; ++c) {
+                        normals[v * 4 + c] = int8_t(std::lround(glm::clamp(normal[c], -1.0f, 1.0f) * 127.0f));
+                    }
+                }
+                record.normalOffset = appendAligned(cooked.geometry, normals.data(), normals.size());
+            }
+
+            if (texcoordAccessor != nullptr) {
+                std::vector<uint16_t> texcoords(size_t(vertexCount) * 2);
+                for (uint32_t v = 0; v < vertexCount; ++v) {
+                    glm::vec2 texcoord;
+                    source.readElement(*texcoordAccessor, order[v], &texcoord.x);
+                    texcoords[v * 2] = glm::packHalf1x16(texcoord.x);
+                    texcoords[v * 2 + 1] = glm::packHalf1x16(texcoord.y);
+                }
+                record.texcoordOffset = appendAligned(cooked.geometry, texcoords.data(), texcoords.size());
+            }
+            return cooked;
+        }
+
+        vk::Format chooseTextureFormat(ImageUse use, bool hasAlpha, const CookOptions& options)
+        {
+            if (!options.compressTextures) {
+                return use == ImageUse::eColor ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+            }
+            switch (use) {
+            case ImageUse::eColor: return hasAlpha ? vk::Format::eBc3SrgbBlock : vk::Format::eBc1RgbSrgbBlock;
+            case ImageUse::eNormal: return vk::Format::eBc5UnormBlock;
+            default: return hasAlpha ? vk::Format::eBc3UnormBlock : vk::Format::eBc1RgbUnormBlock;
+            }
+        }
+
+        CookedTexture cookTexture(ByteRange encoded, ImageUse use, const CookOptions& options, JobSystem& jobs)
+        {
+            if (encoded.data == nullptr) {
+                throw std::runtime_error("image has no data");
+            }
+            DecodedImage image = decodeImage(encoded.data, encoded.size);
+
+            bool hasAlpha = false;
+            for (size_t i = 3; i < image.rgba.size() && !hasAlpha; i += 4) {
+                hasAlpha = image.rgba[i] != 255;
+            }
+            vk::Format format = chooseTextureFormat(use, hasAlpha, options);
+            bool compressed = getTexelBlock(format).width > 1;
+
+            CookedTexture cooked;
+            cooked.record.format = uint32_t(format);
+            cooked.record.width = image.width;
+            cooked.record.height = image.height;
+            while (true) {
+                if (compressed) {
+                    std::vector<uint8_t> blocks = compressBlocks(format, image, &jobs);
+                    cooked.data.insert(cooked.data.end(), blocks.begin(), blocks.end());
+                }
+                else {
+                    cooked.data.insert(cooked.data.end(), image.rgba.begin(), image.rgba.end());
+                }
+                ++cooked.record.levelCount;
+                if (!options.generateMips || (image.width == 1 && image.height == 1)) {
+                    break;
+                }
+                image = downsampleImage(image, use == ImageUse::eColor);
+            }
+            cooked.record.dataSize = cooked.data.size();
+            return cooked;
+        }
+
+        void writeChunk(std::ofstream& file, std::vector<PackageTocEntry>& toc, PackageChunk type, uint32_t count, const void* data, uint64_t size)
+        {
+            static const char padding[kPackageAlignment] = {};
+            uint64_t offset = uint64_t(file.tellp());
+            uint64_t aligned = alignUp(offset, kPackageAlignment);
+            file.write(padding, std::streamsize(aligned - offset));
+            if (size > 0) {
+                file.write(static_cast<const char*>(data), std::streamsize(size));
+            }
+            toc.push_back(PackageTocEntry{ type, count, aligned, size });
+        }
+
+        template<typename T>
+        void writeTable(std::ofstream& file, std::vector<PackageTocEntry>& toc, PackageChunk type, const std::vector<T>& records)
+        {
+            writeChunk(file, toc, type, uint32_t(records.size()), records.data(), records.size() * sizeof(T));
+        }
+    }
+
+    CookStats cookGltf(const std::string& sourcePath, const std::string& packagePath, const CookOptions& options, JobSystem& jobs)
+    {
+        CookStats stats;
+        auto start = std::chrono::steady_clock::now();
+
+        SourceAsset source;
+        source.file = MappedFile{ sourcePath };
+        source.directory = directoryOf(sourcePath);
+        stats.sourceBytes = source.file.size();
+
+        ByteRange json{ source.file.data(), source.file.size() };
+        ByteRange glbBinary;
+        if (source.file.size() >= 12 && readLe32(source.file.data()) == kGlbMagic) {
+            if (readLe32(source.file.data() + 4) != 2) {
+                throw std::runtime_error("Unsupported GLB version");
+            }
+            size_t length = std::min<size_t>(readLe32(source.file.data() + 8), source.file.size());
+            json = ByteRange{};
+            for (size_t pos = 12; pos + 8 <= length;) {
+                size_t chunkLength = readLe32(source.file.data() + pos);
+                uint32_t chunkType = readLe32(source.file.data() + pos + 4);
+                if (pos + 8 + chunkLength > length) {
+                    throw std::runtime_error("Truncated GLB chunk");
+                }
+                if (chunkType == kGlbChunkJson) {
+                    json = ByteRange{ source.file.data() + pos + 8, chunkLength };
+                }
+                else if (chunkType == kGlbChunkBin && glbBinary.data == nullptr) {
+                    glbBinary = ByteRange{ source.file.data() + pos + 8, chunkLength };
+                }
+                pos += 8 + ((chunkLength + 3) & ~size_t(3));
+            }
+            if (json.data == nullptr) {
+                throw std::runtime_error("GLB without a JSON chunk");
+            }
+        }
+
+        JsonDocument document;
+        document.parse(reinterpret_cast<const char*>(json.data), json.size);
+        JsonDocument::Value root = document.root();
+
+        for (JsonDocument::Value buffer = root["buffers"].firstChild(); buffer.isValid(); buffer = buffer.next()) {
+            JsonDocument::Value uri = buffer["uri"];
+            if (!uri.isValid()) {
+                source.buffers.push_back(glbBinary);
+                continue;
+            }
+            std::string uriString = uri.asString();
+            if (isDataUri(uriString)) {
+                source.embeddedBuffers.push_back(decodeDataUri(uriString));
+                source.buffers.push_back(ByteRange{ source.embeddedBuffers.back().data(), source.embeddedBuffers.back().size() });
+                continue;
+            }
+            source.externalFiles.emplace_back(source.directory + uriString);
+            source.buffers.push_back(ByteRange{ source.externalFiles.back().data(), source.externalFiles.back().size() });
+            stats.sourceBytes += source.externalFiles.back().size();
+        }
+
+        for (JsonDocument::Value view = root["bufferViews"].firstChild(); view.isValid(); view = view.next()) {
+            BufferView parsed{};
+            parsed.buffer = view["buffer"].asUint();
+            parsed.offset = size_t(view["byteOffset"].asNumber());
+            parsed.length = size_t(view["byteLength"].asNumber());
+            parsed.stride = view["byteStride"].asUint();
+            if (parsed.buffer >= source.buffers.size() || parsed.offset + parsed.length > source.buffers[parsed.buffer].size) {
+                throw std::runtime_error("bufferView out of range");
+            }
+            source.views.push_back(parsed);
+        }
+
+        for (JsonDocument::Value accessor = root["accessors"].firstChild(); accessor.isValid(); accessor = accessor.next()) {
+            Accessor parsed{};
+            parsed.bufferView = int32_t(accessor["bufferView"].asNumber(-1.0));
+            parsed.offset = size_t(accessor["byteOffset"].asNumber());
+            parsed.componentType = accessor["componentType"].asUint();
+            parsed.components = componentCount(accessor["type"].asRawString());
+            parsed.count = accessor["count"].asUint();
+            parsed.normalized = accessor["normalized"].asBool();
+            if (parsed.bufferView >= int32_t(source.views.size())) {
+                throw std::runtime_error("accessor references a missing bufferView");
+            }
+            source.accessors.push_back(parsed);
+        }
+
+        std::vector<PackedMesh> meshes;
+        std::vector<SourcePrimitive> primitives;
+        for (JsonDocument::Value mesh = root["meshes"].firstChild(); mesh.isValid(); mesh = mesh.next()) {
+            PackedMesh packed{ uint32_t(primitives.size()), 0 };
+            for (JsonDocument::Value primitive = mesh["primitives"].firstChild(); primitive.isValid(); primitive = primitive.next()) {
+                // Only triangle lists, the default mode.
+                if (primitive["mode"].asUint(4) != 4) {
+                    continue;
+                }
+                JsonDocument::Value attributes = primitive["attributes"];
+                SourcePrimitive parsed{};
+                parsed.position = int32_t(attributes["POSITION"].asNumber(-1.0));
+                parsed.normal = int32_t(attributes["NORMAL"].asNumber(-1.0));
+                parsed.texcoord0 = int32_t(attributes["TEXCOORD_0"].asNumber(-1.0));
+                parsed.indices = int32_t(primitive["indices"].asNumber(-1.0));
+                parsed.material = int32_t(primitive["material"].asNumber(-1.0));
+                if (source.getAccessor(parsed.position, 3) == nullptr) {
+                    continue;
+                }
+                primitives.push_back(parsed);
+                ++packed.primitiveCount;
+            }
+            meshes.push_back(packed);
+        }
+
+        // Flatten the default scene, like GltfLoader.
+        std::vector<PackedInstance> instances;
+        JsonDocument::Value nodes = root["nodes"];
+        std::vector<uint32_t> roots;
+        JsonDocument::Value scene = root["scenes"][root["scene"].asUint(0)];
+        if (scene.isValid()) {
+            for (JsonDocument::Value node = scene["nodes"].firstChild(); node.isValid(); node = node.next()) {
+                roots.push_back(node.asUint());
+            }
+        }
+        else {
+            std::vector<bool> isChild(nodes.size(), false);
+            for (JsonDocument::Value node = nodes.firstChild(); node.isValid(); node = node.next()) {
+                for (JsonDocument::Value child = node["children"].firstChild(); child.isValid(); child = child.next()) {
+                    if (child.asUint() < isChild.size()) {
+                        isChild[child.asUint()] = true;
+                    }
+                }
+            }
+            for (uint32_t i = 0; i < isChild.size(); ++i) {
+                if (!isChild[i]) {
+                    roots.push_back(i);
+                }
+            }
+        }
+
+        std::vector<JsonDocument::Value> nodeValues;
+        nodeValues.reserve(nodes.size());
+        for (JsonDocument::Value node = nodes.firstChild(); node.isValid(); node = node.next()) {
+            nodeValues.push_back(node);
+        }
+
+        std::vector<std::pair<uint32_t, glm::mat4>> stack;
+        for (uint32_t rootNode : roots) {
+            stack.emplace_back(rootNode, glm::mat4{ 1.0f });
+        }
+        // A valid glTF is a forest, the visit limit only protects against cycles.
+        size_t visits = 0;
+        while (!stack.empty() && visits++ <= nodeValues.size()) {
+            std::pair<uint32_t, glm::mat4> entry = stack.back();
+            stack.pop_back();
+            if (entry.first >= nodeValues.size()) {
+                continue;
+            }
+
+            JsonDocument::Value node = nodeValues[entry.first];
+            glm::mat4 world = entry.second * localTransform(node);
+            JsonDocument::Value mesh = node["mesh"];
+            if (mesh.isValid() && mesh.asUint() < meshes.size()) {
+                PackedInstance instance{};
+                instance.world = world;
+                instance.mesh = mesh.asUint();
+                instances.push_back(instance);
+            }
+            for (JsonDocument::Value child = node["children"].firstChild(); child.isValid(); child = child.next()) {
+                stack.emplace_back(child.asUint(), world);
+            }
+        }
+
+        // Materials reference images directly, and decide how each is encoded.
+        std::vector<int32_t> textureSources;
+        for (JsonDocument::Value texture = root["textures"].firstChild(); texture.isValid(); texture = texture.next()) {
+            textureSources.push_back(int32_t(texture["source"].asNumber(-1.0)));
+        }
+        const uint32_t imageCount = root["images"].size();
+        std::vector<ImageUse> imageUses(imageCount, ImageUse::eUnused);
+        auto useImage = [&](JsonDocument::Value textureInfo, ImageUse use) {
+            uint32_t texture = textureInfo["index"].asUint(UINT32_MAX);
+            int32_t image = texture < textureSources.size() ? textureSources[texture] : -1;
+            if (image < 0 || uint32_t(image) >= imageCount) {
+                return -1;
+            }
+            // Color wins over normal over data, when an image is used as several.
+            if (imageUses[image] == ImageUse::eUnused || int(use) < int(imageUses[image])) {
+                imageUses[image] = use;
+            }
+            return image;
+        };
+
+        std::vector<PackedMaterial> materials;
+        for (JsonDocument::Value material = root["materials"].firstChild(); material.isValid(); material = material.next()) {
+            JsonDocument::Value pbr = material["pbrMetallicRoughness"];
+            JsonDocument::Value factor = pbr["baseColorFactor"];
+
+            PackedMaterial packed{};
+            packed.baseColorFactor = glm::vec4{
+                float(factor[0u].asNumber(1.0)),
+                float(factor[1u].asNumber(1.0)),
+                float(factor[2u].asNumber(1.0)),
+                float(factor[3u].asNumber(1.0)),
+            };
+            packed.metallicFactor = float(pbr["metallicFactor"].asNumber(1.0));
+            packed.roughnessFactor = float(pbr["roughnessFactor"].asNumber(1.0));
+            packed.baseColorTexture = useImage(pbr["baseColorTexture"], ImageUse::eColor);
+            packed.metallicRoughnessTexture = useImage(pbr["metallicRoughnessTexture"], ImageUse::eData);
+            packed.normalTexture = useImage(material["normalTexture"], ImageUse::eNormal);
+            // Packages have no emissive slot, but the image is still cooked and
+            // should be sRGB like the loader creates it.
+            useImage(material["emissiveTexture"], ImageUse::eColor);
+            materials.push_back(packed);
+        }
+
+        std::vector<ByteRange> encodedImages(imageCount);
+        std::vector<std::string> imagePaths(imageCount);
+        uint32_t imageIndex = 0;
+        for (JsonDocument::Value image = root["images"].firstChild(); image.isValid(); image = image.next(), ++imageIndex) {
+            JsonDocument::Value view = image["bufferView"];
+            if (view.isValid() && view.asUint() < source.views.size()) {
+                const BufferView& imageView = source.views[view.asUint()];
+                encodedImages[imageIndex] = ByteRange{ source.buffers[imageView.buffer].data + imageView.offset, imageView.length };
+            }
+            else if (image["uri"].isValid()) {
+                std::string uri = image["uri"].asString();
+                imagePaths[imageIndex] = isDataUri(uri) ? uri : source.directory + uri;
+            }
+        }
+        stats.parseMs = millisecondsSince(start);
+
+        // Every primitive and image is a job; images split their blocks into
+        // more jobs, so one huge texture doesn't leave the other cores idle.
+        start = std::chrono::steady_clock::now();
+        std::vector<CookedPrimitive> cookedPrimitives(primitives.size());
+        std::vector<CookedTexture> cookedTextures(imageCount);
+        std::vector<uint64_t> externalImageBytes(imageCount, 0);
+        // A job must not throw, so primitive errors are kept until every job
+        // that references these locals has finished.
+        std::vector<std::exception_ptr> primitiveErrors(primitives.size());
+        JobCounter counter;
+        jobs.parallelFor(uint32_t(primitives.size()), 1, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; ++i) {
+                try {
+                    cookedPrimitives[i] = cookPrimitive(source, primitives[i], options);
+                }
+                catch (...) {
+                    primitiveErrors[i] = std::current_exception();
+                }
+            }
+        }, counter);
+        jobs.parallelFor(imageCount, 1, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; ++i) {
+                try {
+                    MappedFile externalFile;
+                    std::vector<uint8_t> embedded;
+                    ByteRange encoded = encodedImages[i];
+                    if (isDataUri(imagePaths[i])) {
+                        embedded = decodeDataUri(imagePaths[i]);
+                        encoded = ByteRange{ embedded.data(), embedded.size() };
+                    }
+                    else if (!imagePaths[i].empty()) {
+                        externalFile = MappedFile{ imagePaths[i] };
+                        encoded = ByteRange{ externalFile.data(), externalFile.size() };
+                        externalImageBytes[i] = externalFile.size();
+                    }
+                    cookedTextures[i] = cookTexture(encoded, imageUses[i], options, jobs);
+                }
+                catch (const std::exception& e) {
+                    cookedTextures[i] = CookedTexture{};
+                    std::string message = "Skipping image ";
+                    debugLog(message.append(std::to_string(i)).append(" of ").append(sourcePath).append(": ").append(e.what()).c_str());
+                }
+            }
+        }, counter);
+        jobs.wait(counter);
+        for (const std::exception_ptr& error : primitiveErrors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        // Lay the blobs out and point the records at them.
+        std::vector<PackedPrimitive> primitiveRecords;
+        std::vector<PackedMeshlet> meshlets;
+        uint64_t geometrySize = 0;
+        for (const CookedPrimitive& cooked : cookedPrimitives) {
+            geometrySize = alignUp(geometrySize, kStreamAlignment) + cooked.geometry.size();
+        }
+        std::vector<uint8_t> geometry;
+        geometry.reserve(size_t(geometrySize));
+        for (CookedPrimitive& cooked : cookedPrimitives) {
+            uint64_t base = alignUp(geometry.size(), kStreamAlignment);
+            geometry.resize(size_t(base));
+            geometry.insert(geometry.end(), cooked.geometry.begin(), cooked.geometry.end());
+            std::vector<uint8_t>().swap(cooked.geometry);
+
+            PackedPrimitive record = cooked.record;
+            record.indexOffset += base;
+            record.positionOffset += base;
+            record.normalOffset = record.hasNormals() ? record.normalOffset + base : PackedPrimitive::kNoStream;
+            record.texcoordOffset = record.hasTexcoords() ? record.texcoordOffset + base : PackedPrimitive::kNoStream;
+            record.firstMeshlet = uint32_t(meshlets.size());
+            meshlets.insert(meshlets.end(), cooked.meshlets.begin(), cooked.meshlets.end());
+            primitiveRecords.push_back(record);
+        }
+
+        std::vector<PackedTexture> textureRecords;
+        std::vector<uint8_t> textureData;
+        for (uint32_t i = 0; i < imageCount; ++i) {
+            CookedTexture& cooked = cookedTextures[i];
+            PackedTexture record = cooked.record;
+            if (record.levelCount == 0) {
+                ++stats.texturesFailed;
+            }
+            record.dataOffset = alignUp(textureData.size(), kStreamAlignment);
+            textureData.resize(size_t(record.dataOffset));
+            textureData.insert(textureData.end(), cooked.data.begin(), cooked.data.end());
+            std::vector<uint8_t>().swap(cooked.data);
+            textureRecords.push_back(record);
+            stats.sourceBytes += externalImageBytes[i];
+        }
+        stats.processMs = millisecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        std::string tempPath = packagePath + ".tmp";
+        {
+            std::ofstream file{ tempPath, std::ios::binary | std::ios::trunc };
+            PackageHeader header{};
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+            std::vector<PackageTocEntry> toc;
+            writeTable(file, toc, PackageChunk::eMeshes, meshes);
+            writeTable(file, toc, PackageChunk::ePrimitives, primitiveRecords);
+            writeTable(file, toc, PackageChunk::eMeshlets, meshlets);
+            writeTable(file, toc, PackageChunk::eInstances, instances);
+            writeTable(file, toc, PackageChunk::eMaterials, materials);
+            writeTable(file, toc, PackageChunk::eTextures, textureRecords);
+            writeChunk(file, toc, PackageChunk::eGeometry, 0, geometry.data(), geometry.size());
+            writeChunk(file, toc, PackageChunk::eTextureData, 0, textureData.data(), textureData.size());
+
+            header.tocOffset = alignUp(uint64_t(file.tellp()), 8);
+            static const char padding[8] = {};
+            file.write(padding, std::streamsize(header.tocOffset - uint64_t(file.tellp())));
+            file.write(reinterpret_cast<const char*>(toc.data()), std::streamsize(toc.size() * sizeof(PackageTocEntry)));
+            header.tocCount = uint32_t(toc.size());
+            header.fileSize = uint64_t(file.tellp());
+            file.seekp(0);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            if (!file) {
+                throw std::runtime_error("Failed to write " + tempPath);
+            }
+            stats.packageBytes = header.fileSize;
+        }
+        std::remove(packagePath.c_str());
+        if (std::rename(tempPath.c_str(), packagePath.c_str()) != 0) {
+            throw std::runtime_error("Failed to replace " + packagePath);
+        }
+        stats.writeMs = millisecondsSince(start);
+
+        stats.geometryBytes = geometry.size();
+        stats.textureBytes = textureData.size();
+        stats.meshes = uint32_t(meshes.size());
+        stats.primitives = uint32_t(primitiveRecords.size());
+        stats.meshlets = uint32_t(meshlets.size());
+        stats.instances = uint32_t(instances.size());
+        stats.textures = imageCount;
+        return stats;
+    }
+}
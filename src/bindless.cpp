@@ -0,0 +1,164 @@
+#include "bindless.h"
+#include "renderer.h"
+
+#include <stdexcept>
+#include <string>
+
+namespace bvr
+{
+    namespace
+    {
+        const char* s_arrayNames[] = { "texture", "buffer", "sampler" };
+    }
+
+    BindlessTable::BindlessTable(Renderer& renderer, const BindlessConfig& config) :
+        m_renderer(renderer),
+        m_device(renderer.getDevice()),
+        m_slots(std::make_shared<SlotState>())
+    {
+        m_slots->arrays[kBindlessTextureBinding].capacity = config.maxTextures;
+        m_slots->arrays[kBindlessBufferBinding].capacity = config.maxBuffers;
+        m_slots->arrays[kBindlessSamplerBinding].capacity = config.maxSamplers;
+
+        const vk::ShaderStageFlags stages = vk::ShaderStageFlagBits::eAll;
+        std::array<vk::DescriptorSetLayoutBinding, 3> bindings{
+            vk::DescriptorSetLayoutBinding{ kBindlessTextureBinding, vk::DescriptorType::eSampledImage, config.maxTextures, stages },
+            vk::DescriptorSetLayoutBinding{ kBindlessBufferBinding, vk::DescriptorType::eStorageBuffer, config.maxBuffers, stages },
+            vk::DescriptorSetLayoutBinding{ kBindlessSamplerBinding, vk::DescriptorType::eSampler, config.maxSamplers, stages },
+        };
+        // Slots that no shader reads may hold anything, or nothing, and may be
+        // written while frames using the set are in flight.
+        const vk::DescriptorBindingFlags bindingFlags = vk::DescriptorBindingFlagBits::ePartiallyBound |
+            vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+            vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+        std::array<vk::DescriptorBindingFlags, 3> flags{ bindingFlags, bindingFlags, bindingFlags };
+
+        vk::DescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{ uint32_t(flags.size()), flags.data() };
+        vk::DescriptorSetLayoutCreateInfo layoutInfo{
+            vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool,
+            uint32_t(bindings.size()),
+            bindings.data(),
+        };
+        layoutInfo.pNext = &flagsInfo;
+        m_setLayout = m_device.createDescriptorSetLayout(layoutInfo);
+
+        std::array<vk::DescriptorPoolSize, 3> poolSizes{
+            vk::DescriptorPoolSize{ vk::DescriptorType::eSampledImage, config.maxTextures },
+            vk::DescriptorPoolSize{ vk::DescriptorType::eStorageBuffer, config.maxBuffers },
+            vk::DescriptorPoolSize{ vk::DescriptorType::eSampler, config.maxSamplers },
+        };
+        m_pool = m_device.createDescriptorPool(vk::DescriptorPoolCreateInfo{
+            vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind,
+            1,
+            uint32_t(poolSizes.size()),
+            poolSizes.data(),
+        });
+        m_set = m_device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{ m_pool, 1, &m_setLayout })[0];
+    }
+
+    BindlessTable::~BindlessTable()
+    {
+        // Frees the set along with the pool.
+        m_device.destroyDescriptorPool(m_pool);
+        m_device.destroyDescriptorSetLayout(m_setLayout);
+    }
+
+    TextureHandle BindlessTable::addTexture(vk::ImageView view, vk::ImageLayout layout)
+    {
+        TextureHandle handle{ allocateSlot(kBindlessTextureBinding) };
+        vk::DescriptorImageInfo imageInfo{ vk::Sampler{}, view, layout };
+        writeDescriptor(vk::WriteDescriptorSet{ m_set, kBindlessTextureBinding, handle.index, 1, vk::DescriptorType::eSampledImage, &imageInfo });
+        return handle;
+    }
+
+    BufferHandle BindlessTable::addBuffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range)
+    {
+        BufferHandle handle{ allocateSlot(kBindlessBufferBinding) };
+        vk::DescriptorBufferInfo bufferInfo{ buffer, offset, range };
+        writeDescriptor(vk::WriteDescriptorSet{ m_set, kBindlessBufferBinding, handle.index, 1, vk::DescriptorType::eStorageBuffer, nullptr, &bufferInfo });
+        return handle;
+    }
+
+    SamplerHandle BindlessTable::addSampler(vk::Sampler sampler)
+    {
+        SamplerHandle handle{ allocateSlot(kBindlessSamplerBinding) };
+        vk::DescriptorImageInfo imageInfo{ sampler };
+        writeDescriptor(vk::WriteDescriptorSet{ m_set, kBindlessSamplerBinding, handle.index, 1, vk::DescriptorType::eSampler, &imageInfo });
+        return handle;
+    }
+
+    void BindlessTable::release(TextureHandle handle)
+    {
+        releaseSlot(kBindlessTextureBinding, handle.index);
+    }
+
+    void BindlessTable::release(BufferHandle handle)
+    {
+        releaseSlot(kBindlessBufferBinding, handle.index);
+    }
+
+    void BindlessTable::release(SamplerHandle handle)
+    {
+        releaseSlot(kBindlessSamplerBinding, handle.index);
+    }
+
+    BindlessStats BindlessTable::getStats() const
+    {
+        std::lock_guard<std::mutex> lock{ m_slots->mutex };
+        BindlessStats stats{};
+        stats.textures = m_slots->arrays[kBindlessTextureBinding].live;
+        stats.buffers = m_slots->arrays[kBindlessBufferBinding].live;
+        stats.samplers = m_slots->arrays[kBindlessSamplerBinding].live;
+        stats.pendingReleases = m_slots->pendingReleases;
+        return stats;
+    }
+
+    uint32_t BindlessTable::allocateSlot(uint32_t binding)
+    {
+        std::lock_guard<std::mutex> lock{ m_slots->mutex };
+        SlotArray& slots = m_slots->arrays[binding];
+
+        uint32_t index = UINT32_MAX;
+        if (!slots.freeList.empty()) {
+            index = slots.freeList.back();
+            slots.freeList.pop_back();
+        }
+        else if (slots.highWater < slots.capacity) {
+            index = slots.highWater++;
+        }
+        else {
+            std::string errorString{ "Bindless " };
+            throw std::runtime_error(errorString.append(s_arrayNames[binding]).append(" array is full (")
+                .append(std::to_string(slots.capacity)).append(" slots)"));
+        }
+        ++slots.live;
+        return index;
+    }
+
+    void BindlessTable::releaseSlot(uint32_t binding, uint32_t index)
+    {
+        if (index == UINT32_MAX) {
+            return;
+        }
+
+        std::shared_ptr<SlotState> state = m_slots;
+        {
+            std::lock_guard<std::mutex> lock{ state->mutex };
+            --state->arrays[binding].live;
+            ++state->pendingReleases;
+        }
+        // Frames recorded so far may still read the slot, so it only becomes
+        // reusable once they have retired.
+        m_renderer.deferRelease([state, binding, index]() {
+            std::lock_guard<std::mutex> lock{ state->mutex };
+            state->arrays[binding].freeList.push_back(index);
+            --state->pendingReleases;
+        });
+    }
+
+    void BindlessTable::writeDescriptor(const vk::WriteDescriptorSet& write)
+    {
+        std::lock_guard<std::mutex> lock{ m_writeMutex };
+        m_device.updateDescriptorSets(write, nullptr);
+    }
+}
@@ -0,0 +1,503 @@
+#include "clustered_lighting.h"
+#include "renderer.h"
+
+#include <vma/vk_mem_alloc.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVR_CLUSTER_SSE2 1
+#endif
+
+namespace bvr
+{
+    namespace
+    {
+        // Matches AssignParams in shaders/cluster_assign.comp.
+        struct AssignParams
+        {
+            glm::mat4 view;
+            uint32_t clusterCount;
+            uint32_t lightCount;
+            uint32_t indexCapacity;
+            uint32_t padding;
+        };
+
+        // Lights per job when moving them to view space.
+        const uint32_t kTransformGrainSize = 4096;
+
+        bool sphereIntersectsAabb(const glm::vec3& center, float radius, const ClusterBounds& bounds)
+        {
+            glm::vec3 closest = glm::clamp(center, glm::vec3(bounds.minPoint), glm::vec3(bounds.maxPoint)) - center;
+            return glm::dot(closest, closest) <= radius * radius;
+        }
+
+        // Same test as the shader: the cone against the cluster's bounding sphere.
+        bool coneIntersectsCluster(const glm::vec3& position, float range, const glm::vec4& cone, const ClusterBounds& bounds)
+        {
+            glm::vec3 boundsMin{ bounds.minPoint };
+            glm::vec3 boundsMax{ bounds.maxPoint };
+            glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+            float radius = glm::length(boundsMax - boundsMin) * 0.5f;
+            glm::vec3 v = center - position;
+            float alongAxis = glm::dot(v, glm::vec3(cone));
+            float sinAngle = std::sqrt(std::max(1.0f - cone.w * cone.w, 0.0f));
+            float closestDistance = cone.w * std::sqrt(std::max(glm::dot(v, v) - alongAxis * alongAxis, 0.0f)) - alongAxis * sinAngle;
+            return closestDistance <= radius && alongAxis <= radius + range && alongAxis >= -radius;
+        }
+
+        // Where the ray through `ndc` on the near plane crosses view depth `depth`.
+        glm::vec3 unprojectAtDepth(const glm::mat4& inverseProjection, const glm::vec2& ndc, float depth)
+        {
+            glm::vec4 nearPoint = inverseProjection * glm::vec4(ndc, 0.0f, 1.0f);
+            glm::vec3 ray = glm::vec3(nearPoint) / nearPoint.w;
+            return ray * (depth / -ray.z);
+        }
+
+        vk::DescriptorSet allocateSet(vk::Device device, vk::DescriptorPool pool, vk::DescriptorSetLayout layout)
+        {
+            return device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{ pool, 1, &layout })[0];
+        }
+    }
+
+    Light makePointLight(const glm::vec3& position, float range, const glm::vec3& color, float intensity)
+    {
+        Light light{};
+        light.positionRange = glm::vec4(position, range);
+        light.colorIntensity = glm::vec4(color, intensity);
+        light.directionCosAngle = glm::vec4(0.0f, 0.0f, -1.0f, -1.0f);
+        return light;
+    }
+
+    Light makeSpotLight(const glm::vec3& position, float range, const glm::vec3& direction, float outerAngle, const glm::vec3& color, float intensity)
+    {
+        Light light{};
+        light.positionRange = glm::vec4(position, range);
+        light.colorIntensity = glm::vec4(color, intensity);
+        light.directionCosAngle = glm::vec4(glm::normalize(direction), std::cos(std::min(outerAngle, 1.5f)));
+        return light;
+    }
+
+    std::vector<ClusterBounds> buildClusterGrid(const ClusterGridConfig& config, const glm::mat4& projection)
+    {
+        glm::mat4 inverseProjection = glm::inverse(projection);
+        std::vector<ClusterBounds> clusters;
+        clusters.reserve(size_t(config.tilesX) * config.tilesY * config.slices);
+
+        for (uint32_t z = 0; z < config.slices; ++z) {
+            float sliceNear = config.nearZ * std::pow(config.farZ / config.nearZ, float(z) / float(config.slices));
+            float sliceFar = config.nearZ * std::pow(config.farZ / config.nearZ, float(z + 1) / float(config.slices));
+            for (uint32_t y = 0; y < config.tilesY; ++y) {
+                for (uint32_t x = 0; x < config.tilesX; ++x) {
+                    glm::vec2 ndcMin{ -1.0f + 2.0f * float(x) / float(config.tilesX), -1.0f + 2.0f * float(y) / float(config.tilesY) };
+                    glm::vec2 ndcMax{ -1.0f + 2.0f * float(x + 1) / float(config.tilesX), -1.0f + 2.0f * float(y + 1) / float(config.tilesY) };
+
+                    glm::vec3 boundsMin{ std::numeric_limits<float>::max() };
+                    glm::vec3 boundsMax{ -std::numeric_limits<float>::max() };
+                    for (int corner = 0; corner < 4; ++corner) {
+                        glm::vec2 ndc{ (corner & 1) ? ndcMax.x : ndcMin.x, (corner & 2) ? ndcMax.y : ndcMin.y };
+                        for (float depth : { sliceNear, sliceFar }) {
+                            glm::vec3 point = unprojectAtDepth(inverseProjection, ndc, depth);
+                            boundsMin = glm::min(boundsMin, point);
+                            boundsMax = glm::max(boundsMax, point);
+                        }
+                    }
+                    clusters.push_back(ClusterBounds{ glm::vec4(boundsMin, 0.0f), glm::vec4(boundsMax, 0.0f) });
+                }
+            }
+        }
+        return clusters;
+    }
+
+    void ClusteredLighting::ViewLights::resize(size_t count)
+    {
+        x.resize(count);
+        y.resize(count);
+        z.resize(count);
+        radius.resize(count);
+        spotCones.resize(count);
+    }
+
+    ClusteredLighting::ClusteredLighting(Renderer& renderer, const ClusterGridConfig& config) :
+        m_renderer(renderer),
+        m_config(config)
+    {
+        if (config.tilesX == 0 || config.tilesY == 0 || config.slices == 0 || config.nearZ <= 0.0f || config.farZ <= config.nearZ) {
+            throw std::runtime_error("Invalid cluster grid configuration");
+        }
+        m_clusterCount = config.tilesX * config.tilesY * config.slices;
+        m_stats.clusters = m_clusterCount;
+        m_slices.resize(config.slices);
+
+        createPipeline();
+
+        m_slots.resize(m_renderer.getFrameCount());
+        for (SlotBuffers& slot : m_slots) {
+            slot.counterReadback = m_renderer.getMemory().createBuffer(
+                vk::BufferCreateInfo{ vk::BufferCreateFlags{}, sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferDst },
+                MemoryUsage::eReadback
+            );
+        }
+    }
+
+    ClusteredLighting::~ClusteredLighting()
+    {
+        GpuMemory& memory = m_renderer.getMemory();
+        std::vector<SlotBuffers> slots = std::move(m_slots);
+        // The pipeline and its layouts belong to the pipeline cache.
+        m_renderer.deferRelease([&memory, slots]() mutable {
+            for (SlotBuffers& slot : slots) {
+                memory.destroyBuffer(slot.counterReadback);
+                memory.destroyBuffer(slot.cpuRanges);
+                memory.destroyBuffer(slot.cpuIndices);
+            }
+        });
+    }
+
+    void ClusteredLighting::createPipeline()
+    {
+        PipelineCache& pipelines = m_renderer.getPipelines();
+
+        using Type = vk::DescriptorType;
+        const vk::ShaderStageFlags compute = vk::ShaderStageFlagBits::eCompute;
+        std::array<vk::DescriptorSetLayoutBinding, 6> bindings{
+            vk::DescriptorSetLayoutBinding{ 0, Type::eUniformBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 1, Type::eStorageBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 2, Type::eStorageBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 3, Type::eStorageBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 4, Type::eStorageBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 5, Type::eStorageBuffer, 1, compute },
+        };
+        m_setLayout = pipelines.getDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{
+            vk::DescriptorSetLayoutCreateFlags{}, uint32_t(bindings.size()), bindings.data() });
+        m_pipelineLayout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+            vk::PipelineLayoutCreateFlags{}, 1, &m_setLayout, 0, nullptr });
+        m_pipeline = pipelines.getComputePipeline(vk::ComputePipelineCreateInfo{
+            vk::PipelineCreateFlags{},
+            vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eCompute, m_renderer.createEmbeddedShaderModule("cluster_assign.comp"), "main" },
+            m_pipelineLayout,
+        });
+    }
+
+    void ClusteredLighting::updateGrid(const glm::mat4& projection)
+    {
+        if (projection == m_projection && !m_clusters.empty()) {
+            return;
+        }
+        m_projection = projection;
+        m_clusters = buildClusterGrid(m_config, projection);
+    }
+
+    const ClusterLightLists& ClusteredLighting::assignLightsCpu(const glm::mat4& view, const glm::mat4& projection, const std::vector<Light>& lights)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        updateGrid(projection);
+
+        JobSystem& jobs = m_renderer.getJobSystem();
+        uint32_t lightCount = uint32_t(lights.size());
+        m_viewLights.resize(lightCount);
+
+        JobCounter transformCounter;
+        jobs.parallelFor(lightCount, kTransformGrainSize, [this, &view, &lights](uint32_t begin, uint32_t end) {
+            glm::mat3 rotation{ view };
+            for (uint32_t i = begin; i < end; ++i) {
+                const Light& light = lights[i];
+                glm::vec3 position = glm::vec3(view * glm::vec4(glm::vec3(light.positionRange), 1.0f));
+                m_viewLights.x[i] = position.x;
+                m_viewLights.y[i] = position.y;
+                m_viewLights.z[i] = position.z;
+                m_viewLights.radius[i] = light.positionRange.w;
+                m_viewLights.spotCones[i] = glm::vec4(rotation * glm::vec3(light.directionCosAngle), light.directionCosAngle.w);
+            }
+        }, transformCounter);
+        jobs.wait(transformCounter);
+
+        JobCounter sliceCounter;
+        jobs.parallelFor(m_config.slices, 1, [this](uint32_t begin, uint32_t end) {
+            for (uint32_t slice = begin; slice < end; ++slice) {
+                assignSlice(slice);
+            }
+        }, sliceCounter);
+        jobs.wait(sliceCounter);
+
+        // Concatenate the slices in cluster order, clamped like the GPU's list.
+        m_cpuLists.ranges.resize(m_clusterCount);
+        m_cpuLists.indices.clear();
+        uint32_t clustersPerSlice = m_config.tilesX * m_config.tilesY;
+        uint64_t wanted = 0;
+        for (uint32_t slice = 0; slice < m_config.slices; ++slice) {
+            const SliceLists& lists = m_slices[slice];
+            for (uint32_t i = 0; i < clustersPerSlice; ++i) {
+                glm::uvec2 range = lists.ranges[i];
+                uint32_t offset = uint32_t(m_cpuLists.indices.size());
+                uint32_t count = std::min(range.y, m_config.maxLightIndices - offset);
+                m_cpuLists.ranges[slice * clustersPerSlice + i] = glm::uvec2(offset, count);
+                m_cpuLists.indices.insert(m_cpuLists.indices.end(), lists.indices.begin() + range.x, lists.indices.begin() + range.x + count);
+                wanted += range.y;
+            }
+        }
+
+        m_stats.lights = lightCount;
+        m_stats.cpuIndexCount = uint32_t(m_cpuLists.indices.size());
+        m_stats.overflowed = wanted > m_config.maxLightIndices;
+        m_stats.cpuAssignMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return m_cpuLists;
+    }
+
+    void ClusteredLighting::assignSlice(uint32_t slice)
+    {
+        SliceLists& lists = m_slices[slice];
+        lists.candidates.clear();
+        lists.indices.clear();
+
+        uint32_t clustersPerSlice = m_config.tilesX * m_config.tilesY;
+        uint32_t firstCluster = slice * clustersPerSlice;
+        // Every cluster of a slice covers the same view depths.
+        float sliceMinZ = m_clusters[firstCluster].minPoint.z;
+        float sliceMaxZ = m_clusters[firstCluster].maxPoint.z;
+
+        // Lights overlapping the slice's depth range, the only ones worth testing
+        // against its clusters.
+        const ViewLights& lights = m_viewLights;
+        uint32_t lightCount = uint32_t(lights.x.size());
+        uint32_t i = 0;
+        lists.candidates.resize(lightCount);
+        uint32_t candidateCount = 0;
+#ifdef BVR_CLUSTER_SSE2
+        __m128 minZ = _mm_set1_ps(sliceMinZ);
+        __m128 maxZ = _mm_set1_ps(sliceMaxZ);
+        for (; i + 4 <= lightCount; i += 4) {
+            __m128 z = _mm_loadu_ps(&lights.z[i]);
+            __m128 radius = _mm_loadu_ps(&lights.radius[i]);
+            __m128 overlaps = _mm_and_ps(
+                _mm_cmple_ps(_mm_sub_ps(z, radius), maxZ),
+                _mm_cmpge_ps(_mm_add_ps(z, radius), minZ)
+            );
+            uint32_t mask = uint32_t(_mm_movemask_ps(overlaps));
+            for (uint32_t lane = 0; lane < 4; ++lane) {
+                lists.candidates[candidateCount] = i + lane;
+                candidateCount += (mask >> lane) & 1;
+            }
+        }
+#endif
+        for (; i < lightCount; ++i) {
+            if (lights.z[i] - lights.radius[i] <= sliceMaxZ && lights.z[i] + lights.radius[i] >= sliceMinZ) {
+                lists.candidates[candidateCount++] = i;
+            }
+        }
+        lists.candidates.resize(candidateCount);
+
+        // Gather the candidates so the per-cluster loop streams through them.
+        ViewLights& candidates = lists.candidateLights;
+        candidates.resize(candidateCount);
+        for (uint32_t c = 0; c < candidateCount; ++c) {
+            uint32_t light = lists.candidates[c];
+            candidates.x[c] = lights.x[light];
+            candidates.y[c] = lights.y[light];
+            candidates.z[c] = lights.z[light];
+            candidates.radius[c] = lights.radius[light];
+            candidates.spotCones[c] = lights.spotCones[light];
+        }
+
+        lists.ranges.resize(clustersPerSlice);
+        for (uint32_t cluster = 0; cluster < clustersPerSlice; ++cluster) {
+            const ClusterBounds& bounds = m_clusters[firstCluster + cluster];
+            uint32_t offset = uint32_t(lists.indices.size());
+
+            auto addIfHit = [&](uint32_t c) {
+                const glm::vec4& cone = candidates.spotCones[c];
+                if (cone.w > -1.0f) {
+                    glm::vec3 position{ candidates.x[c], candidates.y[c], candidates.z[c] };
+                    if (!coneIntersectsCluster(position, candidates.radius[c], cone, bounds)) {
+                        return;
+                    }
+                }
+                lists.indices.push_back(lists.candidates[c]);
+            };
+
+            uint32_t c = 0;
+#ifdef BVR_CLUSTER_SSE2
+            __m128 boundsMinX = _mm_set1_ps(bounds.minPoint.x);
+            __m128 boundsMinY = _mm_set1_ps(bounds.minPoint.y);
+            __m128 boundsMinZ = _mm_set1_ps(bounds.minPoint.z);
+            __m128 boundsMaxX = _mm_set1_ps(bounds.maxPoint.x);
+            __m128 boundsMaxY = _mm_set1_ps(bounds.maxPoint.y);
+            __m128 boundsMaxZ = _mm_set1_ps(bounds.maxPoint.z);
+            for (; c + 4 <= candidateCount; c += 4) {
+                __m128 x = _mm_loadu_ps(&candidates.x[c]);
+                __m128 y = _mm_loadu_ps(&candidates.y[c]);
+                __m128 z = _mm_loadu_ps(&candidates.z[c]);
+                __m128 radius = _mm_loadu_ps(&candidates.radius[c]);
+                __m128 dx = _mm_sub_ps(_mm_min_ps(_mm_max_ps(x, boundsMinX), boundsMaxX), x);
+                __m128 dy = _mm_sub_ps(_mm_min_ps(_mm_max_ps(y, boundsMinY), boundsMaxY), y);
+                __m128 dz = _mm_sub_ps(_mm_min_ps(_mm_max_ps(z, boundsMinZ), boundsMaxZ), z);
+                __m128 distanceSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                uint32_t mask = uint32_t(_mm_movemask_ps(_mm_cmple_ps(distanceSq, _mm_mul_ps(radius, radius))));
+                for (uint32_t lane = 0; mask != 0; ++lane, mask >>= 1) {
+                    if (mask & 1) {
+                        addIfHit(c + lane);
+                    }
+                }
+            }
+#endif
+            for (; c < candidateCount; ++c) {
+                glm::vec3 position{ candidates.x[c], candidates.y[c], candidates.z[c] };
+                if (sphereIntersectsAabb(position, candidates.radius[c], bounds)) {
+                    addIfHit(c);
+                }
+            }
+
+            lists.ranges[cluster] = glm::uvec2(offset, uint32_t(lists.indices.size()) - offset);
+        }
+    }
+
+    ClusterResources ClusteredLighting::addPasses(
+        RenderGraph& graph,
+        FrameContext& frame,
+        const glm::mat4& view,
+        const glm::mat4& projection,
+        const std::vector<Light>& lights,
+        ClusterCullMode mode)
+    {
+        SlotBuffers& slot = m_slots[frame.frameIndex % m_renderer.getFrameCount()];
+        readBackCounter(slot);
+
+        if (mode == ClusterCullMode::eGpu) {
+            updateGrid(projection);
+            return addGpuPasses(graph, frame, slot, view, lights);
+        }
+        return addCpuPasses(graph, slot, view, projection, lights);
+    }
+
+    ClusterResources ClusteredLighting::addGpuPasses(RenderGraph& graph, FrameContext& frame, SlotBuffers& slot, const glm::mat4& view, const std::vector<Light>& lights)
+    {
+        // Lights and clusters are written by the host before the frame is
+        // submitted, so they live in the frame ring instead of the graph.
+        FrameRingAllocator& ring = m_renderer.getMemory().getFrameRing();
+        vk::DeviceSize lightBytes = std::max<vk::DeviceSize>(lights.size() * sizeof(Light), sizeof(Light));
+        vk::DeviceSize clusterBytes = m_clusterCount * sizeof(ClusterBounds);
+        RingAllocation params = ring.allocate(sizeof(AssignParams));
+        RingAllocation lightData = ring.allocate(lightBytes);
+        RingAllocation clusterData = ring.allocate(clusterBytes);
+        if (!params.buffer || !lightData.buffer || !clusterData.buffer) {
+            throw std::runtime_error("Frame ring exhausted by the light clusters");
+        }
+
+        AssignParams assignParams{};
+        assignParams.view = view;
+        assignParams.clusterCount = m_clusterCount;
+        assignParams.lightCount = uint32_t(lights.size());
+        assignParams.indexCapacity = m_config.maxLightIndices;
+        memcpy(params.mapped, &assignParams, sizeof(assignParams));
+        memcpy(lightData.mapped, lights.data(), lights.size() * sizeof(Light));
+        memcpy(clusterData.mapped, m_clusters.data(), clusterBytes);
+        m_stats.lights = uint32_t(lights.size());
+
+        ClusterResources resources{};
+        resources.ranges = graph.createBuffer("cluster_ranges", m_clusterCount * sizeof(glm::uvec2));
+        resources.indices = graph.createBuffer("cluster_light_indices", vk::DeviceSize(m_config.maxLightIndices) * sizeof(uint32_t));
+        GraphResource counter = graph.createBuffer("cluster_light_counter", sizeof(uint32_t));
+
+        graph.addPass("clear_light_counter", GraphPassType::eTransfer)
+            .write(counter, GraphAccess::eTransferWrite)
+            .record([counter](RenderGraphContext& context) {
+                context.getCommandBuffer().fillBuffer(context.getBuffer(counter), 0, sizeof(uint32_t), 0);
+            });
+
+        vk::Device device = m_renderer.getDevice();
+        graph.addPass("cluster_lights", GraphPassType::eCompute)
+            .write(resources.ranges, GraphAccess::eStorageWriteCompute)
+            .write(resources.indices, GraphAccess::eStorageWriteCompute)
+            .write(counter, GraphAccess::eStorageWriteCompute)
+            .record([this, device, &frame, params, lightData, lightBytes, clusterData, clusterBytes, resources, counter](RenderGraphContext& context) {
+                vk::DescriptorSet set = allocateSet(device, frame.descriptorPool, m_setLayout);
+                std::array<vk::DescriptorBufferInfo, 6> buffers{
+                    vk::DescriptorBufferInfo{ params.buffer, params.offset, sizeof(AssignParams) },
+                    vk::DescriptorBufferInfo{ lightData.buffer, lightData.offset, lightBytes },
+                    vk::DescriptorBufferInfo{ clusterData.buffer, clusterData.offset, clusterBytes },
+                    vk::DescriptorBufferInfo{ context.getBuffer(resources.ranges), 0, VK_WHOLE_SIZE },
+                    vk::DescriptorBufferInfo{ context.getBuffer(resources.indices), 0, VK_WHOLE_SIZE },
+                    vk::DescriptorBufferInfo{ context.getBuffer(counter), 0, VK_WHOLE_SIZE },
+                };
+                std::array<vk::WriteDescriptorSet, 2> writes{
+                    vk::WriteDescriptorSet{ set, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &buffers[0] },
+                    vk::WriteDescriptorSet{ set, 1, 0, 5, vk::DescriptorType::eStorageBuffer, nullptr, &buffers[1] },
+                };
+                device.updateDescriptorSets(writes, nullptr);
+
+                vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_pipelineLayout, 0, set, nullptr);
+                commandBuffer.dispatch((m_clusterCount + 63) / 64, 1, 1);
+            });
+
+        vk::Buffer readback = slot.counterReadback.buffer;
+        graph.addPass("light_counter_readback", GraphPassType::eTransfer)
+            .read(counter, GraphAccess::eTransferRead)
+            .sideEffect()
+            .record([counter, readback](RenderGraphContext& context) {
+                vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                commandBuffer.copyBuffer(context.getBuffer(counter), readback, vk::BufferCopy{ 0, 0, sizeof(uint32_t) });
+                commandBuffer.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eTransfer,
+                    vk::PipelineStageFlagBits::eHost,
+                    vk::DependencyFlags{},
+                    vk::MemoryBarrier{ vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead },
+                    nullptr,
+                    nullptr
+                );
+            });
+        slot.counterPending = true;
+
+        return resources;
+    }
+
+    ClusterResources ClusteredLighting::addCpuPasses(RenderGraph& graph, SlotBuffers& slot, const glm::mat4& view, const glm::mat4& projection, const std::vector<Light>& lights)
+    {
+        const ClusterLightLists& lists = assignLightsCpu(view, projection, lights);
+
+        GpuMemory& memory = m_renderer.getMemory();
+        if (!slot.cpuRanges.buffer) {
+            slot.cpuRanges = memory.createBuffer(vk::BufferCreateInfo{
+                vk::BufferCreateFlags{},
+                m_clusterCount * sizeof(glm::uvec2),
+                vk::BufferUsageFlagBits::eStorageBuffer,
+            }, MemoryUsage::eUpload);
+            slot.cpuIndices = memory.createBuffer(vk::BufferCreateInfo{
+                vk::BufferCreateFlags{},
+                vk::DeviceSize(m_config.maxLightIndices) * sizeof(uint32_t),
+                vk::BufferUsageFlagBits::eStorageBuffer,
+            }, MemoryUsage::eUpload);
+        }
+        memcpy(slot.cpuRanges.mapped, lists.ranges.data(), lists.ranges.size() * sizeof(glm::uvec2));
+        memcpy(slot.cpuIndices.mapped, lists.indices.data(), lists.indices.size() * sizeof(uint32_t));
+
+        // Host writes made before the submission need no barrier.
+        ClusterResources resources{};
+        resources.ranges = graph.importBuffer("cluster_ranges", slot.cpuRanges.buffer, slot.cpuRanges.size);
+        resources.indices = graph.importBuffer("cluster_light_indices", slot.cpuIndices.buffer, slot.cpuIndices.size);
+        return resources;
+    }
+
+    void ClusteredLighting::readBackCounter(SlotBuffers& slot)
+    {
+        // The renderer waited for the slot's previous frame before handing it out.
+        if (!slot.counterPending) {
+            return;
+        }
+        vmaInvalidateAllocation(m_renderer.getMemory().getAllocator(), slot.counterReadback.allocation, 0, VK_WHOLE_SIZE);
+        uint32_t count = 0;
+        memcpy(&count, slot.counterReadback.mapped, sizeof(count));
+        m_stats.gpuIndexCount = std::min(count, m_config.maxLightIndices);
+        m_stats.overflowed = count > m_config.maxLightIndices;
+        slot.counterPending = false;
+    }
+}
@@ -0,0 +1,76 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace bvr
+{
+    namespace
+    {
+        // Weight of a new sample in the smoothed GPU time.
+        const double kSmoothing = 0.2;
+    }
+
+    DynamicResolution::DynamicResolution(const DynamicResolutionConfig& config) :
+        m_config(config)
+    {
+        m_config.minScale = std::min(std::max(m_config.minScale, 0.1f), 1.0f);
+        m_config.maxScale = std::min(std::max(m_config.maxScale, m_config.minScale), 1.0f);
+        m_config.scaleStep = std::max(m_config.scaleStep, 0.001f);
+        m_scale = m_config.maxScale;
+    }
+
+    void DynamicResolution::addSample(float renderScale, double gpuMs)
+    {
+        if (!m_config.enabled || renderScale != m_scale || gpuMs < 0.0) {
+            return;
+        }
+
+        m_smoothedMs = m_samples == 0 ? gpuMs : m_smoothedMs + (gpuMs - m_smoothedMs) * kSmoothing;
+        ++m_samples;
+
+        double budget = m_config.targetGpuMs * m_config.headroom;
+        if (m_smoothedMs <= 0.0 || budget <= 0.0) {
+            return;
+        }
+        // Down to a step, so a scale that just fits isn't rounded over budget.
+        float ideal = m_scale * float(std::sqrt(budget / m_smoothedMs));
+        float stepped = std::floor(ideal / m_config.scaleStep + 1e-3f) * m_config.scaleStep;
+        stepped = std::min(std::max(stepped, m_config.minScale), m_config.maxScale);
+
+        if (stepped < m_scale) {
+            m_framesUnderBudget = 0;
+            if (m_samples >= m_config.decreaseDelayFrames) {
+                changeScale(stepped);
+            }
+        }
+        else if (stepped > m_scale) {
+            // One step at a time: the estimate is least reliable far from the
+            // scale it was measured at.
+            if (++m_framesUnderBudget >= m_config.increaseDelayFrames) {
+                changeScale(std::min(m_scale + m_config.scaleStep, m_config.maxScale));
+            }
+        }
+        else {
+            m_framesUnderBudget = 0;
+        }
+    }
+
+    void DynamicResolution::setScale(float scale)
+    {
+        m_scale = std::min(std::max(scale, m_config.minScale), m_config.maxScale);
+        m_samples = 0;
+        m_framesUnderBudget = 0;
+    }
+
+    void DynamicResolution::changeScale(float scale)
+    {
+        // Carry the estimate over, so the first samples at the new scale are
+        // smoothed against a sensible value rather than taken as is.
+        m_smoothedMs *= double(scale * scale) / double(m_scale * m_scale);
+        m_scale = scale;
+        m_samples = 0;
+        m_framesUnderBudget = 0;
+        ++m_changes;
+    }
+}
@@ -0,0 +1,69 @@
+#include "embedded_shaders.h"
+
+#include <cstring>
+
+#include "triangle.vert.bin.h"
+#include "triangle.frag.bin.h"
+#include "instanced.vert.bin.h"
+#include "cull.comp.bin.h"
+#include "hiz.comp.bin.h"
+#include "cluster_assign.comp.bin.h"
+#include "material.vert.bin.h"
+#include "material_set.frag.bin.h"
+#include "material_bindless.frag.bin.h"
+#include "shadow.vert.bin.h"
+#include "ibl_brdf.comp.bin.h"
+#include "ibl_irradiance.comp.bin.h"
+#include "ibl_specular.comp.bin.h"
+#include "temporal_scene.vert.bin.h"
+#include "temporal_scene.frag.bin.h"
+#include "taa_resolve.comp.bin.h"
+#include "fullscreen.vert.bin.h"
+#include "motion_blur.frag.bin.h"
+
+namespace bvr
+{
+    namespace
+    {
+        struct EmbeddedShader
+        {
+            const char* name;
+            ShaderBinary binary;
+        };
+
+#define BVR_EMBEDDED_SHADER(file, symbol) { file, ShaderBinary{ symbol, sizeof(symbol) } }
+
+        const EmbeddedShader s_shaders[] = {
+            BVR_EMBEDDED_SHADER("triangle.vert", triangle_vert),
+            BVR_EMBEDDED_SHADER("triangle.frag", triangle_frag),
+            BVR_EMBEDDED_SHADER("instanced.vert", instanced_vert),
+            BVR_EMBEDDED_SHADER("cull.comp", cull_comp),
+            BVR_EMBEDDED_SHADER("hiz.comp", hiz_comp),
+            BVR_EMBEDDED_SHADER("cluster_assign.comp", cluster_assign_comp),
+            BVR_EMBEDDED_SHADER("material.vert", material_vert),
+            BVR_EMBEDDED_SHADER("material_set.frag", material_set_frag),
+            BVR_EMBEDDED_SHADER("material_bindless.frag", material_bindless_frag),
+            BVR_EMBEDDED_SHADER("shadow.vert", shadow_vert),
+            BVR_EMBEDDED_SHADER("ibl_brdf.comp", ibl_brdf_comp),
+            BVR_EMBEDDED_SHADER("ibl_irradiance.comp", ibl_irradiance_comp),
+            BVR_EMBEDDED_SHADER("ibl_specular.comp", ibl_specular_comp),
+            BVR_EMBEDDED_SHADER("temporal_scene.vert", temporal_scene_vert),
+            BVR_EMBEDDED_SHADER("temporal_scene.frag", temporal_scene_frag),
+            BVR_EMBEDDED_SHADER("taa_resolve.comp", taa_resolve_comp),
+            BVR_EMBEDDED_SHADER("fullscreen.vert", fullscreen_vert),
+            BVR_EMBEDDED_SHADER("motion_blur.frag", motion_blur_frag),
+        };
+
+#undef BVR_EMBEDDED_SHADER
+    }
+
+    ShaderBinary getEmbeddedShader(const char* name)
+    {
+        for (const EmbeddedShader& shader : s_shaders) {
+            if (strcmp(shader.name, name) == 0) {
+                return shader.binary;
+            }
+        }
+        return ShaderBinary{};
+    }
+}
@@ -0,0 +1,137 @@
+#include "file_watcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace bvr
+{
+    namespace
+    {
+        std::string getAbsolutePath(const std::filesystem::path& path)
+        {
+            std::error_code error;
+            std::filesystem::path absolute = std::filesystem::absolute(path, error);
+            return (error ? path : absolute).lexically_normal().string();
+        }
+    }
+
+#ifdef __linux__
+    FileWatcher::FileWatcher()
+    {
+        m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_fd < 0) {
+            throw std::runtime_error("Failed to initialize inotify");
+        }
+    }
+
+    FileWatcher::~FileWatcher()
+    {
+        // Closing the descriptor removes every watch.
+        close(m_fd);
+    }
+
+    void FileWatcher::addDirectory(const std::string& path)
+    {
+        // Editors either write in place or write a new file and rename it
+        // over the old one.
+        int watch = inotify_add_watch(m_fd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+        if (watch < 0) {
+            throw std::runtime_error("Failed to watch " + path);
+        }
+        m_directories[watch] = getAbsolutePath(path);
+    }
+
+    std::vector<std::string> FileWatcher::wait(uint32_t timeoutMs)
+    {
+        std::vector<std::string> changed;
+        pollfd descriptor{ m_fd, POLLIN, 0 };
+        if (poll(&descriptor, 1, int(timeoutMs)) <= 0) {
+            return changed;
+        }
+
+        alignas(inotify_event) char buffer[4096];
+        for (;;) {
+            ssize_t bytes = read(m_fd, buffer, sizeof(buffer));
+            if (bytes <= 0) {
+                // EAGAIN once every pending event has been read.
+                break;
+            }
+            for (ssize_t offset = 0; offset < bytes;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                auto directory = m_directories.find(event->wd);
+                if (event->len > 0 && directory != m_directories.end()) {
+                    changed.push_back((std::filesystem::path{ directory->second } / event->name).string());
+                }
+                offset += ssize_t(sizeof(inotify_event) + event->len);
+            }
+        }
+        return changed;
+    }
+#else
+    FileWatcher::FileWatcher()
+    { }
+
+    FileWatcher::~FileWatcher()
+    { }
+
+    void FileWatcher::addDirectory(const std::string& path)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_directory(path, error)) {
+            throw std::runtime_error("Failed to watch " + path);
+        }
+        m_directories.push_back(getAbsolutePath(path));
+
+        // Only later writes count as changes.
+        std::vector<std::string> existing;
+        scan(existing);
+    }
+
+    std::vector<std::string> FileWatcher::wait(uint32_t timeoutMs)
+    {
+        const auto pollInterval = std::chrono::milliseconds{ 50 };
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{ timeoutMs };
+
+        std::vector<std::string> changed;
+        for (;;) {
+            scan(changed);
+            auto now = std::chrono::steady_clock::now();
+            if (!changed.empty() || now >= deadline) {
+                return changed;
+            }
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(pollInterval, deadline - now));
+        }
+    }
+
+    void FileWatcher::scan(std::vector<std::string>& changed)
+    {
+        for (const std::string& directory : m_directories) {
+            std::error_code error;
+            for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator{ directory, error }) {
+                if (!entry.is_regular_file(error)) {
+                    continue;
+                }
+                std::filesystem::file_time_type writeTime = entry.last_write_time(error);
+                if (error) {
+                    continue;
+                }
+                std::string path = entry.path().lexically_normal().string();
+                auto it = m_writeTimes.find(path);
+                if (it == m_writeTimes.end() || it->second != writeTime) {
+                    m_writeTimes[path] = writeTime;
+                    changed.push_back(path);
+                }
+            }
+        }
+    }
+#endif
+}
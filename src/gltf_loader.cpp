@@ -0,0 +1,722 @@
+#include "gltf_loader.h"
+#include "image_decoder.h"
+#include "json_reader.h"
+#include "mapped_file.h"
+#include "renderer.h"
+#include "utils.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        constexpr uint32_t kGlbMagic = 0x46546C67; // "glTF"
+        constexpr uint32_t kGlbChunkJson = 0x4E4F534A; // "JSON"
+        constexpr uint32_t kGlbChunkBin = 0x004E4942; // "BIN\0"
+        // Keeps every bufferView in the geometry buffer aligned for any index or
+        // vertex component type.
+        constexpr vk::DeviceSize kGeometryAlignment = 16;
+
+        struct BufferView
+        {
+            uint32_t buffer = 0;
+            size_t offset = 0;
+            size_t length = 0;
+            uint32_t stride = 0;
+        };
+
+        struct Accessor
+        {
+            int32_t bufferView = -1;
+            size_t offset = 0;
+            uint32_t componentType = 0;
+            uint32_t components = 0;
+            uint32_t count = 0;
+            bool normalized = false;
+        };
+
+        struct ByteRange
+        {
+            const uint8_t* data = nullptr;
+            size_t size = 0;
+        };
+
+        uint32_t readLe32(const uint8_t* p)
+        {
+            uint32_t value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        uint32_t componentSize(uint32_t componentType)
+        {
+            switch (componentType) {
+            case 5120: case 5121: return 1; // BYTE, UNSIGNED_BYTE
+            case 5122: case 5123: return 2; // SHORT, UNSIGNED_SHORT
+            case 5125: case 5126: return 4; // UNSIGNED_INT, FLOAT
+            default: return 0;
+            }
+        }
+
+        uint32_t componentCount(std::string_view type)
+        {
+            if (type == "SCALAR") return 1;
+            if (type == "VEC2") return 2;
+            if (type == "VEC3") return 3;
+            if (type == "VEC4") return 4;
+            if (type == "MAT4") return 16;
+            return 0;
+        }
+
+        vk::Format toVertexFormat(const Accessor& accessor)
+        {
+            static const vk::Format floats[4] = { vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat };
+            static const vk::Format unorm8[4] = { vk::Format::eR8Unorm, vk::Format::eR8G8Unorm, vk::Format::eR8G8B8Unorm, vk::Format::eR8G8B8A8Unorm };
+            static const vk::Format snorm8[4] = { vk::Format::eR8Snorm, vk::Format::eR8G8Snorm, vk::Format::eR8G8B8Snorm, vk::Format::eR8G8B8A8Snorm };
+            static const vk::Format unorm16[4] = { vk::Format::eR16Unorm, vk::Format::eR16G16Unorm, vk::Format::eR16G16B16Unorm, vk::Format::eR16G16B16A16Unorm };
+            static const vk::Format snorm16[4] = { vk::Format::eR16Snorm, vk::Format::eR16G16Snorm, vk::Format::eR16G16B16Snorm, vk::Format::eR16G16B16A16Snorm };
+
+            if (accessor.components == 0 || accessor.components > 4) {
+                return vk::Format::eUndefined;
+            }
+            uint32_t i = accessor.components - 1;
+            switch (accessor.componentType) {
+            case 5126: return floats[i];
+            case 5121: return accessor.normalized ? unorm8[i] : vk::Format::eUndefined;
+            case 5120: return accessor.normalized ? snorm8[i] : vk::Format::eUndefined;
+            case 5123: return accessor.normalized ? unorm16[i] : vk::Format::eUndefined;
+            case 5122: return accessor.normalized ? snorm16[i] : vk::Format::eUndefined;
+            default: return vk::Format::eUndefined;
+            }
+        }
+
+        std::string directoryOf(const std::string& path)
+        {
+            size_t slash = path.find_last_of("/\\");
+            return slash == std::string::npos ? std::string{} : path.substr(0, slash + 1);
+        }
+
+        glm::mat4 localTransform(JsonDocument::Value node)
+        {
+            JsonDocument::Value matrix = node["matrix"];
+            if (matrix.size() == 16) {
+                // Column major, like glm.
+                glm::mat4 result{ 1.0f };
+                uint32_t i = 0;
+                for (JsonDocument::Value element = matrix.firstChild(); element.isValid(); element = element.next(), ++i) {
+                    result[i / 4][i % 4] = float(element.asNumber());
+                }
+                return result;
+            }
+
+            JsonDocument::Value t = node["translation"];
+            JsonDocument::Value r = node["rotation"];
+            JsonDocument::Value s = node["scale"];
+            glm::vec3 translation{ float(t[0u].asNumber()), float(t[1u].asNumber()), float(t[2u].asNumber()) };
+            glm::quat rotation{ float(r[3u].asNumber(1.0)), float(r[0u].asNumber()), float(r[1u].asNumber()), float(r[2u].asNumber()) };
+            glm::vec3 scale{ float(s[0u].asNumber(1.0)), float(s[1u].asNumber(1.0)), float(s[2u].asNumber(1.0)) };
+
+            return glm::translate(glm::mat4{ 1.0f }, translation) * glm::mat4_cast(rotation) * glm::scale(glm::mat4{ 1.0f }, scale);
+        }
+
+        double millisecondsSince(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // Decode jobs reference the loader's locals, so they must all finish
+        // before those go out of scope, including when an exception unwinds.
+        struct JobScope
+        {
+            JobSystem& jobs;
+            JobCounter counter;
+
+            explicit JobScope(JobSystem& jobSystem) : jobs(jobSystem) { }
+            ~JobScope() { jobs.wait(counter); }
+        };
+    }
+
+    bool isDataUri(const std::string& uri)
+    {
+        return uri.compare(0, 5, "data:") == 0;
+    }
+
+    std::vector<uint8_t> decodeDataUri(const std::string& uri)
+    {
+        size_t comma = uri.find(',');
+        if (!isDataUri(uri) || comma == std::string::npos || comma < 7 || uri.compare(comma - 7, 7, ";base64") != 0) {
+            throw std::runtime_error("Only base64 encoded data: URIs are supported");
+        }
+
+        std::vector<uint8_t> bytes;
+        bytes.reserve((uri.size() - comma) / 4 * 3);
+        uint32_t bits = 0;
+        uint32_t bitCount = 0;
+        for (size_t i = comma + 1; i < uri.size() && uri[i] != '='; ++i) {
+            char c = uri[i];
+            uint32_t value = 0;
+            if (c >= 'A' && c <= 'Z') value = uint32_t(c - 'A');
+            else if (c >= 'a' && c <= 'z') value = uint32_t(c - 'a') + 26;
+            else if (c >= '0' && c <= '9') value = uint32_t(c - '0') + 52;
+            else if (c == '+') value = 62;
+            else if (c == '/') value = 63;
+            else throw std::runtime_error("Invalid base64 in data: URI");
+
+            bits = (bits << 6) | value;
+            bitCount += 6;
+            if (bitCount >= 8) {
+                bitCount -= 8;
+                bytes.push_back(uint8_t(bits >> bitCount));
+            }
+        }
+        return bytes;
+    }
+
+    vk::Buffer GltfAsset::getGeometryBuffer() const
+    {
+        return m_geometry.isValid() ? m_memory->getMovableBuffer(m_geometry).buffer : vk::Buffer{};
+    }
+
+    GltfLoadStats GltfAsset::getStats() const
+    {
+        std::lock_guard<std::mutex> lock{ m_statsMutex };
+        return m_stats;
+    }
+
+    GltfLoader::GltfLoader(Renderer& renderer, uint32_t decodeThreads) :
+        m_renderer(renderer)
+    {
+        if (decodeThreads == 0) {
+            decodeThreads = std::max(std::thread::hardware_concurrency() / 2, 1u);
+        }
+        // The loader thread takes the place of worker 0 while it waits on decodes.
+        m_decodeJobs = std::make_unique<JobSystem>(decodeThreads + 1);
+        m_thread = std::thread(&GltfLoader::loaderLoop, this);
+    }
+
+    GltfLoader::~GltfLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            m_running = false;
+        }
+        m_wake.notify_all();
+        m_thread.join();
+
+        for (const std::shared_ptr<GltfAsset>& asset : m_assets) {
+            releaseResources(*asset);
+        }
+    }
+
+    std::shared_ptr<GltfAsset> GltfLoader::load(const std::string& path)
+    {
+        std::shared_ptr<GltfAsset> asset = std::make_shared<GltfAsset>();
+        asset->m_path = path;
+        asset->m_memory = &m_renderer.getMemory();
+        asset->m_requested = std::chrono::steady_clock::now();
+
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            m_queue.push_back(asset);
+            m_assets.push_back(asset);
+        }
+        m_wake.notify_one();
+        return asset;
+    }
+
+    void GltfLoader::unload(const std::shared_ptr<GltfAsset>& asset)
+    {
+        AssetState state = asset->getState();
+        if (state != AssetState::eResident && state != AssetState::eFailed) {
+            throw std::runtime_error("Only resident or failed assets can be unloaded");
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            m_assets.erase(std::remove(m_assets.begin(), m_assets.end(), asset), m_assets.end());
+        }
+        releaseResources(*asset);
+    }
+
+    void GltfLoader::releaseResources(GltfAsset& asset)
+    {
+        // Failed loads may still have copies in flight on the transfer queue.
+        m_renderer.getUploads().wait(asset.m_lastUploadValue);
+
+        GpuMemory& memory = m_renderer.getMemory();
+        vk::Device device = m_renderer.getDevice();
+        MovableBufferHandle geometry = asset.m_geometry;
+        std::vector<GltfTexture> textures = std::move(asset.m_textures);
+        asset.m_geometry = MovableBufferHandle{};
+        asset.m_textures.clear();
+
+        m_renderer.deferRelease([&memory, device, geometry, textures]() mutable {
+            for (GltfTexture& texture : textures) {
+                device.destroyImageView(texture.view);
+                memory.destroyImage(texture.image);
+            }
+            if (geometry.isValid()) {
+                memory.destroyMovableBuffer(geometry);
+            }
+        });
+    }
+
+    void GltfLoader::loaderLoop()
+    {
+        while (true) {
+            std::shared_ptr<GltfAsset> asset;
+            {
+                std::unique_lock<std::mutex> lock{ m_mutex };
+                m_wake.wait(lock, [this]() { return !m_running || !m_queue.empty(); });
+                if (!m_running) {
+                    return;
+                }
+                asset = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+
+            try {
+                loadAsset(asset);
+            }
+            catch (const std::exception& e) {
+                asset->m_error = e.what();
+                asset->m_lastUploadValue = m_renderer.getUploads().flush();
+                asset->m_state.store(AssetState::eFailed, std::memory_order_release);
+
+                std::string message = "Failed to load ";
+                debugLog(message.append(asset->m_path).append(": ").append(e.what()).c_str());
+            }
+        }
+    }
+
+    void GltfLoader::loadAsset(const std::shared_ptr<GltfAsset>& asset)
+    {
+        asset->m_state.store(AssetState::eParsing, std::memory_order_release);
+
+        GpuMemory& memory = m_renderer.getMemory();
+        UploadQueue& uploads = m_renderer.getUploads();
+        vk::Device device = m_renderer.getDevice();
+
+        MappedFile file{ asset->m_path };
+        const std::string directory = directoryOf(asset->m_path);
+
+        ByteRange json{ file.data(), file.size() };
+        ByteRange glbBinary;
+        if (file.size() >= 12 && readLe32(file.data()) == kGlbMagic) {
+            if (readLe32(file.data() + 4) != 2) {
+                throw std::runtime_error("Unsupported GLB version");
+            }
+            size_t length = std::min<size_t>(readLe32(file.data() + 8), file.size());
+            json = ByteRange{};
+            for (size_t pos = 12; pos + 8 <= length;) {
+                size_t chunkLength = readLe32(file.data() + pos);
+                uint32_t chunkType = readLe32(file.data() + pos + 4);
+                if (pos + 8 + chunkLength > length) {
+                    throw std::runtime_error("Truncated GLB chunk");
+                }
+                if (chunkType == kGlbChunkJson) {
+                    json = ByteRange{ file.data() + pos + 8, chunkLength };
+                }
+                else if (chunkType == kGlbChunkBin && glbBinary.data == nullptr) {
+                    glbBinary = ByteRange{ file.data() + pos + 8, chunkLength };
+                }
+                pos += 8 + ((chunkLength + 3) & ~size_t(3));
+            }
+            if (json.data == nullptr) {
+                throw std::runtime_error("GLB without a JSON chunk");
+            }
+        }
+
+        JsonDocument document;
+        document.parse(reinterpret_cast<const char*>(json.data), json.size);
+        JsonDocument::Value root = document.root();
+
+        uint64_t fileBytes = file.size();
+
+        // Buffers: the GLB binary chunk or external files, all mapped, or
+        // base64 data: URIs decoded into memory.
+        std::vector<MappedFile> externalFiles;
+        std::vector<std::vector<uint8_t>> embeddedBuffers;
+        std::vector<ByteRange> buffers;
+        for (JsonDocument::Value buffer = root["buffers"].firstChild(); buffer.isValid(); buffer = buffer.next()) {
+            JsonDocument::Value uri = buffer["uri"];
+            if (!uri.isValid()) {
+                buffers.push_back(glbBinary);
+                continue;
+            }
+            std::string uriString = uri.asString();
+            if (isDataUri(uriString)) {
+                embeddedBuffers.push_back(decodeDataUri(uriString));
+                buffers.push_back(ByteRange{ embeddedBuffers.back().data(), embeddedBuffers.back().size() });
+                continue;
+            }
+            externalFiles.emplace_back(directory + uriString);
+            buffers.push_back(ByteRange{ externalFiles.back().data(), externalFiles.back().size() });
+            fileBytes += externalFiles.back().size();
+        }
+
+        std::vector<BufferView> views;
+        for (JsonDocument::Value view = root["bufferViews"].firstChild(); view.isValid(); view = view.next()) {
+            BufferView parsed{};
+            parsed.buffer = view["buffer"].asUint();
+            parsed.offset = size_t(view["byteOffset"].asNumber());
+            parsed.length = size_t(view["byteLength"].asNumber());
+            parsed.stride = view["byteStride"].asUint();
+            if (parsed.buffer >= buffers.size() || parsed.offset + parsed.length > buffers[parsed.buffer].size) {
+                throw std::runtime_error("bufferView out of range");
+            }
+            views.push_back(parsed);
+        }
+
+        std::vector<Accessor> accessors;
+        for (JsonDocument::Value accessor = root["accessors"].firstChild(); accessor.isValid(); accessor = accessor.next()) {
+            Accessor parsed{};
+            parsed.bufferView = int32_t(accessor["bufferView"].asNumber(-1.0));
+            parsed.offset = size_t(accessor["byteOffset"].asNumber());
+            parsed.componentType = accessor["componentType"].asUint();
+            parsed.components = componentCount(accessor["type"].asRawString());
+            parsed.count = accessor["count"].asUint();
+            parsed.normalized = accessor["normalized"].asBool();
+            if (parsed.bufferView >= int32_t(views.size())) {
+                throw std::runtime_error("accessor references a missing bufferView");
+            }
+            accessors.push_back(parsed);
+        }
+
+        // Only the bufferViews that meshes read from go into the geometry buffer,
+        // which skips embedded images and animation data.
+        std::vector<vk::DeviceSize> viewOffsets(views.size(), VK_WHOLE_SIZE);
+        vk::DeviceSize geometrySize = 0;
+        auto placeAccessor = [&](JsonDocument::Value index) -> const Accessor* {
+            if (!index.isValid() || index.asUint() >= accessors.size()) {
+                return nullptr;
+            }
+            const Accessor& accessor = accessors[index.asUint()];
+            if (accessor.bufferView < 0) {
+                return nullptr;
+            }
+            // The GPU reads the streams unchecked, so every element must lie
+            // inside the view.
+            const BufferView& view = views[accessor.bufferView];
+            size_t elementSize = size_t(componentSize(accessor.componentType)) * accessor.components;
+            if (elementSize == 0) {
+                throw std::runtime_error("accessor has an unknown type");
+            }
+            size_t stride = view.stride != 0 ? view.stride : elementSize;
+            size_t available = accessor.offset <= view.length ? view.length - accessor.offset : 0;
+            if (accessor.count > 0 && (available < elementSize || (available - elementSize) / stride < size_t(accessor.count - 1))) {
+                throw std::runtime_error("accessor reads past its bufferView");
+            }
+            vk::DeviceSize& offset = viewOffsets[accessor.bufferView];
+            if (offset == VK_WHOLE_SIZE) {
+                offset = geometrySize;
+                geometrySize = (geometrySize + views[accessor.bufferView].length + kGeometryAlignment - 1) & ~(kGeometryAlignment - 1);
+            }
+            return &accessor;
+        };
+        auto toStream = [&](const Accessor* accessor) {
+            GltfVertexStream stream{};
+            if (accessor == nullptr) {
+                return stream;
+            }
+            const BufferView& view = views[accessor->bufferView];
+            stream.offset = viewOffsets[accessor->bufferView] + accessor->offset;
+            stream.stride = view.stride != 0 ? view.stride : componentSize(accessor->componentType) * accessor->components;
+            stream.format = toVertexFormat(*accessor);
+            return stream;
+        };
+
+        std::vector<GltfMesh> meshes;
+        for (JsonDocument::Value mesh = root["meshes"].firstChild(); mesh.isValid(); mesh = mesh.next()) {
+            GltfMesh parsedMesh;
+            for (JsonDocument::Value primitive = mesh["primitives"].firstChild(); primitive.isValid(); primitive = primitive.next()) {
+                // Only triangle lists, the default mode.
+                if (primitive["mode"].asUint(4) != 4) {
+                    continue;
+                }
+                JsonDocument::Value attributes = primitive["attributes"];
+                const Accessor* position = placeAccessor(attributes["POSITION"]);
+                if (position == nullptr) {
+                    continue;
+                }
+
+                const Accessor* normal = placeAccessor(attributes["NORMAL"]);
+                const Accessor* texcoord0 = placeAccessor(attributes["TEXCOORD_0"]);
+                for (const Accessor* attribute : { normal, texcoord0 }) {
+                    if (attribute != nullptr && attribute->count < position->count) {
+                        throw std::runtime_error("vertex attributes have fewer elements than positions");
+                    }
+                }
+
+                GltfPrimitive parsed{};
+                parsed.position = toStream(position);
+                parsed.normal = toStream(normal);
+                parsed.texcoord0 = toStream(texcoord0);
+                parsed.vertexCount = position->count;
+                parsed.material = int32_t(primitive["material"].asNumber(-1.0));
+
+                if (const Accessor* indices = placeAccessor(primitive["indices"])) {
+                    // 8-bit indices would need VK_EXT_index_type_uint8.
+                    if (indices->componentType == 5121) {
+                        continue;
+                    }
+                    parsed.indexOffset = viewOffsets[indices->bufferView] + indices->offset;
+                    parsed.indexCount = indices->count;
+                    parsed.indexType = indices->componentType == 5123 ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+                }
+                parsedMesh.primitives.push_back(parsed);
+            }
+            meshes.push_back(std::move(parsedMesh));
+        }
+
+        // Flatten the default scene. Without scenes, every node nobody references
+        // as a child is a root.
+        std::vector<GltfInstance> instances;
+        JsonDocument::Value nodes = root["nodes"];
+        std::vector<uint32_t> roots;
+        JsonDocument::Value scene = root["scenes"][root["scene"].asUint(0)];
+        if (scene.isValid()) {
+            for (JsonDocument::Value node = scene["nodes"].firstChild(); node.isValid(); node = node.next()) {
+                roots.push_back(node.asUint());
+            }
+        }
+        else {
+            std::vector<bool> isChild(nodes.size(), false);
+            for (JsonDocument::Value node = nodes.firstChild(); node.isValid(); node = node.next()) {
+                for (JsonDocument::Value child = node["children"].firstChild(); child.isValid(); child = child.next()) {
+                    if (child.asUint() < isChild.size()) {
+                        isChild[child.asUint()] = true;
+                    }
+                }
+            }
+            for (uint32_t i = 0; i < isChild.size(); ++i) {
+                if (!isChild[i]) {
+                    roots.push_back(i);
+                }
+            }
+        }
+
+        std::vector<JsonDocument::Value> nodeValues;
+        nodeValues.reserve(nodes.size());
+        for (JsonDocument::Value node = nodes.firstChild(); node.isValid(); node = node.next()) {
+            nodeValues.push_back(node);
+        }
+
+        std::vector<std::pair<uint32_t, glm::mat4>> stack;
+        for (uint32_t rootNode : roots) {
+            stack.emplace_back(rootNode, glm::mat4{ 1.0f });
+        }
+        // A valid glTF is a forest, the visit limit only protects against cycles.
+        size_t visits = 0;
+        while (!stack.empty() && visits++ <= nodeValues.size()) {
+            std::pair<uint32_t, glm::mat4> entry = stack.back();
+            stack.pop_back();
+            if (entry.first >= nodeValues.size()) {
+                continue;
+            }
+
+            JsonDocument::Value node = nodeValues[entry.first];
+            glm::mat4 world = entry.second * localTransform(node);
+            JsonDocument::Value mesh = node["mesh"];
+            if (mesh.isValid() && mesh.asUint() < meshes.size()) {
+                instances.push_back(GltfInstance{ world, mesh.asUint() });
+            }
+            for (JsonDocument::Value child = node["children"].firstChild(); child.isValid(); child = child.next()) {
+                stack.emplace_back(child.asUint(), world);
+            }
+        }
+
+        // glTF textures point at images, materials reference images directly.
+        std::vector<int32_t> textureSources;
+        for (JsonDocument::Value texture = root["textures"].firstChild(); texture.isValid(); texture = texture.next()) {
+            textureSources.push_back(int32_t(texture["source"].asNumber(-1.0)));
+        }
+        auto toImageIndex = [&textureSources](JsonDocument::Value textureInfo) {
+            uint32_t texture = textureInfo["index"].asUint(UINT32_MAX);
+            return texture < textureSources.size() ? textureSources[texture] : -1;
+        };
+
+        std::vector<GltfMaterial> materials;
+        for (JsonDocument::Value material = root["materials"].firstChild(); material.isValid(); material = material.next()) {
+            JsonDocument::Value pbr = material["pbrMetallicRoughness"];
+            JsonDocument::Value factor = pbr["baseColorFactor"];
+
+            GltfMaterial parsed{};
+            parsed.baseColorFactor = glm::vec4{
+                float(factor[0u].asNumber(1.0)),
+                float(factor[1u].asNumber(1.0)),
+                float(factor[2u].asNumber(1.0)),
+                float(factor[3u].asNumber(1.0)),
+            };
+            parsed.metallicFactor = float(pbr["metallicFactor"].asNumber(1.0));
+            parsed.roughnessFactor = float(pbr["roughnessFactor"].asNumber(1.0));
+            parsed.baseColorTexture = toImageIndex(pbr["baseColorTexture"]);
+            parsed.metallicRoughnessTexture = toImageIndex(pbr["metallicRoughnessTexture"]);
+            parsed.normalTexture = toImageIndex(material["normalTexture"]);
+            parsed.emissiveTexture = toImageIndex(material["emissiveTexture"]);
+            materials.push_back(parsed);
+        }
+
+        // Color images are stored sRGB encoded, everything else (normals,
+        // metallic-roughness) is linear data.
+        std::vector<bool> srgbImages(root["images"].size(), false);
+        for (const GltfMaterial& material : materials) {
+            for (int32_t image : { material.baseColorTexture, material.emissiveTexture }) {
+                if (image >= 0 && size_t(image) < srgbImages.size()) {
+                    srgbImages[size_t(image)] = true;
+                }
+            }
+        }
+
+        asset->m_meshes = std::move(meshes);
+        asset->m_instances = std::move(instances);
+        asset->m_materials = std::move(materials);
+        asset->m_textures.resize(root["images"].size());
+        {
+            std::lock_guard<std::mutex> lock{ asset->m_statsMutex };
+            asset->m_stats.fileBytes = fileBytes;
+            asset->m_stats.geometryBytes = geometrySize;
+            asset->m_stats.parsedMs = millisecondsSince(asset->m_requested);
+        }
+        asset->m_state.store(AssetState::eStreaming, std::memory_order_release);
+
+        // Decode images in the background while the geometry uploads.
+        JobScope decodes{ *m_decodeJobs };
+        uint32_t imageIndex = 0;
+        for (JsonDocument::Value image = root["images"].firstChild(); image.isValid(); image = image.next(), ++imageIndex) {
+            ByteRange encoded;
+            std::string uri;
+            JsonDocument::Value view = image["bufferView"];
+            if (view.isValid() && view.asUint() < views.size()) {
+                const BufferView& imageView = views[view.asUint()];
+                encoded = ByteRange{ buffers[imageView.buffer].data + imageView.offset, imageView.length };
+            }
+            else if (image["uri"].isValid()) {
+                uri = image["uri"].asString();
+                if (!isDataUri(uri)) {
+                    uri = directory + uri;
+                }
+            }
+            vk::Format format = srgbImages[imageIndex] ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+
+            m_decodeJobs->run([asset, &memory, &uploads, device, encoded, uri, format, imageIndex]() {
+                try {
+                    MappedFile externalFile;
+                    std::vector<uint8_t> embedded;
+                    ByteRange bytes = encoded;
+                    if (isDataUri(uri)) {
+                        embedded = decodeDataUri(uri);
+                        bytes = ByteRange{ embedded.data(), embedded.size() };
+                    }
+                    else if (!uri.empty()) {
+                        externalFile = MappedFile{ uri };
+                        bytes = ByteRange{ externalFile.data(), externalFile.size() };
+                    }
+                    if (bytes.data == nullptr) {
+                        throw std::runtime_error("image has no data");
+                    }
+
+                    DecodedImage decoded = decodeImage(bytes.data, bytes.size);
+
+                    GltfTexture& texture = asset->m_textures[imageIndex];
+                    texture.width = decoded.width;
+                    texture.height = decoded.height;
+                    vk::ImageCreateInfo imageInfo{
+                        vk::ImageCreateFlags{},
+                        vk::ImageType::e2D,
+                        format,
+                        vk::Extent3D{ decoded.width, decoded.height, 1 },
+                        1, // Mip levels
+                        1, // Array layers
+                        vk::SampleCountFlagBits::e1,
+                        vk::ImageTiling::eOptimal,
+                        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst,
+                    };
+                    texture.image = memory.createImage(imageInfo);
+                    uploads.uploadImage(texture.image.image, vk::Extent2D{ decoded.width, decoded.height }, decoded.rgba.data());
+                    texture.view = device.createImageView(vk::ImageViewCreateInfo{
+                        vk::ImageViewCreateFlags{},
+                        texture.image.image,
+                        vk::ImageViewType::e2D,
+                        imageInfo.format,
+                        vk::ComponentMapping{},
+                        vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 },
+                    });
+
+                    std::lock_guard<std::mutex> lock{ asset->m_statsMutex };
+                    asset->m_stats.imageBytes += decoded.rgba.size();
+                    asset->m_stats.fileBytes += externalFile.size();
+                }
+                catch (const std::exception& e) {
+                    std::lock_guard<std::mutex> lock{ asset->m_statsMutex };
+                    asset->m_stats.imagesFailed += 1;
+
+                    std::string message = "Skipping image ";
+                    debugLog(message.append(std::to_string(imageIndex)).append(" of ").append(asset->m_path)
+                        .append(": ").append(e.what()).c_str());
+                }
+            }, decodes.counter);
+        }
+
+        // Straight from the mapping into the staging ring.
+        if (geometrySize > 0) {
+            asset->m_geometry = memory.createMovableBuffer(
+                vk::BufferCreateInfo{
+                    vk::BufferCreateFlags{},
+                    geometrySize,
+                    vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer |
+                        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                }
+            );
+            vk::Buffer geometryBuffer = memory.getMovableBuffer(asset->m_geometry).buffer;
+            for (size_t i = 0; i < views.size(); ++i) {
+                if (viewOffsets[i] == VK_WHOLE_SIZE) {
+                    continue;
+                }
+                const BufferView& view = views[i];
+                uploads.uploadBuffer(geometryBuffer, viewOffsets[i], buffers[view.buffer].data + view.offset, view.length);
+            }
+        }
+
+        uint64_t geometryValue = uploads.flush();
+        uploads.whenAcquired(geometryValue, [asset]() {
+            AssetState expected = AssetState::eStreaming;
+            if (asset->m_state.compare_exchange_strong(expected, AssetState::eDrawable, std::memory_order_acq_rel)) {
+                // Nothing writes the geometry anymore, so it may move from now on.
+                if (asset->m_geometry.isValid()) {
+                    asset->m_memory->unpinMovableBuffer(asset->m_geometry);
+                }
+                std::lock_guard<std::mutex> lock{ asset->m_statsMutex };
+                asset->m_stats.drawableMs = millisecondsSince(asset->m_requested);
+            }
+        });
+
+        m_decodeJobs->wait(decodes.counter);
+        asset->m_lastUploadValue = uploads.flush();
+        uploads.whenAcquired(asset->m_lastUploadValue, [asset]() {
+            AssetState state = asset->m_state.load(std::memory_order_acquire);
+            if (state == AssetState::eStreaming || state == AssetState::eDrawable) {
+                std::lock_guard<std::mutex> lock{ asset->m_statsMutex };
+                asset->m_stats.residentMs = millisecondsSince(asset->m_requested);
+                if (asset->m_stats.drawableMs == 0.0) {
+                    asset->m_stats.drawableMs = asset->m_stats.residentMs;
+                }
+                asset->m_state.store(AssetState::eResident, std::memory_order_release);
+            }
+        });
+
+#ifndef NDEBUG
+        std::string message = "Parsed ";
+        debugLog(message.append(asset->m_path).append(": ")
+            .append(std::to_string(asset->m_meshes.size())).append(" meshes, ")
+            .append(std::to_string(asset->m_instances.size())).append(" instances, ")
+            .append(std::to_string(asset->m_textures.size())).append(" images").c_str());
+#endif
+    }
+}
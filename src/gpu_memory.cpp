@@ -0,0 +1,627 @@
+#define VMA_IMPLEMENTATION
+#include "gpu_memory.h"
+#include "json_writer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace bvr
+{
+    namespace
+    {
+        VmaMemoryUsage toVmaUsage(MemoryUsage usage)
+        {
+            switch (usage) {
+            case MemoryUsage::eUpload: return VMA_MEMORY_USAGE_CPU_ONLY;
+            case MemoryUsage::eReadback: return VMA_MEMORY_USAGE_GPU_TO_CPU;
+            default: return VMA_MEMORY_USAGE_GPU_ONLY;
+            }
+        }
+
+        void checkResult(VkResult result, const char* what)
+        {
+            if (result != VK_SUCCESS) {
+                std::string errorString{ what };
+                throw std::runtime_error(errorString.append(" failed with VkResult ").append(std::to_string(int(result))));
+            }
+        }
+    }
+
+    void FrameRingAllocator::init(const Buffer& buffer, vk::DeviceSize regionSize, vk::DeviceSize alignment)
+    {
+        m_buffer = buffer;
+        m_regionSize = regionSize;
+        m_alignment = alignment;
+        m_regionStart = 0;
+        m_head = 0;
+    }
+
+    void FrameRingAllocator::beginFrame(uint32_t frameSlot)
+    {
+        m_highWaterMark = std::max(m_highWaterMark, vk::DeviceSize(m_head.load()));
+        m_regionStart = m_regionSize * frameSlot;
+        m_head = 0;
+    }
+
+    RingAllocation FrameRingAllocator::allocate(vk::DeviceSize size)
+    {
+        vk::DeviceSize alignedSize = (size + m_alignment - 1) & ~(m_alignment - 1);
+        vk::DeviceSize offset = m_head.fetch_add(alignedSize);
+        if (offset + alignedSize > m_regionSize) {
+            return RingAllocation{};
+        }
+
+        RingAllocation allocation{};
+        allocation.buffer = m_buffer.buffer;
+        allocation.offset = m_regionStart + offset;
+        allocation.mapped = static_cast<uint8_t*>(m_buffer.mapped) + allocation.offset;
+        return allocation;
+    }
+
+    GpuMemory::GpuMemory(
+        vk::PhysicalDevice physicalDevice,
+        vk::Device device,
+        const GpuMemoryConfig& config,
+        uint32_t framesInFlight,
+        bool memoryBudgetSupported
+    ) :
+        m_physicalDevice(physicalDevice),
+        m_device(device),
+        m_config(config),
+        m_framesInFlight(std::max(framesInFlight, 1u)),
+        m_memoryBudgetSupported(memoryBudgetSupported)
+    {
+        VmaAllocatorCreateInfo allocatorInfo{};
+        allocatorInfo.physicalDevice = physicalDevice;
+        allocatorInfo.device = device;
+        allocatorInfo.preferredLargeHeapBlockSize = m_config.poolBlockSize;
+        allocatorInfo.frameInUseCount = m_framesInFlight - 1;
+        checkResult(vmaCreateAllocator(&allocatorInfo, &m_allocator), "vmaCreateAllocator");
+
+        // Representative create infos, only used to pick each pool's memory type.
+        VkBufferCreateInfo sampleBuffer{ VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+        sampleBuffer.size = 1024;
+        sampleBuffer.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+        VkImageCreateInfo sampleImage{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+        sampleImage.imageType = VK_IMAGE_TYPE_2D;
+        sampleImage.format = VK_FORMAT_R8G8B8A8_UNORM;
+        sampleImage.extent = { 256, 256, 1 };
+        sampleImage.mipLevels = 1;
+        sampleImage.arrayLayers = 1;
+        sampleImage.samples = VK_SAMPLE_COUNT_1_BIT;
+        sampleImage.tiling = VK_IMAGE_TILING_OPTIMAL;
+        sampleImage.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+        VmaAllocationCreateInfo gpuOnly{};
+        gpuOnly.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        VmaAllocationCreateInfo upload{};
+        upload.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+
+        uint32_t memoryType = 0;
+        checkResult(vmaFindMemoryTypeIndexForBufferInfo(m_allocator, &sampleBuffer, &gpuOnly, &memoryType), "Finding buffer memory type");
+        m_bufferPool = Pool{ createPool(memoryType, "buffers"), memoryType, "buffers" };
+        m_movablePool = Pool{ createPool(memoryType, "movable_buffers"), memoryType, "movable_buffers" };
+
+        checkResult(vmaFindMemoryTypeIndexForBufferInfo(m_allocator, &sampleBuffer, &upload, &memoryType), "Finding upload memory type");
+        m_uploadPool = Pool{ createPool(memoryType, "upload"), memoryType, "upload" };
+
+        checkResult(vmaFindMemoryTypeIndexForImageInfo(m_allocator, &sampleImage, &gpuOnly, &memoryType), "Finding image memory type");
+        m_imagePool = Pool{ createPool(memoryType, "images"), memoryType, "images" };
+
+        // One ring region per frame in flight, preferring device local host visible memory.
+        vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+        vk::DeviceSize alignment = std::max<vk::DeviceSize>({
+            limits.minUniformBufferOffsetAlignment,
+            limits.minStorageBufferOffsetAlignment,
+            16,
+        });
+
+        vk::BufferCreateInfo ringInfo{
+            vk::BufferCreateFlags{},
+            m_config.frameRingSize * m_framesInFlight,
+            vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer |
+                vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferSrc,
+        };
+        VkBufferCreateInfo rawRingInfo = ringInfo;
+        VmaAllocationCreateInfo ringAllocInfo{};
+        ringAllocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+        ringAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+
+        VkBuffer ringBuffer;
+        VmaAllocationInfo ringInfoOut;
+        checkResult(
+            vmaCreateBuffer(m_allocator, &rawRingInfo, &ringAllocInfo, &ringBuffer, &m_ringBuffer.allocation, &ringInfoOut),
+            "Creating the frame ring buffer"
+        );
+        m_ringBuffer.buffer = ringBuffer;
+        m_ringBuffer.size = ringInfo.size;
+        m_ringBuffer.mapped = ringInfoOut.pMappedData;
+        m_frameRing.init(m_ringBuffer, m_config.frameRingSize, alignment);
+    }
+
+    GpuMemory::~GpuMemory()
+    {
+        for (MovableBuffer& movable : m_movableBuffers) {
+            destroyBuffer(movable.buffer);
+        }
+        destroyBuffer(m_ringBuffer);
+
+        for (Pool* pool : { &m_bufferPool, &m_imagePool, &m_uploadPool, &m_movablePool }) {
+            if (pool->pool != VK_NULL_HANDLE) {
+                vmaDestroyPool(m_allocator, pool->pool);
+            }
+        }
+        vmaDestroyAllocator(m_allocator);
+    }
+
+    VmaPool GpuMemory::createPool(uint32_t memoryTypeIndex, const char* name)
+    {
+        VmaPoolCreateInfo poolInfo{};
+        poolInfo.memoryTypeIndex = memoryTypeIndex;
+        poolInfo.blockSize = m_config.poolBlockSize;
+        poolInfo.frameInUseCount = m_framesInFlight - 1;
+
+        VmaPool pool;
+        checkResult(vmaCreatePool(m_allocator, &poolInfo, &pool), name);
+        return pool;
+    }
+
+    VmaPool GpuMemory::choosePool(MemoryUsage usage, uint32_t memoryTypeBits, bool isImage) const
+    {
+        const Pool* pool = nullptr;
+        switch (usage) {
+        case MemoryUsage::eGpuOnly: pool = isImage ? &m_imagePool : &m_bufferPool; break;
+        case MemoryUsage::eUpload: pool = isImage ? nullptr : &m_uploadPool; break;
+        default: break;
+        }
+
+        // Resources whose requirements exclude the pool's memory type (e.g. some
+        // depth formats) fall back to VMA's default pools.
+        if (pool == nullptr || (memoryTypeBits & (1u << pool->memoryTypeIndex)) == 0) {
+            return VK_NULL_HANDLE;
+        }
+        return pool->pool;
+    }
+
+    bool GpuMemory::isDedicated(vk::DeviceSize size) const
+    {
+        return size >= m_config.poolBlockSize / 2;
+    }
+
+    Buffer GpuMemory::createBuffer(const vk::BufferCreateInfo& createInfo, MemoryUsage usage)
+    {
+        Buffer buffer{};
+        buffer.size = createInfo.size;
+        buffer.buffer = m_device.createBuffer(createInfo);
+
+        vk::MemoryRequirements requirements = m_device.getBufferMemoryRequirements(buffer.buffer);
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = toVmaUsage(usage);
+        if (usage != MemoryUsage::eGpuOnly) {
+            allocInfo.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        }
+        if (isDedicated(requirements.size)) {
+            allocInfo.flags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+        }
+        else {
+            allocInfo.pool = choosePool(usage, requirements.memoryTypeBits, false);
+        }
+
+        VkMemoryRequirements rawRequirements = requirements;
+        VmaAllocationInfo info;
+        VkResult result = vmaAllocateMemory(m_allocator, &rawRequirements, &allocInfo, &buffer.allocation, &info);
+        if (result != VK_SUCCESS) {
+            m_device.destroyBuffer(buffer.buffer);
+            checkResult(result, "Allocating buffer memory");
+        }
+        checkResult(vmaBindBufferMemory(m_allocator, buffer.allocation, buffer.buffer), "Binding buffer memory");
+        buffer.mapped = info.pMappedData;
+
+        return buffer;
+    }
+
+    void GpuMemory::destroyBuffer(Buffer& buffer)
+    {
+        if (buffer.allocation != VK_NULL_HANDLE) {
+            vmaDestroyBuffer(m_allocator, buffer.buffer, buffer.allocation);
+        }
+        buffer = Buffer{};
+    }
+
+    Image GpuMemory::createImage(const vk::ImageCreateInfo& createInfo, MemoryUsage usage)
+    {
+        Image image{};
+        image.image = m_device.createImage(createInfo);
+
+        vk::MemoryRequirements requirements = m_device.getImageMemoryRequirements(image.image);
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = toVmaUsage(usage);
+        if (isDedicated(requirements.size)) {
+            allocInfo.flags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+        }
+        else {
+            allocInfo.pool = choosePool(usage, requirements.memoryTypeBits, true);
+        }
+
+        VkMemoryRequirements rawRequirements = requirements;
+        VkResult result = vmaAllocateMemory(m_allocator, &rawRequirements, &allocInfo, &image.allocation, nullptr);
+        if (result != VK_SUCCESS) {
+            m_device.destroyImage(image.image);
+            checkResult(result, "Allocating image memory");
+        }
+        checkResult(vmaBindImageMemory(m_allocator, image.allocation, image.image), "Binding image memory");
+
+        return image;
+    }
+
+    void GpuMemory::destroyImage(Image& image)
+    {
+        if (image.allocation != VK_NULL_HANDLE) {
+            vmaDestroyImage(m_allocator, image.image, image.allocation);
+        }
+        image = Image{};
+    }
+
+    VmaAllocation GpuMemory::allocateMemory(const vk::MemoryRequirements& requirements)
+    {
+        // Dedicated, so a whole block isn't pinned by memory that is only ever
+        // reallocated as a unit.
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+
+        VkMemoryRequirements rawRequirements = requirements;
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        checkResult(vmaAllocateMemory(m_allocator, &rawRequirements, &allocInfo, &allocation, nullptr), "Allocating memory");
+        return allocation;
+    }
+
+    void GpuMemory::freeMemory(VmaAllocation allocation)
+    {
+        if (allocation != VK_NULL_HANDLE) {
+            vmaFreeMemory(m_allocator, allocation);
+        }
+    }
+
+    void GpuMemory::bindImageMemory(VmaAllocation allocation, vk::DeviceSize offset, vk::Image image)
+    {
+        checkResult(vmaBindImageMemory2(m_allocator, allocation, offset, image, nullptr), "Binding image memory");
+    }
+
+    void GpuMemory::bindBufferMemory(VmaAllocation allocation, vk::DeviceSize offset, vk::Buffer buffer)
+    {
+        checkResult(vmaBindBufferMemory2(m_allocator, allocation, offset, buffer, nullptr), "Binding buffer memory");
+    }
+
+    MovableBufferHandle GpuMemory::createMovableBuffer(const vk::BufferCreateInfo& createInfo)
+    {
+        MovableBuffer movable{};
+        movable.createInfo = createInfo;
+        // GPU defragmentation copies with vkCmdCopyBuffer.
+        movable.createInfo.usage |= vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+        movable.createInfo.sharingMode = vk::SharingMode::eExclusive;
+        movable.createInfo.queueFamilyIndexCount = 0;
+        movable.createInfo.pQueueFamilyIndices = nullptr;
+
+        movable.buffer.size = createInfo.size;
+        movable.buffer.buffer = m_device.createBuffer(movable.createInfo);
+
+        VkMemoryRequirements requirements = m_device.getBufferMemoryRequirements(movable.buffer.buffer);
+
+        // Too big for the pool's blocks, such buffers stay where they are.
+        VmaAllocationCreateInfo allocInfo{};
+        movable.dedicated = isDedicated(requirements.size);
+        if (movable.dedicated) {
+            allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+        }
+        else {
+            allocInfo.pool = m_movablePool.pool;
+        }
+
+        VkResult result = vmaAllocateMemory(m_allocator, &requirements, &allocInfo, &movable.buffer.allocation, nullptr);
+        if (result != VK_SUCCESS) {
+            m_device.destroyBuffer(movable.buffer.buffer);
+            checkResult(result, "Allocating movable buffer memory");
+        }
+        checkResult(vmaBindBufferMemory(m_allocator, movable.buffer.allocation, movable.buffer.buffer), "Binding movable buffer memory");
+
+        std::lock_guard<std::mutex> lock{ m_movableMutex };
+        MovableBufferHandle handle{};
+        if (!m_freeMovableSlots.empty()) {
+            handle.index = m_freeMovableSlots.back();
+            m_freeMovableSlots.pop_back();
+            m_movableBuffers[handle.index] = movable;
+        }
+        else {
+            handle.index = uint32_t(m_movableBuffers.size());
+            m_movableBuffers.push_back(movable);
+        }
+        return handle;
+    }
+
+    void GpuMemory::unpinMovableBuffer(MovableBufferHandle handle)
+    {
+        std::lock_guard<std::mutex> lock{ m_movableMutex };
+        m_movableBuffers[handle.index].pinned = false;
+    }
+
+    Buffer GpuMemory::getMovableBuffer(MovableBufferHandle handle) const
+    {
+        std::lock_guard<std::mutex> lock{ m_movableMutex };
+        return m_movableBuffers[handle.index].buffer;
+    }
+
+    void GpuMemory::destroyMovableBuffer(MovableBufferHandle handle)
+    {
+        std::lock_guard<std::mutex> lock{ m_movableMutex };
+        destroyBuffer(m_movableBuffers[handle.index].buffer);
+        m_movableBuffers[handle.index].pinned = true;
+        m_freeMovableSlots.push_back(handle.index);
+    }
+
+    void GpuMemory::beginFrame(uint64_t frameIndex)
+    {
+        vmaSetCurrentFrameIndex(m_allocator, uint32_t(frameIndex));
+        m_frameRing.beginFrame(uint32_t(frameIndex % m_framesInFlight));
+    }
+
+    float GpuMemory::getFragmentation() const
+    {
+        VmaPoolStats stats{};
+        vmaGetPoolStats(m_allocator, m_movablePool.pool, &stats);
+        if (stats.unusedSize == 0) {
+            return 0.0f;
+        }
+        return 1.0f - float(stats.unusedRangeSizeMax) / float(stats.unusedSize);
+    }
+
+    bool GpuMemory::shouldDefragment(uint64_t frameIndex) const
+    {
+        if (m_config.defragInterval == 0 || frameIndex % m_config.defragInterval != 0) {
+            return false;
+        }
+        return getFragmentation() > m_config.defragThreshold;
+    }
+
+    uint32_t GpuMemory::defragment(vk::CommandBuffer commandBuffer, std::vector<Buffer>& moved)
+    {
+        std::lock_guard<std::mutex> lock{ m_movableMutex };
+
+        struct Candidate
+        {
+            uint32_t slot;
+            VkDeviceMemory memory;
+            vk::DeviceSize offset;
+        };
+        std::vector<Candidate> candidates;
+        std::vector<std::pair<VkDeviceMemory, vk::DeviceSize>> blockUsage;
+        for (uint32_t i = 0; i < m_movableBuffers.size(); ++i) {
+            const MovableBuffer& movable = m_movableBuffers[i];
+            if (movable.buffer.allocation == VK_NULL_HANDLE || movable.dedicated) {
+                continue;
+            }
+            VmaAllocationInfo info;
+            vmaGetAllocationInfo(m_allocator, movable.buffer.allocation, &info);
+
+            auto block = std::find_if(blockUsage.begin(), blockUsage.end(), [&info](const auto& usage) { return usage.first == info.deviceMemory; });
+            if (block == blockUsage.end()) {
+                blockUsage.emplace_back(info.deviceMemory, 0);
+                block = blockUsage.end() - 1;
+            }
+            block->second += info.size;
+            if (!movable.pinned) {
+                candidates.push_back(Candidate{ i, info.deviceMemory, info.offset });
+            }
+        }
+
+        // Empty the least used block that has something to move, last allocation
+        // first. Emptied blocks are released by VMA once the old copies are freed.
+        VkDeviceMemory source = VK_NULL_HANDLE;
+        vk::DeviceSize sourceUsage = VK_WHOLE_SIZE;
+        for (const Candidate& candidate : candidates) {
+            for (const auto& usage : blockUsage) {
+                if (usage.first == candidate.memory && usage.second < sourceUsage) {
+                    source = usage.first;
+                    sourceUsage = usage.second;
+                }
+            }
+        }
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [source](const Candidate& candidate) {
+            return candidate.memory != source;
+        }), candidates.end());
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.offset > b.offset; });
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.pool = m_movablePool.pool;
+        // Growing the pool to defragment it would defeat the purpose.
+        allocInfo.flags = VMA_ALLOCATION_CREATE_NEVER_ALLOCATE_BIT | VMA_ALLOCATION_CREATE_STRATEGY_MIN_MEMORY_BIT;
+
+        vk::DeviceSize bytesMoved = 0;
+        uint32_t movedCount = 0;
+        for (const Candidate& candidate : candidates) {
+            MovableBuffer& movable = m_movableBuffers[candidate.slot];
+            if (bytesMoved + movable.buffer.size > m_config.defragBytesPerStep) {
+                break;
+            }
+
+            Buffer target{};
+            target.size = movable.buffer.size;
+            target.buffer = m_device.createBuffer(movable.createInfo);
+            VkMemoryRequirements requirements = m_device.getBufferMemoryRequirements(target.buffer);
+            VmaAllocationInfo info;
+            if (vmaAllocateMemory(m_allocator, &requirements, &allocInfo, &target.allocation, &info) != VK_SUCCESS) {
+                m_device.destroyBuffer(target.buffer);
+                break;
+            }
+            // Only a move into another block or further down this one helps.
+            if (info.deviceMemory == candidate.memory && info.offset > candidate.offset) {
+                vmaDestroyBuffer(m_allocator, target.buffer, target.allocation);
+                break;
+            }
+            checkResult(vmaBindBufferMemory(m_allocator, target.allocation, target.buffer), "Binding moved buffer");
+
+            if (movedCount == 0) {
+                vk::MemoryBarrier before{
+                    vk::AccessFlagBits::eMemoryWrite,
+                    vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite,
+                };
+                commandBuffer.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eAllCommands,
+                    vk::PipelineStageFlagBits::eTransfer,
+                    vk::DependencyFlags{},
+                    before, nullptr, nullptr
+                );
+            }
+            commandBuffer.copyBuffer(movable.buffer.buffer, target.buffer, vk::BufferCopy{ 0, 0, target.size });
+
+            moved.push_back(movable.buffer);
+            movable.buffer = target;
+            bytesMoved += target.size;
+            ++movedCount;
+        }
+
+        if (movedCount > 0) {
+            vk::MemoryBarrier after{
+                vk::AccessFlagBits::eTransferWrite,
+                vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite,
+            };
+            commandBuffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eAllCommands,
+                vk::DependencyFlags{},
+                after, nullptr, nullptr
+            );
+        }
+
+        m_defragTotals.steps += 1;
+        m_defragTotals.bytesMoved += bytesMoved;
+        m_defragTotals.allocationsMoved += movedCount;
+        return movedCount;
+    }
+
+    std::vector<HeapBudget> GpuMemory::queryBudget() const
+    {
+        vk::PhysicalDeviceMemoryBudgetPropertiesEXT budgetProps{};
+        vk::PhysicalDeviceMemoryProperties2 memProps2{};
+        if (m_memoryBudgetSupported) {
+            memProps2.pNext = &budgetProps;
+        }
+        m_physicalDevice.getMemoryProperties2(&memProps2);
+        const vk::PhysicalDeviceMemoryProperties& memProps = memProps2.memoryProperties;
+
+        VmaStats stats{};
+        vmaCalculateStats(m_allocator, &stats);
+
+        std::vector<HeapBudget> budgets(memProps.memoryHeapCount);
+        for (uint32_t i = 0; i < memProps.memoryHeapCount; ++i) {
+            HeapBudget& budget = budgets[i];
+            budget.size = memProps.memoryHeaps[i].size;
+            budget.deviceLocal = bool(memProps.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+            budget.blockBytes = stats.memoryHeap[i].usedBytes + stats.memoryHeap[i].unusedBytes;
+
+            if (m_memoryBudgetSupported) {
+                budget.budget = budgetProps.heapBudget[i];
+                budget.usage = budgetProps.heapUsage[i];
+            }
+            else {
+                budget.budget = budget.size * 8 / 10;
+                budget.usage = budget.blockBytes;
+            }
+        }
+        return budgets;
+    }
+
+    bool GpuMemory::isWithinBudget(float fraction) const
+    {
+        for (const HeapBudget& budget : queryBudget()) {
+            if (double(budget.usage) > double(budget.budget) * fraction) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void GpuMemory::logBudget() const
+    {
+        std::vector<HeapBudget> budgets = queryBudget();
+        for (size_t i = 0; i < budgets.size(); ++i) {
+            std::string message = "Heap ";
+            message.append(std::to_string(i))
+                .append(budgets[i].deviceLocal ? " (device local)" : "")
+                .append(": usage ").append(std::to_string(budgets[i].usage >> 20))
+                .append(" MiB / budget ").append(std::to_string(budgets[i].budget >> 20))
+                .append(" MiB, VMA blocks ").append(std::to_string(budgets[i].blockBytes >> 20))
+                .append(" MiB");
+            debugLog(message.c_str());
+        }
+    }
+
+    std::string GpuMemory::buildStatsJson() const
+    {
+        JsonWriter json;
+        json.beginObject();
+        json.field("memory_budget_extension", m_memoryBudgetSupported);
+
+        json.key("heaps");
+        json.beginArray();
+        for (const HeapBudget& budget : queryBudget()) {
+            json.beginObject();
+            json.field("size", uint64_t(budget.size));
+            json.field("budget", uint64_t(budget.budget));
+            json.field("usage", uint64_t(budget.usage));
+            json.field("block_bytes", uint64_t(budget.blockBytes));
+            json.field("device_local", budget.deviceLocal);
+            json.endObject();
+        }
+        json.endArray();
+
+        json.key("pools");
+        json.beginObject();
+        for (const Pool* pool : { &m_bufferPool, &m_imagePool, &m_uploadPool, &m_movablePool }) {
+            VmaPoolStats stats{};
+            vmaGetPoolStats(m_allocator, pool->pool, &stats);
+            json.key(pool->name);
+            json.beginObject();
+            json.field("memory_type", pool->memoryTypeIndex);
+            json.field("size", uint64_t(stats.size));
+            json.field("unused_size", uint64_t(stats.unusedSize));
+            json.field("allocation_count", uint64_t(stats.allocationCount));
+            json.field("block_count", uint64_t(stats.blockCount));
+            json.endObject();
+        }
+        json.endObject();
+
+        json.key("frame_ring");
+        json.beginObject();
+        json.field("region_size", uint64_t(m_frameRing.getRegionSize()));
+        json.field("high_water_mark", uint64_t(m_frameRing.getHighWaterMark()));
+        json.endObject();
+
+        json.key("defragmentation");
+        json.beginObject();
+        json.field("fragmentation", getFragmentation());
+        json.field("steps", m_defragTotals.steps);
+        json.field("bytes_moved", m_defragTotals.bytesMoved);
+        json.field("allocations_moved", m_defragTotals.allocationsMoved);
+        json.endObject();
+
+        char* vmaStats = nullptr;
+        vmaBuildStatsString(m_allocator, &vmaStats, VK_TRUE);
+        json.key("vma");
+        json.raw(vmaStats);
+        vmaFreeStatsString(m_allocator, vmaStats);
+
+        json.endObject();
+        return json.str();
+    }
+}
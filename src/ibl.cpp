@@ -0,0 +1,882 @@
+#include "ibl.h"
+#include "job_system.h"
+#include "ktx2.h"
+#include "mapped_file.h"
+#include "renderer.h"
+#include "utils.h"
+
+#include <vma/vk_mem_alloc.h>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        // Part of every cache key. Bump when the bakes' output changes.
+        const uint32_t kIblCacheVersion = 1;
+        const float kPi = 3.14159265358979f;
+        const float kMaxHalf = 65504.0f;
+
+        // Matches BrdfConstants in shaders/ibl_brdf.comp.
+        struct BrdfConstants
+        {
+            uint32_t size;
+            uint32_t sampleCount;
+        };
+
+        // Matches IrradianceConstants in shaders/ibl_irradiance.comp.
+        struct IrradianceConstants
+        {
+            uint32_t level;
+        };
+
+        // Matches SpecularConstants in shaders/ibl_specular.comp.
+        struct SpecularConstants
+        {
+            uint32_t faceSize;
+            uint32_t outputOffset;
+            float roughness;
+            uint32_t sampleCount;
+            uint32_t levelCount;
+            float texelSolidAngle;
+        };
+
+        // The environment and its box filtered mips, laid out like the
+        // EnvironmentTexels and EnvironmentLevels buffers of shaders/ibl.glsl.
+        struct EnvironmentPyramid
+        {
+            std::vector<glm::vec4> texels;
+            // Offset in texels, width and height of each mip.
+            std::vector<glm::uvec4> levels;
+        };
+
+        void validateConfig(const IblConfig& config)
+        {
+            if (config.brdfLutSize == 0 || config.brdfSamples == 0 || config.specularSize == 0 || config.specularMips == 0 ||
+                config.specularSamples == 0 || config.irradianceWidth == 0 || (config.specularSize >> (config.specularMips - 1)) == 0) {
+                throw std::runtime_error("Invalid IBL configuration");
+            }
+        }
+
+        EnvironmentPyramid buildPyramid(const DecodedHdrImage& environment)
+        {
+            if (environment.width == 0 || environment.height == 0) {
+                throw std::runtime_error("Empty IBL environment");
+            }
+
+            EnvironmentPyramid pyramid;
+            uint32_t width = environment.width;
+            uint32_t height = environment.height;
+            pyramid.levels.push_back(glm::uvec4(0, width, height, 0));
+            pyramid.texels.resize(size_t(width) * height);
+            memcpy(pyramid.texels.data(), environment.rgba.data(), pyramid.texels.size() * sizeof(glm::vec4));
+
+            while (width > 1 || height > 1) {
+                uint32_t source = uint32_t(pyramid.texels.size()) - width * height;
+                uint32_t nextWidth = std::max(width / 2, 1u);
+                uint32_t nextHeight = std::max(height / 2, 1u);
+                pyramid.levels.push_back(glm::uvec4(uint32_t(pyramid.texels.size()), nextWidth, nextHeight, 0));
+                for (uint32_t y = 0; y < nextHeight; ++y) {
+                    uint32_t y0 = std::min(y * 2, height - 1);
+                    uint32_t y1 = std::min(y * 2 + 1, height - 1);
+                    for (uint32_t x = 0; x < nextWidth; ++x) {
+                        uint32_t x0 = std::min(x * 2, width - 1);
+                        uint32_t x1 = std::min(x * 2 + 1, width - 1);
+                        const glm::vec4* texels = pyramid.texels.data() + source;
+                        glm::vec4 sum = texels[y0 * width + x0] + texels[y0 * width + x1] + texels[y1 * width + x0] + texels[y1 * width + x1];
+                        pyramid.texels.push_back(sum * 0.25f);
+                    }
+                }
+                width = nextWidth;
+                height = nextHeight;
+            }
+            return pyramid;
+        }
+
+        uint32_t findIrradianceLevel(const EnvironmentPyramid& pyramid, uint32_t maxWidth)
+        {
+            uint32_t level = 0;
+            while (level + 1 < pyramid.levels.size() && pyramid.levels[level].y > maxWidth) {
+                ++level;
+            }
+            return level;
+        }
+
+        // Offsets of each specular mip in texels, followed by the total.
+        std::vector<uint32_t> getSpecularOffsets(const IblConfig& config)
+        {
+            std::vector<uint32_t> offsets;
+            uint32_t offset = 0;
+            for (uint32_t mip = 0; mip < config.specularMips; ++mip) {
+                offsets.push_back(offset);
+                uint32_t size = config.specularSize >> mip;
+                offset += 6 * size * size;
+            }
+            offsets.push_back(offset);
+            return offsets;
+        }
+
+        float getRoughness(const IblConfig& config, uint32_t mip)
+        {
+            return config.specularMips > 1 ? float(mip) / float(config.specularMips - 1) : 0.0f;
+        }
+
+        // C++ twins of shaders/ibl.glsl.
+
+        glm::vec2 directionToEquirect(const glm::vec3& direction)
+        {
+            return glm::vec2(std::atan2(direction.z, direction.x) / (2.0f * kPi) + 0.5f, std::acos(glm::clamp(direction.y, -1.0f, 1.0f)) / kPi);
+        }
+
+        glm::vec3 equirectToDirection(const glm::vec2& uv)
+        {
+            float phi = (uv.x - 0.5f) * 2.0f * kPi;
+            float theta = uv.y * kPi;
+            return glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+        }
+
+        glm::vec3 cubeDirection(uint32_t face, const glm::vec2& uv)
+        {
+            float s = uv.x * 2.0f - 1.0f;
+            float t = uv.y * 2.0f - 1.0f;
+            glm::vec3 direction;
+            switch (face) {
+            case 0: direction = glm::vec3(1.0f, -t, -s); break;
+            case 1: direction = glm::vec3(-1.0f, -t, s); break;
+            case 2: direction = glm::vec3(s, 1.0f, t); break;
+            case 3: direction = glm::vec3(s, -1.0f, -t); break;
+            case 4: direction = glm::vec3(s, -t, 1.0f); break;
+            default: direction = glm::vec3(-s, -t, -1.0f); break;
+            }
+            return glm::normalize(direction);
+        }
+
+        glm::vec3 sampleLevel(const EnvironmentPyramid& pyramid, uint32_t level, const glm::vec2& uv)
+        {
+            const glm::uvec4& info = pyramid.levels[level];
+            int width = int(info.y);
+            int height = int(info.z);
+            float x = uv.x * float(width) - 0.5f;
+            float y = uv.y * float(height) - 0.5f;
+            float x0 = std::floor(x);
+            float y0 = std::floor(y);
+            float fx = x - x0;
+            float fy = y - y0;
+
+            int left = ((int(x0) % width) + width) % width;
+            int right = (left + 1) % width;
+            int top = glm::clamp(int(y0), 0, height - 1);
+            int bottom = glm::clamp(int(y0) + 1, 0, height - 1);
+            const glm::vec4* texels = pyramid.texels.data() + info.x;
+            glm::vec3 topRow = glm::mix(glm::vec3(texels[top * width + left]), glm::vec3(texels[top * width + right]), fx);
+            glm::vec3 bottomRow = glm::mix(glm::vec3(texels[bottom * width + left]), glm::vec3(texels[bottom * width + right]), fx);
+            return glm::mix(topRow, bottomRow, fy);
+        }
+
+        glm::vec3 sampleEnvironment(const EnvironmentPyramid& pyramid, const glm::vec3& direction, float lod)
+        {
+            uint32_t levelCount = uint32_t(pyramid.levels.size());
+            glm::vec2 uv = directionToEquirect(direction);
+            lod = glm::clamp(lod, 0.0f, float(levelCount - 1));
+            uint32_t lower = uint32_t(lod);
+            uint32_t upper = std::min(lower + 1, levelCount - 1);
+            return glm::mix(sampleLevel(pyramid, lower, uv), sampleLevel(pyramid, upper, uv), lod - float(lower));
+        }
+
+        float radicalInverse(uint32_t bits)
+        {
+            bits = (bits << 16u) | (bits >> 16u);
+            bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+            bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+            bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+            bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+            return float(bits) * 2.3283064365386963e-10f;
+        }
+
+        glm::vec2 hammersley(uint32_t i, uint32_t count)
+        {
+            return glm::vec2(float(i) / float(count), radicalInverse(i));
+        }
+
+        glm::vec3 importanceSampleGgx(const glm::vec2& xi, const glm::vec3& normal, float roughness)
+        {
+            float alpha = roughness * roughness;
+            float phi = 2.0f * kPi * xi.x;
+            float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (alpha * alpha - 1.0f) * xi.y));
+            float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+
+            glm::vec3 up = std::abs(normal.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+            glm::vec3 tangent = glm::normalize(glm::cross(up, normal));
+            glm::vec3 bitangent = glm::cross(normal, tangent);
+            return glm::normalize(tangent * (sinTheta * std::cos(phi)) + bitangent * (sinTheta * std::sin(phi)) + normal * cosTheta);
+        }
+
+        float distributionGgx(float nDotH, float roughness)
+        {
+            float alpha = roughness * roughness;
+            float alpha2 = alpha * alpha;
+            float denominator = nDotH * nDotH * (alpha2 - 1.0f) + 1.0f;
+            return alpha2 / (kPi * denominator * denominator);
+        }
+
+        float geometrySmith(float nDotV, float nDotL, float roughness)
+        {
+            float k = roughness * roughness * 0.5f;
+            return (nDotV / (nDotV * (1.0f - k) + k)) * (nDotL / (nDotL * (1.0f - k) + k));
+        }
+
+        // C++ twins of the compute shaders' main().
+
+        glm::vec2 integrateBrdf(uint32_t x, uint32_t y, uint32_t size, uint32_t sampleCount)
+        {
+            float nDotV = (float(x) + 0.5f) / float(size);
+            float roughness = (float(y) + 0.5f) / float(size);
+            glm::vec3 view{ std::sqrt(1.0f - nDotV * nDotV), 0.0f, nDotV };
+            glm::vec3 normal{ 0.0f, 0.0f, 1.0f };
+
+            float scale = 0.0f;
+            float bias = 0.0f;
+            for (uint32_t i = 0; i < sampleCount; ++i) {
+                glm::vec3 halfVector = importanceSampleGgx(hammersley(i, sampleCount), normal, roughness);
+                glm::vec3 light = 2.0f * glm::dot(view, halfVector) * halfVector - view;
+                float nDotL = std::max(light.z, 0.0f);
+                if (nDotL > 0.0f) {
+                    float nDotH = std::max(halfVector.z, 0.0f);
+                    float vDotH = std::max(glm::dot(view, halfVector), 0.0f);
+                    float visibility = geometrySmith(nDotV, nDotL, roughness) * vDotH / (nDotH * nDotV);
+                    float fresnel = std::pow(1.0f - vDotH, 5.0f);
+                    scale += (1.0f - fresnel) * visibility;
+                    bias += fresnel * visibility;
+                }
+            }
+            return glm::vec2(scale, bias) / float(sampleCount);
+        }
+
+        void projectRow(const EnvironmentPyramid& pyramid, uint32_t level, uint32_t row, glm::vec4* sums)
+        {
+            const glm::uvec4& info = pyramid.levels[level];
+            uint32_t width = info.y;
+            uint32_t height = info.z;
+            float theta = kPi * (float(row) + 0.5f) / float(height);
+            float solidAngle = (2.0f * kPi / float(width)) * (kPi / float(height)) * std::sin(theta);
+
+            glm::vec3 rowSums[9] = {};
+            for (uint32_t x = 0; x < width; ++x) {
+                glm::vec3 radiance = glm::vec3(pyramid.texels[info.x + row * width + x]) * solidAngle;
+                glm::vec3 d = equirectToDirection(glm::vec2((float(x) + 0.5f) / float(width), (float(row) + 0.5f) / float(height)));
+                rowSums[0] += radiance * 0.282095f;
+                rowSums[1] += radiance * (0.488603f * d.y);
+                rowSums[2] += radiance * (0.488603f * d.z);
+                rowSums[3] += radiance * (0.488603f * d.x);
+                rowSums[4] += radiance * (1.092548f * d.x * d.y);
+                rowSums[5] += radiance * (1.092548f * d.y * d.z);
+                rowSums[6] += radiance * (0.315392f * (3.0f * d.z * d.z - 1.0f));
+                rowSums[7] += radiance * (1.092548f * d.x * d.z);
+                rowSums[8] += radiance * (0.546274f * (d.x * d.x - d.y * d.y));
+            }
+            for (uint32_t i = 0; i < 9; ++i) {
+                sums[i] = glm::vec4(rowSums[i], 0.0f);
+            }
+        }
+
+        glm::vec3 prefilterSpecular(const EnvironmentPyramid& pyramid, const glm::vec3& normal, const SpecularConstants& params)
+        {
+            if (params.roughness == 0.0f) {
+                return sampleEnvironment(pyramid, normal, 0.0f);
+            }
+            glm::vec3 sum{ 0.0f };
+            float weight = 0.0f;
+            for (uint32_t i = 0; i < params.sampleCount; ++i) {
+                glm::vec3 halfVector = importanceSampleGgx(hammersley(i, params.sampleCount), normal, params.roughness);
+                glm::vec3 light = 2.0f * glm::dot(normal, halfVector) * halfVector - normal;
+                float nDotL = glm::dot(normal, light);
+                if (nDotL > 0.0f) {
+                    float nDotH = std::max(glm::dot(normal, halfVector), 0.0f);
+                    float pdf = distributionGgx(nDotH, params.roughness) * 0.25f + 0.0001f;
+                    float sampleSolidAngle = 1.0f / (float(params.sampleCount) * pdf + 0.0001f);
+                    float lod = 0.5f * std::log2(sampleSolidAngle / params.texelSolidAngle) + 1.0f;
+                    sum += sampleEnvironment(pyramid, light, lod) * nDotL;
+                    weight += nDotL;
+                }
+            }
+            return sum / std::max(weight, 0.0001f);
+        }
+
+        SpecularConstants getSpecularConstants(const IblConfig& config, const EnvironmentPyramid& pyramid, uint32_t mip, uint32_t outputOffset)
+        {
+            SpecularConstants params{};
+            params.faceSize = config.specularSize >> mip;
+            params.outputOffset = outputOffset;
+            params.roughness = getRoughness(config, mip);
+            params.sampleCount = config.specularSamples;
+            params.levelCount = uint32_t(pyramid.levels.size());
+            params.texelSolidAngle = 4.0f * kPi / (float(pyramid.levels[0].y) * float(pyramid.levels[0].z));
+            return params;
+        }
+
+        uint16_t toHalf(float value)
+        {
+            // NaN becomes 0, and anything brighter than half can hold saturates.
+            if (!(value == value)) {
+                value = 0.0f;
+            }
+            return glm::packHalf1x16(glm::clamp(value, -kMaxHalf, kMaxHalf));
+        }
+
+        // Turns what both bakes produce into IblData: the table and cube map in
+        // half precision, the per-row SH sums added up and convolved.
+        IblData packResults(const IblConfig& config, const glm::vec2* lut, const glm::vec4* rowSums, uint32_t rows, const glm::vec4* specular)
+        {
+            IblData data;
+            data.brdfLutSize = config.brdfLutSize;
+            size_t lutTexels = size_t(config.brdfLutSize) * config.brdfLutSize;
+            data.brdfLut.resize(lutTexels * 2);
+            for (size_t i = 0; i < lutTexels; ++i) {
+                data.brdfLut[i * 2] = toHalf(lut[i].x);
+                data.brdfLut[i * 2 + 1] = toHalf(lut[i].y);
+            }
+
+            // Convolution with the clamped cosine scales each band.
+            const double bandScales[3] = { kPi, 2.0 * kPi / 3.0, kPi / 4.0 };
+            for (uint32_t i = 0; i < 9; ++i) {
+                double sum[3] = {};
+                for (uint32_t row = 0; row < rows; ++row) {
+                    const glm::vec4& rowSum = rowSums[row * 9 + i];
+                    sum[0] += rowSum.x;
+                    sum[1] += rowSum.y;
+                    sum[2] += rowSum.z;
+                }
+                double scale = bandScales[i == 0 ? 0 : i < 4 ? 1 : 2];
+                data.irradianceSH[i] = glm::vec3(float(sum[0] * scale), float(sum[1] * scale), float(sum[2] * scale));
+            }
+
+            data.specularSize = config.specularSize;
+            std::vector<uint32_t> offsets = getSpecularOffsets(config);
+            for (uint32_t mip = 0; mip < config.specularMips; ++mip) {
+                std::vector<uint16_t>& texels = data.specular.emplace_back();
+                texels.resize(size_t(offsets[mip + 1] - offsets[mip]) * 4);
+                const float* source = &specular[offsets[mip]].x;
+                for (size_t i = 0; i < texels.size(); ++i) {
+                    texels[i] = toHalf(source[i]);
+                }
+            }
+            return data;
+        }
+
+        vk::DescriptorSet allocateSet(vk::Device device, vk::DescriptorPool pool, vk::DescriptorSetLayout layout)
+        {
+            return device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{ pool, 1, &layout })[0];
+        }
+
+        std::string getCachePath(const IblConfig& config, uint64_t key, const char* part)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "ibl_v%u_%016llx_%s.ktx2", kIblCacheVersion, static_cast<unsigned long long>(key), part);
+            return (std::filesystem::path{ config.cacheDirectory } / name).string();
+        }
+
+        double elapsedMs(std::chrono::high_resolution_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+    }
+
+    const char* toString(IblSource source)
+    {
+        switch (source) {
+        case IblSource::eCache: return "cache";
+        case IblSource::eGpu: return "gpu";
+        case IblSource::eCpu: return "cpu";
+        }
+        return "unknown";
+    }
+
+    uint64_t computeIblKey(const uint8_t* source, size_t size, const IblConfig& config)
+    {
+        // FNV-1a, over the source and then the settings.
+        uint64_t hash = 0xCBF29CE484222325ull;
+        auto add = [&hash](const void* data, size_t bytes) {
+            const uint8_t* p = static_cast<const uint8_t*>(data);
+            for (size_t i = 0; i < bytes; ++i) {
+                hash = (hash ^ p[i]) * 0x100000001B3ull;
+            }
+        };
+        add(source, size);
+        const uint32_t settings[] = {
+            kIblCacheVersion,
+            config.brdfLutSize,
+            config.brdfSamples,
+            config.specularSize,
+            config.specularMips,
+            config.specularSamples,
+            config.irradianceWidth,
+        };
+        add(settings, sizeof(settings));
+        return hash;
+    }
+
+    IblData bakeIblCpu(const DecodedHdrImage& environment, const IblConfig& config, JobSystem& jobs)
+    {
+        BVR_PROFILE_ZONE("ibl_bake_cpu");
+        validateConfig(config);
+        EnvironmentPyramid pyramid = buildPyramid(environment);
+        uint32_t irradianceLevel = findIrradianceLevel(pyramid, config.irradianceWidth);
+        uint32_t rows = pyramid.levels[irradianceLevel].z;
+        std::vector<uint32_t> offsets = getSpecularOffsets(config);
+
+        std::vector<glm::vec2> lut(size_t(config.brdfLutSize) * config.brdfLutSize);
+        std::vector<glm::vec4> rowSums(size_t(rows) * 9);
+        std::vector<glm::vec4> specular(offsets.back());
+
+        // Everything goes to the job system at once, in rows.
+        JobCounter counter;
+        jobs.parallelFor(config.brdfLutSize, 1, [&lut, &config](uint32_t begin, uint32_t end) {
+            for (uint32_t y = begin; y < end; ++y) {
+                for (uint32_t x = 0; x < config.brdfLutSize; ++x) {
+                    lut[y * config.brdfLutSize + x] = integrateBrdf(x, y, config.brdfLutSize, config.brdfSamples);
+                }
+            }
+        }, counter);
+        jobs.parallelFor(rows, 8, [&pyramid, &rowSums, irradianceLevel](uint32_t begin, uint32_t end) {
+            for (uint32_t row = begin; row < end; ++row) {
+                projectRow(pyramid, irradianceLevel, row, &rowSums[row * 9]);
+            }
+        }, counter);
+        for (uint32_t mip = 0; mip < config.specularMips; ++mip) {
+            SpecularConstants params = getSpecularConstants(config, pyramid, mip, offsets[mip]);
+            // Rows of all six faces.
+            jobs.parallelFor(6 * params.faceSize, 1, [&pyramid, &specular, params](uint32_t begin, uint32_t end) {
+                for (uint32_t faceRow = begin; faceRow < end; ++faceRow) {
+                    uint32_t face = faceRow / params.faceSize;
+                    uint32_t y = faceRow % params.faceSize;
+                    for (uint32_t x = 0; x < params.faceSize; ++x) {
+                        glm::vec2 uv = (glm::vec2(float(x), float(y)) + 0.5f) / float(params.faceSize);
+                        glm::vec3 color = prefilterSpecular(pyramid, cubeDirection(face, uv), params);
+                        specular[params.outputOffset + faceRow * params.faceSize + x] = glm::vec4(color, 1.0f);
+                    }
+                }
+            }, counter);
+        }
+        jobs.wait(counter);
+
+        return packResults(config, lut.data(), rowSums.data(), rows, specular.data());
+    }
+
+    IblData bakeIblGpu(Renderer& renderer, const DecodedHdrImage& environment, const IblConfig& config)
+    {
+        BVR_PROFILE_ZONE("ibl_bake_gpu");
+        validateConfig(config);
+        EnvironmentPyramid pyramid = buildPyramid(environment);
+        uint32_t irradianceLevel = findIrradianceLevel(pyramid, config.irradianceWidth);
+        uint32_t rows = pyramid.levels[irradianceLevel].z;
+        std::vector<uint32_t> offsets = getSpecularOffsets(config);
+
+        vk::Device device = renderer.getDevice();
+        GpuMemory& memory = renderer.getMemory();
+        PipelineCache& pipelines = renderer.getPipelines();
+
+        // The environment is read straight from host visible memory, it is
+        // only sampled by a handful of dispatches.
+        const vk::BufferUsageFlags outputUsage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc;
+        vk::DeviceSize texelBytes = pyramid.texels.size() * sizeof(glm::vec4);
+        vk::DeviceSize levelBytes = pyramid.levels.size() * sizeof(glm::uvec4);
+        vk::DeviceSize lutBytes = vk::DeviceSize(config.brdfLutSize) * config.brdfLutSize * sizeof(glm::vec2);
+        vk::DeviceSize rowBytes = vk::DeviceSize(rows) * 9 * sizeof(glm::vec4);
+        vk::DeviceSize specularBytes = vk::DeviceSize(offsets.back()) * sizeof(glm::vec4);
+        Buffer texels = memory.createBuffer(vk::BufferCreateInfo{ vk::BufferCreateFlags{}, texelBytes, vk::BufferUsageFlagBits::eStorageBuffer }, MemoryUsage::eUpload);
+        Buffer levels = memory.createBuffer(vk::BufferCreateInfo{ vk::BufferCreateFlags{}, levelBytes, vk::BufferUsageFlagBits::eStorageBuffer }, MemoryUsage::eUpload);
+        Buffer lut = memory.createBuffer(vk::BufferCreateInfo{ vk::BufferCreateFlags{}, lutBytes, outputUsage }, MemoryUsage::eGpuOnly);
+        Buffer rowSums = memory.createBuffer(vk::BufferCreateInfo{ vk::BufferCreateFlags{}, rowBytes, outputUsage }, MemoryUsage::eGpuOnly);
+        Buffer specular = memory.createBuffer(vk::BufferCreateInfo{ vk::BufferCreateFlags{}, specularBytes, outputUsage }, MemoryUsage::eGpuOnly);
+        Buffer readback = memory.createBuffer(
+            vk::BufferCreateInfo{ vk::BufferCreateFlags{}, lutBytes + rowBytes + specularBytes, vk::BufferUsageFlagBits::eTransferDst },
+            MemoryUsage::eReadback
+        );
+        memcpy(texels.mapped, pyramid.texels.data(), texelBytes);
+        memcpy(levels.mapped, pyramid.levels.data(), levelBytes);
+
+        using Type = vk::DescriptorType;
+        const vk::ShaderStageFlags compute = vk::ShaderStageFlagBits::eCompute;
+        std::array<vk::DescriptorSetLayoutBinding, 3> bindings{
+            vk::DescriptorSetLayoutBinding{ 0, Type::eStorageBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 1, Type::eStorageBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 2, Type::eStorageBuffer, 1, compute },
+        };
+        vk::DescriptorSetLayout setLayout = pipelines.getDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{
+            vk::DescriptorSetLayoutCreateFlags{}, uint32_t(bindings.size()), bindings.data() });
+        // One range covering the largest of the three shaders' constants.
+        vk::PushConstantRange pushConstants{ compute, 0, sizeof(SpecularConstants) };
+        vk::PipelineLayout pipelineLayout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+            vk::PipelineLayoutCreateFlags{}, 1, &setLayout, 1, &pushConstants });
+        auto createPipeline = [&](const char* shader) {
+            return pipelines.getComputePipeline(vk::ComputePipelineCreateInfo{
+                vk::PipelineCreateFlags{},
+                vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eCompute, renderer.createEmbeddedShaderModule(shader), "main" },
+                pipelineLayout,
+            });
+        };
+        vk::Pipeline brdfPipeline = createPipeline("ibl_brdf.comp");
+        vk::Pipeline irradiancePipeline = createPipeline("ibl_irradiance.comp");
+        vk::Pipeline specularPipeline = createPipeline("ibl_specular.comp");
+
+        // One set per output, all sharing the environment.
+        vk::DescriptorPoolSize poolSize{ Type::eStorageBuffer, 9 };
+        vk::DescriptorPool pool = device.createDescriptorPool(vk::DescriptorPoolCreateInfo{ vk::DescriptorPoolCreateFlags{}, 3, 1, &poolSize });
+        std::array<vk::DescriptorSet, 3> sets{};
+        std::array<vk::Buffer, 3> outputs{ lut.buffer, rowSums.buffer, specular.buffer };
+        for (size_t i = 0; i < sets.size(); ++i) {
+            sets[i] = allocateSet(device, pool, setLayout);
+            std::array<vk::DescriptorBufferInfo, 3> infos{
+                vk::DescriptorBufferInfo{ texels.buffer, 0, VK_WHOLE_SIZE },
+                vk::DescriptorBufferInfo{ levels.buffer, 0, VK_WHOLE_SIZE },
+                vk::DescriptorBufferInfo{ outputs[i], 0, VK_WHOLE_SIZE },
+            };
+            device.updateDescriptorSets(vk::WriteDescriptorSet{ sets[i], 0, 0, 3, Type::eStorageBuffer, nullptr, infos.data() }, nullptr);
+        }
+
+        renderer.immediateSubmit([&](vk::CommandBuffer commandBuffer) {
+            BrdfConstants brdfParams{ config.brdfLutSize, config.brdfSamples };
+            uint32_t lutGroups = (config.brdfLutSize + 7) / 8;
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, brdfPipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, sets[0], nullptr);
+            commandBuffer.pushConstants(pipelineLayout, compute, 0, sizeof(brdfParams), &brdfParams);
+            commandBuffer.dispatch(lutGroups, lutGroups, 1);
+
+            IrradianceConstants irradianceParams{ irradianceLevel };
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, irradiancePipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, sets[1], nullptr);
+            commandBuffer.pushConstants(pipelineLayout, compute, 0, sizeof(irradianceParams), &irradianceParams);
+            commandBuffer.dispatch(rows, 1, 1);
+
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, specularPipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, sets[2], nullptr);
+            for (uint32_t mip = 0; mip < config.specularMips; ++mip) {
+                SpecularConstants params = getSpecularConstants(config, pyramid, mip, offsets[mip]);
+                uint32_t groups = (params.faceSize + 7) / 8;
+                commandBuffer.pushConstants(pipelineLayout, compute, 0, sizeof(params), &params);
+                commandBuffer.dispatch(groups, groups, 6);
+            }
+
+            commandBuffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eComputeShader,
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::DependencyFlags{},
+                vk::MemoryBarrier{ vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead },
+                nullptr, nullptr
+            );
+            commandBuffer.copyBuffer(lut.buffer, readback.buffer, vk::BufferCopy{ 0, 0, lutBytes });
+            commandBuffer.copyBuffer(rowSums.buffer, readback.buffer, vk::BufferCopy{ 0, lutBytes, rowBytes });
+            commandBuffer.copyBuffer(specular.buffer, readback.buffer, vk::BufferCopy{ 0, lutBytes + rowBytes, specularBytes });
+            commandBuffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eHost,
+                vk::DependencyFlags{},
+                vk::MemoryBarrier{ vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead },
+                nullptr, nullptr
+            );
+        });
+
+        vmaInvalidateAllocation(memory.getAllocator(), readback.allocation, 0, VK_WHOLE_SIZE);
+        const uint8_t* results = static_cast<const uint8_t*>(readback.mapped);
+        IblData data = packResults(
+            config,
+            reinterpret_cast<const glm::vec2*>(results),
+            reinterpret_cast<const glm::vec4*>(results + lutBytes),
+            rows,
+            reinterpret_cast<const glm::vec4*>(results + lutBytes + rowBytes)
+        );
+
+        // immediateSubmit() waited, nothing uses these anymore.
+        device.destroyDescriptorPool(pool);
+        for (Buffer* buffer : { &texels, &levels, &lut, &rowSums, &specular, &readback }) {
+            memory.destroyBuffer(*buffer);
+        }
+        return data;
+    }
+
+    bool readIblCache(const IblConfig& config, uint64_t key, IblData& data)
+    {
+        std::string brdfPath = getCachePath(config, key, "brdf");
+        std::string irradiancePath = getCachePath(config, key, "irradiance");
+        std::string specularPath = getCachePath(config, key, "specular");
+        std::error_code error;
+        if (!std::filesystem::exists(brdfPath, error) || !std::filesystem::exists(irradiancePath, error) || !std::filesystem::exists(specularPath, error)) {
+            return false;
+        }
+
+        try {
+            MappedFile brdfFile{ brdfPath };
+            Ktx2Texture brdf = readKtx2(brdfFile.data(), brdfFile.size());
+            MappedFile irradianceFile{ irradiancePath };
+            Ktx2Texture irradiance = readKtx2(irradianceFile.data(), irradianceFile.size());
+            MappedFile specularFile{ specularPath };
+            Ktx2Texture specular = readKtx2(specularFile.data(), specularFile.size());
+
+            if (brdf.format != vk::Format::eR16G16Sfloat || brdf.width != config.brdfLutSize || brdf.height != config.brdfLutSize ||
+                brdf.faceCount != 1 || brdf.levels.size() != 1 ||
+                irradiance.format != vk::Format::eR32G32B32A32Sfloat || irradiance.width != 9 || irradiance.height != 1 ||
+                specular.format != vk::Format::eR16G16B16A16Sfloat || specular.width != config.specularSize ||
+                specular.faceCount != 6 || specular.levels.size() != config.specularMips) {
+                throw std::runtime_error("contents don't match the configuration");
+            }
+
+            IblData loaded;
+            loaded.brdfLutSize = brdf.width;
+            loaded.brdfLut.resize(brdf.levels[0].size() / sizeof(uint16_t));
+            memcpy(loaded.brdfLut.data(), brdf.levels[0].data(), brdf.levels[0].size());
+            for (uint32_t i = 0; i < 9; ++i) {
+                memcpy(&loaded.irradianceSH[i], irradiance.levels[0].data() + i * sizeof(glm::vec4), sizeof(glm::vec3));
+            }
+            loaded.specularSize = specular.width;
+            for (const std::vector<uint8_t>& level : specular.levels) {
+                std::vector<uint16_t>& texels = loaded.specular.emplace_back(level.size() / sizeof(uint16_t));
+                memcpy(texels.data(), level.data(), level.size());
+            }
+            data = std::move(loaded);
+            return true;
+        }
+        catch (const std::exception& e) {
+            std::string message = "Discarding IBL cache entry ";
+            debugLog(message.append(specularPath).append(": ").append(e.what()).c_str());
+            return false;
+        }
+    }
+
+    void writeIblCache(const IblConfig& config, uint64_t key, const IblData& data)
+    {
+        std::filesystem::create_directories(config.cacheDirectory);
+
+        Ktx2Texture brdf;
+        brdf.format = vk::Format::eR16G16Sfloat;
+        brdf.width = data.brdfLutSize;
+        brdf.height = data.brdfLutSize;
+        const uint8_t* lutBytes = reinterpret_cast<const uint8_t*>(data.brdfLut.data());
+        brdf.levels.emplace_back(lutBytes, lutBytes + data.brdfLut.size() * sizeof(uint16_t));
+        writeKtx2(getCachePath(config, key, "brdf"), brdf);
+
+        // Nine texels, one per coefficient.
+        Ktx2Texture irradiance;
+        irradiance.format = vk::Format::eR32G32B32A32Sfloat;
+        irradiance.width = 9;
+        irradiance.height = 1;
+        std::vector<uint8_t>& coefficients = irradiance.levels.emplace_back(9 * sizeof(glm::vec4), 0);
+        for (uint32_t i = 0; i < 9; ++i) {
+            memcpy(coefficients.data() + i * sizeof(glm::vec4), &data.irradianceSH[i], sizeof(glm::vec3));
+        }
+        writeKtx2(getCachePath(config, key, "irradiance"), irradiance);
+
+        Ktx2Texture specular;
+        specular.format = vk::Format::eR16G16B16A16Sfloat;
+        specular.width = data.specularSize;
+        specular.height = data.specularSize;
+        specular.faceCount = 6;
+        for (const std::vector<uint16_t>& level : data.specular) {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(level.data());
+            specular.levels.emplace_back(bytes, bytes + level.size() * sizeof(uint16_t));
+        }
+        // Written last, readers only look at the others once it exists.
+        writeKtx2(getCachePath(config, key, "specular"), specular);
+    }
+
+    ImageBasedLighting::ImageBasedLighting(Renderer& renderer, const std::string& hdrPath, const IblConfig& config, IblSource bakeWith) :
+        m_renderer(renderer)
+    {
+        validateConfig(config);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        MappedFile source{ hdrPath };
+        m_stats.key = computeIblKey(source.data(), source.size(), config);
+        m_stats.hashMs = elapsedMs(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        IblData data;
+        bool cached = !config.cacheDirectory.empty() && readIblCache(config, m_stats.key, data);
+        m_stats.cacheMs = elapsedMs(start);
+
+        if (cached) {
+            m_stats.source = IblSource::eCache;
+        }
+        else {
+            start = std::chrono::high_resolution_clock::now();
+            if (!isHdr(source.data(), source.size())) {
+                std::string errorString{ "Not a Radiance HDR image: " };
+                throw std::runtime_error(errorString.append(hdrPath));
+            }
+            DecodedHdrImage environment = decodeHdr(source.data(), source.size());
+            m_stats.decodeMs = elapsedMs(start);
+
+            start = std::chrono::high_resolution_clock::now();
+            m_stats.source = bakeWith == IblSource::eCpu ? IblSource::eCpu : IblSource::eGpu;
+            data = m_stats.source == IblSource::eCpu ? bakeIblCpu(environment, config, renderer.getJobSystem()) : bakeIblGpu(renderer, environment, config);
+            m_stats.bakeMs = elapsedMs(start);
+
+            // A cache that can't be written only costs the next start a bake.
+            start = std::chrono::high_resolution_clock::now();
+            if (!config.cacheDirectory.empty()) {
+                try {
+                    writeIblCache(config, m_stats.key, data);
+                }
+                catch (const std::exception& e) {
+                    std::string message = "Failed to write the IBL cache: ";
+                    debugLog(message.append(e.what()).c_str());
+                }
+            }
+            m_stats.cacheMs += elapsedMs(start);
+        }
+
+        start = std::chrono::high_resolution_clock::now();
+        m_irradianceSH = data.irradianceSH;
+        createTextures(data);
+        m_stats.uploadMs = elapsedMs(start);
+    }
+
+    ImageBasedLighting::~ImageBasedLighting()
+    {
+        GpuMemory& memory = m_renderer.getMemory();
+        vk::Device device = m_renderer.getDevice();
+        Image brdfLut = m_brdfLut;
+        Image specular = m_specular;
+        vk::ImageView brdfLutView = m_brdfLutView;
+        vk::ImageView specularView = m_specularView;
+        m_renderer.deferRelease([&memory, device, brdfLut, specular, brdfLutView, specularView]() mutable {
+            device.destroyImageView(brdfLutView);
+            device.destroyImageView(specularView);
+            memory.destroyImage(brdfLut);
+            memory.destroyImage(specular);
+        });
+    }
+
+    void ImageBasedLighting::createTextures(const IblData& data)
+    {
+        vk::Device device = m_renderer.getDevice();
+        GpuMemory& memory = m_renderer.getMemory();
+        m_specularMips = uint32_t(data.specular.size());
+
+        const vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+        m_brdfLut = memory.createImage(vk::ImageCreateInfo{
+            vk::ImageCreateFlags{},
+            vk::ImageType::e2D,
+            vk::Format::eR16G16Sfloat,
+            vk::Extent3D{ data.brdfLutSize, data.brdfLutSize, 1 },
+            1,
+            1,
+            vk::SampleCountFlagBits::e1,
+            vk::ImageTiling::eOptimal,
+            usage,
+        });
+        m_brdfLutView = device.createImageView(vk::ImageViewCreateInfo{
+            vk::ImageViewCreateFlags{},
+            m_brdfLut.image,
+            vk::ImageViewType::e2D,
+            vk::Format::eR16G16Sfloat,
+            vk::ComponentMapping{},
+            vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 },
+        });
+        m_specular = memory.createImage(vk::ImageCreateInfo{
+            vk::ImageCreateFlagBits::eCubeCompatible,
+            vk::ImageType::e2D,
+            vk::Format::eR16G16B16A16Sfloat,
+            vk::Extent3D{ data.specularSize, data.specularSize, 1 },
+            m_specularMips,
+            6,
+            vk::SampleCountFlagBits::e1,
+            vk::ImageTiling::eOptimal,
+            usage,
+        });
+        m_specularView = device.createImageView(vk::ImageViewCreateInfo{
+            vk::ImageViewCreateFlags{},
+            m_specular.image,
+            vk::ImageViewType::eCube,
+            vk::Format::eR16G16B16A16Sfloat,
+            vk::ComponentMapping{},
+            vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, m_specularMips, 0, 6 },
+        });
+        m_sampler = m_renderer.getPipelines().getSampler(vk::SamplerCreateInfo{
+            vk::SamplerCreateFlags{},
+            vk::Filter::eLinear,
+            vk::Filter::eLinear,
+            vk::SamplerMipmapMode::eLinear,
+            vk::SamplerAddressMode::eClampToEdge,
+            vk::SamplerAddressMode::eClampToEdge,
+            vk::SamplerAddressMode::eClampToEdge,
+            0.0f,
+            VK_FALSE,
+            1.0f,
+            VK_FALSE,
+            vk::CompareOp::eNever,
+            0.0f,
+            VK_LOD_CLAMP_NONE,
+        });
+
+        // One staging buffer with the table, then every mip of the cube, each
+        // with its six faces back to back as copyBufferToImage expects them.
+        std::vector<vk::BufferImageCopy> specularCopies;
+        vk::DeviceSize lutBytes = data.brdfLut.size() * sizeof(uint16_t);
+        vk::DeviceSize stagingBytes = (lutBytes + 15) / 16 * 16;
+        for (uint32_t mip = 0; mip < m_specularMips; ++mip) {
+            uint32_t size = data.specularSize >> mip;
+            specularCopies.push_back(vk::BufferImageCopy{
+                stagingBytes, 0, 0,
+                vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, mip, 0, 6 },
+                vk::Offset3D{ 0, 0, 0 },
+                vk::Extent3D{ size, size, 1 },
+            });
+            stagingBytes += (data.specular[mip].size() * sizeof(uint16_t) + 15) / 16 * 16;
+        }
+        Buffer staging = memory.createBuffer(
+            vk::BufferCreateInfo{ vk::BufferCreateFlags{}, stagingBytes, vk::BufferUsageFlagBits::eTransferSrc },
+            MemoryUsage::eUpload
+        );
+        uint8_t* mapped = static_cast<uint8_t*>(staging.mapped);
+        memcpy(mapped, data.brdfLut.data(), lutBytes);
+        for (uint32_t mip = 0; mip < m_specularMips; ++mip) {
+            memcpy(mapped + specularCopies[mip].bufferOffset, data.specular[mip].data(), data.specular[mip].size() * sizeof(uint16_t));
+        }
+
+        vk::Image brdfImage = m_brdfLut.image;
+        vk::Image specularImage = m_specular.image;
+        uint32_t lutSize = data.brdfLutSize;
+        uint32_t mips = m_specularMips;
+        m_renderer.immediateSubmit([&](vk::CommandBuffer commandBuffer) {
+            vk::ImageSubresourceRange lutRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+            vk::ImageSubresourceRange cubeRange{ vk::ImageAspectFlagBits::eColor, 0, mips, 0, 6 };
+            std::array<vk::ImageMemoryBarrier, 2> toTransfer{
+                vk::ImageMemoryBarrier{ vk::AccessFlags{}, vk::AccessFlagBits::eTransferWrite, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+                    VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, brdfImage, lutRange },
+                vk::ImageMemoryBarrier{ vk::AccessFlags{}, vk::AccessFlagBits::eTransferWrite, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+                    VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, specularImage, cubeRange },
+            };
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags{}, nullptr, nullptr, toTransfer);
+
+            commandBuffer.copyBufferToImage(staging.buffer, brdfImage, vk::ImageLayout::eTransferDstOptimal, vk::BufferImageCopy{
+                0, 0, 0,
+                vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, 0, 0, 1 },
+                vk::Offset3D{ 0, 0, 0 },
+                vk::Extent3D{ lutSize, lutSize, 1 },
+            });
+            commandBuffer.copyBufferToImage(staging.buffer, specularImage, vk::ImageLayout::eTransferDstOptimal, specularCopies);
+
+            std::array<vk::ImageMemoryBarrier, 2> toShader{
+                vk::ImageMemoryBarrier{ vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+                    VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, brdfImage, lutRange },
+                vk::ImageMemoryBarrier{ vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+                    VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, specularImage, cubeRange },
+            };
+            commandBuffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,
+                vk::DependencyFlags{},
+                nullptr, nullptr, toShader
+            );
+        });
+        memory.destroyBuffer(staging);
+    }
+}
@@ -0,0 +1,1023 @@
+#include "image_decoder.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace bvr
+{
+    namespace
+    {
+        const uint8_t kPngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+        [[noreturn]] void fail(const char* message)
+        {
+            throw std::runtime_error(std::string{ "PNG decode error: " }.append(message));
+        }
+
+        [[noreturn]] void failHdr(const char* message)
+        {
+            throw std::runtime_error(std::string{ "HDR decode error: " }.append(message));
+        }
+
+        // Reads one header line, without its newline.
+        std::string readHdrLine(const uint8_t* data, size_t size, size_t& pos)
+        {
+            size_t start = pos;
+            while (pos < size && data[pos] != '\n') {
+                ++pos;
+            }
+            if (pos >= size) {
+                failHdr("truncated header");
+            }
+            return std::string{ reinterpret_cast<const char*>(data + start), pos++ - start };
+        }
+
+        uint32_t readBe32(const uint8_t* p)
+        {
+            return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+        }
+
+        // Minimal DEFLATE decoder (RFC 1951), enough for zlib streams in PNGs.
+        // Fails rather than writing more than `maxOutput` bytes.
+        class Inflater
+        {
+        public:
+            Inflater(const uint8_t* data, size_t size, std::vector<uint8_t>& out, size_t maxOutput) :
+                m_data(data), m_size(size), m_out(out), m_maxOutput(maxOutput) { }
+
+            void run()
+            {
+                bool last = false;
+                while (!last) {
+                    last = readBits(1) != 0;
+                    uint32_t type = readBits(2);
+                    if (type == 0) {
+                        copyStored();
+                    }
+                    else if (type == 1) {
+                        buildFixedTables();
+                        inflateBlock();
+                    }
+                    else if (type == 2) {
+                        readDynamicTables();
+                        inflateBlock();
+                    }
+                    else {
+                        fail("invalid deflate block type");
+                    }
+                }
+            }
+
+        private:
+            // Canonical Huffman table decoded one bit at a time, as in zlib's puff.
+            struct Huffman
+            {
+                uint16_t counts[16];
+                uint16_t symbols[288];
+            };
+
+            uint32_t readBits(uint32_t count)
+            {
+                while (m_bitCount < count) {
+                    if (m_pos >= m_size) {
+                        fail("truncated deflate stream");
+                    }
+                    m_bitBuffer |= uint32_t(m_data[m_pos++]) << m_bitCount;
+                    m_bitCount += 8;
+                }
+                uint32_t value = m_bitBuffer & ((1u << count) - 1);
+                m_bitBuffer >>= count;
+                m_bitCount -= count;
+                return value;
+            }
+
+            void buildTable(Huffman& table, const uint8_t* lengths, uint32_t count)
+            {
+                memset(table.counts, 0, sizeof(table.counts));
+                for (uint32_t i = 0; i < count; ++i) {
+                    table.counts[lengths[i]]++;
+                }
+                table.counts[0] = 0;
+
+                uint16_t offsets[16];
+                offsets[1] = 0;
+                for (uint32_t len = 1; len < 15; ++len) {
+                    offsets[len + 1] = uint16_t(offsets[len] + table.counts[len]);
+                }
+                for (uint32_t i = 0; i < count; ++i) {
+                    if (lengths[i] != 0) {
+                        table.symbols[offsets[lengths[i]]++] = uint16_t(i);
+                    }
+                }
+            }
+
+            uint32_t decodeSymbol(const Huffman& table)
+            {
+                int32_t code = 0;
+                int32_t first = 0;
+                int32_t index = 0;
+                for (uint32_t len = 1; len < 16; ++len) {
+                    code |= int32_t(readBits(1));
+                    int32_t count = table.counts[len];
+                    if (code - count < first) {
+                        return table.symbols[index + (code - first)];
+                    }
+                    index += count;
+                    first += count;
+                    first <<= 1;
+                    code <<= 1;
+                }
+                fail("invalid huffman code");
+            }
+
+            void copyStored()
+            {
+                m_bitBuffer = 0;
+                m_bitCount = 0;
+                if (m_pos + 4 > m_size) {
+                    fail("truncated stored block");
+                }
+                uint32_t length = uint32_t(m_data[m_pos]) | (uint32_t(m_data[m_pos + 1]) << 8);
+                m_pos += 4;
+                if (m_pos + length > m_size) {
+                    fail("truncated stored block");
+                }
+                reserveOutput(length);
+                m_out.insert(m_out.end(), m_data + m_pos, m_data + m_pos + length);
+                m_pos += length;
+            }
+
+            void buildFixedTables()
+            {
+                uint8_t lengths[288 + 30];
+                uint32_t i = 0;
+                for (; i < 144; ++i) lengths[i] = 8;
+                for (; i < 256; ++i) lengths[i] = 9;
+                for (; i < 280; ++i) lengths[i] = 7;
+                for (; i < 288; ++i) lengths[i] = 8;
+                buildTable(m_literals, lengths, 288);
+                for (i = 0; i < 30; ++i) lengths[i] = 5;
+                buildTable(m_distances, lengths, 30);
+            }
+
+            void readDynamicTables()
+            {
+                static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+                uint32_t literalCount = readBits(5) + 257;
+                uint32_t distanceCount = readBits(5) + 1;
+                uint32_t codeCount = readBits(4) + 4;
+                if (literalCount > 286 || distanceCount > 30) {
+                    fail("bad dynamic table counts");
+                }
+
+                uint8_t lengths[320] = {};
+                for (uint32_t i = 0; i < codeCount; ++i) {
+                    lengths[order[i]] = uint8_t(readBits(3));
+                }
+                Huffman codeLengths;
+                buildTable(codeLengths, lengths, 19);
+
+                uint32_t index = 0;
+                while (index < literalCount + distanceCount) {
+                    uint32_t symbol = decodeSymbol(codeLengths);
+                    if (symbol < 16) {
+                        lengths[index++] = uint8_t(symbol);
+                        continue;
+                    }
+
+                    uint8_t repeated = 0;
+                    uint32_t repeat = 0;
+                    if (symbol == 16) {
+                        if (index == 0) {
+                            fail("repeat with no previous length");
+                        }
+                        repeated = lengths[index - 1];
+                        repeat = 3 + readBits(2);
+                    }
+                    else if (symbol == 17) {
+                        repeat = 3 + readBits(3);
+                    }
+                    else {
+                        repeat = 11 + readBits(7);
+                    }
+                    if (index + repeat > literalCount + distanceCount) {
+                        fail("code lengths overflow");
+                    }
+                    while (repeat--) {
+                        lengths[index++] = repeated;
+                    }
+                }
+
+                buildTable(m_literals, lengths, literalCount);
+                buildTable(m_distances, lengths + literalCount, distanceCount);
+            }
+
+            void inflateBlock()
+            {
+                static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+                static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+                static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+                static const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+                while (true) {
+                    uint32_t symbol = decodeSymbol(m_literals);
+                    if (symbol < 256) {
+                        reserveOutput(1);
+                        m_out.push_back(uint8_t(symbol));
+                        continue;
+                    }
+                    if (symbol == 256) {
+                        return;
+                    }
+
+                    symbol -= 257;
+                    if (symbol >= 29) {
+                        fail("invalid length symbol");
+                    }
+                    uint32_t length = lengthBase[symbol] + readBits(lengthExtra[symbol]);
+
+                    uint32_t distanceSymbol = decodeSymbol(m_distances);
+                    if (distanceSymbol >= 30) {
+                        fail("invalid distance symbol");
+                    }
+                    uint32_t distance = distanceBase[distanceSymbol] + readBits(distanceExtra[distanceSymbol]);
+                    if (distance > m_out.size()) {
+                        fail("distance too far back");
+                    }
+
+                    // Byte by byte, the source and destination ranges may overlap.
+                    reserveOutput(length);
+                    size_t from = m_out.size() - distance;
+                    for (uint32_t i = 0; i < length; ++i) {
+                        m_out.push_back(m_out[from + i]);
+                    }
+                }
+            }
+
+            void reserveOutput(size_t count)
+            {
+                if (count > m_maxOutput - m_out.size()) {
+                    fail("more image data than the header describes");
+                }
+            }
+
+            const uint8_t* m_data;
+            size_t m_size;
+            size_t m_pos = 0;
+            uint32_t m_bitBuffer = 0;
+            uint32_t m_bitCount = 0;
+            std::vector<uint8_t>& m_out;
+            size_t m_maxOutput;
+            Huffman m_literals;
+            Huffman m_distances;
+        };
+
+        uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+        {
+            int32_t p = int32_t(a) + int32_t(b) - int32_t(c);
+            int32_t pa = abs(p - int32_t(a));
+            int32_t pb = abs(p - int32_t(b));
+            int32_t pc = abs(p - int32_t(c));
+            if (pa <= pb && pa <= pc) {
+                return a;
+            }
+            return pb <= pc ? b : c;
+        }
+
+        void unfilter(uint8_t* pixels, const uint8_t* filtered, uint32_t height, size_t stride, uint32_t bytesPerPixel)
+        {
+            const uint8_t* previous = nullptr;
+            for (uint32_t y = 0; y < height; ++y) {
+                uint8_t filter = *filtered++;
+                uint8_t* row = pixels + y * stride;
+                for (size_t x = 0; x < stride; ++x) {
+                    uint8_t a = x >= bytesPerPixel ? row[x - bytesPerPixel] : 0;
+                    uint8_t b = previous ? previous[x] : 0;
+                    uint8_t c = (previous && x >= bytesPerPixel) ? previous[x - bytesPerPixel] : 0;
+                    uint8_t raw = filtered[x];
+                    switch (filter) {
+                    case 0: row[x] = raw; break;
+                    case 1: row[x] = uint8_t(raw + a); break;
+                    case 2: row[x] = uint8_t(raw + b); break;
+                    case 3: row[x] = uint8_t(raw + ((uint32_t(a) + uint32_t(b)) >> 1)); break;
+                    case 4: row[x] = uint8_t(raw + paeth(a, b, c)); break;
+                    default: fail("invalid filter type");
+                    }
+                }
+                filtered += stride;
+                previous = row;
+            }
+        }
+
+        [[noreturn]] void failJpeg(const char* message)
+        {
+            throw std::runtime_error(std::string{ "JPEG decode error: " }.append(message));
+        }
+
+        // Natural order index of each zigzag position.
+        const uint8_t kZigzag[64] = {
+            0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+            12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+            35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+            58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+        };
+
+        uint32_t readBe16(const uint8_t* p)
+        {
+            return (uint32_t(p[0]) << 8) | uint32_t(p[1]);
+        }
+
+        // Canonical Huffman table, decoded one code length at a time (JPEG F.2.2.3).
+        struct JpegHuffman
+        {
+            int32_t maxCode[17] = {};
+            int32_t valueOffset[17] = {};
+            uint8_t values[256] = {};
+            bool defined = false;
+
+            void build(const uint8_t* counts, const uint8_t* symbols, uint32_t symbolCount)
+            {
+                memcpy(values, symbols, symbolCount);
+                int32_t code = 0;
+                int32_t index = 0;
+                for (uint32_t length = 1; length <= 16; ++length) {
+                    valueOffset[length] = index - code;
+                    code += counts[length - 1];
+                    index += counts[length - 1];
+                    maxCode[length] = counts[length - 1] != 0 ? code - 1 : -1;
+                    code <<= 1;
+                }
+                defined = true;
+            }
+        };
+
+        // Entropy coded data with byte stuffing removed. Once a marker is reached
+        // it keeps returning zero bits, like libjpeg does for truncated scans.
+        class JpegBitReader
+        {
+        public:
+            JpegBitReader(const uint8_t* data, size_t size, size_t pos) : m_data(data), m_size(size), m_pos(pos) { }
+
+            uint32_t readBits(uint32_t count)
+            {
+                if (count == 0) {
+                    return 0;
+                }
+                fill();
+                uint32_t value = m_bits >> (32 - count);
+                m_bits <<= count;
+                m_count -= int(count);
+                return value;
+            }
+
+            uint8_t decode(const JpegHuffman& table)
+            {
+                int32_t code = int32_t(readBits(1));
+                uint32_t length = 1;
+                while (code > table.maxCode[length]) {
+                    if (++length > 16) {
+                        failJpeg("invalid Huffman code");
+                    }
+                    code = (code << 1) | int32_t(readBits(1));
+                }
+                return table.values[(code + table.valueOffset[length]) & 0xFF];
+            }
+
+            // Reads `length` bits and sign extends them as in JPEG F.2.2.1.
+            int32_t receiveExtend(uint32_t length)
+            {
+                if (length == 0) {
+                    return 0;
+                }
+                int32_t value = int32_t(readBits(length));
+                return value < (1 << (length - 1)) ? value - (1 << length) + 1 : value;
+            }
+
+            // Drops the partial byte and skips the RSTn marker that follows.
+            void restart()
+            {
+                m_bits = 0;
+                m_count = 0;
+                m_marker = false;
+                if (m_pos + 1 < m_size && m_data[m_pos] == 0xFF && m_data[m_pos + 1] >= 0xD0 && m_data[m_pos + 1] <= 0xD7) {
+                    m_pos += 2;
+                }
+            }
+
+            size_t getPosition() const { return m_pos; }
+
+        private:
+            void fill()
+            {
+                while (m_count <= 24) {
+                    uint32_t byte = 0;
+                    if (!m_marker && m_pos < m_size) {
+                        byte = m_data[m_pos];
+                        if (byte != 0xFF) {
+                            ++m_pos;
+                        }
+                        else if (m_pos + 1 < m_size && m_data[m_pos + 1] == 0x00) {
+                            m_pos += 2;
+                        }
+                        else {
+                            m_marker = true;
+                            byte = 0;
+                        }
+                    }
+                    m_bits |= byte << (24 - m_count);
+                    m_count += 8;
+                }
+            }
+
+            const uint8_t* m_data;
+            size_t m_size;
+            size_t m_pos;
+            uint32_t m_bits = 0;
+            int m_count = 0;
+            bool m_marker = false;
+        };
+
+        struct JpegComponent
+        {
+            uint8_t id = 0;
+            uint32_t h = 1;
+            uint32_t v = 1;
+            uint32_t quantTable = 0;
+            uint32_t dcTable = 0;
+            uint32_t acTable = 0;
+            int32_t dcPredictor = 0;
+            // Samples of whole MCUs, so the plane is padded to a multiple of them.
+            uint32_t blocksWide = 0;
+            uint32_t blocksHigh = 0;
+            std::vector<uint8_t> samples;
+        };
+
+        // Separable float inverse DCT of one dequantized block, level shifted to 0-255.
+        void inverseDct(const float* coefficients, uint8_t* out, size_t stride)
+        {
+            static const auto basis = []() {
+                std::array<float, 64> table{};
+                const double pi = 3.14159265358979323846;
+                for (uint32_t x = 0; x < 8; ++x) {
+                    for (uint32_t u = 0; u < 8; ++u) {
+                        double scale = u == 0 ? std::sqrt(0.5) : 1.0;
+                        table[x * 8 + u] = float(0.5 * scale * std::cos(double(2 * x + 1) * u * pi / 16.0));
+                    }
+                }
+                return table;
+            }();
+
+            float rows[64];
+            for (uint32_t v = 0; v < 8; ++v) {
+                for (uint32_t x = 0; x < 8; ++x) {
+                    float sum = 0.0f;
+                    for (uint32_t u = 0; u < 8; ++u) {
+                        sum += basis[x * 8 + u] * coefficients[v * 8 + u];
+                    }
+                    rows[v * 8 + x] = sum;
+                }
+            }
+            for (uint32_t y = 0; y < 8; ++y) {
+                for (uint32_t x = 0; x < 8; ++x) {
+                    float sum = 128.0f;
+                    for (uint32_t v = 0; v < 8; ++v) {
+                        sum += basis[y * 8 + v] * rows[v * 8 + x];
+                    }
+                    out[y * stride + x] = uint8_t(std::min(std::max(std::lround(sum), 0L), 255L));
+                }
+            }
+        }
+
+        void decodeJpegBlock(JpegBitReader& reader, JpegComponent& component, const JpegHuffman* dcTables, const JpegHuffman* acTables, const uint16_t* quant, uint32_t blockX, uint32_t blockY)
+        {
+            const JpegHuffman& dc = dcTables[component.dcTable];
+            const JpegHuffman& ac = acTables[component.acTable];
+            if (!dc.defined || !ac.defined) {
+                failJpeg("missing Huffman table");
+            }
+
+            float coefficients[64] = {};
+            uint8_t dcLength = reader.decode(dc);
+            if (dcLength > 11) {
+                failJpeg("invalid DC coefficient");
+            }
+            component.dcPredictor += reader.receiveExtend(dcLength);
+            coefficients[0] = float(component.dcPredictor * int32_t(quant[0]));
+            for (uint32_t k = 1; k < 64;) {
+                uint8_t symbol = reader.decode(ac);
+                uint32_t run = symbol >> 4;
+                uint32_t length = symbol & 15;
+                if (length == 0) {
+                    if (run != 15) {
+                        break;
+                    }
+                    k += 16;
+                    continue;
+                }
+                k += run;
+                if (k > 63) {
+                    failJpeg("coefficient index out of range");
+                }
+                coefficients[kZigzag[k]] = float(reader.receiveExtend(length) * int32_t(quant[k]));
+                ++k;
+            }
+
+            size_t stride = size_t(component.blocksWide) * 8;
+            inverseDct(coefficients, component.samples.data() + size_t(blockY) * 8 * stride + size_t(blockX) * 8, stride);
+        }
+    }
+
+    bool isPng(const uint8_t* data, size_t size)
+    {
+        return size >= sizeof(kPngSignature) && memcmp(data, kPngSignature, sizeof(kPngSignature)) == 0;
+    }
+
+    DecodedImage decodePng(const uint8_t* data, size_t size)
+    {
+        if (!isPng(data, size)) {
+            fail("missing signature");
+        }
+
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint8_t bitDepth = 0;
+        uint8_t colorType = 0;
+        std::vector<uint8_t> compressed;
+        uint8_t palette[256][4] = {};
+
+        size_t pos = sizeof(kPngSignature);
+        while (pos + 12 <= size) {
+            uint32_t length = readBe32(data + pos);
+            const uint8_t* type = data + pos + 4;
+            const uint8_t* chunk = data + pos + 8;
+            if (length > size - pos - 12) {
+                fail("truncated chunk");
+            }
+
+            if (memcmp(type, "IHDR", 4) == 0) {
+                width = readBe32(chunk);
+                height = readBe32(chunk + 4);
+                bitDepth = chunk[8];
+                colorType = chunk[9];
+                if (chunk[12] != 0) {
+                    fail("interlaced images are not supported");
+                }
+            }
+            else if (memcmp(type, "PLTE", 4) == 0) {
+                for (uint32_t i = 0; i < length / 3 && i < 256; ++i) {
+                    palette[i][0] = chunk[i * 3];
+                    palette[i][1] = chunk[i * 3 + 1];
+                    palette[i][2] = chunk[i * 3 + 2];
+                    palette[i][3] = 255;
+                }
+            }
+            else if (memcmp(type, "tRNS", 4) == 0 && colorType == 3) {
+                for (uint32_t i = 0; i < length && i < 256; ++i) {
+                    palette[i][3] = chunk[i];
+                }
+            }
+            else if (memcmp(type, "IDAT", 4) == 0) {
+                compressed.insert(compressed.end(), chunk, chunk + length);
+            }
+            else if (memcmp(type, "IEND", 4) == 0) {
+                break;
+            }
+            pos += size_t(length) + 12;
+        }
+
+        uint32_t channels = 0;
+        switch (colorType) {
+        case 0: channels = 1; break;
+        case 2: channels = 3; break;
+        case 3: channels = 1; break;
+        case 4: channels = 2; break;
+        case 6: channels = 4; break;
+        default: fail("unknown color type");
+        }
+        const bool paletted = colorType == 3;
+        if (width == 0 || height == 0 || (bitDepth != 8 && bitDepth != 16 && !(paletted && bitDepth < 8))) {
+            fail("unsupported bit depth or empty image");
+        }
+        if (compressed.size() < 2) {
+            fail("missing image data");
+        }
+
+        const uint32_t bitsPerPixel = channels * bitDepth;
+        const size_t stride = (size_t(width) * bitsPerPixel + 7) / 8;
+        const uint32_t bytesPerPixel = std::max(bitsPerPixel / 8, 1u);
+
+        // Skip the two byte zlib header, the trailing Adler-32 is not verified.
+        std::vector<uint8_t> filtered;
+        filtered.reserve((stride + 1) * height);
+        Inflater inflater{ compressed.data() + 2, compressed.size() - 2, filtered, (stride + 1) * height };
+        inflater.run();
+        if (filtered.size() < (stride + 1) * height) {
+            fail("image data too short");
+        }
+
+        std::vector<uint8_t> pixels(stride * height);
+        unfilter(pixels.data(), filtered.data(), height, stride, bytesPerPixel);
+
+        DecodedImage image;
+        image.width = width;
+        image.height = height;
+        image.rgba.resize(size_t(width) * height * 4);
+
+        const uint32_t sampleBytes = bitDepth == 16 ? 2 : 1;
+        for (uint32_t y = 0; y < height; ++y) {
+            const uint8_t* row = pixels.data() + y * stride;
+            uint8_t* out = image.rgba.data() + size_t(y) * width * 4;
+            for (uint32_t x = 0; x < width; ++x, out += 4) {
+                if (paletted) {
+                    uint32_t bit = x * bitDepth;
+                    uint32_t index = (row[bit / 8] >> (8 - bitDepth - bit % 8)) & ((1u << bitDepth) - 1);
+                    memcpy(out, palette[index], 4);
+                    continue;
+                }
+
+                // Big-endian 16-bit samples keep their high byte first.
+                const uint8_t* sample = row + size_t(x) * channels * sampleBytes;
+                uint8_t c[4];
+                for (uint32_t i = 0; i < channels; ++i) {
+                    c[i] = sample[i * sampleBytes];
+                }
+                switch (channels) {
+                case 1: out[0] = out[1] = out[2] = c[0]; out[3] = 255; break;
+                case 2: out[0] = out[1] = out[2] = c[0]; out[3] = c[1]; break;
+                case 3: out[0] = c[0]; out[1] = c[1]; out[2] = c[2]; out[3] = 255; break;
+                default: memcpy(out, c, 4); break;
+                }
+            }
+        }
+        return image;
+    }
+
+    bool isJpeg(const uint8_t* data, size_t size)
+    {
+        return size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+    }
+
+    DecodedImage decodeJpeg(const uint8_t* data, size_t size)
+    {
+        if (!isJpeg(data, size)) {
+            failJpeg("missing SOI marker");
+        }
+
+        uint16_t quantTables[4][64] = {};
+        JpegHuffman dcTables[4];
+        JpegHuffman acTables[4];
+        std::vector<JpegComponent> components;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t maxH = 1;
+        uint32_t maxV = 1;
+        uint32_t restartInterval = 0;
+        int adobeTransform = -1;
+        bool frameDone = false;
+
+        size_t pos = 2;
+        for (;;) {
+            // Markers may be padded with any number of 0xFF bytes.
+            while (pos < size && data[pos] != 0xFF) {
+                ++pos;
+            }
+            while (pos < size && data[pos] == 0xFF) {
+                ++pos;
+            }
+            if (pos >= size) {
+                failJpeg("missing EOI marker");
+            }
+            uint8_t marker = data[pos++];
+            if (marker == 0xD9) {
+                break;
+            }
+            if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+                continue;
+            }
+            if (pos + 2 > size) {
+                failJpeg("truncated segment");
+            }
+            size_t length = readBe16(data + pos);
+            if (length < 2 || pos + length > size) {
+                failJpeg("truncated segment");
+            }
+            const uint8_t* segment = data + pos + 2;
+            size_t segmentSize = length - 2;
+            pos += length;
+
+            switch (marker) {
+            case 0xDB: {
+                size_t offset = 0;
+                while (offset < segmentSize) {
+                    uint32_t precision = segment[offset] >> 4;
+                    uint32_t table = segment[offset] & 15;
+                    size_t tableSize = precision == 0 ? 64 : 128;
+                    if (table > 3 || offset + 1 + tableSize > segmentSize) {
+                        failJpeg("invalid quantization table");
+                    }
+                    for (uint32_t k = 0; k < 64; ++k) {
+                        quantTables[table][k] = uint16_t(precision == 0 ? segment[offset + 1 + k] : readBe16(segment + offset + 1 + k * 2));
+                    }
+                    offset += 1 + tableSize;
+                }
+                break;
+            }
+            case 0xC4: {
+                size_t offset = 0;
+                while (offset < segmentSize) {
+                    if (offset + 17 > segmentSize) {
+                        failJpeg("invalid Huffman table");
+                    }
+                    uint32_t tableClass = segment[offset] >> 4;
+                    uint32_t table = segment[offset] & 15;
+                    uint32_t symbolCount = 0;
+                    for (uint32_t i = 0; i < 16; ++i) {
+                        symbolCount += segment[offset + 1 + i];
+                    }
+                    if (tableClass > 1 || table > 3 || symbolCount > 256 || offset + 17 + symbolCount > segmentSize) {
+                        failJpeg("invalid Huffman table");
+                    }
+                    (tableClass == 0 ? dcTables : acTables)[table].build(segment + offset + 1, segment + offset + 17, symbolCount);
+                    offset += 17 + symbolCount;
+                }
+                break;
+            }
+            case 0xC0:
+            case 0xC1: {
+                if (frameDone || segmentSize < 6) {
+                    failJpeg("invalid frame header");
+                }
+                if (segment[0] != 8) {
+                    failJpeg("only 8-bit samples are supported");
+                }
+                height = readBe16(segment + 1);
+                width = readBe16(segment + 3);
+                uint32_t componentCount = segment[5];
+                if (width == 0 || height == 0) {
+                    failJpeg("invalid image size");
+                }
+                if (componentCount != 1 && componentCount != 3) {
+                    failJpeg("only grayscale and three component images are supported");
+                }
+                if (segmentSize < 6 + componentCount * 3) {
+                    failJpeg("invalid frame header");
+                }
+                components.resize(componentCount);
+                for (uint32_t i = 0; i < componentCount; ++i) {
+                    JpegComponent& component = components[i];
+                    const uint8_t* entry = segment + 6 + i * 3;
+                    component.id = entry[0];
+                    component.h = entry[1] >> 4;
+                    component.v = entry[1] & 15;
+                    component.quantTable = entry[2];
+                    if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4 || component.quantTable > 3) {
+                        failJpeg("invalid component");
+                    }
+                    maxH = std::max(maxH, component.h);
+                    maxV = std::max(maxV, component.v);
+                }
+                uint32_t mcusX = (width + 8 * maxH - 1) / (8 * maxH);
+                uint32_t mcusY = (height + 8 * maxV - 1) / (8 * maxV);
+                for (JpegComponent& component : components) {
+                    component.blocksWide = mcusX * component.h;
+                    component.blocksHigh = mcusY * component.v;
+                    component.samples.resize(size_t(component.blocksWide) * component.blocksHigh * 64);
+                }
+                frameDone = true;
+                break;
+            }
+            case 0xC2:
+            case 0xC6:
+            case 0xCA:
+            case 0xCE:
+                failJpeg("progressive images are not supported");
+            case 0xC3:
+            case 0xC5:
+            case 0xC7:
+            case 0xC9:
+            case 0xCB:
+            case 0xCD:
+            case 0xCF:
+                failJpeg("only baseline and extended sequential Huffman images are supported");
+            case 0xDD:
+                if (segmentSize < 2) {
+                    failJpeg("invalid restart interval");
+                }
+                restartInterval = readBe16(segment);
+                break;
+            case 0xEE:
+                if (segmentSize >= 12 && memcmp(segment, "Adobe", 5) == 0) {
+                    adobeTransform = segment[11];
+                }
+                break;
+            case 0xDA: {
+                if (!frameDone) {
+                    failJpeg("scan before frame header");
+                }
+                uint32_t scanCount = segmentSize > 0 ? segment[0] : 0;
+                if (scanCount < 1 || scanCount > components.size() || segmentSize < 1 + scanCount * 2 + 3) {
+                    failJpeg("invalid scan header");
+                }
+                std::vector<JpegComponent*> scan;
+                for (uint32_t i = 0; i < scanCount; ++i) {
+                    const uint8_t* entry = segment + 1 + i * 2;
+                    auto found = std::find_if(components.begin(), components.end(), [entry](const JpegComponent& c) { return c.id == entry[0]; });
+                    if (found == components.end() || (entry[1] >> 4) > 3 || (entry[1] & 15) > 3) {
+                        failJpeg("invalid scan component");
+                    }
+                    found->dcTable = entry[1] >> 4;
+                    found->acTable = entry[1] & 15;
+                    found->dcPredictor = 0;
+                    scan.push_back(&*found);
+                }
+
+                // A single component scan is not interleaved and codes only
+                // the blocks inside the component's own size.
+                uint32_t mcusX = 0;
+                uint32_t mcusY = 0;
+                if (scanCount == 1) {
+                    mcusX = ((width * scan[0]->h + maxH - 1) / maxH + 7) / 8;
+                    mcusY = ((height * scan[0]->v + maxV - 1) / maxV + 7) / 8;
+                }
+                else {
+                    mcusX = (width + 8 * maxH - 1) / (8 * maxH);
+                    mcusY = (height + 8 * maxV - 1) / (8 * maxV);
+                }
+
+                JpegBitReader reader{ data, size, pos };
+                uint32_t mcuCount = mcusX * mcusY;
+                for (uint32_t mcu = 0; mcu < mcuCount; ++mcu) {
+                    if (restartInterval != 0 && mcu != 0 && mcu % restartInterval == 0) {
+                        reader.restart();
+                        for (JpegComponent* component : scan) {
+                            component->dcPredictor = 0;
+                        }
+                    }
+                    uint32_t mcuX = mcu % mcusX;
+                    uint32_t mcuY = mcu / mcusX;
+                    for (JpegComponent* component : scan) {
+                        const uint16_t* quant = quantTables[component->quantTable];
+                        if (scanCount == 1) {
+                            decodeJpegBlock(reader, *component, dcTables, acTables, quant, mcuX, mcuY);
+                            continue;
+                        }
+                        for (uint32_t by = 0; by < component->v; ++by) {
+                            for (uint32_t bx = 0; bx < component->h; ++bx) {
+                                decodeJpegBlock(reader, *component, dcTables, acTables, quant, mcuX * component->h + bx, mcuY * component->v + by);
+                            }
+                        }
+                    }
+                }
+                pos = reader.getPosition();
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        if (!frameDone) {
+            failJpeg("missing frame header");
+        }
+
+        DecodedImage image;
+        image.width = width;
+        image.height = height;
+        image.rgba.resize(size_t(width) * height * 4);
+        auto sample = [maxH, maxV](const JpegComponent& component, uint32_t x, uint32_t y) {
+            size_t stride = size_t(component.blocksWide) * 8;
+            return component.samples[size_t(y * component.v / maxV) * stride + x * component.h / maxH];
+        };
+        // Three component images are YCbCr unless an Adobe marker says the
+        // samples are stored untransformed.
+        bool ycbcr = components.size() == 3 && adobeTransform != 0;
+        for (uint32_t y = 0; y < height; ++y) {
+            uint8_t* out = image.rgba.data() + size_t(y) * width * 4;
+            for (uint32_t x = 0; x < width; ++x, out += 4) {
+                out[3] = 255;
+                if (components.size() == 1) {
+                    out[0] = out[1] = out[2] = sample(components[0], x, y);
+                    continue;
+                }
+                float c0 = sample(components[0], x, y);
+                float c1 = sample(components[1], x, y);
+                float c2 = sample(components[2], x, y);
+                if (ycbcr) {
+                    float cb = c1 - 128.0f;
+                    float cr = c2 - 128.0f;
+                    c1 = c0 - 0.344136f * cb - 0.714136f * cr;
+                    c2 = c0 + 1.772f * cb;
+                    c0 = c0 + 1.402f * cr;
+                }
+                out[0] = uint8_t(std::min(std::max(std::lround(c0), 0L), 255L));
+                out[1] = uint8_t(std::min(std::max(std::lround(c1), 0L), 255L));
+                out[2] = uint8_t(std::min(std::max(std::lround(c2), 0L), 255L));
+            }
+        }
+        return image;
+    }
+
+    DecodedImage decodeImage(const uint8_t* data, size_t size)
+    {
+        if (isPng(data, size)) {
+            return decodePng(data, size);
+        }
+        if (isJpeg(data, size)) {
+            return decodeJpeg(data, size);
+        }
+        throw std::runtime_error("Unsupported image format, expected PNG or JPEG");
+    }
+
+    bool isHdr(const uint8_t* data, size_t size)
+    {
+        auto startsWith = [data, size](const char* magic) {
+            size_t length = strlen(magic);
+            return size >= length && memcmp(data, magic, length) == 0;
+        };
+        return startsWith("#?RADIANCE") || startsWith("#?RGBE");
+    }
+
+    DecodedHdrImage decodeHdr(const uint8_t* data, size_t size)
+    {
+        if (!isHdr(data, size)) {
+            failHdr("missing signature");
+        }
+
+        // Header lines up to an empty one, then the resolution.
+        size_t pos = 0;
+        for (std::string line = readHdrLine(data, size, pos); !line.empty(); line = readHdrLine(data, size, pos)) {
+            if (line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe") {
+                failHdr("unsupported pixel format");
+            }
+        }
+        std::string resolution = readHdrLine(data, size, pos);
+        int height = 0;
+        int width = 0;
+        char trailing = 0;
+        if (sscanf(resolution.c_str(), "-Y %d +X %d%c", &height, &width, &trailing) != 2 || width <= 0 || height <= 0) {
+            failHdr("unsupported orientation or invalid resolution");
+        }
+
+        DecodedHdrImage image;
+        image.width = uint32_t(width);
+        image.height = uint32_t(height);
+        image.rgba.resize(size_t(width) * height * 4);
+
+        std::vector<uint8_t> scanline(size_t(width) * 4);
+        for (int y = 0; y < height; ++y) {
+            // Run-length encoded scanlines start with 2, 2 and the width, and
+            // store each channel separately.
+            bool encoded = width >= 8 && width < 0x8000 && pos + 4 <= size &&
+                data[pos] == 2 && data[pos + 1] == 2 && ((data[pos + 2] << 8) | data[pos + 3]) == width;
+            if (encoded) {
+                pos += 4;
+                for (int channel = 0; channel < 4; ++channel) {
+                    for (int x = 0; x < width;) {
+                        if (pos >= size) {
+                            failHdr("truncated scanline");
+                        }
+                        uint32_t count = data[pos++];
+                        bool run = count > 128;
+                        count = run ? count - 128 : count;
+                        if (count == 0 || x + int(count) > width || pos + (run ? 1 : count) > size) {
+                            failHdr("invalid run length");
+                        }
+                        for (uint32_t i = 0; i < count; ++i, ++x) {
+                            scanline[size_t(x) * 4 + channel] = run ? data[pos] : data[pos + i];
+                        }
+                        pos += run ? 1 : count;
+                    }
+                }
+            }
+            else {
+                if (pos + scanline.size() > size) {
+                    failHdr("truncated scanline");
+                }
+                memcpy(scanline.data(), data + pos, scanline.size());
+                pos += scanline.size();
+            }
+
+            float* out = image.rgba.data() + size_t(y) * width * 4;
+            for (int x = 0; x < width; ++x, out += 4) {
+                const uint8_t* rgbe = &scanline[size_t(x) * 4];
+                float scale = rgbe[3] == 0 ? 0.0f : std::ldexp(1.0f, int(rgbe[3]) - (128 + 8));
+                out[0] = float(rgbe[0]) * scale;
+                out[1] = float(rgbe[1]) * scale;
+                out[2] = float(rgbe[2]) * scale;
+                out[3] = 1.0f;
+            }
+        }
+        return image;
+    }
+}
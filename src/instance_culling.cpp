@@ -0,0 +1,813 @@
+#include "instance_culling.h"
+#include "renderer.h"
+
+#include <vma/vk_mem_alloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVR_CULL_SSE2 1
+#endif
+
+namespace bvr
+{
+    namespace
+    {
+        // Matches CullParams in shaders/cull.comp.
+        struct CullParams
+        {
+            glm::mat4 prevViewProjection;
+            glm::vec4 planes[6];
+            glm::vec2 hizSize;
+            uint32_t instanceCount;
+            uint32_t hizLevels;
+        };
+
+        // Matches LevelConstants in shaders/hiz.comp.
+        struct HizLevelConstants
+        {
+            uint32_t srcWidth;
+            uint32_t srcHeight;
+            uint32_t dstWidth;
+            uint32_t dstHeight;
+        };
+
+        const vk::Format kDepthFormat = vk::Format::eD32Sfloat;
+        const vk::Format kHizFormat = vk::Format::eR32Sfloat;
+        // Instances per CPU culling job.
+        const uint32_t kCullGrainSize = 4096;
+
+        glm::vec4 normalizePlane(const glm::vec4& plane)
+        {
+            return plane / glm::length(glm::vec3(plane));
+        }
+
+        vk::DescriptorSet allocateSet(vk::Device device, vk::DescriptorPool pool, vk::DescriptorSetLayout layout)
+        {
+            return device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{ pool, 1, &layout })[0];
+        }
+    }
+
+    BuiltinMeshGeometry buildBuiltinMeshes()
+    {
+        const float c = 1.0f / std::sqrt(3.0f);
+        BuiltinMeshGeometry geometry;
+        uint32_t mesh = 0;
+
+        auto addMesh = [&](std::initializer_list<glm::vec3> meshVertices, std::initializer_list<uint32_t> meshIndices) {
+            BuiltinMeshRange& range = geometry.ranges[mesh++];
+            range.indexCount = uint32_t(meshIndices.size());
+            range.firstIndex = uint32_t(geometry.indices.size());
+            range.vertexOffset = int32_t(geometry.vertices.size());
+            geometry.vertices.insert(geometry.vertices.end(), meshVertices);
+            geometry.indices.insert(geometry.indices.end(), meshIndices);
+        };
+
+        // Same order as BuiltinMesh.
+        addMesh(
+            { { -c, -c, -c }, { c, -c, -c }, { c, c, -c }, { -c, c, -c }, { -c, -c, c }, { c, -c, c }, { c, c, c }, { -c, c, c } },
+            { 0, 2, 1, 0, 3, 2, 4, 5, 6, 4, 6, 7, 0, 1, 5, 0, 5, 4, 3, 6, 2, 3, 7, 6, 0, 4, 7, 0, 7, 3, 1, 2, 6, 1, 6, 5 }
+        );
+        addMesh(
+            { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } },
+            { 0, 2, 4, 2, 1, 4, 1, 3, 4, 3, 0, 4, 2, 0, 5, 1, 2, 5, 3, 1, 5, 0, 3, 5 }
+        );
+        addMesh(
+            { { c, c, c }, { c, -c, -c }, { -c, c, -c }, { -c, -c, c } },
+            { 0, 1, 2, 0, 3, 1, 0, 2, 3, 1, 3, 2 }
+        );
+        return geometry;
+    }
+
+    glm::vec4 builtinMeshBounds(const glm::mat4& transform)
+    {
+        float scale = std::max(
+            std::max(glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1]))),
+            glm::length(glm::vec3(transform[2]))
+        );
+        return glm::vec4(glm::vec3(transform[3]), scale);
+    }
+
+    void InstanceSet::add(const glm::mat4& transform, const glm::vec4& color, BuiltinMesh mesh)
+    {
+        bounds.push_back(builtinMeshBounds(transform));
+        transforms.push_back(transform);
+        colors.push_back(color);
+        meshes.push_back(uint32_t(mesh));
+    }
+
+    BoundsSoA::BoundsSoA(const std::vector<glm::vec4>& bounds)
+    {
+        x.reserve(bounds.size());
+        y.reserve(bounds.size());
+        z.reserve(bounds.size());
+        radius.reserve(bounds.size());
+        for (const glm::vec4& sphere : bounds) {
+            x.push_back(sphere.x);
+            y.push_back(sphere.y);
+            z.push_back(sphere.z);
+            radius.push_back(sphere.w);
+        }
+    }
+
+    CullView makeCullView(const glm::mat4& viewProjection)
+    {
+        // Rows of the matrix, glm stores columns.
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; ++i) {
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        }
+
+        CullView view{};
+        view.viewProjection = viewProjection;
+        view.planes[0] = normalizePlane(rows[3] + rows[0]);
+        view.planes[1] = normalizePlane(rows[3] - rows[0]);
+        view.planes[2] = normalizePlane(rows[3] + rows[1]);
+        view.planes[3] = normalizePlane(rows[3] - rows[1]);
+        // 0 <= z, not -w <= z as with OpenGL's depth range.
+        view.planes[4] = normalizePlane(rows[2]);
+        view.planes[5] = normalizePlane(rows[3] - rows[2]);
+        return view;
+    }
+
+    uint32_t frustumCullSpheres(const CullView& view, const BoundsSoA& bounds, uint32_t begin, uint32_t end, uint32_t* visible)
+    {
+        uint32_t count = 0;
+        uint32_t i = begin;
+
+#ifdef BVR_CULL_SSE2
+        __m128 planeX[6];
+        __m128 planeY[6];
+        __m128 planeZ[6];
+        __m128 planeW[6];
+        for (int p = 0; p < 6; ++p) {
+            planeX[p] = _mm_set1_ps(view.planes[p].x);
+            planeY[p] = _mm_set1_ps(view.planes[p].y);
+            planeZ[p] = _mm_set1_ps(view.planes[p].z);
+            planeW[p] = _mm_set1_ps(view.planes[p].w);
+        }
+
+        for (; i + 4 <= end; i += 4) {
+            __m128 x = _mm_loadu_ps(&bounds.x[i]);
+            __m128 y = _mm_loadu_ps(&bounds.y[i]);
+            __m128 z = _mm_loadu_ps(&bounds.z[i]);
+            __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&bounds.radius[i]));
+
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < 6; ++p) {
+                __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                    _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p])
+                );
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+            }
+
+            // Branchless compaction: every lane is written, only visible ones
+            // advance the output.
+            uint32_t mask = uint32_t(_mm_movemask_ps(inside));
+            for (uint32_t lane = 0; lane < 4; ++lane) {
+                visible[count] = i + lane;
+                count += (mask >> lane) & 1;
+            }
+        }
+#endif
+
+        for (; i < end; ++i) {
+            glm::vec3 center{ bounds.x[i], bounds.y[i], bounds.z[i] };
+            bool inside = true;
+            for (const glm::vec4& plane : view.planes) {
+                inside = inside && glm::dot(glm::vec3(plane), center) + plane.w >= -bounds.radius[i];
+            }
+            if (inside) {
+                visible[count++] = i;
+            }
+        }
+        return count;
+    }
+
+    InstanceCuller::InstanceCuller(Renderer& renderer, const InstanceSet& instances) :
+        m_renderer(renderer),
+        m_instanceCount(instances.size()),
+        m_cpuBounds(instances.bounds),
+        m_cpuMeshes(instances.meshes),
+        m_ready(std::make_shared<std::atomic<bool>>(false))
+    {
+        if (instances.bounds.size() != m_instanceCount || instances.colors.size() != m_instanceCount ||
+            instances.meshes.size() != m_instanceCount || m_instanceCount == 0) {
+            throw std::runtime_error("InstanceSet arrays must be non-empty and of equal size");
+        }
+        m_stats.instances = m_instanceCount;
+
+        createMeshes();
+        createBuffers(instances);
+        createHizPyramid();
+        createPipelines();
+
+        uint32_t frameCount = m_renderer.getFrameCount();
+        m_countPending.resize(frameCount, false);
+        for (uint32_t i = 0; i < frameCount; ++i) {
+            m_countReadbacks.push_back(m_renderer.getMemory().createBuffer(
+                vk::BufferCreateInfo{ vk::BufferCreateFlags{}, sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferDst },
+                MemoryUsage::eReadback
+            ));
+        }
+    }
+
+    InstanceCuller::~InstanceCuller()
+    {
+        m_renderer.getUploads().wait(m_uploadValue);
+
+        GpuMemory& memory = m_renderer.getMemory();
+        vk::Device device = m_renderer.getDevice();
+        std::vector<Buffer> buffers{ m_bounds, m_transforms, m_colors, m_meshes, m_meshTable, m_vertices, m_indices };
+        buffers.insert(buffers.end(), m_countReadbacks.begin(), m_countReadbacks.end());
+        std::vector<vk::ImageView> views{ m_hizView };
+        for (const HizLevel& level : m_hizLevels) {
+            views.push_back(level.view);
+        }
+        Image hiz = m_hiz;
+        vk::RenderPass renderPass = m_drawRenderPass;
+
+        // Everything else came from the pipeline cache, which owns it and drops
+        // the draw pipeline along with the render pass.
+        PipelineCache& pipelines = m_renderer.getPipelines();
+        RenderGraph& graph = m_renderer.getRenderGraph();
+        m_renderer.deferRelease([&memory, &pipelines, &graph, device, buffers, views, hiz, renderPass]() mutable {
+            for (Buffer& buffer : buffers) {
+                memory.destroyBuffer(buffer);
+            }
+            for (vk::ImageView view : views) {
+                graph.releaseImportedView(view);
+                device.destroyImageView(view);
+            }
+            memory.destroyImage(hiz);
+            pipelines.releaseRenderPass(renderPass);
+            device.destroyRenderPass(renderPass);
+        });
+    }
+
+    void InstanceCuller::createMeshes()
+    {
+        BuiltinMeshGeometry geometry = buildBuiltinMeshes();
+        const std::vector<glm::vec3>& vertices = geometry.vertices;
+        const std::vector<uint32_t>& indices = geometry.indices;
+        for (const BuiltinMeshRange& range : geometry.ranges) {
+            MeshDraw draw{};
+            draw.indexCount = range.indexCount;
+            draw.firstIndex = range.firstIndex;
+            draw.vertexOffset = range.vertexOffset;
+            m_meshDraws.push_back(draw);
+        }
+
+        GpuMemory& memory = m_renderer.getMemory();
+        UploadQueue& uploads = m_renderer.getUploads();
+        vk::DeviceSize vertexBytes = vertices.size() * sizeof(glm::vec3);
+        vk::DeviceSize indexBytes = indices.size() * sizeof(uint32_t);
+        m_vertices = memory.createBuffer(vk::BufferCreateInfo{
+            vk::BufferCreateFlags{},
+            vertexBytes,
+            vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        }, MemoryUsage::eGpuOnly);
+        m_indices = memory.createBuffer(vk::BufferCreateInfo{
+            vk::BufferCreateFlags{},
+            indexBytes,
+            vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        }, MemoryUsage::eGpuOnly);
+        uploads.uploadBuffer(m_vertices.buffer, 0, vertices.data(), vertexBytes);
+        uploads.uploadBuffer(m_indices.buffer, 0, indices.data(), indexBytes);
+    }
+
+    void InstanceCuller::createBuffers(const InstanceSet& instances)
+    {
+        GpuMemory& memory = m_renderer.getMemory();
+        UploadQueue& uploads = m_renderer.getUploads();
+
+        auto createStorage = [&memory, &uploads](const void* data, vk::DeviceSize size) {
+            Buffer buffer = memory.createBuffer(vk::BufferCreateInfo{
+                vk::BufferCreateFlags{},
+                size,
+                vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+            }, MemoryUsage::eGpuOnly);
+            uploads.uploadBuffer(buffer.buffer, 0, data, size);
+            return buffer;
+        };
+
+        m_bounds = createStorage(instances.bounds.data(), m_instanceCount * sizeof(glm::vec4));
+        m_transforms = createStorage(instances.transforms.data(), m_instanceCount * sizeof(glm::mat4));
+        m_colors = createStorage(instances.colors.data(), m_instanceCount * sizeof(glm::vec4));
+        m_meshes = createStorage(instances.meshes.data(), m_instanceCount * sizeof(uint32_t));
+        m_meshTable = createStorage(m_meshDraws.data(), m_meshDraws.size() * sizeof(MeshDraw));
+
+        m_uploadValue = uploads.flush();
+        std::shared_ptr<std::atomic<bool>> ready = m_ready;
+        uploads.whenAcquired(m_uploadValue, [ready]() {
+            ready->store(true, std::memory_order_release);
+        });
+    }
+
+    void InstanceCuller::createHizPyramid()
+    {
+        // Half the target's resolution, the first level already reduces 2x2
+        // depth texels.
+        vk::Extent2D target = m_renderer.getTargetExtent();
+        vk::Extent2D extent{ std::max(target.width / 2, 1u), std::max(target.height / 2, 1u) };
+        uint32_t levelCount = uint32_t(std::floor(std::log2(float(std::max(extent.width, extent.height))))) + 1;
+
+        m_hiz = m_renderer.getMemory().createImage(vk::ImageCreateInfo{
+            vk::ImageCreateFlags{},
+            vk::ImageType::e2D,
+            kHizFormat,
+            vk::Extent3D{ extent.width, extent.height, 1 },
+            levelCount,
+            1,
+            vk::SampleCountFlagBits::e1,
+            vk::ImageTiling::eOptimal,
+            vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled,
+        });
+
+        vk::Device device = m_renderer.getDevice();
+        m_hizView = device.createImageView(vk::ImageViewCreateInfo{
+            vk::ImageViewCreateFlags{},
+            m_hiz.image,
+            vk::ImageViewType::e2D,
+            kHizFormat,
+            vk::ComponentMapping{},
+            vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, levelCount, 0, 1 },
+        });
+        for (uint32_t level = 0; level < levelCount; ++level) {
+            HizLevel hizLevel{};
+            hizLevel.extent = extent;
+            hizLevel.view = device.createImageView(vk::ImageViewCreateInfo{
+                vk::ImageViewCreateFlags{},
+                m_hiz.image,
+                vk::ImageViewType::e2D,
+                kHizFormat,
+                vk::ComponentMapping{},
+                vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, level, 1, 0, 1 },
+            });
+            m_hizLevels.push_back(hizLevel);
+            extent = vk::Extent2D{ std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u) };
+        }
+    }
+
+    void InstanceCuller::createPipelines()
+    {
+        vk::Device device = m_renderer.getDevice();
+        PipelineCache& pipelines = m_renderer.getPipelines();
+
+        m_pointSampler = pipelines.getSampler(vk::SamplerCreateInfo{
+            vk::SamplerCreateFlags{},
+            vk::Filter::eNearest,
+            vk::Filter::eNearest,
+            vk::SamplerMipmapMode::eNearest,
+            vk::SamplerAddressMode::eClampToEdge,
+            vk::SamplerAddressMode::eClampToEdge,
+            vk::SamplerAddressMode::eClampToEdge,
+            0.0f,
+            VK_FALSE,
+            1.0f,
+            VK_FALSE,
+            vk::CompareOp::eNever,
+            0.0f,
+            VK_LOD_CLAMP_NONE,
+        });
+
+        using Type = vk::DescriptorType;
+        const vk::ShaderStageFlags compute = vk::ShaderStageFlagBits::eCompute;
+        std::array<vk::DescriptorSetLayoutBinding, 7> cullBindings{
+            vk::DescriptorSetLayoutBinding{ 0, Type::eUniformBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 1, Type::eStorageBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 2, Type::eStorageBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 3, Type::eStorageBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 4, Type::eStorageBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 5, Type::eStorageBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 6, Type::eCombinedImageSampler, 1, compute },
+        };
+        std::array<vk::DescriptorSetLayoutBinding, 2> hizBindings{
+            vk::DescriptorSetLayoutBinding{ 0, Type::eCombinedImageSampler, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 1, Type::eStorageImage, 1, compute },
+        };
+        std::array<vk::DescriptorSetLayoutBinding, 2> drawBindings{
+            vk::DescriptorSetLayoutBinding{ 0, Type::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex },
+            vk::DescriptorSetLayoutBinding{ 1, Type::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex },
+        };
+        m_cullSetLayout = pipelines.getDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{
+            vk::DescriptorSetLayoutCreateFlags{}, uint32_t(cullBindings.size()), cullBindings.data() });
+        m_hizSetLayout = pipelines.getDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{
+            vk::DescriptorSetLayoutCreateFlags{}, uint32_t(hizBindings.size()), hizBindings.data() });
+        m_drawSetLayout = pipelines.getDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{
+            vk::DescriptorSetLayoutCreateFlags{}, uint32_t(drawBindings.size()), drawBindings.data() });
+
+        vk::PushConstantRange hizConstants{ vk::ShaderStageFlagBits::eCompute, 0, sizeof(HizLevelConstants) };
+        vk::PushConstantRange drawConstants{ vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4) };
+        m_cullLayout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+            vk::PipelineLayoutCreateFlags{}, 1, &m_cullSetLayout, 0, nullptr });
+        m_hizLayout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+            vk::PipelineLayoutCreateFlags{}, 1, &m_hizSetLayout, 1, &hizConstants });
+        m_drawLayout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+            vk::PipelineLayoutCreateFlags{}, 1, &m_drawSetLayout, 1, &drawConstants });
+
+        m_cullPipeline = pipelines.getComputePipeline(vk::ComputePipelineCreateInfo{
+            vk::PipelineCreateFlags{},
+            vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eCompute, m_renderer.createEmbeddedShaderModule("cull.comp"), "main" },
+            m_cullLayout,
+        });
+        m_hizPipeline = pipelines.getComputePipeline(vk::ComputePipelineCreateInfo{
+            vk::PipelineCreateFlags{},
+            vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eCompute, m_renderer.createEmbeddedShaderModule("hiz.comp"), "main" },
+            m_hizLayout,
+        });
+
+        // Same formats as the "draw" pass's attachments, which is all render pass
+        // compatibility asks for.
+        std::array<vk::AttachmentDescription, 2> attachments{
+            vk::AttachmentDescription{
+                vk::AttachmentDescriptionFlags{},
+                vk::Format::eR8G8B8A8Unorm,
+                vk::SampleCountFlagBits::e1,
+                vk::AttachmentLoadOp::eClear,
+                vk::AttachmentStoreOp::eStore,
+                vk::AttachmentLoadOp::eDontCare,
+                vk::AttachmentStoreOp::eDontCare,
+                vk::ImageLayout::eColorAttachmentOptimal,
+                vk::ImageLayout::eColorAttachmentOptimal,
+            },
+            vk::AttachmentDescription{
+                vk::AttachmentDescriptionFlags{},
+                kDepthFormat,
+                vk::SampleCountFlagBits::e1,
+                vk::AttachmentLoadOp::eClear,
+                vk::AttachmentStoreOp::eStore,
+                vk::AttachmentLoadOp::eDontCare,
+                vk::AttachmentStoreOp::eDontCare,
+                vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                vk::ImageLayout::eDepthStencilAttachmentOptimal,
+            },
+        };
+        vk::AttachmentReference colorRef{ 0, vk::ImageLayout::eColorAttachmentOptimal };
+        vk::AttachmentReference depthRef{ 1, vk::ImageLayout::eDepthStencilAttachmentOptimal };
+        vk::SubpassDescription subpass{
+            vk::SubpassDescriptionFlags{},
+            vk::PipelineBindPoint::eGraphics,
+            0, nullptr, // Input attachments
+            1, &colorRef,
+            nullptr, // Resolve attachments
+            &depthRef,
+        };
+        m_drawRenderPass = device.createRenderPass(vk::RenderPassCreateInfo{
+            vk::RenderPassCreateFlags{},
+            uint32_t(attachments.size()), attachments.data(),
+            1, &subpass,
+        });
+
+        std::array<vk::PipelineShaderStageCreateInfo, 2> stages{
+            vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eVertex, m_renderer.createEmbeddedShaderModule("instanced.vert"), "main" },
+            vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eFragment, m_renderer.createEmbeddedShaderModule("triangle.frag"), "main" },
+        };
+
+        vk::VertexInputBindingDescription vertexBinding{ 0, sizeof(glm::vec3), vk::VertexInputRate::eVertex };
+        vk::VertexInputAttributeDescription positionAttribute{ 0, 0, vk::Format::eR32G32B32Sfloat, 0 };
+        vk::PipelineVertexInputStateCreateInfo vertexInput{ vk::PipelineVertexInputStateCreateFlags{}, 1, &vertexBinding, 1, &positionAttribute };
+        vk::PipelineInputAssemblyStateCreateInfo inputAssembly{ vk::PipelineInputAssemblyStateCreateFlags{}, vk::PrimitiveTopology::eTriangleList };
+        vk::PipelineViewportStateCreateInfo viewportState{ vk::PipelineViewportStateCreateFlags{}, 1, nullptr, 1, nullptr };
+        vk::PipelineRasterizationStateCreateInfo rasterization{};
+        rasterization.polygonMode = vk::PolygonMode::eFill;
+        rasterization.cullMode = vk::CullModeFlagBits::eNone;
+        rasterization.frontFace = vk::FrontFace::eCounterClockwise;
+        rasterization.lineWidth = 1.0f;
+        vk::PipelineMultisampleStateCreateInfo multisample{};
+        vk::PipelineDepthStencilStateCreateInfo depthStencil{};
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = vk::CompareOp::eLess;
+        vk::PipelineColorBlendAttachmentState blendAttachment{};
+        blendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+            vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+        vk::PipelineColorBlendStateCreateInfo colorBlend{};
+        colorBlend.attachmentCount = 1;
+        colorBlend.pAttachments = &blendAttachment;
+        std::array<vk::DynamicState, 2> dynamicStates{ vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+        vk::PipelineDynamicStateCreateInfo dynamicState{ vk::PipelineDynamicStateCreateFlags{}, uint32_t(dynamicStates.size()), dynamicStates.data() };
+
+        vk::GraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.stageCount = uint32_t(stages.size());
+        pipelineInfo.pStages = stages.data();
+        pipelineInfo.pVertexInputState = &vertexInput;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterization;
+        pipelineInfo.pMultisampleState = &multisample;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlend;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = m_drawLayout;
+        pipelineInfo.renderPass = m_drawRenderPass;
+        pipelineInfo.subpass = 0;
+        m_drawPipeline = pipelines.getGraphicsPipeline(pipelineInfo);
+    }
+
+    void InstanceCuller::addPasses(RenderGraph& graph, FrameContext& frame, GraphResource target, const glm::mat4& viewProjection, CullMode mode)
+    {
+        if (!isReady()) {
+            throw std::runtime_error("InstanceCuller used before its instances were uploaded");
+        }
+        if (mode == CullMode::eGpu && !m_renderer.isGpuCullingSupported()) {
+            throw std::runtime_error("GPU culling needs drawIndirectCount, multiDrawIndirect and drawIndirectFirstInstance");
+        }
+
+        readBackCount(uint32_t(frame.frameIndex % m_renderer.getFrameCount()));
+
+        CullView view = makeCullView(viewProjection);
+        if (mode == CullMode::eGpu) {
+            addGpuPasses(graph, frame, target, view);
+        }
+        else {
+            addCpuPasses(graph, frame, target, view);
+        }
+    }
+
+    void InstanceCuller::addGpuPasses(RenderGraph& graph, FrameContext& frame, GraphResource target, const CullView& view)
+    {
+        vk::Device device = m_renderer.getDevice();
+        vk::Extent2D extent = m_renderer.getTargetExtent();
+        uint32_t frameSlot = uint32_t(frame.frameIndex % m_renderer.getFrameCount());
+
+        // Uploads are acquired before the frame is recorded and nothing on the
+        // GPU writes these, so they need no barriers.
+        GraphResource bounds = graph.importBuffer("instance_bounds", m_bounds.buffer, m_bounds.size);
+        GraphResource meshes = graph.importBuffer("instance_meshes", m_meshes.buffer, m_meshes.size);
+        GraphResource meshTable = graph.importBuffer("mesh_table", m_meshTable.buffer, m_meshTable.size);
+        GraphResource transforms = graph.importBuffer("instance_transforms", m_transforms.buffer, m_transforms.size);
+        GraphResource colors = graph.importBuffer("instance_colors", m_colors.buffer, m_colors.size);
+        GraphResource vertices = graph.importBuffer("mesh_vertices", m_vertices.buffer, m_vertices.size);
+        GraphResource indices = graph.importBuffer("mesh_indices", m_indices.buffer, m_indices.size);
+
+        // The pyramid stays in the general layout between frames, where the
+        // last "hiz_build" left it.
+        GraphImageDesc hizDesc{};
+        hizDesc.format = kHizFormat;
+        hizDesc.width = m_hizLevels[0].extent.width;
+        hizDesc.height = m_hizLevels[0].extent.height;
+        hizDesc.mipLevels = uint32_t(m_hizLevels.size());
+        GraphImportState hizInitial{};
+        if (m_hizValid) {
+            hizInitial = GraphImportState{ vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite };
+        }
+        GraphResource hiz = graph.importImage(
+            "hiz",
+            m_hiz.image,
+            m_hizView,
+            hizDesc,
+            hizInitial,
+            GraphImportState{ vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead }
+        );
+
+        GraphImageDesc depthDesc{};
+        depthDesc.format = kDepthFormat;
+        depthDesc.width = extent.width;
+        depthDesc.height = extent.height;
+        GraphResource depth = graph.createImage("depth", depthDesc);
+        GraphResource commands = graph.createBuffer("draw_commands", m_instanceCount * sizeof(vk::DrawIndexedIndirectCommand));
+        GraphResource count = graph.createBuffer("draw_count", sizeof(uint32_t));
+
+        RingAllocation params = m_renderer.getMemory().getFrameRing().allocate(sizeof(CullParams));
+        if (!params.buffer) {
+            throw std::runtime_error("Frame ring exhausted by the culling parameters");
+        }
+        CullParams cullParams{};
+        cullParams.prevViewProjection = m_hizViewProjection;
+        for (uint32_t i = 0; i < 6; ++i) {
+            cullParams.planes[i] = view.planes[i];
+        }
+        cullParams.hizSize = glm::vec2(float(hizDesc.width), float(hizDesc.height));
+        cullParams.instanceCount = m_instanceCount;
+        cullParams.hizLevels = m_hizValid ? hizDesc.mipLevels : 0;
+        memcpy(params.mapped, &cullParams, sizeof(cullParams));
+        m_stats.occlusionTested = m_hizValid;
+
+        graph.addPass("clear_count", GraphPassType::eTransfer)
+            .write(count, GraphAccess::eTransferWrite)
+            .record([count](RenderGraphContext& context) {
+                context.getCommandBuffer().fillBuffer(context.getBuffer(count), 0, sizeof(uint32_t), 0);
+            });
+
+        graph.addPass("cull", GraphPassType::eCompute)
+            .read(bounds, GraphAccess::eStorageReadCompute)
+            .read(meshes, GraphAccess::eStorageReadCompute)
+            .read(meshTable, GraphAccess::eStorageReadCompute)
+            .read(hiz, GraphAccess::eSampledCompute)
+            .write(commands, GraphAccess::eStorageWriteCompute)
+            .write(count, GraphAccess::eStorageWriteCompute)
+            .record([this, device, &frame, params, commands, count](RenderGraphContext& context) {
+                vk::DescriptorSet set = allocateSet(device, frame.descriptorPool, m_cullSetLayout);
+                std::array<vk::DescriptorBufferInfo, 6> buffers{
+                    vk::DescriptorBufferInfo{ params.buffer, params.offset, sizeof(CullParams) },
+                    vk::DescriptorBufferInfo{ m_bounds.buffer, 0, VK_WHOLE_SIZE },
+                    vk::DescriptorBufferInfo{ m_meshes.buffer, 0, VK_WHOLE_SIZE },
+                    vk::DescriptorBufferInfo{ m_meshTable.buffer, 0, VK_WHOLE_SIZE },
+                    vk::DescriptorBufferInfo{ context.getBuffer(commands), 0, VK_WHOLE_SIZE },
+                    vk::DescriptorBufferInfo{ context.getBuffer(count), 0, VK_WHOLE_SIZE },
+                };
+                vk::DescriptorImageInfo hizInfo{ m_pointSampler, m_hizView, vk::ImageLayout::eShaderReadOnlyOptimal };
+                std::array<vk::WriteDescriptorSet, 3> writes{
+                    vk::WriteDescriptorSet{ set, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &buffers[0] },
+                    vk::WriteDescriptorSet{ set, 1, 0, 5, vk::DescriptorType::eStorageBuffer, nullptr, &buffers[1] },
+                    vk::WriteDescriptorSet{ set, 6, 0, 1, vk::DescriptorType::eCombinedImageSampler, &hizInfo },
+                };
+                device.updateDescriptorSets(writes, nullptr);
+
+                vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_cullPipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_cullLayout, 0, set, nullptr);
+                commandBuffer.dispatch((m_instanceCount + 63) / 64, 1, 1);
+            });
+
+        graph.addPass("draw", GraphPassType::eRaster)
+            .read(commands, GraphAccess::eIndirectRead)
+            .read(count, GraphAccess::eIndirectRead)
+            .read(transforms, GraphAccess::eStorageReadVertex)
+            .read(colors, GraphAccess::eStorageReadVertex)
+            .read(vertices, GraphAccess::eVertexRead)
+            .read(indices, GraphAccess::eIndexRead)
+            .colorAttachment(target, vk::AttachmentLoadOp::eClear, vk::ClearColorValue{ std::array<float, 4>{ 0.1f, 0.1f, 0.12f, 1.0f } })
+            .depthAttachment(depth, vk::AttachmentLoadOp::eClear)
+            .record([this, device, &frame, view, commands, count](RenderGraphContext& context) {
+                vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                vk::DescriptorSet set = allocateSet(device, frame.descriptorPool, m_drawSetLayout);
+                std::array<vk::DescriptorBufferInfo, 2> buffers{
+                    vk::DescriptorBufferInfo{ m_transforms.buffer, 0, VK_WHOLE_SIZE },
+                    vk::DescriptorBufferInfo{ m_colors.buffer, 0, VK_WHOLE_SIZE },
+                };
+                device.updateDescriptorSets(vk::WriteDescriptorSet{ set, 0, 0, 2, vk::DescriptorType::eStorageBuffer, nullptr, buffers.data() }, nullptr);
+
+                vk::Extent2D extent = context.getExtent();
+                commandBuffer.setViewport(0, vk::Viewport{ 0.0f, 0.0f, float(extent.width), float(extent.height), 0.0f, 1.0f });
+                commandBuffer.setScissor(0, vk::Rect2D{ vk::Offset2D{ 0, 0 }, extent });
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_drawPipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_drawLayout, 0, set, nullptr);
+                commandBuffer.pushConstants(m_drawLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4), &view.viewProjection);
+                commandBuffer.bindVertexBuffers(0, m_vertices.buffer, vk::DeviceSize{ 0 });
+                commandBuffer.bindIndexBuffer(m_indices.buffer, 0, vk::IndexType::eUint32);
+                commandBuffer.drawIndexedIndirectCount(
+                    context.getBuffer(commands), 0,
+                    context.getBuffer(count), 0,
+                    m_instanceCount,
+                    sizeof(vk::DrawIndexedIndirectCommand)
+                );
+            });
+
+        graph.addPass("hiz_build", GraphPassType::eCompute)
+            .read(depth, GraphAccess::eSampledCompute)
+            .write(hiz, GraphAccess::eStorageWriteCompute)
+            .record([this, device, &frame, depth, extent](RenderGraphContext& context) {
+                vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_hizPipeline);
+
+                vk::Extent2D srcExtent = extent;
+                for (uint32_t level = 0; level < m_hizLevels.size(); ++level) {
+                    const HizLevel& dst = m_hizLevels[level];
+                    vk::DescriptorImageInfo srcInfo = level == 0 ?
+                        vk::DescriptorImageInfo{ m_pointSampler, context.getImageView(depth), vk::ImageLayout::eShaderReadOnlyOptimal } :
+                        vk::DescriptorImageInfo{ m_pointSampler, m_hizLevels[level - 1].view, vk::ImageLayout::eGeneral };
+                    vk::DescriptorImageInfo dstInfo{ vk::Sampler{}, dst.view, vk::ImageLayout::eGeneral };
+
+                    vk::DescriptorSet set = allocateSet(device, frame.descriptorPool, m_hizSetLayout);
+                    std::array<vk::WriteDescriptorSet, 2> writes{
+                        vk::WriteDescriptorSet{ set, 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &srcInfo },
+                        vk::WriteDescriptorSet{ set, 1, 0, 1, vk::DescriptorType::eStorageImage, &dstInfo },
+                    };
+                    device.updateDescriptorSets(writes, nullptr);
+
+                    // Each level reads the one written before it.
+                    if (level > 0) {
+                        commandBuffer.pipelineBarrier(
+                            vk::PipelineStageFlagBits::eComputeShader,
+                            vk::PipelineStageFlagBits::eComputeShader,
+                            vk::DependencyFlags{},
+                            vk::MemoryBarrier{ vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead },
+                            nullptr,
+                            nullptr
+                        );
+                    }
+
+                    HizLevelConstants constants{ srcExtent.width, srcExtent.height, dst.extent.width, dst.extent.height };
+                    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_hizLayout, 0, set, nullptr);
+                    commandBuffer.pushConstants(m_hizLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants);
+                    commandBuffer.dispatch((dst.extent.width + 7) / 8, (dst.extent.height + 7) / 8, 1);
+                    srcExtent = dst.extent;
+                }
+            });
+        m_hizValid = true;
+        m_hizViewProjection = view.viewProjection;
+
+        vk::Buffer readback = m_countReadbacks[frameSlot].buffer;
+        graph.addPass("count_readback", GraphPassType::eTransfer)
+            .read(count, GraphAccess::eTransferRead)
+            .sideEffect()
+            .record([count, readback](RenderGraphContext& context) {
+                vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                commandBuffer.copyBuffer(context.getBuffer(count), readback, vk::BufferCopy{ 0, 0, sizeof(uint32_t) });
+                commandBuffer.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eTransfer,
+                    vk::PipelineStageFlagBits::eHost,
+                    vk::DependencyFlags{},
+                    vk::MemoryBarrier{ vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead },
+                    nullptr,
+                    nullptr
+                );
+            });
+        m_countPending[frameSlot] = true;
+    }
+
+    void InstanceCuller::addCpuPasses(RenderGraph& graph, FrameContext& frame, GraphResource target, const CullView& view)
+    {
+        auto cullStart = std::chrono::high_resolution_clock::now();
+
+        // One output list per job, concatenated in order by the draw pass.
+        uint32_t jobCount = (m_instanceCount + kCullGrainSize - 1) / kCullGrainSize;
+        m_cpuVisible.resize(jobCount);
+        std::vector<uint32_t> visibleCounts(jobCount, 0);
+        JobCounter counter;
+        JobSystem& jobs = m_renderer.getJobSystem();
+        jobs.parallelFor(m_instanceCount, kCullGrainSize, [this, &view, &visibleCounts](uint32_t begin, uint32_t end) {
+            std::vector<uint32_t>& visible = m_cpuVisible[begin / kCullGrainSize];
+            visible.resize(end - begin);
+            visibleCounts[begin / kCullGrainSize] = frustumCullSpheres(view, m_cpuBounds, begin, end, visible.data());
+        }, counter);
+        jobs.wait(counter);
+
+        uint32_t visibleCount = 0;
+        for (uint32_t job = 0; job < jobCount; ++job) {
+            m_cpuVisible[job].resize(visibleCounts[job]);
+            visibleCount += visibleCounts[job];
+        }
+        m_stats.cpuVisible = visibleCount;
+        m_stats.cpuCullMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - cullStart).count();
+
+        // Nothing rebuilds the pyramid while the CPU culls, so it goes stale.
+        m_hizValid = false;
+
+        GraphImageDesc depthDesc{};
+        depthDesc.format = kDepthFormat;
+        depthDesc.width = m_renderer.getTargetExtent().width;
+        depthDesc.height = m_renderer.getTargetExtent().height;
+        GraphResource depth = graph.createImage("depth", depthDesc);
+        GraphResource transforms = graph.importBuffer("instance_transforms", m_transforms.buffer, m_transforms.size);
+        GraphResource colors = graph.importBuffer("instance_colors", m_colors.buffer, m_colors.size);
+        GraphResource vertices = graph.importBuffer("mesh_vertices", m_vertices.buffer, m_vertices.size);
+        GraphResource indices = graph.importBuffer("mesh_indices", m_indices.buffer, m_indices.size);
+
+        vk::Device device = m_renderer.getDevice();
+        graph.addPass("draw", GraphPassType::eRaster)
+            .read(transforms, GraphAccess::eStorageReadVertex)
+            .read(colors, GraphAccess::eStorageReadVertex)
+            .read(vertices, GraphAccess::eVertexRead)
+            .read(indices, GraphAccess::eIndexRead)
+            .colorAttachment(target, vk::AttachmentLoadOp::eClear, vk::ClearColorValue{ std::array<float, 4>{ 0.1f, 0.1f, 0.12f, 1.0f } })
+            .depthAttachment(depth, vk::AttachmentLoadOp::eClear)
+            .record([this, device, &frame, view](RenderGraphContext& context) {
+                vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                vk::DescriptorSet set = allocateSet(device, frame.descriptorPool, m_drawSetLayout);
+                std::array<vk::DescriptorBufferInfo, 2> buffers{
+                    vk::DescriptorBufferInfo{ m_transforms.buffer, 0, VK_WHOLE_SIZE },
+                    vk::DescriptorBufferInfo{ m_colors.buffer, 0, VK_WHOLE_SIZE },
+                };
+                device.updateDescriptorSets(vk::WriteDescriptorSet{ set, 0, 0, 2, vk::DescriptorType::eStorageBuffer, nullptr, buffers.data() }, nullptr);
+
+                vk::Extent2D extent = context.getExtent();
+                commandBuffer.setViewport(0, vk::Viewport{ 0.0f, 0.0f, float(extent.width), float(extent.height), 0.0f, 1.0f });
+                commandBuffer.setScissor(0, vk::Rect2D{ vk::Offset2D{ 0, 0 }, extent });
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_drawPipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_drawLayout, 0, set, nullptr);
+                commandBuffer.pushConstants(m_drawLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4), &view.viewProjection);
+                commandBuffer.bindVertexBuffers(0, m_vertices.buffer, vk::DeviceSize{ 0 });
+                commandBuffer.bindIndexBuffer(m_indices.buffer, 0, vk::IndexType::eUint32);
+
+                // firstInstance carries the instance index, as the GPU path's
+                // indirect commands do.
+                for (const std::vector<uint32_t>& visible : m_cpuVisible) {
+                    for (uint32_t instance : visible) {
+                        const MeshDraw& mesh = m_meshDraws[m_cpuMeshes[instance]];
+                        commandBuffer.drawIndexed(mesh.indexCount, 1, mesh.firstIndex, mesh.vertexOffset, instance);
+                    }
+                }
+            });
+    }
+
+    void InstanceCuller::readBackCount(uint32_t frameSlot)
+    {
+        // The renderer waited for the slot's previous frame before handing it out.
+        if (!m_countPending[frameSlot]) {
+            return;
+        }
+        const Buffer& readback = m_countReadbacks[frameSlot];
+        vmaInvalidateAllocation(m_renderer.getMemory().getAllocator(), readback.allocation, 0, VK_WHOLE_SIZE);
+        memcpy(&m_stats.gpuVisible, readback.mapped, sizeof(uint32_t));
+        m_countPending[frameSlot] = false;
+    }
+}
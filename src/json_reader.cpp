@@ -0,0 +1,298 @@
+#include "json_reader.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        constexpr uint32_t kMaxDepth = 256;
+
+        void appendUtf8(std::string& out, uint32_t codepoint)
+        {
+            if (codepoint < 0x80) {
+                out.push_back(char(codepoint));
+            }
+            else if (codepoint < 0x800) {
+                out.push_back(char(0xC0 | (codepoint >> 6)));
+                out.push_back(char(0x80 | (codepoint & 0x3F)));
+            }
+            else if (codepoint < 0x10000) {
+                out.push_back(char(0xE0 | (codepoint >> 12)));
+                out.push_back(char(0x80 | ((codepoint >> 6) & 0x3F)));
+                out.push_back(char(0x80 | (codepoint & 0x3F)));
+            }
+            else {
+                out.push_back(char(0xF0 | (codepoint >> 18)));
+                out.push_back(char(0x80 | ((codepoint >> 12) & 0x3F)));
+                out.push_back(char(0x80 | ((codepoint >> 6) & 0x3F)));
+                out.push_back(char(0x80 | (codepoint & 0x3F)));
+            }
+        }
+    }
+
+    JsonDocument::Type JsonDocument::Value::getType() const
+    {
+        return m_document->m_nodes[m_index].type;
+    }
+
+    JsonDocument::Value JsonDocument::Value::operator[](const char* key) const
+    {
+        if (!isObject()) {
+            return Value{};
+        }
+        for (Value child = firstChild(); child.isValid(); child = child.next()) {
+            if (child.key() == key) {
+                return child;
+            }
+        }
+        return Value{};
+    }
+
+    JsonDocument::Value JsonDocument::Value::operator[](uint32_t index) const
+    {
+        if (!isArray()) {
+            return Value{};
+        }
+        Value child = firstChild();
+        for (uint32_t i = 0; i < index && child.isValid(); ++i) {
+            child = child.next();
+        }
+        return child;
+    }
+
+    uint32_t JsonDocument::Value::size() const
+    {
+        return isValid() ? m_document->m_nodes[m_index].childCount : 0;
+    }
+
+    double JsonDocument::Value::asNumber(double fallback) const
+    {
+        if (!isValid() || getType() != Type::eNumber) {
+            return fallback;
+        }
+        return m_document->m_nodes[m_index].number;
+    }
+
+    bool JsonDocument::Value::asBool(bool fallback) const
+    {
+        if (!isValid() || getType() != Type::eBool) {
+            return fallback;
+        }
+        return m_document->m_nodes[m_index].number != 0.0;
+    }
+
+    std::string_view JsonDocument::Value::asRawString(std::string_view fallback) const
+    {
+        if (!isValid() || getType() != Type::eString) {
+            return fallback;
+        }
+        return m_document->m_nodes[m_index].string;
+    }
+
+    std::string JsonDocument::Value::asString(const std::string& fallback) const
+    {
+        if (!isValid() || getType() != Type::eString) {
+            return fallback;
+        }
+
+        std::string_view raw = m_document->m_nodes[m_index].string;
+        std::string out;
+        out.reserve(raw.size());
+        for (size_t i = 0; i < raw.size(); ++i) {
+            if (raw[i] != '\\' || i + 1 >= raw.size()) {
+                out.push_back(raw[i]);
+                continue;
+            }
+            char escaped = raw[++i];
+            switch (escaped) {
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u':
+                if (i + 4 < raw.size()) {
+                    std::string hex{ raw.substr(i + 1, 4) };
+                    appendUtf8(out, uint32_t(strtoul(hex.c_str(), nullptr, 16)));
+                    i += 4;
+                }
+                break;
+            default: out.push_back(escaped); break;
+            }
+        }
+        return out;
+    }
+
+    JsonDocument::Value JsonDocument::Value::firstChild() const
+    {
+        return isValid() ? Value{ m_document, m_document->m_nodes[m_index].firstChild } : Value{};
+    }
+
+    JsonDocument::Value JsonDocument::Value::next() const
+    {
+        return isValid() ? Value{ m_document, m_document->m_nodes[m_index].nextSibling } : Value{};
+    }
+
+    std::string_view JsonDocument::Value::key() const
+    {
+        return isValid() ? m_document->m_nodes[m_index].key : std::string_view{};
+    }
+
+    void JsonDocument::parse(const char* text, size_t length)
+    {
+        m_text = text;
+        m_length = length;
+        m_pos = 0;
+        m_nodes.clear();
+        // glTF documents average roughly one node per 12 bytes of JSON.
+        m_nodes.reserve(length / 12 + 16);
+
+        parseValue(0);
+        skipWhitespace();
+        if (m_pos != m_length && m_text[m_pos] != '\0') {
+            fail("Trailing characters after the root value");
+        }
+    }
+
+    uint32_t JsonDocument::parseValue(uint32_t depth)
+    {
+        if (depth > kMaxDepth) {
+            fail("Nesting too deep");
+        }
+
+        skipWhitespace();
+        if (m_pos >= m_length) {
+            fail("Unexpected end of input");
+        }
+
+        uint32_t index = uint32_t(m_nodes.size());
+        m_nodes.emplace_back();
+
+        char c = m_text[m_pos];
+        if (c == '{' || c == '[') {
+            const bool isObject = c == '{';
+            const char close = isObject ? '}' : ']';
+            m_nodes[index].type = isObject ? Type::eObject : Type::eArray;
+            ++m_pos;
+
+            uint32_t previous = kInvalid;
+            skipWhitespace();
+            if (m_pos < m_length && m_text[m_pos] == close) {
+                ++m_pos;
+                return index;
+            }
+
+            while (true) {
+                std::string_view key;
+                if (isObject) {
+                    skipWhitespace();
+                    if (m_pos >= m_length || m_text[m_pos] != '"') {
+                        fail("Expected an object key");
+                    }
+                    parseString(key);
+                    skipWhitespace();
+                    if (m_pos >= m_length || m_text[m_pos] != ':') {
+                        fail("Expected ':' after an object key");
+                    }
+                    ++m_pos;
+                }
+
+                // m_nodes may reallocate while parsing the child, so index, never hold references.
+                uint32_t child = parseValue(depth + 1);
+                m_nodes[child].key = key;
+                if (previous == kInvalid) {
+                    m_nodes[index].firstChild = child;
+                }
+                else {
+                    m_nodes[previous].nextSibling = child;
+                }
+                previous = child;
+                m_nodes[index].childCount += 1;
+
+                skipWhitespace();
+                if (m_pos >= m_length) {
+                    fail("Unterminated array or object");
+                }
+                if (m_text[m_pos] == ',') {
+                    ++m_pos;
+                    continue;
+                }
+                if (m_text[m_pos] == close) {
+                    ++m_pos;
+                    return index;
+                }
+                fail("Expected ',' or a closing bracket");
+            }
+        }
+
+        if (c == '"') {
+            std::string_view str;
+            parseString(str);
+            m_nodes[index].type = Type::eString;
+            m_nodes[index].string = str;
+            return index;
+        }
+
+        auto matches = [this](const char* literal) {
+            size_t literalLength = strlen(literal);
+            return m_pos + literalLength <= m_length && strncmp(m_text + m_pos, literal, literalLength) == 0;
+        };
+
+        if (matches("true") || matches("false")) {
+            bool value = c == 't';
+            m_nodes[index].type = Type::eBool;
+            m_nodes[index].number = value ? 1.0 : 0.0;
+            m_pos += value ? 4 : 5;
+            return index;
+        }
+        if (matches("null")) {
+            m_pos += 4;
+            return index;
+        }
+
+        // strtod stops at the first character that can't be part of a number,
+        // which is always a delimiter in valid JSON, so it never reads past the text.
+        char* end = nullptr;
+        double number = strtod(m_text + m_pos, &end);
+        if (end == m_text + m_pos) {
+            fail("Unexpected character");
+        }
+        m_nodes[index].type = Type::eNumber;
+        m_nodes[index].number = number;
+        m_pos = size_t(end - m_text);
+        return index;
+    }
+
+    void JsonDocument::parseString(std::string_view& out)
+    {
+        size_t start = ++m_pos;
+        while (m_pos < m_length && m_text[m_pos] != '"') {
+            m_pos += m_text[m_pos] == '\\' ? 2 : 1;
+        }
+        if (m_pos >= m_length) {
+            fail("Unterminated string");
+        }
+        out = std::string_view{ m_text + start, m_pos - start };
+        ++m_pos;
+    }
+
+    void JsonDocument::skipWhitespace()
+    {
+        while (m_pos < m_length) {
+            char c = m_text[m_pos];
+            if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+                return;
+            }
+            ++m_pos;
+        }
+    }
+
+    void JsonDocument::fail(const char* message) const
+    {
+        std::string errorString{ "JSON parse error at byte " };
+        throw std::runtime_error(errorString.append(std::to_string(m_pos)).append(": ").append(message));
+    }
+}
@@ -0,0 +1,267 @@
+#include "ktx2.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        const uint8_t kKtx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+        const char kWriterKey[] = "KTXwriter";
+        const char kWriterValue[] = "bvr";
+
+        // The fixed part of the file after the identifier.
+        struct Ktx2Header
+        {
+            uint32_t vkFormat;
+            uint32_t typeSize;
+            uint32_t pixelWidth;
+            uint32_t pixelHeight;
+            uint32_t pixelDepth;
+            uint32_t layerCount;
+            uint32_t faceCount;
+            uint32_t levelCount;
+            uint32_t supercompressionScheme;
+            uint32_t dfdByteOffset;
+            uint32_t dfdByteLength;
+            uint32_t kvdByteOffset;
+            uint32_t kvdByteLength;
+            // 64-bit fields, split so the struct needs no padding. Only used
+            // with supercompression.
+            uint32_t sgdByteOffset[2];
+            uint32_t sgdByteLength[2];
+        };
+        static_assert(sizeof(Ktx2Header) == 68, "KTX2 header must be packed");
+
+        struct Ktx2LevelIndex
+        {
+            uint64_t byteOffset;
+            uint64_t byteLength;
+            uint64_t uncompressedByteLength;
+        };
+
+        // Khronos Data Format constants of the basic descriptor block.
+        const uint32_t kDfdModelRgbsda = 1;
+        const uint32_t kDfdPrimariesBt709 = 1;
+        const uint32_t kDfdTransferLinear = 1;
+        const uint32_t kDfdTransferSrgb = 2;
+        const uint8_t kDfdChannelAlpha = 15;
+        const uint8_t kDfdSampleLinear = 0x10;
+        const uint8_t kDfdSampleSigned = 0x40;
+        const uint8_t kDfdSampleFloat = 0x80;
+
+        struct FormatInfo
+        {
+            uint32_t channels = 0;
+            // Bytes per channel.
+            uint32_t channelSize = 0;
+            bool isFloat = false;
+            bool isSrgb = false;
+        };
+
+        FormatInfo getFormatInfo(vk::Format format)
+        {
+            switch (format) {
+            case vk::Format::eR8G8B8A8Unorm: return FormatInfo{ 4, 1, false, false };
+            case vk::Format::eR8G8B8A8Srgb: return FormatInfo{ 4, 1, false, true };
+            case vk::Format::eR16G16Sfloat: return FormatInfo{ 2, 2, true, false };
+            case vk::Format::eR16G16B16A16Sfloat: return FormatInfo{ 4, 2, true, false };
+            case vk::Format::eR32G32Sfloat: return FormatInfo{ 2, 4, true, false };
+            case vk::Format::eR32G32B32A32Sfloat: return FormatInfo{ 4, 4, true, false };
+            default: return FormatInfo{};
+            }
+        }
+
+        void appendU32(std::vector<uint8_t>& out, uint32_t value)
+        {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+            out.insert(out.end(), bytes, bytes + sizeof(value));
+        }
+
+        // Basic data format descriptor, one sample per channel.
+        std::vector<uint8_t> buildDfd(const FormatInfo& info)
+        {
+            uint32_t blockSize = 24 + 16 * info.channels;
+            std::vector<uint8_t> dfd;
+            appendU32(dfd, 4 + blockSize);
+            // Khronos vendor, basic descriptor type, then version 2 and the block size.
+            appendU32(dfd, 0);
+            appendU32(dfd, 2 | (blockSize << 16));
+            appendU32(dfd, kDfdModelRgbsda | (kDfdPrimariesBt709 << 8) | ((info.isSrgb ? kDfdTransferSrgb : kDfdTransferLinear) << 16));
+            // 1x1x1 texel blocks, stored as dimension - 1.
+            appendU32(dfd, 0);
+            appendU32(dfd, info.channels * info.channelSize);
+            appendU32(dfd, 0);
+
+            for (uint32_t channel = 0; channel < info.channels; ++channel) {
+                uint32_t bits = info.channelSize * 8;
+                uint8_t channelType = uint8_t(channel == 3 ? kDfdChannelAlpha : channel);
+                if (info.isFloat) {
+                    channelType |= kDfdSampleFloat | kDfdSampleSigned;
+                }
+                else if (info.isSrgb && channel == 3) {
+                    channelType |= kDfdSampleLinear;
+                }
+                appendU32(dfd, (channel * bits) | ((bits - 1) << 16) | (uint32_t(channelType) << 24));
+                appendU32(dfd, 0);
+                // Float samples span -1..1, normalized ones 0..max.
+                appendU32(dfd, info.isFloat ? 0xBF800000u : 0u);
+                appendU32(dfd, info.isFloat ? 0x3F800000u : (1u << bits) - 1);
+            }
+            return dfd;
+        }
+
+        size_t alignUp(size_t value, size_t alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        [[noreturn]] void fail(const char* message)
+        {
+            throw std::runtime_error(std::string{ "KTX2 error: " }.append(message));
+        }
+    }
+
+    uint32_t getKtx2TexelSize(vk::Format format)
+    {
+        FormatInfo info = getFormatInfo(format);
+        return info.channels * info.channelSize;
+    }
+
+    size_t getKtx2LevelSize(const Ktx2Texture& texture, uint32_t level)
+    {
+        size_t width = std::max(texture.width >> level, 1u);
+        size_t height = std::max(texture.height >> level, 1u);
+        return width * height * getKtx2TexelSize(texture.format) * texture.faceCount;
+    }
+
+    bool isKtx2(const uint8_t* data, size_t size)
+    {
+        return size >= sizeof(kKtx2Identifier) && memcmp(data, kKtx2Identifier, sizeof(kKtx2Identifier)) == 0;
+    }
+
+    void writeKtx2(const std::string& path, const Ktx2Texture& texture)
+    {
+        FormatInfo info = getFormatInfo(texture.format);
+        if (info.channels == 0 || texture.width == 0 || texture.height == 0 || texture.levels.empty() ||
+            (texture.faceCount != 1 && texture.faceCount != 6) || (texture.faceCount == 6 && texture.width != texture.height)) {
+            std::string errorString{ "Unsupported KTX2 texture for " };
+            throw std::runtime_error(errorString.append(path));
+        }
+        uint32_t levelCount = uint32_t(texture.levels.size());
+        for (uint32_t level = 0; level < levelCount; ++level) {
+            if (texture.levels[level].size() != getKtx2LevelSize(texture, level)) {
+                std::string errorString{ "Mip level size mismatch writing " };
+                throw std::runtime_error(errorString.append(path));
+            }
+        }
+
+        std::vector<uint8_t> dfd = buildDfd(info);
+        std::vector<uint8_t> kvd;
+        appendU32(kvd, uint32_t(sizeof(kWriterKey) + sizeof(kWriterValue)));
+        kvd.insert(kvd.end(), kWriterKey, kWriterKey + sizeof(kWriterKey));
+        kvd.insert(kvd.end(), kWriterValue, kWriterValue + sizeof(kWriterValue));
+        kvd.resize(alignUp(kvd.size(), 4), 0);
+
+        Ktx2Header header;
+        memset(&header, 0, sizeof(header));
+        header.vkFormat = uint32_t(texture.format);
+        header.typeSize = info.channelSize;
+        header.pixelWidth = texture.width;
+        header.pixelHeight = texture.height;
+        header.faceCount = texture.faceCount;
+        header.levelCount = levelCount;
+        header.dfdByteOffset = uint32_t(sizeof(kKtx2Identifier) + sizeof(header) + levelCount * sizeof(Ktx2LevelIndex));
+        header.dfdByteLength = uint32_t(dfd.size());
+        header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+        header.kvdByteLength = uint32_t(kvd.size());
+
+        // Level data goes smallest first, each aligned to the texel size and 4.
+        size_t texelSize = getKtx2TexelSize(texture.format);
+        size_t alignment = std::lcm(texelSize, size_t(4));
+        std::vector<Ktx2LevelIndex> levelIndex(levelCount);
+        size_t offset = header.kvdByteOffset + header.kvdByteLength;
+        for (uint32_t level = levelCount; level-- > 0;) {
+            offset = alignUp(offset, alignment);
+            levelIndex[level].byteOffset = offset;
+            levelIndex[level].byteLength = texture.levels[level].size();
+            levelIndex[level].uncompressedByteLength = texture.levels[level].size();
+            offset += texture.levels[level].size();
+        }
+
+        std::string tempPath = path + ".tmp";
+        {
+            std::ofstream file{ tempPath, std::ios::binary | std::ios::trunc };
+            file.write(reinterpret_cast<const char*>(kKtx2Identifier), sizeof(kKtx2Identifier));
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(levelIndex.data()), std::streamsize(levelIndex.size() * sizeof(Ktx2LevelIndex)));
+            file.write(reinterpret_cast<const char*>(dfd.data()), std::streamsize(dfd.size()));
+            file.write(reinterpret_cast<const char*>(kvd.data()), std::streamsize(kvd.size()));
+            size_t written = header.kvdByteOffset + header.kvdByteLength;
+            const char padding[16] = {};
+            for (uint32_t level = levelCount; level-- > 0;) {
+                file.write(padding, std::streamsize(levelIndex[level].byteOffset - written));
+                file.write(reinterpret_cast<const char*>(texture.levels[level].data()), std::streamsize(texture.levels[level].size()));
+                written = levelIndex[level].byteOffset + levelIndex[level].byteLength;
+            }
+            if (!file) {
+                throw std::runtime_error("Failed to write " + tempPath);
+            }
+        }
+        std::remove(path.c_str());
+        if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Failed to replace " + path);
+        }
+    }
+
+    Ktx2Texture readKtx2(const uint8_t* data, size_t size)
+    {
+        if (!isKtx2(data, size)) {
+            fail("missing identifier");
+        }
+        Ktx2Header header;
+        if (size < sizeof(kKtx2Identifier) + sizeof(header)) {
+            fail("truncated header");
+        }
+        memcpy(&header, data + sizeof(kKtx2Identifier), sizeof(header));
+
+        Ktx2Texture texture;
+        texture.format = vk::Format(header.vkFormat);
+        texture.width = header.pixelWidth;
+        texture.height = header.pixelHeight;
+        texture.faceCount = header.faceCount;
+        if (getKtx2TexelSize(texture.format) == 0) {
+            fail("unsupported format");
+        }
+        if (header.supercompressionScheme != 0) {
+            fail("supercompression is not supported");
+        }
+        if (header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth > 1 || header.layerCount > 1 ||
+            (header.faceCount != 1 && header.faceCount != 6) || header.levelCount == 0 || header.levelCount > 32) {
+            fail("unsupported dimensions");
+        }
+
+        size_t indexOffset = sizeof(kKtx2Identifier) + sizeof(header);
+        if (size < indexOffset + header.levelCount * sizeof(Ktx2LevelIndex)) {
+            fail("truncated level index");
+        }
+        texture.levels.resize(header.levelCount);
+        for (uint32_t level = 0; level < header.levelCount; ++level) {
+            Ktx2LevelIndex index;
+            memcpy(&index, data + indexOffset + level * sizeof(Ktx2LevelIndex), sizeof(index));
+            if (index.byteLength != getKtx2LevelSize(texture, level)) {
+                fail("mip level size mismatch");
+            }
+            if (index.byteOffset > size || index.byteLength > size - index.byteOffset) {
+                fail("truncated mip level");
+            }
+            texture.levels[level].assign(data + index.byteOffset, data + index.byteOffset + index.byteLength);
+        }
+        return texture;
+    }
+}
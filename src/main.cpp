@@ -1,358 +1,20 @@
-#include <vulkan/vulkan.hpp>
+#include "renderer.h"
+#include "utils.h"
+
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <stdexcept>
 #include <functional>
 #include <cstdlib>
-#include <set>
+#include <memory>
+#include <string>
 
 namespace bvr
 {
-    inline void debugLog(const char* output)
-    {
-#ifndef NDEBUG
-        std::cout << "INFO: " << output << std::endl;
-#endif
-    }
-
-
-    struct RenderConfig
-    {
-        int width = 1280;
-        int height = 720;
-        std::vector <char*> validationLayers = {
-            "VK_LAYER_KHRONOS_validation"
-        };
-    };
-
-
-    struct QueueFamilyIndices
-    {
-        uint32_t graphicsFamily = UINT32_MAX;
-        uint32_t presentFamily = UINT32_MAX;
-
-        bool isComplete()
-        {
-            return graphicsFamily != UINT32_MAX && presentFamily != UINT32_MAX;
-        }
-    };
-
-
-    class Renderer
-    {
-
-    public:
-        Renderer() = default;
-        Renderer(const RenderConfig& config, GLFWwindow* window) :
-            m_config(config),
-            m_window(window)
-        { };
-
-        ~Renderer()
-        {
-            if (m_instance) {
-                debugLog("Cleaning up Renderer!");
-                m_device.destroy();
-                m_instance.destroySurfaceKHR(m_surface);
-                destroyDebugMessenger();
-                m_instance.destroy();
-            }
-        }
-
-        void init()
-        {
-            debugLog("Initializing Renderer!");
-            initVulkan();
-            debugLog("Renderer Initialized!");
-        }
-
-        void renderFrame() { };
-
-    private:
-        void initVulkan()
-        {
-            createInstance();
-            setupDebugMessenger();
-            createSurface();
-            pickPhysicalDevice();
-            createLogicalDevice();
-        }
-
-        void createInstance()
-        {
-            vk::ApplicationInfo appInfo{
-                "BVR",
-                VK_MAKE_VERSION(0, 1, 0),
-                "N/A",
-                VK_MAKE_VERSION(0, 1, 0),
-                VK_API_VERSION_1_1,
-            };
-
-
-            std::vector<const char*> requiredExtensions{ getRequiredExtensions() };
-            validateExtensions(requiredExtensions);
-
-
-            if (!checkValidationLayerSupport()) {
-                throw std::runtime_error("Validation requested, but layers not available.");
-            };
-
-            vk::InstanceCreateInfo createInfo{
-                vk::InstanceCreateFlags(),
-                &appInfo,
-                static_cast<uint32_t>(m_config.validationLayers.size()),
-                m_config.validationLayers.data(),
-                static_cast<uint32_t>(requiredExtensions.size()),
-                requiredExtensions.data(),
-            };
-
-            VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
-
-            if (isValidationEnabled()) {
-                debugCreateInfo = getDebugMessengerCreateInfo();
-                createInfo.pNext = &debugCreateInfo;
-            }
-
-            m_instance = vk::createInstance(createInfo);
-
-        }
-
-        bool isValidationEnabled()
-        {
-            return m_config.validationLayers.size();
-        }
-
-        std::vector<const char*> getRequiredExtensions() const
-        {
-            uint32_t glfwExtensionCount = 0;
-            const char** glfwExtensions;
-            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-            std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
-
-            if (m_config.validationLayers.size() > 0) {
-                extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-            }
-
-            return extensions;
-        }
-
-        void validateExtensions(std::vector<const char*> requiredExtensions) const
-        {
-            std::vector<vk::ExtensionProperties> extensions = vk::enumerateInstanceExtensionProperties();
-
-            for (size_t i = 0; i < requiredExtensions.size(); ++i) {
-                const char* requiredExtension = requiredExtensions[i];
-                bool requirementMet = false;
-
-                for (size_t j = 0; j < extensions.size(); j++) {
-                    if (strcmp(extensions[j].extensionName, requiredExtension) == 0) {
-                        requirementMet = true;
-                        break;
-                    }
-                }
-
-                if (!requirementMet) {
-                    std::string errorString{ requiredExtension };
-                    throw std::runtime_error(errorString.append(" is not supported!"));
-                }
-            }
-        }
-
-        bool checkValidationLayerSupport() const
-        {
-            std::vector < vk::LayerProperties> layers = vk::enumerateInstanceLayerProperties();
-
-            for (const char* layerName : m_config.validationLayers) {
-                bool layerFound = false;
-
-                for (const vk::LayerProperties& layerProps : layers) {
-                    if (strcmp(layerProps.layerName, layerName) == 0) {
-                        layerFound = true;
-                        break;
-                    }
-                }
-
-                if (!layerFound) {
-                    return false;
-                }
-            }
-
-            return true;
-        }
-
-        void pickPhysicalDevice()
-        {
-            std::vector<vk::PhysicalDevice> devices = m_instance.enumeratePhysicalDevices();
-
-            for (const auto& device : devices) {
-                if (isDeviceSuitable(device)) {
-                    m_physicalDevice = device;
-                    break;
-                }
-            }
-
-            if (!m_physicalDevice) {
-                throw std::runtime_error("Failed to find suitable physical device!");
-            }
-
-#ifndef  NDEBUG
-            vk::PhysicalDeviceProperties props = m_physicalDevice.getProperties();
-            std::string message = "Physical Device found! ";
-            debugLog(message.append(props.deviceName).c_str());
-#endif
-        }
-
-        bool isDeviceSuitable(const vk::PhysicalDevice& device) const
-        {
-            QueueFamilyIndices indices = findQueueFamilies(device);
-
-            vk::PhysicalDeviceProperties props = device.getProperties();
-            vk::PhysicalDeviceFeatures features = device.getFeatures();
-
-            return indices.isComplete() && props.deviceType == vk::PhysicalDeviceType::eDiscreteGpu;
-        }
-
-        QueueFamilyIndices findQueueFamilies(const vk::PhysicalDevice& physicalDevice) const
-        {
-            QueueFamilyIndices indices;
-
-            std::vector<vk::QueueFamilyProperties> queueFamilies = physicalDevice.getQueueFamilyProperties();
-            int i = 0;
-            for (const auto& queueFamily : queueFamilies) {
-                if (queueFamily.queueCount > 0) {
-                    if (queueFamily.queueFlags & vk::QueueFlagBits::eGraphics) {
-                        indices.graphicsFamily = i;
-                    }
-
-                    vk::Bool32 presentSupported = physicalDevice.getSurfaceSupportKHR(i, m_surface);
-                    if (presentSupported) {
-                        indices.presentFamily = i;
-                    }
-                }
-
-                if (indices.isComplete()) {
-                    return indices;
-                }
-                ++i;
-            }
-
-            return indices;
-        }
-
-        void createLogicalDevice()
-        {
-            QueueFamilyIndices indices = findQueueFamilies(m_physicalDevice);
-            float queuePriority = 1.0f;
-
-            std::set<uint32_t> uniqueQueueFamilies{
-                indices.graphicsFamily, indices.presentFamily,
-            };
-
-            std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
-            queueCreateInfos.reserve(uniqueQueueFamilies.size());
-
-            for (const uint32_t queueFamily : uniqueQueueFamilies) {
-                queueCreateInfos.emplace_back(
-                    vk::DeviceQueueCreateFlags{},
-                    indices.graphicsFamily,
-                    1,
-                    &queuePriority
-                );
-            }
-
-            vk::PhysicalDeviceFeatures features{};
-            vk::DeviceCreateInfo createInfo{
-                vk::DeviceCreateFlags(),
-                uint32_t(queueCreateInfos.size()),
-                queueCreateInfos.data(),
-                0, nullptr, // Layers, deprecated and ignored
-                0, nullptr, // Extensions
-                &features,
-            };
-
-            m_device = m_physicalDevice.createDevice(createInfo);
-            m_graphicsQueue = m_device.getQueue(indices.graphicsFamily, 0);
-            m_presentQueue = m_device.getQueue(indices.presentFamily, 0);
-        }
-
-        void createSurface()
-        {
-            VkSurfaceKHR surface;
-            if (glfwCreateWindowSurface(m_instance, m_window, nullptr, &surface) != VK_SUCCESS) {
-                throw std::runtime_error("Failed to create the window surface");
-            }
-            m_surface = surface;
-        }
-
-        VkDebugUtilsMessengerCreateInfoEXT getDebugMessengerCreateInfo() const
-        {
-            vk::DebugUtilsMessengerCreateInfoEXT createInfo{
-                {},
-                vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose | vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning | vk::DebugUtilsMessageSeverityFlagBitsEXT::eError,
-                vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral | vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance | vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation,
-                debugCallback,
-                nullptr,
-            };
-
-            return createInfo;
-        }
-
-        void setupDebugMessenger()
-        {
-            if (m_config.validationLayers.size() == 0) {
-                return;
-            }
-
-            VkDebugUtilsMessengerCreateInfoEXT createInfo = getDebugMessengerCreateInfo();
-
-            auto func = (PFN_vkCreateDebugUtilsMessengerEXT)m_instance.getProcAddr("vkCreateDebugUtilsMessengerEXT");
-
-            VkDebugUtilsMessengerEXT dbgMessenger;
-            if (func != nullptr) {
-                func(m_instance, &createInfo, nullptr, &dbgMessenger);
-                m_dbgMessenger = dbgMessenger;
-            }
-            else {
-                throw std::runtime_error("Failed to setup the Debug Messenger");
-            }
-        }
-
-        void destroyDebugMessenger()
-        {
-            auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)m_instance.getProcAddr("vkDestroyDebugUtilsMessengerEXT");
-            if (func != nullptr && m_dbgMessenger) {
-                func(m_instance, m_dbgMessenger, nullptr);
-            }
-        }
-
-        static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-            VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-            VkDebugUtilsMessageTypeFlagsEXT messageType,
-            const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
-            void* pUserData)
-        {
-
-            std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
-
-            return VK_FALSE;
-        }
-
-        RenderConfig m_config{};
-        GLFWwindow* m_window = nullptr;
-
-        vk::Instance m_instance{};
-        vk::DebugUtilsMessengerEXT m_dbgMessenger;
-        vk::PhysicalDevice m_physicalDevice;
-        vk::SurfaceKHR m_surface;
-
-        vk::Device m_device;
-        vk::Queue m_graphicsQueue;
-        vk::Queue m_presentQueue;
-    };
-
     class BVRApp
     {
     public:
@@ -362,6 +24,7 @@ namespace bvr
         ~BVRApp()
         {
             debugLog("Shutting Down!");
+            m_renderer.reset();
             if (m_window != nullptr) {
                 glfwDestroyWindow(m_window);
             }
@@ -394,34 +57,108 @@ namespace bvr
                 throw std::runtime_error("Could not initialize GLFW");
             }
             glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-            glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+            glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
             m_window = glfwCreateWindow(width, height, "BVR", nullptr, nullptr);
 
             if (m_window == nullptr) {
                 throw std::runtime_error("Could not create GLFW window!");
             }
+            glfwSetWindowUserPointer(m_window, this);
+            glfwSetFramebufferSizeCallback(m_window, onFramebufferResized);
+        }
+
+        static void onFramebufferResized(GLFWwindow* window, int width, int height)
+        {
+            BVRApp* app = static_cast<BVRApp*>(glfwGetWindowUserPointer(window));
+            if (app->m_renderer) {
+                app->m_renderer->resize(uint32_t(width), uint32_t(height));
+            }
         }
 
         void initRenderer()
         {
-            m_renderer = Renderer{ m_config, m_window };
-            m_renderer.init();
+            m_renderer = std::make_unique<Renderer>(m_config, m_window);
+            m_renderer->init();
         }
 
         void mainLoop()
         {
             debugLog("Entering Main Loop!");
             while (!glfwWindowShouldClose(m_window)) {
+                // Nothing is presented while minimized, so don't spin.
+                int width = 0;
+                int height = 0;
+                glfwGetFramebufferSize(m_window, &width, &height);
+                if (width == 0 || height == 0) {
+                    glfwWaitEvents();
+                    continue;
+                }
+
+                // Input is sampled once the frame latency limit lets the frame
+                // start, so it is as fresh as possible when shown.
+                m_renderer->waitForFrameLatency();
                 glfwPollEvents();
+                m_renderer->markInputSampled();
+                m_renderer->renderFrame();
+                logLatency();
+            }
+            m_renderer->waitIdle();
+        }
+
+        // Averages and worst cases of the frames retired in about the last
+        // second.
+        void logLatency()
+        {
+            for (const FrameTimings& timings : m_renderer->takeCompletedTimings()) {
+                ++m_latencyFrames;
+                m_submitLatencyMs += timings.inputToSubmitMs;
+                m_maxSubmitLatencyMs = std::max(m_maxSubmitLatencyMs, timings.inputToSubmitMs);
+                if (timings.inputToPresentMs >= 0.0) {
+                    ++m_presentLatencyFrames;
+                    m_presentLatencyMs += timings.inputToPresentMs;
+                    m_maxPresentLatencyMs = std::max(m_maxPresentLatencyMs, timings.inputToPresentMs);
+                }
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - m_latencyLogTime < std::chrono::seconds(1) || m_latencyFrames == 0) {
+                return;
             }
+            m_latencyLogTime = now;
+
+#ifndef NDEBUG
+            std::string message = "Input to submit ";
+            message.append(std::to_string(m_submitLatencyMs / double(m_latencyFrames))).append(" ms, max ")
+                .append(std::to_string(m_maxSubmitLatencyMs)).append(" ms");
+            if (m_presentLatencyFrames > 0) {
+                message.append(", input to present ").append(std::to_string(m_presentLatencyMs / double(m_presentLatencyFrames)))
+                    .append(" ms, max ").append(std::to_string(m_maxPresentLatencyMs)).append(" ms");
+            }
+            debugLog(message.c_str());
+#endif
+
+            m_latencyFrames = 0;
+            m_presentLatencyFrames = 0;
+            m_submitLatencyMs = 0.0;
+            m_presentLatencyMs = 0.0;
+            m_maxSubmitLatencyMs = 0.0;
+            m_maxPresentLatencyMs = 0.0;
         }
 
         RenderConfig m_config;
         bool m_glfwInitialized = true;
         GLFWwindow* m_window = nullptr;
 
-        Renderer m_renderer;
+        std::unique_ptr<Renderer> m_renderer;
+
+        std::chrono::steady_clock::time_point m_latencyLogTime;
+        uint32_t m_latencyFrames = 0;
+        uint32_t m_presentLatencyFrames = 0;
+        double m_submitLatencyMs = 0.0;
+        double m_presentLatencyMs = 0.0;
+        double m_maxSubmitLatencyMs = 0.0;
+        double m_maxPresentLatencyMs = 0.0;
 
     };
 }
@@ -438,10 +175,38 @@ int main()
     config.validationLayers = { };
 #endif
 
+    if (const char* device = std::getenv("BVR_DEVICE")) {
+        config.forcedDevice = device;
+    }
+    // fifo (default), fifo_relaxed, mailbox or immediate.
+    if (const char* presentMode = std::getenv("BVR_PRESENT_MODE")) {
+        for (bvr::PresentMode mode : { bvr::PresentMode::eFifo, bvr::PresentMode::eFifoRelaxed, bvr::PresentMode::eMailbox, bvr::PresentMode::eImmediate }) {
+            if (std::string{ presentMode } == bvr::toString(mode)) {
+                config.swapchain.presentMode = mode;
+            }
+        }
+    }
+    // Builds the scene shaders from this directory and reloads them on save.
+    if (const char* shaderDirectory = std::getenv("BVR_SHADER_DIR")) {
+        config.shaders.hotReload = true;
+        config.shaders.sourceDirectory = shaderDirectory;
+    }
+
+#if BVR_PROFILE
+    // Profiles the whole run and writes it as a Chrome trace on exit.
+    const char* tracePath = std::getenv("BVR_TRACE");
+    bvr::Profiler::get().setEnabled(tracePath != nullptr);
+#endif
+
     bvr::BVRApp app{ config };
 
     try {
         app.run();
+#if BVR_PROFILE
+        if (tracePath != nullptr) {
+            bvr::Profiler::get().writeChromeTrace(tracePath);
+        }
+#endif
     }
     catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -0,0 +1,116 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bvr
+{
+    MappedFile::MappedFile(const std::string& path)
+    {
+        std::string errorString{ "Failed to map " };
+        errorString.append(path);
+
+#ifdef _WIN32
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) {
+            m_file = nullptr;
+            throw std::runtime_error(errorString);
+        }
+
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(m_file, &fileSize);
+        m_size = size_t(fileSize.QuadPart);
+        if (m_size == 0) {
+            close();
+            throw std::runtime_error(errorString.append(": empty file"));
+        }
+
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mapping != nullptr) {
+            m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (m_data == nullptr) {
+            close();
+            throw std::runtime_error(errorString);
+        }
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error(errorString);
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error(errorString.append(": empty or unreadable file"));
+        }
+        m_size = size_t(fileStat.st_size);
+
+        void* mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps its own reference to the file.
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            m_size = 0;
+            throw std::runtime_error(errorString);
+        }
+        madvise(mapping, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const uint8_t*>(mapping);
+#endif
+    }
+
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+    MappedFile::MappedFile(MappedFile&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other) {
+            close();
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+#ifdef _WIN32
+            std::swap(m_file, other.m_file);
+            std::swap(m_mapping, other.m_mapping);
+#endif
+        }
+        return *this;
+    }
+
+    void MappedFile::close()
+    {
+#ifdef _WIN32
+        if (m_data != nullptr) {
+            UnmapViewOfFile(m_data);
+        }
+        if (m_mapping != nullptr) {
+            CloseHandle(m_mapping);
+        }
+        if (m_file != nullptr) {
+            CloseHandle(m_file);
+        }
+        m_file = nullptr;
+        m_mapping = nullptr;
+#else
+        if (m_data != nullptr) {
+            munmap(const_cast<uint8_t*>(m_data), m_size);
+        }
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
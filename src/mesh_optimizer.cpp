@@ -0,0 +1,200 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace bvr
+{
+    void optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize)
+    {
+        const uint32_t triangleCount = uint32_t(indices.size() / 3);
+        if (triangleCount == 0 || vertexCount == 0) {
+            return;
+        }
+
+        // Triangles around each vertex, as offsets into one adjacency array.
+        std::vector<uint32_t> liveTriangles(vertexCount, 0);
+        for (uint32_t index : indices) {
+            ++liveTriangles[index];
+        }
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (uint32_t v = 0; v < vertexCount; ++v) {
+            adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+        }
+        std::vector<uint32_t> adjacency(adjacencyOffsets.back());
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (uint32_t t = 0; t < triangleCount; ++t) {
+            for (uint32_t k = 0; k < 3; ++k) {
+                adjacency[fill[indices[t * 3 + k]]++] = t;
+            }
+        }
+
+        std::vector<uint32_t> cacheTime(vertexCount, 0);
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<uint32_t> deadEnds;
+        std::vector<uint32_t> candidates;
+        std::vector<uint32_t> output;
+        output.reserve(indices.size());
+
+        uint32_t time = cacheSize + 1;
+        uint32_t cursor = 0;
+        // Next vertex with live triangles: the most recent dead end, else the
+        // next one in input order.
+        auto skipDeadEnd = [&]() -> int64_t {
+            while (!deadEnds.empty()) {
+                uint32_t vertex = deadEnds.back();
+                deadEnds.pop_back();
+                if (liveTriangles[vertex] > 0) {
+                    return vertex;
+                }
+            }
+            while (cursor < vertexCount) {
+                if (liveTriangles[cursor] > 0) {
+                    return cursor;
+                }
+                ++cursor;
+            }
+            return -1;
+        };
+
+        int64_t fanning = skipDeadEnd();
+        while (fanning >= 0) {
+            candidates.clear();
+            for (uint32_t a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; ++a) {
+                uint32_t t = adjacency[a];
+                if (emitted[t]) {
+                    continue;
+                }
+                for (uint32_t k = 0; k < 3; ++k) {
+                    uint32_t vertex = indices[t * 3 + k];
+                    output.push_back(vertex);
+                    deadEnds.push_back(vertex);
+                    candidates.push_back(vertex);
+                    --liveTriangles[vertex];
+                    if (time - cacheTime[vertex] > cacheSize) {
+                        cacheTime[vertex] = time++;
+                    }
+                }
+                emitted[t] = true;
+            }
+
+            // Prefer the candidate that will still be in the cache once all its
+            // remaining triangles are emitted, and of those the oldest.
+            int64_t next = -1;
+            int64_t bestPriority = -1;
+            for (uint32_t vertex : candidates) {
+                if (liveTriangles[vertex] == 0) {
+                    continue;
+                }
+                int64_t priority = 0;
+                if (int64_t(time) - int64_t(cacheTime[vertex]) + 2 * int64_t(liveTriangles[vertex]) <= int64_t(cacheSize)) {
+                    priority = int64_t(time) - int64_t(cacheTime[vertex]);
+                }
+                if (priority > bestPriority) {
+                    bestPriority = priority;
+                    next = vertex;
+                }
+            }
+            fanning = next >= 0 ? next : skipDeadEnd();
+        }
+
+        indices = std::move(output);
+    }
+
+    std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t>& indices, uint32_t vertexCount)
+    {
+        std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+        std::vector<uint32_t> order;
+        order.reserve(vertexCount);
+        for (uint32_t& index : indices) {
+            if (remap[index] == UINT32_MAX) {
+                remap[index] = uint32_t(order.size());
+                order.push_back(index);
+            }
+            index = remap[index];
+        }
+        return order;
+    }
+
+    std::vector<Meshlet> buildMeshlets(const std::vector<uint32_t>& indices, const glm::vec3* positions, uint32_t maxVertices, uint32_t maxTriangles)
+    {
+        std::vector<Meshlet> meshlets;
+        std::vector<uint32_t> vertices;
+        uint32_t vertexCount = 0;
+        for (uint32_t index : indices) {
+            vertexCount = std::max(vertexCount, index + 1);
+        }
+        // Meshlet that last used each vertex, plus one.
+        std::vector<uint32_t> lastMeshlet(vertexCount, 0);
+
+        auto finish = [&](Meshlet& meshlet) {
+            glm::vec3 low{ FLT_MAX };
+            glm::vec3 high{ -FLT_MAX };
+            for (uint32_t vertex : vertices) {
+                low = glm::min(low, positions[vertex]);
+                high = glm::max(high, positions[vertex]);
+            }
+            glm::vec3 center = (low + high) * 0.5f;
+            float radius = 0.0f;
+            for (uint32_t vertex : vertices) {
+                radius = std::max(radius, glm::length(positions[vertex] - center));
+            }
+            meshlet.sphere = glm::vec4(center, radius);
+
+            // Axis from the area weighted normals, then the widest angle to it.
+            glm::vec3 axis{ 0.0f };
+            std::vector<glm::vec3> normals;
+            for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.triangleCount * 3; i += 3) {
+                glm::vec3 p0 = positions[indices[i]];
+                glm::vec3 normal = glm::cross(positions[indices[i + 1]] - p0, positions[indices[i + 2]] - p0);
+                axis += normal;
+                float length = glm::length(normal);
+                if (length > 0.0f) {
+                    normals.push_back(normal / length);
+                }
+            }
+            float axisLength = glm::length(axis);
+            if (axisLength > 0.0f && !normals.empty()) {
+                axis /= axisLength;
+                float minCos = 1.0f;
+                for (const glm::vec3& normal : normals) {
+                    minCos = std::min(minCos, glm::dot(normal, axis));
+                }
+                meshlet.cone = glm::vec4(axis, minCos > 0.0f ? std::sqrt(1.0f - minCos * minCos) : 1.0f);
+            }
+            meshlets.push_back(meshlet);
+            vertices.clear();
+        };
+
+        Meshlet current{};
+        for (uint32_t i = 0; i + 2 < indices.size(); i += 3) {
+            uint32_t marker = uint32_t(meshlets.size()) + 1;
+            uint32_t newVertices = 0;
+            for (uint32_t k = 0; k < 3; ++k) {
+                // Repeated vertices within the triangle count once.
+                bool repeated = (k > 0 && indices[i + k] == indices[i]) || (k > 1 && indices[i + k] == indices[i + 1]);
+                newVertices += lastMeshlet[indices[i + k]] != marker && !repeated ? 1 : 0;
+            }
+            if (current.triangleCount > 0 && (current.vertexCount + newVertices > maxVertices || current.triangleCount == maxTriangles)) {
+                finish(current);
+                current = Meshlet{};
+                current.firstIndex = i;
+                marker = uint32_t(meshlets.size()) + 1;
+            }
+            for (uint32_t k = 0; k < 3; ++k) {
+                uint32_t vertex = indices[i + k];
+                if (lastMeshlet[vertex] != marker) {
+                    lastMeshlet[vertex] = marker;
+                    vertices.push_back(vertex);
+                    ++current.vertexCount;
+                }
+            }
+            ++current.triangleCount;
+        }
+        if (current.triangleCount > 0) {
+            finish(current);
+        }
+        return meshlets;
+    }
+}
@@ -0,0 +1,376 @@
+#include "package_loader.h"
+#include "renderer.h"
+#include "upload_queue.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        struct ChunkRange
+        {
+            const uint8_t* data = nullptr;
+            uint64_t size = 0;
+            uint32_t count = 0;
+        };
+
+        double millisecondsSince(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // Whether [offset, offset + count * elementSize) fits in `size`, without
+        // overflowing on hostile values.
+        bool fits(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t size)
+        {
+            if (offset > size || (elementSize != 0 && count > (size - offset) / elementSize)) {
+                return false;
+            }
+            return true;
+        }
+
+        template<typename T>
+        PackageTable<T> toTable(const ChunkRange& chunk, const char* name)
+        {
+            if (chunk.size != uint64_t(chunk.count) * sizeof(T)) {
+                throw std::runtime_error(std::string("Package ") + name + " chunk has the wrong size");
+            }
+            return PackageTable<T>{ reinterpret_cast<const T*>(chunk.data), chunk.count };
+        }
+
+        // Bytes of a full texture record's mip chain, 0 for unknown formats.
+        uint64_t getTextureSize(const PackedTexture& texture)
+        {
+            vk::Format format = vk::Format(texture.format);
+            if (getTexelBlock(format).bytes == 0) {
+                return 0;
+            }
+            uint64_t size = 0;
+            for (uint32_t level = 0; level < texture.levelCount; ++level) {
+                size += getImageLevelSize(format, vk::Extent2D{ texture.width, texture.height }, level);
+            }
+            return size;
+        }
+
+        bool isBlockCompressed(vk::Format format)
+        {
+            return getTexelBlock(format).width > 1;
+        }
+    }
+
+    vk::Buffer PackageAsset::getGeometryBuffer() const
+    {
+        return m_geometry.isValid() ? m_memory->getMovableBuffer(m_geometry).buffer : vk::Buffer{};
+    }
+
+    PackageLoadStats PackageAsset::getStats() const
+    {
+        std::lock_guard<std::mutex> lock{ m_statsMutex };
+        return m_stats;
+    }
+
+    PackageLoader::PackageLoader(Renderer& renderer) :
+        m_renderer(renderer)
+    {
+        m_thread = std::thread(&PackageLoader::loaderLoop, this);
+    }
+
+    PackageLoader::~PackageLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            m_running = false;
+        }
+        m_wake.notify_all();
+        m_thread.join();
+
+        for (const std::shared_ptr<PackageAsset>& asset : m_assets) {
+            releaseResources(*asset);
+        }
+    }
+
+    std::shared_ptr<PackageAsset> PackageLoader::load(const std::string& path)
+    {
+        std::shared_ptr<PackageAsset> asset = std::make_shared<PackageAsset>();
+        asset->m_path = path;
+        asset->m_memory = &m_renderer.getMemory();
+        asset->m_requested = std::chrono::steady_clock::now();
+
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            m_queue.push_back(asset);
+            m_assets.push_back(asset);
+        }
+        m_wake.notify_one();
+        return asset;
+    }
+
+    void PackageLoader::unload(const std::shared_ptr<PackageAsset>& asset)
+    {
+        AssetState state = asset->getState();
+        if (state != AssetState::eResident && state != AssetState::eFailed) {
+            throw std::runtime_error("Only resident or failed assets can be unloaded");
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            m_assets.erase(std::remove(m_assets.begin(), m_assets.end(), asset), m_assets.end());
+        }
+        releaseResources(*asset);
+    }
+
+    void PackageLoader::releaseResources(PackageAsset& asset)
+    {
+        // Failed loads may still have copies in flight on the transfer queue.
+        m_renderer.getUploads().wait(asset.m_lastUploadValue);
+
+        GpuMemory& memory = m_renderer.getMemory();
+        vk::Device device = m_renderer.getDevice();
+        MovableBufferHandle geometry = asset.m_geometry;
+        std::vector<PackageTexture> textures = std::move(asset.m_textures);
+        asset.m_geometry = MovableBufferHandle{};
+        asset.m_textures.clear();
+
+        m_renderer.deferRelease([&memory, device, geometry, textures]() mutable {
+            for (PackageTexture& texture : textures) {
+                device.destroyImageView(texture.view);
+                memory.destroyImage(texture.image);
+            }
+            if (geometry.isValid()) {
+                memory.destroyMovableBuffer(geometry);
+            }
+        });
+    }
+
+    void PackageLoader::loaderLoop()
+    {
+        while (true) {
+            std::shared_ptr<PackageAsset> asset;
+            {
+                std::unique_lock<std::mutex> lock{ m_mutex };
+                m_wake.wait(lock, [this]() { return !m_running || !m_queue.empty(); });
+                if (!m_running) {
+                    return;
+                }
+                asset = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+
+            try {
+                loadAsset(asset);
+            }
+            catch (const std::exception& e) {
+                asset->m_error = e.what();
+                asset->m_lastUploadValue = m_renderer.getUploads().flush();
+                asset->m_state.store(AssetState::eFailed, std::memory_order_release);
+
+                std::string message = "Failed to load ";
+                debugLog(message.append(asset->m_path).append(": ").append(e.what()).c_str());
+            }
+        }
+    }
+
+    void PackageLoader::loadAsset(const std::shared_ptr<PackageAsset>& asset)
+    {
+        asset->m_state.store(AssetState::eParsing, std::memory_order_release);
+
+        GpuMemory& memory = m_renderer.getMemory();
+        UploadQueue& uploads = m_renderer.getUploads();
+        vk::Device device = m_renderer.getDevice();
+
+        asset->m_file = MappedFile{ asset->m_path };
+        const uint8_t* file = asset->m_file.data();
+        const uint64_t fileSize = asset->m_file.size();
+
+        PackageHeader header;
+        if (fileSize < sizeof(header)) {
+            throw std::runtime_error("Not a package");
+        }
+        memcpy(&header, file, sizeof(header));
+        if (header.magic != kPackageMagic) {
+            throw std::runtime_error("Not a package");
+        }
+        if (header.version != kPackageVersion) {
+            throw std::runtime_error("Package version " + std::to_string(header.version) + " is not supported, cook it again");
+        }
+        if (header.fileSize != fileSize) {
+            throw std::runtime_error("Package is truncated");
+        }
+        if (header.tocOffset % alignof(PackageTocEntry) != 0 || !fits(header.tocOffset, header.tocCount, sizeof(PackageTocEntry), fileSize)) {
+            throw std::runtime_error("Package table of contents is out of range");
+        }
+
+        // Unknown chunk types are skipped, so readers of this version can still
+        // open packages with optional extra chunks.
+        ChunkRange chunks[uint32_t(PackageChunk::eTextureData) + 1];
+        const PackageTocEntry* toc = reinterpret_cast<const PackageTocEntry*>(file + header.tocOffset);
+        for (uint32_t i = 0; i < header.tocCount; ++i) {
+            const PackageTocEntry& entry = toc[i];
+            if (entry.offset % kPackageAlignment != 0 || !fits(entry.offset, entry.size, 1, fileSize)) {
+                throw std::runtime_error("Package chunk is out of range");
+            }
+            uint32_t type = uint32_t(entry.type);
+            if (type != 0 && type < std::size(chunks)) {
+                chunks[type] = ChunkRange{ file + entry.offset, entry.size, entry.count };
+            }
+        }
+
+        PackageTable<PackedMesh> meshes = toTable<PackedMesh>(chunks[uint32_t(PackageChunk::eMeshes)], "meshes");
+        PackageTable<PackedPrimitive> primitives = toTable<PackedPrimitive>(chunks[uint32_t(PackageChunk::ePrimitives)], "primitives");
+        PackageTable<PackedMeshlet> meshlets = toTable<PackedMeshlet>(chunks[uint32_t(PackageChunk::eMeshlets)], "meshlets");
+        PackageTable<PackedInstance> instances = toTable<PackedInstance>(chunks[uint32_t(PackageChunk::eInstances)], "instances");
+        PackageTable<PackedMaterial> materials = toTable<PackedMaterial>(chunks[uint32_t(PackageChunk::eMaterials)], "materials");
+        PackageTable<PackedTexture> textures = toTable<PackedTexture>(chunks[uint32_t(PackageChunk::eTextures)], "textures");
+        const ChunkRange& geometry = chunks[uint32_t(PackageChunk::eGeometry)];
+        const ChunkRange& textureData = chunks[uint32_t(PackageChunk::eTextureData)];
+
+        // Every index the renderer will follow, so a corrupt package fails here
+        // instead of reading past a buffer on the GPU.
+        for (const PackedMesh& mesh : meshes) {
+            if (!fits(mesh.firstPrimitive, mesh.primitiveCount, 1, primitives.size())) {
+                throw std::runtime_error("Package mesh references missing primitives");
+            }
+        }
+        for (const PackedPrimitive& primitive : primitives) {
+            bool valid = (primitive.indexSize == 2 || primitive.indexSize == 4) &&
+                primitive.indexOffset % primitive.indexSize == 0 &&
+                fits(primitive.indexOffset, primitive.indexCount, primitive.indexSize, geometry.size) &&
+                fits(primitive.positionOffset, primitive.vertexCount, 8, geometry.size) &&
+                (!primitive.hasNormals() || fits(primitive.normalOffset, primitive.vertexCount, 4, geometry.size)) &&
+                (!primitive.hasTexcoords() || fits(primitive.texcoordOffset, primitive.vertexCount, 4, geometry.size)) &&
+                fits(primitive.firstMeshlet, primitive.meshletCount, 1, meshlets.size()) &&
+                primitive.material < int32_t(materials.size());
+            if (!valid) {
+                throw std::runtime_error("Package primitive is out of range");
+            }
+        }
+        for (const PackedInstance& instance : instances) {
+            if (instance.mesh >= meshes.size()) {
+                throw std::runtime_error("Package instance references a missing mesh");
+            }
+        }
+        for (const PackedMaterial& material : materials) {
+            for (int32_t texture : { material.baseColorTexture, material.metallicRoughnessTexture, material.normalTexture }) {
+                if (texture >= int32_t(textures.size())) {
+                    throw std::runtime_error("Package material references a missing texture");
+                }
+            }
+        }
+        for (const PackedTexture& texture : textures) {
+            if (texture.levelCount != 0 && (getTextureSize(texture) != texture.dataSize || !fits(texture.dataOffset, texture.dataSize, 1, textureData.size))) {
+                throw std::runtime_error("Package texture is out of range");
+            }
+        }
+
+        asset->m_meshes = meshes;
+        asset->m_primitives = primitives;
+        asset->m_meshlets = meshlets;
+        asset->m_instances = instances;
+        asset->m_materials = materials;
+        asset->m_textures.resize(textures.size());
+        {
+            std::lock_guard<std::mutex> lock{ asset->m_statsMutex };
+            asset->m_stats.fileBytes = fileSize;
+            asset->m_stats.geometryBytes = geometry.size;
+            asset->m_stats.parsedMs = millisecondsSince(asset->m_requested);
+        }
+        asset->m_state.store(AssetState::eStreaming, std::memory_order_release);
+
+        // The geometry chunk is already laid out as the buffer, one copy does it.
+        if (geometry.size > 0) {
+            asset->m_geometry = memory.createMovableBuffer(
+                vk::BufferCreateInfo{
+                    vk::BufferCreateFlags{},
+                    geometry.size,
+                    vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer |
+                        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                }
+            );
+            vk::Buffer geometryBuffer = memory.getMovableBuffer(asset->m_geometry).buffer;
+            uploads.uploadBuffer(geometryBuffer, 0, geometry.data, geometry.size);
+        }
+
+        uint64_t geometryValue = uploads.flush();
+        uploads.whenAcquired(geometryValue, [asset]() {
+            AssetState expected = AssetState::eStreaming;
+            if (asset->m_state.compare_exchange_strong(expected, AssetState::eDrawable, std::memory_order_acq_rel)) {
+                // Nothing writes the geometry anymore, so it may move from now on.
+                if (asset->m_geometry.isValid()) {
+                    asset->m_memory->unpinMovableBuffer(asset->m_geometry);
+                }
+                std::lock_guard<std::mutex> lock{ asset->m_statsMutex };
+                asset->m_stats.drawableMs = millisecondsSince(asset->m_requested);
+            }
+        });
+
+        const bool bcSupported = m_renderer.isTextureCompressionBcSupported();
+        uint64_t textureBytes = 0;
+        uint32_t texturesSkipped = 0;
+        for (uint32_t i = 0; i < textures.size(); ++i) {
+            const PackedTexture& record = textures[i];
+            vk::Format format = vk::Format(record.format);
+            if (record.levelCount == 0) {
+                ++texturesSkipped;
+                continue;
+            }
+            if (isBlockCompressed(format) && !bcSupported) {
+                ++texturesSkipped;
+                std::string message = "Skipping texture ";
+                debugLog(message.append(std::to_string(i)).append(" of ").append(asset->m_path)
+                    .append(": the device can't sample BC formats, cook with --uncompressed").c_str());
+                continue;
+            }
+
+            PackageTexture& texture = asset->m_textures[i];
+            texture.format = format;
+            texture.width = record.width;
+            texture.height = record.height;
+            texture.levelCount = record.levelCount;
+            vk::ImageCreateInfo imageInfo{
+                vk::ImageCreateFlags{},
+                vk::ImageType::e2D,
+                format,
+                vk::Extent3D{ record.width, record.height, 1 },
+                record.levelCount,
+                1, // Array layers
+                vk::SampleCountFlagBits::e1,
+                vk::ImageTiling::eOptimal,
+                vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst,
+            };
+            texture.image = memory.createImage(imageInfo);
+            uploads.uploadImage(texture.image.image, format, vk::Extent2D{ record.width, record.height }, record.levelCount, textureData.data + record.dataOffset);
+            texture.view = device.createImageView(vk::ImageViewCreateInfo{
+                vk::ImageViewCreateFlags{},
+                texture.image.image,
+                vk::ImageViewType::e2D,
+                format,
+                vk::ComponentMapping{},
+                vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, record.levelCount, 0, 1 },
+            });
+            textureBytes += record.dataSize;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{ asset->m_statsMutex };
+            asset->m_stats.textureBytes = textureBytes;
+            asset->m_stats.texturesSkipped = texturesSkipped;
+        }
+        asset->m_lastUploadValue = uploads.flush();
+        uploads.whenAcquired(asset->m_lastUploadValue, [asset]() {
+            AssetState state = asset->m_state.load(std::memory_order_acquire);
+            if (state == AssetState::eStreaming || state == AssetState::eDrawable) {
+                std::lock_guard<std::mutex> lock{ asset->m_statsMutex };
+                asset->m_stats.residentMs = millisecondsSince(asset->m_requested);
+                if (asset->m_stats.drawableMs == 0.0) {
+                    asset->m_stats.drawableMs = asset->m_stats.residentMs;
+                }
+                asset->m_state.store(AssetState::eResident, std::memory_order_release);
+            }
+        });
+    }
+}
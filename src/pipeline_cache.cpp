@@ -0,0 +1,902 @@
+#include "pipeline_cache.h"
+#include "utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace bvr
+{
+    namespace
+    {
+        constexpr uint32_t kCacheFileMagic = 0x43505642; // "BVPC"
+        constexpr uint32_t kCacheFileVersion = 1;
+
+        // Prepended to the driver's cache data. The driver validates its own
+        // header too, but some drivers crash or silently recompile on foreign
+        // data, so we reject it before it ever reaches them.
+        struct CacheFileHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t vendorID;
+            uint32_t deviceID;
+            uint32_t driverVersion;
+            uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+            uint64_t dataSize;
+            uint64_t dataHash;
+        };
+
+        // FNV-1a, fed field by field so struct padding never reaches the hash.
+        // Cache keys also keep the bytes, to tell collisions apart.
+        class Hasher
+        {
+        public:
+            explicit Hasher(bool keepBytes = false) : m_keepBytes(keepBytes) { }
+
+            void addBytes(const void* data, size_t size)
+            {
+                const uint8_t* bytes = static_cast<const uint8_t*>(data);
+                for (size_t i = 0; i < size; ++i) {
+                    m_hash = (m_hash ^ bytes[i]) * 0x100000001B3ull;
+                }
+                if (m_keepBytes) {
+                    m_bytes.insert(m_bytes.end(), bytes, bytes + size);
+                }
+            }
+
+            template <typename T>
+            void add(T value)
+            {
+                static_assert(std::is_arithmetic<T>::value, "Hash arithmetic values, convert Vulkan types first");
+                addBytes(&value, sizeof(value));
+            }
+
+            template <typename BitType>
+            void addFlags(vk::Flags<BitType> flags)
+            {
+                add(static_cast<typename vk::Flags<BitType>::MaskType>(flags));
+            }
+
+            template <typename Enum>
+            void addEnum(Enum value)
+            {
+                add(static_cast<int64_t>(value));
+            }
+
+            template <typename Handle>
+            void addHandle(Handle handle)
+            {
+                // Pointers on 64-bit platforms, uint64_t on 32-bit ones.
+                typename Handle::CType raw = static_cast<typename Handle::CType>(handle);
+                addBytes(&raw, sizeof(raw));
+            }
+
+            void addString(const char* string)
+            {
+                if (string == nullptr) {
+                    add(uint8_t(0));
+                    return;
+                }
+                addBytes(string, strlen(string) + 1);
+            }
+
+            uint64_t get() const { return m_hash; }
+            PipelineCacheKey takeKey() { return PipelineCacheKey{ m_hash, std::move(m_bytes) }; }
+
+        private:
+            uint64_t m_hash = 0xCBF29CE484222325ull;
+            bool m_keepBytes = false;
+            std::vector<uint8_t> m_bytes;
+        };
+
+        void requireNoChain(const void* pNext, const char* what)
+        {
+            if (pNext != nullptr) {
+                std::string errorString{ "PipelineCache does not support pNext chains on " };
+                throw std::runtime_error(errorString.append(what));
+            }
+        }
+
+        template <typename T>
+        std::vector<T> copyArray(const T* data, uint32_t count)
+        {
+            return data != nullptr ? std::vector<T>(data, data + count) : std::vector<T>{};
+        }
+
+        void hashStage(Hasher& hasher, const vk::PipelineShaderStageCreateInfo& stage)
+        {
+            requireNoChain(stage.pNext, "shader stages");
+            hasher.addFlags(stage.flags);
+            hasher.addFlags(vk::ShaderStageFlags{ stage.stage });
+            hasher.addHandle(stage.module);
+            hasher.addString(stage.pName);
+
+            const vk::SpecializationInfo* specialization = stage.pSpecializationInfo;
+            hasher.add(uint32_t(specialization != nullptr ? specialization->mapEntryCount : 0));
+            if (specialization != nullptr) {
+                for (uint32_t i = 0; i < specialization->mapEntryCount; ++i) {
+                    hasher.add(specialization->pMapEntries[i].constantID);
+                    hasher.add(specialization->pMapEntries[i].offset);
+                    hasher.add(uint64_t(specialization->pMapEntries[i].size));
+                }
+                hasher.add(uint64_t(specialization->dataSize));
+                hasher.addBytes(specialization->pData, specialization->dataSize);
+            }
+        }
+
+        PipelineCacheKey hashGraphicsPipeline(const vk::GraphicsPipelineCreateInfo& info)
+        {
+            requireNoChain(info.pNext, "graphics pipelines");
+
+            Hasher hasher{ true };
+            hasher.add(uint8_t('G'));
+            hasher.addFlags(info.flags);
+            hasher.add(info.stageCount);
+            for (uint32_t i = 0; i < info.stageCount; ++i) {
+                hashStage(hasher, info.pStages[i]);
+            }
+
+            if (const vk::PipelineVertexInputStateCreateInfo* state = info.pVertexInputState) {
+                requireNoChain(state->pNext, "vertex input state");
+                hasher.add(state->vertexBindingDescriptionCount);
+                for (uint32_t i = 0; i < state->vertexBindingDescriptionCount; ++i) {
+                    hasher.add(state->pVertexBindingDescriptions[i].binding);
+                    hasher.add(state->pVertexBindingDescriptions[i].stride);
+                    hasher.addEnum(state->pVertexBindingDescriptions[i].inputRate);
+                }
+                hasher.add(state->vertexAttributeDescriptionCount);
+                for (uint32_t i = 0; i < state->vertexAttributeDescriptionCount; ++i) {
+                    hasher.add(state->pVertexAttributeDescriptions[i].location);
+                    hasher.add(state->pVertexAttributeDescriptions[i].binding);
+                    hasher.addEnum(state->pVertexAttributeDescriptions[i].format);
+                    hasher.add(state->pVertexAttributeDescriptions[i].offset);
+                }
+            }
+
+            if (const vk::PipelineInputAssemblyStateCreateInfo* state = info.pInputAssemblyState) {
+                requireNoChain(state->pNext, "input assembly state");
+                hasher.addEnum(state->topology);
+                hasher.add(state->primitiveRestartEnable);
+            }
+
+            if (const vk::PipelineTessellationStateCreateInfo* state = info.pTessellationState) {
+                requireNoChain(state->pNext, "tessellation state");
+                hasher.add(state->patchControlPoints);
+            }
+
+            if (const vk::PipelineViewportStateCreateInfo* state = info.pViewportState) {
+                requireNoChain(state->pNext, "viewport state");
+                hasher.add(state->viewportCount);
+                hasher.add(state->scissorCount);
+                // Null when viewports and scissors are dynamic.
+                for (uint32_t i = 0; state->pViewports != nullptr && i < state->viewportCount; ++i) {
+                    const vk::Viewport& viewport = state->pViewports[i];
+                    hasher.add(viewport.x);
+                    hasher.add(viewport.y);
+                    hasher.add(viewport.width);
+                    hasher.add(viewport.height);
+                    hasher.add(viewport.minDepth);
+                    hasher.add(viewport.maxDepth);
+                }
+                for (uint32_t i = 0; state->pScissors != nullptr && i < state->scissorCount; ++i) {
+                    const vk::Rect2D& scissor = state->pScissors[i];
+                    hasher.add(scissor.offset.x);
+                    hasher.add(scissor.offset.y);
+                    hasher.add(scissor.extent.width);
+                    hasher.add(scissor.extent.height);
+                }
+            }
+
+            if (const vk::PipelineRasterizationStateCreateInfo* state = info.pRasterizationState) {
+                requireNoChain(state->pNext, "rasterization state");
+                hasher.add(state->depthClampEnable);
+                hasher.add(state->rasterizerDiscardEnable);
+                hasher.addEnum(state->polygonMode);
+                hasher.addFlags(state->cullMode);
+                hasher.addEnum(state->frontFace);
+                hasher.add(state->depthBiasEnable);
+                hasher.add(state->depthBiasConstantFactor);
+                hasher.add(state->depthBiasClamp);
+                hasher.add(state->depthBiasSlopeFactor);
+                hasher.add(state->lineWidth);
+            }
+
+            if (const vk::PipelineMultisampleStateCreateInfo* state = info.pMultisampleState) {
+                requireNoChain(state->pNext, "multisample state");
+                hasher.addFlags(vk::SampleCountFlags{ state->rasterizationSamples });
+                hasher.add(state->sampleShadingEnable);
+                hasher.add(state->minSampleShading);
+                if (state->pSampleMask != nullptr) {
+                    uint32_t words = (uint32_t(state->rasterizationSamples) + 31) / 32;
+                    hasher.addBytes(state->pSampleMask, words * sizeof(vk::SampleMask));
+                }
+                hasher.add(state->alphaToCoverageEnable);
+                hasher.add(state->alphaToOneEnable);
+            }
+
+            if (const vk::PipelineDepthStencilStateCreateInfo* state = info.pDepthStencilState) {
+                requireNoChain(state->pNext, "depth stencil state");
+                hasher.add(state->depthTestEnable);
+                hasher.add(state->depthWriteEnable);
+                hasher.addEnum(state->depthCompareOp);
+                hasher.add(state->depthBoundsTestEnable);
+                hasher.add(state->stencilTestEnable);
+                for (const vk::StencilOpState* op : { &state->front, &state->back }) {
+                    hasher.addEnum(op->failOp);
+                    hasher.addEnum(op->passOp);
+                    hasher.addEnum(op->depthFailOp);
+                    hasher.addEnum(op->compareOp);
+                    hasher.add(op->compareMask);
+                    hasher.add(op->writeMask);
+                    hasher.add(op->reference);
+                }
+                hasher.add(state->minDepthBounds);
+                hasher.add(state->maxDepthBounds);
+            }
+
+            if (const vk::PipelineColorBlendStateCreateInfo* state = info.pColorBlendState) {
+                requireNoChain(state->pNext, "color blend state");
+                hasher.add(state->logicOpEnable);
+                hasher.addEnum(state->logicOp);
+                hasher.add(state->attachmentCount);
+                for (uint32_t i = 0; i < state->attachmentCount; ++i) {
+                    const vk::PipelineColorBlendAttachmentState& attachment = state->pAttachments[i];
+                    hasher.add(attachment.blendEnable);
+                    hasher.addEnum(attachment.srcColorBlendFactor);
+                    hasher.addEnum(attachment.dstColorBlendFactor);
+                    hasher.addEnum(attachment.colorBlendOp);
+                    hasher.addEnum(attachment.srcAlphaBlendFactor);
+                    hasher.addEnum(attachment.dstAlphaBlendFactor);
+                    hasher.addEnum(attachment.alphaBlendOp);
+                    hasher.addFlags(attachment.colorWriteMask);
+                }
+                for (float constant : state->blendConstants) {
+                    hasher.add(constant);
+                }
+            }
+
+            if (const vk::PipelineDynamicStateCreateInfo* state = info.pDynamicState) {
+                requireNoChain(state->pNext, "dynamic state");
+                hasher.add(state->dynamicStateCount);
+                for (uint32_t i = 0; i < state->dynamicStateCount; ++i) {
+                    hasher.addEnum(state->pDynamicStates[i]);
+                }
+            }
+
+            hasher.addHandle(info.layout);
+            hasher.addHandle(info.renderPass);
+            hasher.add(info.subpass);
+            hasher.addHandle(info.basePipelineHandle);
+            hasher.add(info.basePipelineIndex);
+            return hasher.takeKey();
+        }
+
+        PipelineCacheKey hashComputePipeline(const vk::ComputePipelineCreateInfo& info)
+        {
+            requireNoChain(info.pNext, "compute pipelines");
+
+            Hasher hasher{ true };
+            hasher.add(uint8_t('C'));
+            hasher.addFlags(info.flags);
+            hashStage(hasher, info.stage);
+            hasher.addHandle(info.layout);
+            hasher.addHandle(info.basePipelineHandle);
+            hasher.add(info.basePipelineIndex);
+            return hasher.takeKey();
+        }
+
+        PipelineCacheKey hashDescriptorSetLayout(const vk::DescriptorSetLayoutCreateInfo& info)
+        {
+            Hasher hasher{ true };
+            hasher.addFlags(info.flags);
+            hasher.add(info.bindingCount);
+            for (uint32_t i = 0; i < info.bindingCount; ++i) {
+                const vk::DescriptorSetLayoutBinding& binding = info.pBindings[i];
+                hasher.add(binding.binding);
+                hasher.addEnum(binding.descriptorType);
+                hasher.add(binding.descriptorCount);
+                hasher.addFlags(binding.stageFlags);
+                for (uint32_t j = 0; binding.pImmutableSamplers != nullptr && j < binding.descriptorCount; ++j) {
+                    hasher.addHandle(binding.pImmutableSamplers[j]);
+                }
+            }
+
+            // Binding flags are the one extension descriptor indexing needs.
+            for (const vk::BaseInStructure* next = static_cast<const vk::BaseInStructure*>(info.pNext); next != nullptr; next = next->pNext) {
+                if (next->sType != vk::StructureType::eDescriptorSetLayoutBindingFlagsCreateInfo) {
+                    requireNoChain(next, "descriptor set layouts, other than binding flags");
+                }
+                const auto* bindingFlags = reinterpret_cast<const vk::DescriptorSetLayoutBindingFlagsCreateInfo*>(next);
+                hasher.add(bindingFlags->bindingCount);
+                for (uint32_t i = 0; i < bindingFlags->bindingCount; ++i) {
+                    hasher.addFlags(bindingFlags->pBindingFlags[i]);
+                }
+            }
+            return hasher.takeKey();
+        }
+
+        PipelineCacheKey hashPipelineLayout(const vk::PipelineLayoutCreateInfo& info)
+        {
+            requireNoChain(info.pNext, "pipeline layouts");
+
+            Hasher hasher{ true };
+            hasher.addFlags(info.flags);
+            hasher.add(info.setLayoutCount);
+            for (uint32_t i = 0; i < info.setLayoutCount; ++i) {
+                hasher.addHandle(info.pSetLayouts[i]);
+            }
+            hasher.add(info.pushConstantRangeCount);
+            for (uint32_t i = 0; i < info.pushConstantRangeCount; ++i) {
+                hasher.addFlags(info.pPushConstantRanges[i].stageFlags);
+                hasher.add(info.pPushConstantRanges[i].offset);
+                hasher.add(info.pPushConstantRanges[i].size);
+            }
+            return hasher.takeKey();
+        }
+
+        PipelineCacheKey hashSampler(const vk::SamplerCreateInfo& info)
+        {
+            requireNoChain(info.pNext, "samplers");
+
+            Hasher hasher{ true };
+            hasher.addFlags(info.flags);
+            hasher.addEnum(info.magFilter);
+            hasher.addEnum(info.minFilter);
+            hasher.addEnum(info.mipmapMode);
+            hasher.addEnum(info.addressModeU);
+            hasher.addEnum(info.addressModeV);
+            hasher.addEnum(info.addressModeW);
+            hasher.add(info.mipLodBias);
+            hasher.add(info.anisotropyEnable);
+            hasher.add(info.maxAnisotropy);
+            hasher.add(info.compareEnable);
+            hasher.addEnum(info.compareOp);
+            hasher.add(info.minLod);
+            hasher.add(info.maxLod);
+            hasher.addEnum(info.borderColor);
+            hasher.add(info.unnormalizedCoordinates);
+            return hasher.takeKey();
+        }
+
+        double millisecondsSince(std::chrono::high_resolution_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+    }
+
+    // Deep copies of create infos for background compilation, since the
+    // caller's arrays are gone by the time the compile thread gets to them.
+    struct PipelineCache::OwnedGraphicsPipelineInfo
+    {
+        struct Stage
+        {
+            vk::PipelineShaderStageCreateInfo info;
+            std::string entryPoint;
+            vk::SpecializationInfo specialization;
+            std::vector<vk::SpecializationMapEntry> mapEntries;
+            std::vector<uint8_t> data;
+        };
+
+        std::vector<Stage> stages;
+        std::vector<vk::PipelineShaderStageCreateInfo> stageInfos;
+        vk::PipelineVertexInputStateCreateInfo vertexInput;
+        std::vector<vk::VertexInputBindingDescription> vertexBindings;
+        std::vector<vk::VertexInputAttributeDescription> vertexAttributes;
+        vk::PipelineInputAssemblyStateCreateInfo inputAssembly;
+        vk::PipelineTessellationStateCreateInfo tessellation;
+        vk::PipelineViewportStateCreateInfo viewport;
+        std::vector<vk::Viewport> viewports;
+        std::vector<vk::Rect2D> scissors;
+        vk::PipelineRasterizationStateCreateInfo rasterization;
+        vk::PipelineMultisampleStateCreateInfo multisample;
+        std::vector<vk::SampleMask> sampleMask;
+        vk::PipelineDepthStencilStateCreateInfo depthStencil;
+        vk::PipelineColorBlendStateCreateInfo colorBlend;
+        std::vector<vk::PipelineColorBlendAttachmentState> blendAttachments;
+        vk::PipelineDynamicStateCreateInfo dynamic;
+        std::vector<vk::DynamicState> dynamicStates;
+        vk::GraphicsPipelineCreateInfo info;
+
+        explicit OwnedGraphicsPipelineInfo(const vk::GraphicsPipelineCreateInfo& source) :
+            info(source)
+        {
+            stages.resize(source.stageCount);
+            for (uint32_t i = 0; i < source.stageCount; ++i) {
+                stages[i] = copyStage(source.pStages[i]);
+            }
+            // Only take pointers once the vector won't move anymore.
+            for (Stage& stage : stages) {
+                stage.info.pName = stage.entryPoint.c_str();
+                if (stage.info.pSpecializationInfo != nullptr) {
+                    stage.specialization.pMapEntries = stage.mapEntries.data();
+                    stage.specialization.pData = stage.data.data();
+                    stage.info.pSpecializationInfo = &stage.specialization;
+                }
+                stageInfos.push_back(stage.info);
+            }
+            info.pStages = stageInfos.data();
+
+            if (source.pVertexInputState != nullptr) {
+                vertexInput = *source.pVertexInputState;
+                vertexBindings = copyArray(vertexInput.pVertexBindingDescriptions, vertexInput.vertexBindingDescriptionCount);
+                vertexAttributes = copyArray(vertexInput.pVertexAttributeDescriptions, vertexInput.vertexAttributeDescriptionCount);
+                vertexInput.pVertexBindingDescriptions = vertexBindings.data();
+                vertexInput.pVertexAttributeDescriptions = vertexAttributes.data();
+                info.pVertexInputState = &vertexInput;
+            }
+            if (source.pInputAssemblyState != nullptr) {
+                inputAssembly = *source.pInputAssemblyState;
+                info.pInputAssemblyState = &inputAssembly;
+            }
+            if (source.pTessellationState != nullptr) {
+                tessellation = *source.pTessellationState;
+                info.pTessellationState = &tessellation;
+            }
+            if (source.pViewportState != nullptr) {
+                viewport = *source.pViewportState;
+                viewports = copyArray(viewport.pViewports, viewport.viewportCount);
+                scissors = copyArray(viewport.pScissors, viewport.scissorCount);
+                viewport.pViewports = viewports.empty() ? nullptr : viewports.data();
+                viewport.pScissors = scissors.empty() ? nullptr : scissors.data();
+                info.pViewportState = &viewport;
+            }
+            if (source.pRasterizationState != nullptr) {
+                rasterization = *source.pRasterizationState;
+                info.pRasterizationState = &rasterization;
+            }
+            if (source.pMultisampleState != nullptr) {
+                multisample = *source.pMultisampleState;
+                sampleMask = copyArray(multisample.pSampleMask, (uint32_t(multisample.rasterizationSamples) + 31) / 32);
+                multisample.pSampleMask = sampleMask.empty() ? nullptr : sampleMask.data();
+                info.pMultisampleState = &multisample;
+            }
+            if (source.pDepthStencilState != nullptr) {
+                depthStencil = *source.pDepthStencilState;
+                info.pDepthStencilState = &depthStencil;
+            }
+            if (source.pColorBlendState != nullptr) {
+                colorBlend = *source.pColorBlendState;
+                blendAttachments = copyArray(colorBlend.pAttachments, colorBlend.attachmentCount);
+                colorBlend.pAttachments = blendAttachments.data();
+                info.pColorBlendState = &colorBlend;
+            }
+            if (source.pDynamicState != nullptr) {
+                dynamic = *source.pDynamicState;
+                dynamicStates = copyArray(dynamic.pDynamicStates, dynamic.dynamicStateCount);
+                dynamic.pDynamicStates = dynamicStates.data();
+                info.pDynamicState = &dynamic;
+            }
+        }
+
+        OwnedGraphicsPipelineInfo(const OwnedGraphicsPipelineInfo&) = delete;
+        OwnedGraphicsPipelineInfo& operator=(const OwnedGraphicsPipelineInfo&) = delete;
+
+        static Stage copyStage(const vk::PipelineShaderStageCreateInfo& source)
+        {
+            Stage stage;
+            stage.info = source;
+            stage.entryPoint = source.pName;
+            if (source.pSpecializationInfo != nullptr) {
+                stage.specialization = *source.pSpecializationInfo;
+                stage.mapEntries = copyArray(stage.specialization.pMapEntries, stage.specialization.mapEntryCount);
+                const uint8_t* data = static_cast<const uint8_t*>(stage.specialization.pData);
+                stage.data.assign(data, data + stage.specialization.dataSize);
+            }
+            return stage;
+        }
+    };
+
+    struct PipelineCache::OwnedComputePipelineInfo
+    {
+        OwnedGraphicsPipelineInfo::Stage stage;
+        vk::ComputePipelineCreateInfo info;
+
+        explicit OwnedComputePipelineInfo(const vk::ComputePipelineCreateInfo& source) :
+            stage(OwnedGraphicsPipelineInfo::copyStage(source.stage)),
+            info(source)
+        {
+            stage.info.pName = stage.entryPoint.c_str();
+            if (stage.info.pSpecializationInfo != nullptr) {
+                stage.specialization.pMapEntries = stage.mapEntries.data();
+                stage.specialization.pData = stage.data.data();
+                stage.info.pSpecializationInfo = &stage.specialization;
+            }
+            info.stage = stage.info;
+        }
+
+        OwnedComputePipelineInfo(const OwnedComputePipelineInfo&) = delete;
+        OwnedComputePipelineInfo& operator=(const OwnedComputePipelineInfo&) = delete;
+    };
+
+    const char* toString(PipelineCacheLoad load)
+    {
+        switch (load) {
+        case PipelineCacheLoad::eWarm: return "warm";
+        case PipelineCacheLoad::eInvalidated: return "invalidated";
+        default: return "cold";
+        }
+    }
+
+    PipelineCache::PipelineCache(vk::Device device, const vk::PhysicalDeviceProperties& properties, const std::string& path) :
+        m_device(device),
+        m_properties(properties),
+        m_path(path)
+    {
+        std::vector<uint8_t> initialData = loadFromDisk();
+        m_cache = m_device.createPipelineCache(vk::PipelineCacheCreateInfo{
+            vk::PipelineCacheCreateFlags{},
+            initialData.size(),
+            initialData.empty() ? nullptr : initialData.data(),
+        });
+    }
+
+    PipelineCache::~PipelineCache()
+    {
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            m_running = false;
+        }
+        m_compileWake.notify_all();
+        if (m_compileThread.joinable()) {
+            m_compileThread.join();
+        }
+
+        try {
+            save();
+        }
+        catch (const std::exception& e) {
+            std::string message = "Failed to save the pipeline cache: ";
+            debugLog(message.append(e.what()).c_str());
+        }
+
+        for (auto& entry : m_pipelines) {
+            if (entry.second->m_pipeline) {
+                m_device.destroyPipeline(entry.second->m_pipeline);
+            }
+        }
+        for (auto& entry : m_pipelineLayouts) {
+            m_device.destroyPipelineLayout(entry.second);
+        }
+        for (auto& entry : m_setLayouts) {
+            m_device.destroyDescriptorSetLayout(entry.second);
+        }
+        for (auto& entry : m_samplers) {
+            m_device.destroySampler(entry.second);
+        }
+        for (auto& entry : m_shaderModules) {
+            m_device.destroyShaderModule(entry.second);
+        }
+        m_device.destroyPipelineCache(m_cache);
+    }
+
+    std::vector<uint8_t> PipelineCache::loadFromDisk()
+    {
+        m_stats.load = PipelineCacheLoad::eCold;
+        if (m_path.empty()) {
+            return {};
+        }
+
+        std::ifstream file{ m_path, std::ios::binary | std::ios::ate };
+        if (!file) {
+            return {};
+        }
+        std::vector<uint8_t> contents(size_t(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(contents.data()), std::streamsize(contents.size()));
+
+        auto reject = [this](const char* reason) {
+            m_stats.load = PipelineCacheLoad::eInvalidated;
+            std::string message = "Discarding pipeline cache ";
+            debugLog(message.append(m_path).append(": ").append(reason).c_str());
+            return std::vector<uint8_t>{};
+        };
+
+        CacheFileHeader header;
+        if (!file || contents.size() < sizeof(header)) {
+            return reject("truncated");
+        }
+        memcpy(&header, contents.data(), sizeof(header));
+        if (header.magic != kCacheFileMagic || header.version != kCacheFileVersion) {
+            return reject("unknown format");
+        }
+        if (header.vendorID != m_properties.vendorID || header.deviceID != m_properties.deviceID) {
+            return reject("written by another device");
+        }
+        if (header.driverVersion != m_properties.driverVersion ||
+            memcmp(header.pipelineCacheUUID, &m_properties.pipelineCacheUUID[0], VK_UUID_SIZE) != 0) {
+            return reject("written by another driver version");
+        }
+        if (header.dataSize != contents.size() - sizeof(header)) {
+            return reject("truncated");
+        }
+
+        std::vector<uint8_t> data(contents.begin() + sizeof(header), contents.end());
+        Hasher hasher;
+        hasher.addBytes(data.data(), data.size());
+        if (hasher.get() != header.dataHash) {
+            return reject("corrupt");
+        }
+
+        // VkPipelineCacheHeaderVersionOne: header size, version, vendor, device, UUID.
+        uint32_t driverHeader[4] = {};
+        if (data.size() < sizeof(driverHeader) + VK_UUID_SIZE) {
+            return reject("truncated driver header");
+        }
+        memcpy(driverHeader, data.data(), sizeof(driverHeader));
+        if (driverHeader[1] != uint32_t(VK_PIPELINE_CACHE_HEADER_VERSION_ONE) ||
+            driverHeader[2] != m_properties.vendorID ||
+            driverHeader[3] != m_properties.deviceID ||
+            memcmp(data.data() + sizeof(driverHeader), &m_properties.pipelineCacheUUID[0], VK_UUID_SIZE) != 0) {
+            return reject("driver header mismatch");
+        }
+
+        m_stats.load = PipelineCacheLoad::eWarm;
+        m_stats.diskBytes = data.size();
+        return data;
+    }
+
+    void PipelineCache::save() const
+    {
+        if (m_path.empty()) {
+            return;
+        }
+
+        std::vector<uint8_t> data = m_device.getPipelineCacheData(m_cache);
+
+        CacheFileHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = kCacheFileMagic;
+        header.version = kCacheFileVersion;
+        header.vendorID = m_properties.vendorID;
+        header.deviceID = m_properties.deviceID;
+        header.driverVersion = m_properties.driverVersion;
+        memcpy(header.pipelineCacheUUID, &m_properties.pipelineCacheUUID[0], VK_UUID_SIZE);
+        header.dataSize = data.size();
+        Hasher hasher;
+        hasher.addBytes(data.data(), data.size());
+        header.dataHash = hasher.get();
+
+        // Write next to the old file and swap, so a crash never leaves half a cache.
+        std::string tempPath = m_path + ".tmp";
+        {
+            std::ofstream file{ tempPath, std::ios::binary | std::ios::trunc };
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+            if (!file) {
+                throw std::runtime_error("Failed to write " + tempPath);
+            }
+        }
+        std::remove(m_path.c_str());
+        if (std::rename(tempPath.c_str(), m_path.c_str()) != 0) {
+            throw std::runtime_error("Failed to replace " + m_path);
+        }
+    }
+
+    vk::ShaderModule PipelineCache::getShaderModule(const uint32_t* code, size_t size)
+    {
+        Hasher hasher{ true };
+        hasher.addBytes(code, size);
+        PipelineCacheKey key = hasher.takeKey();
+
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        auto it = m_shaderModules.find(key);
+        if (it != m_shaderModules.end()) {
+            return it->second;
+        }
+        vk::ShaderModule module = m_device.createShaderModule(vk::ShaderModuleCreateInfo{ vk::ShaderModuleCreateFlags{}, size, code });
+        m_shaderModules.emplace(std::move(key), module);
+        return module;
+    }
+
+    vk::DescriptorSetLayout PipelineCache::getDescriptorSetLayout(const vk::DescriptorSetLayoutCreateInfo& createInfo)
+    {
+        PipelineCacheKey key = hashDescriptorSetLayout(createInfo);
+
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        auto it = m_setLayouts.find(key);
+        if (it != m_setLayouts.end()) {
+            ++m_stats.layoutHits;
+            return it->second;
+        }
+        ++m_stats.layoutMisses;
+        vk::DescriptorSetLayout layout = m_device.createDescriptorSetLayout(createInfo);
+        m_setLayouts.emplace(std::move(key), layout);
+        return layout;
+    }
+
+    vk::PipelineLayout PipelineCache::getPipelineLayout(const vk::PipelineLayoutCreateInfo& createInfo)
+    {
+        PipelineCacheKey key = hashPipelineLayout(createInfo);
+
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        auto it = m_pipelineLayouts.find(key);
+        if (it != m_pipelineLayouts.end()) {
+            ++m_stats.layoutHits;
+            return it->second;
+        }
+        ++m_stats.layoutMisses;
+        vk::PipelineLayout layout = m_device.createPipelineLayout(createInfo);
+        m_pipelineLayouts.emplace(std::move(key), layout);
+        return layout;
+    }
+
+    vk::Sampler PipelineCache::getSampler(const vk::SamplerCreateInfo& createInfo)
+    {
+        PipelineCacheKey key = hashSampler(createInfo);
+
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        auto it = m_samplers.find(key);
+        if (it != m_samplers.end()) {
+            ++m_stats.samplerHits;
+            return it->second;
+        }
+        ++m_stats.samplerMisses;
+        vk::Sampler sampler = m_device.createSampler(createInfo);
+        m_samplers.emplace(std::move(key), sampler);
+        return sampler;
+    }
+
+    vk::Pipeline PipelineCache::getGraphicsPipeline(const vk::GraphicsPipelineCreateInfo& createInfo)
+    {
+        bool inserted = false;
+        std::shared_ptr<AsyncPipeline> pipeline = findOrInsertPipeline(hashGraphicsPipeline(createInfo), createInfo.renderPass, inserted);
+        if (inserted) {
+            compile(*pipeline, &createInfo, nullptr);
+        }
+        return waitForPipeline(*pipeline);
+    }
+
+    vk::Pipeline PipelineCache::getComputePipeline(const vk::ComputePipelineCreateInfo& createInfo)
+    {
+        bool inserted = false;
+        std::shared_ptr<AsyncPipeline> pipeline = findOrInsertPipeline(hashComputePipeline(createInfo), vk::RenderPass{}, inserted);
+        if (inserted) {
+            compile(*pipeline, nullptr, &createInfo);
+        }
+        return waitForPipeline(*pipeline);
+    }
+
+    std::shared_ptr<const AsyncPipeline> PipelineCache::compileGraphicsPipelineAsync(const vk::GraphicsPipelineCreateInfo& createInfo)
+    {
+        bool inserted = false;
+        std::shared_ptr<AsyncPipeline> pipeline = findOrInsertPipeline(hashGraphicsPipeline(createInfo), createInfo.renderPass, inserted);
+        if (inserted) {
+            CompileRequest request{ pipeline, std::make_shared<OwnedGraphicsPipelineInfo>(createInfo), nullptr };
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            if (!m_compileThread.joinable()) {
+                m_compileThread = std::thread(&PipelineCache::compileLoop, this);
+            }
+            m_compileQueue.push_back(std::move(request));
+            m_compileWake.notify_one();
+        }
+        return pipeline;
+    }
+
+    std::shared_ptr<const AsyncPipeline> PipelineCache::compileComputePipelineAsync(const vk::ComputePipelineCreateInfo& createInfo)
+    {
+        bool inserted = false;
+        std::shared_ptr<AsyncPipeline> pipeline = findOrInsertPipeline(hashComputePipeline(createInfo), vk::RenderPass{}, inserted);
+        if (inserted) {
+            CompileRequest request{ pipeline, nullptr, std::make_shared<OwnedComputePipelineInfo>(createInfo) };
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            if (!m_compileThread.joinable()) {
+                m_compileThread = std::thread(&PipelineCache::compileLoop, this);
+            }
+            m_compileQueue.push_back(std::move(request));
+            m_compileWake.notify_one();
+        }
+        return pipeline;
+    }
+
+    PipelineCacheStats PipelineCache::getStats() const
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        return m_stats;
+    }
+
+    void PipelineCache::releaseRenderPass(vk::RenderPass renderPass)
+    {
+        std::vector<std::shared_ptr<AsyncPipeline>> released;
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            for (auto it = m_pipelines.begin(); it != m_pipelines.end();) {
+                if (it->second->m_renderPass == renderPass) {
+                    released.push_back(std::move(it->second));
+                    it = m_pipelines.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+
+        // Background compilations still write into their entry, so let them
+        // finish first.
+        for (const std::shared_ptr<AsyncPipeline>& pipeline : released) {
+            std::unique_lock<std::mutex> lock{ m_mutex };
+            m_compiled.wait(lock, [&pipeline]() { return pipeline->isReady(); });
+            if (pipeline->m_pipeline) {
+                m_device.destroyPipeline(pipeline->m_pipeline);
+                pipeline->m_pipeline = vk::Pipeline{};
+            }
+        }
+    }
+
+    std::shared_ptr<AsyncPipeline> PipelineCache::findOrInsertPipeline(PipelineCacheKey key, vk::RenderPass renderPass, bool& inserted)
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        auto it = m_pipelines.find(key);
+        if (it != m_pipelines.end()) {
+            ++m_stats.pipelineHits;
+            inserted = false;
+            return it->second;
+        }
+
+        ++m_stats.pipelineMisses;
+        inserted = true;
+        std::shared_ptr<AsyncPipeline> pipeline = std::make_shared<AsyncPipeline>();
+        pipeline->m_renderPass = renderPass;
+        m_pipelines.emplace(std::move(key), pipeline);
+        return pipeline;
+    }
+
+    void PipelineCache::compile(AsyncPipeline& pipeline, const vk::GraphicsPipelineCreateInfo* graphics, const vk::ComputePipelineCreateInfo* compute)
+    {
+        // Outside the lock: VkPipelineCache is internally synchronized, and other
+        // threads keep hitting the hash maps while this compiles.
+        auto start = std::chrono::high_resolution_clock::now();
+        vk::Pipeline created;
+        vk::Result result = graphics != nullptr ?
+            m_device.createGraphicsPipelines(m_cache, 1, graphics, nullptr, &created) :
+            m_device.createComputePipelines(m_cache, 1, compute, nullptr, &created);
+        double elapsedMs = millisecondsSince(start);
+
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            m_stats.compileMs += elapsedMs;
+            pipeline.m_pipeline = result == vk::Result::eSuccess ? created : vk::Pipeline{};
+            pipeline.m_state.store(
+                result == vk::Result::eSuccess ? AsyncPipeline::State::eReady : AsyncPipeline::State::eFailed,
+                std::memory_order_release
+            );
+        }
+        m_compiled.notify_all();
+    }
+
+    vk::Pipeline PipelineCache::waitForPipeline(const AsyncPipeline& pipeline)
+    {
+        std::unique_lock<std::mutex> lock{ m_mutex };
+        m_compiled.wait(lock, [&pipeline]() { return pipeline.isReady(); });
+        if (pipeline.isFailed()) {
+            throw std::runtime_error("Failed to compile a pipeline");
+        }
+        return pipeline.m_pipeline;
+    }
+
+    void PipelineCache::compileLoop()
+    {
+        while (true) {
+            CompileRequest request;
+            {
+                std::unique_lock<std::mutex> lock{ m_mutex };
+                m_compileWake.wait(lock, [this]() { return !m_running || !m_compileQueue.empty(); });
+                if (!m_running) {
+                    return;
+                }
+                request = std::move(m_compileQueue.front());
+                m_compileQueue.pop_front();
+            }
+
+            compile(
+                *request.pipeline,
+                request.graphics ? &request.graphics->info : nullptr,
+                request.compute ? &request.compute->info : nullptr
+            );
+        }
+    }
+}
@@ -0,0 +1,344 @@
+#include "profiler.h"
+
+#if BVR_PROFILE
+
+#include "json_writer.h"
+
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        // Chrome trace process ids of the two timelines.
+        const uint32_t kCpuProcess = 1;
+        const uint32_t kGpuProcess = 2;
+
+        const std::chrono::steady_clock::time_point s_epoch = std::chrono::steady_clock::now();
+
+        thread_local void* t_threadBuffer = nullptr;
+
+        void writeMetadata(JsonWriter& json, const char* name, uint32_t process, uint32_t thread, const std::string& value)
+        {
+            json.beginObject();
+            json.field("name", name);
+            json.field("ph", "M");
+            json.field("pid", process);
+            json.field("tid", thread);
+            json.key("args");
+            json.beginObject();
+            json.field("name", value);
+            json.endObject();
+            json.endObject();
+        }
+
+        void writeEvent(JsonWriter& json, const ProfileEvent& event)
+        {
+            json.beginObject();
+            json.field("name", event.name);
+            json.field("cat", event.gpu ? "gpu" : "cpu");
+            json.field("ph", "X");
+            json.field("pid", event.gpu ? kGpuProcess : kCpuProcess);
+            json.field("tid", event.thread);
+            json.field("ts", event.startUs);
+            json.field("dur", event.durationUs);
+            if (event.hasStatistics) {
+                const PipelineStatistics& statistics = event.statistics;
+                json.key("args");
+                json.beginObject();
+                json.field("input_assembly_vertices", statistics.inputAssemblyVertices);
+                json.field("vertex_shader_invocations", statistics.vertexShaderInvocations);
+                json.field("clipping_primitives", statistics.clippingPrimitives);
+                json.field("fragment_shader_invocations", statistics.fragmentShaderInvocations);
+                json.field("compute_shader_invocations", statistics.computeShaderInvocations);
+                json.endObject();
+            }
+            json.endObject();
+        }
+    }
+
+    Profiler& Profiler::get()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    uint64_t Profiler::now()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_epoch).count());
+    }
+
+    Profiler::ThreadBuffer& Profiler::getThreadBuffer()
+    {
+        if (t_threadBuffer == nullptr) {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            auto buffer = std::make_unique<ThreadBuffer>();
+            buffer->thread = uint32_t(m_threads.size());
+            buffer->name = "thread " + std::to_string(buffer->thread);
+            t_threadBuffer = buffer.get();
+            m_threads.push_back(std::move(buffer));
+        }
+        return *static_cast<ThreadBuffer*>(t_threadBuffer);
+    }
+
+    void Profiler::addCpuZone(const char* name, uint64_t startNs, uint64_t endNs)
+    {
+        ThreadBuffer& buffer = getThreadBuffer();
+        ProfileEvent event{};
+        event.name = name;
+        event.thread = buffer.thread;
+        event.startUs = double(startNs) * 1e-3;
+        event.durationUs = double(endNs - startNs) * 1e-3;
+
+        std::lock_guard<std::mutex> lock{ buffer.mutex };
+        buffer.events.push_back(event);
+    }
+
+    void Profiler::addGpuZone(const char* name, double startUs, double durationUs, const PipelineStatistics* statistics)
+    {
+        ProfileEvent event{};
+        event.name = name;
+        event.startUs = startUs;
+        event.durationUs = durationUs;
+        event.gpu = true;
+        if (statistics != nullptr) {
+            event.hasStatistics = true;
+            event.statistics = *statistics;
+        }
+
+        std::lock_guard<std::mutex> lock{ m_gpu.mutex };
+        m_gpu.events.push_back(event);
+    }
+
+    void Profiler::setThreadName(const std::string& name)
+    {
+        ThreadBuffer& buffer = getThreadBuffer();
+        std::lock_guard<std::mutex> lock{ buffer.mutex };
+        buffer.name = name;
+    }
+
+    const char* Profiler::intern(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        return m_names.insert(name).first->c_str();
+    }
+
+    void Profiler::clear()
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        for (const std::unique_ptr<ThreadBuffer>& buffer : m_threads) {
+            std::lock_guard<std::mutex> bufferLock{ buffer->mutex };
+            buffer->events.clear();
+        }
+        std::lock_guard<std::mutex> gpuLock{ m_gpu.mutex };
+        m_gpu.events.clear();
+    }
+
+    size_t Profiler::getEventCount() const
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        size_t count = 0;
+        for (const std::unique_ptr<ThreadBuffer>& buffer : m_threads) {
+            std::lock_guard<std::mutex> bufferLock{ buffer->mutex };
+            count += buffer->events.size();
+        }
+        std::lock_guard<std::mutex> gpuLock{ m_gpu.mutex };
+        return count + m_gpu.events.size();
+    }
+
+    void Profiler::writeChromeTrace(JsonWriter& json) const
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+
+        json.beginObject();
+        json.field("displayTimeUnit", "ms");
+        json.key("traceEvents");
+        json.beginArray();
+
+        writeMetadata(json, "process_name", kCpuProcess, 0, "CPU");
+        writeMetadata(json, "process_name", kGpuProcess, 0, "GPU");
+        writeMetadata(json, "thread_name", kGpuProcess, 0, "graphics queue");
+        for (const std::unique_ptr<ThreadBuffer>& buffer : m_threads) {
+            std::lock_guard<std::mutex> bufferLock{ buffer->mutex };
+            writeMetadata(json, "thread_name", kCpuProcess, buffer->thread, buffer->name);
+            for (const ProfileEvent& event : buffer->events) {
+                writeEvent(json, event);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> gpuLock{ m_gpu.mutex };
+            for (const ProfileEvent& event : m_gpu.events) {
+                writeEvent(json, event);
+            }
+        }
+
+        json.endArray();
+        json.endObject();
+    }
+
+    void Profiler::writeChromeTrace(const std::string& path) const
+    {
+        JsonWriter json;
+        writeChromeTrace(json);
+
+        std::ofstream file{ path, std::ios::binary };
+        if (!file) {
+            std::string errorString{ "Failed to open trace file " };
+            throw std::runtime_error(errorString.append(path));
+        }
+        file << json.str();
+    }
+
+    GpuProfiler::GpuProfiler(vk::Device device, uint32_t frameSlots, float timestampPeriod, uint32_t timestampValidBits, bool pipelineStatistics) :
+        m_device(device),
+        m_timestampPeriod(timestampPeriod),
+        m_timestampMask(timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1),
+        m_pipelineStatistics(pipelineStatistics)
+    {
+        m_slots.resize(frameSlots);
+        for (Slot& slot : m_slots) {
+            // Query 0 marks the start of the frame, then a begin/end pair per zone.
+            slot.timestamps = m_device.createQueryPool(vk::QueryPoolCreateInfo{
+                vk::QueryPoolCreateFlags{},
+                vk::QueryType::eTimestamp,
+                1 + 2 * kMaxZones,
+            });
+            if (m_pipelineStatistics) {
+                slot.statistics = m_device.createQueryPool(vk::QueryPoolCreateInfo{
+                    vk::QueryPoolCreateFlags{},
+                    vk::QueryType::ePipelineStatistics,
+                    kMaxZones,
+                    vk::QueryPipelineStatisticFlagBits::eInputAssemblyVertices |
+                        vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+                        vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+                        vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations |
+                        vk::QueryPipelineStatisticFlagBits::eComputeShaderInvocations,
+                });
+            }
+            slot.zones.reserve(kMaxZones);
+        }
+    }
+
+    GpuProfiler::~GpuProfiler()
+    {
+        for (Slot& slot : m_slots) {
+            m_device.destroyQueryPool(slot.timestamps);
+            m_device.destroyQueryPool(slot.statistics);
+        }
+    }
+
+    void GpuProfiler::beginFrame(vk::CommandBuffer commandBuffer, uint32_t frameSlot)
+    {
+        Slot& slot = m_slots[frameSlot];
+        slot.zones.clear();
+        slot.statisticsUsed = 0;
+        slot.pending = false;
+        slot.recording = Profiler::get().isEnabled();
+        m_current = &slot;
+        if (!slot.recording) {
+            return;
+        }
+
+        commandBuffer.resetQueryPool(slot.timestamps, 0, 1 + 2 * kMaxZones);
+        if (slot.statistics) {
+            commandBuffer.resetQueryPool(slot.statistics, 0, kMaxZones);
+        }
+        commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, slot.timestamps, 0);
+    }
+
+    void GpuProfiler::endFrame()
+    {
+        if (m_current != nullptr && m_current->recording) {
+            m_current->submitNs = Profiler::now();
+            m_current->pending = !m_current->zones.empty();
+        }
+        m_current = nullptr;
+    }
+
+    uint32_t GpuProfiler::beginZone(vk::CommandBuffer commandBuffer, const char* name, bool statistics)
+    {
+        if (m_current == nullptr || !m_current->recording || m_current->zones.size() == kMaxZones) {
+            return UINT32_MAX;
+        }
+
+        Slot& slot = *m_current;
+        uint32_t zone = uint32_t(slot.zones.size());
+        Zone entry{};
+        entry.name = name;
+        if (statistics && slot.statistics) {
+            entry.statisticsQuery = slot.statisticsUsed++;
+            commandBuffer.beginQuery(slot.statistics, entry.statisticsQuery, vk::QueryControlFlags{});
+        }
+        slot.zones.push_back(entry);
+
+        commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, slot.timestamps, 1 + 2 * zone);
+        return zone;
+    }
+
+    void GpuProfiler::endZone(vk::CommandBuffer commandBuffer, uint32_t zone)
+    {
+        if (zone == UINT32_MAX) {
+            return;
+        }
+
+        Slot& slot = *m_current;
+        commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, slot.timestamps, 2 + 2 * zone);
+        if (slot.zones[zone].statisticsQuery != UINT32_MAX) {
+            commandBuffer.endQuery(slot.statistics, slot.zones[zone].statisticsQuery);
+        }
+    }
+
+    void GpuProfiler::collect(uint32_t frameSlot)
+    {
+        Slot& slot = m_slots[frameSlot];
+        if (!slot.pending) {
+            return;
+        }
+        slot.pending = false;
+
+        uint32_t zoneCount = uint32_t(slot.zones.size());
+        std::vector<uint64_t> timestamps(1 + 2 * zoneCount);
+        // The frame has retired, so this never blocks.
+        vk::Result result = m_device.getQueryPoolResults(
+            slot.timestamps, 0, uint32_t(timestamps.size()),
+            timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64
+        );
+        if (result != vk::Result::eSuccess) {
+            return;
+        }
+
+        std::vector<PipelineStatistics> statistics(slot.statisticsUsed);
+        bool hasStatistics = slot.statisticsUsed > 0 && m_device.getQueryPoolResults(
+            slot.statistics, 0, slot.statisticsUsed,
+            statistics.size() * sizeof(PipelineStatistics), statistics.data(), sizeof(PipelineStatistics),
+            vk::QueryResultFlagBits::e64
+        ) == vk::Result::eSuccess;
+
+        Profiler& profiler = Profiler::get();
+        double frameStartUs = double(slot.submitNs) * 1e-3;
+        double ticksToUs = double(m_timestampPeriod) * 1e-3;
+        // Masking the differences drops the undefined high bits and handles
+        // the counter wrapping between two timestamps.
+        auto ticks = [this](uint64_t begin, uint64_t end) { return double((end - begin) & m_timestampMask); };
+        for (uint32_t zone = 0; zone < zoneCount; ++zone) {
+            const Zone& entry = slot.zones[zone];
+            uint64_t begin = timestamps[1 + 2 * zone];
+            uint64_t end = timestamps[2 + 2 * zone];
+            const PipelineStatistics* zoneStatistics = nullptr;
+            if (hasStatistics && entry.statisticsQuery != UINT32_MAX) {
+                zoneStatistics = &statistics[entry.statisticsQuery];
+            }
+            profiler.addGpuZone(
+                entry.name,
+                frameStartUs + ticks(timestamps[0], begin) * ticksToUs,
+                ticks(begin, end) * ticksToUs,
+                zoneStatistics
+            );
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,1202 @@
+#include "render_graph.h"
+#include "json_writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        struct AccessInfo
+        {
+            vk::PipelineStageFlags stages;
+            vk::AccessFlags access;
+            vk::ImageLayout layout;
+            vk::ImageUsageFlags imageUsage;
+            vk::BufferUsageFlags bufferUsage;
+        };
+
+        const vk::AccessFlags kWriteAccess =
+            vk::AccessFlagBits::eShaderWrite |
+            vk::AccessFlagBits::eColorAttachmentWrite |
+            vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+            vk::AccessFlagBits::eTransferWrite |
+            vk::AccessFlagBits::eHostWrite |
+            vk::AccessFlagBits::eMemoryWrite;
+
+        AccessInfo getAccessInfo(GraphAccess access)
+        {
+            using Stage = vk::PipelineStageFlagBits;
+            using Access = vk::AccessFlagBits;
+            using Layout = vk::ImageLayout;
+            using ImageUsage = vk::ImageUsageFlagBits;
+            using BufferUsage = vk::BufferUsageFlagBits;
+
+            const vk::PipelineStageFlags depthStages = Stage::eEarlyFragmentTests | Stage::eLateFragmentTests;
+
+            switch (access) {
+            case GraphAccess::eColorAttachment:
+                return { Stage::eColorAttachmentOutput, Access::eColorAttachmentRead | Access::eColorAttachmentWrite, Layout::eColorAttachmentOptimal, ImageUsage::eColorAttachment, {} };
+            case GraphAccess::eDepthAttachment:
+                return { depthStages, Access::eDepthStencilAttachmentRead | Access::eDepthStencilAttachmentWrite, Layout::eDepthStencilAttachmentOptimal, ImageUsage::eDepthStencilAttachment, {} };
+            case GraphAccess::eDepthRead:
+                return { depthStages, Access::eDepthStencilAttachmentRead, Layout::eDepthStencilReadOnlyOptimal, ImageUsage::eDepthStencilAttachment, {} };
+            case GraphAccess::eSampledFragment:
+                return { Stage::eFragmentShader, Access::eShaderRead, Layout::eShaderReadOnlyOptimal, ImageUsage::eSampled, BufferUsage::eUniformTexelBuffer };
+            case GraphAccess::eSampledCompute:
+                return { Stage::eComputeShader, Access::eShaderRead, Layout::eShaderReadOnlyOptimal, ImageUsage::eSampled, BufferUsage::eUniformTexelBuffer };
+            case GraphAccess::eStorageReadVertex:
+                return { Stage::eVertexShader, Access::eShaderRead, Layout::eGeneral, ImageUsage::eStorage, BufferUsage::eStorageBuffer };
+            case GraphAccess::eStorageReadFragment:
+                return { Stage::eFragmentShader, Access::eShaderRead, Layout::eGeneral, ImageUsage::eStorage, BufferUsage::eStorageBuffer };
+            case GraphAccess::eStorageReadCompute:
+                return { Stage::eComputeShader, Access::eShaderRead, Layout::eGeneral, ImageUsage::eStorage, BufferUsage::eStorageBuffer };
+            case GraphAccess::eStorageWriteCompute:
+                return { Stage::eComputeShader, Access::eShaderRead | Access::eShaderWrite, Layout::eGeneral, ImageUsage::eStorage, BufferUsage::eStorageBuffer };
+            case GraphAccess::eUniformRead:
+                return { Stage::eVertexShader | Stage::eFragmentShader | Stage::eComputeShader, Access::eUniformRead, Layout::eUndefined, {}, BufferUsage::eUniformBuffer };
+            case GraphAccess::eVertexRead:
+                return { Stage::eVertexInput, Access::eVertexAttributeRead, Layout::eUndefined, {}, BufferUsage::eVertexBuffer };
+            case GraphAccess::eIndexRead:
+                return { Stage::eVertexInput, Access::eIndexRead, Layout::eUndefined, {}, BufferUsage::eIndexBuffer };
+            case GraphAccess::eIndirectRead:
+                return { Stage::eDrawIndirect, Access::eIndirectCommandRead, Layout::eUndefined, {}, BufferUsage::eIndirectBuffer };
+            case GraphAccess::eTransferRead:
+                return { Stage::eTransfer, Access::eTransferRead, Layout::eTransferSrcOptimal, ImageUsage::eTransferSrc, BufferUsage::eTransferSrc };
+            case GraphAccess::eTransferWrite:
+                return { Stage::eTransfer, Access::eTransferWrite, Layout::eTransferDstOptimal, ImageUsage::eTransferDst, BufferUsage::eTransferDst };
+            }
+            throw std::runtime_error("Unknown GraphAccess");
+        }
+
+        bool isDepthFormat(vk::Format format)
+        {
+            switch (format) {
+            case vk::Format::eD16Unorm:
+            case vk::Format::eX8D24UnormPack32:
+            case vk::Format::eD32Sfloat:
+            case vk::Format::eD16UnormS8Uint:
+            case vk::Format::eD24UnormS8Uint:
+            case vk::Format::eD32SfloatS8Uint:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        vk::ImageAspectFlags getAspect(vk::Format format)
+        {
+            switch (format) {
+            case vk::Format::eD16UnormS8Uint:
+            case vk::Format::eD24UnormS8Uint:
+            case vk::Format::eD32SfloatS8Uint:
+                return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+            default:
+                return isDepthFormat(format) ? vk::ImageAspectFlagBits::eDepth : vk::ImageAspectFlagBits::eColor;
+            }
+        }
+
+        vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        uint64_t hashCombine(uint64_t hash, uint64_t value)
+        {
+            return (hash ^ value) * 0x100000001B3ull;
+        }
+
+        template <typename Handle>
+        uint64_t handleBits(Handle handle)
+        {
+            // Pointers on 64-bit platforms, uint64_t on 32-bit ones.
+            typename Handle::CType raw = static_cast<typename Handle::CType>(handle);
+            uint64_t bits = 0;
+            memcpy(&bits, &raw, sizeof(raw));
+            return bits;
+        }
+
+        const char* toString(GraphPassType type)
+        {
+            switch (type) {
+            case GraphPassType::eRaster: return "raster";
+            case GraphPassType::eTransfer: return "transfer";
+            default: return "compute";
+            }
+        }
+
+        std::string escapeDot(const std::string& text)
+        {
+            std::string escaped;
+            for (char c : text) {
+                if (c == '"' || c == '\\') {
+                    escaped.push_back('\\');
+                }
+                escaped.push_back(c);
+            }
+            return escaped;
+        }
+
+        std::string formatMiB(vk::DeviceSize bytes)
+        {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.2f MiB", double(bytes) / double(1 << 20));
+            return buffer;
+        }
+    }
+
+    vk::Image RenderGraphContext::getImage(GraphResource resource) const
+    {
+        return m_graph->m_resources[resource.index].vkImage;
+    }
+
+    vk::ImageView RenderGraphContext::getImageView(GraphResource resource) const
+    {
+        return m_graph->m_resources[resource.index].vkView;
+    }
+
+    vk::Buffer RenderGraphContext::getBuffer(GraphResource resource) const
+    {
+        return m_graph->m_resources[resource.index].vkBuffer;
+    }
+
+    RenderGraphPassBuilder& RenderGraphPassBuilder::read(GraphResource resource, GraphAccess access)
+    {
+        m_graph.m_passes[m_pass].uses.push_back({ resource.index, access, false });
+        return *this;
+    }
+
+    RenderGraphPassBuilder& RenderGraphPassBuilder::write(GraphResource resource, GraphAccess access)
+    {
+        if (!(getAccessInfo(access).access & kWriteAccess)) {
+            std::string errorString{ "Pass " };
+            throw std::runtime_error(errorString.append(m_graph.m_passes[m_pass].name).append(" writes through a read-only access"));
+        }
+        m_graph.m_passes[m_pass].uses.push_back({ resource.index, access, true });
+        return *this;
+    }
+
+    RenderGraphPassBuilder& RenderGraphPassBuilder::colorAttachment(GraphResource resource, vk::AttachmentLoadOp loadOp, vk::ClearColorValue clearValue)
+    {
+        RenderGraph::Pass& pass = m_graph.m_passes[m_pass];
+        RenderGraph::Attachment attachment{};
+        attachment.resource = resource.index;
+        attachment.loadOp = loadOp;
+        attachment.clearValue = vk::ClearValue{ clearValue };
+        pass.attachments.push_back(attachment);
+
+        // Loading depends on whoever wrote the attachment before, which keeps
+        // that pass alive.
+        if (loadOp == vk::AttachmentLoadOp::eLoad) {
+            read(resource, GraphAccess::eColorAttachment);
+        }
+        pass.uses.push_back({ resource.index, GraphAccess::eColorAttachment, true, loadOp != vk::AttachmentLoadOp::eLoad });
+        return *this;
+    }
+
+    RenderGraphPassBuilder& RenderGraphPassBuilder::depthAttachment(GraphResource resource, vk::AttachmentLoadOp loadOp, float clearDepth, bool depthWrite)
+    {
+        RenderGraph::Pass& pass = m_graph.m_passes[m_pass];
+        RenderGraph::Attachment attachment{};
+        attachment.resource = resource.index;
+        attachment.loadOp = loadOp;
+        attachment.clearValue = vk::ClearValue{ vk::ClearDepthStencilValue{ clearDepth, 0 } };
+        attachment.depth = true;
+        attachment.depthWrite = depthWrite;
+        pass.attachments.push_back(attachment);
+
+        if (!depthWrite) {
+            return read(resource, GraphAccess::eDepthRead);
+        }
+        if (loadOp == vk::AttachmentLoadOp::eLoad) {
+            read(resource, GraphAccess::eDepthAttachment);
+        }
+        pass.uses.push_back({ resource.index, GraphAccess::eDepthAttachment, true, loadOp != vk::AttachmentLoadOp::eLoad });
+        return *this;
+    }
+
+    RenderGraphPassBuilder& RenderGraphPassBuilder::secondaryCommandBuffers()
+    {
+        m_graph.m_passes[m_pass].secondaryCommandBuffers = true;
+        return *this;
+    }
+
+    RenderGraphPassBuilder& RenderGraphPassBuilder::sideEffect()
+    {
+        m_graph.m_passes[m_pass].sideEffect = true;
+        return *this;
+    }
+
+    RenderGraphPassBuilder& RenderGraphPassBuilder::record(std::function<void(RenderGraphContext&)> callback)
+    {
+        m_graph.m_passes[m_pass].callback = std::move(callback);
+        return *this;
+    }
+
+    RenderGraph::RenderGraph(vk::Device device, GpuMemory& memory, vk::DeviceSize bufferImageGranularity, uint32_t frameSlots) :
+        m_device(device),
+        m_memory(memory),
+        m_bufferImageGranularity(std::max(bufferImageGranularity, vk::DeviceSize(1))),
+        m_slots(std::max(frameSlots, 1u))
+    {
+    }
+
+    RenderGraph::~RenderGraph()
+    {
+        for (FrameSlot& slot : m_slots) {
+            destroyTransients(slot);
+        }
+        for (auto& entry : m_renderPasses) {
+            m_device.destroyRenderPass(entry.second);
+        }
+    }
+
+    void RenderGraph::reset()
+    {
+        m_passes.clear();
+        m_resources.clear();
+        m_finalBarriers.clear();
+        m_currentSlot = UINT32_MAX;
+    }
+
+    GraphResource RenderGraph::createImage(const std::string& name, const GraphImageDesc& desc)
+    {
+        Resource resource{};
+        resource.name = name;
+        resource.image = desc;
+        m_resources.push_back(resource);
+        return GraphResource{ uint32_t(m_resources.size() - 1) };
+    }
+
+    GraphResource RenderGraph::createBuffer(const std::string& name, vk::DeviceSize size)
+    {
+        Resource resource{};
+        resource.name = name;
+        resource.isImage = false;
+        resource.bufferSize = size;
+        m_resources.push_back(resource);
+        return GraphResource{ uint32_t(m_resources.size() - 1) };
+    }
+
+    GraphResource RenderGraph::importImage(
+        const std::string& name,
+        vk::Image image,
+        vk::ImageView view,
+        const GraphImageDesc& desc,
+        const GraphImportState& initialState,
+        const GraphImportState& finalState)
+    {
+        Resource resource{};
+        resource.name = name;
+        resource.imported = true;
+        resource.image = desc;
+        resource.initialState = initialState;
+        resource.finalState = finalState;
+        resource.vkImage = image;
+        resource.vkView = view;
+        m_resources.push_back(resource);
+        return GraphResource{ uint32_t(m_resources.size() - 1) };
+    }
+
+    GraphResource RenderGraph::importBuffer(const std::string& name, vk::Buffer buffer, vk::DeviceSize size, const GraphImportState& initialState)
+    {
+        Resource resource{};
+        resource.name = name;
+        resource.isImage = false;
+        resource.imported = true;
+        resource.bufferSize = size;
+        resource.vkBuffer = buffer;
+        resource.initialState = initialState;
+        m_resources.push_back(resource);
+        return GraphResource{ uint32_t(m_resources.size() - 1) };
+    }
+
+    RenderGraphPassBuilder RenderGraph::addPass(const std::string& name, GraphPassType type)
+    {
+        Pass pass{};
+        pass.name = name;
+        pass.type = type;
+        m_passes.push_back(std::move(pass));
+        return RenderGraphPassBuilder{ *this, uint32_t(m_passes.size() - 1) };
+    }
+
+    void RenderGraph::compile(uint32_t frameSlot)
+    {
+        BVR_PROFILE_ZONE("graph_compile");
+        m_currentSlot = frameSlot % uint32_t(m_slots.size());
+        FrameSlot& slot = m_slots[m_currentSlot];
+
+        cullPasses();
+        computeLifetimes();
+
+        uint64_t key = computeTransientKey();
+        if (key != slot.key) {
+            // The slot's previous frame has retired, nothing uses these anymore.
+            allocateTransients(slot);
+            slot.key = key;
+        }
+        bindTransients(slot);
+
+        m_stats = RenderGraphStats{};
+        m_stats.passes = uint32_t(m_passes.size());
+        for (const Pass& pass : m_passes) {
+            m_stats.culledPasses += pass.culled ? 1 : 0;
+        }
+        m_stats.transientResources = uint32_t(slot.resources.size());
+        m_stats.unaliasedBytes = slot.unaliasedBytes;
+        for (const AliasingHeap& heap : slot.heaps) {
+            m_stats.aliasedBytes += heap.size;
+        }
+
+        planBarriers(slot);
+
+        for (Pass& pass : m_passes) {
+            if (!pass.culled && pass.type == GraphPassType::eRaster) {
+                pass.renderPass = getRenderPass(pass);
+                pass.framebuffer = getFramebuffer(slot, pass);
+            }
+        }
+    }
+
+    void RenderGraph::execute(vk::CommandBuffer commandBuffer)
+    {
+        if (m_currentSlot == UINT32_MAX) {
+            throw std::runtime_error("RenderGraph::execute() called before compile()");
+        }
+
+        BVR_PROFILE_ZONE("graph_execute");
+
+        RenderGraphContext context{};
+        context.m_graph = this;
+        context.m_commandBuffer = commandBuffer;
+
+        for (Pass& pass : m_passes) {
+            if (pass.culled) {
+                continue;
+            }
+
+            if (!pass.imageBarriers.empty() || pass.memoryBarrier) {
+                vk::MemoryBarrier memoryBarrier{ pass.memorySrcAccess, pass.memoryDstAccess };
+                commandBuffer.pipelineBarrier(
+                    pass.srcStages ? pass.srcStages : vk::PipelineStageFlagBits::eTopOfPipe,
+                    pass.dstStages ? pass.dstStages : vk::PipelineStageFlagBits::eBottomOfPipe,
+                    vk::DependencyFlags{},
+                    pass.memoryBarrier ? 1 : 0, &memoryBarrier,
+                    0, nullptr,
+                    uint32_t(pass.imageBarriers.size()), pass.imageBarriers.data()
+                );
+            }
+
+#if BVR_PROFILE
+            uint32_t gpuZone = UINT32_MAX;
+            if (m_gpuProfiler != nullptr && Profiler::get().isEnabled()) {
+                gpuZone = m_gpuProfiler->beginZone(commandBuffer, Profiler::get().intern(pass.name), !pass.secondaryCommandBuffers);
+            }
+#endif
+
+            if (pass.type != GraphPassType::eRaster) {
+                context.m_renderPass = vk::RenderPass{};
+                context.m_framebuffer = vk::Framebuffer{};
+                if (pass.callback) {
+                    pass.callback(context);
+                }
+#if BVR_PROFILE
+                if (m_gpuProfiler != nullptr) {
+                    m_gpuProfiler->endZone(commandBuffer, gpuZone);
+                }
+#endif
+                continue;
+            }
+
+            std::vector<vk::ClearValue> clearValues;
+            for (const Attachment& attachment : pass.attachments) {
+                clearValues.push_back(attachment.clearValue);
+            }
+            vk::RenderPassBeginInfo beginInfo{
+                pass.renderPass,
+                pass.framebuffer,
+                vk::Rect2D{ vk::Offset2D{ 0, 0 }, pass.extent },
+                uint32_t(clearValues.size()),
+                clearValues.data(),
+            };
+
+            context.m_renderPass = pass.renderPass;
+            context.m_framebuffer = pass.framebuffer;
+            context.m_extent = pass.extent;
+            commandBuffer.beginRenderPass(beginInfo, pass.secondaryCommandBuffers ? vk::SubpassContents::eSecondaryCommandBuffers : vk::SubpassContents::eInline);
+            if (pass.callback) {
+                pass.callback(context);
+            }
+            commandBuffer.endRenderPass();
+#if BVR_PROFILE
+            if (m_gpuProfiler != nullptr) {
+                m_gpuProfiler->endZone(commandBuffer, gpuZone);
+            }
+#endif
+        }
+
+        if (!m_finalBarriers.empty()) {
+            commandBuffer.pipelineBarrier(
+                m_finalSrcStages ? m_finalSrcStages : vk::PipelineStageFlagBits::eTopOfPipe,
+                m_finalDstStages ? m_finalDstStages : vk::PipelineStageFlagBits::eBottomOfPipe,
+                vk::DependencyFlags{},
+                0, nullptr,
+                0, nullptr,
+                uint32_t(m_finalBarriers.size()), m_finalBarriers.data()
+            );
+        }
+    }
+
+    void RenderGraph::cullPasses()
+    {
+        // Reference counting over the bipartite pass/resource graph: a pass is
+        // referenced by what it writes, a resource by the passes that read it.
+        // Resources nobody reads release their writers, culled writers release
+        // what they read, and so on.
+        std::vector<uint32_t> passRefs(m_passes.size(), 0);
+        std::vector<uint32_t> resourceRefs(m_resources.size(), 0);
+        std::vector<std::vector<uint32_t>> writers(m_resources.size());
+        std::vector<std::vector<uint32_t>> reads(m_passes.size());
+
+        for (uint32_t p = 0; p < m_passes.size(); ++p) {
+            Pass& pass = m_passes[p];
+            pass.culled = false;
+
+            std::vector<uint32_t> written;
+            for (const ResourceUse& use : pass.uses) {
+                if (use.write && std::find(written.begin(), written.end(), use.resource) == written.end()) {
+                    written.push_back(use.resource);
+                    writers[use.resource].push_back(p);
+                }
+            }
+            // Reading what the pass writes itself doesn't keep anything alive.
+            for (const ResourceUse& use : pass.uses) {
+                if (!use.write &&
+                    std::find(written.begin(), written.end(), use.resource) == written.end() &&
+                    std::find(reads[p].begin(), reads[p].end(), use.resource) == reads[p].end()) {
+                    reads[p].push_back(use.resource);
+                    ++resourceRefs[use.resource];
+                }
+            }
+            passRefs[p] = uint32_t(written.size()) + (pass.sideEffect ? 1 : 0);
+        }
+
+        for (uint32_t r = 0; r < m_resources.size(); ++r) {
+            if (m_resources[r].imported) {
+                ++resourceRefs[r];
+            }
+        }
+
+        auto cull = [&](uint32_t p) {
+            m_passes[p].culled = true;
+            std::vector<uint32_t> released;
+            for (uint32_t r : reads[p]) {
+                if (--resourceRefs[r] == 0) {
+                    released.push_back(r);
+                }
+            }
+            return released;
+        };
+
+        for (uint32_t p = 0; p < m_passes.size(); ++p) {
+            if (passRefs[p] == 0) {
+                cull(p);
+            }
+        }
+
+        std::vector<uint32_t> unused;
+        for (uint32_t r = 0; r < m_resources.size(); ++r) {
+            if (resourceRefs[r] == 0) {
+                unused.push_back(r);
+            }
+        }
+        while (!unused.empty()) {
+            uint32_t r = unused.back();
+            unused.pop_back();
+            for (uint32_t p : writers[r]) {
+                if (passRefs[p] == 0 || --passRefs[p] != 0) {
+                    continue;
+                }
+                std::vector<uint32_t> released = cull(p);
+                unused.insert(unused.end(), released.begin(), released.end());
+            }
+        }
+    }
+
+    void RenderGraph::computeLifetimes()
+    {
+        for (Resource& resource : m_resources) {
+            resource.firstPass = UINT32_MAX;
+            resource.lastPass = 0;
+            resource.imageUsage = vk::ImageUsageFlags{};
+            resource.bufferUsage = vk::BufferUsageFlags{};
+            resource.physical = UINT32_MAX;
+        }
+
+        for (uint32_t p = 0; p < m_passes.size(); ++p) {
+            if (m_passes[p].culled) {
+                continue;
+            }
+            for (const ResourceUse& use : m_passes[p].uses) {
+                Resource& resource = m_resources[use.resource];
+                AccessInfo info = getAccessInfo(use.access);
+                resource.firstPass = std::min(resource.firstPass, p);
+                resource.lastPass = std::max(resource.lastPass, p);
+                resource.imageUsage |= info.imageUsage;
+                resource.bufferUsage |= info.bufferUsage;
+            }
+        }
+    }
+
+    uint64_t RenderGraph::computeTransientKey() const
+    {
+        uint64_t key = 0xCBF29CE484222325ull;
+        for (const Resource& resource : m_resources) {
+            if (resource.imported || resource.firstPass == UINT32_MAX) {
+                continue;
+            }
+            key = hashCombine(key, resource.isImage ? 1 : 2);
+            key = hashCombine(key, resource.firstPass);
+            key = hashCombine(key, resource.lastPass);
+            if (resource.isImage) {
+                key = hashCombine(key, uint64_t(resource.image.format));
+                key = hashCombine(key, resource.image.width);
+                key = hashCombine(key, resource.image.height);
+                key = hashCombine(key, resource.image.mipLevels);
+                key = hashCombine(key, resource.image.arrayLayers);
+                key = hashCombine(key, uint64_t(resource.image.samples));
+                key = hashCombine(key, static_cast<VkImageUsageFlags>(resource.imageUsage));
+            }
+            else {
+                key = hashCombine(key, resource.bufferSize);
+                key = hashCombine(key, static_cast<VkBufferUsageFlags>(resource.bufferUsage));
+            }
+        }
+        return key;
+    }
+
+    void RenderGraph::allocateTransients(FrameSlot& slot)
+    {
+        destroyTransients(slot);
+
+        for (const Resource& resource : m_resources) {
+            if (resource.imported || resource.firstPass == UINT32_MAX) {
+                continue;
+            }
+
+            PhysicalResource physical{};
+            physical.firstPass = resource.firstPass;
+            physical.lastPass = resource.lastPass;
+            if (resource.isImage) {
+                physical.image = m_device.createImage(vk::ImageCreateInfo{
+                    vk::ImageCreateFlags{},
+                    vk::ImageType::e2D,
+                    resource.image.format,
+                    vk::Extent3D{ resource.image.width, resource.image.height, 1 },
+                    resource.image.mipLevels,
+                    resource.image.arrayLayers,
+                    resource.image.samples,
+                    vk::ImageTiling::eOptimal,
+                    resource.imageUsage,
+                });
+                physical.requirements = m_device.getImageMemoryRequirements(physical.image);
+            }
+            else {
+                physical.buffer = m_device.createBuffer(vk::BufferCreateInfo{
+                    vk::BufferCreateFlags{},
+                    resource.bufferSize,
+                    resource.bufferUsage,
+                });
+                physical.requirements = m_device.getBufferMemoryRequirements(physical.buffer);
+            }
+            slot.unaliasedBytes += physical.requirements.size;
+            slot.resources.push_back(physical);
+        }
+
+        // Largest first, each at the lowest offset that doesn't overlap a
+        // resource that is alive at the same time. Buffers and optimal images
+        // share heaps, so everything is aligned to the buffer-image granularity.
+        std::vector<uint32_t> order(slot.resources.size());
+        for (uint32_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&slot](uint32_t a, uint32_t b) {
+            return slot.resources[a].requirements.size > slot.resources[b].requirements.size;
+        });
+
+        std::vector<uint32_t> placed;
+        for (uint32_t index : order) {
+            PhysicalResource& physical = slot.resources[index];
+            const vk::MemoryRequirements& requirements = physical.requirements;
+            vk::DeviceSize alignment = std::max(requirements.alignment, m_bufferImageGranularity);
+
+            uint32_t heapIndex = 0;
+            while (heapIndex < slot.heaps.size() && (slot.heaps[heapIndex].memoryTypeBits & requirements.memoryTypeBits) == 0) {
+                ++heapIndex;
+            }
+            if (heapIndex == slot.heaps.size()) {
+                AliasingHeap heap{};
+                heap.memoryTypeBits = requirements.memoryTypeBits;
+                slot.heaps.push_back(heap);
+            }
+            AliasingHeap& heap = slot.heaps[heapIndex];
+
+            std::vector<vk::DeviceSize> candidates{ 0 };
+            for (uint32_t other : placed) {
+                const PhysicalResource& placedResource = slot.resources[other];
+                if (placedResource.heap == heapIndex) {
+                    candidates.push_back(alignUp(placedResource.offset + placedResource.requirements.size, alignment));
+                }
+            }
+            std::sort(candidates.begin(), candidates.end());
+
+            for (vk::DeviceSize candidate : candidates) {
+                bool conflict = false;
+                for (uint32_t other : placed) {
+                    const PhysicalResource& placedResource = slot.resources[other];
+                    bool sameHeap = placedResource.heap == heapIndex;
+                    bool alive = !(placedResource.lastPass < physical.firstPass || physical.lastPass < placedResource.firstPass);
+                    bool overlaps = candidate < placedResource.offset + placedResource.requirements.size &&
+                        placedResource.offset < candidate + requirements.size;
+                    if (sameHeap && alive && overlaps) {
+                        conflict = true;
+                        break;
+                    }
+                }
+                if (!conflict) {
+                    physical.offset = candidate;
+                    break;
+                }
+            }
+
+            physical.heap = heapIndex;
+            heap.memoryTypeBits &= requirements.memoryTypeBits;
+            heap.alignment = std::max(heap.alignment, alignment);
+            heap.size = std::max(heap.size, physical.offset + requirements.size);
+            placed.push_back(index);
+        }
+
+        for (AliasingHeap& heap : slot.heaps) {
+            heap.allocation = m_memory.allocateMemory(vk::MemoryRequirements{ heap.size, heap.alignment, heap.memoryTypeBits });
+        }
+
+        uint32_t index = 0;
+        for (const Resource& resource : m_resources) {
+            if (resource.imported || resource.firstPass == UINT32_MAX) {
+                continue;
+            }
+            PhysicalResource& physical = slot.resources[index++];
+            VmaAllocation allocation = slot.heaps[physical.heap].allocation;
+            if (!resource.isImage) {
+                m_memory.bindBufferMemory(allocation, physical.offset, physical.buffer);
+                continue;
+            }
+
+            m_memory.bindImageMemory(allocation, physical.offset, physical.image);
+            physical.view = m_device.createImageView(vk::ImageViewCreateInfo{
+                vk::ImageViewCreateFlags{},
+                physical.image,
+                resource.image.arrayLayers > 1 ? vk::ImageViewType::e2DArray : vk::ImageViewType::e2D,
+                resource.image.format,
+                vk::ComponentMapping{},
+                vk::ImageSubresourceRange{ getAspect(resource.image.format), 0, resource.image.mipLevels, 0, resource.image.arrayLayers },
+            });
+        }
+    }
+
+    void RenderGraph::destroyTransients(FrameSlot& slot)
+    {
+        for (auto& entry : slot.framebuffers) {
+            m_device.destroyFramebuffer(entry.second.framebuffer);
+        }
+        for (PhysicalResource& physical : slot.resources) {
+            m_device.destroyImageView(physical.view);
+            m_device.destroyImage(physical.image);
+            m_device.destroyBuffer(physical.buffer);
+        }
+        for (AliasingHeap& heap : slot.heaps) {
+            m_memory.freeMemory(heap.allocation);
+        }
+        slot = FrameSlot{};
+    }
+
+    void RenderGraph::bindTransients(const FrameSlot& slot)
+    {
+        uint32_t index = 0;
+        for (Resource& resource : m_resources) {
+            if (resource.imported || resource.firstPass == UINT32_MAX) {
+                continue;
+            }
+            const PhysicalResource& physical = slot.resources[index];
+            resource.physical = index++;
+            resource.vkImage = physical.image;
+            resource.vkView = physical.view;
+            resource.vkBuffer = physical.buffer;
+        }
+    }
+
+    void RenderGraph::planBarriers(const FrameSlot& slot)
+    {
+        // What has happened to a resource so far this frame. Reads only need to
+        // wait for the last write, writes for the last write and every read since.
+        struct TrackedState
+        {
+            vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+            vk::PipelineStageFlags writeStages;
+            vk::AccessFlags writeAccess;
+            vk::PipelineStageFlags readStages;
+            vk::AccessFlags readAccess;
+        };
+
+        std::vector<TrackedState> states(m_resources.size());
+        for (uint32_t r = 0; r < m_resources.size(); ++r) {
+            const Resource& resource = m_resources[r];
+            if (resource.imported) {
+                states[r].layout = resource.initialState.layout;
+                states[r].writeStages = resource.initialState.stages;
+                states[r].writeAccess = resource.initialState.access;
+            }
+        }
+
+        for (uint32_t p = 0; p < m_passes.size(); ++p) {
+            Pass& pass = m_passes[p];
+            pass.srcStages = vk::PipelineStageFlags{};
+            pass.dstStages = vk::PipelineStageFlags{};
+            pass.imageBarriers.clear();
+            pass.memorySrcAccess = vk::AccessFlags{};
+            pass.memoryDstAccess = vk::AccessFlags{};
+            pass.memoryBarrier = false;
+            if (pass.culled) {
+                continue;
+            }
+
+            // Merge every use of the same resource within the pass.
+            struct CombinedUse
+            {
+                uint32_t resource;
+                AccessInfo info;
+                bool write;
+                bool discard;
+            };
+            std::vector<CombinedUse> combined;
+            for (const ResourceUse& use : pass.uses) {
+                AccessInfo info = getAccessInfo(use.access);
+                auto it = std::find_if(combined.begin(), combined.end(), [&use](const CombinedUse& c) { return c.resource == use.resource; });
+                if (it == combined.end()) {
+                    combined.push_back({ use.resource, info, use.write, use.discard });
+                    continue;
+                }
+                if (m_resources[use.resource].isImage && it->info.layout != info.layout) {
+                    std::string errorString{ "Pass " };
+                    throw std::runtime_error(errorString.append(pass.name).append(" uses ")
+                        .append(m_resources[use.resource].name).append(" in two image layouts"));
+                }
+                it->info.stages |= info.stages;
+                it->info.access |= info.access;
+                it->write = it->write || use.write;
+                // Discarding is only fine when nothing in the pass reads the contents.
+                it->discard = it->discard && use.discard;
+            }
+
+            for (const CombinedUse& use : combined) {
+                const Resource& resource = m_resources[use.resource];
+                TrackedState& state = states[use.resource];
+
+                // The first use of a transient waits for every earlier transient
+                // that occupied the same memory.
+                if (!resource.imported && resource.firstPass == p) {
+                    const PhysicalResource& physical = slot.resources[resource.physical];
+                    for (uint32_t r = 0; r < m_resources.size(); ++r) {
+                        const Resource& other = m_resources[r];
+                        if (other.imported || other.physical == UINT32_MAX || other.lastPass >= p) {
+                            continue;
+                        }
+                        const PhysicalResource& otherPhysical = slot.resources[other.physical];
+                        bool overlaps = otherPhysical.heap == physical.heap &&
+                            physical.offset < otherPhysical.offset + otherPhysical.requirements.size &&
+                            otherPhysical.offset < physical.offset + physical.requirements.size;
+                        if (overlaps) {
+                            state.writeStages |= states[r].writeStages | states[r].readStages;
+                            state.writeAccess |= states[r].writeAccess;
+                        }
+                    }
+                }
+
+                bool layoutChange = resource.isImage && state.layout != use.info.layout;
+                vk::PipelineStageFlags srcStages = state.writeStages | state.readStages;
+
+                if (use.write || layoutChange) {
+                    if (resource.isImage) {
+                        pass.imageBarriers.push_back(vk::ImageMemoryBarrier{
+                            state.writeAccess,
+                            use.info.access,
+                            use.discard ? vk::ImageLayout::eUndefined : state.layout,
+                            use.info.layout,
+                            VK_QUEUE_FAMILY_IGNORED,
+                            VK_QUEUE_FAMILY_IGNORED,
+                            resource.vkImage,
+                            vk::ImageSubresourceRange{ getAspect(resource.image.format), 0, resource.image.mipLevels, 0, resource.image.arrayLayers },
+                        });
+                        pass.srcStages |= srcStages;
+                        pass.dstStages |= use.info.stages;
+                    }
+                    else if (srcStages) {
+                        pass.memoryBarrier = true;
+                        pass.memorySrcAccess |= state.writeAccess;
+                        pass.memoryDstAccess |= use.info.access;
+                        pass.srcStages |= srcStages;
+                        pass.dstStages |= use.info.stages;
+                    }
+
+                    state.layout = use.info.layout;
+                    if (use.write) {
+                        state.writeStages = use.info.stages;
+                        state.writeAccess = use.info.access & kWriteAccess;
+                        state.readStages = vk::PipelineStageFlags{};
+                        state.readAccess = vk::AccessFlags{};
+                    }
+                    else {
+                        // The transition is this frame's latest write, already
+                        // visible to the stages that triggered it.
+                        state.writeStages = use.info.stages;
+                        state.writeAccess = vk::AccessFlags{};
+                        state.readStages = use.info.stages;
+                        state.readAccess = use.info.access;
+                    }
+                    continue;
+                }
+
+                bool alreadyVisible = (state.readStages & use.info.stages) == use.info.stages &&
+                    (state.readAccess & use.info.access) == use.info.access;
+                if (!alreadyVisible && state.writeStages) {
+                    // Same layout, so a global memory barrier does.
+                    pass.memoryBarrier = true;
+                    pass.memorySrcAccess |= state.writeAccess;
+                    pass.memoryDstAccess |= use.info.access;
+                    pass.srcStages |= state.writeStages;
+                    pass.dstStages |= use.info.stages;
+                }
+                state.readStages |= use.info.stages;
+                state.readAccess |= use.info.access;
+            }
+
+            m_stats.imageBarriers += uint32_t(pass.imageBarriers.size());
+            m_stats.memoryBarriers += pass.memoryBarrier ? 1 : 0;
+            m_stats.barrierBatches += (!pass.imageBarriers.empty() || pass.memoryBarrier) ? 1 : 0;
+        }
+
+        m_finalBarriers.clear();
+        m_finalSrcStages = vk::PipelineStageFlags{};
+        m_finalDstStages = vk::PipelineStageFlags{};
+        for (uint32_t r = 0; r < m_resources.size(); ++r) {
+            const Resource& resource = m_resources[r];
+            const TrackedState& state = states[r];
+            if (!resource.imported || !resource.isImage || resource.finalState.layout == vk::ImageLayout::eUndefined) {
+                continue;
+            }
+            m_finalBarriers.push_back(vk::ImageMemoryBarrier{
+                state.writeAccess,
+                resource.finalState.access,
+                state.layout,
+                resource.finalState.layout,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                resource.vkImage,
+                vk::ImageSubresourceRange{ getAspect(resource.image.format), 0, resource.image.mipLevels, 0, resource.image.arrayLayers },
+            });
+            m_finalSrcStages |= state.writeStages | state.readStages;
+            m_finalDstStages |= resource.finalState.stages;
+        }
+        if (!m_finalBarriers.empty()) {
+            m_stats.imageBarriers += uint32_t(m_finalBarriers.size());
+            ++m_stats.barrierBatches;
+        }
+    }
+
+    vk::RenderPass RenderGraph::getRenderPass(const Pass& pass)
+    {
+        if (pass.attachments.empty()) {
+            std::string errorString{ "Raster pass " };
+            throw std::runtime_error(errorString.append(pass.name).append(" has no attachments"));
+        }
+
+        uint32_t passIndex = uint32_t(&pass - m_passes.data());
+        uint64_t key = 0xCBF29CE484222325ull;
+        std::vector<vk::AttachmentDescription> descriptions;
+        std::vector<vk::AttachmentReference> colorRefs;
+        vk::AttachmentReference depthRef{ VK_ATTACHMENT_UNUSED, vk::ImageLayout::eUndefined };
+
+        for (const Attachment& attachment : pass.attachments) {
+            const Resource& resource = m_resources[attachment.resource];
+            vk::ImageLayout layout = !attachment.depth ? vk::ImageLayout::eColorAttachmentOptimal :
+                attachment.depthWrite ? vk::ImageLayout::eDepthStencilAttachmentOptimal : vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+            // Transients nobody reads after this pass don't need to reach memory.
+            // Read-only depth is stored too: DONT_CARE would leave its contents
+            // undefined for every later pass.
+            bool store = resource.imported || resource.lastPass > passIndex;
+            vk::AttachmentStoreOp storeOp = store ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+
+            // Layouts are handled by the graph's barriers, the render pass never
+            // transitions anything.
+            descriptions.push_back(vk::AttachmentDescription{
+                vk::AttachmentDescriptionFlags{},
+                resource.image.format,
+                resource.image.samples,
+                attachment.loadOp,
+                storeOp,
+                vk::AttachmentLoadOp::eDontCare,
+                vk::AttachmentStoreOp::eDontCare,
+                layout,
+                layout,
+            });
+            vk::AttachmentReference reference{ uint32_t(descriptions.size() - 1), layout };
+            if (attachment.depth) {
+                depthRef = reference;
+            }
+            else {
+                colorRefs.push_back(reference);
+            }
+
+            key = hashCombine(key, uint64_t(resource.image.format));
+            key = hashCombine(key, uint64_t(resource.image.samples));
+            key = hashCombine(key, uint64_t(attachment.loadOp));
+            key = hashCombine(key, uint64_t(storeOp));
+            key = hashCombine(key, uint64_t(layout));
+        }
+
+        auto it = m_renderPasses.find(key);
+        if (it != m_renderPasses.end()) {
+            return it->second;
+        }
+
+        vk::SubpassDescription subpass{
+            vk::SubpassDescriptionFlags{},
+            vk::PipelineBindPoint::eGraphics,
+            0, nullptr, // Input attachments
+            uint32_t(colorRefs.size()), colorRefs.data(),
+            nullptr, // Resolve attachments
+            depthRef.attachment != VK_ATTACHMENT_UNUSED ? &depthRef : nullptr,
+        };
+        vk::RenderPass renderPass = m_device.createRenderPass(vk::RenderPassCreateInfo{
+            vk::RenderPassCreateFlags{},
+            uint32_t(descriptions.size()), descriptions.data(),
+            1, &subpass,
+        });
+        m_renderPasses.emplace(key, renderPass);
+        return renderPass;
+    }
+
+    vk::Framebuffer RenderGraph::getFramebuffer(FrameSlot& slot, const Pass& pass)
+    {
+        const GraphImageDesc& first = m_resources[pass.attachments.front().resource].image;
+        vk::Extent2D extent{ first.width, first.height };
+
+        uint64_t key = hashCombine(0xCBF29CE484222325ull, handleBits(pass.renderPass));
+        std::vector<vk::ImageView> views;
+        std::vector<vk::ImageView> importedViews;
+        for (const Attachment& attachment : pass.attachments) {
+            const Resource& resource = m_resources[attachment.resource];
+            if (resource.image.width != extent.width || resource.image.height != extent.height) {
+                std::string errorString{ "Attachments of pass " };
+                throw std::runtime_error(errorString.append(pass.name).append(" differ in size"));
+            }
+            views.push_back(resource.vkView);
+            if (resource.imported) {
+                importedViews.push_back(resource.vkView);
+            }
+            key = hashCombine(key, handleBits(resource.vkView));
+        }
+        key = hashCombine(key, extent.width);
+        key = hashCombine(key, extent.height);
+
+        // Passes of the same frame compile into this slot, so the extent is set here.
+        m_passes[uint32_t(&pass - m_passes.data())].extent = extent;
+
+        auto it = slot.framebuffers.find(key);
+        if (it != slot.framebuffers.end()) {
+            return it->second.framebuffer;
+        }
+
+        // Imported views may change every frame. The slot's last frame has
+        // retired, so stale framebuffers can simply be dropped.
+        if (slot.framebuffers.size() >= 64) {
+            for (auto& entry : slot.framebuffers) {
+                m_device.destroyFramebuffer(entry.second.framebuffer);
+            }
+            slot.framebuffers.clear();
+        }
+
+        vk::Framebuffer framebuffer = m_device.createFramebuffer(vk::FramebufferCreateInfo{
+            vk::FramebufferCreateFlags{},
+            pass.renderPass,
+            uint32_t(views.size()),
+            views.data(),
+            extent.width,
+            extent.height,
+            1,
+        });
+        slot.framebuffers.emplace(key, CachedFramebuffer{ framebuffer, std::move(importedViews) });
+        return framebuffer;
+    }
+
+    void RenderGraph::releaseImportedView(vk::ImageView view)
+    {
+        for (FrameSlot& slot : m_slots) {
+            for (auto it = slot.framebuffers.begin(); it != slot.framebuffers.end();) {
+                const std::vector<vk::ImageView>& views = it->second.importedViews;
+                if (std::find(views.begin(), views.end(), view) != views.end()) {
+                    m_device.destroyFramebuffer(it->second.framebuffer);
+                    it = slot.framebuffers.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    std::string RenderGraph::dumpGraphviz() const
+    {
+        vk::DeviceSize saved = m_stats.unaliasedBytes - std::min(m_stats.aliasedBytes, m_stats.unaliasedBytes);
+
+        std::string dot = "digraph RenderGraph {\n";
+        dot.append("    rankdir=LR;\n    labelloc=t;\n");
+        dot.append("    label=\"")
+            .append(std::to_string(m_stats.passes - m_stats.culledPasses)).append(" passes, ")
+            .append(std::to_string(m_stats.culledPasses)).append(" culled, ")
+            .append(std::to_string(m_stats.barrierBatches)).append(" barrier batches\\ntransients: ")
+            .append(formatMiB(m_stats.aliasedBytes)).append(" aliased, ")
+            .append(formatMiB(m_stats.unaliasedBytes)).append(" unaliased, ")
+            .append(formatMiB(saved)).append(" saved\";\n");
+
+        for (uint32_t p = 0; p < m_passes.size(); ++p) {
+            const Pass& pass = m_passes[p];
+            dot.append("    p").append(std::to_string(p)).append(" [shape=box, label=\"")
+                .append(escapeDot(pass.name)).append("\\n").append(toString(pass.type));
+            if (!pass.culled) {
+                dot.append("\\n").append(std::to_string(pass.imageBarriers.size())).append(" image barriers");
+                dot.append(pass.memoryBarrier ? " + memory barrier" : "");
+            }
+            dot.append(pass.culled ? "\", style=dashed, fontcolor=gray, color=gray];\n" : "\", style=filled, fillcolor=lightblue];\n");
+        }
+
+        for (uint32_t r = 0; r < m_resources.size(); ++r) {
+            const Resource& resource = m_resources[r];
+            dot.append("    r").append(std::to_string(r)).append(" [shape=ellipse, label=\"").append(escapeDot(resource.name)).append("\\n");
+            if (resource.isImage) {
+                dot.append(vk::to_string(resource.image.format)).append(" ")
+                    .append(std::to_string(resource.image.width)).append("x").append(std::to_string(resource.image.height));
+            }
+            else {
+                dot.append(std::to_string(resource.bufferSize)).append(" bytes");
+            }
+            if (resource.physical != UINT32_MAX && m_currentSlot != UINT32_MAX) {
+                const PhysicalResource& physical = m_slots[m_currentSlot].resources[resource.physical];
+                dot.append("\\nheap ").append(std::to_string(physical.heap))
+                    .append(" @ ").append(formatMiB(physical.offset));
+            }
+            dot.append(resource.imported ? "\", peripheries=2];\n" : "\"];\n");
+        }
+
+        for (uint32_t p = 0; p < m_passes.size(); ++p) {
+            std::vector<uint32_t> reads;
+            std::vector<uint32_t> writes;
+            for (const ResourceUse& use : m_passes[p].uses) {
+                std::vector<uint32_t>& edges = use.write ? writes : reads;
+                if (std::find(edges.begin(), edges.end(), use.resource) == edges.end()) {
+                    edges.push_back(use.resource);
+                }
+            }
+            for (uint32_t r : reads) {
+                dot.append("    r").append(std::to_string(r)).append(" -> p").append(std::to_string(p)).append(";\n");
+            }
+            for (uint32_t r : writes) {
+                dot.append("    p").append(std::to_string(p)).append(" -> r").append(std::to_string(r)).append(" [color=red];\n");
+            }
+        }
+
+        dot.append("}\n");
+        return dot;
+    }
+
+    std::string RenderGraph::dumpJson() const
+    {
+        JsonWriter json;
+        json.beginObject();
+
+        json.key("passes");
+        json.beginArray();
+        for (const Pass& pass : m_passes) {
+            json.beginObject();
+            json.field("name", pass.name);
+            json.field("type", toString(pass.type));
+            json.field("culled", pass.culled);
+            json.field("image_barriers", uint32_t(pass.imageBarriers.size()));
+            json.field("memory_barrier", pass.memoryBarrier);
+            json.key("reads");
+            json.beginArray();
+            for (const ResourceUse& use : pass.uses) {
+                if (!use.write) {
+                    json.value(m_resources[use.resource].name);
+                }
+            }
+            json.endArray();
+            json.key("writes");
+            json.beginArray();
+            for (const ResourceUse& use : pass.uses) {
+                if (use.write) {
+                    json.value(m_resources[use.resource].name);
+                }
+            }
+            json.endArray();
+            json.endObject();
+        }
+        json.endArray();
+
+        json.key("resources");
+        json.beginArray();
+        for (const Resource& resource : m_resources) {
+            json.beginObject();
+            json.field("name", resource.name);
+            json.field("kind", resource.isImage ? "image" : "buffer");
+            json.field("imported", resource.imported);
+            if (resource.isImage) {
+                json.field("format", vk::to_string(resource.image.format));
+                json.field("width", resource.image.width);
+                json.field("height", resource.image.height);
+            }
+            else {
+                json.field("size", uint64_t(resource.bufferSize));
+            }
+            bool used = resource.firstPass != UINT32_MAX;
+            json.field("first_pass", used ? int64_t(resource.firstPass) : int64_t(-1));
+            json.field("last_pass", used ? int64_t(resource.lastPass) : int64_t(-1));
+            if (resource.physical != UINT32_MAX && m_currentSlot != UINT32_MAX) {
+                const PhysicalResource& physical = m_slots[m_currentSlot].resources[resource.physical];
+                json.field("heap", physical.heap);
+                json.field("offset", uint64_t(physical.offset));
+                json.field("bytes", uint64_t(physical.requirements.size));
+            }
+            json.endObject();
+        }
+        json.endArray();
+
+        json.key("stats");
+        json.beginObject();
+        json.field("passes", m_stats.passes);
+        json.field("culled_passes", m_stats.culledPasses);
+        json.field("transient_resources", m_stats.transientResources);
+        json.field("image_barriers", m_stats.imageBarriers);
+        json.field("memory_barriers", m_stats.memoryBarriers);
+        json.field("barrier_batches", m_stats.barrierBatches);
+        json.field("aliased_bytes", uint64_t(m_stats.aliasedBytes));
+        json.field("unaliased_bytes", uint64_t(m_stats.unaliasedBytes));
+        json.field("saved_bytes", uint64_t(m_stats.unaliasedBytes - std::min(m_stats.aliasedBytes, m_stats.unaliasedBytes)));
+        json.endObject();
+
+        json.endObject();
+        return json.str();
+    }
+}
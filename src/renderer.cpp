@@ -0,0 +1,1476 @@
+#include "renderer.h"
+#include "embedded_shaders.h"
+#include "utils.h"
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+namespace bvr
+{
+    Renderer::~Renderer()
+    {
+        if (m_instance) {
+            debugLog("Cleaning up Renderer!");
+            if (m_device) {
+                waitIdle();
+                m_swapchain.reset();
+                m_bindless.reset();
+                m_graph.reset();
+#if BVR_PROFILE
+                m_gpuProfiler.reset();
+#endif
+                for (FrameContext& frame : m_frames) {
+                    destroyFrameContext(frame);
+                }
+                m_device.destroySemaphore(m_frameTimeline);
+                m_shaders.reset();
+                m_pipelines.reset();
+                m_device.destroyRenderPass(m_sceneRenderPass);
+                m_device.destroyFence(m_immediateFence);
+                m_device.destroyCommandPool(m_immediatePool);
+                m_uploads.reset();
+                m_memory.reset();
+                m_device.destroy();
+            }
+            if (m_surface) {
+                m_instance.destroySurfaceKHR(m_surface);
+            }
+            destroyDebugMessenger();
+            m_instance.destroy();
+        }
+    }
+
+    void Renderer::init()
+    {
+        debugLog("Initializing Renderer!");
+        BVR_PROFILE_THREAD("render");
+        auto start = std::chrono::high_resolution_clock::now();
+        m_jobs = std::make_unique<JobSystem>(m_config.workerThreads);
+        initVulkan();
+        m_startupMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+#ifndef NDEBUG
+        std::string message = "Renderer Initialized in ";
+        debugLog(message.append(std::to_string(m_startupMs)).append(" ms, ")
+            .append(toString(m_pipelines->getStats().load)).append(" pipeline cache").c_str());
+#endif
+    }
+
+    FrameContext& Renderer::beginFrame()
+    {
+        waitForFrameLatency();
+
+        // Swaps in pipelines rebuilt from edited shaders. Frames in flight keep
+        // the ones they were recorded with, which the pipeline cache keeps alive.
+        m_shaders->update();
+        if (m_sceneShaders.isValid()) {
+            const ShaderPipeline& scene = m_shaders->get(m_sceneShaders);
+            m_scenePipeline = scene.pipeline;
+            m_scenePipelineLayout = scene.layout;
+        }
+
+        FrameContext& frame = m_frames[m_frameIndex % m_frames.size()];
+
+        // Only the frame that used this context last needs to be done, later frames
+        // may still be executing while we record.
+        {
+            BVR_PROFILE_ZONE("wait_for_frame");
+            waitForTimelineValue(frame.timelineValue);
+        }
+        retireFrame(frame);
+
+        m_device.resetCommandPool(frame.commandPool, vk::CommandPoolResetFlags{});
+        for (FrameContext::WorkerCommandPool& workerPool : frame.workerPools) {
+            m_device.resetCommandPool(workerPool.pool, vk::CommandPoolResetFlags{});
+            workerPool.used = 0;
+        }
+        m_device.resetDescriptorPool(frame.descriptorPool);
+        m_memory->beginFrame(m_frameIndex);
+
+        frame.frameIndex = m_frameIndex;
+        frame.presentId = 0;
+        frame.inputSampleTime = m_inputSampled ? m_inputSampleTime : std::chrono::steady_clock::now();
+        frame.inputToSubmitMs = 0.0;
+        frame.inputToPresentMs = -1.0;
+        m_inputSampled = false;
+        frame.renderScale = m_dynamicResolution.getScale();
+        frame.renderExtent = vk::Extent2D{
+            std::max(uint32_t(float(m_config.width) * frame.renderScale + 0.5f), 1u),
+            std::max(uint32_t(float(m_config.height) * frame.renderScale + 0.5f), 1u)
+        };
+        frame.commandBuffer.begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+        if (m_timestampsSupported) {
+            frame.commandBuffer.resetQueryPool(frame.timestampPool, 0, 2);
+            frame.commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, frame.timestampPool, 0);
+        }
+#if BVR_PROFILE
+        if (m_gpuProfiler) {
+            m_gpuProfiler->beginFrame(frame.commandBuffer, uint32_t(m_frameIndex % m_frames.size()));
+        }
+#endif
+
+        // Take ownership of everything the transfer queue finished uploading, so
+        // this frame can already use it.
+        frame.uploadWaitValue = m_uploads->recordAcquires(frame.commandBuffer);
+
+        if (m_memory->shouldDefragment(m_frameIndex)) {
+            defragmentMemory(frame);
+        }
+
+        m_currentFrame = &frame;
+        return frame;
+    }
+
+    void Renderer::endFrame()
+    {
+        BVR_PROFILE_ZONE("submit");
+        FrameContext& frame = *m_currentFrame;
+
+        // Acquired as late as possible, the image is only needed for the copy.
+        SwapchainImage image{};
+        if (m_swapchain) {
+            image = m_swapchain->acquire(uint32_t(m_frameIndex % m_frames.size()));
+            if (image.isValid()) {
+                recordPresentCopy(frame, image);
+            }
+        }
+
+        if (m_timestampsSupported) {
+            frame.commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, frame.timestampPool, 1);
+        }
+        frame.commandBuffer.end();
+
+        frame.timelineValue = m_frameIndex + 1;
+        frame.pendingTimings = true;
+
+        // Binary semaphores ignore their values, they only pad the arrays.
+        std::array<vk::Semaphore, 2> waitSemaphores;
+        std::array<uint64_t, 2> waitValues{};
+        std::array<vk::PipelineStageFlags, 2> waitStages;
+        uint32_t waitCount = 0;
+        if (frame.uploadWaitValue != 0) {
+            waitSemaphores[waitCount] = m_uploads->getTimeline();
+            waitValues[waitCount] = frame.uploadWaitValue;
+            waitStages[waitCount] = vk::PipelineStageFlagBits::eAllCommands;
+            ++waitCount;
+        }
+        if (image.acquired) {
+            waitSemaphores[waitCount] = image.acquired;
+            waitStages[waitCount] = vk::PipelineStageFlagBits::eTransfer;
+            ++waitCount;
+        }
+        std::array<vk::Semaphore, 2> signalSemaphores{ m_frameTimeline, image.presentReady };
+        std::array<uint64_t, 2> signalValues{ frame.timelineValue, 0 };
+        uint32_t signalCount = image.presentReady ? 2 : 1;
+
+        vk::TimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.waitSemaphoreValueCount = waitCount;
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = signalCount;
+        timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+        vk::SubmitInfo submitInfo{};
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = waitCount;
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &frame.commandBuffer;
+        submitInfo.signalSemaphoreCount = signalCount;
+        submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+        {
+            std::lock_guard<std::mutex> lock{ m_graphicsQueueMutex };
+            m_graphicsQueue.submit(submitInfo, vk::Fence{});
+        }
+        frame.inputToSubmitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame.inputSampleTime).count();
+#if BVR_PROFILE
+        if (m_gpuProfiler) {
+            m_gpuProfiler->endFrame();
+        }
+#endif
+
+        if (image.isValid()) {
+            BVR_PROFILE_ZONE("present");
+            frame.presentId = frame.timelineValue;
+            // The present queue may be the graphics queue uploads share.
+            std::lock_guard<std::mutex> lock{ m_graphicsQueueMutex };
+            m_swapchain->present(m_presentQueue, image, frame.presentId, frame.timelineValue);
+        }
+
+        m_currentFrame = nullptr;
+        ++m_frameIndex;
+        m_latencyWaited = false;
+    }
+
+    void Renderer::waitForFrameLatency()
+    {
+        if (m_latencyWaited || !m_swapchain) {
+            return;
+        }
+        m_latencyWaited = true;
+
+        uint64_t latency = std::min(std::max(m_config.swapchain.maxFrameLatency, 1u), uint32_t(m_frames.size()));
+        if (m_frameIndex < latency) {
+            return;
+        }
+        // Still holds that frame, its context is reused by this one at the
+        // earliest.
+        FrameContext& frame = m_frames[(m_frameIndex - latency) % m_frames.size()];
+
+        BVR_PROFILE_ZONE("wait_for_present");
+        Swapchain::Clock::time_point shownTime;
+        if (frame.presentId != 0 && m_swapchain->waitForPresent(frame.presentId, shownTime)) {
+            frame.inputToPresentMs = std::chrono::duration<double, std::milli>(shownTime - frame.inputSampleTime).count();
+        }
+        else {
+            waitForTimelineValue(m_frameIndex - latency + 1);
+        }
+    }
+
+    void Renderer::markInputSampled()
+    {
+        m_inputSampleTime = std::chrono::steady_clock::now();
+        m_inputSampled = true;
+    }
+
+    void Renderer::resize(uint32_t width, uint32_t height)
+    {
+        if (m_swapchain) {
+            m_swapchain->resize(vk::Extent2D{ width, height });
+        }
+    }
+
+    void Renderer::renderFrame(const std::vector<DrawItem>& draws)
+    {
+        FrameContext& frame = beginFrame();
+        recordScene(frame, draws);
+        endFrame();
+    }
+
+    void Renderer::renderFrame()
+    {
+        renderFrame(std::vector<DrawItem>{});
+    }
+
+    void Renderer::renderFrameGraph(const std::function<void(RenderGraph& graph, FrameContext& frame, GraphResource target)>& build)
+    {
+        FrameContext& frame = beginFrame();
+
+        m_graph->reset();
+        {
+            BVR_PROFILE_ZONE("build_graph");
+            build(*m_graph, frame, importTarget(frame));
+        }
+        m_graph->compile(uint32_t(frame.frameIndex % m_frames.size()));
+        m_graph->execute(frame.commandBuffer);
+
+        endFrame();
+    }
+
+    GraphResource Renderer::importTarget(FrameContext& frame)
+    {
+        GraphImageDesc targetDesc{};
+        targetDesc.format = vk::Format::eR8G8B8A8Unorm;
+        targetDesc.width = uint32_t(m_config.width);
+        targetDesc.height = uint32_t(m_config.height);
+        // The frame that used this target last has retired, and whatever consumes
+        // the target after the frame samples it.
+        return m_graph->importImage(
+            "scene_target",
+            frame.target.color.image,
+            frame.target.view,
+            targetDesc,
+            GraphImportState{},
+            GraphImportState{ vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead }
+        );
+    }
+
+    void Renderer::recordPresentCopy(FrameContext& frame, const SwapchainImage& image)
+    {
+        vk::ImageSubresourceRange colorRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+        vk::CommandBuffer commandBuffer = frame.commandBuffer;
+
+        // The graph leaves the target ready to be sampled. The swapchain image's
+        // contents are discarded, and the acquire semaphore is waited on at the
+        // transfer stage.
+        std::array<vk::ImageMemoryBarrier, 2> before{
+            vk::ImageMemoryBarrier{
+                vk::AccessFlagBits::eShaderRead,
+                vk::AccessFlagBits::eTransferRead,
+                vk::ImageLayout::eShaderReadOnlyOptimal,
+                vk::ImageLayout::eTransferSrcOptimal,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                frame.target.color.image,
+                colorRange,
+            },
+            vk::ImageMemoryBarrier{
+                vk::AccessFlags{},
+                vk::AccessFlagBits::eTransferWrite,
+                vk::ImageLayout::eUndefined,
+                vk::ImageLayout::eTransferDstOptimal,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                image.image,
+                colorRange,
+            },
+        };
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::DependencyFlags{},
+            nullptr, nullptr, before
+        );
+
+        vk::ImageSubresourceLayers colorLayers{ vk::ImageAspectFlagBits::eColor, 0, 0, 1 };
+        vk::ImageBlit region{
+            colorLayers,
+            std::array<vk::Offset3D, 2>{ vk::Offset3D{ 0, 0, 0 }, vk::Offset3D{ m_config.width, m_config.height, 1 } },
+            colorLayers,
+            std::array<vk::Offset3D, 2>{ vk::Offset3D{ 0, 0, 0 }, vk::Offset3D{ int32_t(image.extent.width), int32_t(image.extent.height), 1 } },
+        };
+        bool scaled = image.extent.width != uint32_t(m_config.width) || image.extent.height != uint32_t(m_config.height);
+        commandBuffer.blitImage(
+            frame.target.color.image, vk::ImageLayout::eTransferSrcOptimal,
+            image.image, vk::ImageLayout::eTransferDstOptimal,
+            region,
+            scaled ? vk::Filter::eLinear : vk::Filter::eNearest
+        );
+
+        // Back to where importTarget() says the frame leaves the target.
+        std::array<vk::ImageMemoryBarrier, 2> after{
+            vk::ImageMemoryBarrier{
+                vk::AccessFlags{},
+                vk::AccessFlagBits::eShaderRead,
+                vk::ImageLayout::eTransferSrcOptimal,
+                vk::ImageLayout::eShaderReadOnlyOptimal,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                frame.target.color.image,
+                colorRange,
+            },
+            vk::ImageMemoryBarrier{
+                vk::AccessFlagBits::eTransferWrite,
+                vk::AccessFlags{},
+                vk::ImageLayout::eTransferDstOptimal,
+                m_swapchain->getPresentLayout(),
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                image.image,
+                colorRange,
+            },
+        };
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eBottomOfPipe,
+            vk::DependencyFlags{},
+            nullptr, nullptr, after
+        );
+    }
+
+    void Renderer::recordScene(FrameContext& frame, const std::vector<DrawItem>& draws)
+    {
+        BVR_PROFILE_ZONE("record_scene");
+        auto recordStart = std::chrono::high_resolution_clock::now();
+
+        m_graph->reset();
+        GraphResource target = importTarget(frame);
+
+        float t = float(frame.frameIndex % 256) / 255.0f;
+        RenderGraphPassBuilder scenePass = m_graph->addPass("scene", GraphPassType::eRaster);
+        scenePass.colorAttachment(target, vk::AttachmentLoadOp::eClear, vk::ClearColorValue{ std::array<float, 4>{ t, 0.2f, 1.0f - t, 1.0f } });
+        if (!draws.empty()) {
+            scenePass.secondaryCommandBuffers();
+            scenePass.record([this, &frame, &draws](RenderGraphContext& context) {
+                recordDraws(frame, context, draws);
+            });
+        }
+
+        m_graph->compile(uint32_t(frame.frameIndex % m_frames.size()));
+        m_graph->execute(frame.commandBuffer);
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - recordStart;
+        m_lastRecordCpuMs = draws.empty() ? 0.0 : elapsed.count();
+    }
+
+    void Renderer::recordDraws(FrameContext& frame, RenderGraphContext& context, const std::vector<DrawItem>& draws)
+    {
+        // One job per thread keeps the number of secondaries, and so the cost of
+        // executing them, low. Tiny scenes aren't worth splitting at all.
+        uint32_t threadCount = m_recordThreadCount == 0 ?
+            m_jobs->getThreadCount() :
+            std::min(m_recordThreadCount, m_jobs->getThreadCount());
+        uint32_t drawCount = uint32_t(draws.size());
+        uint32_t jobCount = std::max(std::min(threadCount, drawCount / std::max(m_config.minDrawsPerRecordJob, 1u)), 1u);
+        uint32_t drawsPerJob = (drawCount + jobCount - 1) / jobCount;
+
+        vk::CommandBufferInheritanceInfo inheritanceInfo{ context.getRenderPass(), 0, context.getFramebuffer() };
+        std::vector<vk::CommandBuffer> secondaries(jobCount);
+        JobCounter counter;
+        for (uint32_t job = 0; job < jobCount; ++job) {
+            uint32_t first = job * drawsPerJob;
+            uint32_t count = std::min(drawsPerJob, drawCount - first);
+            m_jobs->run([this, &frame, &inheritanceInfo, &draws, &secondaries, job, first, count]() {
+                secondaries[job] = recordDrawChunk(frame, inheritanceInfo, draws.data() + first, count);
+            }, counter);
+        }
+        m_jobs->wait(counter);
+
+        context.getCommandBuffer().executeCommands(secondaries);
+    }
+
+    vk::CommandBuffer Renderer::recordDrawChunk(FrameContext& frame, const vk::CommandBufferInheritanceInfo& inheritanceInfo, const DrawItem* draws, uint32_t count)
+    {
+        BVR_PROFILE_ZONE("record_draws");
+        FrameContext::WorkerCommandPool& workerPool = frame.workerPools[m_jobs->getWorkerIndex()];
+        if (workerPool.used == workerPool.secondaries.size()) {
+            vk::CommandBufferAllocateInfo allocInfo{ workerPool.pool, vk::CommandBufferLevel::eSecondary, 1 };
+            workerPool.secondaries.push_back(m_device.allocateCommandBuffers(allocInfo)[0]);
+        }
+        vk::CommandBuffer commandBuffer = workerPool.secondaries[workerPool.used++];
+
+        commandBuffer.begin(vk::CommandBufferBeginInfo{
+            vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+            &inheritanceInfo,
+        });
+
+        vk::Viewport viewport{ 0.0f, 0.0f, float(m_config.width), float(m_config.height), 0.0f, 1.0f };
+        vk::Rect2D scissor{ vk::Offset2D{ 0, 0 }, vk::Extent2D{ uint32_t(m_config.width), uint32_t(m_config.height) } };
+        commandBuffer.setViewport(0, viewport);
+        commandBuffer.setScissor(0, scissor);
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_scenePipeline);
+
+        for (uint32_t i = 0; i < count; ++i) {
+            commandBuffer.pushConstants(m_scenePipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(DrawItem), &draws[i]);
+            commandBuffer.draw(3, 1, 0, 0);
+        }
+
+        commandBuffer.end();
+        return commandBuffer;
+    }
+
+    void Renderer::waitIdle()
+    {
+        waitForTimelineValue(m_frameIndex);
+        for (FrameContext& frame : m_frames) {
+            retireFrame(frame);
+        }
+        m_device.waitIdle();
+    }
+
+    void Renderer::deferRelease(std::function<void()> release)
+    {
+        // While recording, the current frame is the newest one that can reference
+        // the resource. Outside of a frame, the last submitted one is.
+        FrameContext* frame = m_currentFrame;
+        if (frame == nullptr) {
+            frame = &m_frames[(m_frameIndex + m_frames.size() - 1) % m_frames.size()];
+        }
+        frame->deferredReleases.push_back(std::move(release));
+    }
+
+    std::vector<FrameTimings> Renderer::takeCompletedTimings()
+    {
+        std::vector<FrameTimings> timings;
+        timings.swap(m_completedTimings);
+        return timings;
+    }
+
+    void Renderer::immediateSubmit(const std::function<void(vk::CommandBuffer)>& record)
+    {
+        vk::CommandBufferAllocateInfo allocInfo{ m_immediatePool, vk::CommandBufferLevel::ePrimary, 1 };
+        vk::CommandBuffer commandBuffer = m_device.allocateCommandBuffers(allocInfo)[0];
+
+        commandBuffer.begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+        record(commandBuffer);
+        commandBuffer.end();
+
+        vk::SubmitInfo submitInfo{};
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        {
+            std::lock_guard<std::mutex> lock{ m_graphicsQueueMutex };
+            m_graphicsQueue.submit(submitInfo, m_immediateFence);
+        }
+
+        if (m_device.waitForFences(m_immediateFence, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess) {
+            throw std::runtime_error("Failed to wait for immediate submission");
+        }
+        m_device.resetFences(m_immediateFence);
+        m_device.freeCommandBuffers(m_immediatePool, commandBuffer);
+    }
+
+    void Renderer::defragmentMemory(FrameContext& frame)
+    {
+        BVR_PROFILE_ZONE("defragment");
+        std::vector<Buffer> moved;
+        if (m_memory->defragment(frame.commandBuffer, moved) == 0) {
+            return;
+        }
+
+        // Earlier frames may still read the old copies, but they retire first.
+        GpuMemory& memory = *m_memory;
+        frame.deferredReleases.push_back([&memory, moved]() mutable {
+            for (Buffer& buffer : moved) {
+                memory.destroyBuffer(buffer);
+            }
+        });
+
+        std::string message = "Defragmentation moved ";
+        debugLog(message.append(std::to_string(moved.size())).append(" buffers").c_str());
+    }
+
+    void Renderer::waitForTimelineValue(uint64_t value)
+    {
+        if (value == 0) {
+            return;
+        }
+
+        vk::SemaphoreWaitInfo waitInfo{};
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &m_frameTimeline;
+        waitInfo.pValues = &value;
+        if (m_device.waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess) {
+            throw std::runtime_error("Failed to wait for the frame timeline");
+        }
+    }
+
+    void Renderer::retireFrame(FrameContext& frame)
+    {
+        for (std::function<void()>& release : frame.deferredReleases) {
+            release();
+        }
+        frame.deferredReleases.clear();
+
+        if (!frame.pendingTimings) {
+            return;
+        }
+        frame.pendingTimings = false;
+
+#if BVR_PROFILE
+        if (m_gpuProfiler) {
+            m_gpuProfiler->collect(uint32_t(&frame - m_frames.data()));
+        }
+#endif
+
+        FrameTimings timings{};
+        timings.frameIndex = frame.frameIndex;
+        timings.renderScale = frame.renderScale;
+        timings.inputToSubmitMs = frame.inputToSubmitMs;
+        timings.inputToPresentMs = frame.inputToPresentMs;
+
+        if (m_timestampsSupported) {
+            // The frame has retired, so this never blocks.
+            uint64_t timestamps[2] = {};
+            vk::Result result = m_device.getQueryPoolResults(
+                frame.timestampPool, 0, 2,
+                sizeof(timestamps), timestamps, sizeof(uint64_t),
+                vk::QueryResultFlagBits::e64
+            );
+            if (result == vk::Result::eSuccess) {
+                // Only the low bits are defined, and the counter may wrap.
+                uint64_t mask = m_timestampValidBits >= 64 ? ~0ull : (1ull << m_timestampValidBits) - 1;
+                timings.gpuMs = double((timestamps[1] - timestamps[0]) & mask) * m_timestampPeriod * 1e-6;
+            }
+        }
+        m_dynamicResolution.addSample(timings.renderScale, timings.gpuMs);
+        m_completedTimings.push_back(timings);
+    }
+
+    void Renderer::initVulkan()
+    {
+        createInstance();
+        setupDebugMessenger();
+        if (!m_config.headless) {
+            createSurface();
+        }
+        pickPhysicalDevice();
+        createLogicalDevice();
+        createMemory();
+        createUploadQueue();
+        createPipelineCache();
+        createShaderLibrary();
+        createScenePass();
+        createFrameContexts();
+        createBindlessTable();
+        createSwapchain();
+    }
+
+    void Renderer::createInstance()
+    {
+        vk::ApplicationInfo appInfo{
+            "BVR",
+            VK_MAKE_VERSION(0, 1, 0),
+            "N/A",
+            VK_MAKE_VERSION(0, 1, 0),
+            VK_API_VERSION_1_2,
+        };
+
+
+        std::vector<const char*> requiredExtensions{ getRequiredExtensions() };
+        validateExtensions(requiredExtensions);
+
+
+        if (!checkValidationLayerSupport()) {
+            throw std::runtime_error("Validation requested, but layers not available.");
+        };
+
+        vk::InstanceCreateInfo createInfo{
+            vk::InstanceCreateFlags(),
+            &appInfo,
+            static_cast<uint32_t>(m_config.validationLayers.size()),
+            m_config.validationLayers.data(),
+            static_cast<uint32_t>(requiredExtensions.size()),
+            requiredExtensions.data(),
+        };
+
+        VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
+
+        if (isValidationEnabled()) {
+            debugCreateInfo = getDebugMessengerCreateInfo();
+            createInfo.pNext = &debugCreateInfo;
+        }
+
+        m_instance = vk::createInstance(createInfo);
+
+    }
+
+    bool Renderer::isValidationEnabled()
+    {
+        return m_config.validationLayers.size();
+    }
+
+    std::vector<const char*> Renderer::getRequiredExtensions() const
+    {
+        std::vector<const char*> extensions;
+
+        // GLFW can't be queried without being initialized, which headless runs never do.
+        if (!m_config.headless) {
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions;
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+            extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
+
+        if (m_config.validationLayers.size() > 0) {
+            extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+        }
+
+        return extensions;
+    }
+
+    void Renderer::validateExtensions(std::vector<const char*> requiredExtensions) const
+    {
+        std::vector<vk::ExtensionProperties> extensions = vk::enumerateInstanceExtensionProperties();
+
+        for (size_t i = 0; i < requiredExtensions.size(); ++i) {
+            const char* requiredExtension = requiredExtensions[i];
+            bool requirementMet = false;
+
+            for (size_t j = 0; j < extensions.size(); j++) {
+                if (strcmp(extensions[j].extensionName, requiredExtension) == 0) {
+                    requirementMet = true;
+                    break;
+                }
+            }
+
+            if (!requirementMet) {
+                std::string errorString{ requiredExtension };
+                throw std::runtime_error(errorString.append(" is not supported!"));
+            }
+        }
+    }
+
+    bool Renderer::checkValidationLayerSupport() const
+    {
+        std::vector < vk::LayerProperties> layers = vk::enumerateInstanceLayerProperties();
+
+        for (const char* layerName : m_config.validationLayers) {
+            bool layerFound = false;
+
+            for (const vk::LayerProperties& layerProps : layers) {
+                if (strcmp(layerProps.layerName, layerName) == 0) {
+                    layerFound = true;
+                    break;
+                }
+            }
+
+            if (!layerFound) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void Renderer::pickPhysicalDevice()
+    {
+        std::vector<vk::PhysicalDevice> devices = m_instance.enumeratePhysicalDevices();
+
+        if (!m_config.forcedDevice.empty()) {
+            m_physicalDevice = findForcedDevice(devices);
+        }
+        else {
+            uint64_t bestScore = 0;
+            for (const auto& device : devices) {
+                uint64_t score = scoreDevice(device);
+#ifndef  NDEBUG
+                vk::PhysicalDeviceProperties props = device.getProperties();
+                std::string message = "Physical Device candidate ";
+                debugLog(message.append(&props.deviceName[0]).append(", score ").append(std::to_string(score)).c_str());
+#endif
+                if (score > bestScore) {
+                    bestScore = score;
+                    m_physicalDevice = device;
+                }
+            }
+        }
+
+        if (!m_physicalDevice) {
+            throw std::runtime_error("Failed to find suitable physical device!");
+        }
+
+#ifndef  NDEBUG
+        vk::PhysicalDeviceProperties props = m_physicalDevice.getProperties();
+        std::string message = "Physical Device found! ";
+        debugLog(message.append(props.deviceName).c_str());
+#endif
+    }
+
+    vk::PhysicalDevice Renderer::findForcedDevice(const std::vector<vk::PhysicalDevice>& devices) const
+    {
+        const std::string& forced = m_config.forcedDevice;
+        bool isIndex = std::all_of(forced.begin(), forced.end(), [](char c) { return c >= '0' && c <= '9'; });
+
+        for (size_t i = 0; i < devices.size(); ++i) {
+            vk::PhysicalDeviceProperties props = devices[i].getProperties();
+            bool matches = isIndex ?
+                std::to_string(i) == forced :
+                std::string{ &props.deviceName[0] }.find(forced) != std::string::npos;
+
+            if (!matches) {
+                continue;
+            }
+            if (!isDeviceSuitable(devices[i])) {
+                std::string errorString{ "Forced physical device " };
+                throw std::runtime_error(errorString.append(&props.deviceName[0]).append(" is missing required queues!"));
+            }
+            return devices[i];
+        }
+
+        std::string errorString{ "No physical device matches " };
+        throw std::runtime_error(errorString.append(forced));
+    }
+
+    bool Renderer::isDeviceSuitable(const vk::PhysicalDevice& device) const
+    {
+        QueueFamilyIndices indices = findQueueFamilies(device);
+
+        vk::PhysicalDeviceProperties props = device.getProperties();
+        if (props.apiVersion < VK_API_VERSION_1_2) {
+            return false;
+        }
+
+        // Frame pacing relies on timeline semaphores.
+        vk::PhysicalDeviceVulkan12Features features12{};
+        vk::PhysicalDeviceFeatures2 features2{};
+        features2.pNext = &features12;
+        device.getFeatures2(&features2);
+
+        if (!indices.isComplete(m_config.headless) || !features12.timelineSemaphore) {
+            return false;
+        }
+
+        // Windows present through a swapchain.
+        if (!m_config.headless) {
+            std::vector<vk::ExtensionProperties> extensions = device.enumerateDeviceExtensionProperties();
+            bool swapchainSupported = std::any_of(extensions.begin(), extensions.end(), [](const vk::ExtensionProperties& extension) {
+                return strcmp(extension.extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0;
+            });
+            if (!swapchainSupported) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint64_t Renderer::scoreDevice(const vk::PhysicalDevice& device) const
+    {
+        if (!isDeviceSuitable(device)) {
+            return 0;
+        }
+
+        vk::PhysicalDeviceProperties props = device.getProperties();
+        vk::PhysicalDeviceMemoryProperties memProps = device.getMemoryProperties();
+        std::vector<vk::QueueFamilyProperties> queueFamilies = device.getQueueFamilyProperties();
+
+        // Device type dominates, the rest only breaks ties between devices of the same kind.
+        uint64_t score = 1;
+        switch (props.deviceType) {
+        case vk::PhysicalDeviceType::eDiscreteGpu: score += 1000000; break;
+        case vk::PhysicalDeviceType::eIntegratedGpu: score += 500000; break;
+        case vk::PhysicalDeviceType::eVirtualGpu: score += 250000; break;
+        case vk::PhysicalDeviceType::eCpu: score += 100000; break;
+        default: break;
+        }
+
+        // Queues that can run alongside graphics let uploads and compute overlap with rendering.
+        bool hasTransferQueue = false;
+        bool hasComputeQueue = false;
+        bool hasTimestamps = false;
+        for (const vk::QueueFamilyProperties& family : queueFamilies) {
+            bool graphics = bool(family.queueFlags & vk::QueueFlagBits::eGraphics);
+            bool compute = bool(family.queueFlags & vk::QueueFlagBits::eCompute);
+            bool transfer = bool(family.queueFlags & vk::QueueFlagBits::eTransfer);
+            hasTransferQueue |= transfer && !graphics && !compute;
+            hasComputeQueue |= compute && !graphics;
+            hasTimestamps |= graphics && family.timestampValidBits > 0;
+        }
+        score += hasTransferQueue ? 20000 : 0;
+        score += hasComputeQueue ? 20000 : 0;
+        score += hasTimestamps && props.limits.timestampComputeAndGraphics ? 10000 : 0;
+
+        // One point per 64 MiB of device local memory, capped at 64 GiB.
+        vk::DeviceSize deviceLocalBytes = 0;
+        for (uint32_t i = 0; i < memProps.memoryHeapCount; ++i) {
+            if (memProps.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+                deviceLocalBytes += memProps.memoryHeaps[i].size;
+            }
+        }
+        score += std::min<uint64_t>(deviceLocalBytes >> 26, 1024) * 10;
+
+        // Limits that cap what we can render: render target size and compute dispatch width.
+        score += std::min<uint64_t>(props.limits.maxImageDimension2D / 1024, 32) * 100;
+        score += std::min<uint64_t>(props.limits.maxComputeWorkGroupInvocations / 64, 32) * 50;
+
+        return score;
+    }
+
+    QueueFamilyIndices Renderer::findQueueFamilies(const vk::PhysicalDevice& physicalDevice) const
+    {
+        QueueFamilyIndices indices;
+
+        std::vector<vk::QueueFamilyProperties> queueFamilies = physicalDevice.getQueueFamilyProperties();
+        uint32_t computeFamily = UINT32_MAX;
+        for (uint32_t i = 0; i < uint32_t(queueFamilies.size()); ++i) {
+            const vk::QueueFamilyProperties& queueFamily = queueFamilies[i];
+            if (queueFamily.queueCount == 0) {
+                continue;
+            }
+
+            bool graphics = bool(queueFamily.queueFlags & vk::QueueFlagBits::eGraphics);
+            bool compute = bool(queueFamily.queueFlags & vk::QueueFlagBits::eCompute);
+            bool transfer = bool(queueFamily.queueFlags & vk::QueueFlagBits::eTransfer);
+
+            if (graphics && indices.graphicsFamily == UINT32_MAX) {
+                indices.graphicsFamily = i;
+            }
+            // Transfer-only families map to the DMA engines.
+            if (transfer && !graphics && !compute && indices.transferFamily == UINT32_MAX) {
+                indices.transferFamily = i;
+            }
+            if (compute && !graphics && computeFamily == UINT32_MAX) {
+                computeFamily = i;
+            }
+
+            if (!m_config.headless && indices.presentFamily != indices.graphicsFamily) {
+                vk::Bool32 presentSupported = physicalDevice.getSurfaceSupportKHR(i, m_surface);
+                // Presenting from the graphics family avoids an ownership transfer.
+                if (presentSupported && (indices.presentFamily == UINT32_MAX || i == indices.graphicsFamily)) {
+                    indices.presentFamily = i;
+                }
+            }
+        }
+
+        // Async compute queues can copy as well, which still beats sharing the graphics queue.
+        if (indices.transferFamily == UINT32_MAX) {
+            indices.transferFamily = computeFamily != UINT32_MAX ? computeFamily : indices.graphicsFamily;
+        }
+
+        return indices;
+    }
+
+    void Renderer::createLogicalDevice()
+    {
+        QueueFamilyIndices indices = findQueueFamilies(m_physicalDevice);
+        std::vector<vk::QueueFamilyProperties> queueFamilies = m_physicalDevice.getQueueFamilyProperties();
+        std::array<float, 2> queuePriorities{ 1.0f, 0.5f };
+
+        std::set<uint32_t> uniqueQueueFamilies{ indices.graphicsFamily, indices.transferFamily };
+        if (!m_config.headless) {
+            uniqueQueueFamilies.insert(indices.presentFamily);
+        }
+
+        // Without a separate transfer family, uploads get a second graphics queue
+        // if there is one, and share the graphics queue otherwise.
+        uint32_t transferQueueIndex = 0;
+        if (indices.transferFamily == indices.graphicsFamily) {
+            if (queueFamilies[indices.graphicsFamily].queueCount > 1) {
+                transferQueueIndex = 1;
+            }
+            else {
+                m_transferSharesGraphicsQueue = true;
+            }
+        }
+
+        std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
+        queueCreateInfos.reserve(uniqueQueueFamilies.size());
+
+        for (const uint32_t queueFamily : uniqueQueueFamilies) {
+            uint32_t queueCount = queueFamily == indices.graphicsFamily ? transferQueueIndex + 1 : 1;
+            queueCreateInfos.emplace_back(
+                vk::DeviceQueueCreateFlags{},
+                queueFamily,
+                queueCount,
+                queuePriorities.data()
+            );
+        }
+
+        vk::PhysicalDeviceVulkan12Features supported12{};
+        vk::PhysicalDeviceFeatures2 supported{};
+        supported.pNext = &supported12;
+        m_physicalDevice.getFeatures2(&supported);
+
+        vk::PhysicalDeviceVulkan12Features features12{};
+        features12.timelineSemaphore = VK_TRUE;
+
+        // Optional, GPU-driven culling falls back to the CPU without them.
+        m_gpuCullingSupported = supported12.drawIndirectCount &&
+            supported.features.multiDrawIndirect &&
+            supported.features.drawIndirectFirstInstance;
+        features12.drawIndirectCount = m_gpuCullingSupported;
+
+        // Optional, what the bindless table needs: arrays that are partially
+        // bound, updated after bind, and indexed with non-uniform values.
+        m_bindlessSupported = supported12.descriptorIndexing &&
+            supported12.runtimeDescriptorArray &&
+            supported12.descriptorBindingPartiallyBound &&
+            supported12.descriptorBindingUpdateUnusedWhilePending &&
+            supported12.descriptorBindingSampledImageUpdateAfterBind &&
+            supported12.descriptorBindingStorageBufferUpdateAfterBind &&
+            supported12.shaderSampledImageArrayNonUniformIndexing &&
+            supported12.shaderStorageBufferArrayNonUniformIndexing;
+        features12.descriptorIndexing = m_bindlessSupported;
+        features12.runtimeDescriptorArray = m_bindlessSupported;
+        features12.descriptorBindingPartiallyBound = m_bindlessSupported;
+        features12.descriptorBindingUpdateUnusedWhilePending = m_bindlessSupported;
+        features12.descriptorBindingSampledImageUpdateAfterBind = m_bindlessSupported;
+        features12.descriptorBindingStorageBufferUpdateAfterBind = m_bindlessSupported;
+        features12.shaderSampledImageArrayNonUniformIndexing = m_bindlessSupported;
+        features12.shaderStorageBufferArrayNonUniformIndexing = m_bindlessSupported;
+
+        std::vector<const char*> deviceExtensions;
+        std::vector<vk::ExtensionProperties> availableExtensions = m_physicalDevice.enumerateDeviceExtensionProperties();
+        auto isExtensionAvailable = [&availableExtensions](const char* name) {
+            for (const vk::ExtensionProperties& extension : availableExtensions) {
+                if (strcmp(extension.extensionName, name) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        m_memoryBudgetSupported = isExtensionAvailable(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        if (m_memoryBudgetSupported) {
+            deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+
+        if (!m_config.headless) {
+            deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        }
+
+        // Optional, limiting frame latency falls back to waiting for the GPU
+        // instead of the display without them.
+        vk::PhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+        vk::PhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+        if (!m_config.headless &&
+            isExtensionAvailable(VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+            isExtensionAvailable(VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+            presentIdFeatures.pNext = &presentWaitFeatures;
+            vk::PhysicalDeviceFeatures2 presentFeatures{};
+            presentFeatures.pNext = &presentIdFeatures;
+            m_physicalDevice.getFeatures2(&presentFeatures);
+            m_presentWaitSupported = presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+        }
+        if (m_presentWaitSupported) {
+            deviceExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+            deviceExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+            features12.pNext = &presentIdFeatures;
+        }
+
+        vk::PhysicalDeviceFeatures features{};
+        features.multiDrawIndirect = m_gpuCullingSupported;
+        features.drawIndirectFirstInstance = m_gpuCullingSupported;
+        // Optional, packages cooked with BC textures can't load theirs without it.
+        m_textureCompressionBcSupported = supported.features.textureCompressionBC;
+        features.textureCompressionBC = m_textureCompressionBcSupported;
+#if BVR_PROFILE
+        // Optional, the GPU profiler only records timestamps without it.
+        m_pipelineStatisticsSupported = supported.features.pipelineStatisticsQuery;
+        features.pipelineStatisticsQuery = m_pipelineStatisticsSupported;
+#endif
+        vk::DeviceCreateInfo createInfo{
+            vk::DeviceCreateFlags(),
+            uint32_t(queueCreateInfos.size()),
+            queueCreateInfos.data(),
+            0, nullptr, // Layers, deprecated and ignored
+            uint32_t(deviceExtensions.size()),
+            deviceExtensions.data(),
+            &features,
+        };
+        createInfo.pNext = &features12;
+
+        m_device = m_physicalDevice.createDevice(createInfo);
+        m_queueFamilies = indices;
+        m_graphicsQueue = m_device.getQueue(indices.graphicsFamily, 0);
+        m_transferQueue = m_device.getQueue(indices.transferFamily, transferQueueIndex);
+        if (!m_config.headless) {
+            m_presentQueue = m_device.getQueue(indices.presentFamily, 0);
+        }
+    }
+
+    void Renderer::createSurface()
+    {
+        VkSurfaceKHR surface;
+        if (glfwCreateWindowSurface(m_instance, m_window, nullptr, &surface) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create the window surface");
+        }
+        m_surface = surface;
+    }
+
+    void Renderer::createMemory()
+    {
+        m_memory = std::make_unique<GpuMemory>(
+            m_physicalDevice,
+            m_device,
+            m_config.memory,
+            std::max(m_config.framesInFlight, 1u),
+            m_memoryBudgetSupported
+        );
+#ifndef NDEBUG
+        m_memory->logBudget();
+#endif
+
+        m_immediatePool = m_device.createCommandPool(vk::CommandPoolCreateInfo{
+            vk::CommandPoolCreateFlagBits::eTransient,
+            m_queueFamilies.graphicsFamily,
+        });
+        m_immediateFence = m_device.createFence(vk::FenceCreateInfo{});
+    }
+
+    void Renderer::createUploadQueue()
+    {
+        std::vector<vk::QueueFamilyProperties> families = m_physicalDevice.getQueueFamilyProperties();
+        m_uploads = std::make_unique<UploadQueue>(
+            m_device,
+            *m_memory,
+            m_transferQueue,
+            m_queueFamilies.transferFamily,
+            m_queueFamilies.graphicsFamily,
+            families[m_queueFamilies.transferFamily].minImageTransferGranularity,
+            m_config.memory.uploadStagingSize,
+            m_transferSharesGraphicsQueue ? &m_graphicsQueueMutex : nullptr
+        );
+
+#ifndef NDEBUG
+        std::string message = "Uploads use queue family ";
+        debugLog(message.append(std::to_string(m_queueFamilies.transferFamily))
+            .append(m_queueFamilies.transferFamily == m_queueFamilies.graphicsFamily ? " (graphics)" : " (dedicated)").c_str());
+#endif
+    }
+
+    void Renderer::createPipelineCache()
+    {
+        m_pipelines = std::make_unique<PipelineCache>(m_device, m_physicalDevice.getProperties(), m_config.pipelineCachePath);
+    }
+
+    void Renderer::createShaderLibrary()
+    {
+        m_shaders = std::make_unique<ShaderLibrary>(*this, m_config.shaders);
+    }
+
+    void Renderer::createFrameContexts()
+    {
+        vk::PhysicalDeviceProperties props = m_physicalDevice.getProperties();
+        std::vector<vk::QueueFamilyProperties> families = m_physicalDevice.getQueueFamilyProperties();
+        m_timestampsSupported = props.limits.timestampComputeAndGraphics &&
+            families[m_queueFamilies.graphicsFamily].timestampValidBits > 0;
+        m_timestampPeriod = props.limits.timestampPeriod;
+        m_timestampValidBits = families[m_queueFamilies.graphicsFamily].timestampValidBits;
+
+        vk::SemaphoreTypeCreateInfo timelineInfo{ vk::SemaphoreType::eTimeline, 0 };
+        vk::SemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.pNext = &timelineInfo;
+        m_frameTimeline = m_device.createSemaphore(semaphoreInfo);
+
+        // Per-frame descriptors are transient: allocated while recording and
+        // released wholesale when the frame context is reused.
+        std::array<vk::DescriptorPoolSize, 4> poolSizes{
+            vk::DescriptorPoolSize{ vk::DescriptorType::eUniformBuffer, 256 },
+            vk::DescriptorPoolSize{ vk::DescriptorType::eStorageBuffer, 256 },
+            vk::DescriptorPoolSize{ vk::DescriptorType::eCombinedImageSampler, 256 },
+            vk::DescriptorPoolSize{ vk::DescriptorType::eStorageImage, 64 },
+        };
+
+        m_frames.resize(std::max(m_config.framesInFlight, 1u));
+        for (FrameContext& frame : m_frames) {
+            frame.commandPool = m_device.createCommandPool(vk::CommandPoolCreateInfo{
+                vk::CommandPoolCreateFlagBits::eTransient,
+                m_queueFamilies.graphicsFamily,
+            });
+
+            vk::CommandBufferAllocateInfo allocInfo{ frame.commandPool, vk::CommandBufferLevel::ePrimary, 1 };
+            frame.commandBuffer = m_device.allocateCommandBuffers(allocInfo)[0];
+
+            frame.descriptorPool = m_device.createDescriptorPool(vk::DescriptorPoolCreateInfo{
+                vk::DescriptorPoolCreateFlags{},
+                256,
+                uint32_t(poolSizes.size()),
+                poolSizes.data(),
+            });
+
+            if (m_timestampsSupported) {
+                frame.timestampPool = m_device.createQueryPool(vk::QueryPoolCreateInfo{
+                    vk::QueryPoolCreateFlags{},
+                    vk::QueryType::eTimestamp,
+                    2,
+                });
+            }
+
+            frame.workerPools.resize(m_jobs->getThreadCount());
+            for (FrameContext::WorkerCommandPool& workerPool : frame.workerPools) {
+                workerPool.pool = m_device.createCommandPool(vk::CommandPoolCreateInfo{
+                    vk::CommandPoolCreateFlagBits::eTransient,
+                    m_queueFamilies.graphicsFamily,
+                });
+            }
+
+            // Windowed runs render into the same offscreen images as headless
+            // ones, endFrame() copies them into the swapchain.
+            frame.target = createOffscreenTarget();
+        }
+
+        m_graph = std::make_unique<RenderGraph>(m_device, *m_memory, props.limits.bufferImageGranularity, uint32_t(m_frames.size()));
+
+#if BVR_PROFILE
+        if (m_timestampsSupported) {
+            m_gpuProfiler = std::make_unique<GpuProfiler>(m_device, uint32_t(m_frames.size()), m_timestampPeriod, m_timestampValidBits, m_pipelineStatisticsSupported);
+            m_graph->setGpuProfiler(m_gpuProfiler.get());
+        }
+#endif
+    }
+
+    void Renderer::createSwapchain()
+    {
+        if (m_config.headless && !m_config.swapchain.virtualSwapchain) {
+            return;
+        }
+
+        vk::Extent2D extent{ uint32_t(m_config.width), uint32_t(m_config.height) };
+        if (!m_config.headless) {
+            int width = 0;
+            int height = 0;
+            glfwGetFramebufferSize(m_window, &width, &height);
+            extent = vk::Extent2D{ uint32_t(width), uint32_t(height) };
+        }
+
+        // Without a surface it is virtual.
+        m_swapchain = std::make_unique<Swapchain>(
+            *this,
+            m_config.swapchain,
+            m_physicalDevice,
+            m_surface,
+            m_queueFamilies.graphicsFamily,
+            m_config.headless ? m_queueFamilies.graphicsFamily : m_queueFamilies.presentFamily,
+            uint32_t(m_frames.size()),
+            m_frameTimeline,
+            m_presentWaitSupported,
+            extent
+        );
+    }
+
+    void Renderer::createBindlessTable()
+    {
+        if (!m_bindlessSupported) {
+            debugLog("Descriptor indexing unsupported, no bindless table");
+            return;
+        }
+
+        vk::PhysicalDeviceVulkan12Properties props12{};
+        vk::PhysicalDeviceProperties2 props{};
+        props.pNext = &props12;
+        m_physicalDevice.getProperties2(&props);
+
+        // Every stage sees the whole set, so the per-stage limits apply as well.
+        BindlessConfig config = m_config.bindless;
+        config.maxTextures = std::min({ config.maxTextures,
+            props12.maxDescriptorSetUpdateAfterBindSampledImages,
+            props12.maxPerStageDescriptorUpdateAfterBindSampledImages });
+        config.maxBuffers = std::min({ config.maxBuffers,
+            props12.maxDescriptorSetUpdateAfterBindStorageBuffers,
+            props12.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+        config.maxSamplers = std::min({ config.maxSamplers,
+            props12.maxDescriptorSetUpdateAfterBindSamplers,
+            props12.maxPerStageDescriptorUpdateAfterBindSamplers });
+        m_bindless = std::make_unique<BindlessTable>(*this, config);
+
+#ifndef NDEBUG
+        std::string message = "Bindless table with ";
+        debugLog(message.append(std::to_string(config.maxTextures)).append(" textures, ")
+            .append(std::to_string(config.maxBuffers)).append(" buffers, ")
+            .append(std::to_string(config.maxSamplers)).append(" samplers").c_str());
+#endif
+    }
+
+    void Renderer::createScenePass()
+    {
+        // Only used to create the scene pipelines. Frames render through the
+        // render graph's own, compatible render passes.
+        vk::AttachmentDescription colorAttachment{
+            vk::AttachmentDescriptionFlags{},
+            vk::Format::eR8G8B8A8Unorm,
+            vk::SampleCountFlagBits::e1,
+            vk::AttachmentLoadOp::eClear,
+            vk::AttachmentStoreOp::eStore,
+            vk::AttachmentLoadOp::eDontCare,
+            vk::AttachmentStoreOp::eDontCare,
+            vk::ImageLayout::eUndefined,
+            vk::ImageLayout::eShaderReadOnlyOptimal,
+        };
+        vk::AttachmentReference colorRef{ 0, vk::ImageLayout::eColorAttachmentOptimal };
+        vk::SubpassDescription subpass{
+            vk::SubpassDescriptionFlags{},
+            vk::PipelineBindPoint::eGraphics,
+            0, nullptr, // Input attachments
+            1, &colorRef,
+        };
+        // The previous frame in flight may still be reading its own target, but
+        // never this one; only order against our own earlier writes.
+        vk::SubpassDependency dependency{
+            VK_SUBPASS_EXTERNAL,
+            0,
+            vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            vk::AccessFlags{},
+            vk::AccessFlagBits::eColorAttachmentWrite,
+        };
+        m_sceneRenderPass = m_device.createRenderPass(vk::RenderPassCreateInfo{
+            vk::RenderPassCreateFlags{},
+            1, &colorAttachment,
+            1, &subpass,
+            1, &dependency,
+        });
+
+        vk::PushConstantRange pushConstants{ vk::ShaderStageFlagBits::eVertex, 0, sizeof(DrawItem) };
+        m_scenePipelineLayout = m_pipelines->getPipelineLayout(vk::PipelineLayoutCreateInfo{
+            vk::PipelineLayoutCreateFlags{},
+            0, nullptr,
+            1, &pushConstants,
+        });
+
+        if (!m_config.shaders.hotReload) {
+            m_scenePipeline = getScenePipelineVariant(0);
+            return;
+        }
+
+        // The same fixed-function state, with stages and layout built from the
+        // sources. Reflecting the shaders gives the same layout as above.
+        GraphicsShaderDesc sceneShaders{};
+        sceneShaders.stages = { "triangle.vert", "triangle.frag" };
+        sceneShaders.build = [this](const vk::GraphicsPipelineCreateInfo& shaderInfo, const std::function<void(const vk::GraphicsPipelineCreateInfo&)>& compile) {
+            buildScenePipelineInfo(0, [&](const vk::GraphicsPipelineCreateInfo& sceneInfo) {
+                vk::GraphicsPipelineCreateInfo pipelineInfo = sceneInfo;
+                pipelineInfo.stageCount = shaderInfo.stageCount;
+                pipelineInfo.pStages = shaderInfo.pStages;
+                pipelineInfo.layout = shaderInfo.layout;
+                compile(pipelineInfo);
+            });
+        };
+        m_sceneShaders = m_shaders->createGraphicsPipeline(sceneShaders);
+        m_scenePipeline = m_shaders->get(m_sceneShaders).pipeline;
+        m_scenePipelineLayout = m_shaders->get(m_sceneShaders).layout;
+    }
+
+    vk::Pipeline Renderer::getScenePipelineVariant(uint32_t variant)
+    {
+        vk::Pipeline pipeline;
+        buildScenePipelineInfo(variant, [&](const vk::GraphicsPipelineCreateInfo& pipelineInfo) {
+            pipeline = m_pipelines->getGraphicsPipeline(pipelineInfo);
+        });
+        return pipeline;
+    }
+
+    std::shared_ptr<const AsyncPipeline> Renderer::compileScenePipelineVariantAsync(uint32_t variant)
+    {
+        std::shared_ptr<const AsyncPipeline> pipeline;
+        buildScenePipelineInfo(variant, [&](const vk::GraphicsPipelineCreateInfo& pipelineInfo) {
+            pipeline = m_pipelines->compileGraphicsPipelineAsync(pipelineInfo);
+        });
+        return pipeline;
+    }
+
+    void Renderer::buildScenePipelineInfo(uint32_t variant, const std::function<void(const vk::GraphicsPipelineCreateInfo&)>& compile)
+    {
+        vk::SpecializationMapEntry variantEntry{ 0, 0, sizeof(uint32_t) };
+        vk::SpecializationInfo specialization{ 1, &variantEntry, sizeof(uint32_t), &variant };
+
+        vk::ShaderModule vertexShader = createEmbeddedShaderModule("triangle.vert");
+        vk::ShaderModule fragmentShader = createEmbeddedShaderModule("triangle.frag");
+        std::array<vk::PipelineShaderStageCreateInfo, 2> stages{
+            vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eVertex, vertexShader, "main" },
+            vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eFragment, fragmentShader, "main", &specialization },
+        };
+
+        vk::PipelineVertexInputStateCreateInfo vertexInput{};
+        vk::PipelineInputAssemblyStateCreateInfo inputAssembly{ vk::PipelineInputAssemblyStateCreateFlags{}, vk::PrimitiveTopology::eTriangleList };
+        vk::PipelineViewportStateCreateInfo viewportState{ vk::PipelineViewportStateCreateFlags{}, 1, nullptr, 1, nullptr };
+        vk::PipelineRasterizationStateCreateInfo rasterization{};
+        rasterization.polygonMode = vk::PolygonMode::eFill;
+        rasterization.cullMode = vk::CullModeFlagBits::eNone;
+        rasterization.frontFace = vk::FrontFace::eCounterClockwise;
+        rasterization.lineWidth = 1.0f;
+        vk::PipelineMultisampleStateCreateInfo multisample{};
+        vk::PipelineColorBlendAttachmentState blendAttachment{};
+        blendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+            vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+        vk::PipelineColorBlendStateCreateInfo colorBlend{};
+        colorBlend.attachmentCount = 1;
+        colorBlend.pAttachments = &blendAttachment;
+        std::array<vk::DynamicState, 2> dynamicStates{ vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+        vk::PipelineDynamicStateCreateInfo dynamicState{ vk::PipelineDynamicStateCreateFlags{}, uint32_t(dynamicStates.size()), dynamicStates.data() };
+
+        vk::GraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.stageCount = uint32_t(stages.size());
+        pipelineInfo.pStages = stages.data();
+        pipelineInfo.pVertexInputState = &vertexInput;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterization;
+        pipelineInfo.pMultisampleState = &multisample;
+        pipelineInfo.pColorBlendState = &colorBlend;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = m_scenePipelineLayout;
+        pipelineInfo.renderPass = m_sceneRenderPass;
+        pipelineInfo.subpass = 0;
+
+        compile(pipelineInfo);
+    }
+
+    vk::ShaderModule Renderer::createEmbeddedShaderModule(const char* name)
+    {
+        ShaderBinary binary = getEmbeddedShader(name);
+        if (binary.code == nullptr) {
+            std::string errorString{ "Missing embedded shader " };
+            throw std::runtime_error(errorString.append(name));
+        }
+        // Owned by the pipeline cache, which hands out the same module for every
+        // request of the same SPIR-V.
+        return m_pipelines->getShaderModule(binary.code, binary.size);
+    }
+
+    void Renderer::destroyFrameContext(FrameContext& frame)
+    {
+        for (FrameContext::WorkerCommandPool& workerPool : frame.workerPools) {
+            m_device.destroyCommandPool(workerPool.pool);
+        }
+        m_device.destroyImageView(frame.target.view);
+        m_memory->destroyImage(frame.target.color);
+        m_device.destroyQueryPool(frame.timestampPool);
+        m_device.destroyDescriptorPool(frame.descriptorPool);
+        m_device.destroyCommandPool(frame.commandPool);
+    }
+
+    OffscreenTarget Renderer::createOffscreenTarget()
+    {
+        OffscreenTarget target{};
+
+        vk::ImageCreateInfo imageInfo{
+            vk::ImageCreateFlags{},
+            vk::ImageType::e2D,
+            vk::Format::eR8G8B8A8Unorm,
+            vk::Extent3D{ uint32_t(m_config.width), uint32_t(m_config.height), 1 },
+            1, // Mip levels
+            1, // Array layers
+            vk::SampleCountFlagBits::e1,
+            vk::ImageTiling::eOptimal,
+            vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eSampled,
+        };
+        target.color = m_memory->createImage(imageInfo);
+
+        vk::ImageViewCreateInfo viewInfo{
+            vk::ImageViewCreateFlags{},
+            target.color.image,
+            vk::ImageViewType::e2D,
+            imageInfo.format,
+            vk::ComponentMapping{},
+            vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 },
+        };
+        target.view = m_device.createImageView(viewInfo);
+
+        return target;
+    }
+
+    VkDebugUtilsMessengerCreateInfoEXT Renderer::getDebugMessengerCreateInfo() const
+    {
+        vk::DebugUtilsMessengerCreateInfoEXT createInfo{
+            {},
+            vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose | vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning | vk::DebugUtilsMessageSeverityFlagBitsEXT::eError,
+            vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral | vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance | vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation,
+            debugCallback,
+            nullptr,
+        };
+
+        return createInfo;
+    }
+
+    void Renderer::setupDebugMessenger()
+    {
+        if (m_config.validationLayers.size() == 0) {
+            return;
+        }
+
+        VkDebugUtilsMessengerCreateInfoEXT createInfo = getDebugMessengerCreateInfo();
+
+        auto func = (PFN_vkCreateDebugUtilsMessengerEXT)m_instance.getProcAddr("vkCreateDebugUtilsMessengerEXT");
+
+        VkDebugUtilsMessengerEXT dbgMessenger;
+        if (func != nullptr) {
+            func(m_instance, &createInfo, nullptr, &dbgMessenger);
+            m_dbgMessenger = dbgMessenger;
+        }
+        else {
+            throw std::runtime_error("Failed to setup the Debug Messenger");
+        }
+    }
+
+    void Renderer::destroyDebugMessenger()
+    {
+        auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)m_instance.getProcAddr("vkDestroyDebugUtilsMessengerEXT");
+        if (func != nullptr && m_dbgMessenger) {
+            func(m_instance, m_dbgMessenger, nullptr);
+        }
+    }
+
+    VKAPI_ATTR VkBool32 VKAPI_CALL Renderer::debugCallback(
+        VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+        VkDebugUtilsMessageTypeFlagsEXT messageType,
+        const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+        void* pUserData)
+    {
+
+        std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
+
+        return VK_FALSE;
+    }
+}
@@ -0,0 +1,281 @@
+#include "shader_compiler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        // Part of every cache entry's name. Bump when the compiler flags
+        // change, so entries compiled with the old ones are left alone.
+        const uint32_t kShaderCacheVersion = 1;
+        const uint32_t kSpirvMagic = 0x07230203;
+
+        struct StageExtension
+        {
+            const char* extension;
+            vk::ShaderStageFlagBits stage;
+        };
+
+        const StageExtension s_stageExtensions[] = {
+            { ".vert", vk::ShaderStageFlagBits::eVertex },
+            { ".frag", vk::ShaderStageFlagBits::eFragment },
+            { ".comp", vk::ShaderStageFlagBits::eCompute },
+            { ".geom", vk::ShaderStageFlagBits::eGeometry },
+            { ".tesc", vk::ShaderStageFlagBits::eTessellationControl },
+            { ".tese", vk::ShaderStageFlagBits::eTessellationEvaluation },
+        };
+
+        bool readFile(const std::string& path, std::string& contents)
+        {
+            std::ifstream file{ path, std::ios::binary };
+            if (!file) {
+                return false;
+            }
+            std::ostringstream stream;
+            stream << file.rdbuf();
+            contents = stream.str();
+            return true;
+        }
+
+        bool readSpirv(const std::string& path, std::vector<uint32_t>& spirv)
+        {
+            std::string bytes;
+            // At least the five words of the header.
+            if (!readFile(path, bytes) || bytes.size() < 20 || bytes.size() % sizeof(uint32_t) != 0) {
+                return false;
+            }
+            spirv.resize(bytes.size() / sizeof(uint32_t));
+            memcpy(spirv.data(), bytes.data(), bytes.size());
+            if (spirv[0] != kSpirvMagic) {
+                spirv.clear();
+                return false;
+            }
+            return true;
+        }
+
+        // Both `#include "name"` and `#include <name>`, as glslang takes them in
+        // GLSL and HLSL. Includes that are commented or preprocessed out are
+        // listed too, which only costs an unneeded recompile.
+        std::vector<std::string> findIncludes(const std::string& source)
+        {
+            std::vector<std::string> includes;
+            std::istringstream lines{ source };
+            std::string line;
+            while (std::getline(lines, line)) {
+                size_t start = line.find_first_not_of(" \t");
+                if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+                    continue;
+                }
+                size_t open = line.find_first_of("\"<", start + 8);
+                if (open == std::string::npos) {
+                    continue;
+                }
+                size_t close = line.find(line[open] == '"' ? '"' : '>', open + 1);
+                if (close != std::string::npos) {
+                    includes.push_back(line.substr(open + 1, close - open - 1));
+                }
+            }
+            return includes;
+        }
+
+        // The including file's directory first, then the include directories,
+        // like the compiler. Missing files resolve next to the includer.
+        std::string resolveInclude(const std::string& includer, const std::string& name, const std::vector<std::string>& includeDirs)
+        {
+            std::error_code error;
+            std::filesystem::path local = std::filesystem::path{ includer }.parent_path() / name;
+            if (std::filesystem::exists(local, error)) {
+                return local.lexically_normal().string();
+            }
+            for (const std::string& directory : includeDirs) {
+                std::filesystem::path candidate = std::filesystem::path{ directory } / name;
+                if (std::filesystem::exists(candidate, error)) {
+                    return candidate.lexically_normal().string();
+                }
+            }
+            return local.lexically_normal().string();
+        }
+
+        const char* getStageName(vk::ShaderStageFlagBits stage)
+        {
+            for (const StageExtension& entry : s_stageExtensions) {
+                if (entry.stage == stage) {
+                    return entry.extension + 1;
+                }
+            }
+            return "vert";
+        }
+
+        std::string quote(const std::string& argument)
+        {
+            return "\"" + argument + "\"";
+        }
+
+        double elapsedMs(std::chrono::high_resolution_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+    }
+
+    bool getShaderStage(const std::string& path, vk::ShaderStageFlagBits& stage, ShaderLanguage& language)
+    {
+        std::filesystem::path file{ path };
+        language = ShaderLanguage::eGlsl;
+        if (file.extension() == ".hlsl") {
+            language = ShaderLanguage::eHlsl;
+            file = file.stem();
+        }
+
+        std::string extension = file.extension().string();
+        for (const StageExtension& entry : s_stageExtensions) {
+            if (extension == entry.extension) {
+                stage = entry.stage;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ShaderCompiler::ShaderCompiler(const ShaderCompilerConfig& config) :
+        m_config(config)
+    { }
+
+    CompiledShader ShaderCompiler::compile(const std::string& path) const
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        CompiledShader shader;
+        shader.path = std::filesystem::path{ path }.lexically_normal().string();
+        if (!getShaderStage(shader.path, shader.stage, shader.language)) {
+            throw std::runtime_error("No shader stage matches the name of " + path);
+        }
+        shader.hash = hashSource(shader.path, shader.stage, shader.language, shader.dependencies);
+
+        char name[64];
+        snprintf(name, sizeof(name), "spirv_v%u_%016llx.spv", kShaderCacheVersion, static_cast<unsigned long long>(shader.hash));
+        std::error_code error;
+        std::filesystem::path cachePath;
+        if (!m_config.cacheDirectory.empty()) {
+            cachePath = std::filesystem::path{ m_config.cacheDirectory } / name;
+            if (readSpirv(cachePath.string(), shader.spirv)) {
+                shader.cacheHit = true;
+                shader.compileMs = elapsedMs(start);
+                return shader;
+            }
+            std::filesystem::create_directories(m_config.cacheDirectory, error);
+        }
+
+        // Compiled under a name of its own and renamed into place, so nobody
+        // reads a partly written cache entry.
+        std::filesystem::path directory = cachePath.empty() ? std::filesystem::temp_directory_path(error) : cachePath.parent_path();
+        std::string unique = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())
+            .append("_").append(std::to_string(m_compileCount.fetch_add(1, std::memory_order_relaxed)));
+        std::filesystem::path outputPath = directory / (std::string{ name } + "." + unique + ".tmp");
+
+        if (runCompiler(shader, outputPath.string(), shader.error) && readSpirv(outputPath.string(), shader.spirv)) {
+            if (!cachePath.empty()) {
+                std::filesystem::rename(outputPath, cachePath, error);
+            }
+        }
+        else if (shader.error.empty()) {
+            shader.error = "The compiler wrote no SPIR-V for " + shader.path;
+        }
+        std::filesystem::remove(outputPath, error);
+
+        shader.compileMs = elapsedMs(start);
+        return shader;
+    }
+
+    uint64_t ShaderCompiler::hashSource(const std::string& path, vk::ShaderStageFlagBits stage, ShaderLanguage language, std::vector<std::string>& dependencies) const
+    {
+        // FNV-1a over the settings, then every file in include order.
+        uint64_t hash = 0xCBF29CE484222325ull;
+        auto add = [&hash](const void* data, size_t bytes) {
+            const uint8_t* input = static_cast<const uint8_t*>(data);
+            for (size_t i = 0; i < bytes; ++i) {
+                hash = (hash ^ input[i]) * 0x100000001B3ull;
+            }
+        };
+        auto addString = [&add](const std::string& value) {
+            uint64_t size = value.size();
+            add(&size, sizeof(size));
+            add(value.data(), value.size());
+        };
+
+        add(&kShaderCacheVersion, sizeof(kShaderCacheVersion));
+        uint32_t stageBits = uint32_t(stage);
+        uint32_t languageValue = uint32_t(language);
+        add(&stageBits, sizeof(stageBits));
+        add(&languageValue, sizeof(languageValue));
+        addString(m_config.compilerPath);
+        for (const std::string& directory : m_config.includeDirs) {
+            addString(directory);
+        }
+
+        std::set<std::string> visited;
+        std::function<void(const std::string&)> visit = [&](const std::string& file) {
+            if (!visited.insert(file).second) {
+                return;
+            }
+            std::string contents;
+            bool found = readFile(file, contents);
+            if (!found && dependencies.empty()) {
+                throw std::runtime_error("Failed to read shader " + file);
+            }
+            // Missing includes are for the compiler to report, but are still
+            // dependencies: creating one has to recompile the shader.
+            dependencies.push_back(file);
+            addString(file);
+            addString(found ? contents : std::string{});
+            for (const std::string& include : findIncludes(contents)) {
+                visit(resolveInclude(file, include, m_config.includeDirs));
+            }
+        };
+        visit(path);
+
+        return hash;
+    }
+
+    bool ShaderCompiler::runCompiler(const CompiledShader& shader, const std::string& outputPath, std::string& error) const
+    {
+        std::string logPath = outputPath + ".log";
+
+        std::string command = quote(m_config.compilerPath);
+        command.append(" -V --target-env vulkan1.2 -S ").append(getStageName(shader.stage));
+        if (shader.language == ShaderLanguage::eHlsl) {
+            command.append(" -D -e main");
+        }
+        for (const std::string& directory : m_config.includeDirs) {
+            command.append(" -I").append(quote(directory));
+        }
+        command.append(" -o ").append(quote(outputPath)).append(" ").append(quote(shader.path));
+        command.append(" > ").append(quote(logPath)).append(" 2>&1");
+#ifdef _WIN32
+        // cmd.exe drops the outer quotes of a command that starts with one.
+        command = "\"" + command + "\"";
+#endif
+
+        int status = std::system(command.c_str());
+
+        std::string log;
+        readFile(logPath, log);
+        std::error_code removeError;
+        std::filesystem::remove(logPath, removeError);
+
+        if (status != 0) {
+            error = log.empty() ? "Failed to run " + m_config.compilerPath : log;
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,356 @@
+#include "shader_library.h"
+#include "pipeline_cache.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        // How often the watch thread checks whether it should stop.
+        const uint32_t kWatchTimeoutMs = 100;
+
+        std::string getAbsolutePath(const std::filesystem::path& path)
+        {
+            std::error_code error;
+            std::filesystem::path absolute = std::filesystem::absolute(path, error);
+            return (error ? path : absolute).lexically_normal().string();
+        }
+
+        // Include directories as absolute paths, so dependencies match what
+        // the watcher reports, followed by the source directory.
+        ShaderCompilerConfig getCompilerConfig(const ShaderLibraryConfig& config)
+        {
+            ShaderCompilerConfig compiler = config.compiler;
+            for (std::string& directory : compiler.includeDirs) {
+                directory = getAbsolutePath(directory);
+            }
+            compiler.includeDirs.push_back(getAbsolutePath(config.sourceDirectory));
+            return compiler;
+        }
+
+        double elapsedMs(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    ShaderLibrary::ShaderLibrary(Renderer& renderer, const ShaderLibraryConfig& config) :
+        m_pipelines(renderer.getPipelines()),
+        m_config(config),
+        m_compiler(getCompilerConfig(config))
+    {
+        if (!m_config.hotReload) {
+            return;
+        }
+        m_watcher = std::make_unique<FileWatcher>();
+        for (const std::string& directory : m_compiler.getConfig().includeDirs) {
+            if (m_watchedDirectories.insert(directory).second) {
+                m_watcher->addDirectory(directory);
+            }
+        }
+        m_watchThread = std::thread{ &ShaderLibrary::watchLoop, this };
+    }
+
+    ShaderLibrary::~ShaderLibrary()
+    {
+        m_running = false;
+        if (m_watchThread.joinable()) {
+            m_watchThread.join();
+        }
+    }
+
+    ShaderPipelineHandle ShaderLibrary::createGraphicsPipeline(const GraphicsShaderDesc& desc)
+    {
+        if (desc.stages.empty() || !desc.build) {
+            throw std::runtime_error("Graphics shader pipelines need stages and a build function");
+        }
+
+        auto entry = std::make_unique<Entry>();
+        for (const std::string& stage : desc.stages) {
+            entry->paths.push_back(getAbsolutePath(std::filesystem::path{ m_config.sourceDirectory } / stage));
+        }
+        entry->externalSets = desc.externalSets;
+        entry->build = desc.build;
+        buildPipeline(*entry, entry->current, nullptr);
+        return addEntry(std::move(entry));
+    }
+
+    ShaderPipelineHandle ShaderLibrary::createComputePipeline(const ComputeShaderDesc& desc)
+    {
+        auto entry = std::make_unique<Entry>();
+        entry->paths.push_back(getAbsolutePath(std::filesystem::path{ m_config.sourceDirectory } / desc.path));
+        entry->externalSets = desc.externalSets;
+        buildPipeline(*entry, entry->current, nullptr);
+        return addEntry(std::move(entry));
+    }
+
+    void ShaderLibrary::update()
+    {
+        std::vector<CompileResult> results;
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            results.swap(m_results);
+        }
+
+        for (CompileResult& result : results) {
+            recordCompile(result.shader);
+            if (!result.shader.isValid()) {
+                std::cerr << "Failed to compile " << result.shader.path << ", keeping the previous version:\n" << result.shader.error << std::endl;
+                continue;
+            }
+
+            const std::string path = result.shader.path;
+            m_shaders[path] = std::move(result.shader);
+            for (std::unique_ptr<Entry>& entry : m_entries) {
+                if (std::find(entry->paths.begin(), entry->paths.end(), path) == entry->paths.end()) {
+                    continue;
+                }
+                if (!entry->dirty) {
+                    entry->dirty = true;
+                    entry->changeTime = result.changeTime;
+                }
+            }
+        }
+
+        for (std::unique_ptr<Entry>& entry : m_entries) {
+            if (entry->pending && entry->pending->isReady()) {
+                std::lock_guard<std::mutex> lock{ m_mutex };
+                if (entry->pending->isFailed()) {
+                    std::cerr << "Failed to rebuild the pipeline of " << entry->paths.front() << ", keeping the previous version" << std::endl;
+                    ++m_stats.failures;
+                }
+                else {
+                    entry->next.pipeline = entry->pending->get();
+                    entry->next.version = entry->current.version + 1;
+                    entry->current = std::move(entry->next);
+                    double reloadMs = elapsedMs(entry->nextChangeTime);
+                    ++m_stats.reloads;
+                    m_stats.lastReloadMs = reloadMs;
+                    m_stats.maxReloadMs = std::max(m_stats.maxReloadMs, reloadMs);
+                }
+                entry->pending.reset();
+                entry->next = ShaderPipeline{};
+            }
+
+            // Changes that arrive during a rebuild wait for it, so swaps keep
+            // their order.
+            if (entry->dirty && !entry->pending) {
+                entry->dirty = false;
+                entry->nextChangeTime = entry->changeTime;
+                try {
+                    buildPipeline(*entry, entry->next, &entry->pending);
+                }
+                catch (const std::exception& e) {
+                    std::cerr << "Failed to rebuild the pipeline of " << entry->paths.front() << ", keeping the previous version:\n" << e.what() << std::endl;
+                    std::lock_guard<std::mutex> lock{ m_mutex };
+                    ++m_stats.failures;
+                    entry->pending.reset();
+                    entry->next = ShaderPipeline{};
+                }
+            }
+        }
+    }
+
+    const ShaderPipeline& ShaderLibrary::get(ShaderPipelineHandle handle) const
+    {
+        return m_entries[handle.index]->current;
+    }
+
+    bool ShaderLibrary::isReloading() const
+    {
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            if (m_compiling || !m_results.empty()) {
+                return true;
+            }
+        }
+        return std::any_of(m_entries.begin(), m_entries.end(), [](const std::unique_ptr<Entry>& entry) {
+            return entry->dirty || entry->pending;
+        });
+    }
+
+    ShaderLibraryStats ShaderLibrary::getStats() const
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        return m_stats;
+    }
+
+    ShaderPipelineHandle ShaderLibrary::addEntry(std::unique_ptr<Entry> entry)
+    {
+        ShaderPipelineHandle handle{ uint32_t(m_entries.size()) };
+        m_entries.push_back(std::move(entry));
+
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        m_stats.pipelines = uint32_t(m_entries.size());
+        return handle;
+    }
+
+    const CompiledShader& ShaderLibrary::getCompiled(const std::string& path)
+    {
+        auto it = m_shaders.find(path);
+        if (it != m_shaders.end()) {
+            return it->second;
+        }
+
+        CompiledShader shader = m_compiler.compile(path);
+        recordCompile(shader);
+        if (!shader.isValid()) {
+            throw std::runtime_error("Failed to compile " + path + ":\n" + shader.error);
+        }
+        return m_shaders.emplace(path, std::move(shader)).first->second;
+    }
+
+    void ShaderLibrary::recordCompile(const CompiledShader& shader)
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        ++m_stats.compiles;
+        m_stats.cacheHits += shader.cacheHit ? 1 : 0;
+        m_stats.failures += shader.isValid() ? 0 : 1;
+        m_stats.compileMs += shader.compileMs;
+        // A source that couldn't be read keeps its previous dependencies, so
+        // restoring it still reloads.
+        if (!shader.dependencies.empty()) {
+            m_dependencies[shader.path] = shader.dependencies;
+            m_dependenciesChanged = true;
+        }
+    }
+
+    void ShaderLibrary::buildPipeline(const Entry& entry, ShaderPipeline& pipeline, std::shared_ptr<const AsyncPipeline>* pending)
+    {
+        ShaderReflection reflection{};
+        std::vector<vk::PipelineShaderStageCreateInfo> stages;
+        std::vector<std::string> entryPoints;
+        entryPoints.reserve(entry.paths.size());
+        for (const std::string& path : entry.paths) {
+            const CompiledShader& shader = getCompiled(path);
+            ShaderReflection stageReflection = reflectSpirv(shader.spirv.data(), shader.spirv.size() * sizeof(uint32_t));
+            mergeReflection(reflection, stageReflection);
+            entryPoints.push_back(stageReflection.entryPoint);
+
+            vk::ShaderModule module = m_pipelines.getShaderModule(shader.spirv.data(), shader.spirv.size() * sizeof(uint32_t));
+            stages.push_back(vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, shader.stage, module, entryPoints.back().c_str() });
+        }
+
+        ReflectedLayout layout = createReflectedLayout(m_pipelines, reflection, entry.externalSets);
+        pipeline.layout = layout.layout;
+        pipeline.setLayouts = std::move(layout.setLayouts);
+        pipeline.reflection = std::move(reflection);
+
+        if (!entry.build) {
+            if (stages.size() != 1 || stages[0].stage != vk::ShaderStageFlagBits::eCompute) {
+                throw std::runtime_error(entry.paths.front() + " is not a compute shader");
+            }
+            vk::ComputePipelineCreateInfo pipelineInfo{ vk::PipelineCreateFlags{}, stages[0], pipeline.layout };
+            if (pending != nullptr) {
+                *pending = m_pipelines.compileComputePipelineAsync(pipelineInfo);
+            }
+            else {
+                pipeline.pipeline = m_pipelines.getComputePipeline(pipelineInfo);
+            }
+            return;
+        }
+
+        vk::GraphicsPipelineCreateInfo shaderInfo{};
+        shaderInfo.stageCount = uint32_t(stages.size());
+        shaderInfo.pStages = stages.data();
+        shaderInfo.layout = pipeline.layout;
+        entry.build(shaderInfo, [&](const vk::GraphicsPipelineCreateInfo& pipelineInfo) {
+            if (pending != nullptr) {
+                *pending = m_pipelines.compileGraphicsPipelineAsync(pipelineInfo);
+            }
+            else {
+                pipeline.pipeline = m_pipelines.getGraphicsPipeline(pipelineInfo);
+            }
+        });
+    }
+
+    void ShaderLibrary::watchDependencyDirectories()
+    {
+        std::set<std::string> directories;
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            if (!m_dependenciesChanged) {
+                return;
+            }
+            m_dependenciesChanged = false;
+            for (const auto& [source, dependencies] : m_dependencies) {
+                for (const std::string& dependency : dependencies) {
+                    directories.insert(std::filesystem::path{ dependency }.parent_path().string());
+                }
+            }
+        }
+
+        for (const std::string& directory : directories) {
+            if (!m_watchedDirectories.insert(directory).second) {
+                continue;
+            }
+            try {
+                m_watcher->addDirectory(directory);
+            }
+            catch (const std::exception&) {
+                // The directory of an include that doesn't exist yet. Creating
+                // it won't be noticed, but saving the includer will.
+            }
+        }
+    }
+
+    void ShaderLibrary::watchLoop()
+    {
+        while (m_running) {
+            watchDependencyDirectories();
+            std::vector<std::string> changed = m_watcher->wait(kWatchTimeoutMs);
+            if (changed.empty()) {
+                continue;
+            }
+            Clock::time_point changeTime = Clock::now();
+
+            // Saving can take several writes and renames; compile once they
+            // have settled.
+            for (std::vector<std::string> more; !(more = m_watcher->wait(m_config.debounceMs)).empty();) {
+                changed.insert(changed.end(), more.begin(), more.end());
+            }
+            std::sort(changed.begin(), changed.end());
+            changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+            std::vector<std::string> sources;
+            {
+                std::lock_guard<std::mutex> lock{ m_mutex };
+                for (const auto& [source, dependencies] : m_dependencies) {
+                    bool affected = std::any_of(dependencies.begin(), dependencies.end(), [&](const std::string& dependency) {
+                        return std::binary_search(changed.begin(), changed.end(), dependency);
+                    });
+                    if (affected) {
+                        sources.push_back(source);
+                    }
+                }
+                m_compiling = !sources.empty();
+            }
+
+            std::vector<CompileResult> results;
+            for (const std::string& source : sources) {
+                CompileResult result{};
+                result.changeTime = changeTime;
+                try {
+                    result.shader = m_compiler.compile(source);
+                }
+                catch (const std::exception& e) {
+                    // E.g. the source was deleted, or caught mid-rename.
+                    result.shader.path = source;
+                    result.shader.error = e.what();
+                }
+                results.push_back(std::move(result));
+            }
+
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            for (CompileResult& result : results) {
+                m_results.push_back(std::move(result));
+            }
+            m_compiling = false;
+        }
+    }
+}
@@ -0,0 +1,452 @@
+#include "shader_reflection.h"
+#include "pipeline_cache.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace bvr
+{
+    namespace
+    {
+        const uint32_t kSpirvMagic = 0x07230203;
+        const size_t kHeaderWords = 5;
+
+        // The few opcodes, decorations and enumerants reflection needs, from
+        // the SPIR-V specification.
+        enum Op : uint32_t
+        {
+            eOpEntryPoint = 15,
+            eOpTypeBool = 20,
+            eOpTypeInt = 21,
+            eOpTypeFloat = 22,
+            eOpTypeVector = 23,
+            eOpTypeMatrix = 24,
+            eOpTypeImage = 25,
+            eOpTypeSampler = 26,
+            eOpTypeSampledImage = 27,
+            eOpTypeArray = 28,
+            eOpTypeRuntimeArray = 29,
+            eOpTypeStruct = 30,
+            eOpTypePointer = 32,
+            eOpConstant = 43,
+            eOpSpecConstant = 50,
+            eOpVariable = 59,
+            eOpDecorate = 71,
+            eOpMemberDecorate = 72,
+        };
+
+        enum Decoration : uint32_t
+        {
+            eDecorationBufferBlock = 3,
+            eDecorationArrayStride = 6,
+            eDecorationMatrixStride = 7,
+            eDecorationBinding = 33,
+            eDecorationDescriptorSet = 34,
+            eDecorationOffset = 35,
+        };
+
+        enum StorageClass : uint32_t
+        {
+            eStorageUniformConstant = 0,
+            eStorageUniform = 2,
+            eStoragePushConstant = 9,
+            eStorageStorageBuffer = 12,
+        };
+
+        const uint32_t kDimBuffer = 5;
+        const uint32_t kDimSubpassData = 6;
+        // OpTypeImage's Sampled operand for images used without a sampler.
+        const uint32_t kImageStorage = 2;
+
+        struct Instruction
+        {
+            uint32_t op = 0;
+            const uint32_t* words = nullptr;
+            uint32_t wordCount = 0;
+
+            uint32_t operand(uint32_t index) const
+            {
+                if (index + 1 >= wordCount) {
+                    throw std::runtime_error("Truncated SPIR-V instruction");
+                }
+                return words[index + 1];
+            }
+        };
+
+        struct Decorations
+        {
+            uint32_t set = UINT32_MAX;
+            uint32_t binding = UINT32_MAX;
+            uint32_t arrayStride = 0;
+            bool bufferBlock = false;
+        };
+
+        struct MemberDecorations
+        {
+            uint32_t offset = 0;
+            uint32_t matrixStride = 0;
+        };
+
+        class SpirvModule
+        {
+        public:
+            SpirvModule(const uint32_t* code, size_t size)
+            {
+                size_t wordCount = size / sizeof(uint32_t);
+                if (code == nullptr || size % sizeof(uint32_t) != 0 || wordCount < kHeaderWords || code[0] != kSpirvMagic) {
+                    throw std::runtime_error("Not a SPIR-V module");
+                }
+
+                for (size_t i = kHeaderWords; i < wordCount;) {
+                    Instruction instruction{ code[i] & 0xFFFF, code + i, code[i] >> 16 };
+                    if (instruction.wordCount == 0 || i + instruction.wordCount > wordCount) {
+                        throw std::runtime_error("Malformed SPIR-V instruction stream");
+                    }
+                    record(instruction);
+                    i += instruction.wordCount;
+                }
+            }
+
+            const Instruction& getDefinition(uint32_t id) const
+            {
+                auto it = m_definitions.find(id);
+                if (it == m_definitions.end()) {
+                    throw std::runtime_error("SPIR-V references an undefined id");
+                }
+                return it->second;
+            }
+
+            Decorations getDecorations(uint32_t id) const
+            {
+                auto it = m_decorations.find(id);
+                return it != m_decorations.end() ? it->second : Decorations{};
+            }
+
+            MemberDecorations getMemberDecorations(uint32_t structId, uint32_t member) const
+            {
+                auto it = m_memberDecorations.find(memberKey(structId, member));
+                return it != m_memberDecorations.end() ? it->second : MemberDecorations{};
+            }
+
+            uint32_t getConstant(uint32_t id) const
+            {
+                const Instruction& constant = getDefinition(id);
+                if (constant.op != eOpConstant && constant.op != eOpSpecConstant) {
+                    throw std::runtime_error("SPIR-V array length is not a constant");
+                }
+                return constant.operand(2);
+            }
+
+            // Size in bytes of a type in a push constant block.
+            uint32_t getSize(uint32_t typeId, uint32_t matrixStride) const
+            {
+                const Instruction& type = getDefinition(typeId);
+                switch (type.op) {
+                case eOpTypeBool:
+                    return 4;
+                case eOpTypeInt:
+                case eOpTypeFloat:
+                    return type.operand(1) / 8;
+                case eOpTypeVector:
+                    return getSize(type.operand(1), 0) * type.operand(2);
+                case eOpTypeMatrix:
+                    return (matrixStride != 0 ? matrixStride : getSize(type.operand(1), 0)) * type.operand(2);
+                case eOpTypeArray: {
+                    uint32_t stride = getDecorations(typeId).arrayStride;
+                    if (stride == 0) {
+                        stride = getSize(type.operand(1), matrixStride);
+                    }
+                    return stride * getConstant(type.operand(2));
+                }
+                case eOpTypeStruct: {
+                    uint32_t size = 0;
+                    for (uint32_t member = 0; member + 2 < type.wordCount; ++member) {
+                        MemberDecorations decorations = getMemberDecorations(typeId, member);
+                        size = std::max(size, decorations.offset + getSize(type.operand(member + 1), decorations.matrixStride));
+                    }
+                    return size;
+                }
+                default:
+                    throw std::runtime_error("Unsupported type in a SPIR-V push constant block");
+                }
+            }
+
+            const std::vector<Instruction>& getVariables() const { return m_variables; }
+            const Instruction& getEntryPoint() const
+            {
+                if (m_entryPoints.empty()) {
+                    throw std::runtime_error("SPIR-V module has no entry point");
+                }
+                return m_entryPoints.front();
+            }
+
+        private:
+            static uint64_t memberKey(uint32_t structId, uint32_t member)
+            {
+                return (uint64_t(structId) << 32) | member;
+            }
+
+            void record(const Instruction& instruction)
+            {
+                switch (instruction.op) {
+                case eOpEntryPoint:
+                    m_entryPoints.push_back(instruction);
+                    break;
+                case eOpTypeBool:
+                case eOpTypeInt:
+                case eOpTypeFloat:
+                case eOpTypeVector:
+                case eOpTypeMatrix:
+                case eOpTypeImage:
+                case eOpTypeSampler:
+                case eOpTypeSampledImage:
+                case eOpTypeArray:
+                case eOpTypeRuntimeArray:
+                case eOpTypeStruct:
+                case eOpTypePointer:
+                    m_definitions[instruction.operand(0)] = instruction;
+                    break;
+                case eOpConstant:
+                case eOpSpecConstant:
+                    m_definitions[instruction.operand(1)] = instruction;
+                    break;
+                case eOpVariable:
+                    m_variables.push_back(instruction);
+                    break;
+                case eOpDecorate: {
+                    Decorations& decorations = m_decorations[instruction.operand(0)];
+                    switch (instruction.operand(1)) {
+                    case eDecorationDescriptorSet:
+                        decorations.set = instruction.operand(2);
+                        break;
+                    case eDecorationBinding:
+                        decorations.binding = instruction.operand(2);
+                        break;
+                    case eDecorationArrayStride:
+                        decorations.arrayStride = instruction.operand(2);
+                        break;
+                    case eDecorationBufferBlock:
+                        decorations.bufferBlock = true;
+                        break;
+                    }
+                    break;
+                }
+                case eOpMemberDecorate: {
+                    MemberDecorations& decorations = m_memberDecorations[memberKey(instruction.operand(0), instruction.operand(1))];
+                    if (instruction.operand(2) == eDecorationOffset) {
+                        decorations.offset = instruction.operand(3);
+                    }
+                    else if (instruction.operand(2) == eDecorationMatrixStride) {
+                        decorations.matrixStride = instruction.operand(3);
+                    }
+                    break;
+                }
+                }
+            }
+
+            std::vector<Instruction> m_entryPoints;
+            std::vector<Instruction> m_variables;
+            std::unordered_map<uint32_t, Instruction> m_definitions;
+            std::unordered_map<uint32_t, Decorations> m_decorations;
+            std::unordered_map<uint64_t, MemberDecorations> m_memberDecorations;
+        };
+
+        vk::ShaderStageFlagBits getStage(uint32_t executionModel)
+        {
+            switch (executionModel) {
+            case 0: return vk::ShaderStageFlagBits::eVertex;
+            case 1: return vk::ShaderStageFlagBits::eTessellationControl;
+            case 2: return vk::ShaderStageFlagBits::eTessellationEvaluation;
+            case 3: return vk::ShaderStageFlagBits::eGeometry;
+            case 4: return vk::ShaderStageFlagBits::eFragment;
+            case 5: return vk::ShaderStageFlagBits::eCompute;
+            }
+            throw std::runtime_error("Unsupported SPIR-V execution model");
+        }
+
+        std::string getLiteralString(const Instruction& instruction, uint32_t firstOperand)
+        {
+            std::string value;
+            for (uint32_t i = firstOperand + 1; i < instruction.wordCount; ++i) {
+                for (uint32_t byte = 0; byte < 4; ++byte) {
+                    char c = char((instruction.words[i] >> (byte * 8)) & 0xFF);
+                    if (c == '\0') {
+                        return value;
+                    }
+                    value.push_back(c);
+                }
+            }
+            return value;
+        }
+
+        vk::DescriptorType getImageDescriptorType(const Instruction& image)
+        {
+            uint32_t dim = image.operand(2);
+            bool storage = image.operand(6) == kImageStorage;
+            if (dim == kDimSubpassData) {
+                return vk::DescriptorType::eInputAttachment;
+            }
+            if (dim == kDimBuffer) {
+                return storage ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+            }
+            return storage ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+        }
+
+        // Fills the type and count of a descriptor variable whose pointer
+        // points to `typeId`.
+        void describeBinding(const SpirvModule& module, uint32_t storageClass, uint32_t typeId, ReflectedBinding& binding)
+        {
+            binding.count = 1;
+            const Instruction* type = &module.getDefinition(typeId);
+            while (type->op == eOpTypeArray || type->op == eOpTypeRuntimeArray) {
+                binding.count = type->op == eOpTypeArray ? binding.count * module.getConstant(type->operand(2)) : 0;
+                typeId = type->operand(1);
+                type = &module.getDefinition(typeId);
+            }
+
+            switch (storageClass) {
+            case eStorageUniform:
+                binding.type = module.getDecorations(typeId).bufferBlock ? vk::DescriptorType::eStorageBuffer : vk::DescriptorType::eUniformBuffer;
+                return;
+            case eStorageStorageBuffer:
+                binding.type = vk::DescriptorType::eStorageBuffer;
+                return;
+            }
+
+            switch (type->op) {
+            case eOpTypeSampler:
+                binding.type = vk::DescriptorType::eSampler;
+                return;
+            case eOpTypeImage:
+                binding.type = getImageDescriptorType(*type);
+                return;
+            case eOpTypeSampledImage: {
+                const Instruction& image = module.getDefinition(type->operand(1));
+                binding.type = image.operand(2) == kDimBuffer ? vk::DescriptorType::eUniformTexelBuffer : vk::DescriptorType::eCombinedImageSampler;
+                return;
+            }
+            }
+            throw std::runtime_error("Unsupported SPIR-V descriptor type");
+        }
+    }
+
+    ShaderReflection reflectSpirv(const uint32_t* code, size_t size)
+    {
+        SpirvModule module{ code, size };
+
+        ShaderReflection reflection{};
+        const Instruction& entryPoint = module.getEntryPoint();
+        vk::ShaderStageFlagBits stage = getStage(entryPoint.operand(0));
+        reflection.stages = stage;
+        reflection.entryPoint = getLiteralString(entryPoint, 2);
+
+        for (const Instruction& variable : module.getVariables()) {
+            uint32_t storageClass = variable.operand(2);
+            if (storageClass != eStorageUniformConstant && storageClass != eStorageUniform &&
+                storageClass != eStorageStorageBuffer && storageClass != eStoragePushConstant) {
+                continue;
+            }
+
+            const Instruction& pointer = module.getDefinition(variable.operand(0));
+            if (pointer.op != eOpTypePointer) {
+                throw std::runtime_error("SPIR-V variable without a pointer type");
+            }
+            uint32_t typeId = pointer.operand(2);
+
+            if (storageClass == eStoragePushConstant) {
+                reflection.pushConstants.stageFlags = stage;
+                reflection.pushConstants.size = std::max(reflection.pushConstants.size, module.getSize(typeId, 0));
+                continue;
+            }
+
+            Decorations decorations = module.getDecorations(variable.operand(1));
+            if (decorations.binding == UINT32_MAX) {
+                continue;
+            }
+            ReflectedBinding binding{};
+            binding.set = decorations.set != UINT32_MAX ? decorations.set : 0;
+            binding.binding = decorations.binding;
+            binding.stages = stage;
+            describeBinding(module, storageClass, typeId, binding);
+            reflection.bindings.push_back(binding);
+        }
+
+        std::sort(reflection.bindings.begin(), reflection.bindings.end(), [](const ReflectedBinding& a, const ReflectedBinding& b) {
+            return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+        });
+        return reflection;
+    }
+
+    void mergeReflection(ShaderReflection& reflection, const ShaderReflection& stage)
+    {
+        reflection.stages |= stage.stages;
+        if (reflection.entryPoint.empty()) {
+            reflection.entryPoint = stage.entryPoint;
+        }
+
+        for (const ReflectedBinding& binding : stage.bindings) {
+            auto it = std::find_if(reflection.bindings.begin(), reflection.bindings.end(), [&](const ReflectedBinding& existing) {
+                return existing.set == binding.set && existing.binding == binding.binding;
+            });
+            if (it == reflection.bindings.end()) {
+                reflection.bindings.push_back(binding);
+                continue;
+            }
+            if (it->type != binding.type || it->count != binding.count) {
+                throw std::runtime_error("Shader stages disagree about set " + std::to_string(binding.set) +
+                    " binding " + std::to_string(binding.binding));
+            }
+            it->stages |= binding.stages;
+        }
+        std::sort(reflection.bindings.begin(), reflection.bindings.end(), [](const ReflectedBinding& a, const ReflectedBinding& b) {
+            return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+        });
+
+        if (stage.pushConstants.size > 0) {
+            reflection.pushConstants.stageFlags |= stage.pushConstants.stageFlags;
+            reflection.pushConstants.size = std::max(reflection.pushConstants.size, stage.pushConstants.size);
+        }
+    }
+
+    ReflectedLayout createReflectedLayout(PipelineCache& pipelines, const ShaderReflection& reflection, const std::vector<vk::DescriptorSetLayout>& externalSets)
+    {
+        uint32_t setCount = uint32_t(externalSets.size());
+        for (const ReflectedBinding& binding : reflection.bindings) {
+            setCount = std::max(setCount, binding.set + 1);
+        }
+
+        ReflectedLayout layout{};
+        layout.setLayouts.resize(setCount);
+        for (uint32_t set = 0; set < setCount; ++set) {
+            if (set < externalSets.size() && externalSets[set]) {
+                layout.setLayouts[set] = externalSets[set];
+                continue;
+            }
+
+            std::vector<vk::DescriptorSetLayoutBinding> bindings;
+            for (const ReflectedBinding& binding : reflection.bindings) {
+                if (binding.set != set) {
+                    continue;
+                }
+                if (binding.count == 0) {
+                    throw std::runtime_error("Runtime-sized array at set " + std::to_string(set) +
+                        " binding " + std::to_string(binding.binding) + " needs an external set layout");
+                }
+                bindings.push_back(vk::DescriptorSetLayoutBinding{ binding.binding, binding.type, binding.count, binding.stages });
+            }
+            layout.setLayouts[set] = pipelines.getDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{
+                vk::DescriptorSetLayoutCreateFlags{},
+                uint32_t(bindings.size()), bindings.data(),
+            });
+        }
+
+        bool hasPushConstants = reflection.pushConstants.size > 0;
+        layout.layout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+            vk::PipelineLayoutCreateFlags{},
+            uint32_t(layout.setLayouts.size()), layout.setLayouts.data(),
+            hasPushConstants ? 1u : 0u, hasPushConstants ? &reflection.pushConstants : nullptr,
+        });
+        return layout;
+    }
+}
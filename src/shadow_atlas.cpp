@@ -0,0 +1,955 @@
+#include "shadow_atlas.h"
+#include "renderer.h"
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace bvr
+{
+    namespace
+    {
+        const vk::Format kAtlasFormat = vk::Format::eD32Sfloat;
+
+        // Cube map face conventions, in the order of a point light's views.
+        const glm::vec3 kFaceDirections[6] = {
+            { 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f },
+            { 0.0f, 1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+            { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f },
+        };
+        const glm::vec3 kFaceUps[6] = {
+            { 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+            { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f },
+            { 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+        };
+
+        bool isPowerOfTwo(uint32_t value)
+        {
+            return value != 0 && (value & (value - 1)) == 0;
+        }
+
+        uint32_t roundUpToPowerOfTwo(float value, uint32_t maxSize)
+        {
+            uint32_t size = 1;
+            while (float(size) < value && size < maxSize) {
+                size *= 2;
+            }
+            return size;
+        }
+
+        bool sphereInFrustum(const CullView& view, const glm::vec4& sphere)
+        {
+            for (const glm::vec4& plane : view.planes) {
+                if (glm::dot(glm::vec3(plane), glm::vec3(sphere)) + plane.w < -sphere.w) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // What the shadow depends on, unlike the color and intensity.
+        bool sameShadow(const Light& a, const Light& b)
+        {
+            return a.positionRange == b.positionRange && a.directionCosAngle == b.directionCosAngle;
+        }
+
+        vk::DescriptorSet allocateSet(vk::Device device, vk::DescriptorPool pool, vk::DescriptorSetLayout layout)
+        {
+            return device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{ pool, 1, &layout })[0];
+        }
+    }
+
+    ShadowTileAllocator::ShadowTileAllocator(uint32_t atlasSize, uint32_t minTileSize) :
+        m_atlasSize(atlasSize)
+    {
+        for (uint32_t size = atlasSize; size >= minTileSize && size > 0; size /= 2) {
+            ++m_levelCount;
+        }
+        m_freeTiles.resize(m_levelCount);
+        m_freeTiles[0].push_back(glm::uvec2(0, 0));
+    }
+
+    uint32_t ShadowTileAllocator::getLevel(uint32_t size) const
+    {
+        for (uint32_t level = 0; level < m_levelCount; ++level) {
+            if (m_atlasSize >> level == size) {
+                return level;
+            }
+        }
+        std::string errorString{ "Invalid shadow tile size " };
+        throw std::runtime_error(errorString.append(std::to_string(size)));
+    }
+
+    ShadowTile ShadowTileAllocator::allocate(uint32_t size)
+    {
+        uint32_t level = getLevel(size);
+        uint32_t source = level;
+        while (m_freeTiles[source].empty()) {
+            if (source == 0) {
+                return ShadowTile{};
+            }
+            --source;
+        }
+
+        glm::uvec2 origin = m_freeTiles[source].back();
+        m_freeTiles[source].pop_back();
+        // Keeps the first quadrant of every split and frees the other three.
+        for (; source < level; ++source) {
+            uint32_t half = m_atlasSize >> (source + 1);
+            std::vector<glm::uvec2>& children = m_freeTiles[source + 1];
+            children.push_back(origin + glm::uvec2(half, 0));
+            children.push_back(origin + glm::uvec2(0, half));
+            children.push_back(origin + glm::uvec2(half, half));
+        }
+
+        m_allocatedArea += uint64_t(size) * size;
+        return ShadowTile{ origin.x, origin.y, size };
+    }
+
+    void ShadowTileAllocator::free(const ShadowTile& tile)
+    {
+        if (!tile.isValid()) {
+            return;
+        }
+        m_allocatedArea -= uint64_t(tile.size) * tile.size;
+
+        uint32_t level = getLevel(tile.size);
+        glm::uvec2 origin{ tile.x, tile.y };
+        while (level > 0) {
+            uint32_t size = m_atlasSize >> level;
+            glm::uvec2 parent{ origin.x & ~(2 * size - 1), origin.y & ~(2 * size - 1) };
+            std::vector<glm::uvec2>& freeTiles = m_freeTiles[level];
+
+            std::array<size_t, 3> siblings{};
+            uint32_t found = 0;
+            for (size_t i = 0; i < freeTiles.size() && found < 3; ++i) {
+                glm::uvec2 offset = freeTiles[i] - parent;
+                if (freeTiles[i] != origin && freeTiles[i].x >= parent.x && freeTiles[i].y >= parent.y && offset.x <= size && offset.y <= size) {
+                    siblings[found++] = i;
+                }
+            }
+            if (found < 3) {
+                break;
+            }
+
+            // Back to front, so the remaining indices stay valid.
+            std::sort(siblings.begin(), siblings.end(), std::greater<size_t>());
+            for (size_t sibling : siblings) {
+                freeTiles[sibling] = freeTiles.back();
+                freeTiles.pop_back();
+            }
+            origin = parent;
+            --level;
+        }
+        m_freeTiles[level].push_back(origin);
+    }
+
+    ShadowAtlas::ShadowAtlas(Renderer& renderer, const ShadowConfig& config) :
+        m_renderer(renderer),
+        m_config(config),
+        m_allocator(config.atlasSize, config.minTileSize),
+        m_ready(std::make_shared<std::atomic<bool>>(false)),
+        m_casterBounds(std::vector<glm::vec4>{})
+    {
+        if (!isPowerOfTwo(config.atlasSize) || !isPowerOfTwo(config.minTileSize) || !isPowerOfTwo(config.maxTileSize) ||
+            config.minTileSize > config.maxTileSize || config.maxTileSize > config.atlasSize ||
+            (config.cascadeCount > 0 && (!isPowerOfTwo(config.cascadeSize) || config.cascadeSize < config.minTileSize || config.cascadeSize > config.atlasSize))) {
+            throw std::runtime_error("Invalid shadow atlas configuration");
+        }
+
+        // Cascades keep their tiles for the atlas's lifetime.
+        m_cascades.resize(config.cascadeCount);
+        m_cascadeSplits.resize(config.cascadeCount, 0.0f);
+        for (Cascade& cascade : m_cascades) {
+            cascade.tile = m_allocator.allocate(config.cascadeSize);
+            if (!cascade.tile.isValid()) {
+                throw std::runtime_error("Shadow atlas too small for its cascades");
+            }
+        }
+
+        createBuffers();
+        createPipeline();
+    }
+
+    ShadowAtlas::~ShadowAtlas()
+    {
+        m_renderer.getUploads().wait(m_uploadValue);
+
+        GpuMemory& memory = m_renderer.getMemory();
+        vk::Device device = m_renderer.getDevice();
+        std::vector<Buffer> buffers{ m_transforms, m_vertices, m_indices };
+        buffers.insert(buffers.end(), m_viewBuffers.begin(), m_viewBuffers.end());
+        Image atlas = m_atlas;
+        vk::ImageView atlasView = m_atlasView;
+        vk::RenderPass renderPass = m_renderPass;
+
+        // The pipeline and its layouts belong to the pipeline cache, which drops
+        // the pipeline along with the render pass.
+        PipelineCache& pipelines = m_renderer.getPipelines();
+        RenderGraph& graph = m_renderer.getRenderGraph();
+        m_renderer.deferRelease([&memory, &pipelines, &graph, device, buffers, atlas, atlasView, renderPass]() mutable {
+            for (Buffer& buffer : buffers) {
+                memory.destroyBuffer(buffer);
+            }
+            graph.releaseImportedView(atlasView);
+            device.destroyImageView(atlasView);
+            memory.destroyImage(atlas);
+            pipelines.releaseRenderPass(renderPass);
+            device.destroyRenderPass(renderPass);
+        });
+    }
+
+    void ShadowAtlas::createBuffers()
+    {
+        GpuMemory& memory = m_renderer.getMemory();
+        UploadQueue& uploads = m_renderer.getUploads();
+
+        m_atlas = memory.createImage(vk::ImageCreateInfo{
+            vk::ImageCreateFlags{},
+            vk::ImageType::e2D,
+            kAtlasFormat,
+            vk::Extent3D{ m_config.atlasSize, m_config.atlasSize, 1 },
+            1,
+            1,
+            vk::SampleCountFlagBits::e1,
+            vk::ImageTiling::eOptimal,
+            vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled,
+        });
+        m_atlasView = m_renderer.getDevice().createImageView(vk::ImageViewCreateInfo{
+            vk::ImageViewCreateFlags{},
+            m_atlas.image,
+            vk::ImageViewType::e2D,
+            kAtlasFormat,
+            vk::ComponentMapping{},
+            vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1 },
+        });
+
+        // Written by the "shadow_casters" pass as casters change.
+        m_transforms = memory.createBuffer(vk::BufferCreateInfo{
+            vk::BufferCreateFlags{},
+            vk::DeviceSize(m_config.maxCasters) * sizeof(glm::mat4),
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        }, MemoryUsage::eGpuOnly);
+
+        vk::DeviceSize viewBytes = vk::DeviceSize(m_config.cascadeCount + 6 * m_config.maxLights) * sizeof(ShadowViewData);
+        for (uint32_t i = 0; i < m_renderer.getFrameCount(); ++i) {
+            m_viewBuffers.push_back(memory.createBuffer(vk::BufferCreateInfo{
+                vk::BufferCreateFlags{},
+                std::max<vk::DeviceSize>(viewBytes, sizeof(ShadowViewData)),
+                vk::BufferUsageFlagBits::eStorageBuffer,
+            }, MemoryUsage::eUpload));
+        }
+
+        BuiltinMeshGeometry geometry = buildBuiltinMeshes();
+        m_meshRanges = geometry.ranges;
+        vk::DeviceSize vertexBytes = geometry.vertices.size() * sizeof(glm::vec3);
+        vk::DeviceSize indexBytes = geometry.indices.size() * sizeof(uint32_t);
+        m_vertices = memory.createBuffer(vk::BufferCreateInfo{
+            vk::BufferCreateFlags{},
+            vertexBytes,
+            vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        }, MemoryUsage::eGpuOnly);
+        m_indices = memory.createBuffer(vk::BufferCreateInfo{
+            vk::BufferCreateFlags{},
+            indexBytes,
+            vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        }, MemoryUsage::eGpuOnly);
+        uploads.uploadBuffer(m_vertices.buffer, 0, geometry.vertices.data(), vertexBytes);
+        uploads.uploadBuffer(m_indices.buffer, 0, geometry.indices.data(), indexBytes);
+
+        m_uploadValue = uploads.flush();
+        std::shared_ptr<std::atomic<bool>> ready = m_ready;
+        uploads.whenAcquired(m_uploadValue, [ready]() {
+            ready->store(true, std::memory_order_release);
+        });
+    }
+
+    void ShadowAtlas::createPipeline()
+    {
+        vk::Device device = m_renderer.getDevice();
+        PipelineCache& pipelines = m_renderer.getPipelines();
+
+        vk::DescriptorSetLayoutBinding binding{ 0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex };
+        m_setLayout = pipelines.getDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{
+            vk::DescriptorSetLayoutCreateFlags{}, 1, &binding });
+        vk::PushConstantRange viewConstants{ vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4) };
+        m_pipelineLayout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+            vk::PipelineLayoutCreateFlags{}, 1, &m_setLayout, 1, &viewConstants });
+
+        // Same format as the "shadow_atlas" pass's attachment, which is all
+        // render pass compatibility asks for.
+        vk::AttachmentDescription depthAttachment{
+            vk::AttachmentDescriptionFlags{},
+            kAtlasFormat,
+            vk::SampleCountFlagBits::e1,
+            vk::AttachmentLoadOp::eLoad,
+            vk::AttachmentStoreOp::eStore,
+            vk::AttachmentLoadOp::eDontCare,
+            vk::AttachmentStoreOp::eDontCare,
+            vk::ImageLayout::eDepthStencilAttachmentOptimal,
+            vk::ImageLayout::eDepthStencilAttachmentOptimal,
+        };
+        vk::AttachmentReference depthRef{ 0, vk::ImageLayout::eDepthStencilAttachmentOptimal };
+        vk::SubpassDescription subpass{
+            vk::SubpassDescriptionFlags{},
+            vk::PipelineBindPoint::eGraphics,
+            0, nullptr, // Input attachments
+            0, nullptr, // Color attachments
+            nullptr, // Resolve attachments
+            &depthRef,
+        };
+        m_renderPass = device.createRenderPass(vk::RenderPassCreateInfo{
+            vk::RenderPassCreateFlags{},
+            1, &depthAttachment,
+            1, &subpass,
+        });
+
+        // Depth only, so no fragment shader.
+        vk::PipelineShaderStageCreateInfo stage{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eVertex, m_renderer.createEmbeddedShaderModule("shadow.vert"), "main" };
+
+        vk::VertexInputBindingDescription vertexBinding{ 0, sizeof(glm::vec3), vk::VertexInputRate::eVertex };
+        vk::VertexInputAttributeDescription positionAttribute{ 0, 0, vk::Format::eR32G32B32Sfloat, 0 };
+        vk::PipelineVertexInputStateCreateInfo vertexInput{ vk::PipelineVertexInputStateCreateFlags{}, 1, &vertexBinding, 1, &positionAttribute };
+        vk::PipelineInputAssemblyStateCreateInfo inputAssembly{ vk::PipelineInputAssemblyStateCreateFlags{}, vk::PrimitiveTopology::eTriangleList };
+        vk::PipelineViewportStateCreateInfo viewportState{ vk::PipelineViewportStateCreateFlags{}, 1, nullptr, 1, nullptr };
+        vk::PipelineRasterizationStateCreateInfo rasterization{};
+        rasterization.polygonMode = vk::PolygonMode::eFill;
+        rasterization.cullMode = vk::CullModeFlagBits::eNone;
+        rasterization.frontFace = vk::FrontFace::eCounterClockwise;
+        rasterization.depthBiasEnable = VK_TRUE;
+        rasterization.lineWidth = 1.0f;
+        vk::PipelineMultisampleStateCreateInfo multisample{};
+        vk::PipelineDepthStencilStateCreateInfo depthStencil{};
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = vk::CompareOp::eLess;
+        vk::PipelineColorBlendStateCreateInfo colorBlend{};
+        std::array<vk::DynamicState, 3> dynamicStates{ vk::DynamicState::eViewport, vk::DynamicState::eScissor, vk::DynamicState::eDepthBias };
+        vk::PipelineDynamicStateCreateInfo dynamicState{ vk::PipelineDynamicStateCreateFlags{}, uint32_t(dynamicStates.size()), dynamicStates.data() };
+
+        vk::GraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.stageCount = 1;
+        pipelineInfo.pStages = &stage;
+        pipelineInfo.pVertexInputState = &vertexInput;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterization;
+        pipelineInfo.pMultisampleState = &multisample;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlend;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = m_pipelineLayout;
+        pipelineInfo.renderPass = m_renderPass;
+        pipelineInfo.subpass = 0;
+        m_pipeline = pipelines.getGraphicsPipeline(pipelineInfo);
+    }
+
+    ShadowLightHandle ShadowAtlas::addLight(const Light& light)
+    {
+        uint32_t index = UINT32_MAX;
+        if (!m_freeLights.empty()) {
+            index = m_freeLights.back();
+            m_freeLights.pop_back();
+        }
+        else if (m_lights.size() < m_config.maxLights) {
+            index = uint32_t(m_lights.size());
+            m_lights.emplace_back();
+        }
+        else {
+            std::string errorString{ "Shadowed lights exceed the limit of " };
+            throw std::runtime_error(errorString.append(std::to_string(m_config.maxLights)));
+        }
+
+        LightSlot& slot = m_lights[index];
+        slot = LightSlot{};
+        slot.light = light;
+        slot.alive = true;
+        updateFaceViews(slot);
+        ++m_lightCount;
+        return ShadowLightHandle{ index };
+    }
+
+    void ShadowAtlas::updateLight(ShadowLightHandle handle, const Light& light)
+    {
+        LightSlot& slot = m_lights[handle.index];
+        if (sameShadow(slot.light, light)) {
+            slot.light = light;
+            return;
+        }
+        // Switching between spot and point changes the number of tiles.
+        if (slot.light.isSpot() != light.isSpot()) {
+            releaseTiles(slot);
+        }
+        slot.light = light;
+        updateFaceViews(slot);
+    }
+
+    void ShadowAtlas::removeLight(ShadowLightHandle handle)
+    {
+        if (!handle.isValid() || !m_lights[handle.index].alive) {
+            return;
+        }
+        LightSlot& slot = m_lights[handle.index];
+        releaseTiles(slot);
+        slot.alive = false;
+        m_freeLights.push_back(handle.index);
+        --m_lightCount;
+    }
+
+    void ShadowAtlas::updateFaceViews(LightSlot& slot)
+    {
+        glm::vec3 position{ slot.light.positionRange };
+        float range = slot.light.positionRange.w;
+        float nearZ = std::max(range * 0.01f, 0.01f);
+
+        if (slot.light.isSpot()) {
+            glm::vec3 direction{ slot.light.directionCosAngle };
+            glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            float fieldOfView = 2.0f * std::acos(slot.light.directionCosAngle.w);
+            slot.faceCount = 1;
+            slot.faces[0].view = makeCullView(glm::perspectiveRH_ZO(fieldOfView, 1.0f, nearZ, range) * glm::lookAt(position, position + direction, up));
+        }
+        else {
+            glm::mat4 projection = glm::perspectiveRH_ZO(glm::half_pi<float>(), 1.0f, nearZ, range);
+            slot.faceCount = 6;
+            for (uint32_t face = 0; face < 6; ++face) {
+                slot.faces[face].view = makeCullView(projection * glm::lookAt(position, position + kFaceDirections[face], kFaceUps[face]));
+            }
+        }
+        for (ShadowFace& face : slot.faces) {
+            face.dirty = true;
+        }
+    }
+
+    void ShadowAtlas::releaseTiles(LightSlot& slot)
+    {
+        for (ShadowFace& face : slot.faces) {
+            m_allocator.free(face.tile);
+            m_allocator.free(face.pendingTile);
+            face.tile = ShadowTile{};
+            face.pendingTile = ShadowTile{};
+            face.dirty = true;
+            face.waitedFrames = 0;
+        }
+        slot.tileSize = 0;
+    }
+
+    ShadowCasterHandle ShadowAtlas::addCaster(const glm::mat4& transform, BuiltinMesh mesh)
+    {
+        uint32_t index = UINT32_MAX;
+        if (!m_freeCasters.empty()) {
+            index = m_freeCasters.back();
+            m_freeCasters.pop_back();
+        }
+        else if (m_casterTransforms.size() < m_config.maxCasters) {
+            index = uint32_t(m_casterTransforms.size());
+            m_casterBounds.x.push_back(0.0f);
+            m_casterBounds.y.push_back(0.0f);
+            m_casterBounds.z.push_back(0.0f);
+            m_casterBounds.radius.push_back(0.0f);
+            m_casterTransforms.emplace_back(1.0f);
+            m_casterMeshes.push_back(0);
+            m_casterChanged.push_back(false);
+        }
+        else {
+            std::string errorString{ "Shadow casters exceed the limit of " };
+            throw std::runtime_error(errorString.append(std::to_string(m_config.maxCasters)));
+        }
+
+        glm::vec4 bounds = builtinMeshBounds(transform);
+        setCasterBounds(index, bounds);
+        m_casterTransforms[index] = transform;
+        m_casterMeshes[index] = uint32_t(mesh);
+        markCasterChanged(index);
+        m_changedBounds.push_back(bounds);
+        ++m_casterCount;
+        return ShadowCasterHandle{ index };
+    }
+
+    void ShadowAtlas::moveCaster(ShadowCasterHandle handle, const glm::mat4& transform)
+    {
+        uint32_t index = handle.index;
+        if (m_casterTransforms[index] == transform) {
+            return;
+        }
+        // Both where it was and where it is now change shadows.
+        m_changedBounds.push_back(glm::vec4(m_casterBounds.x[index], m_casterBounds.y[index], m_casterBounds.z[index], m_casterBounds.radius[index]));
+        glm::vec4 bounds = builtinMeshBounds(transform);
+        setCasterBounds(index, bounds);
+        m_changedBounds.push_back(bounds);
+        m_casterTransforms[index] = transform;
+        markCasterChanged(index);
+    }
+
+    void ShadowAtlas::removeCaster(ShadowCasterHandle handle)
+    {
+        uint32_t index = handle.index;
+        if (!handle.isValid() || m_casterBounds.radius[index] < 0.0f) {
+            return;
+        }
+        m_changedBounds.push_back(glm::vec4(m_casterBounds.x[index], m_casterBounds.y[index], m_casterBounds.z[index], m_casterBounds.radius[index]));
+        setCasterBounds(index, glm::vec4(0.0f, 0.0f, 0.0f, -std::numeric_limits<float>::infinity()));
+        m_freeCasters.push_back(index);
+        --m_casterCount;
+    }
+
+    void ShadowAtlas::setCasterBounds(uint32_t index, const glm::vec4& bounds)
+    {
+        m_casterBounds.x[index] = bounds.x;
+        m_casterBounds.y[index] = bounds.y;
+        m_casterBounds.z[index] = bounds.z;
+        m_casterBounds.radius[index] = bounds.w;
+    }
+
+    void ShadowAtlas::markCasterChanged(uint32_t index)
+    {
+        if (!m_casterChanged[index]) {
+            m_casterChanged[index] = true;
+            m_changedCasters.push_back(index);
+        }
+    }
+
+    void ShadowAtlas::setDirectionalLight(const glm::vec3& direction)
+    {
+        m_lightDirection = direction;
+    }
+
+    uint32_t ShadowAtlas::getShadowView(ShadowLightHandle handle) const
+    {
+        if (!handle.isValid() || !m_lights[handle.index].alive) {
+            return UINT32_MAX;
+        }
+        return m_lights[handle.index].viewIndex;
+    }
+
+    void ShadowAtlas::updateCascades(const ShadowCamera& camera)
+    {
+        if (m_cascades.empty()) {
+            return;
+        }
+
+        // Corners of a slice of the view frustum are at distance k * depth from
+        // the view axis.
+        float tanHalfX = 1.0f / std::abs(camera.projection[0][0]);
+        float tanHalfY = 1.0f / std::abs(camera.projection[1][1]);
+        float k2 = tanHalfX * tanHalfX + tanHalfY * tanHalfY;
+        glm::mat4 inverseView = glm::inverse(camera.view);
+
+        glm::vec3 direction = glm::normalize(m_lightDirection);
+        glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+        float nearZ = camera.nearZ;
+        float farZ = std::max(m_config.shadowDistance, nearZ * 2.0f);
+        uint32_t cascadeCount = uint32_t(m_cascades.size());
+        float sliceNear = nearZ;
+        for (uint32_t i = 0; i < cascadeCount; ++i) {
+            float t = float(i + 1) / float(cascadeCount);
+            float logSplit = nearZ * std::pow(farZ / nearZ, t);
+            float uniformSplit = nearZ + (farZ - nearZ) * t;
+            float sliceFar = m_config.cascadeSplitLambda * logSplit + (1.0f - m_config.cascadeSplitLambda) * uniformSplit;
+            m_cascadeSplits[i] = sliceFar;
+
+            // The smallest sphere around the slice only depends on the
+            // projection, so the cascade's size stays put as the camera turns.
+            float centerDepth = std::min(0.5f * (sliceNear + sliceFar) * (1.0f + k2), sliceFar);
+            float radius = std::sqrt((sliceFar - centerDepth) * (sliceFar - centerDepth) + sliceFar * sliceFar * k2);
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+            glm::vec3 center = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+            sliceNear = sliceFar;
+
+            // Snaps the center to texels across the light and to coarser steps
+            // along it, so the matrix only changes once the camera moved by
+            // that much. The extent is a texel wider to cover the snapping.
+            float size = float(m_config.cascadeSize);
+            float halfExtent = radius * size / (size - 2.0f);
+            float texel = 2.0f * halfExtent / size;
+            float depthStep = radius * 0.125f;
+            glm::vec3 lightCenter = glm::vec3(lightRotation * glm::vec4(center, 1.0f));
+            lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+            lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+            lightCenter.z = std::floor(lightCenter.z / depthStep) * depthStep;
+
+            // Looks down -z from past the sphere, far enough to catch casters
+            // up to cascadeCasterDistance beyond it.
+            float eyeZ = lightCenter.z + radius + depthStep + m_config.cascadeCasterDistance;
+            glm::mat4 view = glm::translate(glm::mat4(1.0f), glm::vec3(-lightCenter.x, -lightCenter.y, -eyeZ)) * lightRotation;
+            glm::mat4 projection = glm::orthoRH_ZO(-halfExtent, halfExtent, -halfExtent, halfExtent, 0.0f, 2.0f * (radius + depthStep) + m_config.cascadeCasterDistance);
+
+            Cascade& cascade = m_cascades[i];
+            glm::mat4 viewProjection = projection * view;
+            if (viewProjection != cascade.view.viewProjection) {
+                cascade.view = makeCullView(viewProjection);
+                cascade.drawn = false;
+            }
+        }
+    }
+
+    void ShadowAtlas::allocateTiles(const ShadowCamera& camera)
+    {
+        CullView cameraView = makeCullView(camera.projection * camera.view);
+        glm::vec3 eye = glm::vec3(glm::inverse(camera.view)[3]);
+        float height = float(camera.viewportHeight);
+        // Projected size of one unit at distance one.
+        float pixelsPerUnit = std::abs(camera.projection[1][1]) * 0.5f * height;
+
+        // Lights out of view can't shade anything visible, so they give their
+        // tiles back.
+        m_lightOrder.clear();
+        for (uint32_t i = 0; i < m_lights.size(); ++i) {
+            LightSlot& slot = m_lights[i];
+            if (!slot.alive) {
+                continue;
+            }
+            if (!sphereInFrustum(cameraView, slot.light.positionRange)) {
+                releaseTiles(slot);
+                slot.importance = 0.0f;
+                continue;
+            }
+            float range = slot.light.positionRange.w;
+            float distance = glm::length(glm::vec3(slot.light.positionRange) - eye);
+            slot.importance = distance <= range ? height : std::min(2.0f * range * pixelsPerUnit / distance, height);
+            m_lightOrder.push_back(i);
+        }
+        std::sort(m_lightOrder.begin(), m_lightOrder.end(), [this](uint32_t a, uint32_t b) {
+            return m_lights[a].importance > m_lights[b].importance;
+        });
+
+        for (uint32_t index : m_lightOrder) {
+            LightSlot& slot = m_lights[index];
+            uint32_t desired = std::max(roundUpToPowerOfTwo(slot.importance, m_config.maxTileSize), m_config.minTileSize);
+            // Grows right away but only shrinks by two sizes or more, so lights
+            // hovering around a size don't keep getting redrawn.
+            if (slot.tileSize != 0 && desired <= slot.tileSize && desired * 4 > slot.tileSize) {
+                continue;
+            }
+
+            // Falls back to smaller tiles, but never to the size it already has.
+            uint32_t smallest = slot.tileSize != 0 && desired > slot.tileSize ? slot.tileSize * 2 : m_config.minTileSize;
+            std::array<ShadowTile, 6> tiles{};
+            uint32_t allocated = 0;
+            for (uint32_t size = desired; size >= smallest && allocated < slot.faceCount; size /= 2) {
+                for (allocated = 0; allocated < slot.faceCount; ++allocated) {
+                    tiles[allocated] = m_allocator.allocate(size);
+                    if (!tiles[allocated].isValid()) {
+                        break;
+                    }
+                }
+                if (allocated < slot.faceCount) {
+                    for (uint32_t face = 0; face < allocated; ++face) {
+                        m_allocator.free(tiles[face]);
+                    }
+                }
+            }
+            if (allocated < slot.faceCount) {
+                continue;
+            }
+
+            for (uint32_t face = 0; face < slot.faceCount; ++face) {
+                m_allocator.free(slot.faces[face].pendingTile);
+                slot.faces[face].pendingTile = tiles[face];
+            }
+            slot.tileSize = tiles[0].size;
+        }
+
+        for (uint32_t index : m_lightOrder) {
+            if (m_lights[index].tileSize == 0) {
+                ++m_stats.lightsWithoutTile;
+            }
+        }
+    }
+
+    void ShadowAtlas::invalidateTiles()
+    {
+        if (m_changedBounds.empty()) {
+            return;
+        }
+
+        BoundsSoA changed{ m_changedBounds };
+        uint32_t changedCount = uint32_t(m_changedBounds.size());
+        std::vector<uint32_t> hits(changedCount);
+        auto touched = [&](const CullView& view) {
+            return frustumCullSpheres(view, changed, 0, changedCount, hits.data()) > 0;
+        };
+
+        for (LightSlot& slot : m_lights) {
+            if (!slot.alive) {
+                continue;
+            }
+            for (uint32_t face = 0; face < slot.faceCount; ++face) {
+                ShadowFace& shadowFace = slot.faces[face];
+                if (!shadowFace.dirty && shadowFace.tile.isValid() && touched(shadowFace.view)) {
+                    shadowFace.dirty = true;
+                }
+            }
+        }
+        for (Cascade& cascade : m_cascades) {
+            if (cascade.drawn && touched(cascade.view)) {
+                cascade.drawn = false;
+            }
+        }
+        m_changedBounds.clear();
+    }
+
+    void ShadowAtlas::addDraw(const CullView& view, const ShadowTile& tile)
+    {
+        if (m_drawCount == m_draws.size()) {
+            m_draws.emplace_back();
+        }
+        TileDraw& draw = m_draws[m_drawCount++];
+        draw.view = view;
+        draw.tile = tile;
+        draw.casterCount = 0;
+    }
+
+    void ShadowAtlas::selectDraws()
+    {
+        m_drawCount = 0;
+
+        // Cascades follow the camera, so they never wait for the budget.
+        for (Cascade& cascade : m_cascades) {
+            if (!cascade.drawn || m_config.disableCaching) {
+                addDraw(cascade.view, cascade.tile);
+                cascade.drawn = true;
+                ++m_stats.cascadesUpdated;
+            }
+        }
+
+        m_candidates.clear();
+        for (uint32_t index = 0; index < m_lights.size(); ++index) {
+            LightSlot& slot = m_lights[index];
+            if (!slot.alive || slot.tileSize == 0) {
+                continue;
+            }
+            bool complete = true;
+            for (uint32_t face = 0; face < slot.faceCount; ++face) {
+                complete = complete && slot.faces[face].tile.isValid();
+            }
+            for (uint32_t face = 0; face < slot.faceCount; ++face) {
+                const ShadowFace& shadowFace = slot.faces[face];
+                if (shadowFace.pendingTile.isValid() || shadowFace.dirty || m_config.disableCaching) {
+                    FaceCandidate candidate{};
+                    candidate.light = index;
+                    candidate.face = face;
+                    candidate.lightComplete = complete;
+                    // Waiting raises the priority, so unimportant tiles get
+                    // their turn eventually.
+                    candidate.priority = slot.importance * float(1 + shadowFace.waitedFrames);
+                    m_candidates.push_back(candidate);
+                }
+                else {
+                    ++m_stats.tilesCached;
+                }
+            }
+        }
+
+        size_t budget = m_config.disableCaching ? m_candidates.size() : std::min<size_t>(m_candidates.size(), m_config.tileUpdateBudget);
+        std::partial_sort(m_candidates.begin(), m_candidates.begin() + budget, m_candidates.end(), [](const FaceCandidate& a, const FaceCandidate& b) {
+            if (a.lightComplete != b.lightComplete) {
+                return !a.lightComplete;
+            }
+            return a.priority > b.priority;
+        });
+
+        for (size_t i = 0; i < m_candidates.size(); ++i) {
+            ShadowFace& face = m_lights[m_candidates[i].light].faces[m_candidates[i].face];
+            if (i >= budget) {
+                ++face.waitedFrames;
+                ++m_stats.tilesDeferred;
+                continue;
+            }
+
+            if (face.pendingTile.isValid()) {
+                m_allocator.free(face.tile);
+                face.tile = face.pendingTile;
+                face.pendingTile = ShadowTile{};
+            }
+            addDraw(face.view, face.tile);
+            face.dirty = false;
+            face.waitedFrames = 0;
+            ++m_stats.tilesUpdated;
+        }
+    }
+
+    void ShadowAtlas::cullDraws()
+    {
+        uint32_t casterSlots = uint32_t(m_casterTransforms.size());
+        JobCounter counter;
+        JobSystem& jobs = m_renderer.getJobSystem();
+        jobs.parallelFor(m_drawCount, 1, [this, casterSlots](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; ++i) {
+                TileDraw& draw = m_draws[i];
+                draw.casters.resize(casterSlots);
+                draw.casterCount = frustumCullSpheres(draw.view, m_casterBounds, 0, casterSlots, draw.casters.data());
+            }
+        }, counter);
+        jobs.wait(counter);
+
+        for (uint32_t i = 0; i < m_drawCount; ++i) {
+            m_stats.casterDraws += m_draws[i].casterCount;
+        }
+    }
+
+    void ShadowAtlas::buildViews()
+    {
+        m_views.clear();
+        float atlasSize = float(m_config.atlasSize);
+        auto addView = [this, atlasSize](const CullView& view, const ShadowTile& tile) {
+            ShadowViewData data{};
+            data.viewProjection = view.viewProjection;
+            data.atlasRect = glm::vec4(float(tile.x), float(tile.y), float(tile.size), float(tile.size)) / atlasSize;
+            m_views.push_back(data);
+        };
+
+        for (const Cascade& cascade : m_cascades) {
+            addView(cascade.view, cascade.tile);
+        }
+        for (LightSlot& slot : m_lights) {
+            slot.viewIndex = UINT32_MAX;
+            if (!slot.alive || slot.tileSize == 0) {
+                continue;
+            }
+            bool complete = true;
+            for (uint32_t face = 0; face < slot.faceCount; ++face) {
+                complete = complete && slot.faces[face].tile.isValid();
+                m_stats.tiles += slot.faces[face].tile.isValid() ? 1 : 0;
+            }
+            if (!complete) {
+                continue;
+            }
+            slot.viewIndex = uint32_t(m_views.size());
+            for (uint32_t face = 0; face < slot.faceCount; ++face) {
+                addView(slot.faces[face].view, slot.faces[face].tile);
+            }
+            ++m_stats.shadowedLights;
+        }
+    }
+
+    ShadowResources ShadowAtlas::addPasses(RenderGraph& graph, FrameContext& frame, const ShadowCamera& camera)
+    {
+        BVR_PROFILE_ZONE("shadow_update");
+        if (!isReady()) {
+            throw std::runtime_error("ShadowAtlas used before its meshes were uploaded");
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+
+        m_stats = ShadowStats{};
+        m_stats.lights = m_lightCount;
+        m_stats.casters = m_casterCount;
+
+        updateCascades(camera);
+        allocateTiles(camera);
+        invalidateTiles();
+        selectDraws();
+        cullDraws();
+        buildViews();
+        m_stats.atlasOccupancy = float(double(m_allocator.getAllocatedArea()) / (double(m_config.atlasSize) * m_config.atlasSize));
+
+        // Host writes made before the submission need no barrier.
+        const Buffer& viewBuffer = m_viewBuffers[frame.frameIndex % m_renderer.getFrameCount()];
+        memcpy(viewBuffer.mapped, m_views.data(), m_views.size() * sizeof(ShadowViewData));
+
+        ShadowResources resources{};
+        resources.views = graph.importBuffer("shadow_views", viewBuffer.buffer, viewBuffer.size);
+
+        GraphImageDesc atlasDesc{};
+        atlasDesc.format = kAtlasFormat;
+        atlasDesc.width = m_config.atlasSize;
+        atlasDesc.height = m_config.atlasSize;
+        GraphImportState readState{
+            vk::ImageLayout::eShaderReadOnlyOptimal,
+            vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,
+            vk::AccessFlagBits::eShaderRead,
+        };
+        resources.atlas = graph.importImage("shadow_atlas", m_atlas.image, m_atlasView, atlasDesc, m_atlasInitialized ? readState : GraphImportState{}, readState);
+        m_atlasInitialized = true;
+
+        // Earlier frames may still be drawing with the transforms.
+        GraphResource transforms = graph.importBuffer(
+            "shadow_caster_transforms",
+            m_transforms.buffer,
+            m_transforms.size,
+            GraphImportState{ vk::ImageLayout::eUndefined, vk::PipelineStageFlagBits::eVertexShader, vk::AccessFlagBits::eShaderRead }
+        );
+        if (!m_changedCasters.empty()) {
+            RingAllocation upload = m_renderer.getMemory().getFrameRing().allocate(m_changedCasters.size() * sizeof(glm::mat4));
+            if (!upload.buffer) {
+                throw std::runtime_error("Frame ring exhausted by the shadow caster transforms");
+            }
+            std::vector<vk::BufferCopy> regions;
+            regions.reserve(m_changedCasters.size());
+            for (size_t i = 0; i < m_changedCasters.size(); ++i) {
+                uint32_t caster = m_changedCasters[i];
+                memcpy(static_cast<uint8_t*>(upload.mapped) + i * sizeof(glm::mat4), &m_casterTransforms[caster], sizeof(glm::mat4));
+                regions.push_back(vk::BufferCopy{ upload.offset + i * sizeof(glm::mat4), caster * sizeof(glm::mat4), sizeof(glm::mat4) });
+                m_casterChanged[caster] = false;
+            }
+            m_changedCasters.clear();
+
+            graph.addPass("shadow_casters", GraphPassType::eTransfer)
+                .write(transforms, GraphAccess::eTransferWrite)
+                .record([upload, regions, transforms](RenderGraphContext& context) {
+                    context.getCommandBuffer().copyBuffer(upload.buffer, context.getBuffer(transforms), regions);
+                });
+        }
+
+        if (m_drawCount > 0) {
+            // Uploads are acquired before the frame is recorded and nothing on
+            // the GPU writes these, so they need no barriers.
+            GraphResource vertices = graph.importBuffer("shadow_mesh_vertices", m_vertices.buffer, m_vertices.size);
+            GraphResource indices = graph.importBuffer("shadow_mesh_indices", m_indices.buffer, m_indices.size);
+
+            vk::Device device = m_renderer.getDevice();
+            graph.addPass("shadow_atlas", GraphPassType::eRaster)
+                .read(transforms, GraphAccess::eStorageReadVertex)
+                .read(vertices, GraphAccess::eVertexRead)
+                .read(indices, GraphAccess::eIndexRead)
+                .depthAttachment(resources.atlas, vk::AttachmentLoadOp::eLoad)
+                .record([this, device, &frame](RenderGraphContext& context) {
+                    vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                    vk::DescriptorSet set = allocateSet(device, frame.descriptorPool, m_setLayout);
+                    vk::DescriptorBufferInfo transformsInfo{ m_transforms.buffer, 0, VK_WHOLE_SIZE };
+                    device.updateDescriptorSets(vk::WriteDescriptorSet{ set, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &transformsInfo }, nullptr);
+
+                    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_pipeline);
+                    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_pipelineLayout, 0, set, nullptr);
+                    commandBuffer.bindVertexBuffers(0, m_vertices.buffer, vk::DeviceSize{ 0 });
+                    commandBuffer.bindIndexBuffer(m_indices.buffer, 0, vk::IndexType::eUint32);
+                    commandBuffer.setDepthBias(m_config.depthBiasConstant, 0.0f, m_config.depthBiasSlope);
+
+                    // The rest of the atlas is loaded, only the redrawn tiles
+                    // are cleared.
+                    for (uint32_t i = 0; i < m_drawCount; ++i) {
+                        const TileDraw& draw = m_draws[i];
+                        vk::Rect2D rect{ vk::Offset2D{ int32_t(draw.tile.x), int32_t(draw.tile.y) }, vk::Extent2D{ draw.tile.size, draw.tile.size } };
+                        commandBuffer.setViewport(0, vk::Viewport{ float(draw.tile.x), float(draw.tile.y), float(draw.tile.size), float(draw.tile.size), 0.0f, 1.0f });
+                        commandBuffer.setScissor(0, rect);
+                        commandBuffer.clearAttachments(
+                            vk::ClearAttachment{ vk::ImageAspectFlagBits::eDepth, 0, vk::ClearDepthStencilValue{ 1.0f, 0 } },
+                            vk::ClearRect{ rect, 0, 1 }
+                        );
+                        commandBuffer.pushConstants(m_pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4), &draw.view.viewProjection);
+
+                        // firstInstance carries the caster index, as in the
+                        // instance culler's draws.
+                        for (uint32_t j = 0; j < draw.casterCount; ++j) {
+                            uint32_t caster = draw.casters[j];
+                            const BuiltinMeshRange& mesh = m_meshRanges[m_casterMeshes[caster]];
+                            commandBuffer.drawIndexed(mesh.indexCount, 1, mesh.firstIndex, mesh.vertexOffset, caster);
+                        }
+                    }
+                });
+        }
+
+        m_stats.cpuUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return resources;
+    }
+}
@@ -0,0 +1,486 @@
+#include "swapchain.h"
+#include "renderer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace bvr
+{
+    namespace
+    {
+        // Long enough for any refresh rate, short enough that a compositor
+        // holding back an occluded window doesn't stall the frame loop.
+        const uint64_t kPresentWaitTimeoutNs = 250000000;
+        // Shown virtual presents kept around for late waits.
+        const size_t kMaxVirtualPresents = 16;
+
+        vk::PresentModeKHR toVkPresentMode(PresentMode mode)
+        {
+            switch (mode) {
+            case PresentMode::eFifo: return vk::PresentModeKHR::eFifo;
+            case PresentMode::eFifoRelaxed: return vk::PresentModeKHR::eFifoRelaxed;
+            case PresentMode::eMailbox: return vk::PresentModeKHR::eMailbox;
+            case PresentMode::eImmediate: return vk::PresentModeKHR::eImmediate;
+            }
+            return vk::PresentModeKHR::eFifo;
+        }
+
+        // The offscreen target is UNORM, and copying into a UNORM image keeps
+        // its values as they are.
+        vk::SurfaceFormatKHR chooseSurfaceFormat(vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface)
+        {
+            std::vector<vk::SurfaceFormatKHR> formats = physicalDevice.getSurfaceFormatsKHR(surface);
+            for (vk::Format preferred : { vk::Format::eB8G8R8A8Unorm, vk::Format::eR8G8B8A8Unorm }) {
+                vk::FormatProperties props = physicalDevice.getFormatProperties(preferred);
+                if (!(props.optimalTilingFeatures & vk::FormatFeatureFlagBits::eBlitDst)) {
+                    continue;
+                }
+                for (const vk::SurfaceFormatKHR& format : formats) {
+                    if (format.format == preferred && format.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear) {
+                        return format;
+                    }
+                }
+            }
+            throw std::runtime_error("The surface has no 8 bit UNORM format to copy frames into");
+        }
+
+        vk::CompositeAlphaFlagBitsKHR chooseCompositeAlpha(vk::CompositeAlphaFlagsKHR supported)
+        {
+            for (vk::CompositeAlphaFlagBitsKHR alpha : {
+                vk::CompositeAlphaFlagBitsKHR::eOpaque,
+                vk::CompositeAlphaFlagBitsKHR::eInherit,
+                vk::CompositeAlphaFlagBitsKHR::ePreMultiplied,
+                vk::CompositeAlphaFlagBitsKHR::ePostMultiplied }) {
+                if (supported & alpha) {
+                    return alpha;
+                }
+            }
+            return vk::CompositeAlphaFlagBitsKHR::eOpaque;
+        }
+
+        // The first vertical blank at or after `time`.
+        Swapchain::Clock::time_point nextBlank(Swapchain::Clock::time_point start, Swapchain::Clock::duration period, Swapchain::Clock::time_point time)
+        {
+            if (time <= start) {
+                return start;
+            }
+            Swapchain::Clock::duration::rep blanks = ((time - start).count() + period.count() - 1) / period.count();
+            return start + period * blanks;
+        }
+    }
+
+    const char* toString(PresentMode mode)
+    {
+        switch (mode) {
+        case PresentMode::eFifo: return "fifo";
+        case PresentMode::eFifoRelaxed: return "fifo_relaxed";
+        case PresentMode::eMailbox: return "mailbox";
+        case PresentMode::eImmediate: return "immediate";
+        }
+        return "unknown";
+    }
+
+    Swapchain::Swapchain(
+        Renderer& renderer,
+        const SwapchainConfig& config,
+        vk::PhysicalDevice physicalDevice,
+        vk::SurfaceKHR surface,
+        uint32_t graphicsFamily,
+        uint32_t presentFamily,
+        uint32_t frameCount,
+        vk::Semaphore frameTimeline,
+        bool presentWaitSupported,
+        vk::Extent2D extent) :
+        m_renderer(renderer),
+        m_config(config),
+        m_physicalDevice(physicalDevice),
+        m_device(renderer.getDevice()),
+        m_surface(surface),
+        m_graphicsFamily(graphicsFamily),
+        m_presentFamily(presentFamily),
+        m_frameTimeline(frameTimeline),
+        m_requestedExtent(extent),
+        m_presentMode(config.presentMode)
+    {
+        m_virtualStart = Clock::now();
+        m_virtualPeriod = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / double(std::max(m_config.virtualRefreshHz, 1u))));
+        m_lastShownTime = m_virtualStart - m_virtualPeriod;
+
+        if (isVirtual()) {
+            m_format = vk::Format::eR8G8B8A8Unorm;
+        }
+        else {
+            std::vector<vk::PresentModeKHR> modes = m_physicalDevice.getSurfacePresentModesKHR(m_surface);
+            if (std::find(modes.begin(), modes.end(), toVkPresentMode(m_presentMode)) == modes.end()) {
+                std::string message = "Present mode ";
+                debugLog(message.append(toString(m_presentMode)).append(" is not supported, using fifo").c_str());
+                m_presentMode = PresentMode::eFifo;
+            }
+
+            if (presentWaitSupported) {
+                m_waitForPresent = (PFN_vkWaitForPresentKHR)m_device.getProcAddr("vkWaitForPresentKHR");
+            }
+            for (uint32_t i = 0; i < frameCount; ++i) {
+                m_acquireSemaphores.push_back(m_device.createSemaphore(vk::SemaphoreCreateInfo{}));
+            }
+        }
+
+        if (m_requestedExtent.width == 0 || m_requestedExtent.height == 0) {
+            m_outOfDate = true;
+        }
+        else {
+            recreate();
+        }
+    }
+
+    Swapchain::~Swapchain()
+    {
+        // The renderer has gone idle before destroying the swapchain, so
+        // nothing needs deferring.
+        for (vk::Semaphore semaphore : m_presentSemaphores) {
+            m_device.destroySemaphore(semaphore);
+        }
+        for (vk::Semaphore semaphore : m_acquireSemaphores) {
+            m_device.destroySemaphore(semaphore);
+        }
+        if (m_swapchain) {
+            m_device.destroySwapchainKHR(m_swapchain);
+        }
+        for (Image& image : m_virtualImages) {
+            m_renderer.getMemory().destroyImage(image);
+        }
+    }
+
+    SwapchainImage Swapchain::acquire(uint32_t frameSlot)
+    {
+        // A second attempt for swapchains that turn out of date while acquiring.
+        for (uint32_t attempt = 0; attempt < 2; ++attempt) {
+            if (m_outOfDate) {
+                if (m_requestedExtent.width == 0 || m_requestedExtent.height == 0) {
+                    return SwapchainImage{};
+                }
+                recreate();
+                if (m_outOfDate) {
+                    return SwapchainImage{};
+                }
+                ++m_recreateCount;
+            }
+
+            SwapchainImage image{};
+            if (isVirtual()) {
+                image.index = m_nextVirtualImage;
+                m_nextVirtualImage = (m_nextVirtualImage + 1) % uint32_t(m_images.size());
+            }
+            else {
+                vk::Semaphore acquired = m_acquireSemaphores[frameSlot % m_acquireSemaphores.size()];
+                uint32_t index = 0;
+                vk::Result result = m_device.acquireNextImageKHR(m_swapchain, UINT64_MAX, acquired, vk::Fence{}, &index);
+                if (result == vk::Result::eErrorOutOfDateKHR) {
+                    m_outOfDate = true;
+                    continue;
+                }
+                if (result != vk::Result::eSuccess && result != vk::Result::eSuboptimalKHR) {
+                    throw std::runtime_error("Failed to acquire a swapchain image");
+                }
+                // Still presentable, so recreate after this frame.
+                if (result == vk::Result::eSuboptimalKHR) {
+                    m_outOfDate = true;
+                }
+                image.index = index;
+                image.acquired = acquired;
+                image.presentReady = m_presentSemaphores[index];
+            }
+            image.image = m_images[image.index];
+            image.extent = m_extent;
+            return image;
+        }
+        return SwapchainImage{};
+    }
+
+    void Swapchain::present(vk::Queue queue, const SwapchainImage& image, uint64_t presentId, uint64_t timelineValue)
+    {
+        if (isVirtual()) {
+            pollVirtualPresents();
+            VirtualPresent virtualPresent{};
+            virtualPresent.presentId = presentId;
+            virtualPresent.timelineValue = timelineValue;
+            m_virtualPresents.push_back(virtualPresent);
+        }
+        else {
+            vk::PresentIdKHR presentIdInfo{ 1, &presentId };
+            vk::PresentInfoKHR presentInfo{ 1, &image.presentReady, 1, &m_swapchain, &image.index };
+            if (m_waitForPresent != nullptr) {
+                presentInfo.pNext = &presentIdInfo;
+            }
+
+            vk::Result result = queue.presentKHR(&presentInfo);
+            if (result == vk::Result::eErrorOutOfDateKHR) {
+                m_outOfDate = true;
+                return;
+            }
+            if (result != vk::Result::eSuccess && result != vk::Result::eSuboptimalKHR) {
+                throw std::runtime_error("Failed to present a swapchain image");
+            }
+            if (result == vk::Result::eSuboptimalKHR) {
+                m_outOfDate = true;
+            }
+        }
+
+        if (m_firstPresentId == 0) {
+            m_firstPresentId = presentId;
+        }
+        m_lastPresentId = presentId;
+    }
+
+    bool Swapchain::waitForPresent(uint64_t presentId, Clock::time_point& shownTime)
+    {
+        if (m_firstPresentId == 0 || presentId < m_firstPresentId || presentId > m_lastPresentId) {
+            return false;
+        }
+
+        if (isVirtual()) {
+            pollVirtualPresents();
+            for (VirtualPresent& virtualPresent : m_virtualPresents) {
+                if (virtualPresent.presentId > presentId) {
+                    break;
+                }
+                // Schedules in order, so earlier presents hold their place on
+                // the display.
+                if (!virtualPresent.scheduled) {
+                    vk::SemaphoreWaitInfo waitInfo{};
+                    waitInfo.semaphoreCount = 1;
+                    waitInfo.pSemaphores = &m_frameTimeline;
+                    waitInfo.pValues = &virtualPresent.timelineValue;
+                    if (m_device.waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess) {
+                        throw std::runtime_error("Failed to wait for the frame timeline");
+                    }
+                    virtualPresent.shownTime = scheduleVirtualPresent(Clock::now());
+                    virtualPresent.scheduled = true;
+                }
+                if (virtualPresent.presentId == presentId) {
+                    shownTime = virtualPresent.shownTime;
+                    std::this_thread::sleep_until(shownTime);
+                    return true;
+                }
+            }
+            // Skipped, e.g. while resizing.
+            return false;
+        }
+
+        if (m_waitForPresent == nullptr) {
+            return false;
+        }
+        VkResult result = m_waitForPresent(m_device, m_swapchain, presentId, kPresentWaitTimeoutNs);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            m_outOfDate = true;
+            return false;
+        }
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            return false;
+        }
+        shownTime = Clock::now();
+        return true;
+    }
+
+    void Swapchain::resize(vk::Extent2D extent)
+    {
+        if (extent == m_requestedExtent && extent == m_extent) {
+            return;
+        }
+        m_requestedExtent = extent;
+        m_outOfDate = true;
+    }
+
+    vk::ImageLayout Swapchain::getPresentLayout() const
+    {
+        // Nothing reads virtual images, transfer source is what a compositor
+        // copying them out would want.
+        return isVirtual() ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+    }
+
+    void Swapchain::recreate()
+    {
+        m_outOfDate = false;
+        if (isVirtual()) {
+            releaseImages();
+            m_extent = m_requestedExtent;
+            createVirtualImages();
+        }
+        else {
+            createSurfaceSwapchain();
+        }
+    }
+
+    void Swapchain::createSurfaceSwapchain()
+    {
+        vk::SurfaceCapabilitiesKHR caps = m_physicalDevice.getSurfaceCapabilitiesKHR(m_surface);
+        if (!(caps.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferDst)) {
+            throw std::runtime_error("The surface doesn't support copying into its images");
+        }
+
+        // Surfaces that size themselves after the swapchain report UINT32_MAX.
+        vk::Extent2D extent = caps.currentExtent;
+        if (extent.width == UINT32_MAX) {
+            extent.width = std::min(std::max(m_requestedExtent.width, caps.minImageExtent.width), caps.maxImageExtent.width);
+            extent.height = std::min(std::max(m_requestedExtent.height, caps.minImageExtent.height), caps.maxImageExtent.height);
+        }
+        // Minimized. Try again at the next acquire.
+        if (extent.width == 0 || extent.height == 0) {
+            m_outOfDate = true;
+            return;
+        }
+
+        uint32_t imageCount = std::max(m_config.imageCount, caps.minImageCount);
+        if (caps.maxImageCount != 0) {
+            imageCount = std::min(imageCount, caps.maxImageCount);
+        }
+
+        vk::SurfaceFormatKHR format = chooseSurfaceFormat(m_physicalDevice, m_surface);
+        std::array<uint32_t, 2> families{ m_graphicsFamily, m_presentFamily };
+        bool concurrent = m_graphicsFamily != m_presentFamily;
+
+        // Creating from the old swapchain lets the presentation engine hand its
+        // images over without waiting for anything.
+        vk::SwapchainCreateInfoKHR createInfo{
+            vk::SwapchainCreateFlagsKHR{},
+            m_surface,
+            imageCount,
+            format.format,
+            format.colorSpace,
+            extent,
+            1, // Array layers
+            vk::ImageUsageFlagBits::eTransferDst,
+            concurrent ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
+            concurrent ? uint32_t(families.size()) : 0,
+            concurrent ? families.data() : nullptr,
+            caps.currentTransform,
+            chooseCompositeAlpha(caps.supportedCompositeAlpha),
+            toVkPresentMode(m_presentMode),
+            VK_TRUE, // Clipped
+            m_swapchain,
+        };
+        vk::SwapchainKHR swapchain = m_device.createSwapchainKHR(createInfo);
+
+        releaseImages();
+        m_swapchain = swapchain;
+        m_format = format.format;
+        m_extent = extent;
+        m_images = m_device.getSwapchainImagesKHR(m_swapchain);
+        for (size_t i = 0; i < m_images.size(); ++i) {
+            m_presentSemaphores.push_back(m_device.createSemaphore(vk::SemaphoreCreateInfo{}));
+        }
+        // Present ids start over with every swapchain.
+        m_firstPresentId = 0;
+        m_lastPresentId = 0;
+
+#ifndef NDEBUG
+        std::string message = "Swapchain ";
+        debugLog(message.append(std::to_string(extent.width)).append("x").append(std::to_string(extent.height))
+            .append(", ").append(std::to_string(m_images.size())).append(" images, ").append(toString(m_presentMode)).c_str());
+#endif
+    }
+
+    void Swapchain::createVirtualImages()
+    {
+        vk::ImageCreateInfo imageInfo{
+            vk::ImageCreateFlags{},
+            vk::ImageType::e2D,
+            m_format,
+            vk::Extent3D{ m_extent.width, m_extent.height, 1 },
+            1, // Mip levels
+            1, // Array layers
+            vk::SampleCountFlagBits::e1,
+            vk::ImageTiling::eOptimal,
+            vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc,
+        };
+
+        uint32_t imageCount = std::max(m_config.imageCount, 2u);
+        for (uint32_t i = 0; i < imageCount; ++i) {
+            m_virtualImages.push_back(m_renderer.getMemory().createImage(imageInfo));
+            m_images.push_back(m_virtualImages.back().image);
+        }
+        m_nextVirtualImage = 0;
+    }
+
+    void Swapchain::releaseImages()
+    {
+        // Frames in flight may still copy into the images, and presents wait on
+        // the semaphores until those frames are done.
+        if (m_swapchain) {
+            vk::Device device = m_device;
+            vk::SwapchainKHR swapchain = m_swapchain;
+            std::vector<vk::Semaphore> semaphores = std::move(m_presentSemaphores);
+            m_renderer.deferRelease([device, swapchain, semaphores]() {
+                for (vk::Semaphore semaphore : semaphores) {
+                    device.destroySemaphore(semaphore);
+                }
+                device.destroySwapchainKHR(swapchain);
+            });
+            m_swapchain = nullptr;
+        }
+        if (!m_virtualImages.empty()) {
+            GpuMemory* memory = &m_renderer.getMemory();
+            std::vector<Image> images = std::move(m_virtualImages);
+            m_renderer.deferRelease([memory, images]() mutable {
+                for (Image& image : images) {
+                    memory->destroyImage(image);
+                }
+            });
+        }
+        m_virtualImages.clear();
+        m_presentSemaphores.clear();
+        m_images.clear();
+    }
+
+    void Swapchain::pollVirtualPresents()
+    {
+        // Frames the GPU finished since the last poll count as finished now,
+        // which is as close as the timeline gets without waiting on it.
+        uint64_t completed = m_device.getSemaphoreCounterValue(m_frameTimeline);
+        Clock::time_point now = Clock::now();
+        for (VirtualPresent& virtualPresent : m_virtualPresents) {
+            if (virtualPresent.scheduled) {
+                continue;
+            }
+            if (virtualPresent.timelineValue > completed) {
+                break;
+            }
+            virtualPresent.shownTime = scheduleVirtualPresent(now);
+            virtualPresent.scheduled = true;
+        }
+
+        while (m_virtualPresents.size() > kMaxVirtualPresents && m_virtualPresents.front().scheduled) {
+            m_virtualPresents.pop_front();
+        }
+    }
+
+    Swapchain::Clock::time_point Swapchain::scheduleVirtualPresent(Clock::time_point readyTime)
+    {
+        Clock::time_point shownTime = readyTime;
+        switch (m_presentMode) {
+        case PresentMode::eImmediate:
+            break;
+        case PresentMode::eMailbox:
+            // Frames done within the same refresh replace each other, the last
+            // one is shown.
+            shownTime = nextBlank(m_virtualStart, m_virtualPeriod, readyTime);
+            break;
+        case PresentMode::eFifoRelaxed:
+            if (readyTime > m_lastShownTime + m_virtualPeriod) {
+                break;
+            }
+            shownTime = nextBlank(m_virtualStart, m_virtualPeriod, std::max(readyTime, m_lastShownTime + m_virtualPeriod));
+            break;
+        case PresentMode::eFifo:
+            // One frame per refresh, queued behind the ones before it.
+            shownTime = nextBlank(m_virtualStart, m_virtualPeriod, std::max(readyTime, m_lastShownTime + m_virtualPeriod));
+            break;
+        }
+        m_lastShownTime = std::max(m_lastShownTime, shownTime);
+        return shownTime;
+    }
+}
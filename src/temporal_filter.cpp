@@ -0,0 +1,711 @@
+#include "temporal_filter.h"
+#include "renderer.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace bvr
+{
+    namespace
+    {
+        const vk::Format kColorFormat = vk::Format::eR16G16B16A16Sfloat;
+        const vk::Format kVelocityFormat = vk::Format::eR16G16Sfloat;
+        // Two halves packed into one texel: 32 bit integers are storage
+        // formats everywhere, RG16F needs shaderStorageImageExtendedFormats.
+        const vk::Format kVelocityHistoryFormat = vk::Format::eR32Uint;
+        const vk::Format kDepthFormat = vk::Format::eD32Sfloat;
+        const vk::Format kTargetFormat = vk::Format::eR8G8B8A8Unorm;
+
+        // Matches SceneParams in shaders/temporal_scene.vert.
+        struct SceneParams
+        {
+            glm::mat4 jitteredViewProjection;
+            glm::mat4 viewProjection;
+            glm::mat4 previousViewProjection;
+            glm::vec4 lightDirection;
+        };
+
+        // Matches ResolveParams in shaders/taa_resolve.comp.
+        struct ResolveParams
+        {
+            // From this frame's clip space to the previous frame's, unjittered.
+            glm::mat4 reprojection;
+            // Jitter in render pixels in xy, render extent in zw.
+            glm::vec4 jitterRenderSize;
+            // Output extent in xy, its inverse in zw.
+            glm::vec4 outputSize;
+            // feedbackMin, feedbackMax, velocityRejection, and 1 with a valid
+            // history.
+            glm::vec4 feedback;
+        };
+
+        // Matches BlurConstants in shaders/motion_blur.frag.
+        struct BlurConstants
+        {
+            glm::vec4 outputSize;
+            float shutter;
+            float maxBlurPixels;
+            uint32_t sampleCount;
+            uint32_t padding;
+        };
+
+        float halton(uint32_t index, uint32_t base)
+        {
+            float result = 0.0f;
+            float fraction = 1.0f / float(base);
+            for (; index > 0; index /= base) {
+                result += fraction * float(index % base);
+                fraction /= float(base);
+            }
+            return result;
+        }
+
+        vk::DescriptorSet allocateSet(vk::Device device, vk::DescriptorPool pool, vk::DescriptorSetLayout layout)
+        {
+            return device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{ pool, 1, &layout })[0];
+        }
+
+        // A single subpass render pass with the given attachment formats, for
+        // creating pipelines compatible with the graph's render passes.
+        vk::RenderPass createCompatibleRenderPass(vk::Device device, const std::vector<vk::Format>& colorFormats, vk::Format depthFormat)
+        {
+            std::vector<vk::AttachmentDescription> attachments;
+            std::vector<vk::AttachmentReference> colorRefs;
+            for (vk::Format format : colorFormats) {
+                colorRefs.push_back(vk::AttachmentReference{ uint32_t(attachments.size()), vk::ImageLayout::eColorAttachmentOptimal });
+                attachments.push_back(vk::AttachmentDescription{
+                    vk::AttachmentDescriptionFlags{},
+                    format,
+                    vk::SampleCountFlagBits::e1,
+                    vk::AttachmentLoadOp::eClear,
+                    vk::AttachmentStoreOp::eStore,
+                    vk::AttachmentLoadOp::eDontCare,
+                    vk::AttachmentStoreOp::eDontCare,
+                    vk::ImageLayout::eColorAttachmentOptimal,
+                    vk::ImageLayout::eColorAttachmentOptimal,
+                });
+            }
+            vk::AttachmentReference depthRef{ uint32_t(attachments.size()), vk::ImageLayout::eDepthStencilAttachmentOptimal };
+            if (depthFormat != vk::Format::eUndefined) {
+                attachments.push_back(vk::AttachmentDescription{
+                    vk::AttachmentDescriptionFlags{},
+                    depthFormat,
+                    vk::SampleCountFlagBits::e1,
+                    vk::AttachmentLoadOp::eClear,
+                    vk::AttachmentStoreOp::eStore,
+                    vk::AttachmentLoadOp::eDontCare,
+                    vk::AttachmentStoreOp::eDontCare,
+                    vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                    vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                });
+            }
+            vk::SubpassDescription subpass{
+                vk::SubpassDescriptionFlags{},
+                vk::PipelineBindPoint::eGraphics,
+                0, nullptr, // Input attachments
+                uint32_t(colorRefs.size()), colorRefs.data(),
+                nullptr, // Resolve attachments
+                depthFormat != vk::Format::eUndefined ? &depthRef : nullptr,
+            };
+            return device.createRenderPass(vk::RenderPassCreateInfo{
+                vk::RenderPassCreateFlags{},
+                uint32_t(attachments.size()), attachments.data(),
+                1, &subpass,
+            });
+        }
+    }
+
+    TemporalFilter::TemporalFilter(Renderer& renderer, const TemporalConfig& config) :
+        m_renderer(renderer),
+        m_config(config),
+        m_outputExtent(renderer.getTargetExtent()),
+        m_ready(std::make_shared<std::atomic<bool>>(false))
+    {
+        if (config.jitterPhases == 0 || config.feedbackMin < 0.0f || config.feedbackMin > config.feedbackMax || config.feedbackMax >= 1.0f) {
+            throw std::runtime_error("Invalid temporal filter configuration");
+        }
+        createBuffers();
+        createPipelines();
+    }
+
+    TemporalFilter::~TemporalFilter()
+    {
+        m_renderer.getUploads().wait(m_uploadValue);
+
+        GpuMemory& memory = m_renderer.getMemory();
+        vk::Device device = m_renderer.getDevice();
+        std::vector<Buffer> buffers{ m_objectBuffer, m_vertices, m_indices };
+        std::vector<Image> images{ m_history[0], m_history[1], m_velocityHistory[0], m_velocityHistory[1] };
+        std::vector<vk::ImageView> views{ m_historyViews[0], m_historyViews[1], m_velocityHistoryViews[0], m_velocityHistoryViews[1] };
+        std::vector<vk::RenderPass> renderPasses{ m_sceneRenderPass, m_blurRenderPass };
+
+        // The pipelines, their layouts and the samplers belong to the pipeline
+        // cache, which drops the pipelines along with the render passes.
+        PipelineCache& pipelines = m_renderer.getPipelines();
+        RenderGraph& graph = m_renderer.getRenderGraph();
+        m_renderer.deferRelease([&memory, &pipelines, &graph, device, buffers, images, views, renderPasses]() mutable {
+            for (Buffer& buffer : buffers) {
+                memory.destroyBuffer(buffer);
+            }
+            for (vk::ImageView view : views) {
+                graph.releaseImportedView(view);
+                device.destroyImageView(view);
+            }
+            for (Image& image : images) {
+                memory.destroyImage(image);
+            }
+            for (vk::RenderPass renderPass : renderPasses) {
+                pipelines.releaseRenderPass(renderPass);
+                device.destroyRenderPass(renderPass);
+            }
+        });
+    }
+
+    void TemporalFilter::createBuffers()
+    {
+        GpuMemory& memory = m_renderer.getMemory();
+        UploadQueue& uploads = m_renderer.getUploads();
+        vk::Device device = m_renderer.getDevice();
+
+        auto createHistoryImage = [&memory, device, this](vk::Format format, Image& image, vk::ImageView& view) {
+            image = memory.createImage(vk::ImageCreateInfo{
+                vk::ImageCreateFlags{},
+                vk::ImageType::e2D,
+                format,
+                vk::Extent3D{ m_outputExtent.width, m_outputExtent.height, 1 },
+                1,
+                1,
+                vk::SampleCountFlagBits::e1,
+                vk::ImageTiling::eOptimal,
+                vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled,
+            });
+            view = device.createImageView(vk::ImageViewCreateInfo{
+                vk::ImageViewCreateFlags{},
+                image.image,
+                vk::ImageViewType::e2D,
+                format,
+                vk::ComponentMapping{},
+                vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 },
+            });
+        };
+        for (uint32_t i = 0; i < 2; ++i) {
+            createHistoryImage(kColorFormat, m_history[i], m_historyViews[i]);
+            createHistoryImage(kVelocityHistoryFormat, m_velocityHistory[i], m_velocityHistoryViews[i]);
+        }
+
+        // Written by the "temporal_objects" pass as objects change.
+        m_objectBuffer = memory.createBuffer(vk::BufferCreateInfo{
+            vk::BufferCreateFlags{},
+            vk::DeviceSize(std::max(m_config.maxObjects, 1u)) * sizeof(ObjectData),
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        }, MemoryUsage::eGpuOnly);
+
+        BuiltinMeshGeometry geometry = buildBuiltinMeshes();
+        m_meshRanges = geometry.ranges;
+        vk::DeviceSize vertexBytes = geometry.vertices.size() * sizeof(glm::vec3);
+        vk::DeviceSize indexBytes = geometry.indices.size() * sizeof(uint32_t);
+        m_vertices = memory.createBuffer(vk::BufferCreateInfo{
+            vk::BufferCreateFlags{},
+            vertexBytes,
+            vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        }, MemoryUsage::eGpuOnly);
+        m_indices = memory.createBuffer(vk::BufferCreateInfo{
+            vk::BufferCreateFlags{},
+            indexBytes,
+            vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        }, MemoryUsage::eGpuOnly);
+        uploads.uploadBuffer(m_vertices.buffer, 0, geometry.vertices.data(), vertexBytes);
+        uploads.uploadBuffer(m_indices.buffer, 0, geometry.indices.data(), indexBytes);
+
+        m_uploadValue = uploads.flush();
+        std::shared_ptr<std::atomic<bool>> ready = m_ready;
+        uploads.whenAcquired(m_uploadValue, [ready]() {
+            ready->store(true, std::memory_order_release);
+        });
+    }
+
+    void TemporalFilter::createPipelines()
+    {
+        vk::Device device = m_renderer.getDevice();
+        PipelineCache& pipelines = m_renderer.getPipelines();
+
+        auto createSampler = [&pipelines](vk::Filter filter) {
+            return pipelines.getSampler(vk::SamplerCreateInfo{
+                vk::SamplerCreateFlags{},
+                filter,
+                filter,
+                vk::SamplerMipmapMode::eNearest,
+                vk::SamplerAddressMode::eClampToEdge,
+                vk::SamplerAddressMode::eClampToEdge,
+                vk::SamplerAddressMode::eClampToEdge,
+                0.0f,
+                VK_FALSE,
+                1.0f,
+                VK_FALSE,
+                vk::CompareOp::eNever,
+                0.0f,
+                0.0f,
+            });
+        };
+        m_pointSampler = createSampler(vk::Filter::eNearest);
+        m_linearSampler = createSampler(vk::Filter::eLinear);
+
+        using Type = vk::DescriptorType;
+        const vk::ShaderStageFlags compute = vk::ShaderStageFlagBits::eCompute;
+        const vk::ShaderStageFlags fragment = vk::ShaderStageFlagBits::eFragment;
+        std::array<vk::DescriptorSetLayoutBinding, 2> sceneBindings{
+            vk::DescriptorSetLayoutBinding{ 0, Type::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment },
+            vk::DescriptorSetLayoutBinding{ 1, Type::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex },
+        };
+        std::array<vk::DescriptorSetLayoutBinding, 8> resolveBindings{
+            vk::DescriptorSetLayoutBinding{ 0, Type::eUniformBuffer, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 1, Type::eCombinedImageSampler, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 2, Type::eCombinedImageSampler, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 3, Type::eCombinedImageSampler, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 4, Type::eCombinedImageSampler, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 5, Type::eCombinedImageSampler, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 6, Type::eStorageImage, 1, compute },
+            vk::DescriptorSetLayoutBinding{ 7, Type::eStorageImage, 1, compute },
+        };
+        std::array<vk::DescriptorSetLayoutBinding, 2> blurBindings{
+            vk::DescriptorSetLayoutBinding{ 0, Type::eCombinedImageSampler, 1, fragment },
+            vk::DescriptorSetLayoutBinding{ 1, Type::eCombinedImageSampler, 1, fragment },
+        };
+        m_sceneSetLayout = pipelines.getDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{
+            vk::DescriptorSetLayoutCreateFlags{}, uint32_t(sceneBindings.size()), sceneBindings.data() });
+        m_resolveSetLayout = pipelines.getDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{
+            vk::DescriptorSetLayoutCreateFlags{}, uint32_t(resolveBindings.size()), resolveBindings.data() });
+        m_blurSetLayout = pipelines.getDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{
+            vk::DescriptorSetLayoutCreateFlags{}, uint32_t(blurBindings.size()), blurBindings.data() });
+
+        vk::PushConstantRange blurConstants{ vk::ShaderStageFlagBits::eFragment, 0, sizeof(BlurConstants) };
+        m_sceneLayout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+            vk::PipelineLayoutCreateFlags{}, 1, &m_sceneSetLayout, 0, nullptr });
+        m_resolveLayout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+            vk::PipelineLayoutCreateFlags{}, 1, &m_resolveSetLayout, 0, nullptr });
+        m_blurLayout = pipelines.getPipelineLayout(vk::PipelineLayoutCreateInfo{
+            vk::PipelineLayoutCreateFlags{}, 1, &m_blurSetLayout, 1, &blurConstants });
+
+        m_resolvePipeline = pipelines.getComputePipeline(vk::ComputePipelineCreateInfo{
+            vk::PipelineCreateFlags{},
+            vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eCompute, m_renderer.createEmbeddedShaderModule("taa_resolve.comp"), "main" },
+            m_resolveLayout,
+        });
+
+        // Same formats as the "temporal_scene" and "motion_blur" passes'
+        // attachments, which is all render pass compatibility asks for.
+        m_sceneRenderPass = createCompatibleRenderPass(device, { kColorFormat, kVelocityFormat }, kDepthFormat);
+        m_blurRenderPass = createCompatibleRenderPass(device, { kTargetFormat }, vk::Format::eUndefined);
+
+        vk::PipelineInputAssemblyStateCreateInfo inputAssembly{ vk::PipelineInputAssemblyStateCreateFlags{}, vk::PrimitiveTopology::eTriangleList };
+        vk::PipelineViewportStateCreateInfo viewportState{ vk::PipelineViewportStateCreateFlags{}, 1, nullptr, 1, nullptr };
+        vk::PipelineRasterizationStateCreateInfo rasterization{};
+        rasterization.polygonMode = vk::PolygonMode::eFill;
+        rasterization.cullMode = vk::CullModeFlagBits::eNone;
+        rasterization.frontFace = vk::FrontFace::eCounterClockwise;
+        rasterization.lineWidth = 1.0f;
+        vk::PipelineMultisampleStateCreateInfo multisample{};
+        vk::PipelineColorBlendAttachmentState blendAttachment{};
+        blendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+            vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+        std::array<vk::PipelineColorBlendAttachmentState, 2> blendAttachments{ blendAttachment, blendAttachment };
+        std::array<vk::DynamicState, 2> dynamicStates{ vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+        vk::PipelineDynamicStateCreateInfo dynamicState{ vk::PipelineDynamicStateCreateFlags{}, uint32_t(dynamicStates.size()), dynamicStates.data() };
+
+        // Objects, into color and velocity.
+        {
+            std::array<vk::PipelineShaderStageCreateInfo, 2> stages{
+                vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eVertex, m_renderer.createEmbeddedShaderModule("temporal_scene.vert"), "main" },
+                vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eFragment, m_renderer.createEmbeddedShaderModule("temporal_scene.frag"), "main" },
+            };
+            vk::VertexInputBindingDescription vertexBinding{ 0, sizeof(glm::vec3), vk::VertexInputRate::eVertex };
+            vk::VertexInputAttributeDescription positionAttribute{ 0, 0, vk::Format::eR32G32B32Sfloat, 0 };
+            vk::PipelineVertexInputStateCreateInfo vertexInput{ vk::PipelineVertexInputStateCreateFlags{}, 1, &vertexBinding, 1, &positionAttribute };
+            vk::PipelineDepthStencilStateCreateInfo depthStencil{};
+            depthStencil.depthTestEnable = VK_TRUE;
+            depthStencil.depthWriteEnable = VK_TRUE;
+            depthStencil.depthCompareOp = vk::CompareOp::eLess;
+            vk::PipelineColorBlendStateCreateInfo colorBlend{};
+            colorBlend.attachmentCount = uint32_t(blendAttachments.size());
+            colorBlend.pAttachments = blendAttachments.data();
+
+            vk::GraphicsPipelineCreateInfo pipelineInfo{};
+            pipelineInfo.stageCount = uint32_t(stages.size());
+            pipelineInfo.pStages = stages.data();
+            pipelineInfo.pVertexInputState = &vertexInput;
+            pipelineInfo.pInputAssemblyState = &inputAssembly;
+            pipelineInfo.pViewportState = &viewportState;
+            pipelineInfo.pRasterizationState = &rasterization;
+            pipelineInfo.pMultisampleState = &multisample;
+            pipelineInfo.pDepthStencilState = &depthStencil;
+            pipelineInfo.pColorBlendState = &colorBlend;
+            pipelineInfo.pDynamicState = &dynamicState;
+            pipelineInfo.layout = m_sceneLayout;
+            pipelineInfo.renderPass = m_sceneRenderPass;
+            pipelineInfo.subpass = 0;
+            m_scenePipeline = pipelines.getGraphicsPipeline(pipelineInfo);
+        }
+
+        // A full screen triangle, positioned by gl_VertexIndex.
+        {
+            std::array<vk::PipelineShaderStageCreateInfo, 2> stages{
+                vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eVertex, m_renderer.createEmbeddedShaderModule("fullscreen.vert"), "main" },
+                vk::PipelineShaderStageCreateInfo{ vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eFragment, m_renderer.createEmbeddedShaderModule("motion_blur.frag"), "main" },
+            };
+            vk::PipelineVertexInputStateCreateInfo vertexInput{};
+            vk::PipelineDepthStencilStateCreateInfo depthStencil{};
+            vk::PipelineColorBlendStateCreateInfo colorBlend{};
+            colorBlend.attachmentCount = 1;
+            colorBlend.pAttachments = &blendAttachment;
+
+            vk::GraphicsPipelineCreateInfo pipelineInfo{};
+            pipelineInfo.stageCount = uint32_t(stages.size());
+            pipelineInfo.pStages = stages.data();
+            pipelineInfo.pVertexInputState = &vertexInput;
+            pipelineInfo.pInputAssemblyState = &inputAssembly;
+            pipelineInfo.pViewportState = &viewportState;
+            pipelineInfo.pRasterizationState = &rasterization;
+            pipelineInfo.pMultisampleState = &multisample;
+            pipelineInfo.pDepthStencilState = &depthStencil;
+            pipelineInfo.pColorBlendState = &colorBlend;
+            pipelineInfo.pDynamicState = &dynamicState;
+            pipelineInfo.layout = m_blurLayout;
+            pipelineInfo.renderPass = m_blurRenderPass;
+            pipelineInfo.subpass = 0;
+            m_blurPipeline = pipelines.getGraphicsPipeline(pipelineInfo);
+        }
+    }
+
+    TemporalObjectHandle TemporalFilter::addObject(const glm::mat4& transform, const glm::vec4& color, BuiltinMesh mesh)
+    {
+        uint32_t index = UINT32_MAX;
+        if (!m_freeObjects.empty()) {
+            index = m_freeObjects.back();
+            m_freeObjects.pop_back();
+        }
+        else if (m_objects.size() < m_config.maxObjects) {
+            index = uint32_t(m_objects.size());
+            m_objects.emplace_back();
+            m_objectMeshes.push_back(0);
+            m_objectAlive.push_back(false);
+            m_objectDirty.push_back(false);
+            m_objectMoved.push_back(false);
+        }
+        else {
+            std::string errorString{ "Temporal objects exceed the limit of " };
+            throw std::runtime_error(errorString.append(std::to_string(m_config.maxObjects)));
+        }
+
+        // A new object hasn't moved yet, wherever the slot's last one was.
+        m_objects[index] = ObjectData{ transform, transform, color };
+        m_objectMeshes[index] = uint32_t(mesh);
+        m_objectAlive[index] = true;
+        markObjectDirty(index);
+        ++m_objectCount;
+        return TemporalObjectHandle{ index };
+    }
+
+    void TemporalFilter::moveObject(TemporalObjectHandle handle, const glm::mat4& transform)
+    {
+        uint32_t index = handle.index;
+        ObjectData& object = m_objects[index];
+        if (object.world == transform) {
+            return;
+        }
+        if (!m_objectMoved[index]) {
+            m_objectMoved[index] = true;
+            m_movedObjects.push_back(index);
+            object.previousWorld = object.world;
+        }
+        object.world = transform;
+        markObjectDirty(index);
+    }
+
+    void TemporalFilter::removeObject(TemporalObjectHandle handle)
+    {
+        uint32_t index = handle.index;
+        if (!handle.isValid() || !m_objectAlive[index]) {
+            return;
+        }
+        m_objectAlive[index] = false;
+        m_freeObjects.push_back(index);
+        --m_objectCount;
+    }
+
+    void TemporalFilter::setLightDirection(const glm::vec3& direction)
+    {
+        m_lightDirection = direction;
+    }
+
+    void TemporalFilter::markObjectDirty(uint32_t index)
+    {
+        if (!m_objectDirty[index]) {
+            m_objectDirty[index] = true;
+            m_dirtyObjects.push_back(index);
+        }
+    }
+
+    glm::vec2 TemporalFilter::nextJitter(float renderScale)
+    {
+        uint32_t phases = uint32_t(std::ceil(float(m_config.jitterPhases) / (renderScale * renderScale)));
+        m_stats.jitterPhases = phases;
+        // Halton from 1, since index 0 is the pixel's corner in both bases.
+        uint32_t index = m_jitterIndex++ % phases + 1;
+        return glm::vec2(halton(index, 2), halton(index, 3)) - 0.5f;
+    }
+
+    void TemporalFilter::addPasses(RenderGraph& graph, FrameContext& frame, const TemporalCamera& camera, GraphResource target)
+    {
+        BVR_PROFILE_ZONE("temporal_update");
+        if (!isReady()) {
+            throw std::runtime_error("TemporalFilter used before its meshes were uploaded");
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+
+        m_stats = TemporalStats{};
+        m_stats.renderScale = frame.renderScale;
+        m_stats.renderExtent = vk::Extent2D{
+            std::min(frame.renderExtent.width, m_outputExtent.width),
+            std::min(frame.renderExtent.height, m_outputExtent.height),
+        };
+        m_stats.objects = m_objectCount;
+        m_stats.historyValid = m_historyValid;
+        const vk::Extent2D renderExtent = m_stats.renderExtent;
+
+        // Objects that moved last frame but not in this one stop moving: their
+        // previous transform catches up.
+        for (uint32_t index : m_settlingObjects) {
+            if (!m_objectMoved[index]) {
+                m_objects[index].previousWorld = m_objects[index].world;
+                markObjectDirty(index);
+            }
+        }
+        m_settlingObjects.swap(m_movedObjects);
+        m_movedObjects.clear();
+        for (uint32_t index : m_settlingObjects) {
+            m_objectMoved[index] = false;
+        }
+
+        // The jitter is a fraction of a render pixel, which is a larger share of
+        // clip space at lower render scales.
+        glm::vec2 jitter = nextJitter(frame.renderScale);
+        m_stats.jitter = jitter;
+        glm::mat4 jitterOffset = glm::translate(glm::mat4(1.0f), glm::vec3(
+            2.0f * jitter.x / float(renderExtent.width),
+            2.0f * jitter.y / float(renderExtent.height),
+            0.0f
+        ));
+        glm::mat4 viewProjection = camera.projection * camera.view;
+        if (!m_historyValid) {
+            m_previousViewProjection = viewProjection;
+        }
+
+        FrameRingAllocator& ring = m_renderer.getMemory().getFrameRing();
+        RingAllocation sceneUpload = ring.allocate(sizeof(SceneParams));
+        RingAllocation resolveUpload = ring.allocate(sizeof(ResolveParams));
+        if (!sceneUpload.buffer || !resolveUpload.buffer) {
+            throw std::runtime_error("Frame ring exhausted by the temporal filter parameters");
+        }
+        SceneParams sceneParams{};
+        sceneParams.jitteredViewProjection = jitterOffset * viewProjection;
+        sceneParams.viewProjection = viewProjection;
+        sceneParams.previousViewProjection = m_previousViewProjection;
+        sceneParams.lightDirection = glm::vec4(glm::normalize(m_lightDirection), 0.0f);
+        memcpy(sceneUpload.mapped, &sceneParams, sizeof(sceneParams));
+
+        ResolveParams resolveParams{};
+        resolveParams.reprojection = m_previousViewProjection * glm::inverse(viewProjection);
+        resolveParams.jitterRenderSize = glm::vec4(jitter, float(renderExtent.width), float(renderExtent.height));
+        resolveParams.outputSize = glm::vec4(
+            float(m_outputExtent.width), float(m_outputExtent.height),
+            1.0f / float(m_outputExtent.width), 1.0f / float(m_outputExtent.height)
+        );
+        resolveParams.feedback = glm::vec4(m_config.feedbackMin, m_config.feedbackMax, m_config.velocityRejection, m_historyValid ? 1.0f : 0.0f);
+        memcpy(resolveUpload.mapped, &resolveParams, sizeof(resolveParams));
+        m_previousViewProjection = viewProjection;
+
+        // Earlier frames may still be drawing with the object data.
+        GraphResource objects = graph.importBuffer(
+            "temporal_objects",
+            m_objectBuffer.buffer,
+            m_objectBuffer.size,
+            GraphImportState{ vk::ImageLayout::eUndefined, vk::PipelineStageFlagBits::eVertexShader, vk::AccessFlagBits::eShaderRead }
+        );
+        if (!m_dirtyObjects.empty()) {
+            RingAllocation upload = ring.allocate(m_dirtyObjects.size() * sizeof(ObjectData));
+            if (!upload.buffer) {
+                throw std::runtime_error("Frame ring exhausted by the temporal object data");
+            }
+            std::vector<vk::BufferCopy> regions;
+            regions.reserve(m_dirtyObjects.size());
+            for (size_t i = 0; i < m_dirtyObjects.size(); ++i) {
+                uint32_t object = m_dirtyObjects[i];
+                memcpy(static_cast<uint8_t*>(upload.mapped) + i * sizeof(ObjectData), &m_objects[object], sizeof(ObjectData));
+                regions.push_back(vk::BufferCopy{ upload.offset + i * sizeof(ObjectData), object * sizeof(ObjectData), sizeof(ObjectData) });
+                m_objectDirty[object] = false;
+            }
+            m_stats.objectsUploaded = uint32_t(m_dirtyObjects.size());
+            m_dirtyObjects.clear();
+
+            graph.addPass("temporal_objects", GraphPassType::eTransfer)
+                .write(objects, GraphAccess::eTransferWrite)
+                .record([upload, regions, objects](RenderGraphContext& context) {
+                    context.getCommandBuffer().copyBuffer(upload.buffer, context.getBuffer(objects), regions);
+                });
+        }
+
+        // Uploads are acquired before the frame is recorded and nothing on the
+        // GPU writes these, so they need no barriers.
+        GraphResource vertices = graph.importBuffer("temporal_mesh_vertices", m_vertices.buffer, m_vertices.size);
+        GraphResource indices = graph.importBuffer("temporal_mesh_indices", m_indices.buffer, m_indices.size);
+
+        // Full size, so they don't change with the render scale and the graph
+        // keeps reusing the same transients. Only renderExtent of them is drawn.
+        GraphImageDesc sceneDesc{};
+        sceneDesc.width = m_outputExtent.width;
+        sceneDesc.height = m_outputExtent.height;
+        sceneDesc.format = kColorFormat;
+        GraphResource color = graph.createImage("temporal_color", sceneDesc);
+        sceneDesc.format = kVelocityFormat;
+        GraphResource velocity = graph.createImage("temporal_velocity", sceneDesc);
+        sceneDesc.format = kDepthFormat;
+        GraphResource depth = graph.createImage("temporal_depth", sceneDesc);
+
+        // The histories stay readable between frames, where "motion_blur" and
+        // the next "taa_resolve" read them. Without a valid history, their
+        // contents are discarded.
+        GraphImageDesc historyDesc{};
+        historyDesc.format = kColorFormat;
+        historyDesc.width = m_outputExtent.width;
+        historyDesc.height = m_outputExtent.height;
+        GraphImageDesc velocityHistoryDesc = historyDesc;
+        velocityHistoryDesc.format = kVelocityHistoryFormat;
+        GraphImportState readState{
+            vk::ImageLayout::eShaderReadOnlyOptimal,
+            vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,
+            vk::AccessFlagBits::eShaderRead,
+        };
+        GraphImportState initialState = m_historyInitialized ? readState : GraphImportState{};
+        uint32_t read = m_historyIndex;
+        uint32_t written = 1 - m_historyIndex;
+        GraphResource historyIn = graph.importImage("taa_history_in", m_history[read].image, m_historyViews[read], historyDesc, initialState, readState);
+        GraphResource historyOut = graph.importImage("taa_history_out", m_history[written].image, m_historyViews[written], historyDesc, initialState, readState);
+        GraphResource velocityHistoryIn = graph.importImage(
+            "taa_velocity_history_in", m_velocityHistory[read].image, m_velocityHistoryViews[read], velocityHistoryDesc, initialState, readState);
+        GraphResource velocityHistoryOut = graph.importImage(
+            "taa_velocity_history_out", m_velocityHistory[written].image, m_velocityHistoryViews[written], velocityHistoryDesc, initialState, readState);
+        m_historyIndex = written;
+        m_historyInitialized = true;
+        m_historyValid = true;
+
+        vk::Device device = m_renderer.getDevice();
+        graph.addPass("temporal_scene", GraphPassType::eRaster)
+            .read(objects, GraphAccess::eStorageReadVertex)
+            .read(vertices, GraphAccess::eVertexRead)
+            .read(indices, GraphAccess::eIndexRead)
+            .colorAttachment(color, vk::AttachmentLoadOp::eClear, vk::ClearColorValue{ std::array<float, 4>{ 0.1f, 0.1f, 0.12f, 1.0f } })
+            .colorAttachment(velocity, vk::AttachmentLoadOp::eClear)
+            .depthAttachment(depth, vk::AttachmentLoadOp::eClear)
+            .record([this, device, &frame, sceneUpload, renderExtent](RenderGraphContext& context) {
+                vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                vk::DescriptorSet set = allocateSet(device, frame.descriptorPool, m_sceneSetLayout);
+                vk::DescriptorBufferInfo paramsInfo{ sceneUpload.buffer, sceneUpload.offset, sizeof(SceneParams) };
+                vk::DescriptorBufferInfo objectsInfo{ m_objectBuffer.buffer, 0, VK_WHOLE_SIZE };
+                std::array<vk::WriteDescriptorSet, 2> writes{
+                    vk::WriteDescriptorSet{ set, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &paramsInfo },
+                    vk::WriteDescriptorSet{ set, 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &objectsInfo },
+                };
+                device.updateDescriptorSets(writes, nullptr);
+
+                commandBuffer.setViewport(0, vk::Viewport{ 0.0f, 0.0f, float(renderExtent.width), float(renderExtent.height), 0.0f, 1.0f });
+                commandBuffer.setScissor(0, vk::Rect2D{ vk::Offset2D{ 0, 0 }, renderExtent });
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_scenePipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_sceneLayout, 0, set, nullptr);
+                commandBuffer.bindVertexBuffers(0, m_vertices.buffer, vk::DeviceSize{ 0 });
+                commandBuffer.bindIndexBuffer(m_indices.buffer, 0, vk::IndexType::eUint32);
+
+                // firstInstance carries the object's slot, as in the instance
+                // culler's draws.
+                for (uint32_t i = 0; i < m_objects.size(); ++i) {
+                    if (m_objectAlive[i]) {
+                        const BuiltinMeshRange& mesh = m_meshRanges[m_objectMeshes[i]];
+                        commandBuffer.drawIndexed(mesh.indexCount, 1, mesh.firstIndex, mesh.vertexOffset, i);
+                    }
+                }
+            });
+
+        graph.addPass("taa_resolve", GraphPassType::eCompute)
+            .read(color, GraphAccess::eSampledCompute)
+            .read(velocity, GraphAccess::eSampledCompute)
+            .read(depth, GraphAccess::eSampledCompute)
+            .read(historyIn, GraphAccess::eSampledCompute)
+            .read(velocityHistoryIn, GraphAccess::eSampledCompute)
+            .write(historyOut, GraphAccess::eStorageWriteCompute)
+            .write(velocityHistoryOut, GraphAccess::eStorageWriteCompute)
+            .record([this, device, &frame, resolveUpload, color, velocity, depth, read, written](RenderGraphContext& context) {
+                vk::DescriptorSet set = allocateSet(device, frame.descriptorPool, m_resolveSetLayout);
+                vk::DescriptorBufferInfo paramsInfo{ resolveUpload.buffer, resolveUpload.offset, sizeof(ResolveParams) };
+                const vk::ImageLayout readLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+                std::array<vk::DescriptorImageInfo, 5> sampled{
+                    vk::DescriptorImageInfo{ m_pointSampler, context.getImageView(color), readLayout },
+                    vk::DescriptorImageInfo{ m_pointSampler, context.getImageView(velocity), readLayout },
+                    vk::DescriptorImageInfo{ m_pointSampler, context.getImageView(depth), readLayout },
+                    vk::DescriptorImageInfo{ m_linearSampler, m_historyViews[read], readLayout },
+                    vk::DescriptorImageInfo{ m_pointSampler, m_velocityHistoryViews[read], readLayout },
+                };
+                std::array<vk::DescriptorImageInfo, 2> storage{
+                    vk::DescriptorImageInfo{ vk::Sampler{}, m_historyViews[written], vk::ImageLayout::eGeneral },
+                    vk::DescriptorImageInfo{ vk::Sampler{}, m_velocityHistoryViews[written], vk::ImageLayout::eGeneral },
+                };
+                std::array<vk::WriteDescriptorSet, 3> writes{
+                    vk::WriteDescriptorSet{ set, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &paramsInfo },
+                    vk::WriteDescriptorSet{ set, 1, 0, uint32_t(sampled.size()), vk::DescriptorType::eCombinedImageSampler, sampled.data() },
+                    vk::WriteDescriptorSet{ set, 6, 0, uint32_t(storage.size()), vk::DescriptorType::eStorageImage, storage.data() },
+                };
+                device.updateDescriptorSets(writes, nullptr);
+
+                vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_resolvePipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_resolveLayout, 0, set, nullptr);
+                commandBuffer.dispatch((m_outputExtent.width + 7) / 8, (m_outputExtent.height + 7) / 8, 1);
+            });
+
+        // Always runs, as the copy into the target. Without motion blur it
+        // takes a single sample.
+        BlurConstants blurConstants{};
+        blurConstants.outputSize = resolveParams.outputSize;
+        blurConstants.shutter = m_config.shutter;
+        blurConstants.maxBlurPixels = m_config.maxBlurPixels;
+        blurConstants.sampleCount = m_config.motionBlur ? std::max(m_config.motionBlurSamples, 1u) : 1u;
+        graph.addPass("motion_blur", GraphPassType::eRaster)
+            .read(historyOut, GraphAccess::eSampledFragment)
+            .read(velocityHistoryOut, GraphAccess::eSampledFragment)
+            .colorAttachment(target, vk::AttachmentLoadOp::eDontCare)
+            .record([this, device, &frame, blurConstants, written](RenderGraphContext& context) {
+                vk::CommandBuffer commandBuffer = context.getCommandBuffer();
+                vk::DescriptorSet set = allocateSet(device, frame.descriptorPool, m_blurSetLayout);
+                std::array<vk::DescriptorImageInfo, 2> sampled{
+                    vk::DescriptorImageInfo{ m_linearSampler, m_historyViews[written], vk::ImageLayout::eShaderReadOnlyOptimal },
+                    vk::DescriptorImageInfo{ m_pointSampler, m_velocityHistoryViews[written], vk::ImageLayout::eShaderReadOnlyOptimal },
+                };
+                device.updateDescriptorSets(
+                    vk::WriteDescriptorSet{ set, 0, 0, uint32_t(sampled.size()), vk::DescriptorType::eCombinedImageSampler, sampled.data() }, nullptr);
+
+                vk::Extent2D extent = context.getExtent();
+                commandBuffer.setViewport(0, vk::Viewport{ 0.0f, 0.0f, float(extent.width), float(extent.height), 0.0f, 1.0f });
+                commandBuffer.setScissor(0, vk::Rect2D{ vk::Offset2D{ 0, 0 }, extent });
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_blurPipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_blurLayout, 0, set, nullptr);
+                commandBuffer.pushConstants(m_blurLayout, vk::ShaderStageFlagBits::eFragment, 0, sizeof(BlurConstants), &blurConstants);
+                commandBuffer.draw(3, 1, 0, 0);
+            });
+
+        m_stats.cpuUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+}
@@ -0,0 +1,343 @@
+#include "texture_compressor.h"
+#include "job_system.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        enum class BlockLayout
+        {
+            eBc1,
+            eBc3,
+            eBc4,
+            eBc5,
+        };
+
+        const float* getSrgbToLinearTable()
+        {
+            static const std::vector<float> table = []() {
+                std::vector<float> values(256);
+                for (uint32_t i = 0; i < 256; ++i) {
+                    float c = float(i) / 255.0f;
+                    values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+                }
+                return values;
+            }();
+            return table.data();
+        }
+
+        uint8_t linearToSrgb(float linear)
+        {
+            float c = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+            return uint8_t(std::lround(glm::clamp(c, 0.0f, 1.0f) * 255.0f));
+        }
+
+        uint16_t packRgb565(const glm::vec3& color)
+        {
+            glm::vec3 c = glm::clamp(color, 0.0f, 255.0f);
+            uint32_t r = uint32_t(std::lround(c.r * 31.0f / 255.0f));
+            uint32_t g = uint32_t(std::lround(c.g * 63.0f / 255.0f));
+            uint32_t b = uint32_t(std::lround(c.b * 31.0f / 255.0f));
+            return uint16_t((r << 11) | (g << 5) | b);
+        }
+
+        glm::vec3 unpackRgb565(uint16_t packed)
+        {
+            uint32_t r = (packed >> 11) & 31;
+            uint32_t g = (packed >> 5) & 63;
+            uint32_t b = packed & 31;
+            return glm::vec3(float((r << 3) | (r >> 2)), float((g << 2) | (g >> 4)), float((b << 3) | (b >> 2)));
+        }
+
+        // Picks the closest of the four colors for every texel and returns the
+        // squared error. The block is always in four color mode: `c0` > `c1`, or
+        // equal, in which case every texel takes c0.
+        float fitColorIndices(const glm::vec3* texels, uint16_t c0, uint16_t c1, uint32_t& indices)
+        {
+            glm::vec3 e0 = unpackRgb565(c0);
+            glm::vec3 e1 = unpackRgb565(c1);
+            const glm::vec3 palette[4] = { e0, e1, (2.0f * e0 + e1) / 3.0f, (e0 + 2.0f * e1) / 3.0f };
+
+            indices = 0;
+            float error = 0.0f;
+            for (uint32_t i = 0; i < 16; ++i) {
+                uint32_t best = 0;
+                float bestDistance = FLT_MAX;
+                for (uint32_t p = 0; p < (c0 == c1 ? 1u : 4u); ++p) {
+                    glm::vec3 d = texels[i] - palette[p];
+                    float distance = glm::dot(d, d);
+                    if (distance < bestDistance) {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+                indices |= best << (i * 2);
+                error += bestDistance;
+            }
+            return error;
+        }
+
+        void orderEndpoints(uint16_t& c0, uint16_t& c1)
+        {
+            if (c0 < c1) {
+                std::swap(c0, c1);
+            }
+        }
+
+        void encodeColorBlock(const glm::vec3* texels, uint8_t* out)
+        {
+            glm::vec3 mean{ 0.0f };
+            for (uint32_t i = 0; i < 16; ++i) {
+                mean += texels[i];
+            }
+            mean /= 16.0f;
+
+            // Principal axis of the block's colors, by power iteration on their
+            // covariance.
+            float xx = 0.0f, xy = 0.0f, xz = 0.0f, yy = 0.0f, yz = 0.0f, zz = 0.0f;
+            for (uint32_t i = 0; i < 16; ++i) {
+                glm::vec3 d = texels[i] - mean;
+                xx += d.x * d.x;
+                xy += d.x * d.y;
+                xz += d.x * d.z;
+                yy += d.y * d.y;
+                yz += d.y * d.z;
+                zz += d.z * d.z;
+            }
+            glm::vec3 axis{ 1.0f, 1.0f, 1.0f };
+            for (uint32_t iteration = 0; iteration < 4; ++iteration) {
+                axis = glm::vec3(xx * axis.x + xy * axis.y + xz * axis.z, xy * axis.x + yy * axis.y + yz * axis.z, xz * axis.x + yz * axis.y + zz * axis.z);
+                float length = glm::length(axis);
+                if (length < 1e-6f) {
+                    axis = glm::vec3(0.57735f);
+                    break;
+                }
+                axis /= length;
+            }
+
+            float minProjection = FLT_MAX;
+            float maxProjection = -FLT_MAX;
+            for (uint32_t i = 0; i < 16; ++i) {
+                float projection = glm::dot(texels[i] - mean, axis);
+                minProjection = std::min(minProjection, projection);
+                maxProjection = std::max(maxProjection, projection);
+            }
+            // Pulling the endpoints in a little lowers the error of the
+            // interpolated colors more than it costs at the extremes.
+            float inset = (maxProjection - minProjection) / 16.0f;
+            uint16_t c0 = packRgb565(mean + axis * (maxProjection - inset));
+            uint16_t c1 = packRgb565(mean + axis * (minProjection + inset));
+            orderEndpoints(c0, c1);
+            uint32_t indices = 0;
+            float error = fitColorIndices(texels, c0, c1, indices);
+
+            // One least squares pass over the endpoints, given those indices.
+            if (c0 != c1) {
+                static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+                float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+                glm::vec3 ax{ 0.0f };
+                glm::vec3 bx{ 0.0f };
+                for (uint32_t i = 0; i < 16; ++i) {
+                    float a = weights[(indices >> (i * 2)) & 3];
+                    float b = 1.0f - a;
+                    aa += a * a;
+                    ab += a * b;
+                    bb += b * b;
+                    ax += a * texels[i];
+                    bx += b * texels[i];
+                }
+                float determinant = aa * bb - ab * ab;
+                if (std::abs(determinant) > 1e-6f) {
+                    uint16_t r0 = packRgb565((ax * bb - bx * ab) / determinant);
+                    uint16_t r1 = packRgb565((bx * aa - ax * ab) / determinant);
+                    orderEndpoints(r0, r1);
+                    uint32_t refinedIndices = 0;
+                    float refinedError = fitColorIndices(texels, r0, r1, refinedIndices);
+                    if (refinedError < error) {
+                        c0 = r0;
+                        c1 = r1;
+                        indices = refinedIndices;
+                    }
+                }
+            }
+
+            memcpy(out, &c0, 2);
+            memcpy(out + 2, &c1, 2);
+            memcpy(out + 4, &indices, 4);
+        }
+
+        // BC4 in its eight value mode, also the alpha half of BC3 and both
+        // halves of BC5.
+        void encodeChannelBlock(const uint8_t* values, uint8_t* out)
+        {
+            uint8_t a0 = *std::max_element(values, values + 16);
+            uint8_t a1 = *std::min_element(values, values + 16);
+            out[0] = a0;
+            out[1] = a1;
+
+            uint64_t indices = 0;
+            if (a0 != a1) {
+                float palette[8] = { float(a0), float(a1) };
+                for (uint32_t i = 2; i < 8; ++i) {
+                    palette[i] = (float(8 - i) * float(a0) + float(i - 1) * float(a1)) / 7.0f;
+                }
+                for (uint32_t i = 0; i < 16; ++i) {
+                    uint64_t best = 0;
+                    float bestDistance = FLT_MAX;
+                    for (uint32_t p = 0; p < 8; ++p) {
+                        float distance = std::abs(float(values[i]) - palette[p]);
+                        if (distance < bestDistance) {
+                            bestDistance = distance;
+                            best = p;
+                        }
+                    }
+                    indices |= best << (i * 3);
+                }
+            }
+            for (uint32_t i = 0; i < 6; ++i) {
+                out[2 + i] = uint8_t(indices >> (i * 8));
+            }
+        }
+
+        BlockLayout getBlockLayout(vk::Format format)
+        {
+            switch (format) {
+            case vk::Format::eBc1RgbUnormBlock:
+            case vk::Format::eBc1RgbSrgbBlock:
+                return BlockLayout::eBc1;
+            case vk::Format::eBc3UnormBlock:
+            case vk::Format::eBc3SrgbBlock:
+                return BlockLayout::eBc3;
+            case vk::Format::eBc4UnormBlock:
+                return BlockLayout::eBc4;
+            case vk::Format::eBc5UnormBlock:
+                return BlockLayout::eBc5;
+            default:
+                throw std::runtime_error("Unsupported block compression format");
+            }
+        }
+
+        void encodeBlock(BlockLayout layout, const DecodedImage& image, uint32_t blockX, uint32_t blockY, uint8_t* out)
+        {
+            // Edge blocks repeat the last row and column.
+            uint8_t texels[16][4];
+            for (uint32_t y = 0; y < 4; ++y) {
+                uint32_t sourceY = std::min(blockY * 4 + y, image.height - 1);
+                for (uint32_t x = 0; x < 4; ++x) {
+                    uint32_t sourceX = std::min(blockX * 4 + x, image.width - 1);
+                    memcpy(texels[y * 4 + x], &image.rgba[(size_t(sourceY) * image.width + sourceX) * 4], 4);
+                }
+            }
+
+            auto encodeChannel = [&texels](uint32_t channel, uint8_t* channelOut) {
+                uint8_t values[16];
+                for (uint32_t i = 0; i < 16; ++i) {
+                    values[i] = texels[i][channel];
+                }
+                encodeChannelBlock(values, channelOut);
+            };
+            auto encodeColor = [&texels](uint8_t* colorOut) {
+                glm::vec3 colors[16];
+                for (uint32_t i = 0; i < 16; ++i) {
+                    colors[i] = glm::vec3(float(texels[i][0]), float(texels[i][1]), float(texels[i][2]));
+                }
+                encodeColorBlock(colors, colorOut);
+            };
+
+            switch (layout) {
+            case BlockLayout::eBc1:
+                encodeColor(out);
+                break;
+            case BlockLayout::eBc3:
+                encodeChannel(3, out);
+                encodeColor(out + 8);
+                break;
+            case BlockLayout::eBc4:
+                encodeChannel(0, out);
+                break;
+            case BlockLayout::eBc5:
+                encodeChannel(0, out);
+                encodeChannel(1, out + 8);
+                break;
+            }
+        }
+    }
+
+    DecodedImage downsampleImage(const DecodedImage& image, bool srgb)
+    {
+        const float* toLinear = getSrgbToLinearTable();
+
+        DecodedImage result;
+        result.width = std::max(image.width / 2, 1u);
+        result.height = std::max(image.height / 2, 1u);
+        result.rgba.resize(size_t(result.width) * result.height * 4);
+        for (uint32_t y = 0; y < result.height; ++y) {
+            uint32_t y0 = std::min(y * 2, image.height - 1);
+            uint32_t y1 = std::min(y * 2 + 1, image.height - 1);
+            for (uint32_t x = 0; x < result.width; ++x) {
+                uint32_t x0 = std::min(x * 2, image.width - 1);
+                uint32_t x1 = std::min(x * 2 + 1, image.width - 1);
+                const uint8_t* texels[4] = {
+                    &image.rgba[(size_t(y0) * image.width + x0) * 4],
+                    &image.rgba[(size_t(y0) * image.width + x1) * 4],
+                    &image.rgba[(size_t(y1) * image.width + x0) * 4],
+                    &image.rgba[(size_t(y1) * image.width + x1) * 4],
+                };
+                uint8_t* out = &result.rgba[(size_t(y) * result.width + x) * 4];
+                for (uint32_t channel = 0; channel < 4; ++channel) {
+                    if (srgb && channel < 3) {
+                        float sum = 0.0f;
+                        for (const uint8_t* texel : texels) {
+                            sum += toLinear[texel[channel]];
+                        }
+                        out[channel] = linearToSrgb(sum * 0.25f);
+                    }
+                    else {
+                        uint32_t sum = 0;
+                        for (const uint8_t* texel : texels) {
+                            sum += texel[channel];
+                        }
+                        out[channel] = uint8_t((sum + 2) / 4);
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    std::vector<uint8_t> compressBlocks(vk::Format format, const DecodedImage& image, JobSystem* jobs)
+    {
+        const BlockLayout layout = getBlockLayout(format);
+        const uint32_t blockBytes = layout == BlockLayout::eBc1 || layout == BlockLayout::eBc4 ? 8 : 16;
+        const uint32_t blocksX = (image.width + 3) / 4;
+        const uint32_t blocksY = (image.height + 3) / 4;
+
+        std::vector<uint8_t> blocks(size_t(blocksX) * blocksY * blockBytes);
+        auto encodeRows = [&](uint32_t begin, uint32_t end) {
+            for (uint32_t blockY = begin; blockY < end; ++blockY) {
+                for (uint32_t blockX = 0; blockX < blocksX; ++blockX) {
+                    encodeBlock(layout, image, blockX, blockY, &blocks[(size_t(blockY) * blocksX + blockX) * blockBytes]);
+                }
+            }
+        };
+
+        // Small mips aren't worth a job.
+        if (jobs == nullptr || blocksY < 16) {
+            encodeRows(0, blocksY);
+        }
+        else {
+            JobCounter counter;
+            jobs->parallelFor(blocksY, 8, encodeRows, counter);
+            jobs->wait(counter);
+        }
+        return blocks;
+    }
+}
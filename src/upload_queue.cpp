@@ -0,0 +1,475 @@
+#include "upload_queue.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace bvr
+{
+    namespace
+    {
+        // Satisfies vkCmdCopyBufferToImage's texel (or block) and 4 byte alignment
+        // for every format uploadImage() accepts.
+        constexpr vk::DeviceSize kStagingAlignment = 16;
+
+        vk::DeviceSize alignStaging(vk::DeviceSize size)
+        {
+            return (size + kStagingAlignment - 1) & ~(kStagingAlignment - 1);
+        }
+    }
+
+    TexelBlock getTexelBlock(vk::Format format)
+    {
+        switch (format) {
+        case vk::Format::eR8G8B8A8Unorm:
+        case vk::Format::eR8G8B8A8Srgb:
+        case vk::Format::eB8G8R8A8Unorm:
+        case vk::Format::eB8G8R8A8Srgb:
+        case vk::Format::eR16G16Sfloat:
+        case vk::Format::eR32Sfloat:
+            return TexelBlock{ 1, 1, 4 };
+        case vk::Format::eR16G16B16A16Sfloat:
+        case vk::Format::eR32G32Sfloat:
+            return TexelBlock{ 1, 1, 8 };
+        case vk::Format::eR32G32B32A32Sfloat:
+            return TexelBlock{ 1, 1, 16 };
+        case vk::Format::eBc1RgbUnormBlock:
+        case vk::Format::eBc1RgbSrgbBlock:
+        case vk::Format::eBc1RgbaUnormBlock:
+        case vk::Format::eBc1RgbaSrgbBlock:
+        case vk::Format::eBc4UnormBlock:
+            return TexelBlock{ 4, 4, 8 };
+        case vk::Format::eBc3UnormBlock:
+        case vk::Format::eBc3SrgbBlock:
+        case vk::Format::eBc5UnormBlock:
+        case vk::Format::eBc7UnormBlock:
+        case vk::Format::eBc7SrgbBlock:
+            return TexelBlock{ 4, 4, 16 };
+        default:
+            return TexelBlock{ 1, 1, 0 };
+        }
+    }
+
+    vk::DeviceSize getImageLevelSize(vk::Format format, vk::Extent2D extent, uint32_t level)
+    {
+        TexelBlock block = getTexelBlock(format);
+        vk::DeviceSize columns = (std::max(extent.width >> level, 1u) + block.width - 1) / block.width;
+        vk::DeviceSize rows = (std::max(extent.height >> level, 1u) + block.height - 1) / block.height;
+        return columns * rows * block.bytes;
+    }
+
+    UploadQueue::UploadQueue(
+        vk::Device device,
+        GpuMemory& memory,
+        vk::Queue transferQueue,
+        uint32_t transferFamily,
+        uint32_t graphicsFamily,
+        vk::Extent3D imageGranularity,
+        vk::DeviceSize stagingSize,
+        std::mutex* queueMutex
+    ) :
+        m_device(device),
+        m_memory(memory),
+        m_queue(transferQueue),
+        m_transferFamily(transferFamily),
+        m_graphicsFamily(graphicsFamily),
+        m_imageGranularity(imageGranularity),
+        m_queueMutex(queueMutex)
+    {
+        m_commandPool = m_device.createCommandPool(vk::CommandPoolCreateInfo{
+            vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+            m_transferFamily,
+        });
+
+        vk::SemaphoreTypeCreateInfo timelineInfo{ vk::SemaphoreType::eTimeline, 0 };
+        vk::SemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.pNext = &timelineInfo;
+        m_timeline = m_device.createSemaphore(semaphoreInfo);
+
+        m_staging = m_memory.createBuffer(
+            vk::BufferCreateInfo{ vk::BufferCreateFlags{}, alignStaging(stagingSize), vk::BufferUsageFlagBits::eTransferSrc },
+            MemoryUsage::eUpload
+        );
+    }
+
+    UploadQueue::~UploadQueue()
+    {
+        flush();
+        wait(m_lastSubmittedValue);
+
+        m_device.destroyCommandPool(m_commandPool);
+        m_device.destroySemaphore(m_timeline);
+        m_memory.destroyBuffer(m_staging);
+    }
+
+    void UploadQueue::uploadBuffer(vk::Buffer dst, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize size)
+    {
+        std::unique_lock<std::mutex> lock{ m_mutex };
+
+        const uint8_t* src = static_cast<const uint8_t*>(data);
+        for (vk::DeviceSize copied = 0; copied < size;) {
+            vk::DeviceSize chunk = std::min(size - copied, getMaxChunkSize());
+            vk::DeviceSize stagingOffset = allocateStaging(chunk, lock);
+            memcpy(static_cast<uint8_t*>(m_staging.mapped) + stagingOffset, src + copied, size_t(chunk));
+
+            Batch& batch = getRecordingBatch();
+            batch.commandBuffer.copyBuffer(m_staging.buffer, dst, vk::BufferCopy{ stagingOffset, dstOffset + copied, chunk });
+            batch.stagingBytes += chunk;
+            copied += chunk;
+
+            if (copied == size && m_transferFamily != m_graphicsFamily) {
+                vk::BufferMemoryBarrier release{
+                    vk::AccessFlagBits::eTransferWrite,
+                    vk::AccessFlags{},
+                    m_transferFamily,
+                    m_graphicsFamily,
+                    dst,
+                    dstOffset,
+                    size,
+                };
+                batch.commandBuffer.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eTransfer,
+                    vk::PipelineStageFlagBits::eBottomOfPipe,
+                    vk::DependencyFlags{},
+                    nullptr, release, nullptr
+                );
+
+                vk::BufferMemoryBarrier acquire = release;
+                acquire.srcAccessMask = vk::AccessFlags{};
+                acquire.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+                batch.bufferAcquires.push_back(acquire);
+            }
+            submitIfLarge();
+        }
+        m_stats.bytesUploaded += size;
+    }
+
+    void UploadQueue::uploadImage(vk::Image dst, vk::Extent2D extent, const void* texels)
+    {
+        uploadImage(dst, vk::Format::eR8G8B8A8Unorm, extent, 1, texels);
+    }
+
+    void UploadQueue::uploadImage(vk::Image dst, vk::Format format, vk::Extent2D extent, uint32_t levelCount, const void* data)
+    {
+        const TexelBlock block = getTexelBlock(format);
+        if (block.bytes == 0) {
+            throw std::runtime_error("Unsupported image upload format");
+        }
+
+        std::unique_lock<std::mutex> lock{ m_mutex };
+
+        const vk::ImageSubresourceRange range{ vk::ImageAspectFlagBits::eColor, 0, levelCount, 0, 1 };
+        const uint8_t* src = static_cast<const uint8_t*>(data);
+        vk::DeviceSize uploaded = 0;
+        for (uint32_t level = 0; level < levelCount; ++level) {
+            const uint32_t width = std::max(extent.width >> level, 1u);
+            const uint32_t height = std::max(extent.height >> level, 1u);
+            const uint32_t blockRows = (height + block.height - 1) / block.height;
+            const vk::DeviceSize rowBytes = vk::DeviceSize((width + block.width - 1) / block.width) * block.bytes;
+
+            // Split by block rows, respecting the queue's copy granularity, which
+            // is in blocks for compressed formats. A zero granularity only allows
+            // whole level copies.
+            uint32_t rowsPerChunk = blockRows;
+            if (m_imageGranularity.height != 0) {
+                rowsPerChunk = uint32_t(std::max<vk::DeviceSize>(getMaxChunkSize() / rowBytes, 1));
+                if (m_imageGranularity.height > 1) {
+                    rowsPerChunk = std::max(rowsPerChunk / m_imageGranularity.height, 1u) * m_imageGranularity.height;
+                }
+                rowsPerChunk = std::min(rowsPerChunk, blockRows);
+            }
+            if (rowsPerChunk * rowBytes > m_staging.size) {
+                throw std::runtime_error("Image upload does not fit into the staging ring");
+            }
+
+            for (uint32_t row = 0; row < blockRows; row += rowsPerChunk) {
+                uint32_t rows = std::min(rowsPerChunk, blockRows - row);
+                vk::DeviceSize chunk = rows * rowBytes;
+                vk::DeviceSize stagingOffset = allocateStaging(chunk, lock);
+                memcpy(static_cast<uint8_t*>(m_staging.mapped) + stagingOffset, src + uploaded + row * rowBytes, size_t(chunk));
+
+                Batch& batch = getRecordingBatch();
+                if (level == 0 && row == 0) {
+                    vk::ImageMemoryBarrier toTransfer{
+                        vk::AccessFlags{},
+                        vk::AccessFlagBits::eTransferWrite,
+                        vk::ImageLayout::eUndefined,
+                        vk::ImageLayout::eTransferDstOptimal,
+                        VK_QUEUE_FAMILY_IGNORED,
+                        VK_QUEUE_FAMILY_IGNORED,
+                        dst,
+                        range,
+                    };
+                    batch.commandBuffer.pipelineBarrier(
+                        vk::PipelineStageFlagBits::eTopOfPipe,
+                        vk::PipelineStageFlagBits::eTransfer,
+                        vk::DependencyFlags{},
+                        nullptr, nullptr, toTransfer
+                    );
+                }
+
+                // The last chunk may end in partial blocks at the image's edge.
+                uint32_t firstTexelRow = row * block.height;
+                vk::BufferImageCopy region{
+                    stagingOffset,
+                    0, 0, // Tightly packed
+                    vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, level, 0, 1 },
+                    vk::Offset3D{ 0, int32_t(firstTexelRow), 0 },
+                    vk::Extent3D{ width, std::min(rows * block.height, height - firstTexelRow), 1 },
+                };
+                batch.commandBuffer.copyBufferToImage(m_staging.buffer, dst, vk::ImageLayout::eTransferDstOptimal, region);
+                batch.stagingBytes += chunk;
+
+                if (level + 1 == levelCount && row + rows == blockRows) {
+                    // The layout transition to shader reads happens as part of the
+                    // ownership transfer, on both queues.
+                    bool transferOwnership = m_transferFamily != m_graphicsFamily;
+                    vk::ImageMemoryBarrier release{
+                        vk::AccessFlagBits::eTransferWrite,
+                        vk::AccessFlags{},
+                        vk::ImageLayout::eTransferDstOptimal,
+                        vk::ImageLayout::eShaderReadOnlyOptimal,
+                        transferOwnership ? m_transferFamily : VK_QUEUE_FAMILY_IGNORED,
+                        transferOwnership ? m_graphicsFamily : VK_QUEUE_FAMILY_IGNORED,
+                        dst,
+                        range,
+                    };
+                    batch.commandBuffer.pipelineBarrier(
+                        vk::PipelineStageFlagBits::eTransfer,
+                        vk::PipelineStageFlagBits::eBottomOfPipe,
+                        vk::DependencyFlags{},
+                        nullptr, nullptr, release
+                    );
+
+                    if (transferOwnership) {
+                        vk::ImageMemoryBarrier acquire = release;
+                        acquire.srcAccessMask = vk::AccessFlags{};
+                        acquire.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+                        batch.imageAcquires.push_back(acquire);
+                    }
+                }
+                submitIfLarge();
+            }
+            uploaded += vk::DeviceSize(blockRows) * rowBytes;
+        }
+        m_stats.bytesUploaded += uploaded;
+    }
+
+    uint64_t UploadQueue::flush()
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        if (m_recording) {
+            return submitRecording();
+        }
+        return m_lastSubmittedValue;
+    }
+
+    uint64_t UploadQueue::getCompletedValue() const
+    {
+        return m_device.getSemaphoreCounterValue(m_timeline);
+    }
+
+    void UploadQueue::wait(uint64_t value)
+    {
+        if (value == 0) {
+            return;
+        }
+
+        vk::SemaphoreWaitInfo waitInfo{};
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &m_timeline;
+        waitInfo.pValues = &value;
+        if (m_device.waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess) {
+            throw std::runtime_error("Failed to wait for the upload timeline");
+        }
+    }
+
+    void UploadQueue::whenAcquired(uint64_t value, std::function<void()> callback)
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        m_callbacks.push_back(AcquireCallback{ value, std::move(callback) });
+    }
+
+    uint64_t UploadQueue::recordAcquires(vk::CommandBuffer commandBuffer)
+    {
+        std::vector<AcquireCallback> ready;
+        uint64_t waitValue = 0;
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            reclaimCompleted();
+
+            if (!m_readyBufferAcquires.empty() || !m_readyImageAcquires.empty()) {
+                commandBuffer.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eTopOfPipe,
+                    vk::PipelineStageFlagBits::eAllCommands,
+                    vk::DependencyFlags{},
+                    nullptr, m_readyBufferAcquires, m_readyImageAcquires
+                );
+                m_readyBufferAcquires.clear();
+                m_readyImageAcquires.clear();
+            }
+
+            // The batches have completed already, so this wait never stalls the
+            // graphics queue. It only makes their writes visible.
+            if (m_completedValue > m_lastAcquiredValue) {
+                waitValue = m_completedValue;
+                m_lastAcquiredValue = m_completedValue;
+            }
+
+            auto firstPending = std::stable_partition(m_callbacks.begin(), m_callbacks.end(), [this](const AcquireCallback& entry) {
+                return entry.timelineValue <= m_lastAcquiredValue;
+            });
+            std::move(m_callbacks.begin(), firstPending, std::back_inserter(ready));
+            m_callbacks.erase(m_callbacks.begin(), firstPending);
+        }
+
+        for (AcquireCallback& entry : ready) {
+            entry.callback();
+        }
+        return waitValue;
+    }
+
+    UploadStats UploadQueue::getStats() const
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        return m_stats;
+    }
+
+    vk::DeviceSize UploadQueue::allocateStaging(vk::DeviceSize size, std::unique_lock<std::mutex>& lock)
+    {
+        size = alignStaging(size);
+
+        vk::DeviceSize offset = 0;
+        reclaimCompleted();
+        while (!tryAllocateStaging(size, offset)) {
+            // Hand the copies recorded so far to the GPU, then wait for the oldest
+            // batch to give its staging space back. Other threads, including the
+            // render thread acquiring batches, may use the queue meanwhile.
+            if (m_recording) {
+                submitRecording();
+            }
+            ++m_stats.stagingStalls;
+
+            uint64_t oldest = m_submitted.front().timelineValue;
+            lock.unlock();
+            wait(oldest);
+            lock.lock();
+            reclaimCompleted();
+        }
+        return offset;
+    }
+
+    bool UploadQueue::tryAllocateStaging(vk::DeviceSize size, vk::DeviceSize& offset)
+    {
+        const bool empty = !m_recording && m_submitted.empty();
+        if (empty) {
+            m_stagingHead = 0;
+            m_stagingTail = 0;
+        }
+
+        // Allocations never make the head catch up with the tail, so head == tail
+        // always means the ring is empty.
+        if (empty || m_stagingHead > m_stagingTail) {
+            if (m_stagingHead + size <= m_staging.size) {
+                offset = m_stagingHead;
+                m_stagingHead += size;
+                return true;
+            }
+            if (size < m_stagingTail) {
+                offset = 0;
+                m_stagingHead = size;
+                return true;
+            }
+            return false;
+        }
+
+        if (m_stagingHead + size < m_stagingTail) {
+            offset = m_stagingHead;
+            m_stagingHead += size;
+            return true;
+        }
+        return false;
+    }
+
+    UploadQueue::Batch& UploadQueue::getRecordingBatch()
+    {
+        if (m_recording) {
+            return m_recordingBatch;
+        }
+
+        vk::CommandBuffer commandBuffer;
+        if (!m_freeCommandBuffers.empty()) {
+            commandBuffer = m_freeCommandBuffers.back();
+            m_freeCommandBuffers.pop_back();
+            commandBuffer.reset(vk::CommandBufferResetFlags{});
+        }
+        else {
+            vk::CommandBufferAllocateInfo allocInfo{ m_commandPool, vk::CommandBufferLevel::ePrimary, 1 };
+            commandBuffer = m_device.allocateCommandBuffers(allocInfo)[0];
+        }
+        commandBuffer.begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+        m_recordingBatch = Batch{};
+        m_recordingBatch.commandBuffer = commandBuffer;
+        m_recording = true;
+        return m_recordingBatch;
+    }
+
+    uint64_t UploadQueue::submitRecording()
+    {
+        Batch& batch = m_recordingBatch;
+        batch.commandBuffer.end();
+        batch.timelineValue = ++m_lastSubmittedValue;
+        batch.stagingEnd = m_stagingHead;
+
+        vk::TimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &batch.timelineValue;
+
+        vk::SubmitInfo submitInfo{};
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &m_timeline;
+
+        if (m_queueMutex != nullptr) {
+            std::lock_guard<std::mutex> queueLock{ *m_queueMutex };
+            m_queue.submit(submitInfo, vk::Fence{});
+        }
+        else {
+            m_queue.submit(submitInfo, vk::Fence{});
+        }
+
+        m_submitted.push_back(std::move(batch));
+        m_recording = false;
+        ++m_stats.batchesSubmitted;
+        return m_lastSubmittedValue;
+    }
+
+    void UploadQueue::submitIfLarge()
+    {
+        // Keeps the transfer queue busy while the rest of the ring fills up.
+        if (m_recording && m_recordingBatch.stagingBytes >= getMaxChunkSize()) {
+            submitRecording();
+        }
+    }
+
+    void UploadQueue::reclaimCompleted()
+    {
+        if (m_submitted.empty()) {
+            return;
+        }
+
+        m_completedValue = m_device.getSemaphoreCounterValue(m_timeline);
+        while (!m_submitted.empty() && m_submitted.front().timelineValue <= m_completedValue) {
+            Batch& batch = m_submitted.front();
+            m_stagingTail = batch.stagingEnd;
+            m_readyBufferAcquires.insert(m_readyBufferAcquires.end(), batch.bufferAcquires.begin(), batch.bufferAcquires.end());
+            m_readyImageAcquires.insert(m_readyImageAcquires.end(), batch.imageAcquires.begin(), batch.imageAcquires.end());
+            m_freeCommandBuffers.push_back(batch.commandBuffer);
+            m_submitted.pop_front();
+        }
+    }
+}
@@ -0,0 +1,2 @@
+#pragma once
+#define BVR_PROFILE_THREAD(x) (void)(x)